@@ -0,0 +1,207 @@
+/**
+ * @file midi_capture.h
+ * @brief Compact Binary Log of Received MIDI Traffic
+ *
+ * Transport RX paths hand their raw input (MIDI 1.0 bytes, USB-MIDI
+ * event packets, UMP words) to midi_capture_rx(). While a capture is
+ * active it is appended to a RAM ring, oldest records overwritten
+ * first; with none active the call is a single test. The ring is later
+ * saved as a log that replays the same input, parser state and timing
+ * included, through the router.
+ *
+ * Log layout (little-endian):
+ *   header   "MCAP", u8 version, 3 reserved bytes, u64 time of origin (us)
+ *   record   u8 tag (transport << 4 | kind), [u8 source], varint length,
+ *            varint microseconds since the previous record, payload
+ *
+ * Bit 3 of the kind nibble marks an output record: what the router sent
+ * to the transport, followed by the source it was routed from.
+ *
+ * Varints are LEB128. A record is never split across the ring's end,
+ * so readers get each payload as one contiguous span.
+ */
+
+#ifndef MIDI_CAPTURE_H
+#define MIDI_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#define MIDI_CAPTURE_MAGIC          "MCAP"
+#define MIDI_CAPTURE_VERSION        1
+#define MIDI_CAPTURE_HEADER_SIZE    16
+#define MIDI_CAPTURE_NO_SOURCE      0xFF    /**< Record of received input */
+
+/**
+ * @brief What a record's payload holds
+ */
+typedef enum {
+    MIDI_CAPTURE_BYTES,           /**< MIDI 1.0 byte stream (UART) */
+    MIDI_CAPTURE_USB_MIDI1,       /**< USB-MIDI 1.0 event packets, 4 bytes each */
+    MIDI_CAPTURE_UMP,             /**< UMP words, native (little-endian) order */
+    MIDI_CAPTURE_KIND_COUNT
+} midi_capture_kind_t;
+
+/**
+ * @brief One log record
+ */
+typedef struct {
+    uint64_t time_us;             /**< When it was received */
+    uint8_t transport;            /**< Router transport ID it arrived on */
+    uint8_t kind;                 /**< midi_capture_kind_t */
+    uint8_t source;               /**< Output records: source routed from, else MIDI_CAPTURE_NO_SOURCE */
+    uint16_t length;              /**< Payload bytes */
+    const uint8_t *data;          /**< Payload (points into the ring or log) */
+} midi_capture_record_t;
+
+/**
+ * @brief Capture ring
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t head;                  /**< Oldest record */
+    size_t tail;                  /**< Next write */
+    size_t used;                  /**< Bytes in use, padding included */
+    uint64_t base_us;             /**< Time the head record's delta counts from */
+    uint64_t last_us;             /**< Time of the newest record */
+    uint32_t records;             /**< Records held */
+    uint32_t overwritten;         /**< Records lost to wrap-around */
+    uint32_t rejected;            /**< Payloads larger than the ring */
+    portMUX_TYPE lock;
+} midi_capture_t;
+
+/**
+ * @brief Sequential reader over a ring or a saved log
+ */
+typedef struct {
+    const uint8_t *buf;
+    size_t size;
+    size_t pos;
+    size_t remaining;
+    uint64_t time_us;
+} midi_capture_reader_t;
+
+/**
+ * @brief Record selector for midi_capture_diff()
+ */
+typedef bool (*midi_capture_filter_t)(const midi_capture_record_t *record, void *ctx);
+
+/**
+ * @brief Sink for midi_capture_save()
+ *
+ * @return ESP_OK, or an error that aborts the save
+ */
+typedef esp_err_t (*midi_capture_write_fn_t)(void *ctx, const void *data, size_t len);
+
+/**
+ * @brief Prepare a ring in caller-provided memory
+ */
+esp_err_t midi_capture_init(midi_capture_t *cap, uint8_t *buf, size_t size);
+
+/**
+ * @brief Drop all records
+ */
+void midi_capture_clear(midi_capture_t *cap);
+
+/**
+ * @brief Append a record with an explicit time (any task)
+ *
+ * Times must not go backwards. Evicts the oldest records as needed.
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_SIZE if the payload cannot fit at all
+ */
+esp_err_t midi_capture_write_at(midi_capture_t *cap, uint64_t time_us, uint8_t transport,
+                                midi_capture_kind_t kind, const void *data, size_t len);
+
+/**
+ * @brief Append a record stamped now (any task)
+ */
+esp_err_t midi_capture_write(midi_capture_t *cap, uint8_t transport,
+                             midi_capture_kind_t kind, const void *data, size_t len);
+
+/**
+ * @brief Append an output record stamped now (any task)
+ *
+ * @param transport Output the router sent to
+ * @param source Transport the packet was routed from
+ */
+esp_err_t midi_capture_write_output(midi_capture_t *cap, uint8_t transport, uint8_t source,
+                                    midi_capture_kind_t kind, const void *data, size_t len);
+
+/**
+ * @brief Route transport RX input into a ring (NULL stops capturing)
+ */
+void midi_capture_set_active(midi_capture_t *cap);
+
+/**
+ * @brief Record raw input from a transport RX path, if capturing
+ */
+void midi_capture_rx(uint8_t transport, midi_capture_kind_t kind, const void *data, size_t len);
+
+/**
+ * @brief Remove the oldest record, copying its payload out (any task)
+ *
+ * Lets a consumer drain an active ring while transports keep writing
+ * to it, e.g. to stream a recording to flash. A record whose payload
+ * does not fit in buf is dropped.
+ *
+ * @param cap Ring to take from
+ * @param record Output: the record, data pointing into buf
+ * @param buf Payload destination
+ * @param size Bytes available in buf
+ * @return ESP_OK, ESP_ERR_NOT_FOUND if empty, or ESP_ERR_INVALID_SIZE if dropped
+ */
+esp_err_t midi_capture_take(midi_capture_t *cap, midi_capture_record_t *record,
+                            uint8_t *buf, size_t size);
+
+/**
+ * @brief Write the ring out as a log
+ *
+ * Stop writers first (midi_capture_set_active(NULL)); the ring is read
+ * without the lock so the sink may block.
+ */
+esp_err_t midi_capture_save(const midi_capture_t *cap, midi_capture_write_fn_t write, void *ctx);
+
+/**
+ * @brief Read a ring in place, oldest record first
+ */
+void midi_capture_reader_ring(midi_capture_reader_t *reader, const midi_capture_t *cap);
+
+/**
+ * @brief Read a saved log
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_VERSION / ESP_ERR_INVALID_SIZE for a bad header
+ */
+esp_err_t midi_capture_reader_log(midi_capture_reader_t *reader, const uint8_t *log, size_t len);
+
+/**
+ * @brief Next record
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND at the end, or ESP_ERR_INVALID_SIZE if truncated
+ */
+esp_err_t midi_capture_next(midi_capture_reader_t *reader, midi_capture_record_t *record);
+
+/**
+ * @brief Compare two captures, ignoring timing
+ *
+ * Records match when transport, source, kind and payload are equal.
+ * A filter restricts the comparison to one stream whose order is
+ * defined, e.g. one output and source, so how separately scheduled
+ * streams were interleaved does not count as a difference.
+ *
+ * @param a First capture
+ * @param b Second capture
+ * @param filter Records to compare (NULL = all)
+ * @param ctx Filter context
+ * @param first_diff Output: index of the first mismatch, or -1 (may be NULL)
+ * @return Number of mismatching positions, a length difference counting
+ *         one per record the longer capture has in excess
+ */
+uint32_t midi_capture_diff(midi_capture_reader_t *a, midi_capture_reader_t *b,
+                           midi_capture_filter_t filter, void *ctx, int32_t *first_diff);
+
+#endif // MIDI_CAPTURE_H
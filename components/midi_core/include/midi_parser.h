@@ -33,6 +33,10 @@ typedef struct {
     uint16_t sysex_index;          /**< Current SysEx buffer position */
     uint16_t sysex_buffer_size;    /**< Size of SysEx buffer */
     
+    /* Active Sensing */
+    bool active_sensing;           /**< 0xFE seen: link is being monitored */
+    uint32_t last_rx_us;           /**< Time of the last byte while monitored */
+    
     /* Statistics */
     uint32_t messages_parsed;      /**< Total messages parsed */
     uint32_t parse_errors;         /**< Parse error count */
@@ -80,7 +84,11 @@ esp_err_t midi_parser_parse_byte(midi_parser_state_t *state,
 /**
  * @brief Check for Active Sensing timeout
  * 
- * Should be called periodically if Active Sensing is enabled
+ * Monitoring starts with the first Active Sensing byte; from then on
+ * any byte restarts the timer. More than MIDI_ACTIVE_SENSING_TIMEOUT_MS
+ * of silence means the link was lost: monitoring stops until the next
+ * 0xFE and the caller should silence what the source left sounding.
+ * Call at least every few tens of milliseconds while bytes are awaited.
  * 
  * @param state Pointer to parser state
  * @param current_time_us Current timestamp in microseconds
@@ -0,0 +1,116 @@
+/**
+ * @file midi_stats.h
+ * @brief Sharded Statistics Counters
+ *
+ * Each task that updates statistics owns a shard and increments it with
+ * plain stores: no locks or atomics on the hot path. Readers fold the
+ * shards on demand. 32-bit aligned loads are atomic on the ESP32, so a
+ * fold may be a few counts stale but never torn.
+ *
+ * Resetting from another task would race with the writers, so a reset
+ * only advances an epoch. A shard from an older epoch is skipped by
+ * readers and zeroed by its owner before its next update.
+ */
+
+#ifndef MIDI_STATS_H
+#define MIDI_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * @brief Reset epoch shared by a set of shards
+ */
+typedef struct {
+    uint32_t generation;
+} midi_stats_epoch_t;
+
+/**
+ * @brief Start a reset period (any task)
+ */
+static inline void midi_stats_epoch_advance(midi_stats_epoch_t *epoch) {
+    __atomic_add_fetch(&epoch->generation, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Current reset period
+ */
+static inline uint32_t midi_stats_epoch_current(const midi_stats_epoch_t *epoch) {
+    return __atomic_load_n(&epoch->generation, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Bring a shard into the current epoch (owner only, before updating)
+ *
+ * Costs one load and compare when no reset is pending.
+ *
+ * @param epoch Shared epoch
+ * @param shard_generation The shard's epoch tag
+ * @param counters Shard counters
+ * @param size Size of counters in bytes
+ */
+static inline void midi_stats_shard_sync(const midi_stats_epoch_t *epoch,
+                                         uint32_t *shard_generation,
+                                         void *counters, size_t size) {
+    uint32_t generation = midi_stats_epoch_current(epoch);
+    if (*shard_generation != generation) {
+        memset(counters, 0, size);
+        __atomic_store_n(shard_generation, generation, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Check whether a shard belongs in a fold (readers)
+ */
+static inline bool midi_stats_shard_current(const midi_stats_epoch_t *epoch,
+                                            const uint32_t *shard_generation) {
+    return __atomic_load_n(shard_generation, __ATOMIC_ACQUIRE) ==
+           midi_stats_epoch_current(epoch);
+}
+
+/**
+ * @brief Add a block of uint32_t counters
+ *
+ * @param dst Accumulator
+ * @param src Shard counters
+ * @param size Size in bytes (multiple of 4)
+ */
+static inline void midi_stats_add_u32(void *dst, const void *src, size_t size) {
+    uint32_t *d = dst;
+    const volatile uint32_t *s = src;
+    for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+        d[i] += s[i];
+    }
+}
+
+/**
+ * @brief Difference of two readings of a block of uint32_t counters
+ *
+ * Unsigned subtraction, so a counter that wrapped between the
+ * readings still gives the right difference.
+ *
+ * @param delta Output: newer - older
+ * @param newer Later reading
+ * @param older Earlier reading
+ * @param size Size in bytes (multiple of 4)
+ */
+static inline void midi_stats_delta_u32(void *delta, const void *newer, const void *older,
+                                        size_t size) {
+    uint32_t *d = delta;
+    const uint32_t *n = newer;
+    const uint32_t *o = older;
+    for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+        d[i] = n[i] - o[i];
+    }
+}
+
+/**
+ * @brief Events per second from a counter delta
+ */
+static inline uint32_t midi_stats_rate(uint32_t delta, int64_t elapsed_us) {
+    return elapsed_us > 0 ? (uint32_t)(((uint64_t)delta * 1000000u) / (uint64_t)elapsed_us) : 0;
+}
+
+#endif /* MIDI_STATS_H */
@@ -0,0 +1,117 @@
+/**
+ * @file midi_timebase.h
+ * @brief Disciplined Timebase Shared Across Devices
+ *
+ * Shared time is the device's local clock (esp_timer) run through an
+ * offset and a rate correction:
+ *
+ *   shared = shared_ref + (local - local_ref) * (1 + rate_ppb / 10^9)
+ *
+ * Until something disciplines it, rate and offset are zero and shared
+ * time is local time. A clock sync slave (midi_sync.h) feeds measured
+ * errors against its master to midi_timebase_correct(); a PI servo then
+ * slews the rate so the error drains smoothly, never making time run
+ * backwards, and only steps on the first correction or when the error
+ * exceeds MIDI_TIMEBASE_STEP_US. The integral part learns the crystal's
+ * frequency error, so the timebase keeps running true through a lost
+ * master (holdover).
+ *
+ * One writer updates a timebase; any task may read it. Readers retry
+ * across an update (sequence counter), so no lock is taken on either
+ * side.
+ *
+ * Scheduled playback start times are in shared time, so they mean the
+ * same instant on every synchronized device. Anything measured on one
+ * device, like router latency, stays on esp_timer.
+ */
+
+#ifndef MIDI_TIMEBASE_H
+#define MIDI_TIMEBASE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MIDI_TIMEBASE_STEP_US       20000   /**< Larger errors are stepped, not slewed */
+#define MIDI_TIMEBASE_MAX_PPM       500     /**< Largest rate correction (slew limit) */
+
+/**
+ * @brief Timebase state
+ */
+typedef struct {
+    uint32_t generation;          /**< Odd while an update is in progress */
+    int64_t local_ref_us;         /**< Local time of the last correction */
+    int64_t shared_ref_us;        /**< Shared time at local_ref_us */
+    int32_t rate_ppb;             /**< Shared time rate beyond 1 (freq_ppb plus phase slew) */
+    int32_t freq_ppb;             /**< Learned frequency correction (servo integral) */
+    bool locked;                  /**< Disciplined by at least one correction */
+    int64_t last_error_us;        /**< Error passed to the last correction */
+    uint32_t steps;               /**< Corrections applied as a step */
+    uint32_t slews;               /**< Corrections applied as a slew */
+} midi_timebase_t;
+
+//=============================================================================
+// Any Timebase
+//=============================================================================
+
+/**
+ * @brief Reset to local time (no offset, no rate correction)
+ */
+void midi_timebase_init(midi_timebase_t *tb);
+
+/**
+ * @brief Shared time at a local time
+ */
+int64_t midi_timebase_shared_us(const midi_timebase_t *tb, int64_t local_us);
+
+/**
+ * @brief Local time at which shared time reaches shared_us
+ *
+ * Exact for the current correction; a later correction moves the
+ * instant by at most the slew limit times the wait.
+ */
+int64_t midi_timebase_local_us(const midi_timebase_t *tb, int64_t shared_us);
+
+/**
+ * @brief Feed one measurement (writer only)
+ *
+ * @param local_us Local time the measurement refers to
+ * @param error_us Reference time minus our shared time at local_us
+ * @param interval_us Time since the previous measurement
+ */
+void midi_timebase_correct(midi_timebase_t *tb, int64_t local_us, int64_t error_us,
+                           uint32_t interval_us);
+
+/**
+ * @brief Stop slewing and run on the learned frequency (writer only)
+ *
+ * For a lost reference; the next correction slews again.
+ */
+void midi_timebase_holdover(midi_timebase_t *tb, int64_t local_us);
+
+//=============================================================================
+// Device Timebase
+//=============================================================================
+
+/**
+ * @brief The device's shared timebase
+ */
+midi_timebase_t *midi_timebase_get(void);
+
+/**
+ * @brief Current shared time of the device
+ */
+int64_t midi_timebase_now_us(void);
+
+/**
+ * @brief Device shared time at an esp_timer time
+ */
+int64_t midi_timebase_from_local_us(int64_t local_us);
+
+/**
+ * @brief esp_timer time at which device shared time reaches shared_us
+ *
+ * For timers and waits on the local clock.
+ */
+int64_t midi_timebase_to_local_us(int64_t shared_us);
+
+#endif /* MIDI_TIMEBASE_H */
@@ -9,6 +9,7 @@
 #ifndef MIDI_TRANSLATOR_H
 #define MIDI_TRANSLATOR_H
 
+#include <stddef.h>
 #include "midi_types.h"
 #include "ump_types.h"
 #include "esp_err.h"
@@ -43,7 +44,9 @@ esp_err_t midi_translator_init(const midi_translator_config_t *config);
  * @brief Translate MIDI 1.0 message to UMP (MIDI 2.0)
  * 
  * Performs upscaling of 7/14-bit values to 16/32-bit using Min-Center-Max algorithm
- * per spec Appendix D.1.3 and D.3
+ * per spec Appendix D.1.3 and D.3. Channel voice messages become MT 0x4
+ * (Note On velocity 0 becomes Note Off), system messages MT 0x1.
+ * Controllers go one to one: RPN/NRPN and bank sequences are not merged.
  * 
  * @param midi1_msg MIDI 1.0 message
  * @param ump_out Output UMP packet
@@ -56,7 +59,8 @@ esp_err_t midi_translate_1to2(const midi_message_t *midi1_msg,
  * @brief Translate UMP (MIDI 2.0) to MIDI 1.0 message
  * 
  * Performs downscaling of 16/32-bit values to 7/14-bit using bit shift
- * per spec Appendix D.1.4 and D.2
+ * per spec Appendix D.1.4 and D.2. Takes MT 0x4 and the MIDI 1.0
+ * Protocol forms (MT 0x1, MT 0x2), which carry the bytes unchanged.
  * 
  * @param ump_in Input UMP packet
  * @param midi1_msg Output MIDI 1.0 message
@@ -65,6 +69,37 @@ esp_err_t midi_translate_1to2(const midi_message_t *midi1_msg,
 esp_err_t midi_translate_2to1(const ump_packet_t *ump_in,
                                midi_message_t *midi1_msg);
 
+/**
+ * @brief Wrap a MIDI 1.0 message in UMP for the MIDI 1.0 Protocol
+ * 
+ * Channel voice messages become MT 0x2, system messages MT 0x1: one
+ * 32-bit word with the original bytes, no scaling. What a link that
+ * negotiated the MIDI 1.0 Protocol expects.
+ * 
+ * @param midi1_msg MIDI 1.0 message
+ * @param ump_out Output UMP packet (group 0)
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED for SysEx
+ */
+esp_err_t midi_translate_1to_ump1(const midi_message_t *midi1_msg,
+                                  ump_packet_t *ump_out);
+
+/**
+ * @brief Cut a MIDI 1.0 SysEx into SysEx7 packets (MT 0x3)
+ * 
+ * Call with offset 0, then with each returned offset until it reaches
+ * the SysEx length. Each call yields one packet of up to 6 data bytes,
+ * marked Complete, Start, Continue or End. The form is the same in
+ * both protocols.
+ * 
+ * @param midi1_msg SysEx message (data without F0/F7)
+ * @param group UMP group
+ * @param offset Data bytes already packed
+ * @param ump_out Output UMP packet
+ * @return Offset for the next call
+ */
+size_t midi_translate_sysex_to_ump(const midi_message_t *midi1_msg, uint8_t group,
+                                   size_t offset, ump_packet_t *ump_out);
+
 /**
  * @brief Upscale 7-bit MIDI 1.0 value to 16-bit MIDI 2.0 value
  * 
@@ -83,6 +118,17 @@ uint16_t midi_upscale_7to16(uint8_t value7);
  */
 uint32_t midi_upscale_14to32(uint16_t value14);
 
+/**
+ * @brief Upscale 7-bit MIDI 1.0 value to 32-bit MIDI 2.0 value
+ * 
+ * Shift with bit repeat above center (spec Appendix D.3): 0, 64 and 127
+ * map to 0, 0x80000000 and 0xFFFFFFFF.
+ * 
+ * @param value7 7-bit input value (0-127)
+ * @return 32-bit output value
+ */
+uint32_t midi_upscale_7to32(uint8_t value7);
+
 /**
  * @brief Downscale 16-bit MIDI 2.0 value to 7-bit MIDI 1.0 value
  * 
@@ -101,4 +147,12 @@ uint8_t midi_downscale_16to7(uint16_t value16);
  */
 uint16_t midi_downscale_32to14(uint32_t value32);
 
+/**
+ * @brief Downscale 32-bit MIDI 2.0 value to 7-bit MIDI 1.0 value
+ * 
+ * @param value32 32-bit input value
+ * @return 7-bit output value (0-127)
+ */
+uint8_t midi_downscale_32to7(uint32_t value32);
+
 #endif /* MIDI_TRANSLATOR_H */
@@ -147,6 +147,44 @@
 
 /** @} */
 
+/**
+ * @defgroup UMP_STREAM_FIELDS UMP Stream Message Fields
+ * @{
+ */
+
+/** Form (bits 27-26) and status (bits 25-16) of a UMP Stream message */
+#define UMP_STREAM_GET_FORM(word0)         (((word0) >> 26) & 0x03)
+#define UMP_STREAM_GET_STATUS(word0)       (((word0) >> 16) & 0x3FF)
+
+/** Stream Configuration protocol and JR bits */
+#define UMP_STREAM_PROTOCOL_MIDI1          0x01  /**< MIDI 1.0 Protocol */
+#define UMP_STREAM_PROTOCOL_MIDI2          0x02  /**< MIDI 2.0 Protocol */
+#define UMP_STREAM_JR_RX                   0x02  /**< Receive JR Timestamps */
+#define UMP_STREAM_JR_TX                   0x01  /**< Transmit JR Timestamps */
+
+/** Endpoint Discovery filter bits */
+#define UMP_DISCOVER_ENDPOINT_INFO         0x01
+#define UMP_DISCOVER_DEVICE_IDENTITY       0x02
+#define UMP_DISCOVER_ENDPOINT_NAME         0x04
+#define UMP_DISCOVER_PRODUCT_INSTANCE_ID   0x08
+#define UMP_DISCOVER_STREAM_CONFIG         0x10
+#define UMP_DISCOVER_ALL                   0x1F
+
+/** Function Block Discovery filter bits and block number */
+#define UMP_FB_DISCOVER_INFO               0x01
+#define UMP_FB_DISCOVER_NAME               0x02
+#define UMP_FB_ALL                         0xFF
+
+/** Function Block direction and MIDI 1.0 fields */
+#define UMP_FB_DIR_INPUT                   0x01  /**< Receives messages only */
+#define UMP_FB_DIR_OUTPUT                  0x02  /**< Sends messages only */
+#define UMP_FB_DIR_BIDIRECTIONAL           0x03
+#define UMP_FB_MIDI1_NONE                  0x00  /**< Not a MIDI 1.0 port */
+#define UMP_FB_MIDI1_YES                   0x01  /**< MIDI 1.0, no bandwidth limit */
+#define UMP_FB_MIDI1_31250                 0x02  /**< MIDI 1.0 at 31.25 kb/s (DIN) */
+
+/** @} */
+
 /**
  * @defgroup UMP_FORMAT UMP Format Field Values
  * @{
@@ -0,0 +1,126 @@
+/**
+ * @file ump_endpoint.h
+ * @brief UMP Endpoint Discovery and Protocol Negotiation (MT 0xF)
+ *
+ * Answers the UMP Stream messages a MIDI 2.0 peer sends to learn what
+ * is on the other end of a link: Endpoint Info, Device Identity, names,
+ * Function Blocks and the current Stream Configuration. It also runs
+ * the negotiation from both sides: a peer's Stream Configuration
+ * Request is accepted as far as this endpoint supports it, and a peer's
+ * Endpoint Info (the answer to ump_endpoint_discover()) is followed by
+ * a request for the protocol and JR timestamps both ends support.
+ *
+ * The outcome is kept per link in ump_endpoint_link_t, so a transport
+ * or router can pick the cheapest encoding for each peer and hold back
+ * JR timestamps the peer did not ask for (ump_endpoint_link_adapt()).
+ * Replies go out through a callback; nothing here blocks or allocates.
+ */
+
+#ifndef UMP_ENDPOINT_H
+#define UMP_ENDPOINT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "ump_types.h"
+#include "ump_defs.h"
+
+#define UMP_ENDPOINT_NAME_MAX       98    /**< Longest endpoint name sent */
+#define UMP_PRODUCT_INSTANCE_MAX    42    /**< Longest product instance ID sent */
+#define UMP_FB_NAME_MAX             91    /**< Longest function block name sent */
+
+/**
+ * @brief One Function Block (a range of groups with one purpose)
+ */
+typedef struct {
+    const char *name;             /**< Block name (NULL = none) */
+    uint8_t first_group;          /**< 0-15 */
+    uint8_t num_groups;           /**< Groups spanned (1-16) */
+    uint8_t direction;            /**< UMP_FB_DIR_* */
+    uint8_t midi1;                /**< UMP_FB_MIDI1_* */
+    uint8_t ui_hint;              /**< UMP_FB_DIR_* bits shown to users (0 = as direction) */
+} ump_function_block_t;
+
+/**
+ * @brief What this endpoint reports about itself
+ */
+typedef struct {
+    ump_endpoint_info_t info;     /**< Version, protocols, JR support; num_function_blocks entries in blocks */
+    uint8_t protocol;             /**< UMP_STREAM_PROTOCOL_* preferred when the peer supports both */
+    const char *name;             /**< Endpoint name (NULL = none) */
+    const char *product_instance_id; /**< Unique per unit, e.g. a serial number (NULL = none) */
+    uint8_t manufacturer[3];      /**< SysEx ID; a 1-byte ID is { id, 0, 0 } */
+    uint16_t family;              /**< Device family (14-bit) */
+    uint16_t model;               /**< Family member (14-bit) */
+    uint8_t version[4];           /**< Software revision (7-bit each) */
+    const ump_function_block_t *blocks;
+} ump_endpoint_t;
+
+/**
+ * @brief Negotiated state of one link
+ */
+typedef struct {
+    uint8_t protocol;             /**< UMP_STREAM_PROTOCOL_* in use on the link */
+    bool jr_rx;                   /**< We receive JR timestamps (the peer sends them) */
+    bool jr_tx;                   /**< We send JR timestamps (the peer expects them) */
+    bool negotiated;              /**< Protocol confirmed by a Stream Configuration message */
+    bool peer_known;              /**< Peer's Endpoint Info received */
+    ump_endpoint_info_t peer;     /**< Peer's Endpoint Info (valid if peer_known) */
+} ump_endpoint_link_t;
+
+/**
+ * @brief Send one UMP Stream message to the link's peer
+ */
+typedef void (*ump_endpoint_send_fn_t)(const ump_packet_t *ump, void *ctx);
+
+/**
+ * @brief Start a link in the endpoint's preferred protocol, no JR
+ */
+void ump_endpoint_link_init(const ump_endpoint_t *endpoint, ump_endpoint_link_t *link);
+
+/**
+ * @brief Handle a UMP Stream message received on a link
+ *
+ * @param endpoint This endpoint
+ * @param link Link the message arrived on (updated by configuration messages)
+ * @param ump Received message
+ * @param send Sends replies back over the same link
+ * @param ctx Passed to send
+ * @return ESP_OK if the message was for the endpoint (consumed),
+ *         ESP_ERR_NOT_SUPPORTED if it is not a discovery or
+ *         configuration message (e.g. Start of Clip) and should be
+ *         passed on, ESP_ERR_INVALID_ARG
+ */
+esp_err_t ump_endpoint_handle(const ump_endpoint_t *endpoint, ump_endpoint_link_t *link,
+                              const ump_packet_t *ump, ump_endpoint_send_fn_t send, void *ctx);
+
+/**
+ * @brief Ask the peer of a link for its Endpoint Info and configuration
+ *
+ * Sends Endpoint Discovery. Its Endpoint Info reply, handled by
+ * ump_endpoint_handle(), starts the protocol negotiation.
+ */
+void ump_endpoint_discover(ump_endpoint_send_fn_t send, void *ctx);
+
+/**
+ * @brief Fit an outgoing UMP to what a link negotiated
+ *
+ * MIDI 2.0 channel voice becomes MT 0x2 on a MIDI 1.0 Protocol link.
+ * JR Clock and JR Timestamps only go out where JR transmit is on.
+ *
+ * @param link Link the UMP is for
+ * @param ump Message, rewritten in place
+ * @return ESP_OK to send ump, ESP_ERR_NOT_SUPPORTED to drop it (JR not
+ *         agreed, or no MIDI 1.0 form)
+ */
+esp_err_t ump_endpoint_link_adapt(const ump_endpoint_link_t *link, ump_packet_t *ump);
+
+/**
+ * @brief Protocol both ends support, the endpoint's preference first
+ *
+ * @return UMP_STREAM_PROTOCOL_*, or 0 if there is none in common
+ */
+uint8_t ump_endpoint_choose_protocol(const ump_endpoint_t *endpoint,
+                                     const ump_endpoint_info_t *peer);
+
+#endif /* UMP_ENDPOINT_H */
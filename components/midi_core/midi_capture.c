@@ -0,0 +1,380 @@
+/**
+ * @file midi_capture.c
+ * @brief Capture Ring and Log Reader Implementation
+ */
+
+#include "midi_capture.h"
+#include "esp_timer.h"
+#include <string.h>
+
+#define CAPTURE_PAD         0xFF    // Tag: rest of the ring up to its end is unused
+#define CAPTURE_OUTPUT      0x08    // Tag kind bit: source byte follows
+#define CAPTURE_MAX_PREFIX  15      // Tag + source + 3-byte length + 10-byte delta
+
+static midi_capture_t *s_active;
+
+//=============================================================================
+// Encoding
+//=============================================================================
+
+static size_t varint_put(uint8_t *out, uint64_t value) {
+    size_t n = 0;
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        out[n++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return n;
+}
+
+static size_t varint_get(const uint8_t *in, size_t avail, uint64_t *value) {
+    uint64_t v = 0;
+    for (size_t n = 0; n < avail && n < 10; n++) {
+        v |= (uint64_t)(in[n] & 0x7F) << (7 * n);
+        if (!(in[n] & 0x80)) {
+            *value = v;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode the record at buf, returning its total size (0 if malformed)
+ */
+static size_t record_decode(const uint8_t *buf, size_t avail, uint64_t *delta,
+                            midi_capture_record_t *rec) {
+    if (avail < 3) {
+        return 0;
+    }
+    uint64_t length;
+    size_t n = (buf[0] & CAPTURE_OUTPUT) ? 2 : 1;
+    size_t k = varint_get(buf + n, avail - n, &length);
+    if (!k || length > UINT16_MAX) {
+        return 0;
+    }
+    n += k;
+    k = varint_get(buf + n, avail - n, delta);
+    if (!k || avail - n - k < length) {
+        return 0;
+    }
+    n += k;
+    if (rec) {
+        rec->transport = buf[0] >> 4;
+        rec->kind = buf[0] & 0x07;
+        rec->source = (buf[0] & CAPTURE_OUTPUT) ? buf[1] : MIDI_CAPTURE_NO_SOURCE;
+        rec->length = (uint16_t)length;
+        rec->data = buf + n;
+    }
+    return n + length;
+}
+
+//=============================================================================
+// Ring
+//=============================================================================
+
+esp_err_t midi_capture_init(midi_capture_t *cap, uint8_t *buf, size_t size) {
+    if (!cap || !buf || size < CAPTURE_MAX_PREFIX + 4) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(cap, 0, sizeof(*cap));
+    cap->buf = buf;
+    cap->size = size;
+    cap->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    return ESP_OK;
+}
+
+void midi_capture_clear(midi_capture_t *cap) {
+    portENTER_CRITICAL(&cap->lock);
+    cap->head = cap->tail = cap->used = 0;
+    cap->base_us = cap->last_us;
+    cap->records = 0;
+    portEXIT_CRITICAL(&cap->lock);
+}
+
+/**
+ * @brief Drop the oldest record (or trailing padding)
+ */
+static void capture_evict(midi_capture_t *cap) {
+    if (cap->buf[cap->head] == CAPTURE_PAD) {
+        cap->used -= cap->size - cap->head;
+        cap->head = 0;
+        return;
+    }
+    uint64_t delta = 0;
+    size_t n = record_decode(&cap->buf[cap->head], cap->size - cap->head, &delta, NULL);
+    cap->base_us += delta;
+    cap->used -= n;
+    cap->head += n;
+    if (cap->head == cap->size) {
+        cap->head = 0;
+    }
+    cap->records--;
+    cap->overwritten++;
+}
+
+static esp_err_t capture_append(midi_capture_t *cap, uint64_t time_us, uint8_t transport,
+                                uint8_t source, midi_capture_kind_t kind,
+                                const void *data, size_t len) {
+    if (!cap || kind >= MIDI_CAPTURE_KIND_COUNT || (len && !data)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (len > UINT16_MAX || len + CAPTURE_MAX_PREFIX > cap->size / 2) {
+        cap->rejected++;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t prefix[CAPTURE_MAX_PREFIX];
+    portENTER_CRITICAL(&cap->lock);
+
+    uint64_t delta = time_us > cap->last_us ? time_us - cap->last_us : 0;
+    size_t p = 0;
+    prefix[p++] = (uint8_t)((transport & 0x0F) << 4 | kind |
+                            (source != MIDI_CAPTURE_NO_SOURCE ? CAPTURE_OUTPUT : 0));
+    if (source != MIDI_CAPTURE_NO_SOURCE) {
+        prefix[p++] = source;
+    }
+    p += varint_put(&prefix[p], len);
+    p += varint_put(&prefix[p], delta);
+    size_t need = p + len;
+
+    // Make a contiguous gap of `need` bytes at the tail
+    for (;;) {
+        if (cap->used == 0) {
+            cap->head = cap->tail = 0;
+            break;
+        }
+        if (cap->tail > cap->head) {
+            if (cap->size - cap->tail >= need) {
+                break;
+            }
+            if (cap->head >= need) {
+                cap->buf[cap->tail] = CAPTURE_PAD;
+                cap->used += cap->size - cap->tail;
+                cap->tail = 0;
+                break;
+            }
+        } else if (cap->head - cap->tail >= need) {
+            break;
+        }
+        capture_evict(cap);
+    }
+
+    memcpy(&cap->buf[cap->tail], prefix, p);
+    memcpy(&cap->buf[cap->tail + p], data, len);
+    cap->tail += need;
+    if (cap->tail == cap->size) {
+        cap->tail = 0;
+    }
+    cap->used += need;
+    cap->records++;
+    if (cap->records == 1) {
+        cap->base_us = cap->last_us;
+    }
+    cap->last_us += delta;
+
+    portEXIT_CRITICAL(&cap->lock);
+    return ESP_OK;
+}
+
+esp_err_t midi_capture_write_at(midi_capture_t *cap, uint64_t time_us, uint8_t transport,
+                                midi_capture_kind_t kind, const void *data, size_t len) {
+    return capture_append(cap, time_us, transport, MIDI_CAPTURE_NO_SOURCE, kind, data, len);
+}
+
+esp_err_t midi_capture_write(midi_capture_t *cap, uint8_t transport,
+                             midi_capture_kind_t kind, const void *data, size_t len) {
+    return capture_append(cap, (uint64_t)esp_timer_get_time(), transport,
+                          MIDI_CAPTURE_NO_SOURCE, kind, data, len);
+}
+
+esp_err_t midi_capture_write_output(midi_capture_t *cap, uint8_t transport, uint8_t source,
+                                    midi_capture_kind_t kind, const void *data, size_t len) {
+    return capture_append(cap, (uint64_t)esp_timer_get_time(), transport, source,
+                          kind, data, len);
+}
+
+void midi_capture_set_active(midi_capture_t *cap) {
+    __atomic_store_n(&s_active, cap, __ATOMIC_RELEASE);
+}
+
+void midi_capture_rx(uint8_t transport, midi_capture_kind_t kind, const void *data, size_t len) {
+    midi_capture_t *cap = __atomic_load_n(&s_active, __ATOMIC_ACQUIRE);
+    if (cap) {
+        midi_capture_write(cap, transport, kind, data, len);
+    }
+}
+
+esp_err_t midi_capture_take(midi_capture_t *cap, midi_capture_record_t *record,
+                            uint8_t *buf, size_t size) {
+    if (!cap || !record || (size && !buf)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_OK;
+    portENTER_CRITICAL(&cap->lock);
+    if (cap->used && cap->buf[cap->head] == CAPTURE_PAD) {
+        cap->used -= cap->size - cap->head;
+        cap->head = 0;
+    }
+    if (cap->used == 0) {
+        portEXIT_CRITICAL(&cap->lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint64_t delta = 0;
+    size_t n = record_decode(&cap->buf[cap->head], cap->size - cap->head, &delta, record);
+    cap->base_us += delta;
+    record->time_us = cap->base_us;
+    if (record->length <= size) {
+        memcpy(buf, record->data, record->length);
+        record->data = buf;
+    } else {
+        record->data = NULL;
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    cap->used -= n;
+    cap->head += n;
+    if (cap->head == cap->size) {
+        cap->head = 0;
+    }
+    cap->records--;
+    portEXIT_CRITICAL(&cap->lock);
+    return err;
+}
+
+//=============================================================================
+// Reading and Saving
+//=============================================================================
+
+void midi_capture_reader_ring(midi_capture_reader_t *reader, const midi_capture_t *cap) {
+    reader->buf = cap->buf;
+    reader->size = cap->size;
+    reader->pos = cap->head;
+    reader->remaining = cap->used;
+    reader->time_us = cap->base_us;
+}
+
+esp_err_t midi_capture_reader_log(midi_capture_reader_t *reader, const uint8_t *log, size_t len) {
+    if (!reader || !log || len < MIDI_CAPTURE_HEADER_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (memcmp(log, MIDI_CAPTURE_MAGIC, 4) != 0 || log[4] != MIDI_CAPTURE_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    uint64_t origin = 0;
+    for (int i = 7; i >= 0; i--) {
+        origin = (origin << 8) | log[8 + i];
+    }
+    reader->buf = log + MIDI_CAPTURE_HEADER_SIZE;
+    reader->size = len - MIDI_CAPTURE_HEADER_SIZE;
+    reader->pos = 0;
+    reader->remaining = reader->size;
+    reader->time_us = origin;
+    return ESP_OK;
+}
+
+esp_err_t midi_capture_next(midi_capture_reader_t *reader, midi_capture_record_t *record) {
+    if (reader->remaining && reader->pos < reader->size &&
+        reader->buf[reader->pos] == CAPTURE_PAD) {
+        size_t pad = reader->size - reader->pos;
+        reader->remaining -= pad < reader->remaining ? pad : reader->remaining;
+        reader->pos = 0;
+    }
+    if (reader->remaining == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    size_t avail = reader->size - reader->pos;
+    if (avail > reader->remaining) {
+        avail = reader->remaining;
+    }
+    uint64_t delta;
+    size_t n = record_decode(&reader->buf[reader->pos], avail, &delta, record);
+    if (!n) {
+        reader->remaining = 0;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    reader->time_us += delta;
+    record->time_us = reader->time_us;
+    reader->pos += n;
+    reader->remaining -= n;
+    if (reader->pos == reader->size) {
+        reader->pos = 0;
+    }
+    return ESP_OK;
+}
+
+esp_err_t midi_capture_save(const midi_capture_t *cap, midi_capture_write_fn_t write, void *ctx) {
+    if (!cap || !write) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t header[MIDI_CAPTURE_HEADER_SIZE] = { 'M', 'C', 'A', 'P', MIDI_CAPTURE_VERSION };
+    for (int i = 0; i < 8; i++) {
+        header[8 + i] = (uint8_t)(cap->base_us >> (8 * i));
+    }
+    esp_err_t err = write(ctx, header, sizeof(header));
+
+    // At most two spans: head up to the padding or end, then from the start
+    midi_capture_reader_t reader;
+    midi_capture_record_t rec;
+    midi_capture_reader_ring(&reader, cap);
+    size_t span_start = reader.pos, span_end = reader.pos;
+    while (err == ESP_OK && midi_capture_next(&reader, &rec) == ESP_OK) {
+        size_t data_at = (size_t)(rec.data - reader.buf);
+        if (data_at < span_end) {
+            err = write(ctx, &reader.buf[span_start], span_end - span_start);
+            span_start = 0;
+        }
+        span_end = data_at + rec.length;
+    }
+    if (err == ESP_OK && span_end > span_start) {
+        err = write(ctx, &reader.buf[span_start], span_end - span_start);
+    }
+    return err;
+}
+
+//=============================================================================
+// Comparison
+//=============================================================================
+
+/**
+ * @brief Next record of one stream
+ */
+static bool capture_next_of(midi_capture_reader_t *reader, midi_capture_filter_t filter,
+                            void *ctx, midi_capture_record_t *rec) {
+    while (midi_capture_next(reader, rec) == ESP_OK) {
+        if (!filter || filter(rec, ctx)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t midi_capture_diff(midi_capture_reader_t *a, midi_capture_reader_t *b,
+                           midi_capture_filter_t filter, void *ctx, int32_t *first_diff) {
+    uint32_t diffs = 0;
+    int32_t first = -1;
+    midi_capture_record_t ra, rb;
+
+    for (int32_t i = 0;; i++) {
+        bool has_a = capture_next_of(a, filter, ctx, &ra);
+        bool has_b = capture_next_of(b, filter, ctx, &rb);
+        if (!has_a && !has_b) {
+            break;
+        }
+        bool same = has_a && has_b && ra.kind == rb.kind && ra.length == rb.length &&
+                    ra.transport == rb.transport && ra.source == rb.source && memcmp(ra.data, rb.data, ra.length) == 0;
+        if (!same) {
+            diffs++;
+            if (first < 0) {
+                first = i;
+            }
+        }
+    }
+    if (first_diff) {
+        *first_diff = first;
+    }
+    return diffs;
+}
@@ -88,6 +88,7 @@ esp_err_t midi_parser_reset(midi_parser_state_t *state) {
     state->expected_data_bytes = 0;
     state->in_sysex = false;
     state->sysex_index = 0;
+    state->active_sensing = false;
     
     ESP_LOGD(TAG, "Parser state reset");
     
@@ -110,6 +111,15 @@ esp_err_t midi_parser_parse_byte(midi_parser_state_t *state,
     
     *message_complete = false;
     
+    /* Once the sender uses Active Sensing, every byte proves the link
+     * alive (spec page 30); the timeout is checked by the transport */
+    if (byte == MIDI_STATUS_ACTIVE_SENSING) {
+        state->active_sensing = true;
+    }
+    if (state->active_sensing) {
+        state->last_rx_us = (uint32_t)esp_timer_get_time();
+    }
+    
     /* === SYSTEM REAL-TIME MESSAGES (0xF8-0xFF) === */
     /* Real-Time messages can occur at ANY time, even between status 
      * and data bytes. They must be processed immediately without 
@@ -248,3 +258,20 @@ esp_err_t midi_parser_parse_byte(midi_parser_state_t *state,
     return ESP_OK;
 }
 
+/**
+ * @brief Check for Active Sensing timeout
+ */
+bool midi_parser_check_active_sensing_timeout(midi_parser_state_t *state,
+                                               uint32_t current_time_us) {
+    if (!state || !state->active_sensing) {
+        return false;
+    }
+    
+    if (current_time_us - state->last_rx_us <= MIDI_ACTIVE_SENSING_TIMEOUT_MS * 1000u) {
+        return false;
+    }
+    
+    state->active_sensing = false;  // Re-armed by the next 0xFE
+    ESP_LOGD(TAG, "Active Sensing timeout");
+    return true;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file midi_timebase.c
+ * @brief Disciplined Timebase Implementation
+ *
+ * The servo turns each error into the rate that would cancel it within
+ * one measurement interval: half of that rate goes into the slew for
+ * the next interval (proportional), an eighth is added to the learned
+ * frequency (integral). Both poles then sit at |z| = 0.71, so an error
+ * halves roughly every other interval without overshooting the slew
+ * limit in practice.
+ */
+
+#include "midi_timebase.h"
+#include "esp_timer.h"
+#include <string.h>
+
+#define TIMEBASE_MAX_PPB    ((int64_t)MIDI_TIMEBASE_MAX_PPM * 1000)
+#define TIMEBASE_MIN_INTERVAL_US 1000
+
+static midi_timebase_t s_timebase;  // All zero: shared time is local time
+
+static inline int32_t clamp_ppb(int64_t ppb) {
+    if (ppb > TIMEBASE_MAX_PPB) {
+        return (int32_t)TIMEBASE_MAX_PPB;
+    }
+    if (ppb < -TIMEBASE_MAX_PPB) {
+        return (int32_t)-TIMEBASE_MAX_PPB;
+    }
+    return (int32_t)ppb;
+}
+
+//=============================================================================
+// Sequence Counter
+//=============================================================================
+
+static void update_begin(midi_timebase_t *tb) {
+    __atomic_store_n(&tb->generation, tb->generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void update_end(midi_timebase_t *tb) {
+    __atomic_store_n(&tb->generation, tb->generation + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Consistent copy of the mapping (retries across an update)
+ */
+static void read_mapping(const midi_timebase_t *tb, int64_t *local_ref, int64_t *shared_ref,
+                         int32_t *rate_ppb) {
+    uint32_t before, after;
+    do {
+        before = __atomic_load_n(&tb->generation, __ATOMIC_ACQUIRE);
+        *local_ref = tb->local_ref_us;
+        *shared_ref = tb->shared_ref_us;
+        *rate_ppb = tb->rate_ppb;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&tb->generation, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
+
+//=============================================================================
+// Any Timebase
+//=============================================================================
+
+void midi_timebase_init(midi_timebase_t *tb) {
+    update_begin(tb);
+    uint32_t generation = tb->generation;
+    memset(tb, 0, sizeof(*tb));
+    tb->generation = generation;
+    update_end(tb);
+}
+
+int64_t midi_timebase_shared_us(const midi_timebase_t *tb, int64_t local_us) {
+    int64_t local_ref, shared_ref;
+    int32_t rate_ppb;
+    read_mapping(tb, &local_ref, &shared_ref, &rate_ppb);
+
+    int64_t elapsed = local_us - local_ref;
+    return shared_ref + elapsed + elapsed * rate_ppb / 1000000000;
+}
+
+int64_t midi_timebase_local_us(const midi_timebase_t *tb, int64_t shared_us) {
+    int64_t local_ref, shared_ref;
+    int32_t rate_ppb;
+    read_mapping(tb, &local_ref, &shared_ref, &rate_ppb);
+
+    int64_t span = shared_us - shared_ref;
+    return local_ref + span - span * rate_ppb / (1000000000 + rate_ppb);
+}
+
+void midi_timebase_correct(midi_timebase_t *tb, int64_t local_us, int64_t error_us,
+                           uint32_t interval_us) {
+    int64_t shared = midi_timebase_shared_us(tb, local_us);
+    int64_t magnitude = error_us < 0 ? -error_us : error_us;
+
+    update_begin(tb);
+    tb->local_ref_us = local_us;
+    tb->last_error_us = error_us;
+    if (!tb->locked || magnitude >= MIDI_TIMEBASE_STEP_US) {
+        tb->shared_ref_us = shared + error_us;
+        tb->rate_ppb = tb->freq_ppb;
+        tb->locked = true;
+        tb->steps++;
+    } else {
+        if (interval_us < TIMEBASE_MIN_INTERVAL_US) {
+            interval_us = TIMEBASE_MIN_INTERVAL_US;
+        }
+        int64_t ppb = error_us * 1000000000 / interval_us;
+        tb->shared_ref_us = shared;
+        tb->freq_ppb = clamp_ppb(tb->freq_ppb + ppb / 8);
+        tb->rate_ppb = clamp_ppb(tb->freq_ppb + ppb / 2);
+        tb->slews++;
+    }
+    update_end(tb);
+}
+
+void midi_timebase_holdover(midi_timebase_t *tb, int64_t local_us) {
+    int64_t shared = midi_timebase_shared_us(tb, local_us);
+
+    update_begin(tb);
+    tb->local_ref_us = local_us;
+    tb->shared_ref_us = shared;
+    tb->rate_ppb = tb->freq_ppb;
+    update_end(tb);
+}
+
+//=============================================================================
+// Device Timebase
+//=============================================================================
+
+midi_timebase_t *midi_timebase_get(void) {
+    return &s_timebase;
+}
+
+int64_t midi_timebase_now_us(void) {
+    return midi_timebase_shared_us(&s_timebase, esp_timer_get_time());
+}
+
+int64_t midi_timebase_from_local_us(int64_t local_us) {
+    return midi_timebase_shared_us(&s_timebase, local_us);
+}
+
+int64_t midi_timebase_to_local_us(int64_t shared_us) {
+    return midi_timebase_local_us(&s_timebase, shared_us);
+}
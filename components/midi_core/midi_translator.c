@@ -1,6 +1,8 @@
 #include "midi_types.h"
 #include "midi_defs.h"
+#include "midi_parser.h"
 #include "ump_types.h"
+#include "ump_defs.h"
 #include "ump_message.h"
 #include "midi_translator.h"
 
@@ -14,6 +16,20 @@ uint16_t midi_upscale_7to16(uint8_t value7) {
     return (uint16_t)(32768 + (((uint32_t)(value7 - 64) * 32767) / 63));
 }
 
+// MIDI 1.0 (7-bit) to 32-bit: shift, then repeat the bits below the
+// top one above center so 127 reaches 0xFFFFFFFF (spec Appendix D.3)
+uint32_t midi_upscale_7to32(uint8_t value7) {
+    value7 &= 0x7F;
+    uint32_t shifted = (uint32_t)value7 << 25;
+    if (value7 <= 64) return shifted;
+    uint32_t repeat = (uint32_t)(value7 & 0x3F) << 19;
+    while (repeat) {
+        shifted |= repeat;
+        repeat >>= 6;
+    }
+    return shifted;
+}
+
 // MIDI 1.0 (14-bit) to 32-bit (MIDI 2.0)
 uint32_t midi_upscale_14to32(uint16_t value14) {
     if (value14 == 0) return 0;
@@ -28,40 +44,161 @@ uint32_t midi_upscale_14to32(uint16_t value14) {
 uint8_t midi_downscale_16to7(uint16_t value16) {
     return value16 >> 9; // 16->7 bits: shift right by 16-7=9
 }
+uint8_t midi_downscale_32to7(uint32_t value32) {
+    return value32 >> 25; // 32->7 bits: shift by 25
+}
 uint16_t midi_downscale_32to14(uint32_t value32) {
     return value32 >> 18; // 32->14 bits: shift by 18
 }
 
-// MIDI 1.0 → UMP (MT 0x2 or 0x4 depending on translation mode)
+// MIDI 1.0 → UMP in MIDI 1.0 Protocol: MT 0x2 channel voice, MT 0x1
+// system. Same bytes, no scaling
+esp_err_t midi_translate_1to_ump1(const midi_message_t *msg, ump_packet_t *packet) {
+    if (!msg || !packet) return ESP_ERR_INVALID_ARG;
+    uint8_t status = msg->status;
+    if (status < 0x80 || status == MIDI_STATUS_SYSEX_START || status == MIDI_STATUS_SYSEX_END)
+        return ESP_ERR_NOT_SUPPORTED; // SysEx goes as MT 0x3, not one message
+    uint8_t mt = (status < 0xF0) ? UMP_MT_MIDI1_CHANNEL_VOICE : UMP_MT_SYSTEM;
+    uint8_t count = midi_get_data_byte_count(status);
+    uint32_t word0 = ((uint32_t)mt << 28) | ((uint32_t)status << 16);
+    if (count > 0) word0 |= (uint32_t)(msg->data.bytes[0] & 0x7F) << 8;
+    if (count > 1) word0 |= msg->data.bytes[1] & 0x7F;
+    packet->words[0] = word0;
+    packet->words[1] = packet->words[2] = packet->words[3] = 0;
+    packet->num_words = 1;
+    packet->message_type = mt;
+    packet->group = 0;
+    packet->timestamp_us = 0;
+    return ESP_OK;
+}
+
+// MIDI 1.0 → UMP (MT 0x4 for channel voice, upscaled; MT 0x1 for system)
 esp_err_t midi_translate_1to2(const midi_message_t *msg, ump_packet_t *packet) {
     if (!msg || !packet) return ESP_ERR_INVALID_ARG;
-    // Example: Note On translation only; expand for full coverage as needed
-    if ((msg->status & 0xF0) == MIDI_STATUS_NOTE_ON) {
-        // Upscale velocity
-        uint16_t velocity16 = midi_upscale_7to16(msg->data.bytes[1]);
-        return ump_build_midi2_note_on(0, msg->channel, msg->data.bytes[0], velocity16, 0, 0, packet);
+    uint8_t status = msg->status;
+    if (status >= 0xF0) return midi_translate_1to_ump1(msg, packet); // System is the same in both
+    if (status < 0x80) return ESP_ERR_NOT_SUPPORTED;
+    uint8_t type = status & 0xF0;
+    uint8_t channel = status & 0x0F;
+    uint8_t d0 = msg->data.bytes[0] & 0x7F;
+    uint8_t d1 = msg->data.bytes[1] & 0x7F;
+    uint32_t word1;
+    switch (type) {
+    case MIDI_STATUS_NOTE_ON:
+        if (d1 == 0) {
+            type = MIDI_STATUS_NOTE_OFF; // Velocity 0 is a Note Off only in MIDI 1.0
+            word1 = 0;
+            break;
+        }
+        return ump_build_midi2_note_on(0, channel, d0, midi_upscale_7to16(d1), 0, 0, packet);
+    case MIDI_STATUS_NOTE_OFF:
+        word1 = (uint32_t)midi_upscale_7to16(d1) << 16;
+        break;
+    case MIDI_STATUS_POLY_PRESSURE:
+    case MIDI_STATUS_CONTROL_CHANGE:
+        word1 = midi_upscale_7to32(d1);
+        break;
+    case MIDI_STATUS_PROGRAM_CHANGE:
+        word1 = (uint32_t)d0 << 24; // No bank: Bank Valid flag clear
+        d0 = 0;
+        break;
+    case MIDI_STATUS_CHANNEL_PRESSURE:
+        word1 = midi_upscale_7to32(d0);
+        d0 = 0;
+        break;
+    case MIDI_STATUS_PITCH_BEND:
+        word1 = midi_upscale_14to32((uint16_t)d0 | ((uint16_t)d1 << 7));
+        d0 = 0;
+        break;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
     }
-    // Add translation for other message types here...
-    return ESP_ERR_NOT_SUPPORTED;
+    packet->words[0] = ((uint32_t)UMP_MT_MIDI2_CHANNEL_VOICE << 28) |
+                       ((uint32_t)(type | channel) << 16) | ((uint32_t)d0 << 8);
+    packet->words[1] = word1;
+    packet->words[2] = packet->words[3] = 0;
+    packet->num_words = 2;
+    packet->message_type = UMP_MT_MIDI2_CHANNEL_VOICE;
+    packet->group = 0;
+    packet->timestamp_us = 0;
+    return ESP_OK;
 }
 
-// UMP (MIDI 2.0, Note On) → MIDI 1.0
+// UMP (MT 0x1, 0x2, 0x4) → MIDI 1.0
 esp_err_t midi_translate_2to1(const ump_packet_t *packet, midi_message_t *msg) {
     if (!packet || !msg) return ESP_ERR_INVALID_ARG;
-    if (packet->message_type == UMP_MT_MIDI2_CHANNEL_VOICE) {
-        uint32_t word0 = packet->words[0];
-        uint32_t word1 = packet->words[1];
-        uint8_t status = (word0 >> 16) & 0xFF;
-        uint8_t channel = (word0 >> 8) & 0xF;
-        uint8_t note = (word0 >> 8) & 0xFF;
-        uint16_t velocity16 = word1 >> 16;
-        uint8_t velocity7 = midi_downscale_16to7(velocity16);
-        msg->status = MIDI_STATUS_NOTE_ON | channel;
-        msg->channel = channel;
-        msg->data.bytes[0] = note;
-        msg->data.bytes[1] = velocity7;
-        return ESP_OK;
+    uint32_t word0 = packet->words[0];
+    uint32_t word1 = packet->words[1];
+    uint8_t status = (word0 >> 16) & 0xFF;
+    uint8_t d0 = (word0 >> 8) & 0x7F;
+    uint8_t d1 = word0 & 0x7F;
+    switch (packet->message_type) {
+    case UMP_MT_SYSTEM:
+    case UMP_MT_MIDI1_CHANNEL_VOICE:
+        break;
+    case UMP_MT_MIDI2_CHANNEL_VOICE:
+        switch (status & 0xF0) {
+        case MIDI_STATUS_NOTE_ON:
+            d1 = midi_downscale_16to7(word1 >> 16);
+            if (d1 == 0) d1 = 1; // Still a Note On in MIDI 1.0
+            break;
+        case MIDI_STATUS_NOTE_OFF:
+            d1 = midi_downscale_16to7(word1 >> 16);
+            break;
+        case MIDI_STATUS_POLY_PRESSURE:
+        case MIDI_STATUS_CONTROL_CHANGE:
+            d1 = midi_downscale_32to7(word1);
+            break;
+        case MIDI_STATUS_PROGRAM_CHANGE:
+            d0 = (word1 >> 24) & 0x7F; // Bank select would need messages of its own
+            d1 = 0;
+            break;
+        case MIDI_STATUS_CHANNEL_PRESSURE:
+            d0 = midi_downscale_32to7(word1);
+            d1 = 0;
+            break;
+        case MIDI_STATUS_PITCH_BEND: {
+            uint16_t bend = midi_downscale_32to14(word1);
+            d0 = bend & 0x7F;
+            d1 = bend >> 7;
+            break;
+        }
+        default:
+            return ESP_ERR_NOT_SUPPORTED; // Per-note, RPN/NRPN, relative: no 1:1 form
+        }
+        break;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
     }
-    // Add more as needed
-    return ESP_ERR_NOT_SUPPORTED;
+    if (status < 0x80 || status == MIDI_STATUS_SYSEX_START) return ESP_ERR_NOT_SUPPORTED;
+    msg->type = (status < 0xF0) ? MIDI_MSG_TYPE_CHANNEL :
+                (status >= 0xF8) ? MIDI_MSG_TYPE_SYSTEM_REALTIME : MIDI_MSG_TYPE_SYSTEM_COMMON;
+    msg->status = status;
+    msg->channel = (status < 0xF0) ? (status & 0x0F) : 0;
+    msg->data.bytes[0] = d0;
+    msg->data.bytes[1] = d1;
+    return ESP_OK;
+}
+
+// MIDI 1.0 SysEx → SysEx7, 6 bytes per packet
+size_t midi_translate_sysex_to_ump(const midi_message_t *msg, uint8_t group,
+                                   size_t offset, ump_packet_t *packet) {
+    size_t length = msg->data.sysex.data ? msg->data.sysex.length : 0;
+    size_t count = (length - offset > 6) ? 6 : length - offset;
+    uint8_t form;
+    if (offset == 0) form = (count == length) ? UMP_FORMAT_COMPLETE : UMP_FORMAT_START;
+    else form = (offset + count == length) ? UMP_FORMAT_END : UMP_FORMAT_CONTINUE;
+    uint8_t bytes[6] = {0};
+    for (size_t i = 0; i < count; i++) bytes[i] = msg->data.sysex.data[offset + i] & 0x7F;
+    packet->words[0] = ((uint32_t)UMP_MT_DATA_64 << 28) | ((uint32_t)(group & 0x0F) << 24) |
+                       ((uint32_t)form << 20) | ((uint32_t)count << 16) |
+                       ((uint32_t)bytes[0] << 8) | bytes[1];
+    packet->words[1] = ((uint32_t)bytes[2] << 24) | ((uint32_t)bytes[3] << 16) |
+                       ((uint32_t)bytes[4] << 8) | bytes[5];
+    packet->words[2] = packet->words[3] = 0;
+    packet->num_words = 2;
+    packet->message_type = UMP_MT_DATA_64;
+    packet->group = group & 0x0F;
+    packet->timestamp_us = 0;
+    return offset + count;
 }
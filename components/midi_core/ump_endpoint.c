@@ -0,0 +1,309 @@
+/**
+ * @file ump_endpoint.c
+ * @brief UMP Endpoint Discovery and Protocol Negotiation
+ */
+
+#include "ump_endpoint.h"
+#include "midi_translator.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "ump_endpoint";
+
+/** Text bytes in word 0 before the payload: Endpoint Name, Product Instance Id */
+#define TEXT_OFFSET_ENDPOINT    2
+/** Function Block Name: word 0 also holds the block number */
+#define TEXT_OFFSET_BLOCK       3
+
+//=============================================================================
+// Message Builders
+//=============================================================================
+
+static inline uint32_t stream_word0(uint8_t form, uint16_t status) {
+    return ((uint32_t)UMP_MT_UMP_STREAM << 28) | ((uint32_t)form << 26) |
+           ((uint32_t)status << 16);
+}
+
+static void stream_send(uint32_t w0, uint32_t w1, uint32_t w2, uint32_t w3,
+                        ump_endpoint_send_fn_t send, void *ctx) {
+    ump_packet_t ump = {
+        .words = { w0, w1, w2, w3 },
+        .num_words = 4,
+        .message_type = UMP_MT_UMP_STREAM,
+        .group = 0xFF
+    };
+    send(&ump, ctx);
+}
+
+/**
+ * @brief Send a text field as one or more messages (Start/Continue/End)
+ *
+ * @param head Word 0 without form; bytes before offset carry other fields
+ * @param offset Bytes of the 16-byte message in front of the text
+ */
+static void stream_send_text(uint32_t head, size_t offset, const char *text, size_t max,
+                             ump_endpoint_send_fn_t send, void *ctx) {
+    size_t len = strnlen(text, max);
+    size_t per_message = 16 - offset;
+    size_t pos = 0;
+
+    if (len == 0) {
+        return;
+    }
+    do {
+        size_t chunk = (len - pos < per_message) ? len - pos : per_message;
+        bool first = (pos == 0);
+        bool last = (pos + chunk == len);
+        uint8_t form = (first && last) ? UMP_FORMAT_COMPLETE :
+                       first ? UMP_FORMAT_START : last ? UMP_FORMAT_END : UMP_FORMAT_CONTINUE;
+        uint32_t w[4] = { head | ((uint32_t)form << 26), 0, 0, 0 };
+
+        for (size_t i = 0; i < chunk; i++) {
+            size_t at = offset + i;
+            w[at / 4] |= (uint32_t)(uint8_t)text[pos + i] << (24 - 8 * (at % 4));
+        }
+        stream_send(w[0], w[1], w[2], w[3], send, ctx);
+        pos += chunk;
+    } while (pos < len);
+}
+
+static void send_endpoint_info(const ump_endpoint_t *ep, ump_endpoint_send_fn_t send, void *ctx) {
+    const ump_endpoint_info_t *info = &ep->info;
+    uint32_t w1 = (info->static_function_blocks ? 0x80000000u : 0) |
+                  ((uint32_t)(info->num_function_blocks & 0x7F) << 24) |
+                  (info->midi2_protocol ? 0x200u : 0) | (info->midi1_protocol ? 0x100u : 0) |
+                  (info->rx_jr_timestamp ? 0x02u : 0) | (info->tx_jr_timestamp ? 0x01u : 0);
+
+    stream_send(stream_word0(0, UMP_STREAM_ENDPOINT_INFO) |
+                ((uint32_t)info->ump_version_major << 8) | info->ump_version_minor,
+                w1, 0, 0, send, ctx);
+}
+
+static void send_device_identity(const ump_endpoint_t *ep, ump_endpoint_send_fn_t send, void *ctx) {
+    uint32_t w1 = ((uint32_t)(ep->manufacturer[0] & 0x7F) << 16) |
+                  ((uint32_t)(ep->manufacturer[1] & 0x7F) << 8) | (ep->manufacturer[2] & 0x7F);
+    uint32_t w2 = ((uint32_t)(ep->family & 0x7F) << 24) | ((uint32_t)((ep->family >> 7) & 0x7F) << 16) |
+                  ((uint32_t)(ep->model & 0x7F) << 8) | ((ep->model >> 7) & 0x7F);
+    uint32_t w3 = ((uint32_t)(ep->version[0] & 0x7F) << 24) | ((uint32_t)(ep->version[1] & 0x7F) << 16) |
+                  ((uint32_t)(ep->version[2] & 0x7F) << 8) | (ep->version[3] & 0x7F);
+
+    stream_send(stream_word0(0, UMP_STREAM_DEVICE_IDENTITY), w1, w2, w3, send, ctx);
+}
+
+static void send_stream_config(uint16_t status, uint8_t protocol, bool jr_rx, bool jr_tx,
+                               ump_endpoint_send_fn_t send, void *ctx) {
+    stream_send(stream_word0(0, status) | ((uint32_t)protocol << 8) |
+                (jr_rx ? UMP_STREAM_JR_RX : 0) | (jr_tx ? UMP_STREAM_JR_TX : 0),
+                0, 0, 0, send, ctx);
+}
+
+static void send_block(const ump_endpoint_t *ep, uint8_t index, uint8_t filter,
+                       ump_endpoint_send_fn_t send, void *ctx) {
+    const ump_function_block_t *fb = &ep->blocks[index];
+
+    if (filter & UMP_FB_DISCOVER_INFO) {
+        uint8_t hint = fb->ui_hint ? fb->ui_hint : fb->direction;
+        uint32_t w0 = stream_word0(0, UMP_STREAM_FUNCTION_BLOCK_INFO) | 0x8000u |   // Active
+                      ((uint32_t)(index & 0x7F) << 8) | ((uint32_t)(hint & 0x03) << 4) |
+                      ((uint32_t)(fb->midi1 & 0x03) << 2) | (fb->direction & 0x03);
+        uint32_t w1 = ((uint32_t)fb->first_group << 24) | ((uint32_t)fb->num_groups << 16);
+        stream_send(w0, w1, 0, 0, send, ctx);
+    }
+    if ((filter & UMP_FB_DISCOVER_NAME) && fb->name) {
+        stream_send_text(stream_word0(0, UMP_STREAM_FUNCTION_BLOCK_NAME) | ((uint32_t)index << 8),
+                         TEXT_OFFSET_BLOCK, fb->name, UMP_FB_NAME_MAX, send, ctx);
+    }
+}
+
+//=============================================================================
+// Negotiation
+//=============================================================================
+
+/**
+ * @brief Get the protocol field if this endpoint can run it, else 0
+ */
+static uint8_t supported_protocol(const ump_endpoint_t *ep, uint8_t protocol) {
+    if ((protocol == UMP_STREAM_PROTOCOL_MIDI2 && ep->info.midi2_protocol) ||
+        (protocol == UMP_STREAM_PROTOCOL_MIDI1 && ep->info.midi1_protocol)) {
+        return protocol;
+    }
+    return 0;
+}
+
+uint8_t ump_endpoint_choose_protocol(const ump_endpoint_t *endpoint,
+                                     const ump_endpoint_info_t *peer) {
+    bool midi2 = endpoint->info.midi2_protocol && peer->midi2_protocol;
+    bool midi1 = endpoint->info.midi1_protocol && peer->midi1_protocol;
+
+    if (midi2 && (endpoint->protocol == UMP_STREAM_PROTOCOL_MIDI2 || !midi1)) {
+        return UMP_STREAM_PROTOCOL_MIDI2;
+    }
+    return midi1 ? UMP_STREAM_PROTOCOL_MIDI1 : 0;
+}
+
+void ump_endpoint_link_init(const ump_endpoint_t *endpoint, ump_endpoint_link_t *link) {
+    memset(link, 0, sizeof(*link));
+    link->protocol = supported_protocol(endpoint, endpoint->protocol);
+    if (!link->protocol) {
+        link->protocol = endpoint->info.midi2_protocol ? UMP_STREAM_PROTOCOL_MIDI2
+                                                       : UMP_STREAM_PROTOCOL_MIDI1;
+    }
+}
+
+void ump_endpoint_discover(ump_endpoint_send_fn_t send, void *ctx) {
+    stream_send(stream_word0(0, UMP_STREAM_ENDPOINT_DISCOVERY) |
+                ((uint32_t)UMP_VERSION_MAJOR << 8) | UMP_VERSION_MINOR,
+                UMP_DISCOVER_ENDPOINT_INFO | UMP_DISCOVER_STREAM_CONFIG, 0, 0, send, ctx);
+}
+
+esp_err_t ump_endpoint_link_adapt(const ump_endpoint_link_t *link, ump_packet_t *ump) {
+    uint32_t w0 = ump->words[0];
+
+    switch (UMP_GET_MT(w0)) {
+        case UMP_MT_UTILITY: {
+            uint8_t status = (w0 >> 20) & 0x0F;
+            if ((status == UMP_UTILITY_JR_CLOCK || status == UMP_UTILITY_JR_TIMESTAMP) &&
+                !link->jr_tx) {
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            return ESP_OK;
+        }
+
+        case UMP_MT_MIDI2_CHANNEL_VOICE: {
+            if (link->protocol != UMP_STREAM_PROTOCOL_MIDI1) {
+                return ESP_OK;
+            }
+            midi_message_t midi1;
+            ump_packet_t out;
+            if (midi_translate_2to1(ump, &midi1) != ESP_OK ||
+                midi_translate_1to_ump1(&midi1, &out) != ESP_OK) {
+                return ESP_ERR_NOT_SUPPORTED;  // Per-note controllers etc.
+            }
+            uint32_t group = UMP_GET_GROUP(w0);
+            out.words[0] |= group << 24;
+            out.group = (uint8_t)group;
+            out.timestamp_us = ump->timestamp_us;
+            *ump = out;
+            return ESP_OK;
+        }
+
+        default:
+            return ESP_OK;
+    }
+}
+
+esp_err_t ump_endpoint_handle(const ump_endpoint_t *endpoint, ump_endpoint_link_t *link,
+                              const ump_packet_t *ump, ump_endpoint_send_fn_t send, void *ctx) {
+    if (!endpoint || !link || !ump || !send) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint32_t w0 = ump->words[0];
+    if (UMP_GET_MT(w0) != UMP_MT_UMP_STREAM) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    switch (UMP_STREAM_GET_STATUS(w0)) {
+        case UMP_STREAM_ENDPOINT_DISCOVERY: {
+            uint8_t filter = ump->words[1] & 0xFF;
+            if (filter & UMP_DISCOVER_ENDPOINT_INFO) {
+                send_endpoint_info(endpoint, send, ctx);
+            }
+            if (filter & UMP_DISCOVER_DEVICE_IDENTITY) {
+                send_device_identity(endpoint, send, ctx);
+            }
+            if ((filter & UMP_DISCOVER_ENDPOINT_NAME) && endpoint->name) {
+                stream_send_text(stream_word0(0, UMP_STREAM_ENDPOINT_NAME), TEXT_OFFSET_ENDPOINT,
+                                 endpoint->name, UMP_ENDPOINT_NAME_MAX, send, ctx);
+            }
+            if ((filter & UMP_DISCOVER_PRODUCT_INSTANCE_ID) && endpoint->product_instance_id) {
+                stream_send_text(stream_word0(0, UMP_STREAM_PRODUCT_INSTANCE_ID),
+                                 TEXT_OFFSET_ENDPOINT, endpoint->product_instance_id,
+                                 UMP_PRODUCT_INSTANCE_MAX, send, ctx);
+            }
+            if (filter & UMP_DISCOVER_STREAM_CONFIG) {
+                send_stream_config(UMP_STREAM_CONFIGURATION_NOTIFY, link->protocol,
+                                   link->jr_rx, link->jr_tx, send, ctx);
+            }
+            return ESP_OK;
+        }
+
+        case UMP_STREAM_ENDPOINT_INFO: {
+            // Peer answered our discovery: ask for the best common settings
+            uint32_t w1 = ump->words[1];
+            link->peer = (ump_endpoint_info_t){
+                .ump_version_major = (w0 >> 8) & 0xFF,
+                .ump_version_minor = w0 & 0xFF,
+                .num_function_blocks = (w1 >> 24) & 0x7F,
+                .static_function_blocks = w1 & 0x80000000u,
+                .midi2_protocol = w1 & 0x200u,
+                .midi1_protocol = w1 & 0x100u,
+                .rx_jr_timestamp = w1 & 0x02u,
+                .tx_jr_timestamp = w1 & 0x01u
+            };
+            link->peer_known = true;
+
+            uint8_t protocol = ump_endpoint_choose_protocol(endpoint, &link->peer);
+            if (protocol) {
+                // The request's JR bits are for the peer: it receives what we send
+                bool jr_rx = endpoint->info.rx_jr_timestamp && link->peer.tx_jr_timestamp;
+                bool jr_tx = endpoint->info.tx_jr_timestamp && link->peer.rx_jr_timestamp;
+                send_stream_config(UMP_STREAM_CONFIGURATION_REQUEST, protocol, jr_tx, jr_rx,
+                                   send, ctx);
+            } else {
+                ESP_LOGW(TAG, "Peer supports no protocol in common");
+            }
+            return ESP_OK;
+        }
+
+        case UMP_STREAM_CONFIGURATION_REQUEST: {
+            // Switch if we can, then report what is in effect
+            uint8_t protocol = supported_protocol(endpoint, (w0 >> 8) & 0xFF);
+            if (protocol) {
+                link->protocol = protocol;
+            }
+            link->jr_rx = (w0 & UMP_STREAM_JR_RX) && endpoint->info.rx_jr_timestamp;
+            link->jr_tx = (w0 & UMP_STREAM_JR_TX) && endpoint->info.tx_jr_timestamp;
+            link->negotiated = true;
+            send_stream_config(UMP_STREAM_CONFIGURATION_NOTIFY, link->protocol,
+                               link->jr_rx, link->jr_tx, send, ctx);
+            ESP_LOGI(TAG, "Stream configured: MIDI %s protocol%s",
+                     link->protocol == UMP_STREAM_PROTOCOL_MIDI2 ? "2.0" : "1.0",
+                     (link->jr_rx || link->jr_tx) ? ", JR timestamps" : "");
+            return ESP_OK;
+        }
+
+        case UMP_STREAM_CONFIGURATION_NOTIFY: {
+            // Peer reports its settings: follow them where we can
+            uint8_t protocol = supported_protocol(endpoint, (w0 >> 8) & 0xFF);
+            if (protocol) {
+                link->protocol = protocol;
+                link->negotiated = true;
+            }
+            link->jr_rx = (w0 & UMP_STREAM_JR_TX) && endpoint->info.rx_jr_timestamp;
+            link->jr_tx = (w0 & UMP_STREAM_JR_RX) && endpoint->info.tx_jr_timestamp;
+            return ESP_OK;
+        }
+
+        case UMP_STREAM_FUNCTION_BLOCK_DISCOVERY: {
+            uint8_t block = (w0 >> 8) & 0xFF;
+            uint8_t filter = w0 & 0xFF;
+            uint8_t count = endpoint->blocks ? endpoint->info.num_function_blocks : 0;
+            for (uint8_t i = 0; i < count; i++) {
+                if (block == UMP_FB_ALL || block == i) {
+                    send_block(endpoint, i, filter, send, ctx);
+                }
+            }
+            return ESP_OK;
+        }
+
+        case UMP_STREAM_DEVICE_IDENTITY:
+        case UMP_STREAM_ENDPOINT_NAME:
+        case UMP_STREAM_PRODUCT_INSTANCE_ID:
+        case UMP_STREAM_FUNCTION_BLOCK_INFO:
+        case UMP_STREAM_FUNCTION_BLOCK_NAME:
+            return ESP_OK;  // Peer's own notifications: nothing to answer
+
+        default:
+            return ESP_ERR_NOT_SUPPORTED;
+    }
+}
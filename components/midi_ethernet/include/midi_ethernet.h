@@ -26,12 +26,14 @@
 #include <stdbool.h>
 #include "esp_err.h"
 #include "ump_types.h"
+#include "midi_net.h"
+#include "midi_sync.h"
 #include "esp_eth.h"
 
-// Reuse WiFi types for consistency (same Network MIDI 2.0 protocol)
-typedef struct midi_wifi_peer midi_ethernet_peer_t;
+// Same Network MIDI 2.0 session engine as WiFi (midi_net.h)
+typedef midi_net_peer_t midi_ethernet_peer_t;
 typedef struct midi_wifi_discovered_device midi_ethernet_discovered_device_t;
-typedef enum midi_wifi_session_state midi_ethernet_session_state_t;
+typedef midi_net_peer_state_t midi_ethernet_session_state_t;
 
 /**
  * @brief UMP receive callback
@@ -77,9 +79,8 @@ typedef struct {
     char endpoint_name[64];     /**< UMP Endpoint name */
     uint8_t max_clients;        /**< Max simultaneous clients */
     
-    bool enable_fec;            /**< Forward Error Correction */
-    bool enable_retransmit;     /**< Retransmit support */
-    uint16_t retransmit_buffer_size;
+    bool enable_fec;            /**< Repeat MIDI_NET_FEC_DEPTH earlier commands per datagram */
+    bool enable_retransmit;     /**< Ask peers to resend gaps (history: MIDI_NET_HISTORY_SIZE) */
     
     bool enable_mdns;           /**< mDNS discovery */
     
@@ -165,6 +166,25 @@ esp_err_t midi_ethernet_send_ump_to(const ump_packet_t *ump,
  */
 esp_err_t midi_ethernet_get_stats(midi_ethernet_stats_t *stats);
 
+/**
+ * @brief Reset statistics
+ * 
+ * Safe from any task; each shard is cleared by its writer.
+ * 
+ * @return ESP_OK on success
+ */
+esp_err_t midi_ethernet_reset_stats(void);
+
+/**
+ * @brief Get clock sync state
+ * 
+ * @param stats Output: offset achieved and path delay (slave role)
+ * @param locked Output: shared timebase follows the master (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if clock sync does
+ *         not run on Ethernet
+ */
+esp_err_t midi_ethernet_get_sync_stats(midi_sync_stats_t *stats, bool *locked);
+
 /**
  * @brief Get local IP address
  * 
@@ -0,0 +1,67 @@
+/**
+ * @file midi_ethernet_session.h
+ * @brief Ethernet MIDI Session Management - Internal API
+ * 
+ * Network MIDI 2.0 sessions on the W5500 UDP socket, on the same
+ * engine (midi_net.h) as WiFi; per-peer deadlines run on the shared
+ * timer wheel
+ */
+
+#ifndef MIDI_ETHERNET_SESSION_H
+#define MIDI_ETHERNET_SESSION_H
+
+#include "midi_ethernet.h"
+#include "lwip/sockets.h"
+
+/**
+ * @brief Initialize session manager
+ * 
+ * @param config Ethernet MIDI configuration
+ * @param sock_fd Bound UDP socket datagrams are sent from
+ * @return ESP_OK on success
+ */
+esp_err_t midi_ethernet_session_init(const midi_ethernet_config_t *config, int sock_fd);
+
+/**
+ * @brief Deinitialize session manager
+ * 
+ * Sends Bye to every peer.
+ * 
+ * @return ESP_OK on success
+ */
+esp_err_t midi_ethernet_session_deinit(void);
+
+/**
+ * @brief Handle incoming packet
+ * 
+ * @param data Datagram
+ * @param len Datagram length
+ * @param src Sender address
+ * @return ESP_OK on success
+ */
+esp_err_t midi_ethernet_session_handle_packet(const uint8_t *data, size_t len,
+                                               const struct sockaddr_in *src);
+
+/**
+ * @brief Send UMP to every established session
+ * 
+ * @param ump UMP packet
+ * @param sent Output: sessions it went to (may be NULL)
+ * @return ESP_OK on success
+ */
+esp_err_t midi_ethernet_session_send_ump(const ump_packet_t *ump, uint8_t *sent);
+
+/**
+ * @brief Number of established sessions
+ */
+uint8_t midi_ethernet_session_count(void);
+
+/**
+ * @brief Session engine loss and recovery totals
+ * 
+ * @param stats Output totals
+ * @param reset Clear them after reading
+ */
+void midi_ethernet_session_stats(midi_net_stats_t *stats, bool reset);
+
+#endif /* MIDI_ETHERNET_SESSION_H */
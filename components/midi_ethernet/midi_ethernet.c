@@ -7,6 +7,7 @@
 
 #include "midi_ethernet.h"
 #include "midi_ethernet_session.h"
+#include "midi_stats.h"
 #include "esp_log.h"
 #include "esp_eth.h"
 #include "esp_event.h"
@@ -27,8 +28,8 @@ static const char *TAG = "midi_eth";
 #define ETH_GOT_IP_BIT       BIT1
 
 // Network MIDI 2.0 constants (same as WiFi)
-#define MIDI_ETH_DEFAULT_PORT  5004
-#define MIDI_ETH_MTU           1472
+#define MIDI_ETH_DEFAULT_PORT  MIDI_NET_DEFAULT_PORT
+#define MIDI_ETH_MTU           MIDI_NET_MTU
 #define MIDI_ETH_SERVICE_NAME  "_midi2._udp"
 
 // Forward declarations
@@ -40,6 +41,20 @@ extern esp_err_t midi_ethernet_w5500_init_driver(const midi_ethernet_config_t *c
 extern esp_err_t midi_ethernet_w5500_configure_ip(esp_netif_t *netif,
                                                    const midi_ethernet_config_t *config);
 
+/**
+ * @brief Statistics shards, one per writer (see midi_stats.h)
+ */
+typedef enum {
+    ETH_STATS_RX,                 // RX task
+    ETH_STATS_TX,                 // Send path, under tx_mutex
+    ETH_STATS_SHARDS
+} eth_stats_shard_id_t;
+
+typedef struct {
+    uint32_t generation;
+    midi_ethernet_stats_t stats;
+} eth_stats_shard_t;
+
 /**
  * @brief Ethernet MIDI driver state
  */
@@ -48,7 +63,10 @@ typedef struct {
     bool link_up;
     bool ip_assigned;
     midi_ethernet_config_t config;
-    midi_ethernet_stats_t stats;
+    
+    // Statistics (folded by midi_ethernet_get_stats)
+    midi_stats_epoch_t stats_epoch;
+    eth_stats_shard_t stats_shards[ETH_STATS_SHARDS];
     
     // Hardware
     spi_device_handle_t spi_handle;
@@ -62,20 +80,24 @@ typedef struct {
     
     // Tasks
     TaskHandle_t rx_task_handle;
-    TaskHandle_t keepalive_task_handle;
-    
-    // Session management (reuse WiFi session code)
-    midi_ethernet_peer_t peers[CONFIG_MIDI_ETH_MAX_CLIENTS];
-    uint8_t num_active_peers;
-    SemaphoreHandle_t peers_mutex;
     
-    // Sequence number
-    uint32_t tx_sequence_num;
+    // Sessions live in midi_ethernet_session.c; this serializes senders
+    SemaphoreHandle_t tx_mutex;
     
 } midi_ethernet_state_t;
 
 static midi_ethernet_state_t g_eth_state = {0};
 
+/**
+ * @brief Writer's statistics shard, cleared first if a reset is pending
+ */
+static inline midi_ethernet_stats_t *eth_stats(eth_stats_shard_id_t id) {
+    eth_stats_shard_t *shard = &g_eth_state.stats_shards[id];
+    midi_stats_shard_sync(&g_eth_state.stats_epoch, &shard->generation,
+                          &shard->stats, sizeof(shard->stats));
+    return &shard->stats;
+}
+
 /**
  * @brief Ethernet event handler[web:276][web:277]
  */
@@ -86,14 +108,12 @@ static void eth_event_handler(void* arg, esp_event_base_t event_base,
             case ETHERNET_EVENT_CONNECTED:
                 ESP_LOGI(TAG, "Ethernet link up");
                 g_eth_state.link_up = true;
-                g_eth_state.stats.link_up = true;
                 xEventGroupSetBits(g_eth_state.eth_event_group, ETH_LINK_UP_BIT);
                 break;
                 
             case ETHERNET_EVENT_DISCONNECTED:
                 ESP_LOGI(TAG, "Ethernet link down");
                 g_eth_state.link_up = false;
-                g_eth_state.stats.link_up = false;
                 xEventGroupClearBits(g_eth_state.eth_event_group, ETH_LINK_UP_BIT);
                 break;
                 
@@ -116,7 +136,6 @@ static void eth_event_handler(void* arg, esp_event_base_t event_base,
             ESP_LOGI(TAG, "Gateway: " IPSTR, IP2STR(&event->ip_info.gw));
             
             g_eth_state.ip_assigned = true;
-            g_eth_state.stats.ip_assigned = true;
             xEventGroupSetBits(g_eth_state.eth_event_group, ETH_GOT_IP_BIT);
         }
     }
@@ -173,14 +192,10 @@ static void midi_ethernet_rx_task(void *arg) {
                           (struct sockaddr *)&src_addr, &src_addr_len);
         
         if (len > 0) {
-            char src_ip[16];
-            inet_ntoa_r(src_addr.sin_addr, src_ip, sizeof(src_ip));
-            uint16_t src_port = ntohs(src_addr.sin_port);
-            
-            g_eth_state.stats.packets_rx_total++;
+            eth_stats(ETH_STATS_RX)->packets_rx_total++;
             
-            // Handle via session manager (same as WiFi)
-            midi_ethernet_session_handle_packet(rx_buffer, len, src_ip, src_port);
+            // Handle via session manager (same engine as WiFi)
+            midi_ethernet_session_handle_packet(rx_buffer, len, &src_addr);
             
         } else if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
             ESP_LOGW(TAG, "recvfrom failed: errno %d", errno);
@@ -189,21 +204,6 @@ static void midi_ethernet_rx_task(void *arg) {
     }
 }
 
-/**
- * @brief Keepalive task
- */
-static void midi_ethernet_keepalive_task(void *arg) {
-    ESP_LOGI(TAG, "Keepalive task started");
-    
-    while (1) {
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        
-        if (g_eth_state.link_up && g_eth_state.num_active_peers > 0) {
-            midi_ethernet_session_send_keepalive();
-        }
-    }
-}
-
 /**
  * @brief Initialize mDNS service[file:4]
  */
@@ -268,7 +268,7 @@ esp_err_t midi_ethernet_init(const midi_ethernet_config_t *config) {
     g_eth_state.eth_event_group = xEventGroupCreate();
     
     // Create mutexes
-    g_eth_state.peers_mutex = xSemaphoreCreateMutex();
+    g_eth_state.tx_mutex = xSemaphoreCreateMutex();
     
     // Initialize ESP-IDF networking
     ESP_ERROR_CHECK(esp_netif_init());
@@ -330,6 +330,9 @@ esp_err_t midi_ethernet_wait_for_link(uint32_t timeout_ms) {
         esp_err_t err = udp_socket_init();
         if (err != ESP_OK) return err;
         
+        err = midi_ethernet_session_init(&g_eth_state.config, g_eth_state.sock_fd);
+        if (err != ESP_OK) return err;
+        
         // Initialize mDNS
         err = mdns_init_service();
         if (err != ESP_OK) return err;
@@ -337,8 +340,6 @@ esp_err_t midi_ethernet_wait_for_link(uint32_t timeout_ms) {
         // Create tasks
         xTaskCreate(midi_ethernet_rx_task, "midi_eth_rx", 4096, NULL, 10,
                    &g_eth_state.rx_task_handle);
-        xTaskCreate(midi_ethernet_keepalive_task, "midi_eth_ka", 2048, NULL, 5,
-                   &g_eth_state.keepalive_task_handle);
         
         return ESP_OK;
     }
@@ -354,48 +355,71 @@ esp_err_t midi_ethernet_send_ump(const ump_packet_t *ump) {
         return ESP_ERR_INVALID_STATE;
     }
     
-    // Build packet (same format as WiFi)
-    uint8_t payload[MIDI_ETH_MTU];
-    payload[0] = 0x00;  // PKT_UMP
-    uint32_t seq = g_eth_state.tx_sequence_num++;
-    memcpy(&payload[1], &seq, 4);
-    
-    uint32_t ump_bytes = ump->num_words * 4;
-    memcpy(&payload[5], ump->words, ump_bytes);
-    size_t payload_len = 5 + ump_bytes;
-    
-    // Send to all peers
-    xSemaphoreTake(g_eth_state.peers_mutex, portMAX_DELAY);
-    
-    for (int i = 0; i < g_eth_state.num_active_peers; i++) {
-        midi_ethernet_peer_t *peer = &g_eth_state.peers[i];
-        
-        struct sockaddr_in dest_addr;
-        dest_addr.sin_family = AF_INET;
-        dest_addr.sin_port = htons(peer->port);
-        inet_pton(AF_INET, peer->ip_addr, &dest_addr.sin_addr);
-        
-        sendto(g_eth_state.sock_fd, payload, payload_len, 0,
-              (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-        
-        peer->packets_tx++;
-        g_eth_state.stats.packets_tx_total++;
+    if (!ump) {
+        return ESP_ERR_INVALID_ARG;
     }
     
-    xSemaphoreGive(g_eth_state.peers_mutex);
+    // One UMP Data command per session (same engine as WiFi)
+    xSemaphoreTake(g_eth_state.tx_mutex, portMAX_DELAY);
+    uint8_t sent = 0;
+    esp_err_t err = midi_ethernet_session_send_ump(ump, &sent);
+    eth_stats(ETH_STATS_TX)->packets_tx_total += sent;
+    xSemaphoreGive(g_eth_state.tx_mutex);
     
-    return ESP_OK;
+    return err;
 }
 
-// ... (additional helper functions similar to WiFi implementation)
-
 bool midi_ethernet_is_link_up(void) {
     return g_eth_state.link_up;
 }
 
+esp_err_t midi_ethernet_get_local_ip(char *ip_str) {
+    if (!ip_str) return ESP_ERR_INVALID_ARG;
+    if (!g_eth_state.netif || !g_eth_state.ip_assigned) return ESP_ERR_INVALID_STATE;
+    
+    esp_netif_ip_info_t ip_info;
+    esp_err_t err = esp_netif_get_ip_info(g_eth_state.netif, &ip_info);
+    if (err == ESP_OK) {
+        esp_ip4addr_ntoa(&ip_info.ip, ip_str, 16);
+    }
+    return err;
+}
+
+esp_err_t midi_ethernet_get_mac(uint8_t *mac) {
+    if (!mac) return ESP_ERR_INVALID_ARG;
+    if (!g_eth_state.initialized) return ESP_ERR_INVALID_STATE;
+    return esp_eth_ioctl(g_eth_state.eth_handle, ETH_CMD_G_MAC_ADDR, mac);
+}
+
 esp_err_t midi_ethernet_get_stats(midi_ethernet_stats_t *stats) {
     if (!stats) return ESP_ERR_INVALID_ARG;
-    *stats = g_eth_state.stats;
-    stats->active_sessions = g_eth_state.num_active_peers;
+    memset(stats, 0, sizeof(*stats));
+    
+    for (int i = 0; i < ETH_STATS_SHARDS; i++) {
+        const eth_stats_shard_t *shard = &g_eth_state.stats_shards[i];
+        if (!midi_stats_shard_current(&g_eth_state.stats_epoch, &shard->generation)) {
+            continue;
+        }
+        stats->packets_rx_total += shard->stats.packets_rx_total;
+        stats->packets_tx_total += shard->stats.packets_tx_total;
+        stats->packets_lost_total += shard->stats.packets_lost_total;
+        stats->packets_recovered_fec += shard->stats.packets_recovered_fec;
+    }
+    
+    midi_net_stats_t sessions;
+    midi_ethernet_session_stats(&sessions, false);
+    stats->packets_lost_total += sessions.packets_lost;
+    stats->packets_recovered_fec += sessions.packets_recovered_fec;
+    
+    stats->active_sessions = midi_ethernet_session_count();
+    stats->link_up = g_eth_state.link_up;
+    stats->ip_assigned = g_eth_state.ip_assigned;
+    return ESP_OK;
+}
+
+esp_err_t midi_ethernet_reset_stats(void) {
+    midi_net_stats_t sessions;
+    midi_stats_epoch_advance(&g_eth_state.stats_epoch);
+    midi_ethernet_session_stats(&sessions, true);
     return ESP_OK;
 }
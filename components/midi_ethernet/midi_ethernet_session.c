@@ -2,32 +2,310 @@
  * @file midi_ethernet_session.c
  * @brief Ethernet MIDI Session Management
  * 
- * Reuses WiFi session logic (same Network MIDI 2.0 protocol)
+ * Same Network MIDI 2.0 session engine as WiFi (midi_net.h), bound to
+ * the W5500 UDP socket; clock sync messages (midi_sync.h) on that
+ * socket go to the sync engine
  */
 
 #include "midi_ethernet.h"
 #include "midi_ethernet_session.h"
+#include "midi_router.h"
+#include "midi_capture.h"
+#include "midi_timer_wheel.h"
+#include "midi_sync.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string.h>
 
-// External state
-extern midi_ethernet_state_t g_eth_state;
+static const char *TAG = "eth_session";
 
-// Reuse WiFi session implementation with minor adaptations
-// (Session protocol is identical for WiFi and Ethernet)[file:4]
+static midi_net_t s_net;
+static midi_ethernet_peer_t s_peers[CONFIG_MIDI_ETH_MAX_CLIENTS];
+static midi_timer_t s_peer_timers[CONFIG_MIDI_ETH_MAX_CLIENTS]; // Next deadline per slot
+static SemaphoreHandle_t s_peers_mutex;
+static midi_ethernet_config_t s_config;
+static int s_sock_fd = -1;
+static midi_sync_t s_sync;                  // Role off unless configured (under s_peers_mutex)
+static midi_timer_t s_sync_timer;
 
-esp_err_t midi_ethernet_session_init(const midi_ethernet_config_t *config) {
-    // Initialize session manager
+/**
+ * @brief Engine send callback: one datagram to the peer
+ */
+static esp_err_t session_send(const midi_net_addr_t *to, const uint8_t *data, size_t len,
+                              void *ctx) {
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(to->port),
+        .sin_addr.s_addr = to->ip
+    };
+    
+    int sent = sendto(s_sock_fd, data, len, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    return (sent == (int)len) ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Engine UMP callback: capture, then hand to the application
+ */
+static void session_ump(const midi_net_peer_t *peer, const ump_packet_t *ump, void *ctx) {
+    midi_capture_rx(MIDI_TRANSPORT_ETHERNET, MIDI_CAPTURE_UMP, ump->words, ump->num_words * 4);
+    
+    if (s_config.rx_callback) {
+        s_config.rx_callback(ump, peer, s_config.callback_ctx);
+    }
+}
+
+/**
+ * @brief Engine session callback: a peer came or went
+ */
+static void session_changed(const midi_net_peer_t *peer, bool up, void *ctx) {
+    // The engine negotiates the session's protocol itself (session_endpoint)
+    if (!up) {
+        midi_router_source_lost(MIDI_TRANSPORT_ETHERNET);
+    }
+    
+    if (s_config.conn_callback) {
+        s_config.conn_callback(peer, up, s_config.callback_ctx);
+    }
+}
+
+/**
+ * @brief Engine endpoint callback: sessions negotiate as the router's endpoint
+ */
+static const ump_endpoint_t *session_endpoint(void *ctx) {
+    return midi_router_get_endpoint();
+}
+
+/**
+ * @brief Engine schedule callback: move the slot's timer on the shared wheel
+ */
+static void session_schedule(midi_net_peer_t *peer, int64_t due_us, void *ctx) {
+    midi_timer_t *timer = &s_peer_timers[peer - s_peers];
+    
+    if (due_us) {
+        midi_timer_start(timer, due_us);
+    } else {
+        midi_timer_stop(timer);
+    }
+}
+
+/**
+ * @brief A slot's deadline passed (timer task)
+ */
+static void session_timer(midi_timer_t *timer, void *ctx) {
+    xSemaphoreTake(s_peers_mutex, portMAX_DELAY);
+    midi_net_expire(&s_net, ctx, esp_timer_get_time());
+    xSemaphoreGive(s_peers_mutex);
+}
+
+#ifdef CONFIG_MIDI_ETH_CLOCK_SYNC
+/**
+ * @brief Sync engine clock: stamps taken right after a send
+ */
+static int64_t sync_clock(void *ctx) {
+    return esp_timer_get_time();
+}
+
+/**
+ * @brief Sync period passed (timer task)
+ */
+static void sync_timer(midi_timer_t *timer, void *ctx) {
+    xSemaphoreTake(s_peers_mutex, portMAX_DELAY);
+    int64_t next_us = midi_sync_expire(&s_sync, esp_timer_get_time());
+    bool running = (s_sync.config.role != MIDI_SYNC_ROLE_OFF);
+    xSemaphoreGive(s_peers_mutex);
+    
+    if (running) {
+        midi_timer_start(timer, next_us);
+    }
+}
+
+/**
+ * @brief Start clock sync in the configured role
+ */
+static esp_err_t sync_start(void) {
+    midi_sync_config_t sync_config;
+    midi_sync_config_default(&sync_config);
+    sync_config.send = session_send;
+    sync_config.clock = sync_clock;
+#ifdef CONFIG_MIDI_SYNC_ROLE_SLAVE
+    struct in_addr master;
+    if (inet_pton(AF_INET, CONFIG_MIDI_SYNC_MASTER_IP, &master) != 1) {
+        ESP_LOGE(TAG, "Bad clock sync master address %s", CONFIG_MIDI_SYNC_MASTER_IP);
+        return ESP_ERR_INVALID_ARG;
+    }
+    sync_config.master.ip = master.s_addr;
+    sync_config.master.port = CONFIG_MIDI_SYNC_MASTER_PORT;
+#endif
+    
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(s_peers_mutex, portMAX_DELAY);
+    midi_timer_stop(&s_sync_timer); // Re-init after a link loss
+    esp_err_t err = midi_sync_init(&s_sync, &sync_config, now);
+    xSemaphoreGive(s_peers_mutex);
+    
+    if (err == ESP_OK) {
+        midi_timer_init(&s_sync_timer, sync_timer, NULL);
+        midi_timer_start(&s_sync_timer, now);
+        ESP_LOGI(TAG, "Clock sync started as %s",
+                 sync_config.role == MIDI_SYNC_ROLE_MASTER ? "master" : "slave");
+    }
+    return err;
+}
+#endif
+
+esp_err_t midi_ethernet_session_init(const midi_ethernet_config_t *config, int sock_fd) {
+    if (!s_peers_mutex) {
+        s_peers_mutex = xSemaphoreCreateMutex();
+        if (!s_peers_mutex) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    esp_err_t err = midi_timer_service_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    
+    s_config = *config;
+    s_sock_fd = sock_fd;
+    
+    midi_net_config_t net_config = {
+        .name = s_config.endpoint_name,
+        .accept_invitations = true,
+        .fec_depth = config->enable_fec ? MIDI_NET_FEC_DEPTH : 0,
+        .retransmit = config->enable_retransmit,
+        .send = session_send,
+        .on_ump = session_ump,
+        .on_session = session_changed,
+        .schedule = session_schedule,
+        .endpoint = session_endpoint
+    };
+    
+    xSemaphoreTake(s_peers_mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_MIDI_ETH_MAX_CLIENTS; i++) {
+        midi_timer_stop(&s_peer_timers[i]); // Re-init after a link loss
+        midi_timer_init(&s_peer_timers[i], session_timer, &s_peers[i]);
+    }
+    err = midi_net_init(&s_net, &net_config, s_peers, CONFIG_MIDI_ETH_MAX_CLIENTS);
+    xSemaphoreGive(s_peers_mutex);
+    
+#ifdef CONFIG_MIDI_ETH_CLOCK_SYNC
+    if (err == ESP_OK) {
+        err = sync_start();
+    }
+#endif
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Session manager initialized");
+    }
+    return err;
+}
+
+esp_err_t midi_ethernet_session_deinit(void) {
+    if (!s_peers_mutex) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    xSemaphoreTake(s_peers_mutex, portMAX_DELAY);
+    midi_net_close_all(&s_net, MIDI_NET_BYE_POWER_DOWN, esp_timer_get_time());
+    s_sync.config.role = MIDI_SYNC_ROLE_OFF; // A sync tick already due does not rearm
+    xSemaphoreGive(s_peers_mutex);
+    midi_timer_stop(&s_sync_timer);
+    
     return ESP_OK;
 }
 
 esp_err_t midi_ethernet_session_handle_packet(const uint8_t *data, size_t len,
-                                               const char *src_ip, uint16_t src_port) {
-    // Handle incoming packet (same logic as WiFi)
-    // Parse packet type, update peer state, call callbacks
-    // Implementation identical to midi_wifi_session.c
+                                               const struct sockaddr_in *src) {
+    midi_net_addr_t from = {
+        .ip = src->sin_addr.s_addr,
+        .port = ntohs(src->sin_port)
+    };
+    int64_t now = esp_timer_get_time(); // Before the lock: sync timestamps want arrival
+    
+    xSemaphoreTake(s_peers_mutex, portMAX_DELAY);
+    esp_err_t err = midi_sync_match(data, len)
+                    ? midi_sync_receive(&s_sync, &from, data, len, now)
+                    : midi_net_receive(&s_net, &from, data, len, now);
+    xSemaphoreGive(s_peers_mutex);
+    
+    if (err != ESP_OK) {
+        ESP_LOGD(TAG, "Ignored %u-byte datagram: %s", (unsigned)len, esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t midi_ethernet_session_send_ump(const ump_packet_t *ump, uint8_t *sent) {
+    if (sent) {
+        *sent = 0;
+    }
+    if (!s_peers_mutex) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    xSemaphoreTake(s_peers_mutex, portMAX_DELAY);
+    esp_err_t err = midi_net_send_ump(&s_net, ump->words, ump->num_words, esp_timer_get_time());
+    if (sent && err == ESP_OK) {
+        *sent = midi_net_num_sessions(&s_net);
+    }
+    xSemaphoreGive(s_peers_mutex);
+    
+    return err;
+}
+
+uint8_t midi_ethernet_session_count(void) {
+    return midi_net_num_sessions(&s_net);
+}
+
+esp_err_t midi_ethernet_get_peers(midi_ethernet_peer_t *peers, uint8_t max_peers,
+                                  uint8_t *num_peers) {
+    if (!peers || !num_peers) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_peers_mutex) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    *num_peers = 0;
+    xSemaphoreTake(s_peers_mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_MIDI_ETH_MAX_CLIENTS && *num_peers < max_peers; i++) {
+        if (s_peers[i].state == MIDI_NET_PEER_ESTABLISHED) {
+            peers[(*num_peers)++] = s_peers[i];
+        }
+    }
+    xSemaphoreGive(s_peers_mutex);
+    
     return ESP_OK;
 }
 
-esp_err_t midi_ethernet_session_send_keepalive(void) {
-    // Send keepalive to all active peers
+void midi_ethernet_session_stats(midi_net_stats_t *stats, bool reset) {
+    if (!s_peers_mutex) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    
+    xSemaphoreTake(s_peers_mutex, portMAX_DELAY);
+    *stats = s_net.stats;
+    if (reset) {
+        memset(&s_net.stats, 0, sizeof(s_net.stats));
+    }
+    xSemaphoreGive(s_peers_mutex);
+}
+
+esp_err_t midi_ethernet_get_sync_stats(midi_sync_stats_t *stats, bool *locked) {
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_peers_mutex || s_sync.config.role == MIDI_SYNC_ROLE_OFF) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    
+    xSemaphoreTake(s_peers_mutex, portMAX_DELAY);
+    *stats = s_sync.stats;
+    if (locked) {
+        *locked = midi_sync_locked(&s_sync);
+    }
+    xSemaphoreGive(s_peers_mutex);
+    
     return ESP_OK;
 }
@@ -0,0 +1,217 @@
+/**
+ * @file midi_loopback.h
+ * @brief Virtual Transport for Router Load Testing
+ *
+ * A loopback port is a transport with no hardware behind it. As a
+ * source it injects generated traffic (note bursts, CC sweeps, clock,
+ * SysEx dumps) through midi_router_send() at a paced rate; as a
+ * destination it captures what the router delivers, with the ingress
+ * to TX latency of every packet.
+ *
+ * Ports register through the transport driver interface, either in a
+ * free run-time slot or standing in for a built-in transport, so the
+ * whole pipeline (ingress, workers, rules, translation, destination
+ * queues) is exercised exactly as with real hardware. Nothing here
+ * touches a peripheral: the same code runs on the target and under the
+ * IDF linux target for host-side load tests.
+ */
+
+#ifndef MIDI_LOOPBACK_H
+#define MIDI_LOOPBACK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "midi_router.h"
+#include "midi_capture.h"
+
+/** Pass as midi_loopback_config_t::transport to take a free run-time slot */
+#define MIDI_LOOPBACK_NEW_ID    ((midi_transport_t)0xFF)
+
+/** Latency histogram: exact below 32 us, then 16 buckets per octave */
+#define MIDI_LOOPBACK_HIST_LINEAR     32
+#define MIDI_LOOPBACK_HIST_BUCKETS    (MIDI_LOOPBACK_HIST_LINEAR + 27 * 16)
+
+/**
+ * @brief Traffic shapes the injector can generate
+ */
+typedef enum {
+    MIDI_LOOPBACK_NOTES,          /**< Note On/Off pairs walking up the keyboard */
+    MIDI_LOOPBACK_CC_SWEEP,       /**< One controller swept 0..127 and back */
+    MIDI_LOOPBACK_CLOCK,          /**< Timing clock (realtime) */
+    MIDI_LOOPBACK_SYSEX_DUMP      /**< SysEx dumps of a fixed size */
+} midi_loopback_pattern_t;
+
+/**
+ * @brief One captured packet
+ */
+typedef struct {
+    uint32_t time_us;             /**< When the router handed it over (low 32 bits) */
+    uint32_t latency_us;          /**< Router ingress to TX */
+    uint8_t source;               /**< midi_transport_t it came from */
+    uint8_t format;               /**< MIDI_FORMAT_* as delivered */
+    uint32_t word0;               /**< Status and data bytes, or UMP word 0 */
+} midi_loopback_record_t;
+
+/**
+ * @brief Port configuration
+ */
+typedef struct {
+    const char *name;             /**< Transport name shown in logs */
+    uint8_t native_format;        /**< Format the router translates deliveries to */
+    midi_transport_t transport;   /**< Built-in ID to stand in for, or MIDI_LOOPBACK_NEW_ID */
+    midi_loopback_record_t *records; /**< Capture ring (NULL = counters only) */
+    size_t record_capacity;       /**< Entries in records */
+    midi_capture_t *log;          /**< Also log deliveries here, e.g. to diff replays (may be NULL) */
+} midi_loopback_config_t;
+
+/**
+ * @brief Traffic to inject
+ */
+typedef struct {
+    midi_loopback_pattern_t pattern;
+    uint8_t format;               /**< MIDI_FORMAT_1_0 or MIDI_FORMAT_2_0 (UMP) */
+    uint8_t channel;              /**< Channel for channel voice patterns */
+    uint32_t rate_hz;             /**< Packets per second (0 = as fast as accepted) */
+    uint32_t count;               /**< Packets to inject */
+    uint16_t burst;               /**< Packets sent back to back per pacing slot (0 = 1) */
+    uint16_t sysex_length;        /**< Payload bytes per SysEx dump (0 = 64) */
+} midi_loopback_stream_t;
+
+/**
+ * @brief Injection outcome
+ */
+typedef struct {
+    uint32_t accepted;            /**< Taken by midi_router_send() */
+    uint32_t refused;             /**< Rejected at ingress (queue full) */
+    uint32_t elapsed_us;          /**< Wall time of the injection */
+} midi_loopback_inject_result_t;
+
+/**
+ * @brief Loopback port state
+ *
+ * Capture fields are written by the router worker that owns the port
+ * as a destination; read them between runs, not during one.
+ */
+typedef struct {
+    midi_transport_t id;          /**< Transport ID in use */
+    bool dynamic;                 /**< Took a run-time slot */
+    midi_transport_ops_t ops;     /**< Driver interface handed to the router */
+    midi_loopback_record_t *records;
+    size_t record_capacity;
+    midi_capture_t *log;
+    uint32_t seq;                 /**< Injector position in its patterns */
+
+    volatile uint32_t captured;   /**< Packets delivered to this port */
+    volatile uint32_t last_time_us; /**< When the latest one was delivered */
+    uint32_t received[MIDI_TRANSPORT_COUNT]; /**< Delivered, per source */
+    uint32_t latency_max_us;
+    uint64_t latency_sum_us;
+    uint32_t histogram[MIDI_LOOPBACK_HIST_BUCKETS];
+
+    uint32_t injected;            /**< Packets accepted from this port */
+    uint32_t refused;             /**< Packets the router turned away */
+} midi_loopback_t;
+
+/**
+ * @brief Load measurement settings
+ */
+typedef struct {
+    midi_loopback_stream_t stream; /**< Traffic shape; rate_hz and count are set per step */
+    uint32_t start_rate_hz;       /**< First rate tried (0 = 1000) */
+    uint32_t max_rate_hz;         /**< Stop doubling here (0 = 200000) */
+    uint32_t step_ms;             /**< Injection time per step (0 = 200) */
+    uint32_t latency_limit_us;    /**< Highest acceptable p99 (0 = 1000) */
+} midi_loopback_load_config_t;
+
+/**
+ * @brief Result of a load measurement for one route
+ */
+typedef struct {
+    uint32_t sustained_rate_hz;   /**< Highest rate with no loss and p99 in limit (0 = none) */
+    uint32_t failing_rate_hz;     /**< Lowest rate that failed (0 = max rate held) */
+    uint32_t p50_us;              /**< Latency percentiles at the sustained rate */
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+    uint32_t delivered;           /**< Packets captured at the sustained rate */
+    uint32_t lost;                /**< Packets lost or refused at the failing rate */
+} midi_loopback_report_t;
+
+/**
+ * @brief Register a loopback port with the router
+ *
+ * The router must be initialised. A port standing in for a built-in
+ * transport replaces whatever driver was attached there.
+ *
+ * @param lb Port state (must stay valid until destroyed)
+ * @param config Port configuration
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, or ESP_ERR_NO_MEM if no slot is free
+ */
+esp_err_t midi_loopback_create(midi_loopback_t *lb, const midi_loopback_config_t *config);
+
+/**
+ * @brief Detach the port from the router
+ */
+esp_err_t midi_loopback_destroy(midi_loopback_t *lb);
+
+/**
+ * @brief Clear capture records, counters and the latency histogram
+ */
+void midi_loopback_reset(midi_loopback_t *lb);
+
+/**
+ * @brief Inject a stream from this port, paced at the stream's rate
+ *
+ * Blocks the calling task for the duration of the stream. Packets the
+ * router refuses are counted, not retried.
+ *
+ * @param lb Source port
+ * @param stream Traffic to generate
+ * @param result Output: injection outcome (may be NULL)
+ * @return ESP_OK, or ESP_ERR_INVALID_ARG
+ */
+esp_err_t midi_loopback_inject(midi_loopback_t *lb, const midi_loopback_stream_t *stream,
+                               midi_loopback_inject_result_t *result);
+
+/**
+ * @brief Wait until a port has captured a number of packets
+ *
+ * @param lb Destination port
+ * @param count Total of captured to wait for
+ * @param idle_ms Give up after this long without progress
+ * @return true if count was reached
+ */
+bool midi_loopback_wait(midi_loopback_t *lb, uint32_t count, uint32_t idle_ms);
+
+/**
+ * @brief Latency below which a share of captured packets fall
+ *
+ * Resolution is 1 us below 32 us and 1/16 of the value above.
+ *
+ * @param lb Destination port
+ * @param permille Share in thousandths (500 = median, 990 = p99)
+ * @return Latency in microseconds (0 if nothing was captured)
+ */
+uint32_t midi_loopback_latency_percentile(const midi_loopback_t *lb, uint16_t permille);
+
+/**
+ * @brief Find the highest rate a route sustains
+ *
+ * Doubles the rate from start_rate_hz until a step loses packets or its
+ * p99 exceeds the limit (twice in a row), then bisects between the last
+ * good and first failing rate. The caller sets up the route from src to dst (and only
+ * that route) beforehand.
+ *
+ * @param src Injecting port
+ * @param dst Capturing port
+ * @param config Measurement settings
+ * @param report Output: sustained rate and latency at that rate
+ * @return ESP_OK, or ESP_ERR_INVALID_ARG
+ */
+esp_err_t midi_loopback_measure(midi_loopback_t *src, midi_loopback_t *dst,
+                                const midi_loopback_load_config_t *config,
+                                midi_loopback_report_t *report);
+
+#endif // MIDI_LOOPBACK_H
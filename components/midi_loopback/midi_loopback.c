@@ -0,0 +1,493 @@
+/**
+ * @file midi_loopback.c
+ * @brief Virtual Transport Implementation
+ */
+
+#include "midi_loopback.h"
+#include "midi_defs.h"
+#include "midi_parser.h"
+#include "midi_translator.h"
+#include "ump_defs.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char *TAG = "MIDI_LOOPBACK";
+
+#define LOOPBACK_SYSEX_MAX      512
+#define LOOPBACK_SYSEX_DEFAULT  64
+#define LOOPBACK_NOTE_BASE      36
+#define LOOPBACK_NOTE_SPAN      48
+#define LOOPBACK_VELOCITY       100
+#define LOOPBACK_SWEEP_CC       1
+#define LOOPBACK_SEARCH_STEPS   4
+
+static uint8_t s_sysex_payload[LOOPBACK_SYSEX_MAX];
+
+//=============================================================================
+// Capture
+//=============================================================================
+
+static uint16_t latency_bucket(uint32_t us) {
+    if (us < MIDI_LOOPBACK_HIST_LINEAR) {
+        return us;
+    }
+    int octave = 31 - __builtin_clz(us);    // 5..31
+    return MIDI_LOOPBACK_HIST_LINEAR + (octave - 5) * 16 + ((us >> (octave - 4)) & 0x0F);
+}
+
+static uint32_t bucket_floor(uint16_t bucket) {
+    if (bucket < MIDI_LOOPBACK_HIST_LINEAR) {
+        return bucket;
+    }
+    bucket -= MIDI_LOOPBACK_HIST_LINEAR;
+    int octave = 5 + bucket / 16;
+    return (16u + bucket % 16) << (octave - 4);
+}
+
+/**
+ * @brief Append a delivered packet to the port's log, as it would go on the wire
+ */
+static void loopback_log(midi_loopback_t *lb, const midi_router_packet_t *packet) {
+    if (packet->format == MIDI_FORMAT_2_0) {
+        midi_capture_write_output(lb->log, lb->id, packet->source, MIDI_CAPTURE_UMP,
+                                  packet->data.ump.words,
+                                  packet->data.ump.num_words * sizeof(uint32_t));
+        return;
+    }
+
+    const midi_message_t *msg = &packet->data.midi1;
+    uint8_t bytes[3] = { msg->status, msg->data.bytes[0], msg->data.bytes[1] };
+    if (msg->status != MIDI_STATUS_SYSEX_START || !msg->data.sysex.data) {
+        midi_capture_write_output(lb->log, lb->id, packet->source, MIDI_CAPTURE_BYTES,
+                                  bytes, 1 + midi_get_data_byte_count(msg->status));
+        return;
+    }
+    uint8_t frame[LOOPBACK_SYSEX_MAX + 2];
+    uint16_t length = msg->data.sysex.length < LOOPBACK_SYSEX_MAX ? msg->data.sysex.length
+                                                                  : LOOPBACK_SYSEX_MAX;
+    frame[0] = MIDI_STATUS_SYSEX_START;
+    memcpy(&frame[1], msg->data.sysex.data, length);
+    frame[length + 1] = MIDI_STATUS_SYSEX_END;
+    midi_capture_write_output(lb->log, lb->id, packet->source, MIDI_CAPTURE_BYTES,
+                              frame, length + 2);
+}
+
+static esp_err_t loopback_send(void *ctx, const midi_router_packet_t *packet) {
+    midi_loopback_t *lb = ctx;
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    uint32_t latency = now - packet->timestamp_us;
+    uint32_t n = lb->captured;
+
+    if (lb->records) {
+        midi_loopback_record_t *rec = &lb->records[n % lb->record_capacity];
+        rec->time_us = now;
+        rec->latency_us = latency;
+        rec->source = packet->source;
+        rec->format = packet->format;
+        if (packet->format == MIDI_FORMAT_1_0) {
+            const midi_message_t *msg = &packet->data.midi1;
+            rec->word0 = ((uint32_t)msg->status << 16) |
+                         (msg->status == MIDI_STATUS_SYSEX_START ? msg->data.sysex.length
+                                                                 : (msg->data.bytes[0] << 8) |
+                                                                   msg->data.bytes[1]);
+        } else {
+            rec->word0 = packet->data.ump.words[0];
+        }
+    }
+
+    if (lb->log) {
+        loopback_log(lb, packet);
+    }
+
+    if (packet->source < MIDI_TRANSPORT_COUNT) {
+        lb->received[packet->source]++;
+    }
+    lb->histogram[latency_bucket(latency)]++;
+    lb->latency_sum_us += latency;
+    if (latency > lb->latency_max_us) {
+        lb->latency_max_us = latency;
+    }
+    lb->last_time_us = now;
+    lb->captured = n + 1;
+    return ESP_OK;
+}
+
+static esp_err_t loopback_get_stats(void *ctx, midi_transport_stats_t *stats) {
+    const midi_loopback_t *lb = ctx;
+    stats->packets_tx = lb->captured;
+    stats->packets_rx = lb->injected;
+    stats->packets_lost = 0;
+    stats->tx_errors = 0;
+    return ESP_OK;
+}
+
+void midi_loopback_reset(midi_loopback_t *lb) {
+    lb->captured = 0;
+    lb->last_time_us = 0;
+    memset(lb->received, 0, sizeof(lb->received));
+    memset(lb->histogram, 0, sizeof(lb->histogram));
+    lb->latency_max_us = 0;
+    lb->latency_sum_us = 0;
+    lb->injected = 0;
+    lb->refused = 0;
+}
+
+bool midi_loopback_wait(midi_loopback_t *lb, uint32_t count, uint32_t idle_ms) {
+    uint32_t last = lb->captured;
+    int64_t idle_since = esp_timer_get_time();
+
+    while (lb->captured < count) {
+        vTaskDelay(1);
+        uint32_t now_captured = lb->captured;
+        int64_t now = esp_timer_get_time();
+        if (now_captured != last) {
+            last = now_captured;
+            idle_since = now;
+        } else if (now - idle_since >= (int64_t)idle_ms * 1000) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t midi_loopback_latency_percentile(const midi_loopback_t *lb, uint16_t permille) {
+    uint64_t total = 0;
+    for (int b = 0; b < MIDI_LOOPBACK_HIST_BUCKETS; b++) {
+        total += lb->histogram[b];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t target = (total * permille + 999) / 1000;
+    if (target == 0) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < MIDI_LOOPBACK_HIST_BUCKETS; b++) {
+        seen += lb->histogram[b];
+        if (seen >= target) {
+            uint32_t floor = bucket_floor(b);
+            return floor < lb->latency_max_us ? floor : lb->latency_max_us;
+        }
+    }
+    return lb->latency_max_us;
+}
+
+//=============================================================================
+// Port Lifecycle
+//=============================================================================
+
+esp_err_t midi_loopback_create(midi_loopback_t *lb, const midi_loopback_config_t *config) {
+    if (!lb || !config ||
+        (config->native_format != MIDI_FORMAT_1_0 && config->native_format != MIDI_FORMAT_2_0) ||
+        (config->records && config->record_capacity == 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(lb, 0, sizeof(*lb));
+    lb->ops = (midi_transport_ops_t){
+        .name = config->name ? config->name : "Loopback",
+        .native_format = config->native_format,
+        .send = loopback_send,
+        .get_stats = loopback_get_stats,
+    };
+    lb->records = config->records;
+    lb->record_capacity = config->record_capacity;
+    lb->log = config->log;
+
+    esp_err_t err;
+    if (config->transport == MIDI_LOOPBACK_NEW_ID) {
+        err = midi_router_add_transport(&lb->ops, lb, &lb->id);
+        lb->dynamic = true;
+    } else {
+        lb->id = config->transport;
+        err = midi_router_attach_transport(lb->id, &lb->ops, lb);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot register %s: %s", lb->ops.name, esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t midi_loopback_destroy(midi_loopback_t *lb) {
+    if (!lb) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return lb->dynamic ? midi_router_remove_transport(lb->id)
+                       : midi_router_attach_transport(lb->id, NULL, NULL);
+}
+
+//=============================================================================
+// Traffic Generation
+//=============================================================================
+
+static void loopback_make_midi1(midi_router_packet_t *pkt, uint8_t status, uint8_t d1, uint8_t d2) {
+    pkt->format = MIDI_FORMAT_1_0;
+    pkt->data.midi1 = (midi_message_t){
+        .type = MIDI_MSG_TYPE_CHANNEL, .status = status, .channel = status & 0x0F,
+        .data.bytes = {d1, d2}
+    };
+}
+
+static void loopback_make_ump(midi_router_packet_t *pkt, uint8_t mt, uint8_t num_words,
+                              uint32_t word0, uint32_t word1) {
+    pkt->format = MIDI_FORMAT_2_0;
+    pkt->data.ump = (ump_packet_t){
+        .words = {word0, word1}, .num_words = num_words,
+        .message_type = mt, .group = UMP_GET_GROUP(word0)
+    };
+}
+
+/**
+ * @brief Build the next packet of a pattern
+ *
+ * lb->seq walks through the pattern, so consecutive streams continue
+ * where the last one stopped (a sweep does not restart, notes keep
+ * pairing up).
+ */
+static void loopback_next(midi_loopback_t *lb, const midi_loopback_stream_t *stream,
+                          midi_router_packet_t *pkt) {
+    uint32_t seq = lb->seq++;
+    uint8_t ch = stream->channel & 0x0F;
+    bool ump = stream->format == MIDI_FORMAT_2_0;
+
+    switch (stream->pattern) {
+    case MIDI_LOOPBACK_NOTES: {
+        uint8_t note = LOOPBACK_NOTE_BASE + (seq / 2) % LOOPBACK_NOTE_SPAN;
+        bool on = !(seq & 1);
+        if (ump) {
+            uint8_t opcode = on ? MIDI_STATUS_NOTE_ON : MIDI_STATUS_NOTE_OFF;
+            uint16_t velocity = on ? midi_upscale_7to16(LOOPBACK_VELOCITY) : 0;
+            loopback_make_ump(pkt, UMP_MT_MIDI2_CHANNEL_VOICE, 2,
+                              ((uint32_t)UMP_MT_MIDI2_CHANNEL_VOICE << 28) |
+                              ((uint32_t)(opcode | ch) << 16) | ((uint32_t)note << 8),
+                              (uint32_t)velocity << 16);
+        } else {
+            // Note Off as Note On velocity 0, as running-status senders do
+            loopback_make_midi1(pkt, MIDI_STATUS_NOTE_ON | ch, note, on ? LOOPBACK_VELOCITY : 0);
+        }
+        break;
+    }
+    case MIDI_LOOPBACK_CC_SWEEP: {
+        uint32_t pos = seq % 254;
+        uint8_t value = pos <= 127 ? pos : 254 - pos;
+        if (ump) {
+            loopback_make_ump(pkt, UMP_MT_MIDI2_CHANNEL_VOICE, 2,
+                              ((uint32_t)UMP_MT_MIDI2_CHANNEL_VOICE << 28) |
+                              ((uint32_t)(MIDI_STATUS_CONTROL_CHANGE | ch) << 16) |
+                              ((uint32_t)LOOPBACK_SWEEP_CC << 8),
+                              (uint32_t)value << 25);
+        } else {
+            loopback_make_midi1(pkt, MIDI_STATUS_CONTROL_CHANGE | ch, LOOPBACK_SWEEP_CC, value);
+        }
+        break;
+    }
+    case MIDI_LOOPBACK_CLOCK:
+        if (ump) {
+            loopback_make_ump(pkt, UMP_MT_SYSTEM, 1,
+                              ((uint32_t)UMP_MT_SYSTEM << 28) |
+                              ((uint32_t)MIDI_STATUS_TIMING_CLOCK << 16), 0);
+        } else {
+            loopback_make_midi1(pkt, MIDI_STATUS_TIMING_CLOCK, 0, 0);
+            pkt->data.midi1.type = MIDI_MSG_TYPE_SYSTEM_REALTIME;
+            pkt->data.midi1.channel = 0;
+        }
+        break;
+    case MIDI_LOOPBACK_SYSEX_DUMP: {
+        uint16_t length = stream->sysex_length ? stream->sysex_length : LOOPBACK_SYSEX_DEFAULT;
+        if (length > LOOPBACK_SYSEX_MAX) {
+            length = LOOPBACK_SYSEX_MAX;
+        }
+        if (!ump) {
+            // One packet per dump; payload excludes F0/F7
+            pkt->format = MIDI_FORMAT_1_0;
+            pkt->data.midi1 = (midi_message_t){
+                .type = MIDI_MSG_TYPE_SYSTEM_EXCLUSIVE, .status = MIDI_STATUS_SYSEX_START,
+                .data.sysex = { .manufacturer_id = s_sysex_payload[0],
+                                .data = s_sysex_payload, .length = length }
+            };
+            break;
+        }
+        // SysEx7 in six-byte slices: complete, or start/continue.../end
+        uint32_t slices = (length + 5) / 6;
+        uint32_t slice = seq % slices;
+        uint32_t offset = slice * 6;
+        uint8_t count = (length - offset) < 6 ? (length - offset) : 6;
+        uint8_t form = slices == 1 ? 0 : slice == 0 ? 1 : slice == slices - 1 ? 3 : 2;
+        uint8_t b[6] = {0};
+        memcpy(b, &s_sysex_payload[offset], count);
+        loopback_make_ump(pkt, UMP_MT_DATA_64, 2,
+                          ((uint32_t)UMP_MT_DATA_64 << 28) | ((uint32_t)form << 20) |
+                          ((uint32_t)count << 16) | ((uint32_t)b[0] << 8) | b[1],
+                          ((uint32_t)b[2] << 24) | ((uint32_t)b[3] << 16) |
+                          ((uint32_t)b[4] << 8) | b[5]);
+        break;
+    }
+    }
+}
+
+esp_err_t midi_loopback_inject(midi_loopback_t *lb, const midi_loopback_stream_t *stream,
+                               midi_loopback_inject_result_t *result) {
+    if (!lb || !stream ||
+        (stream->format != MIDI_FORMAT_1_0 && stream->format != MIDI_FORMAT_2_0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (s_sysex_payload[0] == 0) {
+        s_sysex_payload[0] = 0x7D;      // Non-commercial ID, then a counting pattern
+        for (int i = 1; i < LOOPBACK_SYSEX_MAX; i++) {
+            s_sysex_payload[i] = i & 0x7F;
+        }
+    }
+
+    uint32_t burst = stream->burst ? stream->burst : 1;
+    uint32_t accepted = 0, refused = 0;
+    midi_router_packet_t pkt;
+    int64_t start = esp_timer_get_time();
+
+    for (uint32_t i = 0; i < stream->count; i++) {
+        if (stream->rate_hz && i % burst == 0) {
+            int64_t due = start + (int64_t)i * 1000000 / stream->rate_hz;
+            for (;;) {
+                int64_t ahead = due - esp_timer_get_time();
+                if (ahead <= 0) {
+                    break;
+                }
+                if (ahead >= (int64_t)portTICK_PERIOD_MS * 1000) {
+                    vTaskDelay(1);
+                } else {
+                    taskYIELD();    // Sub-tick spacing: spin, letting workers run
+                }
+            }
+        }
+
+        memset(&pkt, 0, sizeof(pkt));
+        loopback_next(lb, stream, &pkt);
+        pkt.source = lb->id;
+        pkt.destination = 0xFF;
+        if (midi_router_send(&pkt) == ESP_OK) {
+            accepted++;
+        } else {
+            refused++;
+        }
+    }
+
+    lb->injected += accepted;
+    lb->refused += refused;
+    if (result) {
+        result->accepted = accepted;
+        result->refused = refused;
+        result->elapsed_us = (uint32_t)(esp_timer_get_time() - start);
+    }
+    return ESP_OK;
+}
+
+//=============================================================================
+// Load Measurement
+//=============================================================================
+
+/**
+ * @brief Run one measurement step at a fixed rate
+ *
+ * @return true if every packet arrived and p99 stayed within the limit
+ */
+static bool loopback_step(midi_loopback_t *src, midi_loopback_t *dst,
+                          const midi_loopback_load_config_t *config, uint32_t rate,
+                          midi_loopback_report_t *sample, uint32_t *lost) {
+    midi_loopback_stream_t stream = config->stream;
+    stream.rate_hz = rate;
+    stream.count = (uint32_t)((uint64_t)rate * config->step_ms / 1000);
+    if (stream.count == 0) {
+        stream.count = 1;
+    }
+
+    midi_loopback_reset(dst);
+    midi_loopback_inject_result_t res;
+    midi_loopback_inject(src, &stream, &res);
+    midi_loopback_wait(dst, res.accepted, 50);
+
+    uint32_t captured = dst->received[src->id];
+    *lost = res.refused + (res.accepted > captured ? res.accepted - captured : 0);
+    sample->p50_us = midi_loopback_latency_percentile(dst, 500);
+    sample->p90_us = midi_loopback_latency_percentile(dst, 900);
+    sample->p99_us = midi_loopback_latency_percentile(dst, 990);
+    sample->max_us = dst->latency_max_us;
+    sample->delivered = captured;
+
+    ESP_LOGD(TAG, "%s->%s %lu Hz: %lu delivered, %lu lost, p99 %lu us",
+             src->ops.name, dst->ops.name, (unsigned long)rate,
+             (unsigned long)captured, (unsigned long)*lost, (unsigned long)sample->p99_us);
+    return *lost == 0 && sample->p99_us <= config->latency_limit_us;
+}
+
+/**
+ * @brief Run a step, repeating it once if it fails
+ *
+ * One scheduling hiccup (another task, a flash write) should not end
+ * the search at a rate the route otherwise sustains.
+ */
+static bool loopback_step_confirmed(midi_loopback_t *src, midi_loopback_t *dst,
+                                    const midi_loopback_load_config_t *config, uint32_t rate,
+                                    midi_loopback_report_t *sample, uint32_t *lost) {
+    return loopback_step(src, dst, config, rate, sample, lost) ||
+           loopback_step(src, dst, config, rate, sample, lost);
+}
+
+esp_err_t midi_loopback_measure(midi_loopback_t *src, midi_loopback_t *dst,
+                                const midi_loopback_load_config_t *config,
+                                midi_loopback_report_t *report) {
+    if (!src || !dst || !config || !report) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    midi_loopback_load_config_t cfg = *config;
+    if (!cfg.start_rate_hz) cfg.start_rate_hz = 1000;
+    if (!cfg.max_rate_hz) cfg.max_rate_hz = 200000;
+    if (!cfg.step_ms) cfg.step_ms = 200;
+    if (!cfg.latency_limit_us) cfg.latency_limit_us = 1000;
+
+    memset(report, 0, sizeof(*report));
+    midi_loopback_report_t sample;
+    uint32_t lost;
+
+    // Double until something breaks
+    uint32_t rate = cfg.start_rate_hz < cfg.max_rate_hz ? cfg.start_rate_hz : cfg.max_rate_hz;
+    for (;;) {
+        if (!loopback_step_confirmed(src, dst, &cfg, rate, &sample, &lost)) {
+            report->failing_rate_hz = rate;
+            report->lost = lost;
+            break;
+        }
+        sample.sustained_rate_hz = rate;
+        *report = sample;
+        if (rate == cfg.max_rate_hz) {
+            return ESP_OK;
+        }
+        rate = (rate > cfg.max_rate_hz / 2) ? cfg.max_rate_hz : rate * 2;
+    }
+
+    // Bisect between the last good and the first failing rate
+    for (int i = 0; i < LOOPBACK_SEARCH_STEPS; i++) {
+        uint32_t good = report->sustained_rate_hz;
+        uint32_t mid = good + (report->failing_rate_hz - good) / 2;
+        if (mid <= good || report->failing_rate_hz - good < good / 16) {
+            break;
+        }
+        if (loopback_step_confirmed(src, dst, &cfg, mid, &sample, &lost)) {
+            uint32_t failing = report->failing_rate_hz;
+            uint32_t failing_lost = report->lost;
+            sample.sustained_rate_hz = mid;
+            *report = sample;
+            report->failing_rate_hz = failing;
+            report->lost = failing_lost;
+        } else {
+            report->failing_rate_hz = mid;
+            report->lost = lost;
+        }
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,312 @@
+/**
+ * @file midi_replay.c
+ * @brief Capture Replay Implementation
+ */
+
+#include "midi_replay.h"
+#include "midi_parser.h"
+#include "ump_parser.h"
+#include "ump_defs.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char *TAG = "MIDI_REPLAY";
+
+#define REPLAY_SYSEX_MAX    256
+
+// Parsers start from reset on every run, so a replay is repeatable
+static midi_parser_state_t s_parsers[MIDI_TRANSPORT_COUNT];
+static uint8_t s_sysex[MIDI_TRANSPORT_COUNT][REPLAY_SYSEX_MAX];
+static midi_loopback_t s_latency;   // Outputs' histograms summed
+
+// MIDI bytes carried by a USB-MIDI 1.0 event packet, by Code Index Number
+static const uint8_t usb_cin_length[16] = {
+    0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1
+};
+
+//=============================================================================
+// Feeding
+//=============================================================================
+
+static void replay_send(midi_router_packet_t *pkt, uint8_t transport,
+                        midi_replay_report_t *report) {
+    pkt->source = transport;
+    pkt->destination = 0xFF;
+    report->messages++;
+    if (midi_router_inject(pkt) != ESP_OK) {
+        report->refused++;
+    }
+}
+
+static void replay_bytes(uint8_t transport, const uint8_t *bytes, size_t len,
+                         midi_replay_report_t *report) {
+    midi_router_packet_t pkt;
+    bool complete;
+
+    for (size_t i = 0; i < len; i++) {
+        memset(&pkt, 0, sizeof(pkt));
+        if (midi_parser_parse_byte(&s_parsers[transport], bytes[i], &pkt.data.midi1,
+                                   &complete) != ESP_OK) {
+            report->parse_errors++;
+            continue;
+        }
+        if (complete) {
+            pkt.format = MIDI_FORMAT_1_0;
+            replay_send(&pkt, transport, report);
+        }
+    }
+}
+
+static void replay_ump(uint8_t transport, const uint8_t *data, size_t len,
+                       midi_replay_report_t *report) {
+    midi_router_packet_t pkt;
+    uint32_t words[UMP_MAX_WORDS];
+    size_t offset = 0;
+
+    while (offset + 4 <= len) {
+        memset(&pkt, 0, sizeof(pkt));
+        memset(words, 0, sizeof(words));
+        memcpy(words, &data[offset], (len - offset) < sizeof(words) ? (len - offset)
+                                                                    : sizeof(words));
+        if (ump_parser_parse_packet(words, &pkt.data.ump) != ESP_OK ||
+            offset + pkt.data.ump.num_words * 4u > len) {
+            report->parse_errors++;
+            return;
+        }
+        offset += pkt.data.ump.num_words * 4u;
+        pkt.format = MIDI_FORMAT_2_0;
+        replay_send(&pkt, transport, report);
+    }
+}
+
+static void replay_record(const midi_capture_record_t *rec, midi_replay_report_t *report) {
+    if (rec->transport >= MIDI_TRANSPORT_COUNT) {
+        report->parse_errors++;
+        return;
+    }
+
+    switch (rec->kind) {
+    case MIDI_CAPTURE_BYTES:
+        replay_bytes(rec->transport, rec->data, rec->length, report);
+        break;
+    case MIDI_CAPTURE_USB_MIDI1:
+        for (size_t i = 0; i + 3 < rec->length; i += 4) {
+            uint8_t cin = rec->data[i] & 0x0F;
+            replay_bytes(rec->transport, &rec->data[i + 1], usb_cin_length[cin], report);
+        }
+        break;
+    case MIDI_CAPTURE_UMP:
+        replay_ump(rec->transport, rec->data, rec->length, report);
+        break;
+    default:
+        report->parse_errors++;
+        break;
+    }
+}
+
+//=============================================================================
+// Run
+//=============================================================================
+
+static uint32_t replay_delivered(const midi_replay_config_t *config) {
+    uint32_t total = 0;
+    for (size_t i = 0; i < config->num_outputs; i++) {
+        total += config->outputs[i]->captured;
+    }
+    return total;
+}
+
+// Streams as midi_router_packet_stream() numbers them, plus one for realtime
+#define REPLAY_STREAM_REALTIME  (16 * 17)
+#define REPLAY_STREAMS          (REPLAY_STREAM_REALTIME + 1)
+
+typedef struct {
+    uint8_t output;
+    uint8_t source;
+    uint16_t stream;
+} replay_stream_t;
+
+static uint16_t replay_record_stream(const midi_capture_record_t *rec) {
+    midi_router_packet_t pkt = { 0 };
+    if (rec->kind == MIDI_CAPTURE_UMP && rec->length >= 4) {
+        pkt.format = MIDI_FORMAT_2_0;
+        memcpy(&pkt.data.ump.words[0], rec->data, 4);
+    } else {
+        pkt.format = MIDI_FORMAT_1_0;
+        pkt.data.midi1.status = rec->data[0];
+    }
+    if (midi_router_packet_priority(&pkt) == MIDI_PRIO_REALTIME) {
+        return REPLAY_STREAM_REALTIME;
+    }
+    return midi_router_packet_stream(&pkt);
+}
+
+/**
+ * @brief Whether an output record belongs to the stream being compared
+ *
+ * The router keeps order per source and (group, channel) stream, whatever
+ * the class; only realtime may overtake, so it is compared on its own.
+ */
+static bool replay_stream_match(const midi_capture_record_t *rec, void *ctx) {
+    const replay_stream_t *stream = ctx;
+    return rec->transport == stream->output && rec->source == stream->source &&
+           rec->length && replay_record_stream(rec) == stream->stream;
+}
+
+/**
+ * @brief Mark the streams an output carries from a source in one log
+ */
+static void replay_mark_streams(midi_capture_reader_t *reader, const replay_stream_t *stream,
+                                uint32_t seen[]) {
+    midi_capture_record_t rec;
+    while (midi_capture_next(reader, &rec) == ESP_OK) {
+        if (rec.transport == stream->output && rec.source == stream->source && rec.length) {
+            uint16_t s = replay_record_stream(&rec);
+            seen[s / 32] |= 1u << (s % 32);
+        }
+    }
+}
+
+/**
+ * @brief Compare the outputs' log with the reference, one ordered stream at a time
+ */
+static void replay_diff(const midi_replay_config_t *config, midi_replay_report_t *report) {
+    midi_capture_reader_t got, want;
+    if (midi_capture_reader_log(&want, config->expected, config->expected_len) != ESP_OK) {
+        report->diffs++;
+        report->first_diff = 0;
+        return;
+    }
+
+    replay_stream_t stream;
+    for (size_t i = 0; i < config->num_outputs; i++) {
+        stream.output = config->outputs[i]->id;
+        for (stream.source = 0; stream.source < MIDI_TRANSPORT_COUNT; stream.source++) {
+            uint32_t seen[(REPLAY_STREAMS + 31) / 32] = { 0 };
+            midi_capture_reader_ring(&got, config->output_log);
+            midi_capture_reader_log(&want, config->expected, config->expected_len);
+            replay_mark_streams(&got, &stream, seen);
+            replay_mark_streams(&want, &stream, seen);
+
+            for (stream.stream = 0; stream.stream < REPLAY_STREAMS; stream.stream++) {
+                if (!(seen[stream.stream / 32] & (1u << (stream.stream % 32)))) {
+                    continue;
+                }
+                midi_capture_reader_ring(&got, config->output_log);
+                midi_capture_reader_log(&want, config->expected, config->expected_len);
+                int32_t first;
+                uint32_t diffs = midi_capture_diff(&got, &want, replay_stream_match, &stream,
+                                                   &first);
+                if (diffs && report->first_diff < 0) {
+                    report->first_diff = first;
+                    report->first_diff_transport = stream.output;
+                    report->first_diff_source = stream.source;
+                }
+                report->diffs += diffs;
+            }
+        }
+    }
+}
+
+esp_err_t midi_replay_run(const midi_replay_config_t *config, midi_replay_report_t *report) {
+    if (!config || !report || !config->log || (config->num_outputs && !config->outputs) ||
+        (config->expected && !config->output_log)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    midi_capture_reader_t reader;
+    esp_err_t err = midi_capture_reader_log(&reader, config->log, config->log_len);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    memset(report, 0, sizeof(*report));
+    report->first_diff = -1;
+    for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+        midi_parser_init(&s_parsers[t], s_sysex[t], REPLAY_SYSEX_MAX);
+    }
+    for (size_t i = 0; i < config->num_outputs; i++) {
+        midi_loopback_reset(config->outputs[i]);
+    }
+    if (config->output_log) {
+        midi_capture_clear(config->output_log);
+    }
+
+    midi_capture_record_t rec;
+    uint64_t origin = 0;
+    int64_t start = esp_timer_get_time();
+
+    while ((err = midi_capture_next(&reader, &rec)) == ESP_OK) {
+        if (report->records == 0) {
+            origin = rec.time_us;
+        }
+        if (config->speed) {
+            int64_t due = start + (int64_t)((rec.time_us - origin) / config->speed);
+            for (;;) {
+                int64_t ahead = due - esp_timer_get_time();
+                if (ahead <= 0) {
+                    break;
+                }
+                if (ahead >= (int64_t)portTICK_PERIOD_MS * 1000) {
+                    vTaskDelay(1);
+                } else {
+                    taskYIELD();
+                }
+            }
+        }
+        replay_record(&rec, report);
+        report->records++;
+    }
+    if (err != ESP_ERR_NOT_FOUND) {
+        ESP_LOGW(TAG, "Log truncated after %lu records", (unsigned long)report->records);
+    }
+
+    // Let the outputs drain
+    uint32_t settle_ms = config->settle_ms ? config->settle_ms : 50;
+    uint32_t last = replay_delivered(config);
+    int64_t idle_since = esp_timer_get_time();
+    while (esp_timer_get_time() - idle_since < (int64_t)settle_ms * 1000) {
+        vTaskDelay(1);
+        uint32_t now = replay_delivered(config);
+        if (now != last) {
+            last = now;
+            idle_since = esp_timer_get_time();
+        }
+    }
+
+    // Throughput and latency over all outputs
+    memset(&s_latency, 0, sizeof(s_latency));
+    uint32_t last_delivery = (uint32_t)start;
+    for (size_t i = 0; i < config->num_outputs; i++) {
+        const midi_loopback_t *out = config->outputs[i];
+        for (int b = 0; b < MIDI_LOOPBACK_HIST_BUCKETS; b++) {
+            s_latency.histogram[b] += out->histogram[b];
+        }
+        if (out->latency_max_us > s_latency.latency_max_us) {
+            s_latency.latency_max_us = out->latency_max_us;
+        }
+        if (out->captured && (int32_t)(out->last_time_us - last_delivery) > 0) {
+            last_delivery = out->last_time_us;
+        }
+    }
+    report->delivered = last;
+    report->elapsed_us = last_delivery - (uint32_t)start;
+    if (report->elapsed_us) {
+        report->throughput_hz = (uint32_t)((uint64_t)last * 1000000 / report->elapsed_us);
+    }
+    report->p50_us = midi_loopback_latency_percentile(&s_latency, 500);
+    report->p99_us = midi_loopback_latency_percentile(&s_latency, 990);
+    report->max_us = s_latency.latency_max_us;
+
+    if (config->expected) {
+        replay_diff(config, report);
+    }
+
+    ESP_LOGI(TAG, "Replayed %lu records: %lu messages, %lu delivered, %lu diffs",
+             (unsigned long)report->records, (unsigned long)report->messages,
+             (unsigned long)report->delivered, (unsigned long)report->diffs);
+    return ESP_OK;
+}
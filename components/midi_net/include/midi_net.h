@@ -0,0 +1,464 @@
+/**
+ * @file midi_net.h
+ * @brief Network MIDI 2.0 (UDP) Session Protocol
+ *
+ * Sessions between UMP endpoints over UDP as specified by the MIDI
+ * Association in "Network MIDI 2.0 (UDP) Transport" (M2-124-UM). Every
+ * datagram starts with the "MIDI" signature and carries one or more
+ * command packets:
+ *
+ *   word 0   code (8) | payload length in words (8) | command specific (16)
+ *   word 1.. payload
+ *
+ * UMP travels in UMP Data commands whose command specific field is a
+ * 16-bit sequence number, counted per session and direction from 0.
+ * A sender repeats its last few UMP Data commands in front of each new
+ * one (FEC), so a single lost datagram costs nothing; longer gaps are
+ * asked for again with Retransmit Request and answered from a short
+ * history. Sessions open with Invitation / Invitation Reply, stay alive
+ * with Ping / Ping Reply and close with Bye. Any datagram from a peer
+ * proves it alive, so a Ping goes out only after a ping interval of
+ * silence from it, and rides along with outgoing UMP Data when that
+ * silence is most of the way there. On an idle session the inviting
+ * side pings; the invited side waits twice as long, so the two do not
+ * both ping.
+ *
+ * Between MIDI-Cube devices a UMP Data command may start with a hop
+ * marker: a UMP NOOP (MT 0, status 0) whose low 16 bits read 'H' and
+ * the number of routers the message after it has already crossed.
+ * Standard peers discard NOOPs, so the marker costs them nothing; we
+ * strip it and report the count through the peer (last_rx_hops), which
+ * lets bridged devices bound loops of traffic that repeats by design,
+ * like realtime clock.
+ *
+ * Each Ping Reply is a round trip time sample. Our Invitations and
+ * replies to them set a reserved capability bit (MIDI_NET_CAP_PING_CLOCK);
+ * to a peer that set it too, our Ping Replies carry two more payload
+ * words after the ping ID: the replier's clock (µs, high word first)
+ * when it answered. With that the pinger also estimates the peer's
+ * clock offset, NTP-style, as if both directions took half the round
+ * trip. Standard peers get the plain one-word reply and give RTT alone. Both
+ * estimates are smoothed per peer (RTT as in RFC 6298, the offset as an
+ * EWMA with a jitter figure) and drive the retransmit timeout.
+ *
+ * With an endpoint configured, each session negotiates UMP Stream
+ * settings for itself (ump_endpoint.h): the engine sends Endpoint
+ * Discovery when a session opens, answers discovery and configuration
+ * on the session they came from instead of delivering them, and sends
+ * a session that settled on the MIDI 1.0 Protocol MIDI 2.0 channel
+ * voice as MT 0x2. JR Clock and JR Timestamps go only to sessions that
+ * turned them on.
+ *
+ * The engine is independent of sockets and clocks: datagrams go out
+ * through a callback and every entry point takes the current time, so
+ * WiFi and Ethernet share it and it runs on a host. Each peer has one
+ * deadline (ping, timeout, invitation retry, retransmit retry or FEC
+ * flush, whichever comes first); the engine reports it through the
+ * schedule callback and the owner calls midi_net_expire() for that peer
+ * when it passes, typically from a timer on the shared timer wheel
+ * (midi_timer_wheel.h). It does not lock;
+ * callers serialize calls on one midi_net_t (the drivers' peers mutex).
+ * Callbacks run inside those calls and must not call back into the
+ * same engine.
+ */
+
+#ifndef MIDI_NET_H
+#define MIDI_NET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "ump_types.h"
+#include "ump_defs.h"
+#include "ump_endpoint.h"
+
+//=============================================================================
+// Wire Format
+//=============================================================================
+
+#define MIDI_NET_SIGNATURE              0x4D494449  /**< "MIDI" */
+#define MIDI_NET_DEFAULT_PORT           5004
+#define MIDI_NET_MTU                    1472        /**< Largest datagram sent or accepted */
+
+/**
+ * @brief Command codes
+ */
+#define MIDI_NET_CMD_INVITATION             0x01
+#define MIDI_NET_CMD_INVITATION_AUTH        0x02    /**< Not supported: answered with NAK */
+#define MIDI_NET_CMD_INVITATION_USER_AUTH   0x03    /**< Not supported: answered with NAK */
+#define MIDI_NET_CMD_INVITATION_ACCEPTED    0x10
+#define MIDI_NET_CMD_INVITATION_PENDING     0x11
+#define MIDI_NET_CMD_PING                   0x20
+#define MIDI_NET_CMD_PING_REPLY             0x21    /**< Ours may add the replier's clock (see below) */
+#define MIDI_NET_CMD_RETRANSMIT_REQUEST     0x80
+#define MIDI_NET_CMD_RETRANSMIT_ERROR       0x81
+#define MIDI_NET_CMD_SESSION_RESET          0x82
+#define MIDI_NET_CMD_SESSION_RESET_REPLY    0x83
+#define MIDI_NET_CMD_NAK                    0x8F
+#define MIDI_NET_CMD_BYE                    0xF0
+#define MIDI_NET_CMD_BYE_REPLY              0xF1
+#define MIDI_NET_CMD_UMP_DATA               0xFF
+
+/**
+ * @brief Capability bits (second command specific byte of Invitation and
+ *        Invitation Reply: Accepted)
+ */
+#define MIDI_NET_CAP_PING_CLOCK             0x80    /**< Reserved bit: "add your clock to Ping Replies" */
+
+/**
+ * @brief Hop marker: UMP NOOP carrying the hop count of the next message
+ */
+#define MIDI_NET_HOP_MARKER                 0x00004800
+#define MIDI_NET_HOP_MARKER_MASK            0xFFFFFF00
+#define MIDI_NET_IS_HOP_MARKER(word)        (((word) & MIDI_NET_HOP_MARKER_MASK) == MIDI_NET_HOP_MARKER)
+
+/**
+ * @brief Bye reasons (first command specific byte)
+ */
+#define MIDI_NET_BYE_UNKNOWN                0x00
+#define MIDI_NET_BYE_USER_TERMINATED        0x01
+#define MIDI_NET_BYE_POWER_DOWN             0x02
+#define MIDI_NET_BYE_TOO_MANY_MISSING       0x03
+#define MIDI_NET_BYE_TIMEOUT                0x04
+#define MIDI_NET_BYE_NO_SESSION             0x05    /**< Command from a peer without a session */
+#define MIDI_NET_BYE_NO_PENDING_SESSION     0x06
+#define MIDI_NET_BYE_PROTOCOL_ERROR         0x07
+#define MIDI_NET_BYE_TOO_MANY_SESSIONS      0x40    /**< Invitation refused: no free slot */
+
+/**
+ * @brief NAK reasons
+ */
+#define MIDI_NET_NAK_OTHER                  0x00
+#define MIDI_NET_NAK_NOT_SUPPORTED          0x01
+#define MIDI_NET_NAK_NOT_EXPECTED           0x02
+#define MIDI_NET_NAK_MALFORMED              0x03
+
+/**
+ * @brief Retransmit Error reasons
+ */
+#define MIDI_NET_RETX_ERROR_UNKNOWN         0x00
+#define MIDI_NET_RETX_ERROR_NOT_IN_BUFFER   0x01
+
+//=============================================================================
+// Configuration
+//=============================================================================
+
+#ifdef CONFIG_MIDI_NET_HISTORY_SIZE
+#define MIDI_NET_HISTORY_SIZE       CONFIG_MIDI_NET_HISTORY_SIZE
+#else
+#define MIDI_NET_HISTORY_SIZE       32
+#endif
+
+#ifdef CONFIG_MIDI_NET_FEC_DEPTH
+#define MIDI_NET_FEC_DEPTH          CONFIG_MIDI_NET_FEC_DEPTH
+#else
+#define MIDI_NET_FEC_DEPTH          2
+#endif
+
+#define MIDI_NET_PING_INTERVAL_MS   1000    /**< Default ping_interval_ms (of silence from the peer) */
+#define MIDI_NET_SESSION_TIMEOUT_MS 5000    /**< Default timeout_ms */
+#define MIDI_NET_FEC_FLUSH_MS       20      /**< Quiet time before the last commands are sent again */
+#define MIDI_NET_RETRANSMIT_TIMEOUT_MS 100  /**< Retransmit wait until an RTT is measured */
+#define MIDI_NET_RETRANSMIT_MIN_MS  10      /**< Shortest RTT-derived retransmit wait */
+#define MIDI_NET_RETRANSMIT_MAX_MS  1000    /**< Longest RTT-derived retransmit wait */
+#define MIDI_NET_RETRANSMIT_TRIES   3       /**< Retransmit Requests per gap */
+#define MIDI_NET_PING_PIGGYBACK_PCT 75      /**< Silence (% of the ping interval) before UMP Data carries a Ping */
+#define MIDI_NET_NAME_MAX           63      /**< Longest peer name kept */
+#define MIDI_NET_PRODUCT_ID_MAX     42      /**< Longest product instance ID sent */
+
+//=============================================================================
+// Types
+//=============================================================================
+
+/**
+ * @brief IPv4 address and port of a peer
+ */
+typedef struct {
+    uint32_t ip;                  /**< Network byte order, as in sin_addr.s_addr */
+    uint16_t port;                /**< Host byte order */
+} midi_net_addr_t;
+
+/**
+ * @brief Session state of a peer slot
+ */
+typedef enum {
+    MIDI_NET_PEER_FREE = 0,       /**< Slot unused */
+    MIDI_NET_PEER_INVITING,       /**< Invitation sent, no reply yet */
+    MIDI_NET_PEER_ESTABLISHED,    /**< Session open */
+    MIDI_NET_PEER_CLOSING         /**< Bye sent, waiting for Bye Reply */
+} midi_net_peer_state_t;
+
+/**
+ * @brief One sent UMP Data command, kept for FEC and retransmission
+ */
+typedef struct {
+    uint16_t seq;
+    uint8_t num_words;
+    uint32_t words[UMP_MAX_WORDS + 1]; /**< Hop marker, if any, then the UMP */
+} midi_net_history_t;
+
+/**
+ * @brief Remote session peer
+ */
+typedef struct {
+    midi_net_peer_state_t state;
+    midi_net_addr_t addr;
+    bool inviter;                 /**< We sent the Invitation */
+    bool ping_clock;              /**< Peer set MIDI_NET_CAP_PING_CLOCK: add our clock to Ping Replies */
+    char endpoint_name[MIDI_NET_NAME_MAX + 1]; /**< From the peer's Invitation or reply */
+    ump_endpoint_link_t link;     /**< UMP Stream settings of this session (with config.endpoint) */
+
+    // Sequence state
+    uint16_t tx_seq;              /**< Next UMP Data sequence number sent */
+    uint16_t rx_next;             /**< Next sequence number expected */
+    uint32_t rx_window;           /**< Bit n set: rx_next - 1 - n received */
+    uint32_t last_rx_seq;         /**< Sequence tag of the UMP being delivered (never 0) */
+    uint8_t last_rx_hops;         /**< Hop marker of the UMP being delivered (0 = none) */
+
+    // Timing
+    int64_t last_rx_us;           /**< Last datagram from the peer */
+    int64_t last_tx_us;           /**< Last datagram to the peer */
+    int64_t last_ping_us;         /**< Last Ping or Invitation sent */
+    uint32_t ping_id;             /**< ID of the last Ping sent */
+    int64_t retx_due_us;          /**< Ask again for missing commands (0 = none missing) */
+    int64_t fec_flush_us;         /**< Repeat the newest commands if nothing follows (0 = none) */
+    int64_t due_us;               /**< Deadline last passed to the schedule callback (0 = none) */
+    uint8_t retx_tries;           /**< Retransmit Requests sent for the current gap */
+
+    // Path estimates from Ping / Ping Reply (valid once the sample counts are non-zero)
+    uint32_t rtt_us;              /**< Smoothed round trip time */
+    uint32_t rtt_var_us;          /**< Round trip time variation */
+    uint32_t rtt_min_us;          /**< Shortest round trip seen */
+    int64_t clock_offset_us;      /**< Peer clock minus ours */
+    uint32_t clock_jitter_us;     /**< Mean deviation of offset samples */
+    uint16_t rtt_samples;
+    uint16_t offset_samples;      /**< Replies that carried the peer's clock */
+
+    // Counters
+    uint32_t packets_rx;          /**< UMP Data commands delivered */
+    uint32_t packets_tx;          /**< UMP Data commands sent (FEC copies not counted) */
+    uint32_t packets_lost;        /**< Sequence numbers missed and never recovered */
+    uint32_t packets_recovered_fec;        /**< Delivered from an FEC copy */
+    uint32_t packets_recovered_retransmit; /**< Delivered late, after a Retransmit Request */
+    uint32_t packets_retransmitted;        /**< Sent again at the peer's request */
+    uint32_t duplicates;          /**< Copies dropped as already delivered */
+    uint32_t pings_sent;          /**< Pings sent, piggybacked ones included */
+    uint32_t pings_piggybacked;   /**< Pings that rode along with UMP Data */
+
+    // Sent UMP Data, a ring with the newest entry before history_head
+    midi_net_history_t history[MIDI_NET_HISTORY_SIZE];
+    uint16_t history_head;        /**< Slot the next entry goes to */
+    uint16_t history_count;       /**< Valid entries, up to MIDI_NET_HISTORY_SIZE */
+} midi_net_peer_t;
+
+/**
+ * @brief Totals over all sessions, kept when peers leave
+ */
+typedef struct {
+    uint32_t packets_lost;
+    uint32_t packets_recovered_fec;
+    uint32_t packets_recovered_retransmit;
+    uint32_t packets_retransmitted;
+    uint32_t duplicates;
+    uint32_t naks;                /**< NAKs received */
+} midi_net_stats_t;
+
+/**
+ * @brief Send one datagram
+ */
+typedef esp_err_t (*midi_net_send_fn_t)(const midi_net_addr_t *to, const uint8_t *data,
+                                        size_t len, void *ctx);
+
+/**
+ * @brief One UMP received in order (or recovered) from a session
+ *
+ * peer->last_rx_seq tags the UMP for the router's duplicate filter,
+ * peer->last_rx_hops carries its hop marker.
+ */
+typedef void (*midi_net_ump_fn_t)(const midi_net_peer_t *peer, const ump_packet_t *ump,
+                                  void *ctx);
+
+/**
+ * @brief A session opened (up) or ended (!up); the slot is freed after the call
+ */
+typedef void (*midi_net_session_fn_t)(const midi_net_peer_t *peer, bool up, void *ctx);
+
+/**
+ * @brief The peer's next deadline moved earlier (due_us), or it has none left (0)
+ *
+ * Call midi_net_expire() for the peer at or after due_us. Later
+ * deadlines are not reported; expiring early is harmless, the engine
+ * reports the real deadline again.
+ */
+typedef void (*midi_net_schedule_fn_t)(midi_net_peer_t *peer, int64_t due_us, void *ctx);
+
+/**
+ * @brief The UMP Endpoint sessions negotiate as, read at each use
+ */
+typedef const ump_endpoint_t *(*midi_net_endpoint_fn_t)(void *ctx);
+
+/**
+ * @brief Engine settings
+ */
+typedef struct {
+    const char *name;             /**< UMP Endpoint name sent with invitations and replies */
+    const char *product_instance_id; /**< Sent after the name (NULL = none) */
+    bool accept_invitations;      /**< Host role: open sessions for inviting peers */
+    uint8_t fec_depth;            /**< Earlier UMP Data commands repeated per datagram (0 = off) */
+    bool retransmit;              /**< Ask for gaps FEC did not cover */
+    uint32_t ping_interval_ms;    /**< Silence before a Ping; re-invite period (0 = MIDI_NET_PING_INTERVAL_MS) */
+    uint32_t timeout_ms;          /**< Silence that ends a session (0 = MIDI_NET_SESSION_TIMEOUT_MS) */
+    midi_net_send_fn_t send;
+    midi_net_ump_fn_t on_ump;
+    midi_net_session_fn_t on_session; /**< Optional */
+    midi_net_schedule_fn_t schedule; /**< Optional; without it, call midi_net_poll() */
+    midi_net_endpoint_fn_t endpoint; /**< Optional; without it, UMP Stream messages go to on_ump */
+    void *ctx;                    /**< Passed to the callbacks */
+} midi_net_config_t;
+
+/**
+ * @brief Session engine for one socket
+ */
+typedef struct {
+    midi_net_config_t config;
+    midi_net_peer_t *peers;       /**< Caller-provided slots */
+    uint8_t max_peers;
+    uint32_t next_ping_id;
+    midi_net_stats_t stats;
+    uint8_t tx[MIDI_NET_MTU];     /**< Datagram being built (calls are serialized) */
+    size_t tx_len;
+} midi_net_t;
+
+//=============================================================================
+// API
+//=============================================================================
+
+/**
+ * @brief Set up an engine over caller-provided peer slots
+ *
+ * @param net Engine to initialize
+ * @param config Settings (copied; the strings must outlive the engine)
+ * @param peers Slots, one per simultaneous session
+ * @param max_peers Number of slots
+ * @return ESP_OK, ESP_ERR_INVALID_ARG
+ */
+esp_err_t midi_net_init(midi_net_t *net, const midi_net_config_t *config,
+                        midi_net_peer_t *peers, uint8_t max_peers);
+
+/**
+ * @brief Handle one received datagram
+ *
+ * Answers session commands, delivers UMP through on_ump and reports
+ * sessions opening or closing through on_session.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_SIZE or ESP_ERR_INVALID_RESPONSE if
+ *         the datagram is truncated or lacks the signature
+ */
+esp_err_t midi_net_receive(midi_net_t *net, const midi_net_addr_t *from,
+                           const uint8_t *data, size_t len, int64_t now_us);
+
+/**
+ * @brief Invite a host to a session (client role)
+ *
+ * The Invitation is repeated every ping interval until accepted or the
+ * session timeout passes.
+ *
+ * @return ESP_OK, ESP_ERR_NO_MEM if no slot is free
+ */
+esp_err_t midi_net_invite(midi_net_t *net, const midi_net_addr_t *to, int64_t now_us);
+
+/**
+ * @brief End a session with Bye
+ *
+ * The slot is freed when the Bye Reply arrives or the timeout passes.
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND
+ */
+esp_err_t midi_net_bye(midi_net_t *net, const midi_net_addr_t *to, uint8_t reason,
+                       int64_t now_us);
+
+/**
+ * @brief End every session (Bye to each peer) and free the slots at once
+ */
+void midi_net_close_all(midi_net_t *net, uint8_t reason, int64_t now_us);
+
+/**
+ * @brief Send UMP to every established session
+ *
+ * Adapted per session to what it negotiated (see above).
+ *
+ * @param words UMP words, whole messages only
+ * @param num_words 1 to UMP_MAX_WORDS
+ * @return ESP_OK, ESP_ERR_INVALID_ARG
+ */
+esp_err_t midi_net_send_ump(midi_net_t *net, const uint32_t *words, uint8_t num_words,
+                            int64_t now_us);
+
+/**
+ * @brief Send UMP to every established session behind a hop marker
+ *
+ * @param hops Routers the message has crossed (0 = no marker)
+ * @return ESP_OK, ESP_ERR_INVALID_ARG
+ */
+esp_err_t midi_net_send_ump_hops(midi_net_t *net, const uint32_t *words, uint8_t num_words,
+                                 uint8_t hops, int64_t now_us);
+
+/**
+ * @brief Restart sequence numbering with a peer (Session Reset)
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND
+ */
+esp_err_t midi_net_reset_session(midi_net_t *net, const midi_net_addr_t *to, int64_t now_us);
+
+/**
+ * @brief Do what is due for one peer: ping, timeout, repeated invitation,
+ *        retransmit retry or FEC flush
+ *
+ * Reports the peer's next deadline through the schedule callback.
+ */
+void midi_net_expire(midi_net_t *net, midi_net_peer_t *peer, int64_t now_us);
+
+/**
+ * @brief midi_net_expire() for every peer
+ *
+ * For owners without a schedule callback; call at least every
+ * MIDI_NET_FEC_FLUSH_MS for precise flushes and retries.
+ */
+void midi_net_poll(midi_net_t *net, int64_t now_us);
+
+/**
+ * @brief How long to wait for a retransmission from the peer
+ *
+ * Smoothed RTT plus four times its variation, within
+ * MIDI_NET_RETRANSMIT_MIN_MS..MAX_MS; MIDI_NET_RETRANSMIT_TIMEOUT_MS
+ * before the first sample.
+ */
+uint32_t midi_net_peer_retransmit_timeout_us(const midi_net_peer_t *peer);
+
+/**
+ * @brief One-way delay to the peer (half the smoothed RTT), 0 if unknown
+ *
+ * For delay compensation and playout (JR timestamp) margins, together
+ * with rtt_var_us and clock_jitter_us.
+ */
+uint32_t midi_net_peer_delay_us(const midi_net_peer_t *peer);
+
+/**
+ * @brief A time on the peer's clock, on ours
+ *
+ * @return peer_us unchanged while no offset is known
+ */
+int64_t midi_net_peer_to_local_us(const midi_net_peer_t *peer, int64_t peer_us);
+
+/**
+ * @brief Peer slot for an address (any state but free), or NULL
+ */
+midi_net_peer_t *midi_net_find(midi_net_t *net, const midi_net_addr_t *addr);
+
+/**
+ * @brief Number of established sessions
+ */
+uint8_t midi_net_num_sessions(const midi_net_t *net);
+
+#endif /* MIDI_NET_H */
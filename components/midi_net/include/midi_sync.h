@@ -0,0 +1,219 @@
+/**
+ * @file midi_sync.h
+ * @brief Clock Synchronization Between Devices (PTP-like, over UDP)
+ *
+ * One device is the master; the others (slaves) discipline their shared
+ * timebase (midi_timebase.h) to its. The exchange follows IEEE 1588's
+ * delay request-response mechanism with software timestamps:
+ *
+ *   master                          slave
+ *     Sync (seq)          t1 ---->  t2
+ *     Follow Up (seq, t1)     ---->
+ *                         t4 <----  t3   Delay Request (seq)
+ *     Delay Response (seq, t4) --->
+ *
+ *   offset (slave - master) = ((t2 - t1) - (t4 - t3)) / 2
+ *   path delay              = ((t2 - t1) + (t4 - t3)) / 2
+ *
+ * t1 is taken right after the Sync went out and travels in the Follow
+ * Up; t2 and t3 are read on the slave's shared timebase, so the offset
+ * is the error the servo has left. Exchanges whose delay is far above
+ * the smoothed path delay were queued somewhere and are discarded.
+ *
+ * The master learns its slaves from their Delay Requests: a slave
+ * without Syncs sends one every interval to subscribe, and is dropped
+ * after MIDI_SYNC_SLAVE_TIMEOUT_INTERVALS of silence. A slave that
+ * misses MIDI_SYNC_LOST_INTERVALS Syncs holds over on its learned
+ * frequency and subscribes again.
+ *
+ * Messages share the Network MIDI 2.0 socket. They start with their own
+ * signature ("MCLK") so the drivers tell them apart with
+ * midi_sync_match(), and standard Network MIDI peers ignore them:
+ *
+ *   word 0   signature "MCLK"
+ *   word 1   type (8) | domain (8) | sequence (16)
+ *   word 2-3 timestamp, shared µs, high word first (0 if unused)
+ *
+ * Like midi_net.h the engine has no socket or clock of its own; calls
+ * on one engine are serialized by the owner.
+ */
+
+#ifndef MIDI_SYNC_H
+#define MIDI_SYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "midi_net.h"
+#include "midi_timebase.h"
+
+//=============================================================================
+// Wire Format
+//=============================================================================
+
+#define MIDI_SYNC_SIGNATURE         0x4D434C4B  /**< "MCLK" */
+#define MIDI_SYNC_MSG_LEN           16
+
+#define MIDI_SYNC_MSG_SYNC          0x01
+#define MIDI_SYNC_MSG_FOLLOW_UP     0x02
+#define MIDI_SYNC_MSG_DELAY_REQ     0x03
+#define MIDI_SYNC_MSG_DELAY_RESP    0x04
+
+//=============================================================================
+// Configuration
+//=============================================================================
+
+#ifdef CONFIG_MIDI_SYNC_INTERVAL_MS
+#define MIDI_SYNC_INTERVAL_MS       CONFIG_MIDI_SYNC_INTERVAL_MS
+#else
+#define MIDI_SYNC_INTERVAL_MS       1000
+#endif
+
+#ifdef CONFIG_MIDI_SYNC_DOMAIN
+#define MIDI_SYNC_DOMAIN            CONFIG_MIDI_SYNC_DOMAIN
+#else
+#define MIDI_SYNC_DOMAIN            0
+#endif
+
+#ifdef CONFIG_MIDI_SYNC_MAX_SLAVES
+#define MIDI_SYNC_MAX_SLAVES        CONFIG_MIDI_SYNC_MAX_SLAVES
+#else
+#define MIDI_SYNC_MAX_SLAVES        8
+#endif
+
+#define MIDI_SYNC_LOST_INTERVALS            4   /**< Missed Syncs before a slave holds over */
+#define MIDI_SYNC_SLAVE_TIMEOUT_INTERVALS   8   /**< Silence before the master drops a slave */
+
+//=============================================================================
+// Types
+//=============================================================================
+
+/**
+ * @brief Part a device plays
+ */
+typedef enum {
+    MIDI_SYNC_ROLE_OFF = 0,
+    MIDI_SYNC_ROLE_MASTER,        /**< Serves its timebase as is */
+    MIDI_SYNC_ROLE_SLAVE          /**< Disciplines its timebase to the master */
+} midi_sync_role_t;
+
+/**
+ * @brief Local clock read (µs), for timestamps taken right after a send
+ */
+typedef int64_t (*midi_sync_clock_fn_t)(void *ctx);
+
+/**
+ * @brief Engine settings
+ */
+typedef struct {
+    midi_sync_role_t role;
+    uint8_t domain;               /**< Messages from other domains are ignored */
+    uint32_t interval_ms;         /**< Sync period (0 = MIDI_SYNC_INTERVAL_MS) */
+    midi_net_addr_t master;       /**< Slave: the master's address */
+    midi_timebase_t *timebase;    /**< Served or disciplined (NULL = midi_timebase_get()) */
+    midi_net_send_fn_t send;
+    midi_sync_clock_fn_t clock;   /**< Optional; without it, sends are stamped with now_us */
+    void *ctx;                    /**< Passed to the callbacks */
+} midi_sync_config_t;
+
+/**
+ * @brief A subscribed slave (master role)
+ */
+typedef struct {
+    midi_net_addr_t addr;
+    int64_t last_seen_us;         /**< Last Delay Request (0 = slot free) */
+} midi_sync_slave_t;
+
+/**
+ * @brief Achieved synchronization (slave role)
+ */
+typedef struct {
+    uint32_t exchanges;           /**< Completed Sync / Delay Request exchanges */
+    uint32_t discarded;           /**< Exchanges dropped as delayed outliers */
+    uint32_t holdovers;           /**< Times the master was lost */
+    int64_t offset_us;            /**< Last measured offset, slave minus master */
+    uint32_t offset_abs_us;       /**< Smoothed |offset|: the accuracy achieved */
+    uint32_t delay_us;            /**< Smoothed one-way path delay */
+    uint32_t delay_var_us;        /**< Path delay variation */
+} midi_sync_stats_t;
+
+/**
+ * @brief Sync engine for one socket
+ */
+typedef struct {
+    midi_sync_config_t config;
+    uint16_t seq;                 /**< Master: current Sync; slave: exchange in progress */
+
+    // Master role
+    midi_sync_slave_t slaves[MIDI_SYNC_MAX_SLAVES];
+
+    // Slave role
+    bool have_sync;               /**< t2 taken for seq */
+    bool awaiting_resp;           /**< Delay Request for seq sent */
+    int64_t t1_us, t2_us, t3_us;
+    int64_t last_sync_us;         /**< Local time of the last Sync from the master */
+    int64_t last_update_us;       /**< Local time of the last timebase correction */
+    bool tracking;                /**< Receiving Syncs (false before the first and after a loss) */
+    midi_sync_stats_t stats;
+
+    int64_t next_us;              /**< Next midi_sync_expire() */
+    uint8_t tx[MIDI_SYNC_MSG_LEN];
+} midi_sync_t;
+
+//=============================================================================
+// API
+//=============================================================================
+
+/**
+ * @brief Settings from Kconfig (role, domain, interval) with the device
+ *        timebase; the caller adds master address and callbacks
+ */
+void midi_sync_config_default(midi_sync_config_t *config);
+
+/**
+ * @brief Whether a datagram is a sync message (checked before midi_net)
+ */
+static inline bool midi_sync_match(const uint8_t *data, size_t len) {
+    return len >= MIDI_SYNC_MSG_LEN && data[0] == 'M' && data[1] == 'C' &&
+           data[2] == 'L' && data[3] == 'K';
+}
+
+/**
+ * @brief Set up an engine
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG
+ */
+esp_err_t midi_sync_init(midi_sync_t *sync, const midi_sync_config_t *config, int64_t now_us);
+
+/**
+ * @brief Handle one sync message
+ *
+ * @param now_us Local time of reception
+ * @return ESP_OK, ESP_ERR_INVALID_SIZE, ESP_ERR_INVALID_RESPONSE (not a
+ *         sync message), ESP_ERR_NOT_FOUND (other domain, not from the
+ *         master, or not expected in this role), ESP_ERR_NO_MEM (master
+ *         with MIDI_SYNC_MAX_SLAVES slaves already)
+ */
+esp_err_t midi_sync_receive(midi_sync_t *sync, const midi_net_addr_t *from,
+                            const uint8_t *data, size_t len, int64_t now_us);
+
+/**
+ * @brief Periodic work: Syncs to the slaves (master) or subscribing and
+ *        loss detection (slave)
+ *
+ * @return Local time to call again
+ */
+int64_t midi_sync_expire(midi_sync_t *sync, int64_t now_us);
+
+/**
+ * @brief Whether the timebase follows a master (always true for a master)
+ */
+bool midi_sync_locked(const midi_sync_t *sync);
+
+/**
+ * @brief Number of subscribed slaves (master role)
+ */
+uint8_t midi_sync_num_slaves(const midi_sync_t *sync, int64_t now_us);
+
+#endif /* MIDI_SYNC_H */
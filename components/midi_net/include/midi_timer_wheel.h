@@ -0,0 +1,142 @@
+/**
+ * @file midi_timer_wheel.h
+ * @brief Hierarchical Timer Wheel and the Shared Timer Service
+ *
+ * Session deadlines (keepalive, timeout, retransmit, FEC flush) of every
+ * network peer live in one hierarchical timer wheel: three levels of 64
+ * slots at MIDI_TIMER_TICK_US resolution, so starting and stopping a
+ * timer is O(1) and only due slots are ever touched. Timers further out
+ * than the wheel spans wait in its last slot and are re-placed when it
+ * cascades.
+ *
+ * The wheel itself is a plain data structure without locking or clock;
+ * the timer service wraps one wheel with a mutex and a single task that
+ * sleeps until the next due slot and runs the expired callbacks, with
+ * the mutex released.
+ */
+
+#ifndef MIDI_TIMER_WHEEL_H
+#define MIDI_TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define MIDI_TIMER_TICK_US          1000    /**< Wheel resolution */
+#define MIDI_TIMER_WHEEL_BITS       6       /**< 64 slots per level */
+#define MIDI_TIMER_WHEEL_SLOTS      (1 << MIDI_TIMER_WHEEL_BITS)
+#define MIDI_TIMER_WHEEL_LEVELS     3       /**< Spans 2^18 ticks (262 s at 1 ms) */
+
+typedef struct midi_timer midi_timer_t;
+
+/**
+ * @brief Expiry callback; may start the same timer again
+ */
+typedef void (*midi_timer_fn_t)(midi_timer_t *timer, void *ctx);
+
+/**
+ * @brief One timer, embedded in its owner
+ */
+struct midi_timer {
+    midi_timer_t *next;           /**< Slot list link */
+    midi_timer_t **pprev;         /**< Link pointing here (NULL when not pending) */
+    uint64_t expires;             /**< Due tick */
+    midi_timer_fn_t fn;
+    void *ctx;
+};
+
+/**
+ * @brief Wheel state
+ */
+typedef struct {
+    midi_timer_t *slots[MIDI_TIMER_WHEEL_LEVELS][MIDI_TIMER_WHEEL_SLOTS]; /**< List heads */
+    midi_timer_t *expired;        /**< Due timers not yet handed out, oldest first */
+    midi_timer_t **expired_tail;
+    uint64_t tick;                /**< Last tick processed */
+    uint32_t pending;             /**< Timers in the slots or expired list */
+} midi_timer_wheel_t;
+
+//=============================================================================
+// Wheel
+//=============================================================================
+
+/**
+ * @brief Set up an empty wheel
+ *
+ * @param now_us Current time; nothing can expire before it
+ */
+void midi_timer_wheel_init(midi_timer_wheel_t *wheel, int64_t now_us);
+
+/**
+ * @brief Prepare a timer for use (not pending)
+ */
+void midi_timer_init(midi_timer_t *timer, midi_timer_fn_t fn, void *ctx);
+
+/**
+ * @brief Whether a timer is pending in a wheel (or due, not yet handed out)
+ */
+static inline bool midi_timer_pending(const midi_timer_t *timer) {
+    return timer->pprev != NULL;
+}
+
+/**
+ * @brief (Re)start a timer, O(1)
+ *
+ * It expires on the first tick at or after at_us, never earlier; a time
+ * already past expires on the next tick.
+ */
+void midi_timer_wheel_add(midi_timer_wheel_t *wheel, midi_timer_t *timer, int64_t at_us);
+
+/**
+ * @brief Stop a timer if pending, O(1)
+ */
+void midi_timer_wheel_cancel(midi_timer_wheel_t *wheel, midi_timer_t *timer);
+
+/**
+ * @brief Move the wheel to now_us, collecting the timers that expire
+ *
+ * Idle stretches are skipped rather than ticked through.
+ */
+void midi_timer_wheel_advance(midi_timer_wheel_t *wheel, int64_t now_us);
+
+/**
+ * @brief Take one expired timer, or NULL; it is no longer pending
+ */
+midi_timer_t *midi_timer_wheel_pop(midi_timer_wheel_t *wheel);
+
+/**
+ * @brief Time the wheel next needs advancing, or 0 if nothing is pending
+ *
+ * For timers in upper levels this is when their slot cascades, which
+ * may be before they expire, never after.
+ */
+int64_t midi_timer_wheel_next_us(const midi_timer_wheel_t *wheel);
+
+//=============================================================================
+// Timer Service
+//=============================================================================
+
+/**
+ * @brief Start the shared timer task (once; later calls do nothing)
+ *
+ * @return ESP_OK, ESP_ERR_NO_MEM
+ */
+esp_err_t midi_timer_service_init(void);
+
+/**
+ * @brief (Re)start a timer on the shared wheel, due at at_us (esp_timer clock)
+ *
+ * Callbacks run on the timer task. Safe to call from any task and from
+ * callbacks; callers may hold their own locks, the service never holds
+ * its lock while calling out.
+ */
+void midi_timer_start(midi_timer_t *timer, int64_t at_us);
+
+/**
+ * @brief Stop a timer on the shared wheel
+ *
+ * A callback already handed to the timer task may still run once.
+ */
+void midi_timer_stop(midi_timer_t *timer);
+
+#endif /* MIDI_TIMER_WHEEL_H */
@@ -0,0 +1,1023 @@
+/**
+ * @file midi_net.c
+ * @brief Network MIDI 2.0 (UDP) Session Protocol
+ */
+
+#include "midi_net.h"
+#include "ump_parser.h"
+#include "ump_endpoint.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "midi_net";
+
+#define ADDR_FMT        "%u.%u.%u.%u:%u"
+#define ADDR_ARGS(a)    ((const uint8_t *)&(a)->ip)[0], ((const uint8_t *)&(a)->ip)[1], \
+                        ((const uint8_t *)&(a)->ip)[2], ((const uint8_t *)&(a)->ip)[3], (a)->port
+
+/** Payload words of an Invitation or its reply: name, then product instance ID */
+#define NAME_WORDS      ((UMP_ENDPOINT_NAME_MAX + 3) / 4)
+#define PRODUCT_WORDS   ((MIDI_NET_PRODUCT_ID_MAX + 3) / 4)
+
+//=============================================================================
+// Datagram Building
+//=============================================================================
+
+static inline void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void dgram_begin(midi_net_t *net) {
+    put_be32(net->tx, MIDI_NET_SIGNATURE);
+    net->tx_len = 4;
+}
+
+static bool dgram_add(midi_net_t *net, uint8_t code, uint16_t specific,
+                      const uint32_t *payload, uint8_t num_words) {
+    size_t size = 4 + 4 * (size_t)num_words;
+    uint8_t *p = net->tx + net->tx_len;
+
+    if (net->tx_len + size > MIDI_NET_MTU) {
+        return false;
+    }
+    put_be32(p, ((uint32_t)code << 24) | ((uint32_t)num_words << 16) | specific);
+    for (uint8_t i = 0; i < num_words; i++) {
+        put_be32(p + 4 + 4 * i, payload[i]);
+    }
+    net->tx_len += size;
+    return true;
+}
+
+/**
+ * @brief Send the datagram built so far; peer may be NULL (no session)
+ */
+static void dgram_send(midi_net_t *net, midi_net_peer_t *peer, const midi_net_addr_t *to,
+                       int64_t now_us) {
+    if (net->config.send(to, net->tx, net->tx_len, net->config.ctx) != ESP_OK) {
+        ESP_LOGD(TAG, "Send to " ADDR_FMT " failed", ADDR_ARGS(to));
+    }
+    if (peer) {
+        peer->last_tx_us = now_us;
+    }
+}
+
+/**
+ * @brief One command alone in a datagram
+ */
+static void send_command(midi_net_t *net, midi_net_peer_t *peer, const midi_net_addr_t *to,
+                         uint8_t code, uint16_t specific, const uint32_t *payload,
+                         uint8_t num_words, int64_t now_us) {
+    dgram_begin(net);
+    dgram_add(net, code, specific, payload, num_words);
+    dgram_send(net, peer, to, now_us);
+}
+
+/**
+ * @brief When an established peer needs a Ping: percent of a ping interval after
+ *        the later of its last datagram and our last Ping
+ *
+ * The invited side allows twice the interval: while idle, the inviter's
+ * Pings (and our replies) keep the session alive.
+ */
+static inline int64_t ping_due_us(const midi_net_t *net, const midi_net_peer_t *peer,
+                                  uint32_t percent) {
+    int64_t since = (peer->last_rx_us > peer->last_ping_us) ? peer->last_rx_us : peer->last_ping_us;
+    int64_t interval_us = (int64_t)net->config.ping_interval_ms * (peer->inviter ? 10 : 20);
+    return since + interval_us * percent;
+}
+
+/**
+ * @brief Add a Ping to the datagram being built
+ */
+static void dgram_add_ping(midi_net_t *net, midi_net_peer_t *peer, int64_t now_us) {
+    uint32_t id = ++net->next_ping_id;
+
+    if (dgram_add(net, MIDI_NET_CMD_PING, 0, &id, 1)) {
+        peer->ping_id = id;
+        peer->last_ping_us = now_us;
+        peer->pings_sent++;
+    }
+}
+
+/**
+ * @brief Let UMP Data carry the Ping a quiet peer will soon need
+ */
+static void dgram_piggyback_ping(midi_net_t *net, midi_net_peer_t *peer, int64_t now_us) {
+    if (now_us >= ping_due_us(net, peer, MIDI_NET_PING_PIGGYBACK_PCT)) {
+        dgram_add_ping(net, peer, now_us);
+        peer->pings_piggybacked++;
+    }
+}
+
+static void send_bye(midi_net_t *net, midi_net_peer_t *peer, const midi_net_addr_t *to,
+                     uint8_t reason, int64_t now_us) {
+    send_command(net, peer, to, MIDI_NET_CMD_BYE, (uint16_t)reason << 8, NULL, 0, now_us);
+}
+
+/**
+ * @brief Text as big-endian words, zero padded
+ *
+ * @return Words written
+ */
+static uint8_t text_to_words(const char *text, size_t max, uint32_t *out) {
+    size_t len = text ? strnlen(text, max) : 0;
+    uint8_t num_words = (len + 3) / 4;
+
+    for (uint8_t i = 0; i < num_words; i++) {
+        uint32_t word = 0;
+        for (size_t b = 0; b < 4; b++) {
+            size_t at = (size_t)i * 4 + b;
+            word = (word << 8) | (at < len ? (uint8_t)text[at] : 0);
+        }
+        out[i] = word;
+    }
+    return num_words;
+}
+
+static void words_to_text(const uint8_t *payload, size_t num_words, char *out, size_t size) {
+    size_t len = 0;
+
+    for (size_t at = 0; at < num_words * 4 && len + 1 < size && payload[at]; at++) {
+        out[len++] = (char)payload[at];
+    }
+    out[len] = '\0';
+}
+
+/**
+ * @brief Invitation or Invitation Reply: Accepted, carrying our identity
+ */
+static void send_identity(midi_net_t *net, midi_net_peer_t *peer, uint8_t code, int64_t now_us) {
+    uint32_t payload[NAME_WORDS + PRODUCT_WORDS];
+    uint8_t name_words = text_to_words(net->config.name, UMP_ENDPOINT_NAME_MAX, payload);
+    uint8_t product_words = text_to_words(net->config.product_instance_id,
+                                          MIDI_NET_PRODUCT_ID_MAX, payload + name_words);
+
+    // Second specific byte: capabilities (no authentication; clock in Ping Replies)
+    send_command(net, peer, &peer->addr, code, ((uint16_t)name_words << 8) | MIDI_NET_CAP_PING_CLOCK,
+                 payload, name_words + product_words, now_us);
+}
+
+//=============================================================================
+// Peers
+//=============================================================================
+
+static inline bool addr_equal(const midi_net_addr_t *a, const midi_net_addr_t *b) {
+    return a->ip == b->ip && a->port == b->port;
+}
+
+midi_net_peer_t *midi_net_find(midi_net_t *net, const midi_net_addr_t *addr) {
+    if (!net || !addr) {
+        return NULL;
+    }
+    for (uint8_t i = 0; i < net->max_peers; i++) {
+        midi_net_peer_t *peer = &net->peers[i];
+        if (peer->state != MIDI_NET_PEER_FREE && addr_equal(&peer->addr, addr)) {
+            return peer;
+        }
+    }
+    return NULL;
+}
+
+uint8_t midi_net_num_sessions(const midi_net_t *net) {
+    uint8_t count = 0;
+
+    for (uint8_t i = 0; net && i < net->max_peers; i++) {
+        if (net->peers[i].state == MIDI_NET_PEER_ESTABLISHED) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Sequence numbers back to 0 in both directions, history dropped
+ */
+static void reset_sequence(midi_net_peer_t *peer) {
+    peer->tx_seq = 0;
+    peer->rx_next = 0;
+    peer->rx_window = UINT32_MAX; // Nothing before 0 is missing
+    peer->history_head = 0;
+    peer->history_count = 0;
+    peer->retx_due_us = 0;
+    peer->fec_flush_us = 0;
+}
+
+/**
+ * @brief Earliest thing the peer waits for, 0 if nothing
+ */
+static int64_t peer_deadline(const midi_net_t *net, const midi_net_peer_t *peer) {
+    int64_t interval_us = (int64_t)net->config.ping_interval_ms * 1000;
+    int64_t timeout_us = (int64_t)net->config.timeout_ms * 1000;
+    int64_t due;
+
+    switch (peer->state) {
+    case MIDI_NET_PEER_ESTABLISHED:
+    case MIDI_NET_PEER_INVITING:
+        due = (peer->state == MIDI_NET_PEER_ESTABLISHED) ? ping_due_us(net, peer, 100) :
+              peer->last_ping_us + interval_us;
+        if (peer->last_rx_us + timeout_us < due) {
+            due = peer->last_rx_us + timeout_us;
+        }
+        break;
+    case MIDI_NET_PEER_CLOSING:
+        return peer->last_ping_us + interval_us;
+    default:
+        return 0;
+    }
+    if (peer->retx_due_us && peer->retx_due_us < due) {
+        due = peer->retx_due_us;
+    }
+    if (peer->fec_flush_us && peer->fec_flush_us < due) {
+        due = peer->fec_flush_us;
+    }
+    return due;
+}
+
+/**
+ * @brief Tell the owner if the peer's deadline moved earlier or went away
+ */
+static void peer_schedule(midi_net_t *net, midi_net_peer_t *peer) {
+    int64_t due = peer_deadline(net, peer);
+
+    if (due == peer->due_us || (due && peer->due_us && due > peer->due_us)) {
+        return; // Found when the earlier deadline expires
+    }
+    peer->due_us = due;
+    if (net->config.schedule) {
+        net->config.schedule(peer, due, net->config.ctx);
+    }
+}
+
+static midi_net_peer_t *peer_alloc(midi_net_t *net, const midi_net_addr_t *addr,
+                                   midi_net_peer_state_t state, int64_t now_us) {
+    for (uint8_t i = 0; i < net->max_peers; i++) {
+        midi_net_peer_t *peer = &net->peers[i];
+        if (peer->state == MIDI_NET_PEER_FREE) {
+            memset(peer, 0, sizeof(*peer));
+            peer->state = state;
+            peer->addr = *addr;
+            peer->last_rx_us = now_us;
+            reset_sequence(peer);
+            return peer;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Free a slot, telling the owner if a session ends with it
+ */
+static void peer_free(midi_net_t *net, midi_net_peer_t *peer) {
+    if (peer->state == MIDI_NET_PEER_ESTABLISHED && net->config.on_session) {
+        net->config.on_session(peer, false, net->config.ctx);
+    }
+    peer->state = MIDI_NET_PEER_FREE;
+    peer_schedule(net, peer);
+}
+
+static void session_negotiate(midi_net_t *net, midi_net_peer_t *peer, int64_t now_us);
+
+static void session_open(midi_net_t *net, midi_net_peer_t *peer, const uint8_t *payload,
+                         uint8_t name_words, int64_t now_us) {
+    bool was_open = (peer->state == MIDI_NET_PEER_ESTABLISHED);
+
+    words_to_text(payload, name_words, peer->endpoint_name, sizeof(peer->endpoint_name));
+    reset_sequence(peer);
+    peer->state = MIDI_NET_PEER_ESTABLISHED;
+    peer->last_ping_us = now_us; // The handshake just proved the peer alive
+    peer_schedule(net, peer);
+    ESP_LOGI(TAG, "Session with " ADDR_FMT " (%s)%s", ADDR_ARGS(&peer->addr),
+             peer->endpoint_name, was_open ? " restarted" : "");
+    if (!was_open && net->config.on_session) {
+        net->config.on_session(peer, true, net->config.ctx);
+    }
+    session_negotiate(net, peer, now_us);
+}
+
+//=============================================================================
+// History, FEC and Retransmission
+//=============================================================================
+
+static midi_net_history_t *history_push(midi_net_peer_t *peer) {
+    midi_net_history_t *entry = &peer->history[peer->history_head];
+
+    peer->history_head = (peer->history_head + 1) % MIDI_NET_HISTORY_SIZE;
+    if (peer->history_count < MIDI_NET_HISTORY_SIZE) {
+        peer->history_count++;
+    }
+    return entry;
+}
+
+static midi_net_history_t *history_find(midi_net_peer_t *peer, uint16_t seq) {
+    uint16_t age = (uint16_t)(peer->tx_seq - 1 - seq); // 0 = newest
+    if (age >= peer->history_count) {
+        return NULL;
+    }
+    midi_net_history_t *entry =
+        &peer->history[(peer->history_head + MIDI_NET_HISTORY_SIZE - 1 - age) % MIDI_NET_HISTORY_SIZE];
+    return (entry->seq == seq) ? entry : NULL;
+}
+
+/**
+ * @brief One UMP Data command to one session, behind the FEC copies of
+ *        the previous ones
+ */
+static void send_ump_peer(midi_net_t *net, midi_net_peer_t *peer, const uint32_t *words,
+                          uint8_t num_words, uint8_t hops, int64_t now_us) {
+    midi_net_history_t *entry = history_push(peer);
+    entry->seq = peer->tx_seq++;
+    entry->num_words = 0;
+    if (hops) {
+        entry->words[entry->num_words++] = MIDI_NET_HOP_MARKER | hops;
+    }
+    memcpy(&entry->words[entry->num_words], words, sizeof(uint32_t) * num_words);
+    entry->num_words += num_words;
+
+    // FEC: the commands before this one, oldest first
+    dgram_begin(net);
+    uint8_t fec = net->config.fec_depth;
+    if (fec > peer->history_count - 1) {
+        fec = peer->history_count - 1;
+    }
+    for (uint8_t back = fec; back > 0; back--) {
+        midi_net_history_t *copy = history_find(peer, entry->seq - back);
+        if (copy) {
+            dgram_add(net, MIDI_NET_CMD_UMP_DATA, copy->seq, copy->words, copy->num_words);
+        }
+    }
+    dgram_add(net, MIDI_NET_CMD_UMP_DATA, entry->seq, entry->words, entry->num_words);
+    dgram_piggyback_ping(net, peer, now_us);
+    dgram_send(net, peer, &peer->addr, now_us);
+    peer->packets_tx++;
+
+    if (net->config.fec_depth) {
+        peer->fec_flush_us = now_us + MIDI_NET_FEC_FLUSH_MS * 1000;
+        peer_schedule(net, peer);
+    }
+}
+
+static void answer_retransmit(midi_net_t *net, midi_net_peer_t *peer, uint16_t first,
+                              uint16_t count, int64_t now_us) {
+    if (!history_find(peer, first)) {
+        uint32_t payload = (uint32_t)first << 16;
+        send_command(net, peer, &peer->addr, MIDI_NET_CMD_RETRANSMIT_ERROR,
+                     (uint16_t)MIDI_NET_RETX_ERROR_NOT_IN_BUFFER << 8, &payload, 1, now_us);
+        return;
+    }
+    dgram_begin(net);
+    for (uint16_t i = 0; i < (count ? count : 1); i++) {
+        midi_net_history_t *entry = history_find(peer, first + i);
+        if (!entry || !dgram_add(net, MIDI_NET_CMD_UMP_DATA, entry->seq, entry->words,
+                                 entry->num_words)) {
+            break;
+        }
+        peer->packets_retransmitted++;
+        net->stats.packets_retransmitted++;
+    }
+    dgram_send(net, peer, &peer->addr, now_us);
+}
+
+//=============================================================================
+// UMP Endpoint and Delivery
+//=============================================================================
+
+/**
+ * @brief Where endpoint replies go: the session the request came from
+ */
+typedef struct {
+    midi_net_t *net;
+    midi_net_peer_t *peer;
+    int64_t now_us;
+} endpoint_reply_t;
+
+static void endpoint_reply_tx(const ump_packet_t *ump, void *ctx) {
+    endpoint_reply_t *reply = ctx;
+    send_ump_peer(reply->net, reply->peer, ump->words, ump->num_words, 0, reply->now_us);
+}
+
+/**
+ * @brief Start a new session's negotiation: default settings, then ask
+ *        the peer what it is
+ */
+static void session_negotiate(midi_net_t *net, midi_net_peer_t *peer, int64_t now_us) {
+    if (!net->config.endpoint) {
+        return;
+    }
+    endpoint_reply_t reply = { .net = net, .peer = peer, .now_us = now_us };
+    ump_endpoint_link_init(net->config.endpoint(net->config.ctx), &peer->link);
+    ump_endpoint_discover(endpoint_reply_tx, &reply);
+}
+
+/**
+ * @brief Answer a UMP Stream message on its session
+ *
+ * @return true if it was for the endpoint (consumed)
+ */
+static bool session_stream(midi_net_t *net, midi_net_peer_t *peer, const ump_packet_t *ump,
+                           int64_t now_us) {
+    if (!net->config.endpoint || UMP_GET_MT(ump->words[0]) != UMP_MT_UMP_STREAM) {
+        return false;
+    }
+    endpoint_reply_t reply = { .net = net, .peer = peer, .now_us = now_us };
+    // Start/End of Clip and unknown statuses are delivered like any other UMP
+    return ump_endpoint_handle(net->config.endpoint(net->config.ctx), &peer->link, ump,
+                               endpoint_reply_tx, &reply) == ESP_OK;
+}
+
+/**
+ * @brief Ask again for the oldest run of missing commands the sender may still hold
+ *
+ * @return false if nothing is missing any more
+ */
+static bool request_missing(midi_net_t *net, midi_net_peer_t *peer, int64_t now_us) {
+    int span = MIDI_NET_HISTORY_SIZE < 32 ? MIDI_NET_HISTORY_SIZE : 32;
+
+    for (int bit = span - 1; bit >= 0; bit--) {
+        if (peer->rx_window & (1u << bit)) {
+            continue;
+        }
+        uint32_t run = 1;
+        while (bit - (int)run >= 0 && !(peer->rx_window & (1u << (bit - run)))) {
+            run++;
+        }
+        uint32_t count = run << 16;
+        send_command(net, peer, &peer->addr, MIDI_NET_CMD_RETRANSMIT_REQUEST,
+                     (uint16_t)(peer->rx_next - 1 - bit), &count, 1, now_us);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief The newest UMP Data commands again, for a lost last datagram
+ */
+static void send_fec_flush(midi_net_t *net, midi_net_peer_t *peer, int64_t now_us) {
+    uint8_t depth = net->config.fec_depth;
+
+    if (depth > peer->history_count) {
+        depth = peer->history_count;
+    }
+    if (depth == 0) {
+        return;
+    }
+    dgram_begin(net);
+    for (uint8_t back = depth; back > 0; back--) {
+        midi_net_history_t *copy = history_find(peer, peer->tx_seq - back);
+        if (copy) {
+            dgram_add(net, MIDI_NET_CMD_UMP_DATA, copy->seq, copy->words, copy->num_words);
+        }
+    }
+    dgram_piggyback_ping(net, peer, now_us);
+    dgram_send(net, peer, &peer->addr, now_us);
+}
+
+/**
+ * @brief Deliver the UMP of one UMP Data command, tagging each message
+ *
+ * A hop marker applies to the message after it and is not delivered.
+ */
+static void deliver(midi_net_t *net, midi_net_peer_t *peer, uint16_t seq,
+                    const uint8_t *payload, uint8_t num_words, int64_t now_us) {
+    uint32_t slot = (uint32_t)(peer - net->peers);
+    uint32_t index = 0;
+    uint8_t hops = 0;
+    uint8_t at = 0;
+
+    while (at < num_words) {
+        uint32_t words[UMP_MAX_WORDS] = { 0 };
+        ump_packet_t ump;
+        for (uint8_t i = 0; i < UMP_MAX_WORDS && at + i < num_words; i++) {
+            words[i] = get_be32(payload + 4 * (at + i));
+        }
+        if (MIDI_NET_IS_HOP_MARKER(words[0])) {
+            hops = (uint8_t)words[0];
+            at++;
+            continue;
+        }
+        if (ump_parser_parse_packet(words, &ump) != ESP_OK || ump.num_words > num_words - at) {
+            ESP_LOGW(TAG, "Truncated UMP from " ADDR_FMT, ADDR_ARGS(&peer->addr));
+            break;
+        }
+        // Slot, sequence number and position: unique per transport, never 0
+        peer->last_rx_seq = (slot << 25) | ((uint32_t)seq << 9) | (++index & 0x1FF);
+        peer->last_rx_hops = hops;
+        if (!session_stream(net, peer, &ump, now_us)) {
+            net->config.on_ump(peer, &ump, net->config.ctx);
+        }
+        hops = 0;
+        at += ump.num_words;
+    }
+    peer->last_rx_hops = 0;
+    peer->packets_rx++;
+}
+
+/**
+ * @brief Sequence check of one received UMP Data command
+ *
+ * In-order and late (gap-filling) commands are delivered, copies
+ * dropped. A gap is counted lost until filled and, if retransmission
+ * is on, asked for again; delivery goes on past it.
+ *
+ * @param fec_copy Another UMP Data command follows in the same datagram
+ */
+static void receive_ump_data(midi_net_t *net, midi_net_peer_t *peer, uint16_t seq,
+                             const uint8_t *payload, uint8_t num_words, bool fec_copy,
+                             int64_t now_us) {
+    int16_t ahead = (int16_t)(seq - peer->rx_next);
+
+    if (ahead < 0) {
+        uint32_t bit = (uint32_t)(-ahead) - 1;
+        if (bit >= 32 || (peer->rx_window & (1u << bit))) {
+            peer->duplicates++;
+            net->stats.duplicates++;
+            return;
+        }
+        peer->rx_window |= 1u << bit;
+        if (peer->packets_lost) {
+            peer->packets_lost--;
+        }
+        if (net->stats.packets_lost) {
+            net->stats.packets_lost--; // May have been reset since
+        }
+        peer->packets_recovered_retransmit++;
+        net->stats.packets_recovered_retransmit++;
+    } else {
+        if (ahead > 0) {
+            peer->packets_lost += ahead;
+            net->stats.packets_lost += ahead;
+            ESP_LOGD(TAG, "Gap of %d before #%u from " ADDR_FMT, ahead, seq, ADDR_ARGS(&peer->addr));
+            if (net->config.retransmit && ahead <= MIDI_NET_HISTORY_SIZE) {
+                uint32_t count = (uint32_t)ahead << 16;
+                send_command(net, peer, &peer->addr, MIDI_NET_CMD_RETRANSMIT_REQUEST,
+                             peer->rx_next, &count, 1, now_us);
+                peer->retx_tries = 1;
+                peer->retx_due_us = now_us + midi_net_peer_retransmit_timeout_us(peer);
+                peer_schedule(net, peer);
+            }
+        }
+        uint32_t shift = (uint32_t)ahead + 1;
+        peer->rx_window = (shift >= 32) ? 1 : ((peer->rx_window << shift) | 1);
+        peer->rx_next = seq + 1;
+        if (fec_copy) {
+            peer->packets_recovered_fec++;
+            net->stats.packets_recovered_fec++;
+        }
+    }
+    deliver(net, peer, seq, payload, num_words, now_us);
+}
+
+//=============================================================================
+// Path Estimates
+//=============================================================================
+
+/**
+ * @brief Fold in one Ping round trip: sent at t1, answered at peer_us
+ *        on the peer's clock (if has_clock), reply received at t4
+ */
+static void path_sample(midi_net_peer_t *peer, int64_t t1, int64_t t4, bool has_clock,
+                        int64_t peer_us) {
+    uint32_t rtt = (t4 > t1) ? (uint32_t)(t4 - t1) : 0;
+
+    if (peer->rtt_samples == 0) {
+        peer->rtt_us = rtt;
+        peer->rtt_var_us = rtt / 2;
+        peer->rtt_min_us = rtt;
+    } else {
+        uint32_t err = (rtt > peer->rtt_us) ? rtt - peer->rtt_us : peer->rtt_us - rtt;
+        peer->rtt_var_us = peer->rtt_var_us - peer->rtt_var_us / 4 + err / 4;
+        peer->rtt_us = peer->rtt_us - peer->rtt_us / 8 + rtt / 8;
+        if (rtt < peer->rtt_min_us) {
+            peer->rtt_min_us = rtt;
+        }
+    }
+    if (peer->rtt_samples < UINT16_MAX) {
+        peer->rtt_samples++;
+    }
+    if (!has_clock) {
+        return;
+    }
+
+    // A round trip far above normal was queued one way; its offset is skewed
+    if (peer->offset_samples && rtt > peer->rtt_us + 4 * peer->rtt_var_us) {
+        return;
+    }
+    int64_t offset = peer_us - t1 - (int64_t)(rtt / 2);
+    if (peer->offset_samples == 0) {
+        peer->clock_offset_us = offset;
+        peer->clock_jitter_us = 0;
+    } else {
+        int64_t diff = offset - peer->clock_offset_us;
+        uint32_t dev = (uint32_t)(diff < 0 ? -diff : diff);
+        peer->clock_jitter_us = peer->clock_jitter_us - peer->clock_jitter_us / 16 + dev / 16;
+        peer->clock_offset_us += diff / 8;
+    }
+    if (peer->offset_samples < UINT16_MAX) {
+        peer->offset_samples++;
+    }
+}
+
+uint32_t midi_net_peer_retransmit_timeout_us(const midi_net_peer_t *peer) {
+    if (!peer || peer->rtt_samples == 0) {
+        return MIDI_NET_RETRANSMIT_TIMEOUT_MS * 1000;
+    }
+    uint32_t rto = peer->rtt_us + 4 * peer->rtt_var_us;
+    if (rto < MIDI_NET_RETRANSMIT_MIN_MS * 1000) {
+        rto = MIDI_NET_RETRANSMIT_MIN_MS * 1000;
+    }
+    if (rto > MIDI_NET_RETRANSMIT_MAX_MS * 1000) {
+        rto = MIDI_NET_RETRANSMIT_MAX_MS * 1000;
+    }
+    return rto;
+}
+
+uint32_t midi_net_peer_delay_us(const midi_net_peer_t *peer) {
+    return (peer && peer->rtt_samples) ? peer->rtt_us / 2 : 0;
+}
+
+int64_t midi_net_peer_to_local_us(const midi_net_peer_t *peer, int64_t peer_us) {
+    return (peer && peer->offset_samples) ? peer_us - peer->clock_offset_us : peer_us;
+}
+
+//=============================================================================
+// Receive
+//=============================================================================
+
+/**
+ * @brief Commands only a peer with an open session may send
+ */
+static bool needs_session(uint8_t code) {
+    switch (code) {
+    case MIDI_NET_CMD_PING:
+    case MIDI_NET_CMD_PING_REPLY:
+    case MIDI_NET_CMD_RETRANSMIT_REQUEST:
+    case MIDI_NET_CMD_RETRANSMIT_ERROR:
+    case MIDI_NET_CMD_SESSION_RESET:
+    case MIDI_NET_CMD_SESSION_RESET_REPLY:
+    case MIDI_NET_CMD_UMP_DATA:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Handle one command
+ *
+ * @return false to ignore the rest of the datagram
+ */
+static bool handle_command(midi_net_t *net, midi_net_peer_t **peer_io, const midi_net_addr_t *from,
+                           uint32_t header, const uint8_t *payload, bool fec_copy,
+                           int64_t now_us) {
+    midi_net_peer_t *peer = *peer_io;
+    uint8_t code = header >> 24;
+    uint8_t num_words = (header >> 16) & 0xFF;
+    uint16_t specific = header & 0xFFFF;
+
+    if (needs_session(code) && (!peer || peer->state != MIDI_NET_PEER_ESTABLISHED)) {
+        send_bye(net, peer, from, MIDI_NET_BYE_NO_SESSION, now_us);
+        return false;
+    }
+
+    switch (code) {
+    case MIDI_NET_CMD_INVITATION:
+        if (!net->config.accept_invitations) {
+            send_command(net, peer, from, MIDI_NET_CMD_NAK, MIDI_NET_NAK_NOT_EXPECTED << 8,
+                         &header, 1, now_us);
+            return false;
+        }
+        if (!peer) {
+            peer = peer_alloc(net, from, MIDI_NET_PEER_INVITING, now_us);
+            if (!peer) {
+                ESP_LOGW(TAG, "No session slot for " ADDR_FMT, ADDR_ARGS(from));
+                send_bye(net, NULL, from, MIDI_NET_BYE_TOO_MANY_SESSIONS, now_us);
+                return false;
+            }
+            *peer_io = peer;
+        }
+        peer->ping_clock = (specific & MIDI_NET_CAP_PING_CLOCK) != 0;
+        send_identity(net, peer, MIDI_NET_CMD_INVITATION_ACCEPTED, now_us);
+        session_open(net, peer, payload, (specific >> 8) < num_words ? (specific >> 8) : num_words,
+                     now_us);
+        return true;
+
+    case MIDI_NET_CMD_INVITATION_ACCEPTED:
+        if (!peer) {
+            send_bye(net, NULL, from, MIDI_NET_BYE_NO_PENDING_SESSION, now_us);
+            return false;
+        }
+        if (peer->state == MIDI_NET_PEER_INVITING) {
+            peer->ping_clock = (specific & MIDI_NET_CAP_PING_CLOCK) != 0;
+            session_open(net, peer, payload, (specific >> 8) < num_words ? (specific >> 8) : num_words,
+                         now_us);
+        }
+        return true;
+
+    case MIDI_NET_CMD_INVITATION_PENDING:
+        return true; // Keep inviting until accepted or timed out
+
+    case MIDI_NET_CMD_PING: {
+        // Echo the ID, then our clock for the pinger's offset estimate if it asked
+        uint32_t reply[3] = {
+            num_words ? get_be32(payload) : 0, (uint32_t)((uint64_t)now_us >> 32), (uint32_t)now_us
+        };
+        send_command(net, peer, from, MIDI_NET_CMD_PING_REPLY, 0, reply, peer->ping_clock ? 3 : 1,
+                     now_us);
+        return true;
+    }
+
+    case MIDI_NET_CMD_PING_REPLY:
+        // Any reply counts as traffic (last_rx_us); the one to our last Ping is a sample
+        if (num_words && peer->ping_id && get_be32(payload) == peer->ping_id) {
+            bool has_clock = num_words >= 3;
+            int64_t peer_us = has_clock ? (int64_t)(((uint64_t)get_be32(payload + 4) << 32) |
+                                                    get_be32(payload + 8)) : 0;
+            path_sample(peer, peer->last_ping_us, now_us, has_clock, peer_us);
+            peer->ping_id = 0;
+        }
+        return true;
+
+    case MIDI_NET_CMD_RETRANSMIT_REQUEST:
+        answer_retransmit(net, peer, specific, num_words ? get_be32(payload) >> 16 : 1, now_us);
+        return true;
+
+    case MIDI_NET_CMD_RETRANSMIT_ERROR:
+        ESP_LOGD(TAG, ADDR_FMT " cannot resend #%u", ADDR_ARGS(from),
+                 num_words ? (unsigned)(get_be32(payload) >> 16) : 0);
+        peer->retx_due_us = 0;
+        return true; // The gap stays counted as lost
+
+    case MIDI_NET_CMD_SESSION_RESET:
+        reset_sequence(peer);
+        send_command(net, peer, from, MIDI_NET_CMD_SESSION_RESET_REPLY, 0, NULL, 0, now_us);
+        return true;
+
+    case MIDI_NET_CMD_SESSION_RESET_REPLY:
+        return true; // Reset when requested
+
+    case MIDI_NET_CMD_NAK:
+        net->stats.naks++;
+        ESP_LOGW(TAG, "NAK 0x%02X from " ADDR_FMT " for command 0x%02X", specific >> 8,
+                 ADDR_ARGS(from), num_words ? payload[0] : 0);
+        return true;
+
+    case MIDI_NET_CMD_BYE:
+        send_command(net, peer, from, MIDI_NET_CMD_BYE_REPLY, 0, NULL, 0, now_us);
+        if (peer) {
+            ESP_LOGI(TAG, "Bye (0x%02X) from " ADDR_FMT, specific >> 8, ADDR_ARGS(from));
+            peer_free(net, peer);
+            *peer_io = NULL;
+        }
+        return false;
+
+    case MIDI_NET_CMD_BYE_REPLY:
+        if (peer && peer->state == MIDI_NET_PEER_CLOSING) {
+            peer_free(net, peer);
+            *peer_io = NULL;
+        }
+        return false;
+
+    case MIDI_NET_CMD_UMP_DATA:
+        receive_ump_data(net, peer, specific, payload, num_words, fec_copy, now_us);
+        return true;
+
+    default:
+        send_command(net, peer, from, MIDI_NET_CMD_NAK, MIDI_NET_NAK_NOT_SUPPORTED << 8,
+                     &header, 1, now_us);
+        return true;
+    }
+}
+
+esp_err_t midi_net_receive(midi_net_t *net, const midi_net_addr_t *from,
+                           const uint8_t *data, size_t len, int64_t now_us) {
+    if (!net || !from || !data) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (len < 4 || len % 4) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (get_be32(data) != MIDI_NET_SIGNATURE) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    midi_net_peer_t *peer = midi_net_find(net, from);
+    if (peer) {
+        peer->last_rx_us = now_us;
+    }
+
+    size_t pos = 4;
+    while (pos + 4 <= len) {
+        uint32_t header = get_be32(data + pos);
+        size_t size = 4 + 4 * (size_t)((header >> 16) & 0xFF);
+        if (pos + size > len) {
+            send_command(net, peer, from, MIDI_NET_CMD_NAK, MIDI_NET_NAK_MALFORMED << 8,
+                         &header, 1, now_us);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        const uint8_t *payload = data + pos + 4;
+        pos += size;
+
+        bool fec_copy = (header >> 24) == MIDI_NET_CMD_UMP_DATA &&
+                        pos + 4 <= len && data[pos] == MIDI_NET_CMD_UMP_DATA;
+        if (!handle_command(net, &peer, from, header, payload, fec_copy, now_us)) {
+            break;
+        }
+    }
+    return ESP_OK;
+}
+
+//=============================================================================
+// Sessions and Sending
+//=============================================================================
+
+esp_err_t midi_net_init(midi_net_t *net, const midi_net_config_t *config,
+                        midi_net_peer_t *peers, uint8_t max_peers) {
+    if (!net || !config || !config->send || !config->on_ump || !peers || max_peers == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(net, 0, sizeof(*net));
+    memset(peers, 0, sizeof(*peers) * max_peers);
+    net->config = *config;
+    net->peers = peers;
+    net->max_peers = max_peers;
+    if (net->config.fec_depth >= MIDI_NET_HISTORY_SIZE) {
+        net->config.fec_depth = MIDI_NET_HISTORY_SIZE - 1;
+    }
+    if (net->config.ping_interval_ms == 0) {
+        net->config.ping_interval_ms = MIDI_NET_PING_INTERVAL_MS;
+    }
+    if (net->config.timeout_ms == 0) {
+        net->config.timeout_ms = MIDI_NET_SESSION_TIMEOUT_MS;
+    }
+    return ESP_OK;
+}
+
+esp_err_t midi_net_invite(midi_net_t *net, const midi_net_addr_t *to, int64_t now_us) {
+    if (!net || !to) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    midi_net_peer_t *peer = midi_net_find(net, to);
+    if (peer && peer->state == MIDI_NET_PEER_ESTABLISHED) {
+        return ESP_OK;
+    }
+    if (!peer) {
+        peer = peer_alloc(net, to, MIDI_NET_PEER_INVITING, now_us);
+        if (!peer) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    peer->state = MIDI_NET_PEER_INVITING;
+    peer->inviter = true;
+    peer->last_ping_us = now_us;
+    send_identity(net, peer, MIDI_NET_CMD_INVITATION, now_us);
+    peer_schedule(net, peer);
+    return ESP_OK;
+}
+
+esp_err_t midi_net_bye(midi_net_t *net, const midi_net_addr_t *to, uint8_t reason,
+                       int64_t now_us) {
+    midi_net_peer_t *peer = midi_net_find(net, to);
+    if (!peer) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    send_bye(net, peer, &peer->addr, reason, now_us);
+    if (peer->state == MIDI_NET_PEER_ESTABLISHED && net->config.on_session) {
+        net->config.on_session(peer, false, net->config.ctx);
+    }
+    peer->state = MIDI_NET_PEER_CLOSING;
+    peer->last_ping_us = now_us;
+    peer_schedule(net, peer);
+    return ESP_OK;
+}
+
+void midi_net_close_all(midi_net_t *net, uint8_t reason, int64_t now_us) {
+    for (uint8_t i = 0; net && i < net->max_peers; i++) {
+        midi_net_peer_t *peer = &net->peers[i];
+        if (peer->state != MIDI_NET_PEER_FREE) {
+            send_bye(net, peer, &peer->addr, reason, now_us);
+            peer_free(net, peer);
+        }
+    }
+}
+
+esp_err_t midi_net_send_ump(midi_net_t *net, const uint32_t *words, uint8_t num_words,
+                            int64_t now_us) {
+    return midi_net_send_ump_hops(net, words, num_words, 0, now_us);
+}
+
+esp_err_t midi_net_send_ump_hops(midi_net_t *net, const uint32_t *words, uint8_t num_words,
+                                 uint8_t hops, int64_t now_us) {
+    if (!net || !words || num_words == 0 || num_words > UMP_MAX_WORDS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (uint8_t i = 0; i < net->max_peers; i++) {
+        midi_net_peer_t *peer = &net->peers[i];
+        if (peer->state != MIDI_NET_PEER_ESTABLISHED) {
+            continue;
+        }
+        if (!net->config.endpoint) {
+            send_ump_peer(net, peer, words, num_words, hops, now_us);
+            continue;
+        }
+
+        ump_packet_t ump = {
+            .num_words = num_words,
+            .message_type = UMP_GET_MT(words[0]),
+            .group = UMP_GET_GROUP(words[0])
+        };
+        memcpy(ump.words, words, sizeof(uint32_t) * num_words);
+        if (ump_endpoint_link_adapt(&peer->link, &ump) == ESP_OK) {
+            send_ump_peer(net, peer, ump.words, ump.num_words, hops, now_us);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t midi_net_reset_session(midi_net_t *net, const midi_net_addr_t *to, int64_t now_us) {
+    midi_net_peer_t *peer = midi_net_find(net, to);
+    if (!peer || peer->state != MIDI_NET_PEER_ESTABLISHED) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    reset_sequence(peer);
+    send_command(net, peer, &peer->addr, MIDI_NET_CMD_SESSION_RESET, 0, NULL, 0, now_us);
+    return ESP_OK;
+}
+
+void midi_net_expire(midi_net_t *net, midi_net_peer_t *peer, int64_t now_us) {
+    if (!net || !peer) {
+        return;
+    }
+
+    int64_t interval_us = (int64_t)net->config.ping_interval_ms * 1000;
+    int64_t timeout_us = (int64_t)net->config.timeout_ms * 1000;
+
+    switch (peer->state) {
+    case MIDI_NET_PEER_ESTABLISHED:
+        if (now_us - peer->last_rx_us >= timeout_us) {
+            ESP_LOGW(TAG, "Session with " ADDR_FMT " timed out", ADDR_ARGS(&peer->addr));
+            send_bye(net, peer, &peer->addr, MIDI_NET_BYE_TIMEOUT, now_us);
+            peer_free(net, peer);
+            return;
+        }
+        if (peer->retx_due_us && now_us >= peer->retx_due_us) {
+            if (peer->retx_tries < MIDI_NET_RETRANSMIT_TRIES && request_missing(net, peer, now_us)) {
+                peer->retx_tries++;
+                peer->retx_due_us = now_us + midi_net_peer_retransmit_timeout_us(peer);
+            } else {
+                peer->retx_due_us = 0; // Filled, or what is left stays counted lost
+            }
+        }
+        if (peer->fec_flush_us && now_us >= peer->fec_flush_us) {
+            peer->fec_flush_us = 0;
+            send_fec_flush(net, peer, now_us);
+        }
+        if (now_us >= ping_due_us(net, peer, 100)) {
+            dgram_begin(net);
+            dgram_add_ping(net, peer, now_us);
+            dgram_send(net, peer, &peer->addr, now_us);
+        }
+        break;
+
+    case MIDI_NET_PEER_INVITING:
+        if (now_us - peer->last_rx_us >= timeout_us) {
+            ESP_LOGW(TAG, "No reply to invitation from " ADDR_FMT, ADDR_ARGS(&peer->addr));
+            peer_free(net, peer);
+            return;
+        }
+        if (now_us - peer->last_ping_us >= interval_us) {
+            peer->last_ping_us = now_us;
+            send_identity(net, peer, MIDI_NET_CMD_INVITATION, now_us);
+        }
+        break;
+
+    case MIDI_NET_PEER_CLOSING:
+        if (now_us - peer->last_ping_us >= interval_us) {
+            peer_free(net, peer); // No Bye Reply; give up on it
+            return;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    // The deadline just passed; report the next one even if later
+    peer->due_us = 0;
+    peer_schedule(net, peer);
+}
+
+void midi_net_poll(midi_net_t *net, int64_t now_us) {
+    for (uint8_t i = 0; net && i < net->max_peers; i++) {
+        if (net->peers[i].state != MIDI_NET_PEER_FREE) {
+            midi_net_expire(net, &net->peers[i], now_us);
+        }
+    }
+}
@@ -0,0 +1,326 @@
+/**
+ * @file midi_sync.c
+ * @brief Clock Synchronization Between Devices
+ */
+
+#include "midi_sync.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "midi_sync";
+
+#define ADDR_FMT        "%u.%u.%u.%u:%u"
+#define ADDR_ARGS(a)    ((const uint8_t *)&(a)->ip)[0], ((const uint8_t *)&(a)->ip)[1], \
+                        ((const uint8_t *)&(a)->ip)[2], ((const uint8_t *)&(a)->ip)[3], (a)->port
+
+#define DELAY_SLACK_US  100     // Path delay above normal still trusted (host scheduling)
+
+static inline void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline bool addr_equal(const midi_net_addr_t *a, const midi_net_addr_t *b) {
+    return a->ip == b->ip && a->port == b->port;
+}
+
+static inline int64_t interval_us(const midi_sync_t *sync) {
+    return (int64_t)sync->config.interval_ms * 1000;
+}
+
+static inline int64_t shared_us(const midi_sync_t *sync, int64_t local_us) {
+    return midi_timebase_shared_us(sync->config.timebase, local_us);
+}
+
+/**
+ * @brief Local time right after a send (now_us without a clock callback)
+ */
+static inline int64_t stamp_us(const midi_sync_t *sync, int64_t now_us) {
+    return sync->config.clock ? sync->config.clock(sync->config.ctx) : now_us;
+}
+
+static void send_msg(midi_sync_t *sync, const midi_net_addr_t *to, uint8_t type, uint16_t seq,
+                     int64_t time_us) {
+    put_be32(sync->tx, MIDI_SYNC_SIGNATURE);
+    put_be32(sync->tx + 4, ((uint32_t)type << 24) | ((uint32_t)sync->config.domain << 16) | seq);
+    put_be32(sync->tx + 8, (uint32_t)((uint64_t)time_us >> 32));
+    put_be32(sync->tx + 12, (uint32_t)time_us);
+    if (sync->config.send(to, sync->tx, MIDI_SYNC_MSG_LEN, sync->config.ctx) != ESP_OK) {
+        ESP_LOGD(TAG, "Send to " ADDR_FMT " failed", ADDR_ARGS(to));
+    }
+}
+
+//=============================================================================
+// Master
+//=============================================================================
+
+static bool slave_alive(const midi_sync_t *sync, const midi_sync_slave_t *slave, int64_t now_us) {
+    return slave->last_seen_us &&
+           now_us - slave->last_seen_us < MIDI_SYNC_SLAVE_TIMEOUT_INTERVALS * interval_us(sync);
+}
+
+static esp_err_t master_delay_req(midi_sync_t *sync, const midi_net_addr_t *from, uint16_t seq,
+                                  int64_t now_us) {
+    int64_t t4 = shared_us(sync, now_us);
+    midi_sync_slave_t *slot = NULL;
+    midi_sync_slave_t *free_slot = NULL;
+
+    for (int i = 0; i < MIDI_SYNC_MAX_SLAVES && !slot; i++) {
+        midi_sync_slave_t *slave = &sync->slaves[i];
+        if (slave->last_seen_us && addr_equal(&slave->addr, from)) {
+            slot = slave;
+        } else if (!free_slot && !slave_alive(sync, slave, now_us)) {
+            free_slot = slave;
+        }
+    }
+    if (!slot) {
+        slot = free_slot;
+    }
+    if (!slot) {
+        ESP_LOGW(TAG, "No room for slave " ADDR_FMT, ADDR_ARGS(from));
+        return ESP_ERR_NO_MEM;
+    }
+    if (!slot->last_seen_us || !addr_equal(&slot->addr, from)) {
+        ESP_LOGI(TAG, "Slave " ADDR_FMT " subscribed", ADDR_ARGS(from));
+        slot->addr = *from;
+    }
+    slot->last_seen_us = now_us;
+
+    send_msg(sync, from, MIDI_SYNC_MSG_DELAY_RESP, seq, t4);
+    return ESP_OK;
+}
+
+static void master_round(midi_sync_t *sync, int64_t now_us) {
+    sync->seq++;
+    for (int i = 0; i < MIDI_SYNC_MAX_SLAVES; i++) {
+        midi_sync_slave_t *slave = &sync->slaves[i];
+        if (!slave->last_seen_us) {
+            continue;
+        }
+        if (!slave_alive(sync, slave, now_us)) {
+            ESP_LOGI(TAG, "Slave " ADDR_FMT " gone", ADDR_ARGS(&slave->addr));
+            slave->last_seen_us = 0;
+            continue;
+        }
+        send_msg(sync, &slave->addr, MIDI_SYNC_MSG_SYNC, sync->seq, 0);
+        int64_t t1 = shared_us(sync, stamp_us(sync, now_us));
+        send_msg(sync, &slave->addr, MIDI_SYNC_MSG_FOLLOW_UP, sync->seq, t1);
+    }
+}
+
+//=============================================================================
+// Slave
+//=============================================================================
+
+/**
+ * @brief One completed exchange: track the path, correct the timebase
+ */
+static void slave_sample(midi_sync_t *sync, int64_t t4, int64_t now_us) {
+    midi_sync_stats_t *stats = &sync->stats;
+    int64_t to_slave = sync->t2_us - sync->t1_us;
+    int64_t to_master = t4 - sync->t3_us;
+    int64_t offset = (to_slave - to_master) / 2;
+    uint32_t delay = (to_slave + to_master > 0) ? (uint32_t)((to_slave + to_master) / 2) : 0;
+
+    // Judge against the path so far, then let it follow (a lasting change is accepted)
+    bool outlier = stats->exchanges >= 4 &&
+                   delay > stats->delay_us + 4 * stats->delay_var_us + DELAY_SLACK_US;
+    if (stats->exchanges == 0) {
+        stats->delay_us = delay;
+        stats->delay_var_us = delay / 2;
+    } else {
+        uint32_t err = (delay > stats->delay_us) ? delay - stats->delay_us : stats->delay_us - delay;
+        stats->delay_var_us = stats->delay_var_us - stats->delay_var_us / 4 + err / 4;
+        stats->delay_us = stats->delay_us - stats->delay_us / 8 + delay / 8;
+    }
+    stats->exchanges++;
+    if (outlier) {
+        stats->discarded++;
+        return;
+    }
+
+    midi_timebase_t *tb = sync->config.timebase;
+    uint32_t steps = tb->steps;
+    int64_t since = sync->last_update_us ? now_us - sync->last_update_us : interval_us(sync);
+    midi_timebase_correct(tb, now_us, -offset, (uint32_t)since);
+    sync->last_update_us = now_us;
+
+    uint32_t magnitude = (uint32_t)(offset < 0 ? -offset : offset);
+    stats->offset_us = offset;
+    if (tb->steps != steps) {
+        ESP_LOGI(TAG, "Timebase stepped %lld us to the master (path delay %lu us)",
+                 (long long)-offset, (unsigned long)delay);
+        stats->offset_abs_us = 0;
+    } else if (stats->offset_abs_us == 0) {
+        stats->offset_abs_us = magnitude ? magnitude : 1;
+    } else {
+        stats->offset_abs_us = stats->offset_abs_us - stats->offset_abs_us / 8 + magnitude / 8;
+    }
+    ESP_LOGD(TAG, "Offset %lld us, delay %lu us, rate %ld ppb", (long long)offset,
+             (unsigned long)delay, (long)tb->rate_ppb);
+}
+
+static esp_err_t slave_receive(midi_sync_t *sync, const midi_net_addr_t *from, uint8_t type,
+                               uint16_t seq, int64_t time_us, int64_t now_us) {
+    if (!addr_equal(from, &sync->config.master)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    switch (type) {
+    case MIDI_SYNC_MSG_SYNC:
+        sync->seq = seq;
+        sync->t2_us = shared_us(sync, now_us);
+        sync->have_sync = true;
+        sync->awaiting_resp = false;
+        sync->last_sync_us = now_us;
+        if (!sync->tracking) {
+            ESP_LOGI(TAG, "Following master " ADDR_FMT, ADDR_ARGS(from));
+            sync->tracking = true;
+        }
+        return ESP_OK;
+
+    case MIDI_SYNC_MSG_FOLLOW_UP:
+        if (!sync->have_sync || sync->awaiting_resp || seq != sync->seq) {
+            return ESP_OK; // Its Sync was lost or reordered
+        }
+        sync->t1_us = time_us;
+        send_msg(sync, from, MIDI_SYNC_MSG_DELAY_REQ, seq, 0);
+        sync->t3_us = shared_us(sync, stamp_us(sync, now_us));
+        sync->awaiting_resp = true;
+        return ESP_OK;
+
+    case MIDI_SYNC_MSG_DELAY_RESP:
+        if (!sync->awaiting_resp || seq != sync->seq) {
+            return ESP_OK; // Answer to a subscription, or to an abandoned exchange
+        }
+        sync->awaiting_resp = false;
+        sync->have_sync = false;
+        slave_sample(sync, time_us, now_us);
+        return ESP_OK;
+
+    default:
+        return ESP_ERR_NOT_FOUND;
+    }
+}
+
+static void slave_tick(midi_sync_t *sync, int64_t now_us) {
+    if (sync->tracking &&
+        now_us - sync->last_sync_us > MIDI_SYNC_LOST_INTERVALS * interval_us(sync)) {
+        ESP_LOGW(TAG, "Master " ADDR_FMT " lost, holding over at %ld ppb",
+                 ADDR_ARGS(&sync->config.master), (long)sync->config.timebase->freq_ppb);
+        midi_timebase_holdover(sync->config.timebase, now_us);
+        sync->tracking = false;
+        sync->have_sync = false;
+        sync->awaiting_resp = false;
+        sync->last_update_us = 0;
+        sync->stats.holdovers++;
+    }
+    if (!sync->tracking) {
+        send_msg(sync, &sync->config.master, MIDI_SYNC_MSG_DELAY_REQ, 0, 0); // Subscribe
+    }
+}
+
+//=============================================================================
+// API
+//=============================================================================
+
+void midi_sync_config_default(midi_sync_config_t *config) {
+    memset(config, 0, sizeof(*config));
+#if defined(CONFIG_MIDI_SYNC_ROLE_MASTER)
+    config->role = MIDI_SYNC_ROLE_MASTER;
+#elif defined(CONFIG_MIDI_SYNC_ROLE_SLAVE)
+    config->role = MIDI_SYNC_ROLE_SLAVE;
+#else
+    config->role = MIDI_SYNC_ROLE_OFF;
+#endif
+    config->domain = MIDI_SYNC_DOMAIN;
+    config->interval_ms = MIDI_SYNC_INTERVAL_MS;
+    config->timebase = midi_timebase_get();
+}
+
+esp_err_t midi_sync_init(midi_sync_t *sync, const midi_sync_config_t *config, int64_t now_us) {
+    if (!sync || !config || (config->role != MIDI_SYNC_ROLE_OFF && !config->send) ||
+        (config->role == MIDI_SYNC_ROLE_SLAVE && !config->master.port)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(sync, 0, sizeof(*sync));
+    sync->config = *config;
+    if (!sync->config.interval_ms) {
+        sync->config.interval_ms = MIDI_SYNC_INTERVAL_MS;
+    }
+    if (!sync->config.timebase) {
+        sync->config.timebase = midi_timebase_get();
+    }
+    sync->next_us = now_us;
+    return ESP_OK;
+}
+
+esp_err_t midi_sync_receive(midi_sync_t *sync, const midi_net_addr_t *from,
+                            const uint8_t *data, size_t len, int64_t now_us) {
+    if (len < MIDI_SYNC_MSG_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (get_be32(data) != MIDI_SYNC_SIGNATURE) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    uint32_t header = get_be32(data + 4);
+    uint8_t type = header >> 24;
+    uint16_t seq = header & 0xFFFF;
+    int64_t time_us = (int64_t)(((uint64_t)get_be32(data + 8) << 32) | get_be32(data + 12));
+    if (((header >> 16) & 0xFF) != sync->config.domain) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    switch (sync->config.role) {
+    case MIDI_SYNC_ROLE_MASTER:
+        return (type == MIDI_SYNC_MSG_DELAY_REQ) ? master_delay_req(sync, from, seq, now_us)
+                                                 : ESP_ERR_NOT_FOUND;
+    case MIDI_SYNC_ROLE_SLAVE:
+        return slave_receive(sync, from, type, seq, time_us, now_us);
+    default:
+        return ESP_ERR_NOT_FOUND;
+    }
+}
+
+int64_t midi_sync_expire(midi_sync_t *sync, int64_t now_us) {
+    if (now_us < sync->next_us) {
+        return sync->next_us;
+    }
+
+    if (sync->config.role == MIDI_SYNC_ROLE_MASTER) {
+        master_round(sync, now_us);
+    } else if (sync->config.role == MIDI_SYNC_ROLE_SLAVE) {
+        slave_tick(sync, now_us);
+    }
+    sync->next_us = now_us + interval_us(sync);
+    return sync->next_us;
+}
+
+bool midi_sync_locked(const midi_sync_t *sync) {
+    switch (sync->config.role) {
+    case MIDI_SYNC_ROLE_MASTER:
+        return true;
+    case MIDI_SYNC_ROLE_SLAVE:
+        return sync->tracking && sync->config.timebase->locked;
+    default:
+        return false;
+    }
+}
+
+uint8_t midi_sync_num_slaves(const midi_sync_t *sync, int64_t now_us) {
+    uint8_t count = 0;
+    for (int i = 0; i < MIDI_SYNC_MAX_SLAVES; i++) {
+        if (slave_alive(sync, &sync->slaves[i], now_us)) {
+            count++;
+        }
+    }
+    return count;
+}
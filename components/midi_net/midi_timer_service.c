@@ -0,0 +1,106 @@
+/**
+ * @file midi_timer_service.c
+ * @brief Shared Timer Service: One Wheel, One Task
+ *
+ * The task sleeps until the wheel's next due slot (or until a timer is
+ * started earlier than that), advances the wheel and runs the expired
+ * callbacks one by one with the service mutex released, so callbacks
+ * may take their owner's lock and restart timers.
+ */
+
+#include "midi_timer_wheel.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "midi_timer";
+
+#define TIMER_TASK_STACK_SIZE   4096    // Callbacks build and send datagrams
+#define TIMER_TASK_PRIORITY     6
+
+static midi_timer_wheel_t s_wheel;
+static SemaphoreHandle_t s_mutex;
+static TaskHandle_t s_task;
+static int64_t s_wake_us;           // When the task wakes next (0 = no timer pending)
+
+static void timer_task(void *arg) {
+    for (;;) {
+        xSemaphoreTake(s_mutex, portMAX_DELAY);
+        int64_t now = esp_timer_get_time();
+        midi_timer_wheel_advance(&s_wheel, now);
+
+        midi_timer_t *timer;
+        while ((timer = midi_timer_wheel_pop(&s_wheel)) != NULL) {
+            midi_timer_fn_t fn = timer->fn;
+            void *ctx = timer->ctx;
+            xSemaphoreGive(s_mutex);
+            fn(timer, ctx);
+            xSemaphoreTake(s_mutex, portMAX_DELAY);
+        }
+
+        s_wake_us = midi_timer_wheel_next_us(&s_wheel);
+        int64_t wait_us = s_wake_us ? s_wake_us - esp_timer_get_time() : 0;
+        xSemaphoreGive(s_mutex);
+
+        TickType_t wait = portMAX_DELAY;
+        if (s_wake_us) {
+            int64_t tick_us = (int64_t)portTICK_PERIOD_MS * 1000;
+            wait = (wait_us > 0) ? (TickType_t)((wait_us + tick_us - 1) / tick_us) : 0;
+        }
+        if (wait) {
+            ulTaskNotifyTake(pdTRUE, wait);
+        }
+    }
+}
+
+esp_err_t midi_timer_service_init(void) {
+    if (s_task) {
+        return ESP_OK;
+    }
+
+    s_mutex = xSemaphoreCreateMutex();
+    if (!s_mutex) {
+        return ESP_ERR_NO_MEM;
+    }
+    midi_timer_wheel_init(&s_wheel, esp_timer_get_time());
+
+    if (xTaskCreate(timer_task, "midi_timer", TIMER_TASK_STACK_SIZE, NULL,
+                    TIMER_TASK_PRIORITY, &s_task) != pdPASS) {
+        vSemaphoreDelete(s_mutex);
+        s_mutex = NULL;
+        s_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Timer service started (%d us tick)", MIDI_TIMER_TICK_US);
+    return ESP_OK;
+}
+
+void midi_timer_start(midi_timer_t *timer, int64_t at_us) {
+    if (!s_mutex) {
+        ESP_LOGE(TAG, "Timer started before midi_timer_service_init()");
+        return;
+    }
+
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    midi_timer_wheel_add(&s_wheel, timer, at_us);
+    bool sooner = (s_wake_us == 0 || at_us < s_wake_us);
+    if (sooner) {
+        s_wake_us = at_us;
+    }
+    xSemaphoreGive(s_mutex);
+
+    if (sooner) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+void midi_timer_stop(midi_timer_t *timer) {
+    if (!s_mutex) {
+        return;
+    }
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    midi_timer_wheel_cancel(&s_wheel, timer);
+    xSemaphoreGive(s_mutex);
+}
@@ -0,0 +1,191 @@
+/**
+ * @file midi_timer_wheel.c
+ * @brief Hierarchical Timer Wheel
+ *
+ * A timer sits in the level whose span covers its distance from the
+ * current tick, in the slot its own expiry bits select. When the tick
+ * crosses an upper slot's boundary, that slot cascades: its timers are
+ * placed again, now closer, in a lower level. Level 0 slots expire.
+ */
+
+#include "midi_timer_wheel.h"
+#include <string.h>
+
+#define LEVEL_SHIFT(level)  (MIDI_TIMER_WHEEL_BITS * (level))
+#define SLOT_MASK           (MIDI_TIMER_WHEEL_SLOTS - 1)
+#define WHEEL_SPAN          (1ull << LEVEL_SHIFT(MIDI_TIMER_WHEEL_LEVELS))
+
+static inline uint64_t tick_ceil(int64_t us) {
+    return us <= 0 ? 0 : ((uint64_t)us + MIDI_TIMER_TICK_US - 1) / MIDI_TIMER_TICK_US;
+}
+
+static inline uint64_t tick_floor(int64_t us) {
+    return us <= 0 ? 0 : (uint64_t)us / MIDI_TIMER_TICK_US;
+}
+
+//=============================================================================
+// Lists
+//=============================================================================
+
+static void list_push(midi_timer_t **head, midi_timer_t *timer) {
+    timer->next = *head;
+    if (*head) {
+        (*head)->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+}
+
+static void list_unlink(midi_timer_t *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+static void expired_append(midi_timer_wheel_t *wheel, midi_timer_t *timer) {
+    timer->next = NULL;
+    timer->pprev = wheel->expired_tail;
+    *wheel->expired_tail = timer;
+    wheel->expired_tail = &timer->next;
+}
+
+//=============================================================================
+// Wheel
+//=============================================================================
+
+void midi_timer_wheel_init(midi_timer_wheel_t *wheel, int64_t now_us) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->expired_tail = &wheel->expired;
+    wheel->tick = tick_floor(now_us);
+}
+
+void midi_timer_init(midi_timer_t *timer, midi_timer_fn_t fn, void *ctx) {
+    memset(timer, 0, sizeof(*timer));
+    timer->fn = fn;
+    timer->ctx = ctx;
+}
+
+/**
+ * @brief Put a timer in the slot for its distance from the current tick
+ *
+ * @param cascading Placed during the current tick's processing, which
+ *                  can still expire it; otherwise that tick is done
+ */
+static void wheel_place(midi_timer_wheel_t *wheel, midi_timer_t *timer, bool cascading) {
+    uint64_t expires = timer->expires;
+    uint64_t earliest = wheel->tick + (cascading ? 0 : 1);
+
+    if (expires < earliest) {
+        expires = earliest;
+    }
+    if (expires - wheel->tick >= WHEEL_SPAN) {
+        expires = wheel->tick + WHEEL_SPAN - 1; // Waits in the top level, placed again later
+    }
+
+    uint64_t delta = expires - wheel->tick;
+    int level = 0;
+    while (level < MIDI_TIMER_WHEEL_LEVELS - 1 && delta >= (1ull << LEVEL_SHIFT(level + 1))) {
+        level++;
+    }
+    list_push(&wheel->slots[level][(expires >> LEVEL_SHIFT(level)) & SLOT_MASK], timer);
+}
+
+void midi_timer_wheel_add(midi_timer_wheel_t *wheel, midi_timer_t *timer, int64_t at_us) {
+    midi_timer_wheel_cancel(wheel, timer);
+    timer->expires = tick_ceil(at_us);
+    wheel_place(wheel, timer, false);
+    wheel->pending++;
+}
+
+void midi_timer_wheel_cancel(midi_timer_wheel_t *wheel, midi_timer_t *timer) {
+    if (!timer->pprev) {
+        return;
+    }
+    if (wheel->expired_tail == &timer->next) {
+        wheel->expired_tail = timer->pprev;
+    }
+    list_unlink(timer);
+    wheel->pending--;
+}
+
+/**
+ * @brief Next tick with work: a level 0 slot to expire or a slot to cascade
+ *
+ * @return UINT64_MAX if all slots are empty
+ */
+static uint64_t wheel_next_tick(const midi_timer_wheel_t *wheel) {
+    uint64_t best = UINT64_MAX;
+
+    for (int level = 0; level < MIDI_TIMER_WHEEL_LEVELS; level++) {
+        uint64_t base = wheel->tick >> LEVEL_SHIFT(level);
+        for (uint64_t step = 1; step <= MIDI_TIMER_WHEEL_SLOTS; step++) {
+            if (wheel->slots[level][(base + step) & SLOT_MASK]) {
+                uint64_t at = (base + step) << LEVEL_SHIFT(level);
+                if (at < best) {
+                    best = at;
+                }
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+static void wheel_cascade(midi_timer_wheel_t *wheel, int level, uint32_t index) {
+    midi_timer_t *timer = wheel->slots[level][index];
+
+    wheel->slots[level][index] = NULL;
+    while (timer) {
+        midi_timer_t *next = timer->next;
+        wheel_place(wheel, timer, true);
+        timer = next;
+    }
+}
+
+void midi_timer_wheel_advance(midi_timer_wheel_t *wheel, int64_t now_us) {
+    uint64_t target = tick_floor(now_us);
+
+    while (wheel->tick < target) {
+        uint64_t tick = wheel->pending ? wheel_next_tick(wheel) : UINT64_MAX;
+        if (tick > target) {
+            wheel->tick = target;
+            break;
+        }
+        wheel->tick = tick;
+
+        // Upper levels first: what they shed may land in a lower slot due now
+        for (int level = MIDI_TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+            if ((tick & ((1ull << LEVEL_SHIFT(level)) - 1)) == 0) {
+                wheel_cascade(wheel, level, (tick >> LEVEL_SHIFT(level)) & SLOT_MASK);
+            }
+        }
+
+        midi_timer_t *timer = wheel->slots[0][tick & SLOT_MASK];
+        wheel->slots[0][tick & SLOT_MASK] = NULL;
+        while (timer) {
+            midi_timer_t *next = timer->next;
+            expired_append(wheel, timer);
+            timer = next;
+        }
+    }
+}
+
+midi_timer_t *midi_timer_wheel_pop(midi_timer_wheel_t *wheel) {
+    midi_timer_t *timer = wheel->expired;
+
+    if (timer) {
+        midi_timer_wheel_cancel(wheel, timer);
+    }
+    return timer;
+}
+
+int64_t midi_timer_wheel_next_us(const midi_timer_wheel_t *wheel) {
+    if (wheel->expired) {
+        return (int64_t)(wheel->tick * MIDI_TIMER_TICK_US);
+    }
+    uint64_t tick = wheel->pending ? wheel_next_tick(wheel) : UINT64_MAX;
+    return (tick == UINT64_MAX) ? 0 : (int64_t)(tick * MIDI_TIMER_TICK_US);
+}
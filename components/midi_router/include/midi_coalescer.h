@@ -0,0 +1,165 @@
+/**
+ * @file midi_coalescer.h
+ * @brief Continuous-Controller Thinning for Slow Outputs
+ *
+ * Keeps the latest value per (group, channel, controller) while an output
+ * is busy and rate-limits each controller stream. Notes and other
+ * discrete messages are never held: midi_coalescer_offer() returns
+ * MIDI_COALESCE_SEND for them so they go out immediately, after any
+ * value still held on their channel (midi_coalescer_poll_before()).
+ *
+ * A value counts as on the wire only once the transport reports it
+ * written with midi_coalescer_sent(), so a write that fails (output
+ * busy) is retried instead of being mistaken for a duplicate.
+ *
+ * The coalescer is a plain data structure with no locking; the owning
+ * transport serialises offer/poll/sent calls.
+ */
+
+#ifndef MIDI_COALESCER_H
+#define MIDI_COALESCER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "midi_router.h"
+
+/** Tracked controller streams per output */
+#define MIDI_COALESCER_SLOTS        64
+
+/** Slot probe length before giving up (stream is then passed through) */
+#define MIDI_COALESCER_MAX_PROBE    8
+
+/**
+ * @brief Coalescer configuration
+ */
+typedef struct {
+    bool enabled;                 /**< false = pass everything through */
+    uint16_t max_rate_hz;         /**< Max messages/s per controller (0 = unlimited) */
+    uint16_t min_delta;           /**< Min change to send, 14-bit units (0 = any change) */
+    uint16_t settle_ms;           /**< Send a held small change after this quiet time */
+} midi_coalescer_config_t;
+
+/**
+ * @brief Per-controller stream state
+ */
+typedef struct {
+    uint32_t key;                 /**< Stream key, 0 = free */
+    uint32_t last_value;          /**< Last sent value (normalised to 32 bits) */
+    int64_t last_sent_us;         /**< Time of last send, 0 = never */
+    int64_t pending_since_us;     /**< Time latest held value arrived */
+    bool pending;                 /**< packet holds an unsent value */
+    midi_router_packet_t packet;  /**< Latest held value */
+} midi_coalescer_slot_t;
+
+/**
+ * @brief Coalescer statistics
+ */
+typedef struct {
+    uint32_t sent_direct;         /**< Sent immediately */
+    uint32_t sent_deferred;       /**< Held, then sent by poll */
+    uint32_t thinned;             /**< Superseded or duplicate values discarded */
+} midi_coalescer_stats_t;
+
+/**
+ * @brief Coalescer instance (one per output)
+ */
+typedef struct midi_coalescer {
+    midi_coalescer_config_t config;
+    uint32_t min_interval_us;
+    uint16_t pending_count;
+    midi_coalescer_stats_t stats;
+    midi_coalescer_slot_t slots[MIDI_COALESCER_SLOTS];
+} midi_coalescer_t;
+
+/**
+ * @brief Offer result
+ */
+typedef enum {
+    MIDI_COALESCE_SEND,           /**< Caller must send the packet now */
+    MIDI_COALESCE_HELD,           /**< Stored; caller must poll later */
+    MIDI_COALESCE_DROPPED         /**< Redundant (same value as last sent) */
+} midi_coalesce_result_t;
+
+/**
+ * @brief Initialize (or reconfigure and clear) a coalescer
+ */
+void midi_coalescer_init(midi_coalescer_t *c, const midi_coalescer_config_t *config);
+
+/**
+ * @brief Stream key for a packet
+ *
+ * Format | group | channel | class | index. Only CC, pitch bend, channel
+ * pressure and poly pressure have a key; everything else returns 0, as
+ * do Bank Select, Data Entry, switches, (N)RPN select and channel mode
+ * controllers (0/32, 6/38, 64-69, 96-101, 120-127), whose messages act
+ * in sequence.
+ *
+ * @param packet Packet to inspect
+ * @return Key, or 0 if the packet is not a continuous controller
+ */
+uint32_t midi_coalescer_key(const midi_router_packet_t *packet);
+
+/**
+ * @brief Offer an outgoing packet
+ *
+ * @param c Coalescer
+ * @param packet Packet about to be sent
+ * @param now_us Current time (esp_timer_get_time())
+ * @param output_busy true if the output is backed up
+ * @return What the caller must do with the packet; after writing a
+ *         MIDI_COALESCE_SEND packet, report it with midi_coalescer_sent()
+ */
+midi_coalesce_result_t midi_coalescer_offer(midi_coalescer_t *c,
+                                            const midi_router_packet_t *packet,
+                                            int64_t now_us, bool output_busy);
+
+/**
+ * @brief Take the next held value that is due
+ *
+ * The value stays held until it is reported with midi_coalescer_sent(),
+ * so polling again without that returns it again.
+ *
+ * @param c Coalescer
+ * @param now_us Current time
+ * @param out Output: packet to send
+ * @return true if out was filled
+ */
+bool midi_coalescer_poll(midi_coalescer_t *c, int64_t now_us, midi_router_packet_t *out);
+
+/**
+ * @brief Take a held value that must be written before a packet
+ *
+ * Values held on the packet's channel go out ahead of it, whatever their
+ * rate limit, so a Pitch Bend or Volume sent before a note still lands
+ * before it. Call after offer returned MIDI_COALESCE_SEND, until it
+ * returns false; report each value written with midi_coalescer_sent().
+ *
+ * @param c Coalescer
+ * @param packet Packet about to be written
+ * @param out Output: held packet to write first
+ * @return true if out was filled
+ */
+bool midi_coalescer_poll_before(midi_coalescer_t *c, const midi_router_packet_t *packet,
+                                midi_router_packet_t *out);
+
+/**
+ * @brief Record a packet as written to the output
+ *
+ * Call after a successful write of a packet that offer returned
+ * MIDI_COALESCE_SEND for, or that poll returned. Other packets are
+ * ignored.
+ *
+ * @param c Coalescer
+ * @param packet Packet written
+ * @param now_us Time of the write
+ */
+void midi_coalescer_sent(midi_coalescer_t *c, const midi_router_packet_t *packet, int64_t now_us);
+
+/**
+ * @brief Check whether any value is held
+ */
+static inline bool midi_coalescer_has_pending(const midi_coalescer_t *c) {
+    return c->pending_count != 0;
+}
+
+#endif /* MIDI_COALESCER_H */
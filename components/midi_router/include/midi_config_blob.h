@@ -0,0 +1,86 @@
+/**
+ * @file midi_config_blob.h
+ * @brief Compact Versioned Encoding of the Router Configuration
+ *
+ * The whole midi_router_config_t is stored as one little-endian blob:
+ *
+ *   offset 0  magic    "MCFG" (u32)
+ *          4  version  MIDI_CONFIG_BLOB_VERSION when written (u16)
+ *          6  length   payload bytes (u16)
+ *          8  crc32    of the payload (u32)
+ *         12  payload
+ *
+ * The payload packs the routing matrix as one destination bitmask per
+ * source, flags into bit fields, and per-group filter masks and rules
+ * only when present, so a typical config is well under 200 bytes.
+ *
+ * Versions only ever append fields. A decoder fills fields an older
+ * blob lacks with defaults (migration) and ignores a newer blob's
+ * trailing fields; the CRC covers everything either way.
+ *
+ * Versions 1 and 2 cover the four built-in transports. Version 3 adds
+ * the transport count, a 16-bit route mask per source and the settings
+ * of the run-time transport slots, so blobs move between builds with a
+ * different MIDI_ROUTER_MAX_TRANSPORTS.
+ */
+
+#ifndef MIDI_CONFIG_BLOB_H
+#define MIDI_CONFIG_BLOB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "midi_router.h"
+
+/** "MCFG" little-endian */
+#define MIDI_CONFIG_BLOB_MAGIC      0x4746434Du
+
+/** Layout written by this firmware (2: group maps, 3: transport slots) */
+#define MIDI_CONFIG_BLOB_VERSION    3
+
+/** Header bytes before the payload */
+#define MIDI_CONFIG_BLOB_HEADER     12
+
+/** Upper bound of an encoded config (all rules, per-group filters) */
+#define MIDI_CONFIG_BLOB_MAX        (MIDI_CONFIG_BLOB_HEADER + 64 + \
+                                     MIDI_TRANSPORT_COUNT * (48 + 18) + MIDI_RULES_MAX * 20)
+
+/**
+ * @brief Encode a configuration
+ *
+ * @param config Configuration
+ * @param buf Output buffer
+ * @param capacity Buffer size (MIDI_CONFIG_BLOB_MAX always suffices)
+ * @param len Output: blob length
+ * @return ESP_OK, or ESP_ERR_INVALID_SIZE if buf is too small
+ */
+esp_err_t midi_config_blob_encode(const midi_router_config_t *config,
+                                  uint8_t *buf, size_t capacity, size_t *len);
+
+/**
+ * @brief Decode and validate a blob
+ *
+ * Fields the blob's version predates are set to their defaults. On
+ * error config may be partly written: decode into a scratch copy.
+ *
+ * @param buf Blob
+ * @param len Blob length
+ * @param config Output: configuration
+ * @return ESP_OK, ESP_ERR_INVALID_CRC on corruption,
+ *         ESP_ERR_INVALID_VERSION for an unknown magic or version 0,
+ *         ESP_ERR_INVALID_SIZE if truncated
+ */
+esp_err_t midi_config_blob_decode(const uint8_t *buf, size_t len,
+                                  midi_router_config_t *config);
+
+/**
+ * @brief Version of a blob (0 if the header is not valid)
+ */
+uint16_t midi_config_blob_version(const uint8_t *buf, size_t len);
+
+/**
+ * @brief CRC-32 (IEEE 802.3, reflected)
+ */
+uint32_t midi_config_crc32(const uint8_t *data, size_t len);
+
+#endif /* MIDI_CONFIG_BLOB_H */
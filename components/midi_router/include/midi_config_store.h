@@ -0,0 +1,67 @@
+/**
+ * @file midi_config_store.h
+ * @brief Storage Backends for the Router Configuration Blob
+ *
+ * The router reads and writes its configuration and presets as named
+ * blobs through a small backend interface. The default backend keeps
+ * each blob in NVS as a single entry (one nvs_get_blob per blob). The
+ * file backend stores the same bytes in regular files, for a SPIFFS/FAT
+ * volume or for running the config code on a host against plain files
+ * in place of NVS.
+ */
+
+#ifndef MIDI_CONFIG_STORE_H
+#define MIDI_CONFIG_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/**
+ * @brief Blob storage backend
+ */
+typedef struct midi_config_store {
+    /**
+     * @brief Read the stored blob
+     * @return ESP_OK, ESP_ERR_NOT_FOUND if nothing is stored,
+     *         ESP_ERR_INVALID_SIZE if the blob exceeds capacity
+     */
+    esp_err_t (*read)(const struct midi_config_store *store, const char *name,
+                      uint8_t *buf, size_t capacity, size_t *len);
+
+    /**
+     * @brief Replace the stored blob
+     */
+    esp_err_t (*write)(const struct midi_config_store *store, const char *name,
+                       const uint8_t *buf, size_t len);
+
+    /**
+     * @brief Remove the stored blob (ESP_OK if none)
+     */
+    esp_err_t (*erase)(const struct midi_config_store *store, const char *name);
+
+    const char *location;         /**< NVS namespace or file path prefix */
+} midi_config_store_t;
+
+/** NVS namespace of the default store */
+#define MIDI_CONFIG_NVS_NAMESPACE   "midi_router"
+
+/** Longest blob name (NVS key limit) */
+#define MIDI_CONFIG_NAME_MAX        15
+
+/**
+ * @brief Default backend: one blob in NVS
+ */
+const midi_config_store_t *midi_config_store_nvs(void);
+
+/**
+ * @brief Initialize a file backend
+ *
+ * Blob "name" is kept in the file prefix + name.
+ *
+ * @param store Backend to fill (must outlive its use)
+ * @param prefix Path prefix, e.g. "/spiffs/router_" (must outlive store)
+ */
+void midi_config_store_file_init(midi_config_store_t *store, const char *prefix);
+
+#endif /* MIDI_CONFIG_STORE_H */
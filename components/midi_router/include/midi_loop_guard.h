@@ -0,0 +1,109 @@
+/**
+ * @file midi_loop_guard.h
+ * @brief Time-Windowed Fingerprint Set for Loop and Duplicate Suppression
+ *
+ * A fixed-size open-addressed table of 32-bit message fingerprints, each
+ * stamped with the time it was recorded. Entries older than the window
+ * count as free, so memory is constant and no cleanup pass is needed.
+ * Lookup and insert touch at most MIDI_LOOP_GUARD_PROBE slots.
+ *
+ * When every probed slot is still live the oldest one is overwritten:
+ * under flood the window shrinks instead of the table growing, and the
+ * guard fails open (a duplicate may pass) rather than dropping traffic.
+ *
+ * No locking; the router task owns its guards.
+ */
+
+#ifndef MIDI_LOOP_GUARD_H
+#define MIDI_LOOP_GUARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "midi_router.h"
+
+#ifdef CONFIG_MIDI_ROUTER_LOOP_GUARD_SLOTS
+#define MIDI_LOOP_GUARD_SLOTS       CONFIG_MIDI_ROUTER_LOOP_GUARD_SLOTS
+#else
+#define MIDI_LOOP_GUARD_SLOTS       256
+#endif
+
+/** Slots examined per lookup/insert */
+#define MIDI_LOOP_GUARD_PROBE       4
+
+/**
+ * @brief Fingerprint slot
+ */
+typedef struct {
+    uint32_t fingerprint;         /**< 0 = never used */
+    uint32_t stamp_us;            /**< Low 32 bits of insert time */
+} midi_loop_guard_entry_t;
+
+/**
+ * @brief Guard statistics
+ */
+typedef struct {
+    uint32_t hits;                /**< Fingerprints found inside the window */
+    uint32_t evictions;           /**< Live entries overwritten (window too long for load) */
+} midi_loop_guard_stats_t;
+
+/**
+ * @brief Fingerprint set
+ */
+typedef struct {
+    uint32_t window_us;           /**< Entry lifetime, 0 = guard disabled */
+    midi_loop_guard_stats_t stats;
+    midi_loop_guard_entry_t entries[MIDI_LOOP_GUARD_SLOTS];
+} midi_loop_guard_t;
+
+/**
+ * @brief Initialize (or clear) a guard
+ *
+ * @param guard Guard
+ * @param window_ms How long a fingerprint is remembered (0 disables)
+ */
+void midi_loop_guard_init(midi_loop_guard_t *guard, uint32_t window_ms);
+
+/**
+ * @brief Fingerprint of a packet's MIDI content
+ *
+ * Covers format and message bytes/words only, so the same message seen
+ * on different transports has the same fingerprint.
+ *
+ * @param packet Packet (MIDI 1.0 or UMP)
+ * @return Non-zero fingerprint
+ */
+uint32_t midi_loop_guard_content_hash(const midi_router_packet_t *packet);
+
+/**
+ * @brief Fingerprint of (source, sequence tag, content)
+ *
+ * Identifies one specific transmission, e.g. for dropping a datagram
+ * that arrives twice.
+ *
+ * @param packet Packet with a non-zero seq
+ * @return Non-zero fingerprint
+ */
+uint32_t midi_loop_guard_ingress_hash(const midi_router_packet_t *packet);
+
+/**
+ * @brief Check for a live fingerprint
+ *
+ * @return true if recorded less than window ago
+ */
+bool midi_loop_guard_contains(midi_loop_guard_t *guard, uint32_t fingerprint, int64_t now_us);
+
+/**
+ * @brief Record a fingerprint (refreshes its stamp if already present)
+ */
+void midi_loop_guard_insert(midi_loop_guard_t *guard, uint32_t fingerprint, int64_t now_us);
+
+/**
+ * @brief Record a fingerprint unless it is already live
+ *
+ * @return true if it was already present (the caller has a duplicate)
+ */
+bool midi_loop_guard_check_insert(midi_loop_guard_t *guard, uint32_t fingerprint,
+                                  int64_t now_us);
+
+#endif /* MIDI_LOOP_GUARD_H */
@@ -0,0 +1,110 @@
+/**
+ * @file midi_msg_class.h
+ * @brief Message Classification for MIDI 1.0 and UMP
+ *
+ * Maps a MIDI 1.0 status byte or the first word of a UMP to one of
+ * 16 message classes with a single table lookup. Classes are the common
+ * vocabulary used by router filters and rules, so a 16-bit mask can
+ * select any combination of them.
+ */
+
+#ifndef MIDI_MSG_CLASS_H
+#define MIDI_MSG_CLASS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ump_defs.h"
+
+/**
+ * @brief Message classes (bit index in class masks)
+ */
+typedef enum {
+    MIDI_CLASS_NOTE_OFF = 0,      /**< Note Off (8n) */
+    MIDI_CLASS_NOTE_ON,           /**< Note On (9n) */
+    MIDI_CLASS_POLY_PRESSURE,     /**< Polyphonic Key Pressure (An) */
+    MIDI_CLASS_CONTROL_CHANGE,    /**< Control Change (Bn) */
+    MIDI_CLASS_PROGRAM_CHANGE,    /**< Program Change (Cn) */
+    MIDI_CLASS_CHANNEL_PRESSURE,  /**< Channel Pressure (Dn) */
+    MIDI_CLASS_PITCH_BEND,        /**< Pitch Bend (En) */
+    MIDI_CLASS_PER_NOTE,          /**< MIDI 2.0 per-note controllers/pitch/management */
+    MIDI_CLASS_PARAMETER,         /**< MIDI 2.0 RPN/NRPN (absolute and relative) */
+    MIDI_CLASS_SYSEX,             /**< System Exclusive (F0/F7, UMP MT 0x3/0x5) */
+    MIDI_CLASS_SYSTEM_COMMON,     /**< MTC, Song Position, Song Select, Tune Request */
+    MIDI_CLASS_CLOCK,             /**< Timing Clock (F8) */
+    MIDI_CLASS_TRANSPORT,         /**< Start / Continue / Stop (FA-FC) */
+    MIDI_CLASS_ACTIVE_SENSING,    /**< Active Sensing (FE) */
+    MIDI_CLASS_RESET,             /**< System Reset (FF) */
+    MIDI_CLASS_OTHER,             /**< Utility, Stream, Flex Data, undefined */
+    MIDI_CLASS_COUNT
+} midi_msg_class_t;
+
+/** Mask with every class set */
+#define MIDI_CLASS_MASK_ALL         0xFFFF
+
+/** Classes that carry a channel field */
+#define MIDI_CLASS_MASK_CHANNEL     ((1u << MIDI_CLASS_NOTE_OFF) | \
+                                     (1u << MIDI_CLASS_NOTE_ON) | \
+                                     (1u << MIDI_CLASS_POLY_PRESSURE) | \
+                                     (1u << MIDI_CLASS_CONTROL_CHANGE) | \
+                                     (1u << MIDI_CLASS_PROGRAM_CHANGE) | \
+                                     (1u << MIDI_CLASS_CHANNEL_PRESSURE) | \
+                                     (1u << MIDI_CLASS_PITCH_BEND) | \
+                                     (1u << MIDI_CLASS_PER_NOTE) | \
+                                     (1u << MIDI_CLASS_PARAMETER))
+
+/** Classes that address a note number */
+#define MIDI_CLASS_MASK_NOTE        ((1u << MIDI_CLASS_NOTE_OFF) | \
+                                     (1u << MIDI_CLASS_NOTE_ON) | \
+                                     (1u << MIDI_CLASS_POLY_PRESSURE) | \
+                                     (1u << MIDI_CLASS_PER_NOTE))
+
+/**
+ * @brief Classification table
+ *
+ * Indexed by (MT << 4) | nibble, where nibble is the status low nibble
+ * for MT 0x1 (System) and the status high nibble for every other MT.
+ * MIDI 1.0 status bytes are folded onto the MT 0x1 / MT 0x2 rows.
+ */
+extern const uint8_t midi_msg_class_table[256];
+
+/**
+ * @brief Classify a MIDI 1.0 status byte
+ *
+ * @param status Full status byte (0x80-0xFF)
+ * @return Message class
+ */
+static inline midi_msg_class_t midi_msg_class_from_status(uint8_t status) {
+    uint8_t idx = (status < 0xF0) ? (uint8_t)((UMP_MT_MIDI1_CHANNEL_VOICE << 4) | (status >> 4))
+                                  : (uint8_t)((UMP_MT_SYSTEM << 4) | (status & 0x0F));
+    return (midi_msg_class_t)midi_msg_class_table[idx];
+}
+
+/**
+ * @brief Classify a UMP from its first word
+ *
+ * @param word0 First UMP word
+ * @return Message class
+ */
+static inline midi_msg_class_t midi_msg_class_from_ump(uint32_t word0) {
+    uint8_t mt = UMP_GET_MT(word0);
+    uint8_t nibble = (mt == UMP_MT_SYSTEM) ? ((word0 >> 16) & 0x0F)
+                                           : ((word0 >> 20) & 0x0F);
+    return (midi_msg_class_t)midi_msg_class_table[(mt << 4) | nibble];
+}
+
+/**
+ * @brief Check whether a class carries a channel field
+ */
+static inline bool midi_msg_class_has_channel(midi_msg_class_t cls) {
+    return (MIDI_CLASS_MASK_CHANNEL >> cls) & 1u;
+}
+
+/**
+ * @brief Get human-readable class name
+ *
+ * @param cls Message class
+ * @return Class name (e.g., "Note On")
+ */
+const char* midi_msg_class_name(midi_msg_class_t cls);
+
+#endif /* MIDI_MSG_CLASS_H */
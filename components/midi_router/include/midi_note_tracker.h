@@ -0,0 +1,108 @@
+/**
+ * @file midi_note_tracker.h
+ * @brief Active Note Tracking per Destination
+ *
+ * Keeps a 128-bit sounding-note bitmap for every destination, group and
+ * channel, updated in O(1) from each routed Note On/Off. A per-channel
+ * owner mask records which sources have notes sounding there, so when a
+ * source disappears only the channels it played on get targeted Note Offs.
+ *
+ * A channel a second source plays on while notes sound borrows one of a
+ * few per-destination blocks that record the source of each note, so
+ * only the lost source's notes are released there. When all blocks are
+ * in use, such a channel is released as a whole.
+ */
+
+#ifndef MIDI_NOTE_TRACKER_H
+#define MIDI_NOTE_TRACKER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "midi_router.h"
+
+/**
+ * @brief Encoding of the last notes seen on a channel (for Note Off replay)
+ */
+typedef enum {
+    MIDI_NOTE_FMT_MIDI1,          /**< MIDI 1.0 byte message */
+    MIDI_NOTE_FMT_UMP_MT2,        /**< UMP MIDI 1.0 Channel Voice */
+    MIDI_NOTE_FMT_UMP_MT4         /**< UMP MIDI 2.0 Channel Voice */
+} midi_note_fmt_t;
+
+/**
+ * @brief Channels per destination that can track owners note by note
+ */
+#define MIDI_NOTE_TRACKER_SHARED_CHANNELS 4
+
+/**
+ * @brief Source of each sounding note on a channel several sources share
+ */
+typedef struct {
+    bool used;
+    uint8_t owner[128];           /**< Source that struck the note last */
+} midi_note_shared_t;
+
+/**
+ * @brief Tracker state
+ */
+typedef struct {
+    uint32_t notes[MIDI_TRANSPORT_COUNT][UMP_GROUPS_COUNT][16][4]; /**< Sounding notes */
+    uint16_t owners[MIDI_TRANSPORT_COUNT][UMP_GROUPS_COUNT][16];   /**< Source bit per channel */
+    uint8_t formats[MIDI_TRANSPORT_COUNT][UMP_GROUPS_COUNT][16];   /**< midi_note_fmt_t */
+    uint8_t shared_slot[MIDI_TRANSPORT_COUNT][UMP_GROUPS_COUNT][16]; /**< 1 + index into shared, 0 = none */
+    midi_note_shared_t shared[MIDI_TRANSPORT_COUNT][MIDI_NOTE_TRACKER_SHARED_CHANNELS];
+} midi_note_tracker_t;
+
+/**
+ * @brief Callback receiving each generated Note Off
+ */
+typedef void (*midi_note_tracker_emit_t)(midi_transport_t dest,
+                                         const midi_router_packet_t *note_off,
+                                         void *ctx);
+
+/**
+ * @brief Clear all tracking state
+ */
+void midi_note_tracker_reset(midi_note_tracker_t *tracker);
+
+/**
+ * @brief Record a packet leaving the router for a destination
+ *
+ * Ignores anything that is not a Note On/Off. O(1).
+ *
+ * @param tracker Tracker
+ * @param dest Destination the packet is queued for
+ * @param packet Outgoing packet (after translation and rules)
+ */
+void midi_note_tracker_update(midi_note_tracker_t *tracker, midi_transport_t dest,
+                              const midi_router_packet_t *packet);
+
+/**
+ * @brief Release every note a source left sounding
+ *
+ * Emits one Note Off per note, in the format the channel was played in.
+ * Notes other sources struck on a shared channel keep sounding.
+ *
+ * @param tracker Tracker
+ * @param source Lost source transport
+ * @param emit Callback for each Note Off
+ * @param ctx Callback context
+ * @return Number of Note Offs emitted
+ */
+uint32_t midi_note_tracker_release_source(midi_note_tracker_t *tracker,
+                                          midi_transport_t source,
+                                          midi_note_tracker_emit_t emit, void *ctx);
+
+/**
+ * @brief Release notes a source left sounding on one destination
+ *
+ * Same as midi_note_tracker_release_source() restricted to dest, for
+ * callers that own only some destinations.
+ *
+ * @return Number of Note Offs emitted
+ */
+uint32_t midi_note_tracker_release(midi_note_tracker_t *tracker, midi_transport_t source,
+                                   midi_transport_t dest,
+                                   midi_note_tracker_emit_t emit, void *ctx);
+
+#endif /* MIDI_NOTE_TRACKER_H */
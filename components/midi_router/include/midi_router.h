@@ -2,18 +2,24 @@
  * @file midi_router.h
  * @brief MIDI Router - Central Message Routing
  * 
- * Implements flexible, configurable routing between 4 transports:
+ * Implements flexible, configurable routing between the built-in transports:
  * - UART/DIN (MIDI 1.0)
  * - USB (MIDI 1.0 / 2.0)
  * - Ethernet (MIDI 2.0 over UDP)
  * - WiFi (MIDI 2.0 over UDP)
+ * and up to MIDI_ROUTER_MAX_TRANSPORTS in total: further transports
+ * (BLE, a second UART, loopback ports) register at run time.
  * 
  * Features:
- * - 4×4 routing matrix (any input → any outputs)
- * - Automatic protocol translation (MIDI 1.0 ↔ UMP)
+ * - N×N routing matrix (any input → any outputs)
+ * - Automatic protocol translation to each transport's native format
  * - Message filtering (channel, type, etc.)
+ * - Rule engine (match → drop/remap/transpose/scale/rewrite CC)
+ * - Loop and duplicate suppression for network transports
+ * - Priority classes: realtime never waits behind notes, controllers or SysEx
+ * - Sharded workers: routing and output spread over both cores
  * - Real-time performance (<1ms latency)
- * - Configuration save/load (NVS)
+ * - Configuration save/load (one versioned blob in NVS)
  * - Activity monitoring and statistics
  */
 
@@ -22,51 +28,277 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "esp_err.h"
 #include "midi_types.h"
 #include "ump_types.h"
+#include "ump_endpoint.h"
+#include "midi_rules.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_MIDI_ROUTER_WORKERS
+#define MIDI_ROUTER_MAX_WORKERS     CONFIG_MIDI_ROUTER_WORKERS
+#else
+#define MIDI_ROUTER_MAX_WORKERS     2
+#endif
+
+#ifdef CONFIG_MIDI_ROUTER_PRESETS
+#define MIDI_ROUTER_PRESETS         CONFIG_MIDI_ROUTER_PRESETS
+#else
+#define MIDI_ROUTER_PRESETS         8
+#endif
+
+#ifdef CONFIG_MIDI_ROUTER_MAX_TRANSPORTS
+#define MIDI_ROUTER_MAX_TRANSPORTS  CONFIG_MIDI_ROUTER_MAX_TRANSPORTS
+#else
+#define MIDI_ROUTER_MAX_TRANSPORTS  6
+#endif
+
+#ifdef CONFIG_MIDI_ROUTER_ACTIVE_SENSING_MS
+#define MIDI_ROUTER_ACTIVE_SENSING_MS CONFIG_MIDI_ROUTER_ACTIVE_SENSING_MS
+#else
+#define MIDI_ROUTER_ACTIVE_SENSING_MS 250
+#endif
+
+/** source_worker value: shard the source by (group, channel) over all workers */
+#define MIDI_ROUTER_SHARD_SPREAD    0xFF
 
 /**
  * @brief Transport identifiers
+ * 
+ * The built-in transports have fixed IDs. IDs from
+ * MIDI_TRANSPORT_BUILTIN_COUNT up to MIDI_TRANSPORT_COUNT are handed
+ * out by midi_router_add_transport().
  */
 typedef enum {
     MIDI_TRANSPORT_UART,  /**< UART/DIN-5 (MIDI 1.0) */
     MIDI_TRANSPORT_USB,       /**< USB (MIDI 1.0/2.0) */
     MIDI_TRANSPORT_ETHERNET,  /**< Ethernet (MIDI 2.0) */
     MIDI_TRANSPORT_WIFI,      /**< WiFi (MIDI 2.0) */
-    MIDI_TRANSPORT_COUNT      /**< Number of transports */
+    MIDI_TRANSPORT_BUILTIN_COUNT /**< First dynamic transport ID */
 } midi_transport_t;
 
+/** Number of transport IDs (built-in and dynamic) */
+#define MIDI_TRANSPORT_COUNT        MIDI_ROUTER_MAX_TRANSPORTS
+
 typedef enum {
     MIDI_FORMAT_1_0,  /**< MIDI 1.0 format */
-    MIDI_FORMAT_2_0   /**< MIDI 2.0 format */
+    MIDI_FORMAT_2_0,  /**< MIDI 2.0 format */
+    MIDI_FORMAT_EVENT /**< Router control event (not MIDI data) */
 } midi_format_t;
 
+/**
+ * @brief Scheduling priority classes (highest first)
+ * 
+ * Realtime is served strictly first; the others share the remaining
+ * capacity by weight so a controller flood or bulk SysEx cannot
+ * starve notes, nor notes starve SysEx completely.
+ * 
+ * Priority only reorders different (source, group, channel) streams.
+ * While packets of a stream wait, its next ones queue behind them in
+ * the same class, so a Program Change or Sustain sent before a Note On
+ * still arrives first; only realtime overtakes.
+ */
+typedef enum {
+    MIDI_PRIO_REALTIME,           /**< Clock, transport, active sensing, reset */
+    MIDI_PRIO_NOTE,               /**< Note On/Off, per-note messages, router events */
+    MIDI_PRIO_CONTROL,            /**< CC, pitch bend, pressure, program, system common */
+    MIDI_PRIO_BULK,               /**< SysEx and everything else */
+    MIDI_PRIO_COUNT
+} midi_router_priority_t;
+
+/**
+ * @brief Router control events
+ */
+typedef enum {
+    MIDI_ROUTER_EVENT_SOURCE_LOST,  /**< Source disconnected: release its notes */
+    MIDI_ROUTER_EVENT_DISCOVER      /**< Peer connected: send it UMP Endpoint Discovery */
+} midi_router_event_type_t;
+
+/**
+ * @brief Router control event payload
+ */
+typedef struct {
+    uint8_t type;                 /**< midi_router_event_type_t */
+    uint8_t transport;            /**< Transport the event refers to */
+} midi_router_event_t;
+
 /**
  * @brief MIDI packet format (unified internal format)
  */
 typedef struct {
     midi_transport_t source;     /**< Source transport */
     midi_transport_t destination; /**< Destination (0xFF = broadcast) */
-    uint8_t format;               /**< 0=MIDI1.0, 1=UMP */
+    uint8_t format;               /**< 0=MIDI1.0, 1=UMP, 2=event */
+    uint8_t hops;                 /**< Routers already traversed (network hop marker) */
+    uint32_t seq;                 /**< Transport sequence tag, unique per message (0 = none) */
+    uint32_t timestamp_us;        /**< Router ingress, local esp_timer time (low 32 bits, set by router) */
     
     union {
         midi_message_t midi1;     /**< MIDI 1.0 message */
         ump_packet_t ump;         /**< UMP packet */
+        midi_router_event_t event; /**< Router control event */
     } data;
 } midi_router_packet_t;
 
 /**
  * @brief Message filter configuration
+ * 
+ * Applies to MIDI 1.0 and UMP sources alike. MIDI 1.0 messages are
+ * treated as belonging to the router's default group.
  */
 typedef struct {
     bool enabled;                 /**< Enable filtering */
-    uint16_t channel_mask;        /**< Channel filter (bit per channel) */
-    uint8_t msg_type_mask;        /**< Message type filter */
+    uint16_t channel_mask;        /**< Channel filter (bit per channel, all groups) */
+    uint8_t msg_type_mask;        /**< Allowed midi_message_type_t bits (0 = all) */
     bool block_active_sensing;    /**< Block 0xFE messages */
     bool block_clock;             /**< Block 0xF8 messages */
+    
+    // UMP-aware extensions
+    bool per_group_channels;      /**< Use group_channel_mask instead of channel_mask */
+    uint16_t group_channel_mask[UMP_GROUPS_COUNT]; /**< Allowed channels per group */
+    uint16_t class_block_mask;    /**< Blocked classes (bit per midi_msg_class_t) */
 } midi_filter_t;
 
+/**
+ * @brief What to shed when a destination queue is full
+ */
+typedef enum {
+    MIDI_DROP_OLDEST,             /**< Evict the oldest queued packet */
+    MIDI_DROP_NEWEST              /**< Discard the incoming packet */
+} midi_drop_mode_t;
+
+/**
+ * @brief Per-destination overload policy
+ */
+typedef struct {
+    midi_drop_mode_t drop_mode;   /**< Victim selection when full */
+    bool protect_critical;        /**< Never shed Note Off, realtime or SysEx end */
+    bool coalesce;                /**< Replace queued CC/pitch bend/pressure with newer value
+                                       (not Bank Select, Data Entry, (N)RPN or mode CCs) */
+    uint8_t max_tx_retries;       /**< Retries when TX reports busy, one per tick (0 = drop at once) */
+    bool active_sensing;          /**< Send Active Sensing while idle, so DIN gear detects a lost link */
+} midi_dest_policy_t;
+
+/** Recommended policy: shed oldest, keep note-offs, coalesce controllers */
+#define MIDI_DEST_POLICY_DEFAULT() ((midi_dest_policy_t){ \
+    .drop_mode = MIDI_DROP_OLDEST, .protect_critical = true, \
+    .coalesce = true, .max_tx_retries = 5 })
+
+/**
+ * @brief Transport TX callback
+ * 
+ * Return ESP_ERR_TIMEOUT or ESP_ERR_NO_MEM when the transport is busy;
+ * the router keeps the packet queued and retries per destination policy.
+ * 
+ * Return ESP_ERR_NOT_FINISHED after sending one slice of a long SysEx:
+ * the router calls again with the same packet, letting only realtime
+ * packets for that destination go out in between. If the router gives
+ * up on it instead (output down, send failed), it calls the transport's
+ * abort callback.
+ */
+typedef esp_err_t (*midi_router_tx_callback_t)(const midi_router_packet_t *packet);
+
+/**
+ * @brief Transport abort callback: forget a partly sent packet
+ * 
+ * The next packet must start from its beginning.
+ */
+typedef void (*midi_router_abort_callback_t)(void);
+
+/** Transport flag: network session (loop and duplicate checks apply) */
+#define MIDI_TRANSPORT_FLAG_NETWORK     0x01
+/** Transport flag: takes MIDI 1.0 and UMP alike, nothing is translated */
+#define MIDI_TRANSPORT_FLAG_ANY_FORMAT  0x02
+
+/**
+ * @brief Transport counters reported through the router
+ */
+typedef struct {
+    uint32_t packets_tx;          /**< Packets put on the wire */
+    uint32_t packets_rx;          /**< Packets received */
+    uint32_t packets_lost;        /**< Received packets known missing */
+    uint32_t tx_errors;           /**< Send failures */
+} midi_transport_stats_t;
+
+/**
+ * @brief Transport driver interface
+ * 
+ * Only name and send are required. The router calls the TX members
+ * from the worker that owns the destination, one call at a time; ctx
+ * is the pointer given at registration.
+ */
+typedef struct {
+    const char *name;             /**< Shown in logs, e.g. "BLE" */
+    uint8_t native_format;        /**< MIDI_FORMAT_1_0 or MIDI_FORMAT_2_0: what routed packets are translated to */
+    uint8_t flags;                /**< MIDI_TRANSPORT_FLAG_* */
+    
+    /**
+     * @brief Send one packet
+     * 
+     * Same contract as midi_router_tx_callback_t.
+     */
+    esp_err_t (*send)(void *ctx, const midi_router_packet_t *packet);
+    
+    /**
+     * @brief Send several packets in order (optional)
+     * 
+     * @param sent Output: packets fully sent before the one the result refers to
+     * @return ESP_OK if all were sent, else the send() result for packets[*sent]
+     */
+    esp_err_t (*send_batch)(void *ctx, const midi_router_packet_t *packets, size_t count,
+                            size_t *sent);
+    
+    /**
+     * @brief Push out anything buffered (optional)
+     * 
+     * Called after the router has handed over all it had for now, so a
+     * transport may pack several packets into one frame until then.
+     */
+    void (*flush)(void *ctx);
+    
+    /**
+     * @brief Forget a partly sent packet (optional)
+     * 
+     * Same contract as midi_router_abort_callback_t; required if send()
+     * ever returns ESP_ERR_NOT_FINISHED.
+     */
+    void (*abort)(void *ctx);
+    
+    /**
+     * @brief Packets the transport can take without blocking (optional)
+     * 
+     * 0 is treated like a busy send; without this member the router
+     * just tries.
+     */
+    size_t (*tx_capacity)(void *ctx);
+    
+    /**
+     * @brief Whether anything is listening (optional, default up)
+     * 
+     * Packets for a transport that is down are discarded.
+     */
+    bool (*link_up)(void *ctx);
+    
+    /**
+     * @brief Fill in transport counters (optional)
+     */
+    esp_err_t (*get_stats)(void *ctx, midi_transport_stats_t *stats);
+} midi_transport_ops_t;
+
+/**
+ * @brief Registered transport as the router sees it
+ */
+typedef struct {
+    const char *name;
+    uint8_t native_format;        /**< Format routed packets are translated to */
+    uint8_t flags;                /**< MIDI_TRANSPORT_FLAG_* */
+    bool attached;                /**< A driver is registered */
+    bool dynamic;                 /**< ID from midi_router_add_transport() */
+    bool link_up;                 /**< Driver reports a peer (true if it cannot tell) */
+    ump_endpoint_link_t ump_link; /**< Agreed with a UMP peer (network sessions keep their own) */
+} midi_transport_info_t;
+
 /**
  * @brief Router configuration
  */
@@ -81,6 +313,21 @@ typedef struct {
     bool auto_translate;          /**< Auto MIDI 1.0 ↔ UMP translation */
     bool merge_inputs;            /**< Merge all inputs to all outputs */
     uint8_t default_group;        /**< Default UMP group (0-15) */
+    
+    // Overload policy per output
+    midi_dest_policy_t dest_policies[MIDI_TRANSPORT_COUNT];
+    
+    // Filter/transform rules (evaluated in order after translation)
+    midi_rule_t rules[MIDI_RULES_MAX];
+    uint8_t num_rules;            /**< Number of valid entries in rules */
+    
+    // Worker sharding (indexes taken modulo the worker count; all 0 = one worker does everything)
+    uint8_t num_workers;                          /**< Workers to run (0 = MIDI_ROUTER_MAX_WORKERS), read at init */
+    uint8_t source_worker[MIDI_TRANSPORT_COUNT];  /**< Worker routing each source, or MIDI_ROUTER_SHARD_SPREAD */
+    uint8_t dest_worker[MIDI_TRANSPORT_COUNT];    /**< Worker owning each output queue and TX */
+    
+    // UMP group remapping per source: output group + 1 for each input group (0 = unchanged)
+    uint8_t group_map[MIDI_TRANSPORT_COUNT][UMP_GROUPS_COUNT];
 } midi_router_config_t;
 
 /**
@@ -92,9 +339,76 @@ typedef struct {
     uint32_t packets_filtered[MIDI_TRANSPORT_COUNT];
     uint32_t translations_1to2;
     uint32_t translations_2to1;
+    uint32_t translations_1to1;   /**< MIDI 1.0 carried as MT 0x2/0x1 (unscaled) to MIDI 1.0 Protocol links */
     uint32_t routing_errors;
+    
+    // Per-destination queue behaviour
+    uint32_t packets_shed[MIDI_TRANSPORT_COUNT];      /**< Evicted/refused by drop policy */
+    uint32_t packets_coalesced[MIDI_TRANSPORT_COUNT]; /**< Superseded values replaced */
+    uint32_t critical_dropped[MIDI_TRANSPORT_COUNT];  /**< Critical packets lost (queue all critical) */
+    uint32_t tx_retries[MIDI_TRANSPORT_COUNT];        /**< TX busy retries */
+    uint16_t queue_high_water[MIDI_TRANSPORT_COUNT];  /**< Max queue depth seen */
+    
+    // Output controller thinning (from registered coalescers)
+    uint32_t cc_thinned[MIDI_TRANSPORT_COUNT];        /**< Superseded controller values */
+    uint32_t cc_deferred[MIDI_TRANSPORT_COUNT];       /**< Values sent after being held */
+    
+    // Hanging-note protection
+    uint32_t notes_released[MIDI_TRANSPORT_COUNT];    /**< Note Offs sent for lost sources */
+    uint32_t active_sensing_sent[MIDI_TRANSPORT_COUNT]; /**< 0xFE generated for idle outputs */
+    
+    // Loop protection (per source)
+    uint32_t duplicates_dropped[MIDI_TRANSPORT_COUNT]; /**< Same (seq, content) seen twice */
+    uint32_t loops_dropped[MIDI_TRANSPORT_COUNT];      /**< Hop limit hit or own output echoed back */
+    
+    // Per priority class: ingress to transport TX
+    uint32_t class_packets[MIDI_PRIO_COUNT];          /**< Packets delivered */
+    uint32_t class_latency_avg_us[MIDI_PRIO_COUNT];   /**< Moving average (1/8 weight) */
+    uint32_t class_latency_max_us[MIDI_PRIO_COUNT];   /**< Worst case */
+    uint16_t class_queue_high_water[MIDI_PRIO_COUNT]; /**< Max ingress queue depth seen */
+    
+    // Cross-worker handoff (per destination)
+    uint32_t handoff_dropped[MIDI_TRANSPORT_COUNT];   /**< Owner's ring stayed full */
 } midi_router_stats_t;
 
+/**
+ * @brief Statistics at a point in time
+ */
+typedef struct {
+    int64_t timestamp_us;         /**< esp_timer_get_time() when taken */
+    uint32_t generation;          /**< Reset epoch (differs across a reset) */
+    midi_router_stats_t stats;
+} midi_router_stats_snapshot_t;
+
+/**
+ * @brief Startup timing of the last midi_router_init()
+ */
+typedef struct {
+    uint32_t config_load_us;      /**< Reading and decoding the saved config */
+    uint32_t preset_load_us;      /**< Reading and compiling saved presets */
+    uint32_t init_us;             /**< Init entry until workers are routing */
+    uint32_t boot_to_ready_us;    /**< Boot (esp_timer zero) until routing */
+} midi_router_boot_timing_t;
+
+/**
+ * @brief How incoming MIDI selects presets
+ * 
+ * Program Change n on the control channel (and, for UMP, the control
+ * group) recalls preset n. The SysEx F0 7D 'M' 'C' 01 nn F7 recalls
+ * preset nn from any channel or group. Numbers without a stored preset
+ * are ignored.
+ */
+typedef struct {
+    bool program_change;          /**< Program Change on the control channel switches */
+    bool sysex;                   /**< Preset SysEx switches */
+    bool consume;                 /**< Triggers are not routed onwards */
+    uint8_t control_channel;      /**< 0-15 */
+    uint8_t control_group;        /**< UMP group of the control channel (0-15) */
+    uint16_t source_mask;         /**< Bit per source allowed to switch (0 = any) */
+} midi_router_preset_trigger_t;
+
+struct midi_config_store;
+
 void uart_rx_callback(const midi_message_t *msg, void *ctx);
 
 /**
@@ -119,22 +433,257 @@ esp_err_t midi_router_deinit(void);
 /**
  * @brief Send packet to router (from transport layer)
  * 
- * Called by transport RX callbacks to inject packet into router
+ * Called by transport RX callbacks (task context) to inject packet into
+ * router; only the source's own RX task may send for it (other tasks use
+ * midi_router_inject()). Critical packets (Note Off, realtime, SysEx end)
+ * wait briefly for queue space; everything else is non-blocking.
+ * 
+ * Network transports fill in seq and hops from the session (the
+ * peer's last_rx_seq and last_rx_hops, midi_net.h) so duplicates and
+ * looped traffic can be dropped, and send a forwarded packet's hops
+ * back out as a hop marker; others leave them 0.
  * 
  * @param packet MIDI packet to route
  * @return ESP_OK on success, ESP_ERR_NO_MEM if buffer full
  */
 esp_err_t midi_router_send(const midi_router_packet_t *packet);
 
+/**
+ * @brief Send packet to router on behalf of a source
+ * 
+ * For players and replay that feed packets as an existing source from
+ * their own task. Routed like midi_router_send(); drops and queue depths
+ * are counted in a shared injector shard, since only the source's RX
+ * task may use midi_router_send().
+ * 
+ * @param packet MIDI packet to route
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if buffer full
+ */
+esp_err_t midi_router_inject(const midi_router_packet_t *packet);
+
+/**
+ * @brief Report that a source transport disconnected
+ * 
+ * The router sends a Note Off to every destination for each note still
+ * sounding on channels the source played. Call from the transport's
+ * disconnect path (peer timeout, USB unmount). Task context only.
+ * 
+ * @param source Lost source transport
+ * @return ESP_OK if queued, ESP_ERR_NO_MEM if the router queue stayed full
+ */
+esp_err_t midi_router_source_lost(midi_transport_t source);
+
+/**
+ * @brief Ask the peer of a UMP transport what it is
+ * 
+ * Sends UMP Endpoint Discovery on the transport. The peer's Endpoint
+ * Info starts the Stream Configuration exchange; the outcome shows in
+ * midi_transport_info_t.ump_link. Call when the peer comes up. The
+ * router also answers discovery from peers on any UMP transport, so
+ * either side may start. Task context only.
+ * 
+ * Network transports carry several sessions, each with its own peer:
+ * their session engine negotiates per session (midi_net.h), and the
+ * router leaves their UMP Stream messages alone.
+ * 
+ * @param transport Transport with a UMP (MIDI 2.0) driver
+ * @return ESP_OK if queued, ESP_ERR_NO_MEM if the router queue stayed
+ *         full, ESP_ERR_NOT_SUPPORTED for a network transport
+ */
+esp_err_t midi_router_discover_endpoint(midi_transport_t transport);
+
+/**
+ * @brief Set what the router reports to UMP peers
+ * 
+ * The default describes "MIDI-Cube": MIDI 1.0 and 2.0 protocols, MIDI
+ * 2.0 preferred, one bidirectional function block over all 16 groups.
+ * Links negotiated before the change keep their settings.
+ * 
+ * @param endpoint Endpoint (must outlive its use), NULL for the default
+ * @return ESP_OK
+ */
+esp_err_t midi_router_set_endpoint(const ump_endpoint_t *endpoint);
+
+/**
+ * @brief Get what the router reports to UMP peers
+ * 
+ * For session engines that negotiate per session as the same endpoint.
+ * 
+ * @return Endpoint set with midi_router_set_endpoint(), or the default
+ */
+const ump_endpoint_t *midi_router_get_endpoint(void);
+
+/**
+ * @brief Set the protocol a UMP transport's peer speaks
+ * 
+ * For drivers that learn it outside the UMP Stream, e.g. from the USB
+ * alternate setting the host selected. Stream Configuration messages
+ * update it the same way. A MIDI 1.0 Protocol link gets channel voice
+ * messages as MT 0x2 (32 bits, values unscaled); a MIDI 2.0 Protocol
+ * link gets MT 0x4. Other UMP passes through unchanged.
+ * 
+ * @param transport Transport with a UMP (MIDI 2.0) driver
+ * @param protocol UMP_STREAM_PROTOCOL_MIDI1 or UMP_STREAM_PROTOCOL_MIDI2
+ * @return ESP_OK, ESP_ERR_INVALID_ARG
+ */
+esp_err_t midi_router_set_transport_protocol(midi_transport_t transport, uint8_t protocol);
+
+/**
+ * @brief Attach a driver to a transport ID
+ * 
+ * Registrations persist across router init/deinit, so transports may
+ * start before or after the router. Replacing a driver waits until no
+ * worker is still using the old one.
+ * 
+ * @param transport Built-in ID, or an ID from midi_router_add_transport()
+ * @param ops Driver (must outlive the registration), NULL to detach
+ * @param ctx Passed to every ops call
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a bad ID or ops without send
+ */
+esp_err_t midi_router_attach_transport(midi_transport_t transport,
+                                       const midi_transport_ops_t *ops, void *ctx);
+
+/**
+ * @brief Register a transport under a new dynamic ID
+ * 
+ * The new ID's routes, filter and policy come from the active
+ * configuration; the default configuration routes every source to it.
+ * 
+ * @param ops Driver (must outlive the registration)
+ * @param ctx Passed to every ops call
+ * @param transport Output: assigned ID
+ * @return ESP_OK, ESP_ERR_NO_MEM if all MIDI_TRANSPORT_COUNT IDs are taken
+ */
+esp_err_t midi_router_add_transport(const midi_transport_ops_t *ops, void *ctx,
+                                    midi_transport_t *transport);
+
+/**
+ * @brief Detach a transport's driver and free a dynamic ID
+ * 
+ * Returns once no worker can call into the driver any more.
+ * 
+ * @param transport Transport ID
+ * @return ESP_OK on success
+ */
+esp_err_t midi_router_remove_transport(midi_transport_t transport);
+
+/**
+ * @brief Describe a transport
+ * 
+ * @param transport Transport ID
+ * @param info Output: transport details
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a bad ID
+ */
+esp_err_t midi_router_get_transport_info(midi_transport_t transport,
+                                         midi_transport_info_t *info);
+
+/**
+ * @brief Read a transport driver's counters
+ * 
+ * @param transport Transport ID
+ * @param stats Output: counters
+ * @return ESP_OK, ESP_ERR_NOT_SUPPORTED if the driver keeps none
+ */
+esp_err_t midi_router_get_transport_stats(midi_transport_t transport,
+                                          midi_transport_stats_t *stats);
+
+/**
+ * @brief Register transport TX callback
+ * 
+ * Shorthand for attaching a driver with only send. Packets arrive as
+ * MIDI 1.0 for UART and as UMP for every other transport.
+ * 
+ * @param transport Destination transport
+ * @param tx_callback Callback (NULL to unregister)
+ * @return ESP_OK on success
+ */
+esp_err_t midi_router_register_transport_tx(midi_transport_t transport,
+                                             midi_router_tx_callback_t tx_callback);
+
+/**
+ * @brief Register transport abort callback
+ * 
+ * For drivers registered with midi_router_register_transport_tx() that
+ * send SysEx in slices. Kept until the TX callback is unregistered.
+ * 
+ * @param transport Destination transport
+ * @param abort_callback Callback (NULL = none)
+ * @return ESP_OK on success
+ */
+esp_err_t midi_router_register_transport_abort(midi_transport_t transport,
+                                                midi_router_abort_callback_t abort_callback);
+
+struct midi_coalescer;
+
+/**
+ * @brief Register an output's controller coalescer
+ * 
+ * Lets midi_router_get_stats() report thinning done in the transport's
+ * TX path (see midi_coalescer.h).
+ * 
+ * @param destination Destination transport
+ * @param coalescer Coalescer owned by the transport (NULL to unregister)
+ * @return ESP_OK on success
+ */
+esp_err_t midi_router_register_coalescer(midi_transport_t destination,
+                                          const struct midi_coalescer *coalescer);
+
+/**
+ * @brief Set overload policy for a destination
+ * 
+ * @param destination Destination transport
+ * @param policy Policy to apply
+ * @return ESP_OK on success
+ */
+esp_err_t midi_router_set_dest_policy(midi_transport_t destination,
+                                       const midi_dest_policy_t *policy);
+
+/**
+ * @brief Check whether a packet must survive overload
+ * 
+ * Note Off (including MIDI 1.0 Note On velocity 0), system realtime and
+ * the final packet of a SysEx are critical.
+ * 
+ * @param packet Packet to classify
+ * @return true if critical
+ */
+bool midi_router_packet_is_critical(const midi_router_packet_t *packet);
+
+/**
+ * @brief Scheduling class of a packet
+ * 
+ * @param packet Packet to classify
+ * @return Priority class
+ */
+midi_router_priority_t midi_router_packet_priority(const midi_router_packet_t *packet);
+
+/**
+ * @brief Ordered stream of a packet within its source
+ * 
+ * A destination sends one source's packets of the same stream in the
+ * order they came; only realtime may overtake them. MIDI 1.0 packets
+ * count as group 0.
+ * 
+ * @param packet Packet to classify
+ * @return group * 17 + channel, or + 16 for messages without a channel
+ */
+uint16_t midi_router_packet_stream(const midi_router_packet_t *packet);
+
 /**
  * @brief Set routing matrix entry
  * 
  * Enable/disable routing from source to destination
  * 
+ * Like every setter below, this builds a new configuration and
+ * publishes it atomically: routing never pauses, and each packet is
+ * routed entirely under the old or the new configuration. Workers use
+ * the change from their next packet. Setters must not be called from
+ * transport TX callbacks.
+ * 
  * @param source Source transport
  * @param destination Destination transport
  * @param enable true = route, false = block
- * @return ESP_OK on success
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the router is not running
  */
 esp_err_t midi_router_set_route(midi_transport_t source,
                                  midi_transport_t destination,
@@ -155,6 +704,9 @@ esp_err_t midi_router_get_route(midi_transport_t source,
 /**
  * @brief Set input filter for transport
  * 
+ * The filter is compiled to per-group channel bitmaps and a class mask;
+ * filtered packets are discarded before translation and TX.
+ * 
  * @param transport Transport to filter
  * @param filter Filter configuration
  * @return ESP_OK on success
@@ -162,6 +714,20 @@ esp_err_t midi_router_get_route(midi_transport_t source,
 esp_err_t midi_router_set_filter(midi_transport_t transport,
                                   const midi_filter_t *filter);
 
+/**
+ * @brief Replace the filter/transform rule list
+ * 
+ * Rules are compiled into a decision table and take effect for the
+ * next routed packet. Rules are evaluated per route after protocol
+ * translation, so they see the format the destination receives.
+ * 
+ * @param rules Rule list (NULL with count 0 clears all rules)
+ * @param count Number of rules (max MIDI_RULES_MAX)
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG / ESP_ERR_INVALID_SIZE
+ *         if the rules do not compile (active rules are unchanged)
+ */
+esp_err_t midi_router_set_rules(const midi_rule_t *rules, uint8_t count);
+
 /**
  * @brief Enable/disable merge mode
  * 
@@ -173,17 +739,125 @@ esp_err_t midi_router_set_filter(midi_transport_t transport,
  */
 esp_err_t midi_router_set_merge_mode(bool enable);
 
+/**
+ * @brief Replace the whole configuration at once (e.g. a scene change)
+ * 
+ * Routes, filters, rules and policies switch together in one publish.
+ * While running, the worker layout (num_workers, source_worker,
+ * dest_worker) is kept; it takes effect at the next init. Before init,
+ * sets the configuration init starts with.
+ * 
+ * @param config New configuration
+ * @return ESP_OK on success, or the rule compiler's error (nothing changes)
+ */
+esp_err_t midi_router_set_config(const midi_router_config_t *config);
+
+/**
+ * @brief Get a consistent copy of the current configuration
+ * 
+ * @param config Output: configuration
+ * @return ESP_OK on success
+ */
+esp_err_t midi_router_get_config(midi_router_config_t *config);
+
+/**
+ * @brief Store a preset (compiled now, so recall costs no work)
+ * 
+ * The worker layout is not part of a preset. Storing over the active
+ * preset applies the change at once.
+ * 
+ * @param index Preset slot (0 to MIDI_ROUTER_PRESETS - 1)
+ * @param config Configuration, NULL = the current one
+ * @return ESP_OK on success, or the rule compiler's error (slot unchanged)
+ */
+esp_err_t midi_router_preset_store(uint8_t index, const midi_router_config_t *config);
+
+/**
+ * @brief Switch to a preset
+ * 
+ * Publishes the precompiled preset: workers use it from their next
+ * packet. Takes microseconds; later setters modify a copy of the
+ * preset, leaving the stored one intact.
+ * 
+ * @param index Preset slot
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the slot is empty
+ */
+esp_err_t midi_router_preset_recall(uint8_t index);
+
+/**
+ * @brief Delete a preset and its saved copy
+ * 
+ * @param index Preset slot
+ * @return ESP_OK on success
+ */
+esp_err_t midi_router_preset_erase(uint8_t index);
+
+/**
+ * @brief Save a preset to NVS (one blob per preset, loaded at init)
+ * 
+ * @param index Preset slot
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the slot is empty
+ */
+esp_err_t midi_router_preset_save(uint8_t index);
+
+/**
+ * @brief Preset the router is running
+ * 
+ * @return Preset slot, or -1 after any other configuration change
+ */
+int midi_router_get_active_preset(void);
+
+/**
+ * @brief Set which incoming messages switch presets
+ * 
+ * Kept across init/deinit; not saved. Triggers are off by default.
+ * 
+ * @param trigger Trigger settings
+ * @return ESP_OK on success
+ */
+esp_err_t midi_router_set_preset_trigger(const midi_router_preset_trigger_t *trigger);
+
 /**
  * @brief Get router statistics
  * 
+ * Folds the per-worker and per-source counter shards. Lock-free and
+ * callable from any task; counts may lag the hot path by a packet.
+ * 
  * @param stats Output: statistics structure
  * @return ESP_OK on success
  */
 esp_err_t midi_router_get_stats(midi_router_stats_t *stats);
 
+/**
+ * @brief Get statistics with the time they were taken
+ * 
+ * @param snapshot Output: snapshot
+ * @return ESP_OK on success
+ */
+esp_err_t midi_router_get_stats_snapshot(midi_router_stats_snapshot_t *snapshot);
+
+/**
+ * @brief Counter changes between two snapshots (for rates)
+ * 
+ * Counters are subtracted (wrap-safe); averages, maxima and high-water
+ * marks are copied from newer. If the statistics were reset between the
+ * snapshots, delta is newer's counts. Divide by
+ * newer->timestamp_us - older->timestamp_us (see midi_stats_rate()).
+ * 
+ * @param older Earlier snapshot
+ * @param newer Later snapshot
+ * @param delta Output: changes
+ * @return ESP_OK on success
+ */
+esp_err_t midi_router_stats_delta(const midi_router_stats_snapshot_t *older,
+                                  const midi_router_stats_snapshot_t *newer,
+                                  midi_router_stats_t *delta);
+
 /**
  * @brief Reset statistics
  * 
+ * Safe from any task; each shard is cleared by its own writer.
+ * 
  * @return ESP_OK on success
  */
 esp_err_t midi_router_reset_stats(void);
@@ -191,7 +865,9 @@ esp_err_t midi_router_reset_stats(void);
 /**
  * @brief Save configuration to NVS
  * 
- * Persists routing matrix and filters
+ * Persists the whole configuration (routing matrix, filters, policies,
+ * rules, worker layout) as one versioned, CRC-checked blob
+ * (see midi_config_blob.h).
  * 
  * @return ESP_OK on success
  */
@@ -200,7 +876,13 @@ esp_err_t midi_router_save_config(void);
 /**
  * @brief Load configuration from NVS
  * 
- * @return ESP_OK on success, ESP_ERR_NOT_FOUND if no saved config
+ * One blob read. Blobs from older firmware are migrated; corrupted
+ * blobs are rejected and the running config is left unchanged. While
+ * the router runs the worker layout is kept; it applies at next init.
+ * 
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if no saved config,
+ *         ESP_ERR_INVALID_CRC / ESP_ERR_INVALID_VERSION / ESP_ERR_INVALID_SIZE
+ *         if the saved blob is unusable
  */
 esp_err_t midi_router_load_config(void);
 
@@ -213,6 +895,35 @@ esp_err_t midi_router_load_config(void);
  */
 esp_err_t midi_router_reset_config(void);
 
+/**
+ * @brief Fill in the default configuration
+ * 
+ * Every source routed to every other output, translation on, default
+ * destination policies, no filters or rules.
+ * 
+ * @param config Output: configuration
+ */
+void midi_router_get_default_config(midi_router_config_t *config);
+
+/**
+ * @brief Choose where save/load keep the configuration
+ * 
+ * Set before midi_router_init() to affect the boot load. Persists
+ * across deinit.
+ * 
+ * @param store Backend (must outlive its use), NULL = NVS
+ * @return ESP_OK on success
+ */
+esp_err_t midi_router_set_config_store(const struct midi_config_store *store);
+
+/**
+ * @brief Get startup timing of the last init
+ * 
+ * @param timing Output: timing
+ * @return ESP_OK on success
+ */
+esp_err_t midi_router_get_boot_timing(midi_router_boot_timing_t *timing);
+
 /**
  * @brief Get transport name string
  * 
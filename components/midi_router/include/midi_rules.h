@@ -0,0 +1,161 @@
+/**
+ * @file midi_rules.h
+ * @brief Router Rule Engine - Filter/Transform Decision Table
+ *
+ * Rules are written in a readable form (midi_rule_t) and compiled into a
+ * flat decision table (midi_rule_table_t) that the router evaluates for
+ * every packet and destination. Evaluation never allocates; the cost per
+ * packet is bounded by MIDI_RULES_MAX table entries, and per-route
+ * bitmaps skip every entry that cannot apply to the current route.
+ *
+ * Both MIDI 1.0 messages and UMP (MT 0x1, 0x2, 0x4 and data messages)
+ * are handled in place.
+ */
+
+#ifndef MIDI_RULES_H
+#define MIDI_RULES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "midi_types.h"
+#include "ump_types.h"
+#include "midi_msg_class.h"
+
+#ifdef CONFIG_MIDI_ROUTER_MAX_RULES
+#define MIDI_RULES_MAX          CONFIG_MIDI_ROUTER_MAX_RULES
+#else
+#define MIDI_RULES_MAX          16
+#endif
+
+/** Maximum transports addressable by rule source/destination masks */
+#define MIDI_RULES_MAX_TRANSPORTS 16
+
+/**
+ * @brief Rule actions
+ */
+typedef enum {
+    MIDI_RULE_ACTION_PASS,            /**< Accept packet unchanged (stops evaluation) */
+    MIDI_RULE_ACTION_DROP,            /**< Discard packet */
+    MIDI_RULE_ACTION_REMAP_CHANNEL,   /**< Set channel to param (0-15) */
+    MIDI_RULE_ACTION_TRANSPOSE,       /**< Add param semitones to note number */
+    MIDI_RULE_ACTION_SCALE,           /**< value = value * param / 100 + offset */
+    MIDI_RULE_ACTION_REWRITE_CC,      /**< Set controller number to param (0-127) */
+    MIDI_RULE_ACTION_COUNT
+} midi_rule_action_t;
+
+/**
+ * @brief Rule definition (user-facing)
+ *
+ * All masks use 0 for "any". Ranges are inclusive and only checked when
+ * the matching flag is set; a message without the field (e.g. Clock has
+ * no note number) never matches a restricted range or channel mask.
+ */
+typedef struct {
+    /* Match */
+    uint16_t source_mask;         /**< Bit per source transport (0 = any) */
+    uint16_t dest_mask;           /**< Bit per destination transport (0 = any) */
+    uint16_t group_mask;          /**< Bit per UMP group (0 = any) */
+    uint16_t channel_mask;        /**< Bit per channel (0 = any) */
+    uint16_t class_mask;          /**< Bit per midi_msg_class_t (0 = any) */
+    bool     match_data1;         /**< Check data1 range (note / CC number) */
+    uint8_t  data1_min;           /**< Lowest note / controller number */
+    uint8_t  data1_max;           /**< Highest note / controller number */
+    bool     match_value;         /**< Check value range (7-bit scale) */
+    uint8_t  value_min;           /**< Lowest velocity / value */
+    uint8_t  value_max;           /**< Highest velocity / value */
+
+    /* Action */
+    midi_rule_action_t action;    /**< Action to perform on match */
+    int16_t  param;               /**< Channel, semitones, percent or CC number */
+    int16_t  offset;              /**< SCALE only: offset added after scaling (7-bit units) */
+    bool     continue_eval;       /**< Keep evaluating later rules after a transform */
+} midi_rule_t;
+
+/**
+ * @brief Compiled rule entry
+ */
+typedef struct {
+    uint32_t data1_bitmap[4];     /**< 128-bit note / controller set */
+    uint16_t group_mask;          /**< Expanded group mask */
+    uint16_t channel_mask;        /**< Expanded channel mask */
+    uint16_t class_mask;          /**< Expanded class mask */
+    uint8_t  value_min;           /**< Value range low */
+    uint8_t  value_max;           /**< Value range high */
+    uint8_t  action;              /**< midi_rule_action_t */
+    uint8_t  flags;               /**< MIDI_RULE_F_* */
+    int16_t  param;               /**< Action parameter */
+    int16_t  offset;              /**< Action offset */
+} midi_rule_entry_t;
+
+#define MIDI_RULE_F_DATA1       0x01  /**< data1 bitmap is restrictive */
+#define MIDI_RULE_F_VALUE       0x02  /**< value range is restrictive */
+#define MIDI_RULE_F_CHANNEL     0x04  /**< channel mask is restrictive */
+#define MIDI_RULE_F_CONTINUE    0x08  /**< continue after transform */
+
+#if MIDI_RULES_MAX > 32
+#error "MIDI_RULES_MAX must not exceed 32 (route bitmaps are 32-bit)"
+#endif
+
+/**
+ * @brief Compiled decision table
+ */
+typedef struct {
+    uint8_t  count;               /**< Number of valid entries */
+    uint16_t class_any;           /**< Union of all class masks (fast reject) */
+    /** Entries that may apply to [source][destination], bit per entry */
+    uint32_t route_entries[MIDI_RULES_MAX_TRANSPORTS][MIDI_RULES_MAX_TRANSPORTS];
+    midi_rule_entry_t entries[MIDI_RULES_MAX];
+} midi_rule_table_t;
+
+/**
+ * @brief Compile rules into a decision table
+ *
+ * @param rules Rule list (evaluated in order)
+ * @param count Number of rules (0 clears the table)
+ * @param table Output table
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if too many rules,
+ *         ESP_ERR_INVALID_ARG on bad ranges or parameters
+ */
+esp_err_t midi_rules_compile(const midi_rule_t *rules, uint8_t count,
+                             midi_rule_table_t *table);
+
+/**
+ * @brief Apply rules to a MIDI 1.0 message in place
+ *
+ * @param table Compiled table
+ * @param source Source transport
+ * @param dest Destination transport
+ * @param group Group the message is attributed to (router default group)
+ * @param msg Message to filter/transform
+ * @return true to forward, false to drop
+ */
+bool midi_rules_apply_midi1(const midi_rule_table_t *table,
+                            uint8_t source, uint8_t dest, uint8_t group,
+                            midi_message_t *msg);
+
+/**
+ * @brief Apply rules to a UMP in place
+ *
+ * @param table Compiled table
+ * @param source Source transport
+ * @param dest Destination transport
+ * @param ump Packet to filter/transform
+ * @return true to forward, false to drop
+ */
+bool midi_rules_apply_ump(const midi_rule_table_t *table,
+                          uint8_t source, uint8_t dest,
+                          ump_packet_t *ump);
+
+/**
+ * @brief Check whether any rule could apply to a route
+ */
+static inline bool midi_rules_route_active(const midi_rule_table_t *table,
+                                           uint8_t source, uint8_t dest) {
+    return table->count &&
+           source < MIDI_RULES_MAX_TRANSPORTS && dest < MIDI_RULES_MAX_TRANSPORTS &&
+           table->route_entries[source][dest] != 0;
+}
+
+#endif /* MIDI_RULES_H */
@@ -0,0 +1,82 @@
+/**
+ * @file midi_spsc.h
+ * @brief Lock-Free Single-Producer/Single-Consumer Packet Ring
+ *
+ * Hands routed packets from one router worker to another without locks
+ * or critical sections, so the two sides can run on different cores.
+ * Exactly one task may push and exactly one task may pop.
+ *
+ * Indices grow without bound and are masked on access; the producer
+ * publishes a slot with a release store of tail, the consumer frees it
+ * with a release store of head.
+ */
+
+#ifndef MIDI_SPSC_H
+#define MIDI_SPSC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "midi_router.h"
+
+/** Ring capacity (power of two) */
+#define MIDI_SPSC_SLOTS     32
+
+/**
+ * @brief Packet ring
+ */
+typedef struct {
+    uint32_t head;                /**< Next slot to pop (consumer owned) */
+    uint32_t tail;                /**< Next slot to fill (producer owned) */
+    midi_router_packet_t slots[MIDI_SPSC_SLOTS];
+} midi_spsc_ring_t;
+
+/**
+ * @brief Reset a ring (no concurrent users)
+ */
+static inline void midi_spsc_init(midi_spsc_ring_t *ring) {
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+/**
+ * @brief Push a packet (producer side)
+ *
+ * @return false if the ring is full
+ */
+static inline bool midi_spsc_push(midi_spsc_ring_t *ring, const midi_router_packet_t *packet) {
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (tail - head == MIDI_SPSC_SLOTS) {
+        return false;
+    }
+    ring->slots[tail & (MIDI_SPSC_SLOTS - 1)] = *packet;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Pop a packet (consumer side)
+ *
+ * @return false if the ring is empty
+ */
+static inline bool midi_spsc_pop(midi_spsc_ring_t *ring, midi_router_packet_t *packet) {
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+        return false;
+    }
+    *packet = ring->slots[head & (MIDI_SPSC_SLOTS - 1)];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Check for waiting packets (consumer side)
+ */
+static inline bool midi_spsc_empty(midi_spsc_ring_t *ring) {
+    return ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+#endif /* MIDI_SPSC_H */
@@ -0,0 +1,292 @@
+/**
+ * @file midi_coalescer.c
+ * @brief Continuous-Controller Thinning Implementation
+ */
+
+#include "midi_coalescer.h"
+#include "midi_msg_class.h"
+#include <string.h>
+
+/** Idle streams may be recycled after this long */
+#define SLOT_STALE_US   2000000
+
+/** Key bits naming the channel: format | group | channel */
+#define KEY_CHANNEL_MASK    0x0FFF0000u
+
+/**
+ * @brief Controllers where every message counts, not just the latest value
+ *
+ * Bank Select, Data Entry / Increment / Decrement and (N)RPN select only
+ * make sense in sequence; switches (Sustain, Portamento, Sostenuto, Soft,
+ * Legato, Hold 2: 64-69) change how notes play, so each press and release
+ * must land between the same notes; channel mode messages (120-127) are
+ * commands that must arrive each time they are sent.
+ */
+static inline bool coalescer_cc_is_discrete(uint8_t index) {
+    return index == 0 || index == 32 || index == 6 || index == 38 ||
+           (index >= 64 && index <= 69) || (index >= 96 && index <= 101) || index >= 120;
+}
+
+/**
+ * @brief Channel bits of a channel voice packet's key
+ *
+ * @return 0x80000000 | format | group | channel, or 0 if not channel voice
+ */
+static uint32_t coalescer_channel_bits(const midi_router_packet_t *packet) {
+    uint8_t group, channel;
+
+    if (packet->format == MIDI_FORMAT_1_0) {
+        uint8_t status = packet->data.midi1.status;
+        if (status < 0x80 || status >= 0xF0) {
+            return 0;
+        }
+        group = 0;
+        channel = status & 0x0F;
+    } else {
+        uint32_t word0 = packet->data.ump.words[0];
+        uint8_t mt = UMP_GET_MT(word0);
+        if (mt != UMP_MT_MIDI1_CHANNEL_VOICE && mt != UMP_MT_MIDI2_CHANNEL_VOICE) {
+            return 0;
+        }
+        group = UMP_GET_GROUP(word0);
+        channel = UMP_GET_CHANNEL(word0);
+    }
+    return 0x80000000u | ((uint32_t)packet->format << 24) | ((uint32_t)group << 20) |
+           ((uint32_t)channel << 16);
+}
+
+void midi_coalescer_init(midi_coalescer_t *c, const midi_coalescer_config_t *config) {
+    memset(c, 0, sizeof(*c));
+    c->config = *config;
+    c->min_interval_us = config->max_rate_hz ? (1000000u / config->max_rate_hz) : 0;
+}
+
+uint32_t midi_coalescer_key(const midi_router_packet_t *packet) {
+    midi_msg_class_t cls;
+    uint8_t index;
+
+    uint32_t channel_bits = coalescer_channel_bits(packet);
+    if (!channel_bits) {
+        return 0;
+    }
+    if (packet->format == MIDI_FORMAT_1_0) {
+        cls = midi_msg_class_from_status(packet->data.midi1.status);
+        index = packet->data.midi1.data.bytes[0] & 0x7F;
+    } else {
+        uint32_t word0 = packet->data.ump.words[0];
+        cls = midi_msg_class_from_ump(word0);
+        index = (word0 >> 8) & 0x7F;
+    }
+
+    switch (cls) {
+        case MIDI_CLASS_CONTROL_CHANGE:
+            if (coalescer_cc_is_discrete(index)) {
+                return 0;
+            }
+            break;
+        case MIDI_CLASS_POLY_PRESSURE:
+            break;  // Index distinguishes streams
+        case MIDI_CLASS_PITCH_BEND:
+        case MIDI_CLASS_CHANNEL_PRESSURE:
+            index = 0;
+            break;
+        default:
+            return 0;
+    }
+
+    return channel_bits | ((uint32_t)cls << 8) | index;
+}
+
+/**
+ * @brief Controller value scaled to 32 bits
+ */
+static uint32_t coalescer_value(const midi_router_packet_t *packet) {
+    if (packet->format == MIDI_FORMAT_1_0) {
+        const uint8_t *b = packet->data.midi1.data.bytes;
+        switch (packet->data.midi1.status & 0xF0) {
+            case 0xE0: return (((uint32_t)b[1] << 7) | b[0]) << 18;
+            case 0xD0: return (uint32_t)b[0] << 25;
+            default:   return (uint32_t)b[1] << 25;
+        }
+    }
+
+    uint32_t word0 = packet->data.ump.words[0];
+    if (UMP_GET_MT(word0) == UMP_MT_MIDI2_CHANNEL_VOICE) {
+        return packet->data.ump.words[1];
+    }
+    switch ((word0 >> 16) & 0xF0) {
+        case 0xE0: return ((((word0) & 0x7F) << 7) | ((word0 >> 8) & 0x7F)) << 18;
+        case 0xD0: return ((word0 >> 8) & 0x7F) << 25;
+        default:   return (word0 & 0x7F) << 25;
+    }
+}
+
+static inline uint32_t coalescer_index(uint32_t key) {
+    return (key * 2654435761u) >> 26;  // 64 slots
+}
+
+static midi_coalescer_slot_t *coalescer_find(midi_coalescer_t *c, uint32_t key) {
+    uint32_t idx = coalescer_index(key);
+
+    for (int probe = 0; probe < MIDI_COALESCER_MAX_PROBE; probe++) {
+        midi_coalescer_slot_t *slot = &c->slots[(idx + probe) % MIDI_COALESCER_SLOTS];
+        if (slot->key == key) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static midi_coalescer_slot_t *coalescer_slot(midi_coalescer_t *c, uint32_t key, int64_t now_us) {
+    uint32_t idx = coalescer_index(key);
+    midi_coalescer_slot_t *reuse = NULL;
+
+    for (int probe = 0; probe < MIDI_COALESCER_MAX_PROBE; probe++) {
+        midi_coalescer_slot_t *slot = &c->slots[(idx + probe) % MIDI_COALESCER_SLOTS];
+        if (slot->key == key) {
+            return slot;
+        }
+        if (!reuse && (slot->key == 0 ||
+                       (!slot->pending && now_us - slot->last_sent_us > SLOT_STALE_US))) {
+            reuse = slot;
+        }
+    }
+
+    if (reuse) {
+        memset(reuse, 0, sizeof(*reuse));
+        reuse->key = key;
+    }
+    return reuse;
+}
+
+midi_coalesce_result_t midi_coalescer_offer(midi_coalescer_t *c,
+                                            const midi_router_packet_t *packet,
+                                            int64_t now_us, bool output_busy) {
+    if (!c->config.enabled) {
+        return MIDI_COALESCE_SEND;
+    }
+
+    uint32_t key = midi_coalescer_key(packet);
+    if (!key) {
+        return MIDI_COALESCE_SEND;  // Notes etc. are never delayed
+    }
+
+    midi_coalescer_slot_t *slot = coalescer_slot(c, key, now_us);
+    if (!slot) {
+        c->stats.sent_direct++;
+        return MIDI_COALESCE_SEND;  // Table crowded: fail open
+    }
+
+    uint32_t value = coalescer_value(packet);
+    bool sent_before = slot->last_sent_us != 0;
+    uint32_t delta = (value > slot->last_value) ? value - slot->last_value
+                                                : slot->last_value - value;
+
+    // Back to the value already on the wire: nothing to send
+    if (sent_before && delta == 0) {
+        if (slot->pending) {
+            slot->pending = false;
+            c->pending_count--;
+        }
+        c->stats.thinned++;
+        return MIDI_COALESCE_DROPPED;
+    }
+
+    bool interval_ok = !sent_before || (now_us - slot->last_sent_us) >= c->min_interval_us;
+    bool delta_ok = !sent_before || (delta >> 18) >= c->config.min_delta;
+
+    if (!output_busy && interval_ok && delta_ok) {
+        if (slot->pending) {
+            slot->pending = false;
+            c->pending_count--;
+            c->stats.thinned++;
+        }
+        return MIDI_COALESCE_SEND;  // Recorded by midi_coalescer_sent()
+    }
+
+    // Hold latest value; an older held one is superseded
+    if (slot->pending) {
+        c->stats.thinned++;
+    } else {
+        slot->pending = true;
+        c->pending_count++;
+    }
+    slot->packet = *packet;
+    slot->pending_since_us = now_us;
+    return MIDI_COALESCE_HELD;
+}
+
+bool midi_coalescer_poll(midi_coalescer_t *c, int64_t now_us, midi_router_packet_t *out) {
+    if (!c->pending_count) {
+        return false;
+    }
+
+    int64_t settle_us = (int64_t)c->config.settle_ms * 1000;
+
+    for (int i = 0; i < MIDI_COALESCER_SLOTS; i++) {
+        midi_coalescer_slot_t *slot = &c->slots[i];
+        if (!slot->pending) {
+            continue;
+        }
+        if (slot->last_sent_us && now_us - slot->last_sent_us < c->min_interval_us) {
+            continue;  // Rate limit not yet elapsed
+        }
+
+        uint32_t value = coalescer_value(&slot->packet);
+        uint32_t delta = (value > slot->last_value) ? value - slot->last_value
+                                                    : slot->last_value - value;
+        if (slot->last_sent_us && (delta >> 18) < c->config.min_delta &&
+            now_us - slot->pending_since_us < settle_us) {
+            continue;  // Small change: wait until the stream settles
+        }
+
+        *out = slot->packet;
+        return true;  // Held until midi_coalescer_sent()
+    }
+
+    return false;
+}
+
+bool midi_coalescer_poll_before(midi_coalescer_t *c, const midi_router_packet_t *packet,
+                                midi_router_packet_t *out) {
+    if (!c->pending_count) {
+        return false;
+    }
+
+    uint32_t channel_bits = coalescer_channel_bits(packet);
+    if (!channel_bits) {
+        return false;
+    }
+
+    for (int i = 0; i < MIDI_COALESCER_SLOTS; i++) {
+        midi_coalescer_slot_t *slot = &c->slots[i];
+        if (slot->pending && (slot->key & KEY_CHANNEL_MASK) == (channel_bits & KEY_CHANNEL_MASK)) {
+            *out = slot->packet;
+            return true;  // Held until midi_coalescer_sent()
+        }
+    }
+    return false;
+}
+
+void midi_coalescer_sent(midi_coalescer_t *c, const midi_router_packet_t *packet, int64_t now_us) {
+    if (!c->config.enabled) {
+        return;
+    }
+
+    uint32_t key = midi_coalescer_key(packet);
+    midi_coalescer_slot_t *slot = key ? coalescer_find(c, key) : NULL;
+    if (!slot) {
+        return;  // Not a controller, or passed a crowded table (counted by offer)
+    }
+
+    uint32_t value = coalescer_value(packet);
+    if (slot->pending && coalescer_value(&slot->packet) == value) {
+        slot->pending = false;
+        c->pending_count--;
+        c->stats.sent_deferred++;
+    } else {
+        c->stats.sent_direct++;
+    }
+    slot->last_value = value;
+    slot->last_sent_us = now_us;
+}
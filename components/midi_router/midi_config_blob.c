@@ -0,0 +1,412 @@
+/**
+ * @file midi_config_blob.c
+ * @brief Router Configuration Blob Implementation
+ */
+
+#include "midi_config_blob.h"
+#include <string.h>
+
+/** Filter flag bits */
+#define FILTER_F_ENABLED        0x01
+#define FILTER_F_BLOCK_AS       0x02
+#define FILTER_F_BLOCK_CLOCK    0x04
+#define FILTER_F_PER_GROUP      0x08
+
+/** Global flag bits */
+#define GLOBAL_F_TRANSLATE      0x01
+#define GLOBAL_F_MERGE          0x02
+
+/** Policy flag bits */
+#define POLICY_F_DROP_NEWEST    0x01
+#define POLICY_F_PROTECT        0x02
+#define POLICY_F_COALESCE       0x04
+#define POLICY_F_ACTIVE_SENSING 0x08
+
+/** Transports in the version 1 and 2 sections (the built-in ones) */
+#define BLOB_BASE_TRANSPORTS    4
+
+/** Rule flag bits */
+#define RULE_F_DATA1            0x01
+#define RULE_F_VALUE            0x02
+#define RULE_F_CONTINUE         0x04
+
+//=============================================================================
+// Byte Cursor
+//=============================================================================
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t pos;
+    bool overflow;                /**< Write past end / read past end */
+} blob_cursor_t;
+
+static void put_u8(blob_cursor_t *c, uint8_t v) {
+    if (c->pos + 1 > c->len) {
+        c->overflow = true;
+        return;
+    }
+    c->buf[c->pos++] = v;
+}
+
+static void put_u16(blob_cursor_t *c, uint16_t v) {
+    put_u8(c, v & 0xFF);
+    put_u8(c, v >> 8);
+}
+
+static uint8_t get_u8(blob_cursor_t *c) {
+    if (c->pos + 1 > c->len) {
+        c->overflow = true;
+        return 0;
+    }
+    return c->buf[c->pos++];
+}
+
+static uint16_t get_u16(blob_cursor_t *c) {
+    uint16_t lo = get_u8(c);
+    return lo | ((uint16_t)get_u8(c) << 8);
+}
+
+static void put_u32_at(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static uint32_t get_u32_at(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+//=============================================================================
+// CRC
+//=============================================================================
+
+uint32_t midi_config_crc32(const uint8_t *data, size_t len) {
+    uint32_t crc = 0xFFFFFFFFu;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+//=============================================================================
+// Encode
+//=============================================================================
+
+static void encode_filter(blob_cursor_t *c, const midi_filter_t *f) {
+    uint8_t flags = (f->enabled ? FILTER_F_ENABLED : 0) |
+                    (f->block_active_sensing ? FILTER_F_BLOCK_AS : 0) |
+                    (f->block_clock ? FILTER_F_BLOCK_CLOCK : 0) |
+                    (f->per_group_channels ? FILTER_F_PER_GROUP : 0);
+    put_u8(c, flags);
+    put_u16(c, f->channel_mask);
+    put_u8(c, f->msg_type_mask);
+    put_u16(c, f->class_block_mask);
+    if (f->per_group_channels) {
+        for (int g = 0; g < UMP_GROUPS_COUNT; g++) {
+            put_u16(c, f->group_channel_mask[g]);
+        }
+    }
+}
+
+static void encode_policy(blob_cursor_t *c, const midi_dest_policy_t *p) {
+    put_u8(c, (p->drop_mode == MIDI_DROP_NEWEST ? POLICY_F_DROP_NEWEST : 0) |
+              (p->protect_critical ? POLICY_F_PROTECT : 0) |
+              (p->coalesce ? POLICY_F_COALESCE : 0) |
+              (p->active_sensing ? POLICY_F_ACTIVE_SENSING : 0));
+    put_u8(c, p->max_tx_retries);
+}
+
+static void encode_group_map(blob_cursor_t *c, const uint8_t map[UMP_GROUPS_COUNT]) {
+    uint16_t mapped = 0;
+    for (int g = 0; g < UMP_GROUPS_COUNT; g++) {
+        if (map[g]) {
+            mapped |= 1u << g;
+        }
+    }
+    put_u16(c, mapped);
+    for (int g = 0; g < UMP_GROUPS_COUNT; g++) {
+        if (mapped & (1u << g)) {
+            put_u8(c, (map[g] - 1) & 0x0F);
+        }
+    }
+}
+
+static void encode_rule(blob_cursor_t *c, const midi_rule_t *r) {
+    put_u16(c, r->source_mask);
+    put_u16(c, r->dest_mask);
+    put_u16(c, r->group_mask);
+    put_u16(c, r->channel_mask);
+    put_u16(c, r->class_mask);
+    put_u8(c, (r->match_data1 ? RULE_F_DATA1 : 0) | (r->match_value ? RULE_F_VALUE : 0) |
+              (r->continue_eval ? RULE_F_CONTINUE : 0));
+    put_u8(c, r->data1_min);
+    put_u8(c, r->data1_max);
+    put_u8(c, r->value_min);
+    put_u8(c, r->value_max);
+    put_u8(c, (uint8_t)r->action);
+    put_u16(c, (uint16_t)r->param);
+    put_u16(c, (uint16_t)r->offset);
+}
+
+esp_err_t midi_config_blob_encode(const midi_router_config_t *config,
+                                  uint8_t *buf, size_t capacity, size_t *len) {
+    if (!config || !buf || !len || capacity < MIDI_CONFIG_BLOB_HEADER) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    blob_cursor_t c = { .buf = buf, .len = capacity, .pos = MIDI_CONFIG_BLOB_HEADER };
+
+    // Version 1 (built-in transports)
+    for (int src = 0; src < BLOB_BASE_TRANSPORTS; src++) {
+        uint8_t mask = 0;
+        for (int dest = 0; dest < BLOB_BASE_TRANSPORTS; dest++) {
+            if (config->routing_matrix[src][dest]) {
+                mask |= 1u << dest;
+            }
+        }
+        put_u8(&c, mask);
+    }
+    put_u8(&c, (config->auto_translate ? GLOBAL_F_TRANSLATE : 0) |
+               (config->merge_inputs ? GLOBAL_F_MERGE : 0));
+    put_u8(&c, config->default_group);
+
+    for (int t = 0; t < BLOB_BASE_TRANSPORTS; t++) {
+        encode_filter(&c, &config->input_filters[t]);
+    }
+    for (int t = 0; t < BLOB_BASE_TRANSPORTS; t++) {
+        encode_policy(&c, &config->dest_policies[t]);
+    }
+
+    put_u8(&c, config->num_workers);
+    for (int t = 0; t < BLOB_BASE_TRANSPORTS; t++) {
+        put_u8(&c, config->source_worker[t]);
+        put_u8(&c, config->dest_worker[t]);
+    }
+
+    uint8_t num_rules = config->num_rules <= MIDI_RULES_MAX ? config->num_rules : MIDI_RULES_MAX;
+    put_u8(&c, num_rules);
+    for (int i = 0; i < num_rules; i++) {
+        encode_rule(&c, &config->rules[i]);
+    }
+
+    // Version 2: group map per source, mapped groups only
+    for (int src = 0; src < BLOB_BASE_TRANSPORTS; src++) {
+        encode_group_map(&c, config->group_map[src]);
+    }
+
+    // Version 3: transport count, full-width routes, then the settings
+    // of each transport beyond the built-in ones
+    put_u8(&c, MIDI_TRANSPORT_COUNT);
+    for (int src = 0; src < MIDI_TRANSPORT_COUNT; src++) {
+        uint16_t mask = 0;
+        for (int dest = 0; dest < MIDI_TRANSPORT_COUNT; dest++) {
+            if (config->routing_matrix[src][dest]) {
+                mask |= 1u << dest;
+            }
+        }
+        put_u16(&c, mask);
+    }
+    for (int t = BLOB_BASE_TRANSPORTS; t < MIDI_TRANSPORT_COUNT; t++) {
+        encode_filter(&c, &config->input_filters[t]);
+        encode_policy(&c, &config->dest_policies[t]);
+        put_u8(&c, config->source_worker[t]);
+        put_u8(&c, config->dest_worker[t]);
+        encode_group_map(&c, config->group_map[t]);
+    }
+
+    if (c.overflow) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    size_t payload_len = c.pos - MIDI_CONFIG_BLOB_HEADER;
+    put_u32_at(&buf[0], MIDI_CONFIG_BLOB_MAGIC);
+    buf[4] = MIDI_CONFIG_BLOB_VERSION & 0xFF;
+    buf[5] = MIDI_CONFIG_BLOB_VERSION >> 8;
+    buf[6] = payload_len & 0xFF;
+    buf[7] = payload_len >> 8;
+    put_u32_at(&buf[8], midi_config_crc32(&buf[MIDI_CONFIG_BLOB_HEADER], payload_len));
+
+    *len = c.pos;
+    return ESP_OK;
+}
+
+//=============================================================================
+// Decode
+//=============================================================================
+
+static void decode_filter(blob_cursor_t *c, midi_filter_t *f) {
+    uint8_t flags = get_u8(c);
+    memset(f, 0, sizeof(*f));
+    f->enabled = flags & FILTER_F_ENABLED;
+    f->block_active_sensing = flags & FILTER_F_BLOCK_AS;
+    f->block_clock = flags & FILTER_F_BLOCK_CLOCK;
+    f->per_group_channels = flags & FILTER_F_PER_GROUP;
+    f->channel_mask = get_u16(c);
+    f->msg_type_mask = get_u8(c);
+    f->class_block_mask = get_u16(c);
+    if (f->per_group_channels) {
+        for (int g = 0; g < UMP_GROUPS_COUNT; g++) {
+            f->group_channel_mask[g] = get_u16(c);
+        }
+    }
+}
+
+static void decode_policy(blob_cursor_t *c, midi_dest_policy_t *p) {
+    uint8_t flags = get_u8(c);
+    p->drop_mode = (flags & POLICY_F_DROP_NEWEST) ? MIDI_DROP_NEWEST : MIDI_DROP_OLDEST;
+    p->protect_critical = flags & POLICY_F_PROTECT;
+    p->coalesce = flags & POLICY_F_COALESCE;
+    p->active_sensing = flags & POLICY_F_ACTIVE_SENSING;
+    p->max_tx_retries = get_u8(c);
+}
+
+static void decode_group_map(blob_cursor_t *c, uint8_t map[UMP_GROUPS_COUNT]) {
+    uint16_t mapped = get_u16(c);
+    for (int g = 0; g < UMP_GROUPS_COUNT; g++) {
+        if (mapped & (1u << g)) {
+            map[g] = (get_u8(c) & 0x0F) + 1;
+        }
+    }
+}
+
+static void decode_rule(blob_cursor_t *c, midi_rule_t *r) {
+    memset(r, 0, sizeof(*r));
+    r->source_mask = get_u16(c);
+    r->dest_mask = get_u16(c);
+    r->group_mask = get_u16(c);
+    r->channel_mask = get_u16(c);
+    r->class_mask = get_u16(c);
+    uint8_t flags = get_u8(c);
+    r->match_data1 = flags & RULE_F_DATA1;
+    r->match_value = flags & RULE_F_VALUE;
+    r->continue_eval = flags & RULE_F_CONTINUE;
+    r->data1_min = get_u8(c);
+    r->data1_max = get_u8(c);
+    r->value_min = get_u8(c);
+    r->value_max = get_u8(c);
+    r->action = (midi_rule_action_t)get_u8(c);
+    r->param = (int16_t)get_u16(c);
+    r->offset = (int16_t)get_u16(c);
+}
+
+uint16_t midi_config_blob_version(const uint8_t *buf, size_t len) {
+    if (!buf || len < MIDI_CONFIG_BLOB_HEADER || get_u32_at(buf) != MIDI_CONFIG_BLOB_MAGIC) {
+        return 0;
+    }
+    return buf[4] | ((uint16_t)buf[5] << 8);
+}
+
+esp_err_t midi_config_blob_decode(const uint8_t *buf, size_t len,
+                                  midi_router_config_t *config) {
+    if (!buf || !config) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint16_t version = midi_config_blob_version(buf, len);
+    if (version == 0) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    size_t payload_len = buf[6] | ((size_t)buf[7] << 8);
+    if (MIDI_CONFIG_BLOB_HEADER + payload_len > len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (midi_config_crc32(&buf[MIDI_CONFIG_BLOB_HEADER], payload_len) != get_u32_at(&buf[8])) {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    // Start from defaults so fields a version lacks are migrated sensibly
+    midi_router_config_t *decoded = config;
+    midi_router_get_default_config(decoded);
+
+    blob_cursor_t c = { .buf = (uint8_t *)&buf[MIDI_CONFIG_BLOB_HEADER], .len = payload_len };
+
+    // Version 1 (built-in transports)
+    for (int src = 0; src < BLOB_BASE_TRANSPORTS; src++) {
+        uint8_t mask = get_u8(&c);
+        for (int dest = 0; dest < BLOB_BASE_TRANSPORTS; dest++) {
+            decoded->routing_matrix[src][dest] = (mask >> dest) & 1;
+        }
+    }
+    uint8_t flags = get_u8(&c);
+    decoded->auto_translate = flags & GLOBAL_F_TRANSLATE;
+    decoded->merge_inputs = flags & GLOBAL_F_MERGE;
+    decoded->default_group = get_u8(&c) & 0x0F;
+
+    for (int t = 0; t < BLOB_BASE_TRANSPORTS; t++) {
+        decode_filter(&c, &decoded->input_filters[t]);
+    }
+    for (int t = 0; t < BLOB_BASE_TRANSPORTS; t++) {
+        decode_policy(&c, &decoded->dest_policies[t]);
+    }
+
+    decoded->num_workers = get_u8(&c);
+    for (int t = 0; t < BLOB_BASE_TRANSPORTS; t++) {
+        decoded->source_worker[t] = get_u8(&c);
+        decoded->dest_worker[t] = get_u8(&c);
+    }
+
+    uint8_t num_rules = get_u8(&c);
+    if (num_rules > MIDI_RULES_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    decoded->num_rules = num_rules;
+    for (int i = 0; i < num_rules; i++) {
+        decode_rule(&c, &decoded->rules[i]);
+    }
+
+    if (version >= 2) {
+        for (int src = 0; src < BLOB_BASE_TRANSPORTS; src++) {
+            decode_group_map(&c, decoded->group_map[src]);
+        }
+    }
+
+    if (version >= 3) {
+        // Written with another transport count: extra entries are read
+        // and dropped, missing ones keep their defaults
+        uint8_t count = get_u8(&c);
+        if (count < BLOB_BASE_TRANSPORTS || count > 16) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        for (int src = 0; src < count; src++) {
+            uint16_t mask = get_u16(&c);
+            for (int dest = 0; src < MIDI_TRANSPORT_COUNT && dest < MIDI_TRANSPORT_COUNT; dest++) {
+                decoded->routing_matrix[src][dest] = (mask >> dest) & 1;
+            }
+        }
+        for (int t = BLOB_BASE_TRANSPORTS; t < count; t++) {
+            midi_filter_t filter;
+            midi_dest_policy_t policy;
+            uint8_t source_worker, dest_worker;
+            uint8_t group_map[UMP_GROUPS_COUNT] = {0};
+
+            decode_filter(&c, &filter);
+            decode_policy(&c, &policy);
+            source_worker = get_u8(&c);
+            dest_worker = get_u8(&c);
+            decode_group_map(&c, group_map);
+
+            if (t < MIDI_TRANSPORT_COUNT) {
+                decoded->input_filters[t] = filter;
+                decoded->dest_policies[t] = policy;
+                decoded->source_worker[t] = source_worker;
+                decoded->dest_worker[t] = dest_worker;
+                memcpy(decoded->group_map[t], group_map, sizeof(group_map));
+            }
+        }
+    }
+
+    // Later versions append here, each guarded by `if (version >= N)`
+
+    if (c.overflow) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
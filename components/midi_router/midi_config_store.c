@@ -0,0 +1,155 @@
+/**
+ * @file midi_config_store.c
+ * @brief Configuration Blob Storage Backends
+ */
+
+#include "midi_config_store.h"
+#include "nvs.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define FILE_STORE_PATH_MAX 96
+
+//=============================================================================
+// NVS
+//=============================================================================
+
+static esp_err_t nvs_store_read(const midi_config_store_t *store, const char *name,
+                                uint8_t *buf, size_t capacity, size_t *len) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(store->location, NVS_READONLY, &handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_ERR_NOT_FOUND;   // Namespace created on first save
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    size_t size = capacity;
+    err = nvs_get_blob(handle, name, buf, &size);
+    nvs_close(handle);
+
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (err == ESP_ERR_NVS_INVALID_LENGTH) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *len = size;
+    return err;
+}
+
+static esp_err_t nvs_store_write(const midi_config_store_t *store, const char *name,
+                                 const uint8_t *buf, size_t len) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(store->location, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_set_blob(handle, name, buf, len);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+static esp_err_t nvs_store_erase(const midi_config_store_t *store, const char *name) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(store->location, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_erase_key(handle, name);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return (err == ESP_ERR_NVS_NOT_FOUND) ? ESP_OK : err;
+}
+
+static const midi_config_store_t s_nvs_store = {
+    .read = nvs_store_read,
+    .write = nvs_store_write,
+    .erase = nvs_store_erase,
+    .location = MIDI_CONFIG_NVS_NAMESPACE
+};
+
+const midi_config_store_t *midi_config_store_nvs(void) {
+    return &s_nvs_store;
+}
+
+//=============================================================================
+// File
+//=============================================================================
+
+/**
+ * @brief Build prefix + name
+ */
+static bool file_store_path(const midi_config_store_t *store, const char *name,
+                            char *path, size_t size) {
+    int n = snprintf(path, size, "%s%s", store->location, name);
+    return n > 0 && (size_t)n < size;
+}
+
+static esp_err_t file_store_read(const midi_config_store_t *store, const char *name,
+                                 uint8_t *buf, size_t capacity, size_t *len) {
+    char path[FILE_STORE_PATH_MAX];
+    if (!file_store_path(store, name, path, sizeof(path))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return (errno == ENOENT) ? ESP_ERR_NOT_FOUND : ESP_FAIL;
+    }
+
+    size_t size = fread(buf, 1, capacity, f);
+    bool truncated = (size == capacity) && fgetc(f) != EOF;
+    fclose(f);
+
+    if (truncated) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *len = size;
+    return ESP_OK;
+}
+
+static esp_err_t file_store_write(const midi_config_store_t *store, const char *name,
+                                  const uint8_t *buf, size_t len) {
+    char path[FILE_STORE_PATH_MAX];
+    if (!file_store_path(store, name, path, sizeof(path))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return ESP_FAIL;
+    }
+
+    size_t written = fwrite(buf, 1, len, f);
+    int closed = fclose(f);
+    return (written == len && closed == 0) ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t file_store_erase(const midi_config_store_t *store, const char *name) {
+    char path[FILE_STORE_PATH_MAX];
+    if (!file_store_path(store, name, path, sizeof(path))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (remove(path) != 0 && errno != ENOENT) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void midi_config_store_file_init(midi_config_store_t *store, const char *prefix) {
+    store->read = file_store_read;
+    store->write = file_store_write;
+    store->erase = file_store_erase;
+    store->location = prefix;
+}
@@ -0,0 +1,141 @@
+/**
+ * @file midi_loop_guard.c
+ * @brief Fingerprint Set Implementation
+ */
+
+#include "midi_loop_guard.h"
+#include <string.h>
+
+void midi_loop_guard_init(midi_loop_guard_t *guard, uint32_t window_ms) {
+    memset(guard, 0, sizeof(*guard));
+    guard->window_us = window_ms * 1000;
+}
+
+/**
+ * @brief Murmur3-style word mix
+ */
+static inline uint32_t guard_mix(uint32_t h, uint32_t k) {
+    k *= 0xCC9E2D51u;
+    k = (k << 15) | (k >> 17);
+    k *= 0x1B873593u;
+    h ^= k;
+    h = (h << 13) | (h >> 19);
+    return h * 5 + 0xE6546B64u;
+}
+
+static inline uint32_t guard_finish(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h ? h : 1;  // 0 marks an unused slot
+}
+
+static uint32_t guard_hash_content(uint32_t h, const midi_router_packet_t *packet) {
+    h = guard_mix(h, packet->format);
+    if (packet->format == MIDI_FORMAT_1_0) {
+        const midi_message_t *msg = &packet->data.midi1;
+        return guard_mix(h, ((uint32_t)msg->status << 16) |
+                            ((uint32_t)msg->data.bytes[0] << 8) | msg->data.bytes[1]);
+    }
+
+    const ump_packet_t *ump = &packet->data.ump;
+    uint8_t words = ump->num_words <= 4 ? ump->num_words : 4;
+    for (uint8_t i = 0; i < words; i++) {
+        h = guard_mix(h, ump->words[i]);
+    }
+    return h;
+}
+
+uint32_t midi_loop_guard_content_hash(const midi_router_packet_t *packet) {
+    return guard_finish(guard_hash_content(0x4D494449u, packet));
+}
+
+uint32_t midi_loop_guard_ingress_hash(const midi_router_packet_t *packet) {
+    uint32_t h = guard_mix(0x53455130u, packet->source);
+    h = guard_mix(h, packet->seq);
+    return guard_finish(guard_hash_content(h, packet));
+}
+
+/**
+ * @brief Find a fingerprint's slot, or the slot an insert should use
+ *
+ * @param found Output: true if the returned slot holds a live match
+ */
+static midi_loop_guard_entry_t *guard_probe(midi_loop_guard_t *guard, uint32_t fingerprint,
+                                            uint32_t now, bool *found) {
+    uint32_t idx = (uint32_t)(((uint64_t)fingerprint * MIDI_LOOP_GUARD_SLOTS) >> 32);
+    midi_loop_guard_entry_t *victim = NULL;
+    uint32_t victim_age = 0;
+
+    for (int probe = 0; probe < MIDI_LOOP_GUARD_PROBE; probe++) {
+        midi_loop_guard_entry_t *entry = &guard->entries[(idx + probe) % MIDI_LOOP_GUARD_SLOTS];
+        uint32_t age = now - entry->stamp_us;  // Wraps cleanly
+        bool live = entry->fingerprint && age < guard->window_us;
+
+        if (live && entry->fingerprint == fingerprint) {
+            *found = true;
+            return entry;
+        }
+        if (!live) {
+            age = UINT32_MAX;  // Free slots always win
+        }
+        if (!victim || age > victim_age) {
+            victim = entry;
+            victim_age = age;
+        }
+    }
+
+    *found = false;
+    return victim;
+}
+
+bool midi_loop_guard_contains(midi_loop_guard_t *guard, uint32_t fingerprint, int64_t now_us) {
+    if (!guard->window_us) {
+        return false;
+    }
+
+    bool found;
+    guard_probe(guard, fingerprint, (uint32_t)now_us, &found);
+    if (found) {
+        guard->stats.hits++;
+    }
+    return found;
+}
+
+void midi_loop_guard_insert(midi_loop_guard_t *guard, uint32_t fingerprint, int64_t now_us) {
+    if (!guard->window_us) {
+        return;
+    }
+
+    bool found;
+    uint32_t now = (uint32_t)now_us;
+    midi_loop_guard_entry_t *entry = guard_probe(guard, fingerprint, now, &found);
+    if (!found && entry->fingerprint && now - entry->stamp_us < guard->window_us) {
+        guard->stats.evictions++;
+    }
+    entry->fingerprint = fingerprint;
+    entry->stamp_us = now;
+}
+
+bool midi_loop_guard_check_insert(midi_loop_guard_t *guard, uint32_t fingerprint,
+                                  int64_t now_us) {
+    if (!guard->window_us) {
+        return false;
+    }
+
+    bool found;
+    uint32_t now = (uint32_t)now_us;
+    midi_loop_guard_entry_t *entry = guard_probe(guard, fingerprint, now, &found);
+    if (found) {
+        guard->stats.hits++;
+        return true;  // Keep original stamp: window runs from first sighting
+    }
+    if (entry->fingerprint && now - entry->stamp_us < guard->window_us) {
+        guard->stats.evictions++;
+    }
+    entry->fingerprint = fingerprint;
+    entry->stamp_us = now;
+    return false;
+}
@@ -0,0 +1,59 @@
+/**
+ * @file midi_msg_class.c
+ * @brief Message Classification Table
+ */
+
+#include "midi_msg_class.h"
+
+// Short aliases so each table row fits on one line
+#define NOF MIDI_CLASS_NOTE_OFF
+#define NON MIDI_CLASS_NOTE_ON
+#define PKP MIDI_CLASS_POLY_PRESSURE
+#define CC_ MIDI_CLASS_CONTROL_CHANGE
+#define PC_ MIDI_CLASS_PROGRAM_CHANGE
+#define CP_ MIDI_CLASS_CHANNEL_PRESSURE
+#define PB_ MIDI_CLASS_PITCH_BEND
+#define PN_ MIDI_CLASS_PER_NOTE
+#define PRM MIDI_CLASS_PARAMETER
+#define SX_ MIDI_CLASS_SYSEX
+#define SC_ MIDI_CLASS_SYSTEM_COMMON
+#define CLK MIDI_CLASS_CLOCK
+#define TRN MIDI_CLASS_TRANSPORT
+#define AS_ MIDI_CLASS_ACTIVE_SENSING
+#define RST MIDI_CLASS_RESET
+#define OTH MIDI_CLASS_OTHER
+
+#define ROW_OTHER   OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH
+#define ROW_SYSEX   SX_, SX_, SX_, SX_, SX_, SX_, SX_, SX_, SX_, SX_, SX_, SX_, SX_, SX_, SX_, SX_
+
+const uint8_t midi_msg_class_table[256] = {
+    /* MT 0x0 Utility */
+    ROW_OTHER,
+    /* MT 0x1 System (low nibble of 0xFn) */
+    SX_, SC_, SC_, SC_, OTH, OTH, SC_, SX_, CLK, OTH, TRN, TRN, TRN, OTH, AS_, RST,
+    /* MT 0x2 MIDI 1.0 Channel Voice (opcode) */
+    OTH, OTH, OTH, OTH, OTH, OTH, OTH, OTH, NOF, NON, PKP, CC_, PC_, CP_, PB_, OTH,
+    /* MT 0x3 Data 64 (SysEx 7) */
+    ROW_SYSEX,
+    /* MT 0x4 MIDI 2.0 Channel Voice (opcode) */
+    PN_, PN_, PRM, PRM, PRM, PRM, PN_, OTH, NOF, NON, PKP, CC_, PC_, CP_, PB_, PN_,
+    /* MT 0x5 Data 128 (SysEx 8, Mixed Data Set) */
+    ROW_SYSEX,
+    /* MT 0x6 - 0xF */
+    ROW_OTHER, ROW_OTHER, ROW_OTHER, ROW_OTHER, ROW_OTHER,
+    ROW_OTHER, ROW_OTHER, ROW_OTHER, ROW_OTHER, ROW_OTHER,
+};
+
+static const char *class_names[MIDI_CLASS_COUNT] = {
+    "Note Off", "Note On", "Poly Pressure", "Control Change",
+    "Program Change", "Channel Pressure", "Pitch Bend", "Per-Note",
+    "Parameter", "SysEx", "System Common", "Clock",
+    "Transport", "Active Sensing", "Reset", "Other"
+};
+
+const char* midi_msg_class_name(midi_msg_class_t cls) {
+    if (cls < MIDI_CLASS_COUNT) {
+        return class_names[cls];
+    }
+    return "Unknown";
+}
@@ -0,0 +1,207 @@
+/**
+ * @file midi_note_tracker.c
+ * @brief Active Note Tracking Implementation
+ */
+
+#include "midi_note_tracker.h"
+#include "midi_defs.h"
+#include <string.h>
+
+void midi_note_tracker_reset(midi_note_tracker_t *tracker) {
+    memset(tracker, 0, sizeof(*tracker));
+}
+
+/**
+ * @brief Start tracking a channel's owners note by note
+ *
+ * Called when a second source strikes a note there. The notes already
+ * sounding belong to the one previous owner; if owners are already
+ * mixed (no block was free then) or no block is free now, the channel
+ * stays tracked as a whole.
+ */
+static void share_channel(midi_note_tracker_t *tracker, midi_transport_t dest,
+                          const uint32_t bits[4], uint16_t owners, uint8_t *slot) {
+    if (owners & (owners - 1)) {
+        return;
+    }
+
+    for (int i = 0; i < MIDI_NOTE_TRACKER_SHARED_CHANNELS; i++) {
+        midi_note_shared_t *shared = &tracker->shared[dest][i];
+        if (shared->used) {
+            continue;
+        }
+        uint8_t previous = (uint8_t)__builtin_ctz(owners);
+        for (int note = 0; note < 128; note++) {
+            if (bits[note >> 5] & (1u << (note & 31))) {
+                shared->owner[note] = previous;
+            }
+        }
+        shared->used = true;
+        *slot = (uint8_t)(i + 1);
+        return;
+    }
+}
+
+/**
+ * @brief Mark a channel silent, returning its block if it had one
+ */
+static void clear_channel(midi_note_tracker_t *tracker, midi_transport_t dest,
+                          uint8_t group, uint8_t channel) {
+    uint8_t *slot = &tracker->shared_slot[dest][group][channel];
+    if (*slot) {
+        tracker->shared[dest][*slot - 1].used = false;
+        *slot = 0;
+    }
+    tracker->owners[dest][group][channel] = 0;
+}
+
+void midi_note_tracker_update(midi_note_tracker_t *tracker, midi_transport_t dest,
+                              const midi_router_packet_t *packet) {
+    uint8_t group, channel, note, opcode;
+    bool on;
+    midi_note_fmt_t fmt;
+
+    if (dest >= MIDI_TRANSPORT_COUNT || packet->source >= MIDI_TRANSPORT_COUNT) {
+        return;
+    }
+
+    if (packet->format == MIDI_FORMAT_1_0) {
+        uint8_t status = packet->data.midi1.status;
+        opcode = status & 0xF0;
+        group = 0;
+        channel = status & 0x0F;
+        note = packet->data.midi1.data.bytes[0] & 0x7F;
+        on = (opcode == MIDI_STATUS_NOTE_ON) && packet->data.midi1.data.bytes[1] != 0;
+        fmt = MIDI_NOTE_FMT_MIDI1;
+    } else if (packet->format == MIDI_FORMAT_2_0) {
+        uint32_t word0 = packet->data.ump.words[0];
+        uint8_t mt = UMP_GET_MT(word0);
+        opcode = (word0 >> 16) & 0xF0;
+        group = UMP_GET_GROUP(word0);
+        channel = UMP_GET_CHANNEL(word0);
+        note = (word0 >> 8) & 0x7F;
+        if (mt == UMP_MT_MIDI1_CHANNEL_VOICE) {
+            on = (opcode == MIDI_STATUS_NOTE_ON) && (word0 & 0x7F) != 0;
+            fmt = MIDI_NOTE_FMT_UMP_MT2;
+        } else if (mt == UMP_MT_MIDI2_CHANNEL_VOICE) {
+            on = (opcode == MIDI_STATUS_NOTE_ON);  // Velocity 0 is a real Note On in MIDI 2.0
+            fmt = MIDI_NOTE_FMT_UMP_MT4;
+        } else {
+            return;
+        }
+    } else {
+        return;
+    }
+
+    if (opcode != MIDI_STATUS_NOTE_ON && opcode != MIDI_STATUS_NOTE_OFF) {
+        return;
+    }
+
+    uint32_t *bits = tracker->notes[dest][group][channel];
+    uint32_t mask = 1u << (note & 31);
+    uint16_t *owners = &tracker->owners[dest][group][channel];
+    uint8_t *slot = &tracker->shared_slot[dest][group][channel];
+
+    if (on) {
+        uint16_t source_bit = 1u << packet->source;
+        if (!*slot && (*owners & ~source_bit)) {
+            share_channel(tracker, dest, bits, *owners, slot);
+        }
+        if (*slot) {
+            tracker->shared[dest][*slot - 1].owner[note] = packet->source;
+        }
+        bits[note >> 5] |= mask;
+        *owners |= source_bit;
+        tracker->formats[dest][group][channel] = (uint8_t)fmt;
+    } else {
+        bits[note >> 5] &= ~mask;
+        if (!(bits[0] | bits[1] | bits[2] | bits[3])) {
+            clear_channel(tracker, dest, group, channel);
+        }
+    }
+}
+
+/**
+ * @brief Build a Note Off in the given format
+ */
+static void build_note_off(midi_note_fmt_t fmt, uint8_t group, uint8_t channel,
+                           uint8_t note, midi_router_packet_t *out) {
+    if (fmt == MIDI_NOTE_FMT_MIDI1) {
+        out->format = MIDI_FORMAT_1_0;
+        out->data.midi1 = (midi_message_t){
+            .type = MIDI_MSG_TYPE_CHANNEL,
+            .status = MIDI_STATUS_NOTE_OFF | channel,
+            .channel = channel,
+            .data.bytes = {note, 0}
+        };
+        return;
+    }
+
+    uint8_t mt = (fmt == MIDI_NOTE_FMT_UMP_MT2) ? UMP_MT_MIDI1_CHANNEL_VOICE
+                                                : UMP_MT_MIDI2_CHANNEL_VOICE;
+    out->format = MIDI_FORMAT_2_0;
+    memset(&out->data.ump, 0, sizeof(out->data.ump));
+    out->data.ump.words[0] = ((uint32_t)mt << 28) | ((uint32_t)group << 24) |
+                             ((uint32_t)(MIDI_STATUS_NOTE_OFF | channel) << 16) |
+                             ((uint32_t)note << 8);
+    out->data.ump.num_words = (mt == UMP_MT_MIDI2_CHANNEL_VOICE) ? 2 : 1;
+    out->data.ump.message_type = mt;
+    out->data.ump.group = group;
+}
+
+uint32_t midi_note_tracker_release(midi_note_tracker_t *tracker, midi_transport_t source,
+                                   midi_transport_t dest,
+                                   midi_note_tracker_emit_t emit, void *ctx) {
+    uint32_t released = 0;
+    uint16_t source_bit = 1u << source;
+    midi_router_packet_t off = { .source = source, .destination = 0xFF };
+
+    for (int group = 0; group < UMP_GROUPS_COUNT; group++) {
+        for (int channel = 0; channel < 16; channel++) {
+            if (!(tracker->owners[dest][group][channel] & source_bit)) {
+                continue;
+            }
+
+            uint32_t *bits = tracker->notes[dest][group][channel];
+            midi_note_fmt_t fmt = (midi_note_fmt_t)tracker->formats[dest][group][channel];
+            uint8_t slot = tracker->shared_slot[dest][group][channel];
+            const uint8_t *owner = slot ? tracker->shared[dest][slot - 1].owner : NULL;
+            uint16_t remaining = 0;
+
+            for (int word = 0; word < 4; word++) {
+                uint32_t pending = bits[word];
+                while (pending) {
+                    int note = (word << 5) | __builtin_ctz(pending);
+                    pending &= pending - 1;
+                    if (owner && owner[note] != source) {
+                        remaining |= 1u << owner[note];  // Another source's note
+                        continue;
+                    }
+                    bits[word] &= ~(1u << (note & 31));
+                    build_note_off(fmt, group, channel, note, &off);
+                    emit(dest, &off, ctx);
+                    released++;
+                }
+            }
+            if (remaining) {
+                tracker->owners[dest][group][channel] = remaining;
+            } else {
+                clear_channel(tracker, dest, group, channel);
+            }
+        }
+    }
+
+    return released;
+}
+
+uint32_t midi_note_tracker_release_source(midi_note_tracker_t *tracker,
+                                          midi_transport_t source,
+                                          midi_note_tracker_emit_t emit, void *ctx) {
+    uint32_t released = 0;
+
+    for (int dest = 0; dest < MIDI_TRANSPORT_COUNT; dest++) {
+        released += midi_note_tracker_release(tracker, source, dest, emit, ctx);
+    }
+
+    return released;
+}
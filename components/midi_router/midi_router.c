@@ -5,323 +5,3105 @@
 
 #include "midi_router.h"
 #include "midi_translator.h"
+#include "midi_defs.h"
+#include "midi_msg_class.h"
+#include "midi_coalescer.h"
+#include "midi_note_tracker.h"
+#include "midi_loop_guard.h"
+#include "midi_spsc.h"
+#include "midi_stats.h"
+#include "midi_config_blob.h"
+#include "midi_config_store.h"
+#include "esp_timer.h"
 #include "esp_log.h"
+#include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <stdio.h>
 #include <string.h>
 
 static const char *TAG = "midi_router";
 
-#define ROUTER_QUEUE_SIZE 64
 #define ROUTER_TASK_STACK_SIZE 4096
 #define ROUTER_TASK_PRIORITY 10
-#define ROUTER_TASK_CORE 1
+#define ROUTER_TASK_CORE 1        // Worker 0; worker n runs on (1 + n) % cores
+#define ROUTER_DEST_QUEUE_LEN CONFIG_MIDI_ROUTER_DEST_QUEUE_LEN
+#define ROUTER_CRITICAL_SEND_WAIT_MS CONFIG_MIDI_ROUTER_CRITICAL_SEND_WAIT_MS
+#define ROUTER_HANDOFF_WAIT_MS 20  // Max wait on another worker's full ring
+#define ROUTER_HANDOFF_BATCH 8     // Packets taken per ring between output drains
+#define ROUTER_TX_RETRY_TICKS 1
+#define ROUTER_EVENT_SEND_WAIT_MS 20
+#define ROUTER_DUP_WINDOW_MS CONFIG_MIDI_ROUTER_DUP_WINDOW_MS
+#define ROUTER_ECHO_WINDOW_MS CONFIG_MIDI_ROUTER_ECHO_WINDOW_MS
+#define ROUTER_MAX_HOPS CONFIG_MIDI_ROUTER_MAX_HOPS
+#define ROUTER_DEST_RT_LEN 8
+#define ROUTER_DEST_POOL_LEN (ROUTER_DEST_RT_LEN + 3 * ROUTER_DEST_QUEUE_LEN)
+#define ROUTER_STREAM_SLOTS 64     // Hashed (source, group, channel) streams per queue set
+#define ROUTER_INGRESS_SHARD(source) (MIDI_ROUTER_MAX_WORKERS + (source))
+#define ROUTER_INJECT_SHARD (MIDI_ROUTER_MAX_WORKERS + MIDI_TRANSPORT_COUNT)
+#define ROUTER_STATS_SHARDS (ROUTER_INJECT_SHARD + 1)
+#define ROUTER_WORKER_IDLE UINT32_MAX  // Quiescent state of a blocked worker
+#define ROUTER_CONFIG_NAME "config"
+#define ROUTER_PRESET_NAME "preset%u"
 
-// Router input queue (shared by all transports)
-QueueHandle_t router_input_queue = NULL;
+// Packed midi_router_preset_trigger_t (one word, read lock-free by workers)
+#define PRESET_TRIG_PC          0x01u
+#define PRESET_TRIG_SYSEX       0x02u
+#define PRESET_TRIG_CONSUME     0x04u
+#define PRESET_TRIG_CHANNEL(t)  (((t) >> 4) & 0x0F)
+#define PRESET_TRIG_GROUP(t)    (((t) >> 8) & 0x0F)
+#define PRESET_TRIG_SOURCES(t)  ((uint16_t)((t) >> 16))
+
+#define ROUTER_FORMAT_ANY 0xFF       // Translation target of an any-format transport
+#define ROUTER_FORMAT_UMP_MIDI1 0xFE  // Translation target of a MIDI 1.0 Protocol UMP link
+
+#if MIDI_ROUTER_PRESETS > 32
+#error "MIDI_ROUTER_PRESETS must not exceed 32 (valid slots are a 32-bit mask)"
+#endif
+
+#if MIDI_TRANSPORT_COUNT > 16 || MIDI_TRANSPORT_COUNT < MIDI_TRANSPORT_BUILTIN_COUNT
+#error "MIDI_ROUTER_MAX_TRANSPORTS must be 4-16 (routes are 16-bit masks)"
+#endif
+
+// Preset SysEx after F0: non-commercial ID, 'M', 'C', command 01, then preset number
+static const uint8_t preset_sysex_id[4] = { 0x7D, 'M', 'C', 0x01 };
+
+// Ingress queue depth per priority class
+static const uint8_t ingress_queue_len[MIDI_PRIO_COUNT] = { 16, 48, 48, 32 };
+
+// Weighted round robin shares below realtime (realtime is strict)
+static const uint8_t prio_weights[MIDI_PRIO_COUNT] = { 0, 8, 4, 1 };
+
+// Scheduling class per message class
+static const uint8_t class_priority[MIDI_CLASS_COUNT] = {
+    [MIDI_CLASS_NOTE_OFF]         = MIDI_PRIO_NOTE,
+    [MIDI_CLASS_NOTE_ON]          = MIDI_PRIO_NOTE,
+    [MIDI_CLASS_POLY_PRESSURE]    = MIDI_PRIO_CONTROL,
+    [MIDI_CLASS_CONTROL_CHANGE]   = MIDI_PRIO_CONTROL,
+    [MIDI_CLASS_PROGRAM_CHANGE]   = MIDI_PRIO_CONTROL,
+    [MIDI_CLASS_CHANNEL_PRESSURE] = MIDI_PRIO_CONTROL,
+    [MIDI_CLASS_PITCH_BEND]       = MIDI_PRIO_CONTROL,
+    [MIDI_CLASS_PER_NOTE]         = MIDI_PRIO_NOTE,
+    [MIDI_CLASS_PARAMETER]        = MIDI_PRIO_CONTROL,
+    [MIDI_CLASS_SYSEX]            = MIDI_PRIO_BULK,
+    [MIDI_CLASS_SYSTEM_COMMON]    = MIDI_PRIO_CONTROL,
+    [MIDI_CLASS_CLOCK]            = MIDI_PRIO_REALTIME,
+    [MIDI_CLASS_TRANSPORT]        = MIDI_PRIO_REALTIME,
+    [MIDI_CLASS_ACTIVE_SENSING]   = MIDI_PRIO_REALTIME,
+    [MIDI_CLASS_RESET]            = MIDI_PRIO_REALTIME,
+    [MIDI_CLASS_OTHER]            = MIDI_PRIO_BULK,
+};
 
 /**
- * @brief Router state
+ * @brief Bounded output ring for one priority class (router task only)
+ */
+typedef struct {
+    midi_router_packet_t *packets; /**< Slice of the destination's pool */
+    uint16_t capacity;
+    uint16_t head;                /**< Index of oldest packet */
+    uint16_t count;               /**< Packets queued */
+    uint8_t head_attempts;        /**< Busy retries spent on head packet */
+    TickType_t head_tick;         /**< Tick of the last retry counted */
+    bool head_partial;            /**< Head is a SysEx with slices already sent */
+} midi_dest_queue_t;
+
+/**
+ * @brief Per-destination output stage
+ */
+typedef struct {
+    midi_dest_queue_t classes[MIDI_PRIO_COUNT];
+    uint8_t credits[MIDI_PRIO_COUNT];            /**< Weighted round robin state */
+    uint8_t stream_class[ROUTER_STREAM_SLOTS];   /**< Ring holding each stream's queued packets */
+    uint16_t stream_queued[ROUTER_STREAM_SLOTS]; /**< Non-realtime packets queued per stream */
+    int64_t last_tx_us;                          /**< Last handed to the transport (Active Sensing) */
+    midi_router_packet_t pool[ROUTER_DEST_POOL_LEN];
+} midi_dest_t;
+
+/**
+ * @brief Input filter compiled for the fast path
+ */
+typedef struct {
+    bool enabled;
+    uint16_t class_pass;                         /**< Allowed classes */
+    uint16_t channel_pass[UMP_GROUPS_COUNT];     /**< Allowed channels per group */
+} midi_router_filter_fast_t;
+
+/**
+ * @brief Configuration as the workers read it
+ * 
+ * Never modified while published. Writers fill the spare view, publish
+ * it with one pointer store and reuse the old one only after every
+ * worker has passed a quiescent point.
  */
 typedef struct {
-    bool initialized;
     midi_router_config_t config;
+    uint16_t route_mask[MIDI_TRANSPORT_COUNT];        /**< Destinations per source (merge applied) */
+    midi_router_filter_fast_t filters[MIDI_TRANSPORT_COUNT];
+    midi_rule_table_t rules;
+    uint16_t group_mapped[MIDI_TRANSPORT_COUNT];      /**< Input groups remapped per source */
+    uint8_t group_to[MIDI_TRANSPORT_COUNT][UMP_GROUPS_COUNT];
+} midi_router_view_t;
+
+/**
+ * @brief Transport registration (kept across init/deinit)
+ * 
+ * Workers load ops once per use and call it with ctx. A driver is
+ * detached before ctx changes and only after every worker has passed a
+ * quiescent point, so ops and ctx never mismatch.
+ */
+typedef struct {
+    const midi_transport_ops_t *ops;  /**< Attached driver, NULL = none */
+    void *ctx;
+    midi_router_tx_callback_t legacy_tx; /**< Behind midi_router_register_transport_tx() */
+    midi_router_abort_callback_t legacy_abort; /**< Behind midi_router_register_transport_abort() */
+    uint8_t flags;                    /**< MIDI_TRANSPORT_FLAG_* (valid while attached) */
+    uint8_t target_format;            /**< Translate to this, or ROUTER_FORMAT_ANY (valid while attached) */
+    bool dynamic;                     /**< ID taken by midi_router_add_transport() */
+    ump_endpoint_link_t link;         /**< UMP Stream negotiation (written by the routing worker) */
+} midi_router_port_t;
+
+/**
+ * @brief Routing worker (one task, pinned to one core)
+ * 
+ * A worker routes the sources sharded to it and owns the output stage
+ * of the destinations assigned to it. Packets for destinations owned by
+ * another worker are handed over through an SPSC ring.
+ */
+typedef struct {
+    uint8_t index;
+    TaskHandle_t task;
+    
+    // Ingress queues, one per priority class
+    QueueHandle_t packet_queues[MIDI_PRIO_COUNT];
+    uint8_t ingress_credits[MIDI_PRIO_COUNT];
+    
+    uint32_t stream_ingress[ROUTER_STREAM_SLOTS]; /**< Class << 16 | packets queued, per stream */
+    uint32_t source_ingress[MIDI_TRANSPORT_COUNT]; /**< Non-realtime packets queued per source */
+    
+    // Duplicate detection for sources sharded here
+    midi_loop_guard_t ingress_seen;   /**< (source, seq, content) of accepted input */
+    
+    // Config generation seen at the last quiescent point, or ROUTER_WORKER_IDLE
+    uint32_t config_seen;
+    
+    int64_t sense_due_us;             /**< Next Active Sensing check of owned outputs */
+    bool handoff_blocked;             /**< Waiting for room in a full handoff ring */
+} midi_router_worker_t;
+
+/**
+ * @brief Statistics shard (one writer task, or writers holding inject_lock)
+ */
+typedef struct {
+    uint32_t generation;          /**< Epoch the counters belong to */
     midi_router_stats_t stats;
+} midi_router_stats_shard_t;
+
+/**
+ * @brief Router state
+ */
+typedef struct {
+    bool initialized;
+    
+    // Published configuration (RCU: lock-free for workers, one writer at a time)
+    midi_router_view_t views[2];
+    midi_router_view_t *active_view;
+    uint32_t config_generation;       /**< Bumped on every publish */
+    SemaphoreHandle_t config_mutex;   /**< Serializes writers */
+    
+    // Preset bank: precompiled views, recalled by publishing the pointer
+    midi_router_view_t presets[MIDI_ROUTER_PRESETS];
+    uint32_t preset_valid;            /**< Bit per stored preset */
+    int8_t active_preset;             /**< Preset the active view is, or -1 */
+    uint32_t preset_request;          /**< Preset + 1 triggered by a worker, 0 = none */
+    
+    // Worker layout and shard group, fixed from init to deinit (read by RX tasks)
+    uint8_t source_worker[MIDI_TRANSPORT_COUNT];
+    uint8_t dest_worker[MIDI_TRANSPORT_COUNT];
+    uint8_t shard_group;
     
-    // Message queue
-    QueueHandle_t packet_queue;
+    // Statistics: one shard per worker, one per source's RX task, then one
+    // shared by tasks injecting for a source (players), under inject_lock
+    midi_stats_epoch_t stats_epoch;
+    midi_router_stats_shard_t stats_shards[ROUTER_STATS_SHARDS];
+    portMUX_TYPE inject_lock;
+    uint32_t cc_thinned_base[MIDI_TRANSPORT_COUNT];   /**< Coalescer counts at last reset */
+    uint32_t cc_deferred_base[MIDI_TRANSPORT_COUNT];
     
-    // Router task
-    TaskHandle_t router_task_handle;
+    // Routing workers and the rings between them [from][to]
+    midi_router_worker_t workers[MIDI_ROUTER_MAX_WORKERS];
+    uint8_t num_workers;
+    midi_spsc_ring_t handoff[MIDI_ROUTER_MAX_WORKERS][MIDI_ROUTER_MAX_WORKERS];
     
-    // Transport callbacks (registered by transport layers)
-    esp_err_t (*transport_tx_callbacks[MIDI_TRANSPORT_COUNT])(const midi_router_packet_t *);
+    // Output queues
+    midi_dest_t dests[MIDI_TRANSPORT_COUNT];
+    
+    // Sounding notes per destination (each written by its owner only)
+    midi_note_tracker_t notes;
+    
+    // Output-side controller thinning (owned by transports, read for stats)
+    const midi_coalescer_t *coalescers[MIDI_TRANSPORT_COUNT];
+    
+    // Loop protection: written by output owners, read by every worker
+    midi_loop_guard_t egress_sent;    /**< Content sent to network outputs */
+    portMUX_TYPE egress_lock;
+    
+    midi_router_boot_timing_t boot_timing;
     
 } midi_router_state_t;
 
 static midi_router_state_t g_router_state = {0};
 
-// Transport name strings
-static const char *transport_names[] = {
-    "UART", "USB", "Ethernet", "WiFi"
+// Persistence backend and preset triggers (kept across init/deinit)
+static const midi_config_store_t *s_config_store;
+static uint32_t s_preset_trigger;     /**< PRESET_TRIG_* packed trigger settings */
+
+// Registered transports (kept across init/deinit, like the store)
+static midi_router_port_t s_ports[MIDI_TRANSPORT_COUNT];
+static uint16_t s_ports_attached;     /**< Bit per transport with a driver */
+static portMUX_TYPE s_ports_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// What UMP peers are told about this router
+static const ump_function_block_t default_blocks[] = {
+    {
+        .name = "MIDI-Cube",
+        .first_group = 0,
+        .num_groups = UMP_GROUPS_COUNT,
+        .direction = UMP_FB_DIR_BIDIRECTIONAL,
+        .midi1 = UMP_FB_MIDI1_NONE
+    }
+};
+
+static const ump_endpoint_t default_endpoint = {
+    .info = {
+        .ump_version_major = UMP_VERSION_MAJOR,
+        .ump_version_minor = UMP_VERSION_MINOR,
+        .num_function_blocks = 1,
+        .static_function_blocks = true,
+        .midi2_protocol = true,
+        .midi1_protocol = true
+    },
+    .protocol = UMP_STREAM_PROTOCOL_MIDI2,
+    .name = "MIDI-Cube",
+    .manufacturer = { 0x7D, 0x00, 0x00 },   // Non-commercial, as the preset SysEx
+    .blocks = default_blocks
+};
+
+static const ump_endpoint_t *s_endpoint = &default_endpoint;
+
+// Transport names when the driver gives none
+static const char *port_labels[16] = {
+    "UART", "USB", "Ethernet", "WiFi", "Port 4", "Port 5", "Port 6", "Port 7",
+    "Port 8", "Port 9", "Port 10", "Port 11", "Port 12", "Port 13", "Port 14", "Port 15"
 };
 
+/**
+ * @brief Worker that owns a destination's output stage
+ */
+static inline uint8_t midi_router_dest_owner(int dest) {
+    return g_router_state.dest_worker[dest] % g_router_state.num_workers;
+}
+
+/**
+ * @brief Current configuration (workers only, valid until their next quiescent point)
+ */
+static inline const midi_router_view_t *router_view(void) {
+    return __atomic_load_n(&g_router_state.active_view, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Statistics shard of a worker
+ */
+static inline midi_router_stats_t *worker_stats(const midi_router_worker_t *worker) {
+    return &g_router_state.stats_shards[worker->index].stats;
+}
+
+/**
+ * @brief Statistics shard of the worker that owns a destination
+ */
+static inline midi_router_stats_t *dest_stats(int dest) {
+    return &g_router_state.stats_shards[midi_router_dest_owner(dest)].stats;
+}
+
+/**
+ * @brief Bring a shard into the current reset epoch (shard owner, or under inject_lock)
+ */
+static inline midi_router_stats_t *midi_router_stats_sync(int shard_index) {
+    midi_router_stats_shard_t *shard = &g_router_state.stats_shards[shard_index];
+    midi_stats_shard_sync(&g_router_state.stats_epoch, &shard->generation,
+                          &shard->stats, sizeof(shard->stats));
+    return &shard->stats;
+}
+
 /**
  * @brief UART RX Callback
  * Called by UART driver when MIDI message received
  */
 void uart_rx_callback(const midi_message_t *msg, void *ctx) {
-    ESP_LOGI(TAG, "UART RX callback: Status=0x%02X, Ch=%d", msg->status, msg->channel);
-    if (!router_input_queue) {
-        ESP_LOGW(TAG, "Router input queue not initialized");
-        return;
-    }
-    // Create router packet
+    ESP_LOGD(TAG, "UART RX callback: Status=0x%02X, Ch=%d", msg->status, msg->channel);
+    
     midi_router_packet_t packet = {
         .source = MIDI_TRANSPORT_UART,
+        .destination = 0xFF,
         .format = MIDI_FORMAT_1_0,
         .data.midi1 = *msg
     };
-
-    // Send to router (non-blocking to avoid UART ISR delays)
-    if (xQueueSend(router_input_queue, &packet, 0) != pdTRUE) {
-        // Queue full - drop packet (log in debug mode)
+    
+    if (midi_router_send(&packet) != ESP_OK) {
         ESP_LOGD(TAG, "Router queue full, UART packet dropped");
     }
 }
 
+//=============================================================================
+// Overload Handling
+//=============================================================================
+
+bool midi_router_packet_is_critical(const midi_router_packet_t *packet) {
+    if (packet->format == MIDI_FORMAT_1_0) {
+        uint8_t status = packet->data.midi1.status;
+        uint8_t opcode = status & 0xF0;
+        return opcode == MIDI_STATUS_NOTE_OFF ||
+               (opcode == MIDI_STATUS_NOTE_ON && packet->data.midi1.data.bytes[1] == 0) ||
+               status >= 0xF8 ||                // System realtime
+               status == 0xF0 || status == 0xF7; // Complete SysEx carries its end
+    }
+    
+    uint32_t word0 = packet->data.ump.words[0];
+    switch (UMP_GET_MT(word0)) {
+        case UMP_MT_SYSTEM:
+            return UMP_GET_STATUS_BYTE(word0) >= 0xF8;
+        case UMP_MT_MIDI1_CHANNEL_VOICE:
+            return ((word0 >> 20) & 0x0F) == 0x8 ||
+                   (((word0 >> 20) & 0x0F) == 0x9 && (word0 & 0x7F) == 0);
+        case UMP_MT_MIDI2_CHANNEL_VOICE:
+            return ((word0 >> 20) & 0x0F) == 0x8;
+        case UMP_MT_DATA_64:
+        case UMP_MT_DATA_128: {
+            uint8_t form = (word0 >> 20) & 0x0F;
+            return form == UMP_FORMAT_COMPLETE || form == UMP_FORMAT_END;
+        }
+        default:
+            return false;
+    }
+}
+
+//=============================================================================
+// Priority Scheduling
+//=============================================================================
+
+midi_router_priority_t midi_router_packet_priority(const midi_router_packet_t *packet) {
+    midi_msg_class_t cls;
+    
+    if (packet->format == MIDI_FORMAT_EVENT) {
+        return MIDI_PRIO_NOTE;  // Held back until the source's queued packets are routed
+    }
+    if (packet->format == MIDI_FORMAT_1_0) {
+        cls = midi_msg_class_from_status(packet->data.midi1.status);
+    } else {
+        cls = midi_msg_class_from_ump(packet->data.ump.words[0]);
+    }
+    return (midi_router_priority_t)class_priority[cls];
+}
+
 /**
- * @brief Check if message passes filter
+ * @brief Stream key of a packet within its source: group * 17 + channel
+ * 
+ * Messages without a channel use 16, so one group's SysEx, system
+ * common and stream messages form one stream. MIDI 1.0 packets carry
+ * no group and use group_1_0.
  */
-static bool midi_router_check_filter(const midi_router_packet_t *packet, 
-                                      const midi_filter_t *filter) {
-    if (!filter->enabled) {
-        return true;  // Filter disabled, pass all
+static uint32_t midi_router_stream_key(const midi_router_packet_t *packet, uint8_t group_1_0) {
+    midi_msg_class_t cls;
+    uint8_t group, channel;
+    if (packet->format == MIDI_FORMAT_1_0) {
+        cls = midi_msg_class_from_status(packet->data.midi1.status);
+        group = group_1_0;
+        channel = packet->data.midi1.status & 0x0F;
+    } else {
+        uint32_t word0 = packet->data.ump.words[0];
+        uint8_t mt = UMP_GET_MT(word0);
+        cls = midi_msg_class_from_ump(word0);
+        // Groupless messages: bits 27-24 are form/status, not a stable key
+        group = (mt == UMP_MT_UTILITY || mt == UMP_MT_UMP_STREAM) ? 0 : UMP_GET_GROUP(word0);
+        channel = UMP_GET_CHANNEL(word0);
     }
     
-    // Extract channel (if applicable)
-    uint8_t channel = 0;
-    uint8_t status = 0;
+    return group * 17u + (midi_msg_class_has_channel(cls) ? channel : 16u);
+}
+
+uint16_t midi_router_packet_stream(const midi_router_packet_t *packet) {
+    return (uint16_t)midi_router_stream_key(packet, 0);
+}
+
+/**
+ * @brief Hashed (source, group, channel) stream of a packet
+ * 
+ * Streams that share a slot are kept in order together, which only
+ * costs them some priority. Taken again when a packet leaves a queue,
+ * so it depends on the packet alone: MIDI 1.0 goes by channel, not by
+ * the configured default group a publish may change meanwhile.
+ */
+static inline uint8_t midi_router_stream_slot(const midi_router_packet_t *packet) {
+    uint32_t stream = ((uint32_t)packet->source << 9) | midi_router_stream_key(packet, 0);
+    return (uint8_t)(((stream * 2654435761u) >> 24) % ROUTER_STREAM_SLOTS);
+}
+
+/**
+ * @brief Pick the next class to serve
+ * 
+ * Realtime strictly first. The others get weighted round robin: a
+ * class may take its weight in packets, then lower classes get a turn;
+ * credits refill once no waiting class has any left. Classes are
+ * queued per stream (see dest_queue_class()), so this never reorders
+ * one stream's packets.
+ * 
+ * @param waiting Bit per class with packets waiting
+ * @param credits Credit state (updated)
+ * @return Class to serve, or -1 if nothing is waiting
+ */
+static int prio_pick(uint8_t waiting, uint8_t credits[MIDI_PRIO_COUNT]) {
+    if (!waiting) {
+        return -1;
+    }
+    if (waiting & (1u << MIDI_PRIO_REALTIME)) {
+        return MIDI_PRIO_REALTIME;
+    }
     
-    if (packet->format == 0) {  // MIDI 1.0
-        status = packet->data.midi1.status;
-        channel = packet->data.midi1.channel;
-        
-        // Check channel filter
-        if (status < 0xF0) {  // Channel message
-            if (!(filter->channel_mask & (1 << channel))) {
-                return false;  // Channel blocked
+    for (int pass = 0; pass < 2; pass++) {
+        for (int c = MIDI_PRIO_NOTE; c < MIDI_PRIO_COUNT; c++) {
+            if ((waiting & (1u << c)) && credits[c]) {
+                credits[c]--;
+                return c;
             }
         }
-        
-        // Check specific filters
-        if (filter->block_active_sensing && status == 0xFE) {
-            return false;
+        for (int c = MIDI_PRIO_NOTE; c < MIDI_PRIO_COUNT; c++) {
+            credits[c] = prio_weights[c];
         }
-        if (filter->block_clock && status == 0xF8) {
-            return false;
+    }
+    return -1;
+}
+
+/**
+ * @brief Record delivery latency for a packet's class
+ * 
+ * Timestamps are local (esp_timer): a clock sync correction between
+ * ingress and TX would otherwise count as latency.
+ */
+static void midi_router_record_latency(midi_router_stats_t *stats,
+                                       const midi_router_packet_t *packet) {
+    midi_router_priority_t prio = midi_router_packet_priority(packet);
+    uint32_t latency = (uint32_t)esp_timer_get_time() - packet->timestamp_us;
+    
+    if (stats->class_packets[prio]++ == 0) {
+        stats->class_latency_avg_us[prio] = latency;
+    } else {
+        stats->class_latency_avg_us[prio] += ((int32_t)(latency - stats->class_latency_avg_us[prio])) / 8;
+    }
+    if (latency > stats->class_latency_max_us[prio]) {
+        stats->class_latency_max_us[prio] = latency;
+    }
+}
+
+/**
+ * @brief Point each class ring at its part of the destination pool
+ */
+static void dest_queues_init(void) {
+    for (int dest = 0; dest < MIDI_TRANSPORT_COUNT; dest++) {
+        midi_dest_t *d = &g_router_state.dests[dest];
+        uint16_t offset = 0;
+        
+        memset(d->classes, 0, sizeof(d->classes));
+        memset(d->stream_queued, 0, sizeof(d->stream_queued));
+        for (int c = 0; c < MIDI_PRIO_COUNT; c++) {
+            uint16_t capacity = (c == MIDI_PRIO_REALTIME) ? ROUTER_DEST_RT_LEN
+                                                          : ROUTER_DEST_QUEUE_LEN;
+            d->classes[c].packets = &d->pool[offset];
+            d->classes[c].capacity = capacity;
+            d->credits[c] = prio_weights[c];
+            offset += capacity;
         }
     }
+}
+
+/**
+ * @brief Class ring a packet joins at a destination
+ * 
+ * One stream's queued packets all wait in one ring, so they leave in
+ * the order they came: a packet takes its own class's ring while none
+ * of its stream is queued, else the ring the stream is already in.
+ * Only realtime goes to its own ring regardless and may overtake.
+ */
+static int dest_queue_class(const midi_dest_t *d, const midi_router_packet_t *packet,
+                            uint8_t slot) {
+    midi_router_priority_t prio = midi_router_packet_priority(packet);
     
-    return true;  // Passed all filters
+    if (prio == MIDI_PRIO_REALTIME || !d->stream_queued[slot]) {
+        return prio;
+    }
+    return d->stream_class[slot];
+}
+
+/**
+ * @brief Account for a packet leaving its ring
+ */
+static inline void dest_stream_release(midi_dest_t *d, const midi_router_packet_t *packet) {
+    if (midi_router_packet_priority(packet) != MIDI_PRIO_REALTIME) {
+        d->stream_queued[midi_router_stream_slot(packet)]--;
+    }
+}
+
+/**
+ * @brief Remove the packet at logical position pos (0 = oldest)
+ */
+static void dest_queue_remove_at(midi_dest_t *d, midi_dest_queue_t *q, uint16_t pos) {
+    dest_stream_release(d, &q->packets[(q->head + pos) % q->capacity]);
+    for (uint16_t i = pos; i + 1 < q->count; i++) {
+        q->packets[(q->head + i) % q->capacity] =
+            q->packets[(q->head + i + 1) % q->capacity];
+    }
+    q->count--;
+    if (pos == 0) {
+        q->head_attempts = 0;
+        q->head_partial = false;
+    }
+}
+
+/**
+ * @brief Drop the head packet after it was sent or given up on
+ */
+static void dest_queue_pop(midi_dest_t *d, midi_dest_queue_t *q) {
+    dest_stream_release(d, &q->packets[q->head]);
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    q->head_attempts = 0;
+    q->head_partial = false;
 }
 
 /**
- * @brief Translate packet if needed
+ * @brief Give up on the head packet without sending (rest of) it
+ * 
+ * A SysEx with slices already out is abandoned at the transport too, so
+ * the next one does not resume mid-message.
  */
-static esp_err_t midi_router_translate(midi_router_packet_t *packet, 
-                                        bool dest_wants_ump) {
-    if (!g_router_state.config.auto_translate) {
-        return ESP_OK;  // Translation disabled
+static void dest_queue_discard(midi_dest_t *d, midi_dest_queue_t *q,
+                               const midi_transport_ops_t *ops, void *ctx) {
+    if (q->head_partial && ops && ops->abort) {
+        ops->abort(ctx);
     }
+    dest_queue_pop(d, q);
+}
+
+/**
+ * @brief Queue a packet for a destination, applying its overload policy
+ */
+static void dest_queue_push(midi_transport_t dest, const midi_router_packet_t *packet) {
+    midi_dest_t *d = &g_router_state.dests[dest];
+    uint8_t slot = midi_router_stream_slot(packet);
+    int c = dest_queue_class(d, packet, slot);
+    midi_dest_queue_t *q = &d->classes[c];
+    const midi_dest_policy_t *policy = &router_view()->config.dest_policies[dest];
+    midi_router_stats_t *stats = dest_stats(dest);
     
-    bool src_is_midi1 = (packet->format == 0);
+    // Replace a still-queued older value of the same controller from the
+    // same source, unless a message of the stream that cannot be merged
+    // (note, program, Bank Select...) came in between
+    if (policy->coalesce && q->count) {
+        uint32_t key = midi_coalescer_key(packet);
+        if (key) {
+            // Skip head if a TX attempt is in flight for it
+            uint16_t first = (q->head_attempts || q->head_partial) ? 1 : 0;
+            for (int i = q->count - 1; i >= first; i--) {
+                midi_router_packet_t *queued = &q->packets[(q->head + i) % q->capacity];
+                if (queued->source != packet->source) {
+                    continue;
+                }
+                uint32_t queued_key = midi_coalescer_key(queued);
+                if (queued_key == key) {
+                    *queued = *packet;
+                    stats->packets_coalesced[dest]++;
+                    return;
+                }
+                if (!queued_key && midi_router_stream_slot(queued) == slot) {
+                    break;
+                }
+            }
+        }
+    }
     
-    if (src_is_midi1 && dest_wants_ump) {
-        // MIDI 1.0 → UMP
-        ump_packet_t ump;
-        esp_err_t err = midi_translate_1to2(&packet->data.midi1, &ump);
-        if (err == ESP_OK) {
-            packet->format = 1;
-            packet->data.ump = ump;
-            g_router_state.stats.translations_1to2++;
+    if (q->count == q->capacity) {
+        bool incoming_critical = policy->protect_critical && midi_router_packet_is_critical(packet);
+        
+        if (policy->drop_mode == MIDI_DROP_NEWEST && !incoming_critical) {
+            stats->packets_shed[dest]++;
+            return;
         }
-        return err;
-    } else if (!src_is_midi1 && !dest_wants_ump) {
-        // UMP → MIDI 1.0
-        midi_message_t midi1;
-        esp_err_t err = midi_translate_2to1(&packet->data.ump, &midi1);
-        if (err == ESP_OK) {
-            packet->format = 0;
-            packet->data.midi1 = midi1;
-            g_router_state.stats.translations_2to1++;
+        
+        // Evict oldest packet that may be shed (never a half-sent head)
+        int victim = -1;
+        for (uint16_t i = q->head_partial ? 1 : 0; i < q->count; i++) {
+            const midi_router_packet_t *queued = &q->packets[(q->head + i) % q->capacity];
+            if (!policy->protect_critical || !midi_router_packet_is_critical(queued)) {
+                victim = i;
+                break;
+            }
         }
-        return err;
+        
+        if (victim < 0) {
+            // Queue holds only critical packets: the newest one loses
+            if (incoming_critical) {
+                stats->critical_dropped[dest]++;
+            } else {
+                stats->packets_shed[dest]++;
+            }
+            return;
+        }
+        
+        dest_queue_remove_at(d, q, (uint16_t)victim);
+        stats->packets_shed[dest]++;
+    }
+    
+    q->packets[(q->head + q->count) % q->capacity] = *packet;
+    q->count++;
+    if (c != MIDI_PRIO_REALTIME) {
+        d->stream_class[slot] = c;
+        d->stream_queued[slot]++;
     }
     
-    return ESP_OK;  // No translation needed
+    uint16_t depth = 0;
+    for (int c = 0; c < MIDI_PRIO_COUNT; c++) {
+        depth += d->classes[c].count;
+    }
+    if (depth > stats->queue_high_water[dest]) {
+        stats->queue_high_water[dest] = depth;
+    }
 }
 
 /**
- * @brief Router task - processes incoming packets
+ * @brief Number of packets to offer a transport in one call
+ * 
+ * A batch is a contiguous run of the class ring within the class's
+ * round robin share; never while a SysEx is half sent. Limited by what
+ * the transport says it has room for (0 = busy).
  */
-static void midi_router_task(void *arg) {
-    midi_router_packet_t packet;
+static size_t dest_tx_run(const midi_dest_t *d, const midi_dest_queue_t *q, int c,
+                          const midi_transport_ops_t *ops, void *ctx) {
+    size_t run = 1;
     
-    ESP_LOGI(TAG, "Router task started on core %d", xPortGetCoreID());
+    if (ops->send_batch && !q->head_partial) {
+        run = q->count;
+        if (run > (size_t)(q->capacity - q->head)) {
+            run = q->capacity - q->head;
+        }
+        if (c != MIDI_PRIO_REALTIME && run > 1u + d->credits[c]) {
+            run = 1u + d->credits[c];   // prio_pick took the first credit
+        }
+    }
+    if (ops->tx_capacity) {
+        size_t room = ops->tx_capacity(ctx);
+        if (room < run) {
+            run = room;
+        }
+    }
+    return run;
+}
+
+/**
+ * @brief Hand queued packets to transports until empty or busy
+ * 
+ * Each destination serves its class rings by priority. While a SysEx
+ * is half sent only realtime may go out between its slices, since any
+ * other status byte would end the SysEx on a MIDI 1.0 wire. The SysEx
+ * is usually in the bulk ring, but may wait in another ring behind its
+ * stream's system common messages.
+ * 
+ * @return true if any destination still has packets waiting
+ */
+static bool dest_queues_drain(const midi_router_worker_t *worker) {
+    midi_router_stats_t *stats = worker_stats(worker);
+    bool pending = false;
     
-    while (1) {
-        // Wait for packet
-        if (xQueueReceive(g_router_state.packet_queue, &packet, 
-                         portMAX_DELAY) != pdTRUE) {
+    for (int dest = 0; dest < MIDI_TRANSPORT_COUNT; dest++) {
+        if (midi_router_dest_owner(dest) != worker->index) {
             continue;
         }
         
-        midi_transport_t src = packet.source;
-        
-        // Apply input filter
-        if (!midi_router_check_filter(&packet, 
-                                      &g_router_state.config.input_filters[src])) {
-            g_router_state.stats.packets_filtered[src]++;
-            continue;  // Filtered out
+        midi_dest_t *d = &g_router_state.dests[dest];
+        uint16_t queued = 0;
+        for (int c = 0; c < MIDI_PRIO_COUNT; c++) {
+            queued += d->classes[c].count;
+        }
+        if (!queued) {
+            continue;
         }
         
-        // Determine destinations
-        bool merge_mode = g_router_state.config.merge_inputs;
+        midi_router_port_t *port = &s_ports[dest];
+        const midi_transport_ops_t *ops = __atomic_load_n(&port->ops, __ATOMIC_ACQUIRE);
+        void *ctx = port->ctx;
+        bool connected = ops && (!ops->link_up || ops->link_up(ctx));
+        bool sent_any = false;
+        const midi_dest_policy_t *policy = &router_view()->config.dest_policies[dest];
         
-        for (int dest = 0; dest < MIDI_TRANSPORT_COUNT; dest++) {
-            // Check if route enabled
-            bool route_enabled = merge_mode || 
-                                g_router_state.config.routing_matrix[src][dest];
+        while (1) {
+            uint8_t waiting = 0;
+            for (int c = 0; c < MIDI_PRIO_COUNT; c++) {
+                if (d->classes[c].count) {
+                    waiting |= 1u << c;
+                }
+            }
+            for (int c = MIDI_PRIO_NOTE; c < MIDI_PRIO_COUNT; c++) {
+                if (d->classes[c].head_partial) {
+                    waiting &= (1u << MIDI_PRIO_REALTIME) | (1u << c);
+                }
+            }
             
-            if (!route_enabled) {
-                continue;  // Route blocked
+            int c = prio_pick(waiting, d->credits);
+            if (c < 0) {
+                break;
             }
             
-            // Don't route back to source (avoid loops)
-            if (dest == src) {
+            midi_dest_queue_t *q = &d->classes[c];
+            
+            if (!connected) {
+                ESP_LOGD(TAG, "%s not connected", midi_router_get_transport_name(dest));
+                stats->packets_dropped[dest]++;
+                dest_queue_discard(d, q, ops, ctx);
                 continue;
             }
             
-            // Translate if destination requires different format
-            midi_router_packet_t out_packet = packet;
-            bool dest_wants_ump = (dest == MIDI_TRANSPORT_ETHERNET || 
-                                   dest == MIDI_TRANSPORT_WIFI ||
-                                   dest == MIDI_TRANSPORT_USB);  // USB can do both
+            size_t run = dest_tx_run(d, q, c, ops, ctx);
+            size_t sent = 0;
+            esp_err_t err;
+            if (run == 0) {
+                err = ESP_ERR_NO_MEM;   // No room: same as a busy send
+            } else if (run == 1) {
+                err = ops->send(ctx, &q->packets[q->head]);
+            } else {
+                err = ops->send_batch(ctx, &q->packets[q->head], run, &sent);
+            }
+            if (run && (err == ESP_OK || sent >= run)) {
+                sent = run;
+                err = ESP_OK;
+            }
+            if (c != MIDI_PRIO_REALTIME && sent > 1) {
+                d->credits[c] -= sent - 1;
+            }
             
-            esp_err_t err = midi_router_translate(&out_packet, dest_wants_ump);
-            if (err != ESP_OK) {
-                ESP_LOGW(TAG, "Translation failed: %s → %s",
-                         transport_names[src], transport_names[dest]);
-                g_router_state.stats.routing_errors++;
+            for (size_t i = 0; i < sent; i++) {
+                const midi_router_packet_t *packet = &q->packets[q->head];
+                stats->packets_routed[packet->source][dest]++;
+                midi_router_record_latency(stats, packet);
+                dest_queue_pop(d, q);
+            }
+            sent_any |= sent > 0;
+            if (err == ESP_OK) {
                 continue;
             }
             
-            // Send to transport TX callback
-            if (g_router_state.transport_tx_callbacks[dest]) {
-                err = g_router_state.transport_tx_callbacks[dest](&out_packet);
-                if (err == ESP_OK) {
-                    g_router_state.stats.packets_routed[src][dest]++;
-                } else {
-                    g_router_state.stats.packets_dropped[dest]++;
-                    ESP_LOGW(TAG, "TX failed: %s", transport_names[dest]);
+            if (err == ESP_ERR_NOT_FINISHED) {
+                // One SysEx slice out: give realtime a chance, then continue
+                q->head_partial = true;
+                q->head_attempts = 0;
+                sent_any = true;
+                continue;
+            }
+            if ((err == ESP_ERR_TIMEOUT || err == ESP_ERR_NO_MEM) &&
+                (q->head_partial || q->head_attempts < policy->max_tx_retries)) {
+                // Busy: keep packet at head, retry on next pass. Passes also
+                // run for every packet routed, so one retry is counted per
+                // tick, else a burst would use them all up at once. A sliced
+                // SysEx is making progress, so its waits are not counted.
+                TickType_t tick = xTaskGetTickCount();
+                if (!q->head_partial && (!q->head_attempts || tick != q->head_tick)) {
+                    q->head_attempts++;
+                    q->head_tick = tick;
                 }
-            } else {
-                ESP_LOGD(TAG, "No TX callback for %s", transport_names[dest]);
+                stats->tx_retries[dest]++;
+                pending = true;
+                break;
+            }
+            
+            stats->packets_dropped[dest]++;
+            ESP_LOGW(TAG, "TX failed: %s", midi_router_get_transport_name(dest));
+            dest_queue_discard(d, q, ops, ctx);
+        }
+        
+        if (sent_any) {
+            d->last_tx_us = esp_timer_get_time();
+            if (ops->flush) {
+                ops->flush(ctx);
             }
         }
     }
+    
+    return pending;
 }
 
 /**
- * @brief Initialize router
+ * @brief Compile a filter into its fast-path form
  */
-esp_err_t midi_router_init(const midi_router_config_t *config) {
-    if (g_router_state.initialized) {
-        ESP_LOGW(TAG, "Router already initialized");
-        return ESP_ERR_INVALID_STATE;
-    }
-    
-    ESP_LOGI(TAG, "Initializing MIDI router");
+static void midi_router_compile_filter(const midi_filter_t *filter,
+                                       midi_router_filter_fast_t *fast) {
+    memset(fast, 0, sizeof(*fast));
+    fast->enabled = filter->enabled;
     
-    // Clear state
-    memset(&g_router_state, 0, sizeof(g_router_state));
-    
-    // Load or use provided config
-    if (config) {
-        g_router_state.config = *config;
-    } else {
-        esp_err_t err = midi_router_load_config();
-        if (err != ESP_OK) {
-            ESP_LOGI(TAG, "No saved config, using defaults");
-            midi_router_reset_config();
-        }
+    uint16_t blocked = filter->class_block_mask;
+    if (filter->block_active_sensing) {
+        blocked |= 1u << MIDI_CLASS_ACTIVE_SENSING;
     }
-    
-    // Create packet queue
-    g_router_state.packet_queue = xQueueCreate(ROUTER_QUEUE_SIZE, 
-                                                sizeof(midi_router_packet_t));
-    if (!g_router_state.packet_queue) {
-        ESP_LOGE(TAG, "Failed to create packet queue");
-        return ESP_FAIL;
+    if (filter->block_clock) {
+        blocked |= 1u << MIDI_CLASS_CLOCK;
     }
     
-    // Create router task
-    BaseType_t task_created = xTaskCreatePinnedToCore(
-        midi_router_task,
-        "midi_router",
-        ROUTER_TASK_STACK_SIZE,
-        NULL,
-        ROUTER_TASK_PRIORITY,
-        &g_router_state.router_task_handle,
-        ROUTER_TASK_CORE
-    );
-    
-    if (task_created != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create router task");
-        vQueueDelete(g_router_state.packet_queue);
-        return ESP_FAIL;
+    // Legacy message type mask: fold into classes
+    if (filter->msg_type_mask) {
+        if (!(filter->msg_type_mask & (1u << MIDI_MSG_TYPE_CHANNEL))) {
+            blocked |= MIDI_CLASS_MASK_CHANNEL;
+        }
+        if (!(filter->msg_type_mask & (1u << MIDI_MSG_TYPE_SYSTEM_COMMON))) {
+            blocked |= 1u << MIDI_CLASS_SYSTEM_COMMON;
+        }
+        if (!(filter->msg_type_mask & (1u << MIDI_MSG_TYPE_SYSTEM_REALTIME))) {
+            blocked |= (1u << MIDI_CLASS_CLOCK) | (1u << MIDI_CLASS_TRANSPORT) |
+                       (1u << MIDI_CLASS_ACTIVE_SENSING) | (1u << MIDI_CLASS_RESET);
+        }
+        if (!(filter->msg_type_mask & (1u << MIDI_MSG_TYPE_SYSTEM_EXCLUSIVE))) {
+            blocked |= 1u << MIDI_CLASS_SYSEX;
+        }
     }
+    fast->class_pass = (uint16_t)~blocked;
     
-    g_router_state.initialized = true;
-    ESP_LOGI(TAG, "MIDI router initialized");
+    for (int g = 0; g < UMP_GROUPS_COUNT; g++) {
+        fast->channel_pass[g] = filter->per_group_channels ? filter->group_channel_mask[g]
+                                                           : filter->channel_mask;
+    }
+}
+
+/**
+ * @brief Derive a view's lookup tables from its config
+ * 
+ * @return ESP_OK, or the rule compiler's error
+ */
+static esp_err_t midi_router_view_compile(midi_router_view_t *view) {
+    const midi_router_config_t *config = &view->config;
     
-    // Print routing matrix
-    ESP_LOGI(TAG, "Routing matrix:");
     for (int src = 0; src < MIDI_TRANSPORT_COUNT; src++) {
-        ESP_LOGI(TAG, "  %s →", transport_names[src]);
+        uint16_t mask = 0;
         for (int dest = 0; dest < MIDI_TRANSPORT_COUNT; dest++) {
-            if (g_router_state.config.routing_matrix[src][dest]) {
-                ESP_LOGI(TAG, "    ✓ %s", transport_names[dest]);
+            // Never back to the source, even in merge mode
+            if (dest != src && (config->merge_inputs || config->routing_matrix[src][dest])) {
+                mask |= 1u << dest;
             }
         }
+        view->route_mask[src] = mask;
     }
     
-    return ESP_OK;
-}
+    for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+        midi_router_compile_filter(&config->input_filters[t], &view->filters[t]);
+        
+        view->group_mapped[t] = 0;
+        for (int g = 0; g < UMP_GROUPS_COUNT; g++) {
+            uint8_t to = config->group_map[t][g] ? (config->group_map[t][g] - 1) & 0x0F : g;
+            view->group_to[t][g] = to;
+            if (to != g) {
+                view->group_mapped[t] |= 1u << g;
+            }
+        }
+    }
+    
+    return midi_rules_compile(config->rules, config->num_rules, &view->rules);
+}
+
+/**
+ * @brief Check if message passes filter
+ * 
+ * One table lookup for the class, then at most two mask tests.
+ */
+static bool midi_router_check_filter(const midi_router_view_t *view,
+                                     const midi_router_packet_t *packet,
+                                     const midi_router_filter_fast_t *filter) {
+    if (!filter->enabled) {
+        return true;  // Filter disabled, pass all
+    }
+    
+    midi_msg_class_t cls;
+    uint8_t group;
+    uint8_t channel;
+    
+    if (packet->format == MIDI_FORMAT_1_0) {
+        uint8_t status = packet->data.midi1.status;
+        cls = midi_msg_class_from_status(status);
+        group = view->config.default_group & 0x0F;
+        channel = status & 0x0F;
+    } else {
+        uint32_t word0 = packet->data.ump.words[0];
+        cls = midi_msg_class_from_ump(word0);
+        group = UMP_GET_GROUP(word0);
+        channel = UMP_GET_CHANNEL(word0);
+    }
+    
+    if (!(filter->class_pass & (1u << cls))) {
+        return false;  // Class blocked
+    }
+    if (midi_msg_class_has_channel(cls) &&
+        !(filter->channel_pass[group] & (1u << channel))) {
+        return false;  // Channel blocked in this group
+    }
+    
+    return true;  // Passed all filters
+}
+
+/**
+ * @brief Apply compiled rules to an outgoing packet
+ * 
+ * @return true to forward, false if a rule dropped the packet
+ */
+static bool midi_router_apply_rules(const midi_router_view_t *view,
+                                    midi_router_packet_t *packet,
+                                    midi_transport_t dest) {
+    if (packet->format == MIDI_FORMAT_1_0) {
+        return midi_rules_apply_midi1(&view->rules, packet->source, dest,
+                                      view->config.default_group,
+                                      &packet->data.midi1);
+    }
+    return midi_rules_apply_ump(&view->rules, packet->source, dest, &packet->data.ump);
+}
+
+/**
+ * @brief Apply the source's group map to an outgoing UMP
+ */
+static inline void midi_router_map_group(const midi_router_view_t *view,
+                                         midi_transport_t src,
+                                         midi_router_packet_t *packet) {
+    if (packet->format != MIDI_FORMAT_2_0 || !view->group_mapped[src]) {
+        return;
+    }
+    
+    uint32_t word0 = packet->data.ump.words[0];
+    uint8_t mt = UMP_GET_MT(word0);
+    if (mt == UMP_MT_UTILITY || mt == UMP_MT_UMP_STREAM) {
+        return;  // Groupless
+    }
+    
+    uint8_t group = UMP_GET_GROUP(word0);
+    if (view->group_mapped[src] & (1u << group)) {
+        packet->data.ump.words[0] = (word0 & ~0x0F000000u) |
+                                    ((uint32_t)view->group_to[src][group] << 24);
+    }
+}
+
+/**
+ * @brief What a destination is sent: its target format, narrowed to MT 0x2
+ * once its UMP link has settled on the MIDI 1.0 Protocol
+ */
+static inline uint8_t midi_router_dest_format(midi_transport_t dest) {
+    const midi_router_port_t *port = &s_ports[dest];
+    
+    if (port->target_format == MIDI_FORMAT_2_0 &&
+        port->link.protocol == UMP_STREAM_PROTOCOL_MIDI1) {
+        return ROUTER_FORMAT_UMP_MIDI1;
+    }
+    return port->target_format;
+}
+
+/**
+ * @brief Translate packet to a destination's format if needed
+ * 
+ * Picks the cheapest plan: pass-through when the forms already match,
+ * MT 0x2 wrapping (no scaling) for MIDI 1.0 Protocol links, and full
+ * MT 0x4 upscaling only for MIDI 2.0 Protocol links.
+ * 
+ * @param target_format From midi_router_dest_format()
+ */
+static esp_err_t midi_router_translate(const midi_router_view_t *view,
+                                        midi_router_stats_t *stats,
+                                        midi_router_packet_t *packet,
+                                        uint8_t target_format) {
+    if (!view->config.auto_translate || target_format == ROUTER_FORMAT_ANY) {
+        return ESP_OK;  // Translation disabled, or destination takes both
+    }
+    
+    bool src_is_midi1 = (packet->format == MIDI_FORMAT_1_0);
+    bool wants_mt2 = (target_format == ROUTER_FORMAT_UMP_MIDI1);
+    esp_err_t err;
+    
+    if (target_format == MIDI_FORMAT_1_0) {
+        if (src_is_midi1) {
+            return ESP_OK;
+        }
+        // UMP → MIDI 1.0
+        midi_message_t midi1;
+        err = midi_translate_2to1(&packet->data.ump, &midi1);
+        if (err == ESP_OK) {
+            packet->format = MIDI_FORMAT_1_0;
+            packet->data.midi1 = midi1;
+            stats->translations_2to1++;
+        }
+        return err;
+    }
+    
+    if (src_is_midi1) {
+        // MIDI 1.0 → UMP in the link's protocol
+        ump_packet_t ump;
+        err = wants_mt2 ? midi_translate_1to_ump1(&packet->data.midi1, &ump)
+                        : midi_translate_1to2(&packet->data.midi1, &ump);
+        if (err == ESP_OK) {
+            packet->format = MIDI_FORMAT_2_0;
+            packet->data.ump = ump;
+            if (wants_mt2) {
+                stats->translations_1to1++;
+            } else {
+                stats->translations_1to2++;
+            }
+        }
+        return err;
+    }
+    
+    // UMP → UMP: only channel voice in the other protocol's form changes
+    uint8_t mt = packet->data.ump.message_type;
+    if ((mt != UMP_MT_MIDI1_CHANNEL_VOICE && mt != UMP_MT_MIDI2_CHANNEL_VOICE) ||
+        (mt == UMP_MT_MIDI1_CHANNEL_VOICE) == wants_mt2) {
+        return ESP_OK;
+    }
+    
+    midi_message_t midi1;
+    ump_packet_t ump;
+    uint32_t group = UMP_GET_GROUP(packet->data.ump.words[0]);
+    err = midi_translate_2to1(&packet->data.ump, &midi1);
+    if (err == ESP_OK) {
+        err = wants_mt2 ? midi_translate_1to_ump1(&midi1, &ump)
+                        : midi_translate_1to2(&midi1, &ump);
+    }
+    if (err == ESP_OK) {
+        ump.words[0] |= group << 24;
+        ump.group = (uint8_t)group;
+        packet->data.ump = ump;
+        if (wants_mt2) {
+            stats->translations_2to1++;
+        } else {
+            stats->translations_1to2++;
+        }
+    }
+    return err;
+}
+
+/**
+ * @brief Queue a tracker-generated Note Off
+ */
+static void midi_router_emit_note_off(midi_transport_t dest,
+                                      const midi_router_packet_t *note_off,
+                                      void *ctx) {
+    midi_router_packet_t stamped = *note_off;
+    stamped.timestamp_us = (uint32_t)esp_timer_get_time();
+    dest_queue_push(dest, &stamped);
+    dest_stats(dest)->notes_released[dest]++;
+}
+
+//=============================================================================
+// Loop Protection
+//=============================================================================
+
+static inline bool midi_router_is_network(midi_transport_t transport) {
+    if (__atomic_load_n(&s_ports_attached, __ATOMIC_RELAXED) & (1u << transport)) {
+        return s_ports[transport].flags & MIDI_TRANSPORT_FLAG_NETWORK;
+    }
+    return transport == MIDI_TRANSPORT_ETHERNET || transport == MIDI_TRANSPORT_WIFI;
+}
+
+/**
+ * @brief Decide whether an input packet is looped or duplicated traffic
+ * 
+ * Three checks, cheapest first: the hop count MIDI-Cube peers send in
+ * front of forwarded messages (hop marker, midi_net.h), the (source,
+ * seq, content) fingerprint of a datagram received twice, and the
+ * content fingerprint of something we sent to a network output within
+ * the window coming back in (a bridge we cannot see). Critical
+ * packets skip the echo check: a second player's Note Off is identical
+ * to ours, and dropping it would leave a hung note, while a looped Note
+ * Off is harmless and the hop limit still ends the loop.
+ * 
+ * @return true if the packet must be dropped
+ */
+static bool midi_router_loop_check(midi_router_worker_t *worker,
+                                   const midi_router_packet_t *packet, int64_t now_us) {
+    midi_router_stats_t *stats = worker_stats(worker);
+    midi_transport_t src = packet->source;
+    
+    if (packet->hops >= ROUTER_MAX_HOPS) {
+        stats->loops_dropped[src]++;
+        return true;
+    }
+    
+    if (!midi_router_is_network(src)) {
+        return false;
+    }
+    
+    // Duplicates have the same shard key, so they reach the same worker
+    if (packet->seq &&
+        midi_loop_guard_check_insert(&worker->ingress_seen,
+                                     midi_loop_guard_ingress_hash(packet), now_us)) {
+        stats->duplicates_dropped[src]++;
+        return true;
+    }
+    
+    // Realtime repeats by design (clock ticks are identical), and a Note
+    // Off may come from another player; rely on hops for those
+    if (!midi_router_packet_is_critical(packet)) {
+        uint32_t fingerprint = midi_loop_guard_content_hash(packet);
+        portENTER_CRITICAL(&g_router_state.egress_lock);
+        bool echo = midi_loop_guard_contains(&g_router_state.egress_sent, fingerprint, now_us);
+        portEXIT_CRITICAL(&g_router_state.egress_lock);
+        if (echo) {
+            stats->loops_dropped[src]++;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+//=============================================================================
+// Configuration Publishing
+//=============================================================================
+
+/**
+ * @brief Make a view the active one (config lock held)
+ */
+static void midi_router_view_publish(midi_router_view_t *view) {
+    __atomic_store_n(&g_router_state.active_view, view, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&g_router_state.config_generation, 1, __ATOMIC_SEQ_CST);
+    g_router_state.shard_group = view->config.default_group & 0x0F;
+    
+    bool is_preset = view >= &g_router_state.presets[0] &&
+                     view < &g_router_state.presets[MIDI_ROUTER_PRESETS];
+    g_router_state.active_preset = is_preset ? (int8_t)(view - g_router_state.presets) : -1;
+}
+
+/**
+ * @brief Wait until no worker uses a view that is no longer active (config lock held)
+ * 
+ * Each worker has either passed a quiescent point since the last
+ * publish or is blocked. Usually immediate; at most a packet's routing.
+ */
+static void midi_router_config_synchronize(void) {
+    uint32_t generation = __atomic_load_n(&g_router_state.config_generation, __ATOMIC_SEQ_CST);
+    
+    for (int w = 0; w < g_router_state.num_workers; w++) {
+        while (1) {
+            uint32_t seen = __atomic_load_n(&g_router_state.workers[w].config_seen,
+                                            __ATOMIC_SEQ_CST);
+            if (seen == ROUTER_WORKER_IDLE || (int32_t)(seen - generation) >= 0) {
+                break;
+            }
+            vTaskDelay(1);
+        }
+    }
+}
+
+/**
+ * @brief The double-buffer view that is not active (free after synchronize)
+ */
+static midi_router_view_t *midi_router_spare_view(void) {
+    return (g_router_state.active_view == &g_router_state.views[0]) ? &g_router_state.views[1]
+                                                                    : &g_router_state.views[0];
+}
+
+/**
+ * @brief Release the config lock, applying preset switches triggered meanwhile
+ * 
+ * A worker never blocks on the lock: if it is taken, the worker leaves
+ * its request and the holder applies it here.
+ */
+static void midi_router_config_unlock(void) {
+    while (1) {
+        uint32_t request = __atomic_exchange_n(&g_router_state.preset_request, 0,
+                                               __ATOMIC_SEQ_CST);
+        if (request && (g_router_state.preset_valid & (1u << (request - 1)))) {
+            midi_router_view_publish(&g_router_state.presets[request - 1]);
+        }
+        xSemaphoreGive(g_router_state.config_mutex);
+        
+        // A request that arrived after the exchange: its worker may have
+        // failed to take the lock from us
+        if (!__atomic_load_n(&g_router_state.preset_request, __ATOMIC_SEQ_CST) ||
+            xSemaphoreTake(g_router_state.config_mutex, 0) != pdTRUE) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Switch preset from a worker (never blocks)
+ */
+static void midi_router_preset_request(uint8_t index) {
+    if (index >= MIDI_ROUTER_PRESETS) {
+        return;
+    }
+    
+    __atomic_store_n(&g_router_state.preset_request, index + 1u, __ATOMIC_SEQ_CST);
+    if (xSemaphoreTake(g_router_state.config_mutex, 0) == pdTRUE) {
+        midi_router_config_unlock();
+    }
+}
+
+/**
+ * @brief Check whether a packet is a preset trigger
+ * 
+ * @param packet Ingress packet
+ * @param consume Output: trigger must not be routed
+ * @return Preset number, or -1
+ */
+static int midi_router_preset_match(const midi_router_packet_t *packet, bool *consume) {
+    uint32_t trigger = __atomic_load_n(&s_preset_trigger, __ATOMIC_RELAXED);
+    
+    if (!(trigger & (PRESET_TRIG_PC | PRESET_TRIG_SYSEX))) {
+        return -1;
+    }
+    uint16_t sources = PRESET_TRIG_SOURCES(trigger);
+    if (sources && !(sources & (1u << packet->source))) {
+        return -1;
+    }
+    *consume = trigger & PRESET_TRIG_CONSUME;
+    
+    uint8_t pc_status = 0xC0 | PRESET_TRIG_CHANNEL(trigger);
+    
+    if (packet->format == MIDI_FORMAT_1_0) {
+        const midi_message_t *msg = &packet->data.midi1;
+        if ((trigger & PRESET_TRIG_PC) && msg->status == pc_status) {
+            return msg->data.bytes[0] & 0x7F;
+        }
+        if ((trigger & PRESET_TRIG_SYSEX) && msg->status == 0xF0 && msg->data.sysex.data &&
+            msg->data.sysex.length == sizeof(preset_sysex_id) + 1 &&
+            memcmp(msg->data.sysex.data, preset_sysex_id, sizeof(preset_sysex_id)) == 0) {
+            return msg->data.sysex.data[sizeof(preset_sysex_id)] & 0x7F;
+        }
+        return -1;
+    }
+    
+    uint32_t word0 = packet->data.ump.words[0];
+    uint32_t word1 = packet->data.ump.words[1];
+    bool control_group = UMP_GET_GROUP(word0) == PRESET_TRIG_GROUP(trigger);
+    
+    switch (UMP_GET_MT(word0)) {
+        case UMP_MT_MIDI1_CHANNEL_VOICE:
+            if ((trigger & PRESET_TRIG_PC) && control_group &&
+                UMP_GET_STATUS_BYTE(word0) == pc_status) {
+                return (word0 >> 8) & 0x7F;
+            }
+            break;
+        case UMP_MT_MIDI2_CHANNEL_VOICE:
+            if ((trigger & PRESET_TRIG_PC) && control_group &&
+                UMP_GET_STATUS_BYTE(word0) == pc_status) {
+                return (word1 >> 24) & 0x7F;
+            }
+            break;
+        case UMP_MT_DATA_64: {
+            // Complete SysEx7 in one packet, 5 bytes
+            uint8_t form = (word0 >> 20) & 0x0F;
+            uint8_t count = (word0 >> 16) & 0x0F;
+            uint8_t bytes[5] = { (word0 >> 8) & 0x7F, word0 & 0x7F, (word1 >> 24) & 0x7F,
+                                 (word1 >> 16) & 0x7F, (word1 >> 8) & 0x7F };
+            if ((trigger & PRESET_TRIG_SYSEX) && form == UMP_FORMAT_COMPLETE && count == 5 &&
+                memcmp(bytes, preset_sysex_id, sizeof(preset_sysex_id)) == 0) {
+                return bytes[4];
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return -1;
+}
+
+//=============================================================================
+// Workers
+//=============================================================================
+
+/**
+ * @brief Keep idle outputs alive with Active Sensing
+ * 
+ * Queues 0xFE for each owned destination whose policy asks for it and
+ * that has sent nothing for MIDI_ROUTER_ACTIVE_SENSING_MS, so the gear
+ * on the other end notices a pulled cable and silences itself. Off by
+ * default on network outputs, where it would only cost bandwidth.
+ * 
+ * @return Time of the next check
+ */
+static int64_t dest_active_sensing(const midi_router_worker_t *worker, int64_t now_us) {
+    const int64_t period_us = MIDI_ROUTER_ACTIVE_SENSING_MS * 1000LL;
+    const midi_router_view_t *view = router_view();
+    uint16_t attached = __atomic_load_n(&s_ports_attached, __ATOMIC_ACQUIRE);
+    int64_t next_us = now_us + period_us;
+    
+    for (int dest = 0; dest < MIDI_TRANSPORT_COUNT; dest++) {
+        if (midi_router_dest_owner(dest) != worker->index || !(attached & (1u << dest)) ||
+            !view->config.dest_policies[dest].active_sensing) {
+            continue;
+        }
+        
+        midi_dest_t *d = &g_router_state.dests[dest];
+        if (now_us - d->last_tx_us < period_us) {
+            if (d->last_tx_us + period_us < next_us) {
+                next_us = d->last_tx_us + period_us;
+            }
+            continue;
+        }
+        
+        midi_router_packet_t packet = {
+            .source = dest,
+            .destination = dest,
+            .format = MIDI_FORMAT_1_0,
+            .timestamp_us = (uint32_t)now_us,
+            .data.midi1 = {
+                .type = MIDI_MSG_TYPE_SYSTEM_REALTIME,
+                .status = MIDI_STATUS_ACTIVE_SENSING
+            }
+        };
+        if (midi_router_translate(view, worker_stats(worker), &packet,
+                                  midi_router_dest_format(dest)) == ESP_OK) {
+            dest_queue_push(dest, &packet);
+            dest_stats(dest)->active_sensing_sent[dest]++;
+        }
+        d->last_tx_us = now_us;   // At most one queued per period
+    }
+    return next_us;
+}
+
+/**
+ * @brief ump_endpoint send() for messages a destination's owner queues itself
+ */
+static void endpoint_queue_tx(const ump_packet_t *ump, void *ctx) {
+    midi_transport_t dest = (midi_transport_t)(uintptr_t)ctx;
+    midi_router_packet_t packet = {
+        .source = dest,
+        .destination = dest,
+        .format = MIDI_FORMAT_2_0,
+        .timestamp_us = (uint32_t)esp_timer_get_time(),
+        .data.ump = *ump
+    };
+    dest_queue_push(dest, &packet);
+}
+
+/**
+ * @brief Whether a transport has a driver that carries UMP as is
+ */
+static inline bool midi_router_port_is_ump(midi_transport_t transport) {
+    return (__atomic_load_n(&s_ports_attached, __ATOMIC_ACQUIRE) & (1u << transport)) &&
+           s_ports[transport].target_format == MIDI_FORMAT_2_0;
+}
+
+/**
+ * @brief Accept a routed packet into an owned destination's output stage
+ * 
+ * Runs on the destination's owner only, so the tracker row and output
+ * rings for dest are never written by two cores.
+ */
+static void midi_router_deliver(midi_transport_t dest, const midi_router_packet_t *packet,
+                                int64_t now_us) {
+    if (packet->format == MIDI_FORMAT_EVENT) {
+        if (packet->data.event.type == MIDI_ROUTER_EVENT_SOURCE_LOST) {
+            uint32_t released = midi_note_tracker_release(
+                &g_router_state.notes, (midi_transport_t)packet->data.event.transport, dest,
+                midi_router_emit_note_off, NULL);
+            if (released) {
+                ESP_LOGI(TAG, "%s lost: released %lu note(s) on %s",
+                         midi_router_get_transport_name(packet->data.event.transport),
+                         (unsigned long)released, midi_router_get_transport_name(dest));
+            }
+        } else if (packet->data.event.type == MIDI_ROUTER_EVENT_DISCOVER &&
+                   packet->data.event.transport == dest && midi_router_port_is_ump(dest)) {
+            ump_endpoint_discover(endpoint_queue_tx, (void *)(uintptr_t)dest);
+        }
+        return;
+    }
+    
+    midi_note_tracker_update(&g_router_state.notes, dest, packet);
+    dest_queue_push(dest, packet);
+    
+    if (midi_router_is_network(dest)) {
+        uint32_t fingerprint = midi_loop_guard_content_hash(packet);
+        portENTER_CRITICAL(&g_router_state.egress_lock);
+        midi_loop_guard_insert(&g_router_state.egress_sent, fingerprint, now_us);
+        portEXIT_CRITICAL(&g_router_state.egress_lock);
+    }
+}
+
+/**
+ * @brief Accept packets other workers routed to outputs owned here
+ * 
+ * Takes a bounded batch per ring so the caller can drain outputs before
+ * the output queues overflow; the producer waits for the rest.
+ * 
+ * @return true if any packet was taken
+ */
+static bool midi_router_receive_handoffs(midi_router_worker_t *worker) {
+    midi_router_packet_t packet;
+    bool any = false;
+    int64_t now_us = esp_timer_get_time();
+    
+    for (int from = 0; from < g_router_state.num_workers; from++) {
+        if (from == worker->index) {
+            continue;
+        }
+        midi_spsc_ring_t *ring = &g_router_state.handoff[from][worker->index];
+        int n = 0;
+        for (; n < ROUTER_HANDOFF_BATCH && midi_spsc_pop(ring, &packet); n++) {
+            midi_router_deliver((midi_transport_t)packet.destination, &packet, now_us);
+        }
+        
+        // Room made: wake the sender if it waits for it
+        midi_router_worker_t *sender = &g_router_state.workers[from];
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (n && __atomic_exchange_n(&sender->handoff_blocked, false, __ATOMIC_ACQ_REL)) {
+            xTaskNotifyGive(sender->task);
+        }
+        any |= n > 0;
+    }
+    return any;
+}
+
+/**
+ * @brief Send a routed packet to a destination, locally or via its owner
+ */
+static void midi_router_forward(midi_router_worker_t *worker, midi_transport_t dest,
+                                midi_router_packet_t *packet, int64_t now_us) {
+    uint8_t owner = midi_router_dest_owner(dest);
+    
+    if (owner == worker->index) {
+        midi_router_deliver(dest, packet, now_us);
+        return;
+    }
+    
+    packet->destination = dest;
+    midi_spsc_ring_t *ring = &g_router_state.handoff[worker->index][owner];
+    TaskHandle_t owner_task = g_router_state.workers[owner].task;
+    
+    // Owner is behind: sleep until it makes room (it notifies us) or
+    // hands something to us, which we take so two workers handing off to
+    // each other cannot stall
+    int64_t give_up_us = now_us + ROUTER_HANDOFF_WAIT_MS * 1000;
+    while (!midi_spsc_push(ring, packet)) {
+        int64_t left_us = give_up_us - esp_timer_get_time();
+        if (left_us <= 0) {
+            __atomic_store_n(&worker->handoff_blocked, false, __ATOMIC_RELAXED);
+            worker_stats(worker)->handoff_dropped[dest]++;
+            return;
+        }
+        if (midi_router_receive_handoffs(worker)) {
+            dest_queues_drain(worker);
+            continue;
+        }
+        
+        // Announce the wait, then look again: the owner either sees the
+        // flag after its pop or we see the room
+        __atomic_store_n(&worker->handoff_blocked, true, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (midi_spsc_push(ring, packet)) {
+            __atomic_store_n(&worker->handoff_blocked, false, __ATOMIC_RELAXED);
+            break;
+        }
+        xTaskNotifyGive(owner_task);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(left_us / 1000) + 1);
+    }
+    xTaskNotifyGive(owner_task);
+}
+
+/**
+ * @brief Where endpoint replies go: back over the link the request came in on
+ */
+typedef struct {
+    midi_router_worker_t *worker;
+    midi_transport_t port;
+    int64_t now_us;
+} endpoint_reply_t;
+
+static void endpoint_reply_tx(const ump_packet_t *ump, void *ctx) {
+    endpoint_reply_t *reply = ctx;
+    midi_router_packet_t packet = {
+        .source = reply->port,
+        .destination = reply->port,
+        .format = MIDI_FORMAT_2_0,
+        .timestamp_us = (uint32_t)reply->now_us,
+        .data.ump = *ump
+    };
+    midi_router_forward(reply->worker, reply->port, &packet, reply->now_us);
+}
+
+/**
+ * @brief Answer UMP Stream discovery and configuration from a UMP peer
+ * 
+ * Each link negotiates for itself. All stream messages of a source shard
+ * to one worker, so only that worker writes the link state. A network
+ * transport's sessions negotiate in its session engine instead: a reply
+ * from here would go to every session.
+ * 
+ * @return true if the packet was for this endpoint (consumed)
+ */
+static bool midi_router_endpoint_handle(midi_router_worker_t *worker,
+                                        const midi_router_packet_t *packet, int64_t now_us) {
+    midi_transport_t src = packet->source;
+    
+    if (packet->format != MIDI_FORMAT_2_0 ||
+        UMP_GET_MT(packet->data.ump.words[0]) != UMP_MT_UMP_STREAM ||
+        !midi_router_port_is_ump(src) || midi_router_is_network(src)) {
+        return false;
+    }
+    
+    endpoint_reply_t reply = { .worker = worker, .port = src, .now_us = now_us };
+    const ump_endpoint_t *endpoint = __atomic_load_n(&s_endpoint, __ATOMIC_ACQUIRE);
+    // Start/End of Clip and unknown statuses route like any other message
+    return ump_endpoint_handle(endpoint, &s_ports[src].link, &packet->data.ump,
+                               endpoint_reply_tx, &reply) == ESP_OK;
+}
+
+/**
+ * @brief Route a MIDI 1.0 SysEx to a UMP destination as SysEx7
+ * 
+ * One SysEx becomes a run of MT 0x3 packets in default_group, queued
+ * back to back. A rule that drops one packet drops the rest, so no
+ * partial SysEx goes out.
+ */
+static void midi_router_forward_sysex7(midi_router_worker_t *worker,
+                                       const midi_router_view_t *view,
+                                       midi_transport_t dest,
+                                       const midi_router_packet_t *packet,
+                                       int64_t now_us) {
+    const midi_message_t *msg = &packet->data.midi1;
+    size_t length = msg->data.sysex.data ? msg->data.sysex.length : 0;
+    size_t offset = 0;
+    
+    worker_stats(worker)->translations_1to2++;
+    do {
+        midi_router_packet_t slice = *packet;
+        slice.format = MIDI_FORMAT_2_0;
+        offset = midi_translate_sysex_to_ump(msg, view->config.default_group, offset,
+                                             &slice.data.ump);
+        midi_router_map_group(view, packet->source, &slice);
+        if (!midi_router_apply_rules(view, &slice, dest)) {
+            worker_stats(worker)->packets_filtered[packet->source]++;
+            return;
+        }
+        midi_router_forward(worker, dest, &slice, now_us);
+    } while (offset < length);
+}
+
+/**
+ * @brief Handle a router control event
+ * 
+ * Forwarded like a packet to every destination's owner, behind anything
+ * this worker already handed over for that destination. A lost source
+ * may still have packets waiting in other class queues (a Note On
+ * behind a controller): the event goes to the back of its queue until
+ * they are routed, or is handled at once if that queue is full.
+ */
+static void midi_router_handle_event(midi_router_worker_t *worker,
+                                     midi_router_packet_t *event, int64_t now_us) {
+    if (event->data.event.type == MIDI_ROUTER_EVENT_SOURCE_LOST &&
+        __atomic_load_n(&worker->source_ingress[event->source], __ATOMIC_ACQUIRE) &&
+        xQueueSend(worker->packet_queues[MIDI_PRIO_NOTE], event, 0) == pdTRUE) {
+        return;
+    }
+    
+    for (int dest = 0; dest < MIDI_TRANSPORT_COUNT; dest++) {
+        midi_router_forward(worker, dest, event, now_us);
+    }
+}
+
+/**
+ * @brief Route one ingress packet to its destinations
+ */
+static void midi_router_route(midi_router_worker_t *worker, midi_router_packet_t *packet_in) {
+    midi_router_stats_t *stats = worker_stats(worker);
+    midi_router_packet_t packet = *packet_in;
+    int64_t now_us = esp_timer_get_time();
+    
+    if (packet.format == MIDI_FORMAT_EVENT) {
+        midi_router_handle_event(worker, &packet, now_us);
+        return;
+    }
+    
+    midi_transport_t src = packet.source;
+    
+    // Drop looped/duplicate network traffic before any other work
+    if (midi_router_loop_check(worker, &packet, now_us)) {
+        return;
+    }
+    
+    // Endpoint discovery and stream configuration are for this hop only
+    if (midi_router_endpoint_handle(worker, &packet, now_us)) {
+        return;
+    }
+    
+    // Preset switches apply from the next packet
+    bool consume;
+    int preset = midi_router_preset_match(&packet, &consume);
+    if (preset >= 0) {
+        midi_router_preset_request((uint8_t)preset);
+        if (consume) {
+            return;
+        }
+    }
+    
+    // One view for the whole fan-out, so a change never applies halfway
+    const midi_router_view_t *view = router_view();
+    
+    // Apply input filter
+    if (!midi_router_check_filter(view, &packet, &view->filters[src])) {
+        stats->packets_filtered[src]++;
+        return;  // Filtered out
+    }
+    
+    // Determine destinations (merge mode and self-routes already folded in);
+    // nothing is prepared for a transport without a driver
+    uint16_t route_mask = view->route_mask[src] &
+                          __atomic_load_n(&s_ports_attached, __ATOMIC_ACQUIRE);
+    
+    for (int dest = 0; dest < MIDI_TRANSPORT_COUNT; dest++) {
+        if (!(route_mask & (1u << dest))) {
+            continue;  // Route blocked
+        }
+        
+        // Translate if destination requires different format
+        midi_router_packet_t out_packet = packet;
+        out_packet.hops = (packet.hops < UINT8_MAX) ? packet.hops + 1 : UINT8_MAX;
+        out_packet.seq = 0;
+        
+        uint8_t dest_format = midi_router_dest_format(dest);
+        if (view->config.auto_translate && packet.format == MIDI_FORMAT_1_0 &&
+            packet.data.midi1.status == MIDI_STATUS_SYSEX_START &&
+            dest_format != MIDI_FORMAT_1_0 && dest_format != ROUTER_FORMAT_ANY) {
+            midi_router_forward_sysex7(worker, view, dest, &out_packet, now_us);
+            continue;
+        }
+        
+        esp_err_t err = midi_router_translate(view, stats, &out_packet, dest_format);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Translation failed: %s → %s",
+                     midi_router_get_transport_name(src), midi_router_get_transport_name(dest));
+            stats->routing_errors++;
+            continue;
+        }
+        
+        midi_router_map_group(view, src, &out_packet);
+        
+        // JR timestamps only where the link turned them on (the protocol
+        // form is up to translation); network sessions are checked one
+        // by one by their session engine
+        if (out_packet.format == MIDI_FORMAT_2_0 &&
+            UMP_GET_MT(out_packet.data.ump.words[0]) == UMP_MT_UTILITY &&
+            midi_router_port_is_ump(dest) && !midi_router_is_network(dest) &&
+            ump_endpoint_link_adapt(&s_ports[dest].link, &out_packet.data.ump) != ESP_OK) {
+            stats->packets_filtered[src]++;
+            continue;
+        }
+        
+        // Per-route rules (operate on destination format)
+        if (!midi_router_apply_rules(view, &out_packet, dest)) {
+            stats->packets_filtered[src]++;
+            continue;
+        }
+        
+        // Queue for transport TX (policy applies when full)
+        midi_router_forward(worker, dest, &out_packet, now_us);
+    }
+}
+
+/**
+ * @brief Pick the worker that routes a packet
+ * 
+ * Sources with a fixed worker always go there. Spread sources are
+ * sharded by (group, channel); messages without a channel use one key
+ * per group, so a SysEx stream never splits across workers. Either way
+ * every (source, group, channel) stream lands on one worker, in order.
+ */
+static midi_router_worker_t *midi_router_shard(const midi_router_packet_t *packet) {
+    uint8_t n = g_router_state.num_workers;
+    uint8_t affinity = g_router_state.source_worker[packet->source];
+    
+    if (affinity != MIDI_ROUTER_SHARD_SPREAD || n == 1) {
+        return &g_router_state.workers[affinity % n];
+    }
+    
+    return &g_router_state.workers[midi_router_stream_key(packet, g_router_state.shard_group) % n];
+}
+
+/**
+ * @brief Whether a packet is counted in its stream's ingress slot
+ */
+static inline bool midi_router_ingress_counted(const midi_router_packet_t *packet) {
+    return packet->format != MIDI_FORMAT_EVENT &&
+           midi_router_packet_priority(packet) != MIDI_PRIO_REALTIME;
+}
+
+/**
+ * @brief Take the next ingress packet by priority
+ * 
+ * @return true if packet was filled
+ */
+static bool midi_router_ingress_next(midi_router_worker_t *worker,
+                                     midi_router_packet_t *packet) {
+    uint8_t waiting = 0;
+    
+    for (int c = 0; c < MIDI_PRIO_COUNT; c++) {
+        if (uxQueueMessagesWaiting(worker->packet_queues[c])) {
+            waiting |= 1u << c;
+        }
+    }
+    
+    int c = prio_pick(waiting, worker->ingress_credits);
+    if (c < 0 || xQueueReceive(worker->packet_queues[c], packet, 0) != pdTRUE) {
+        return false;
+    }
+    if (midi_router_ingress_counted(packet)) {
+        __atomic_fetch_sub(&worker->stream_ingress[midi_router_stream_slot(packet)], 1,
+                           __ATOMIC_RELEASE);
+        __atomic_fetch_sub(&worker->source_ingress[packet->source], 1, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+/**
+ * @brief Quiescent point: the worker holds no view pointer from before here
+ */
+static inline void midi_router_quiescent(midi_router_worker_t *worker) {
+    uint32_t generation = __atomic_load_n(&g_router_state.config_generation, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&worker->config_seen, generation, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Router worker task - routes its shard, drives its outputs
+ */
+static void midi_router_task(void *arg) {
+    midi_router_worker_t *worker = arg;
+    midi_router_packet_t packet;
+    bool tx_pending = false;
+    
+    ESP_LOGI(TAG, "Router worker %d started on core %d", worker->index, xPortGetCoreID());
+    
+    while (1) {
+        midi_router_stats_sync(worker->index);
+        midi_router_quiescent(worker);
+        
+        bool routed = midi_router_ingress_next(worker, &packet);
+        if (routed) {
+            midi_router_route(worker, &packet);
+        }
+        bool received = midi_router_receive_handoffs(worker);
+        
+        // Wait for work (wake periodically while a transport is busy, and
+        // for Active Sensing); a blocked worker holds no view, so writers
+        // need not wait for it
+        if (!routed && !received) {
+            TickType_t wait = ROUTER_TX_RETRY_TICKS;
+            if (!tx_pending) {
+                int64_t idle_us = worker->sense_due_us - esp_timer_get_time();
+                wait = (idle_us > 0) ? pdMS_TO_TICKS(idle_us / 1000) + 1 : 0;
+            }
+            __atomic_store_n(&worker->config_seen, ROUTER_WORKER_IDLE, __ATOMIC_SEQ_CST);
+            ulTaskNotifyTake(pdTRUE, wait);
+            midi_router_quiescent(worker);
+        }
+        
+        int64_t now_us = esp_timer_get_time();
+        if (now_us >= worker->sense_due_us) {
+            worker->sense_due_us = dest_active_sensing(worker, now_us);
+        }
+        tx_pending = dest_queues_drain(worker);
+    }
+}
+
+/**
+ * @brief Stop worker tasks and delete their ingress queues
+ */
+static void midi_router_delete_workers(void) {
+    for (int w = 0; w < MIDI_ROUTER_MAX_WORKERS; w++) {
+        midi_router_worker_t *worker = &g_router_state.workers[w];
+        if (worker->task) {
+            vTaskDelete(worker->task);
+            worker->task = NULL;
+        }
+        for (int c = 0; c < MIDI_PRIO_COUNT; c++) {
+            if (worker->packet_queues[c]) {
+                vQueueDelete(worker->packet_queues[c]);
+                worker->packet_queues[c] = NULL;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Create worker queues and tasks
+ */
+static esp_err_t midi_router_create_workers(void) {
+    for (int w = 0; w < g_router_state.num_workers; w++) {
+        midi_router_worker_t *worker = &g_router_state.workers[w];
+        worker->index = w;
+        memcpy(worker->ingress_credits, prio_weights, sizeof(prio_weights));
+        memset(worker->stream_ingress, 0, sizeof(worker->stream_ingress));
+        memset(worker->source_ingress, 0, sizeof(worker->source_ingress));
+        midi_loop_guard_init(&worker->ingress_seen, ROUTER_DUP_WINDOW_MS);
+        worker->config_seen = ROUTER_WORKER_IDLE;
+        
+        for (int c = 0; c < MIDI_PRIO_COUNT; c++) {
+            worker->packet_queues[c] = xQueueCreate(ingress_queue_len[c],
+                                                    sizeof(midi_router_packet_t));
+            if (!worker->packet_queues[c]) {
+                ESP_LOGE(TAG, "Failed to create packet queue");
+                return ESP_FAIL;
+            }
+        }
+        for (int to = 0; to < g_router_state.num_workers; to++) {
+            midi_spsc_init(&g_router_state.handoff[w][to]);
+        }
+    }
+    
+    // Queues first: a running worker may hand off to any other
+    for (int w = 0; w < g_router_state.num_workers; w++) {
+        char name[16];
+        snprintf(name, sizeof(name), w ? "midi_router%d" : "midi_router", w);
+        
+        BaseType_t task_created = xTaskCreatePinnedToCore(
+            midi_router_task,
+            name,
+            ROUTER_TASK_STACK_SIZE,
+            &g_router_state.workers[w],
+            ROUTER_TASK_PRIORITY,
+            &g_router_state.workers[w].task,
+            (ROUTER_TASK_CORE + w) % portNUM_PROCESSORS
+        );
+        if (task_created != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create router task");
+            return ESP_FAIL;
+        }
+    }
+    
+    return ESP_OK;
+}
+
+/**
+ * @brief Open an ingress statistics shard for writing
+ * 
+ * RX task shards have one writer and no lock; the injector shard is
+ * shared and locked.
+ */
+static inline midi_router_stats_t *ingress_stats_begin(int shard, portMUX_TYPE *lock) {
+    if (lock) {
+        portENTER_CRITICAL(lock);
+    }
+    return midi_router_stats_sync(shard);
+}
+
+static inline void ingress_stats_end(portMUX_TYPE *lock) {
+    if (lock) {
+        portEXIT_CRITICAL(lock);
+    }
+}
+
+/**
+ * @brief Queue a packet on a worker's class queue and wake it
+ * 
+ * As on the output side (dest_queue_class()), a stream's packets join
+ * the queue its earlier packets still wait in, so they are routed in
+ * order; only realtime and events go by their own class. Any RX task
+ * may feed a stream slot, so the slot's class and count are claimed
+ * together with one compare-and-swap.
+ */
+static esp_err_t midi_router_enqueue_to(midi_router_worker_t *worker,
+                                        const midi_router_packet_t *packet, TickType_t wait,
+                                        int stats_shard, portMUX_TYPE *stats_lock) {
+    midi_router_packet_t stamped = *packet;
+    stamped.timestamp_us = (uint32_t)esp_timer_get_time();
+    
+    uint32_t prio = midi_router_packet_priority(&stamped);
+    bool counted = midi_router_ingress_counted(&stamped);
+    uint32_t *slot = &worker->stream_ingress[midi_router_stream_slot(&stamped)];
+    if (counted) {
+        uint32_t old = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        uint32_t claimed;
+        do {
+            prio = (old & 0xFFFF) ? (old >> 16) : prio;
+            claimed = (prio << 16) | ((old & 0xFFFF) + 1);
+        } while (!__atomic_compare_exchange_n(slot, &old, claimed, true,
+                                              __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+        __atomic_fetch_add(&worker->source_ingress[stamped.source], 1, __ATOMIC_RELAXED);
+    }
+    QueueHandle_t queue = worker->packet_queues[prio];
+    
+    if (xQueueSend(queue, &stamped, wait) != pdTRUE) {
+        if (counted) {
+            __atomic_fetch_sub(slot, 1, __ATOMIC_RELEASE);
+            __atomic_fetch_sub(&worker->source_ingress[stamped.source], 1, __ATOMIC_RELEASE);
+        }
+        return ESP_ERR_NO_MEM;
+    }
+    
+    if (stats_shard >= 0) {
+        UBaseType_t depth = uxQueueMessagesWaiting(queue);
+        midi_router_stats_t *stats = ingress_stats_begin(stats_shard, stats_lock);
+        if (depth > stats->class_queue_high_water[prio]) {
+            stats->class_queue_high_water[prio] = depth;
+        }
+        ingress_stats_end(stats_lock);
+    }
+    
+    xTaskNotifyGive(worker->task);
+    return ESP_OK;
+}
+
+//=============================================================================
+// Stored Configuration
+//=============================================================================
+
+/**
+ * @brief Read and decode one stored blob (one backend read)
+ */
+static esp_err_t midi_router_read_blob(const char *name, midi_router_config_t *config) {
+    static uint8_t blob[MIDI_CONFIG_BLOB_MAX];
+    size_t len = 0;
+    
+    esp_err_t err = s_config_store->read(s_config_store, name, blob, sizeof(blob), &len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    
+    uint16_t version = midi_config_blob_version(blob, len);
+    err = midi_config_blob_decode(blob, len, config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Saved %s rejected: %s", name, esp_err_to_name(err));
+        return err;
+    }
+    if (version != MIDI_CONFIG_BLOB_VERSION) {
+        ESP_LOGI(TAG, "%s migrated from v%d to v%d", name, version, MIDI_CONFIG_BLOB_VERSION);
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Encode and store one blob
+ */
+static esp_err_t midi_router_write_blob(const char *name, const midi_router_config_t *config) {
+    static uint8_t blob[MIDI_CONFIG_BLOB_MAX];
+    size_t len;
+    
+    esp_err_t err = midi_config_blob_encode(config, blob, sizeof(blob), &len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    
+    err = s_config_store->write(s_config_store, name, blob, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Saving %s to %s failed: %s", name, s_config_store->location,
+                 esp_err_to_name(err));
+        return err;
+    }
+    
+    ESP_LOGI(TAG, "Saved %s (%u bytes, v%d)", name, (unsigned)len, MIDI_CONFIG_BLOB_VERSION);
+    return ESP_OK;
+}
+
+/**
+ * @brief Overwrite a config's worker layout with the running one
+ * 
+ * Each output must keep a single owner, so the layout only changes at init.
+ */
+static void midi_router_keep_layout(midi_router_config_t *config) {
+    config->num_workers = g_router_state.views[0].config.num_workers;
+    memcpy(config->source_worker, g_router_state.source_worker, sizeof(config->source_worker));
+    memcpy(config->dest_worker, g_router_state.dest_worker, sizeof(config->dest_worker));
+}
+
+/**
+ * @brief Load and compile every stored preset (before the workers start)
+ */
+static void midi_router_presets_load(void) {
+    static midi_router_config_t loaded;
+    char name[MIDI_CONFIG_NAME_MAX + 1];
+    int count = 0;
+    
+    for (unsigned i = 0; i < MIDI_ROUTER_PRESETS; i++) {
+        snprintf(name, sizeof(name), ROUTER_PRESET_NAME, i);
+        if (midi_router_read_blob(name, &loaded) != ESP_OK) {
+            continue;
+        }
+        
+        midi_router_view_t *slot = &g_router_state.presets[i];
+        slot->config = loaded;
+        midi_router_keep_layout(&slot->config);
+        if (midi_router_view_compile(slot) == ESP_OK) {
+            g_router_state.preset_valid |= 1u << i;
+            count++;
+        }
+    }
+    
+    if (count) {
+        ESP_LOGI(TAG, "Loaded %d preset(s)", count);
+    }
+}
+
+//=============================================================================
+// Router API
+//=============================================================================
+
+/**
+ * @brief Initialize router
+ */
+esp_err_t midi_router_init(const midi_router_config_t *config) {
+    if (g_router_state.initialized) {
+        ESP_LOGW(TAG, "Router already initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    int64_t init_start_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "Initializing MIDI router");
+    
+    // Clear state
+    memset(&g_router_state, 0, sizeof(g_router_state));
+    if (!s_config_store) {
+        s_config_store = midi_config_store_nvs();
+    }
+    g_router_state.active_view = &g_router_state.views[0];
+    dest_queues_init();
+    g_router_state.egress_lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    g_router_state.inject_lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    
+    // Load or use provided config
+    if (config) {
+        g_router_state.views[0].config = *config;
+    } else {
+        esp_err_t err = midi_router_load_config();
+        if (err != ESP_OK) {
+            ESP_LOGI(TAG, "No saved config, using defaults");
+            midi_router_reset_config();
+        }
+    }
+    g_router_state.boot_timing.config_load_us = (uint32_t)(esp_timer_get_time() - init_start_us);
+    
+    midi_loop_guard_init(&g_router_state.egress_sent, ROUTER_ECHO_WINDOW_MS);
+    
+    // Worker count and layout are fixed for the router's lifetime
+    midi_router_config_t *initial = &g_router_state.views[0].config;
+    uint8_t workers = initial->num_workers;
+    g_router_state.num_workers = (workers && workers < MIDI_ROUTER_MAX_WORKERS)
+                                 ? workers : MIDI_ROUTER_MAX_WORKERS;
+    memcpy(g_router_state.source_worker, initial->source_worker, sizeof(initial->source_worker));
+    memcpy(g_router_state.dest_worker, initial->dest_worker, sizeof(initial->dest_worker));
+    g_router_state.shard_group = initial->default_group & 0x0F;
+    
+    g_router_state.config_mutex = xSemaphoreCreateMutex();
+    if (!g_router_state.config_mutex) {
+        return ESP_ERR_NO_MEM;
+    }
+    
+    // Compile the first view (invalid rules are discarded, not fatal)
+    if (midi_router_view_compile(&g_router_state.views[0]) != ESP_OK) {
+        ESP_LOGW(TAG, "Configured rules invalid, routing without rules");
+        initial->num_rules = 0;
+        midi_router_view_compile(&g_router_state.views[0]);
+    }
+    
+    // Preset bank: one blob per stored preset, compiled now so recall is a pointer swap
+    int64_t presets_start_us = esp_timer_get_time();
+    g_router_state.active_preset = -1;
+    midi_router_presets_load();
+    g_router_state.boot_timing.preset_load_us = (uint32_t)(esp_timer_get_time() - presets_start_us);
+    
+    // Create workers
+    if (midi_router_create_workers() != ESP_OK) {
+        midi_router_delete_workers();
+        vSemaphoreDelete(g_router_state.config_mutex);
+        return ESP_FAIL;
+    }
+    
+    g_router_state.initialized = true;
+    
+    int64_t ready_us = esp_timer_get_time();
+    g_router_state.boot_timing.init_us = (uint32_t)(ready_us - init_start_us);
+    g_router_state.boot_timing.boot_to_ready_us = (uint32_t)ready_us;
+    ESP_LOGI(TAG, "MIDI router initialized (%d worker%s) in %lu us, config %lu us, "
+             "routing %lu us after boot",
+             g_router_state.num_workers, g_router_state.num_workers > 1 ? "s" : "",
+             (unsigned long)g_router_state.boot_timing.init_us,
+             (unsigned long)g_router_state.boot_timing.config_load_us,
+             (unsigned long)g_router_state.boot_timing.boot_to_ready_us);
+    
+    // Print routing matrix
+    ESP_LOGI(TAG, "Routing matrix:");
+    for (int src = 0; src < MIDI_TRANSPORT_COUNT; src++) {
+        ESP_LOGI(TAG, "  %s →", midi_router_get_transport_name(src));
+        for (int dest = 0; dest < MIDI_TRANSPORT_COUNT; dest++) {
+            if (g_router_state.active_view->route_mask[src] & (1u << dest)) {
+                ESP_LOGI(TAG, "    ✓ %s", midi_router_get_transport_name(dest));
+            }
+        }
+    }
+    
+    return ESP_OK;
+}
+
+/**
+ * @brief Deinitialize router
+ */
+esp_err_t midi_router_deinit(void) {
+    if (!g_router_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    g_router_state.initialized = false;
+    
+    midi_router_delete_workers();
+    vSemaphoreDelete(g_router_state.config_mutex);
+    g_router_state.config_mutex = NULL;
+    
+    ESP_LOGI(TAG, "MIDI router deinitialized");
+    return ESP_OK;
+}
+
+/**
+ * @brief Queue an input packet, counting it in the given shard
+ */
+static esp_err_t midi_router_ingress(const midi_router_packet_t *packet, int stats_shard,
+                                     portMUX_TYPE *stats_lock) {
+    if (packet->source >= MIDI_TRANSPORT_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!g_router_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    TickType_t wait = midi_router_packet_is_critical(packet)
+                      ? pdMS_TO_TICKS(ROUTER_CRITICAL_SEND_WAIT_MS) : 0;
+    
+    if (midi_router_enqueue_to(midi_router_shard(packet), packet, wait,
+                               stats_shard, stats_lock) != ESP_OK) {
+        midi_router_stats_t *stats = ingress_stats_begin(stats_shard, stats_lock);
+        stats->packets_dropped[packet->source]++;
+        ingress_stats_end(stats_lock);
+        return ESP_ERR_NO_MEM;  // Queue full
+    }
+    
+    return ESP_OK;
+}
+
+/**
+ * @brief Send packet to router
+ */
+esp_err_t midi_router_send(const midi_router_packet_t *packet) {
+    // Only the source's RX task writes its ingress shard
+    return midi_router_ingress(packet, ROUTER_INGRESS_SHARD(packet->source), NULL);
+}
+
+/**
+ * @brief Send packet to router on behalf of a source
+ */
+esp_err_t midi_router_inject(const midi_router_packet_t *packet) {
+    return midi_router_ingress(packet, ROUTER_INJECT_SHARD, &g_router_state.inject_lock);
+}
+
+/**
+ * @brief Report source disconnect
+ */
+esp_err_t midi_router_source_lost(midi_transport_t source) {
+    if (source >= MIDI_TRANSPORT_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!g_router_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    midi_router_packet_t packet = {
+        .source = source,
+        .destination = 0xFF,
+        .format = MIDI_FORMAT_EVENT,
+        .data.event = {
+            .type = MIDI_ROUTER_EVENT_SOURCE_LOST,
+            .transport = source
+        }
+    };
+    
+    // A spread source has traffic on every worker: each one forwards the
+    // event behind what it already handed over (releasing twice is a no-op)
+    bool spread = g_router_state.source_worker[source] == MIDI_ROUTER_SHARD_SPREAD &&
+                  g_router_state.num_workers > 1;
+    esp_err_t result = ESP_OK;
+    
+    for (int w = 0; w < g_router_state.num_workers; w++) {
+        midi_router_worker_t *worker = spread ? &g_router_state.workers[w]
+                                              : midi_router_shard(&packet);
+        // May run on any task: leaves the source's ingress shard alone
+        if (midi_router_enqueue_to(worker, &packet,
+                                   pdMS_TO_TICKS(ROUTER_EVENT_SEND_WAIT_MS), -1, NULL) != ESP_OK) {
+            ESP_LOGW(TAG, "Router queue full, %s release lost",
+                     midi_router_get_transport_name(source));
+            result = ESP_ERR_NO_MEM;
+        }
+        if (!spread) {
+            break;
+        }
+    }
+    
+    return result;
+}
+
+/**
+ * @brief Send UMP Endpoint Discovery to a transport's peer
+ */
+esp_err_t midi_router_discover_endpoint(midi_transport_t transport) {
+    if (transport >= MIDI_TRANSPORT_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!g_router_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (midi_router_is_network(transport)) {
+        return ESP_ERR_NOT_SUPPORTED;  // Negotiated per session
+    }
+    
+    midi_router_packet_t packet = {
+        .source = transport,
+        .destination = transport,
+        .format = MIDI_FORMAT_EVENT,
+        .data.event = {
+            .type = MIDI_ROUTER_EVENT_DISCOVER,
+            .transport = transport
+        }
+    };
+    
+    if (midi_router_enqueue_to(midi_router_shard(&packet), &packet,
+                               pdMS_TO_TICKS(ROUTER_EVENT_SEND_WAIT_MS), -1, NULL) != ESP_OK) {
+        ESP_LOGW(TAG, "Router queue full, %s discovery lost",
+                 midi_router_get_transport_name(transport));
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Set the endpoint reported to UMP peers
+ */
+esp_err_t midi_router_set_endpoint(const ump_endpoint_t *endpoint) {
+    __atomic_store_n(&s_endpoint, endpoint ? endpoint : &default_endpoint, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the endpoint reported to UMP peers
+ */
+const ump_endpoint_t *midi_router_get_endpoint(void) {
+    return __atomic_load_n(&s_endpoint, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Set the protocol of a UMP transport's peer
+ */
+esp_err_t midi_router_set_transport_protocol(midi_transport_t transport, uint8_t protocol) {
+    if (transport >= MIDI_TRANSPORT_COUNT ||
+        (protocol != UMP_STREAM_PROTOCOL_MIDI1 && protocol != UMP_STREAM_PROTOCOL_MIDI2)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    ump_endpoint_link_t *link = &s_ports[transport].link;
+    __atomic_store_n(&link->protocol, protocol, __ATOMIC_RELEASE);
+    link->negotiated = true;
+    ESP_LOGI(TAG, "%s speaks MIDI %s protocol", midi_router_get_transport_name(transport),
+             protocol == UMP_STREAM_PROTOCOL_MIDI1 ? "1.0" : "2.0");
+    return ESP_OK;
+}
+
+/**
+ * @brief Register an output coalescer for statistics
+ */
+esp_err_t midi_router_register_coalescer(midi_transport_t destination,
+                                          const struct midi_coalescer *coalescer) {
+    if (destination >= MIDI_TRANSPORT_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    g_router_state.coalescers[destination] = coalescer;
+    g_router_state.cc_thinned_base[destination] = coalescer ? coalescer->stats.thinned : 0;
+    g_router_state.cc_deferred_base[destination] = coalescer ? coalescer->stats.sent_deferred : 0;
+    return ESP_OK;
+}
+
+//=============================================================================
+// Transports
+//=============================================================================
+
+/**
+ * @brief send() of drivers registered through midi_router_register_transport_tx()
+ */
+static esp_err_t midi_router_legacy_send(void *ctx, const midi_router_packet_t *packet) {
+    midi_router_port_t *port = ctx;
+    midi_router_tx_callback_t tx = __atomic_load_n(&port->legacy_tx, __ATOMIC_ACQUIRE);
+    return tx ? tx(packet) : ESP_ERR_INVALID_STATE;
+}
+
+/**
+ * @brief abort() of drivers registered through midi_router_register_transport_tx()
+ */
+static void midi_router_legacy_abort(void *ctx) {
+    midi_router_port_t *port = ctx;
+    midi_router_abort_callback_t abort_cb = __atomic_load_n(&port->legacy_abort,
+                                                            __ATOMIC_ACQUIRE);
+    if (abort_cb) {
+        abort_cb();
+    }
+}
+
+static const midi_transport_ops_t legacy_ops_midi1 = {
+    .native_format = MIDI_FORMAT_1_0,
+    .send = midi_router_legacy_send,
+    .abort = midi_router_legacy_abort
+};
+
+static const midi_transport_ops_t legacy_ops_ump = {
+    .native_format = MIDI_FORMAT_2_0,
+    .send = midi_router_legacy_send,
+    .abort = midi_router_legacy_abort
+};
+
+/**
+ * @brief Wait until no worker still uses a driver it loaded before now
+ * 
+ * Same grace period as a config change: bump the generation and let
+ * every worker pass a quiescent point.
+ */
+static void midi_router_ports_synchronize(void) {
+    if (!g_router_state.initialized) {
+        return;  // No workers
+    }
+    
+    xSemaphoreTake(g_router_state.config_mutex, portMAX_DELAY);
+    __atomic_add_fetch(&g_router_state.config_generation, 1, __ATOMIC_SEQ_CST);
+    midi_router_config_synchronize();
+    midi_router_config_unlock();
+}
+
+/**
+ * @brief Attach a transport driver
+ */
+esp_err_t midi_router_attach_transport(midi_transport_t transport,
+                                       const midi_transport_ops_t *ops, void *ctx) {
+    if (transport >= MIDI_TRANSPORT_COUNT || (ops && !ops->send)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    midi_router_port_t *port = &s_ports[transport];
+    if (port->ops == ops && port->ctx == ctx) {
+        return ESP_OK;
+    }
+    const char *old_name = midi_router_get_transport_name(transport);
+    
+    // Detach first, so no worker pairs the new ctx with the old ops
+    if (port->ops) {
+        __atomic_and_fetch(&s_ports_attached, (uint16_t)~(1u << transport), __ATOMIC_SEQ_CST);
+        __atomic_store_n(&port->ops, NULL, __ATOMIC_SEQ_CST);
+        midi_router_ports_synchronize();
+    }
+    
+    if (!ops) {
+        ESP_LOGI(TAG, "Detached %s", old_name);
+        return ESP_OK;
+    }
+    
+    port->ctx = ctx;
+    port->flags = ops->flags;
+    ump_endpoint_link_init(__atomic_load_n(&s_endpoint, __ATOMIC_ACQUIRE), &port->link);
+    port->target_format = (ops->flags & MIDI_TRANSPORT_FLAG_ANY_FORMAT) ? ROUTER_FORMAT_ANY
+                                                                        : ops->native_format;
+    __atomic_store_n(&port->ops, ops, __ATOMIC_RELEASE);
+    __atomic_or_fetch(&s_ports_attached, (uint16_t)(1u << transport), __ATOMIC_RELEASE);
+    
+    ESP_LOGI(TAG, "Attached %s (%s)", midi_router_get_transport_name(transport),
+             port->target_format == ROUTER_FORMAT_ANY ? "any format" :
+             port->target_format == MIDI_FORMAT_1_0 ? "MIDI 1.0" : "UMP");
+    return ESP_OK;
+}
+
+/**
+ * @brief Register a transport under a free dynamic ID
+ */
+esp_err_t midi_router_add_transport(const midi_transport_ops_t *ops, void *ctx,
+                                    midi_transport_t *transport) {
+    if (!ops || !ops->send || !transport) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    int id = -1;
+    portENTER_CRITICAL(&s_ports_lock);
+    for (int t = MIDI_TRANSPORT_BUILTIN_COUNT; t < MIDI_TRANSPORT_COUNT; t++) {
+        if (!s_ports[t].dynamic && !s_ports[t].ops) {
+            s_ports[t].dynamic = true;
+            id = t;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_ports_lock);
+    
+    if (id < 0) {
+        ESP_LOGW(TAG, "No free transport slot for %s", ops->name ? ops->name : "transport");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    *transport = (midi_transport_t)id;
+    return midi_router_attach_transport(*transport, ops, ctx);
+}
+
+/**
+ * @brief Detach a transport and release a dynamic ID
+ */
+esp_err_t midi_router_remove_transport(midi_transport_t transport) {
+    if (transport >= MIDI_TRANSPORT_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    esp_err_t err = midi_router_attach_transport(transport, NULL, NULL);
+    s_ports[transport].dynamic = false;
+    return err;
+}
+
+/**
+ * @brief Describe a transport
+ */
+esp_err_t midi_router_get_transport_info(midi_transport_t transport,
+                                         midi_transport_info_t *info) {
+    if (transport >= MIDI_TRANSPORT_COUNT || !info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    const midi_router_port_t *port = &s_ports[transport];
+    const midi_transport_ops_t *ops = __atomic_load_n(&port->ops, __ATOMIC_ACQUIRE);
+    
+    info->name = midi_router_get_transport_name(transport);
+    info->attached = ops != NULL;
+    info->dynamic = port->dynamic;
+    info->ump_link = port->link;
+    if (ops) {
+        info->native_format = ops->native_format;
+        info->flags = ops->flags;
+        info->link_up = !ops->link_up || ops->link_up(port->ctx);
+    } else {
+        info->native_format = (transport == MIDI_TRANSPORT_UART) ? MIDI_FORMAT_1_0
+                                                                 : MIDI_FORMAT_2_0;
+        info->flags = midi_router_is_network(transport) ? MIDI_TRANSPORT_FLAG_NETWORK : 0;
+        info->link_up = false;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Read a transport driver's counters
+ */
+esp_err_t midi_router_get_transport_stats(midi_transport_t transport,
+                                          midi_transport_stats_t *stats) {
+    if (transport >= MIDI_TRANSPORT_COUNT || !stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    const midi_transport_ops_t *ops = __atomic_load_n(&s_ports[transport].ops, __ATOMIC_ACQUIRE);
+    if (!ops || !ops->get_stats) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    memset(stats, 0, sizeof(*stats));
+    return ops->get_stats(s_ports[transport].ctx, stats);
+}
+
+/**
+ * @brief Register transport TX callback
+ */
+esp_err_t midi_router_register_transport_tx(midi_transport_t transport,
+                                             midi_router_tx_callback_t tx_callback) {
+    if (transport >= MIDI_TRANSPORT_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    midi_router_port_t *port = &s_ports[transport];
+    if (!tx_callback) {
+        esp_err_t ret = midi_router_attach_transport(transport, NULL, NULL);
+        __atomic_store_n(&port->legacy_abort, NULL, __ATOMIC_RELEASE);
+        return ret;
+    }
+    
+    // Swapping callbacks keeps the same ops and ctx: no detach needed
+    __atomic_store_n(&port->legacy_tx, tx_callback, __ATOMIC_RELEASE);
+    return midi_router_attach_transport(transport,
+                                        transport == MIDI_TRANSPORT_UART ? &legacy_ops_midi1
+                                                                         : &legacy_ops_ump,
+                                        port);
+}
+
+/**
+ * @brief Register transport abort callback
+ */
+esp_err_t midi_router_register_transport_abort(midi_transport_t transport,
+                                                midi_router_abort_callback_t abort_callback) {
+    if (transport >= MIDI_TRANSPORT_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    __atomic_store_n(&s_ports[transport].legacy_abort, abort_callback, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+//=============================================================================
+// Live Configuration
+//=============================================================================
 
 /**
- * @brief Send packet to router
+ * @brief Start a config change: lock out other writers, copy the live config
+ * 
+ * Must not be called from a worker (TX callbacks), which would wait for
+ * its own quiescent point.
+ * 
+ * @return Spare view to modify, or NULL if the router is not running
  */
-esp_err_t midi_router_send(const midi_router_packet_t *packet) {
+static midi_router_view_t *midi_router_config_begin(void) {
     if (!g_router_state.initialized) {
+        return NULL;
+    }
+    xSemaphoreTake(g_router_state.config_mutex, portMAX_DELAY);
+    midi_router_config_synchronize();
+    
+    midi_router_view_t *next = midi_router_spare_view();
+    next->config = g_router_state.active_view->config;
+    return next;
+}
+
+/**
+ * @brief Abandon a config change
+ */
+static void midi_router_config_abort(void) {
+    midi_router_config_unlock();
+}
+
+/**
+ * @brief Compile and publish the spare view
+ * 
+ * Workers pick up the new view at their next packet; packets already
+ * being fanned out finish with the old one, which the next writer
+ * waits out before reusing it. Routing never waits.
+ */
+static esp_err_t midi_router_config_publish(midi_router_view_t *next) {
+    esp_err_t err = midi_router_view_compile(next);
+    if (err == ESP_OK) {
+        midi_router_view_publish(next);
+    }
+    
+    midi_router_config_unlock();
+    return err;
+}
+
+/**
+ * @brief Set destination overload policy
+ */
+esp_err_t midi_router_set_dest_policy(midi_transport_t destination,
+                                       const midi_dest_policy_t *policy) {
+    if (destination >= MIDI_TRANSPORT_COUNT || !policy) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    midi_router_view_t *next = midi_router_config_begin();
+    if (!next) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    next->config.dest_policies[destination] = *policy;
+    return midi_router_config_publish(next);
+}
+
+/**
+ * @brief Set input filter
+ */
+esp_err_t midi_router_set_filter(midi_transport_t transport,
+                                  const midi_filter_t *filter) {
+    if (transport >= MIDI_TRANSPORT_COUNT || !filter) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    midi_router_view_t *next = midi_router_config_begin();
+    if (!next) {
         return ESP_ERR_INVALID_STATE;
     }
+    next->config.input_filters[transport] = *filter;
+    return midi_router_config_publish(next);
+}
+
+/**
+ * @brief Replace rule list
+ */
+esp_err_t midi_router_set_rules(const midi_rule_t *rules, uint8_t count) {
+    if (count > MIDI_RULES_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (count && !rules) {
+        return ESP_ERR_INVALID_ARG;
+    }
     
-    if (xQueueSend(g_router_state.packet_queue, packet, 0) != pdTRUE) {
-        g_router_state.stats.packets_dropped[packet->source]++;
-        return ESP_ERR_NO_MEM;  // Queue full
+    midi_router_view_t *next = midi_router_config_begin();
+    if (!next) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (count) {
+        memcpy(next->config.rules, rules, count * sizeof(midi_rule_t));
+    }
+    next->config.num_rules = count;
+    
+    // Rules that do not compile leave the active ones in place
+    return midi_router_config_publish(next);
+}
+
+/**
+ * @brief Set routing matrix entry
+ */
+esp_err_t midi_router_set_route(midi_transport_t source,
+                                 midi_transport_t destination,
+                                 bool enable) {
+    if (source >= MIDI_TRANSPORT_COUNT || destination >= MIDI_TRANSPORT_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    midi_router_view_t *next = midi_router_config_begin();
+    if (!next) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    next->config.routing_matrix[source][destination] = enable;
+    esp_err_t err = midi_router_config_publish(next);
+    
+    ESP_LOGD(TAG, "Route %s → %s %s", midi_router_get_transport_name(source),
+             midi_router_get_transport_name(destination),
+             enable ? "enabled" : "disabled");
+    return err;
+}
+
+/**
+ * @brief Get routing matrix entry
+ */
+esp_err_t midi_router_get_route(midi_transport_t source,
+                                 midi_transport_t destination,
+                                 bool *enabled) {
+    if (source >= MIDI_TRANSPORT_COUNT || destination >= MIDI_TRANSPORT_COUNT || !enabled) {
+        return ESP_ERR_INVALID_ARG;
     }
     
+    *enabled = router_view()->config.routing_matrix[source][destination];
     return ESP_OK;
 }
 
 /**
- * @brief Register transport TX callback
+ * @brief Enable/disable merge mode
  */
-esp_err_t midi_router_register_transport_tx(midi_transport_t transport,
-                                             esp_err_t (*tx_callback)(const midi_router_packet_t *)) {
-    if (transport >= MIDI_TRANSPORT_COUNT) {
+esp_err_t midi_router_set_merge_mode(bool enable) {
+    midi_router_view_t *next = midi_router_config_begin();
+    if (!next) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    next->config.merge_inputs = enable;
+    esp_err_t err = midi_router_config_publish(next);
+    
+    ESP_LOGI(TAG, "Merge mode %s", enable ? "enabled" : "disabled");
+    return err;
+}
+
+/**
+ * @brief Replace the whole configuration in one step
+ */
+esp_err_t midi_router_set_config(const midi_router_config_t *config) {
+    if (!config) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    // Before init (boot load): the config becomes the first view
+    if (!g_router_state.initialized) {
+        g_router_state.views[0].config = *config;
+        return ESP_OK;
+    }
+    
+    midi_router_view_t *next = midi_router_config_begin();
+    next->config = *config;
+    midi_router_keep_layout(&next->config);
+    return midi_router_config_publish(next);
+}
+
+/**
+ * @brief Get a consistent copy of the configuration
+ */
+esp_err_t midi_router_get_config(midi_router_config_t *config) {
+    if (!config) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    if (!g_router_state.initialized) {
+        *config = g_router_state.views[0].config;
+        return ESP_OK;
+    }
+    
+    // Holding the writer lock keeps the active view from being recycled
+    xSemaphoreTake(g_router_state.config_mutex, portMAX_DELAY);
+    *config = g_router_state.active_view->config;
+    xSemaphoreGive(g_router_state.config_mutex);
+    return ESP_OK;
+}
+
+//=============================================================================
+// Preset Bank
+//=============================================================================
+
+/**
+ * @brief Store a preset
+ */
+esp_err_t midi_router_preset_store(uint8_t index, const midi_router_config_t *config) {
+    if (index >= MIDI_ROUTER_PRESETS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    // Compile into the spare view first: a bad config leaves the slot alone
+    midi_router_view_t *next = midi_router_config_begin();
+    if (!next) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (config) {
+        next->config = *config;
+    }
+    midi_router_keep_layout(&next->config);
+    esp_err_t err = midi_router_view_compile(next);
+    if (err != ESP_OK) {
+        midi_router_config_abort();
+        return err;
+    }
+    
+    midi_router_view_t *slot = &g_router_state.presets[index];
+    bool was_active = (g_router_state.active_view == slot);
+    if (was_active) {
+        // Move the workers off the slot before rewriting it
+        midi_router_view_publish(next);
+        midi_router_config_synchronize();
+    }
+    
+    *slot = *next;
+    g_router_state.preset_valid |= 1u << index;
+    if (was_active) {
+        midi_router_view_publish(slot);
+    }
+    
+    midi_router_config_unlock();
+    return ESP_OK;
+}
+
+/**
+ * @brief Switch to a preset
+ */
+esp_err_t midi_router_preset_recall(uint8_t index) {
+    if (index >= MIDI_ROUTER_PRESETS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!g_router_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    xSemaphoreTake(g_router_state.config_mutex, portMAX_DELAY);
+    if (!(g_router_state.preset_valid & (1u << index))) {
+        midi_router_config_unlock();
+        return ESP_ERR_NOT_FOUND;
+    }
+    
+    // Precompiled: publishing the pointer is the whole switch
+    midi_router_view_publish(&g_router_state.presets[index]);
+    midi_router_config_unlock();
+    return ESP_OK;
+}
+
+/**
+ * @brief Delete a preset and its saved copy
+ */
+esp_err_t midi_router_preset_erase(uint8_t index) {
+    if (index >= MIDI_ROUTER_PRESETS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!g_router_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    // An active preset stays in effect; its slot is only rewritten by store
+    xSemaphoreTake(g_router_state.config_mutex, portMAX_DELAY);
+    g_router_state.preset_valid &= ~(1u << index);
+    midi_router_config_unlock();
+    
+    char name[MIDI_CONFIG_NAME_MAX + 1];
+    snprintf(name, sizeof(name), ROUTER_PRESET_NAME, (unsigned)index);
+    return s_config_store->erase(s_config_store, name);
+}
+
+/**
+ * @brief Save a preset
+ */
+esp_err_t midi_router_preset_save(uint8_t index) {
+    static midi_router_config_t preset;
+    
+    if (index >= MIDI_ROUTER_PRESETS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!g_router_state.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    xSemaphoreTake(g_router_state.config_mutex, portMAX_DELAY);
+    bool valid = g_router_state.preset_valid & (1u << index);
+    if (valid) {
+        preset = g_router_state.presets[index].config;
+    }
+    midi_router_config_unlock();
+    if (!valid) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    
+    char name[MIDI_CONFIG_NAME_MAX + 1];
+    snprintf(name, sizeof(name), ROUTER_PRESET_NAME, (unsigned)index);
+    return midi_router_write_blob(name, &preset);
+}
+
+/**
+ * @brief Get active preset
+ */
+int midi_router_get_active_preset(void) {
+    return g_router_state.initialized ? g_router_state.active_preset : -1;
+}
+
+/**
+ * @brief Set preset triggers
+ */
+esp_err_t midi_router_set_preset_trigger(const midi_router_preset_trigger_t *trigger) {
+    if (!trigger || trigger->control_channel > 15 || trigger->control_group > 15) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    uint32_t packed = (trigger->program_change ? PRESET_TRIG_PC : 0) |
+                      (trigger->sysex ? PRESET_TRIG_SYSEX : 0) |
+                      (trigger->consume ? PRESET_TRIG_CONSUME : 0) |
+                      ((uint32_t)trigger->control_channel << 4) |
+                      ((uint32_t)trigger->control_group << 8) |
+                      ((uint32_t)trigger->source_mask << 16);
+    __atomic_store_n(&s_preset_trigger, packed, __ATOMIC_RELAXED);
+    return ESP_OK;
+}
+
+//=============================================================================
+// Configuration Persistence
+//=============================================================================
+
+/**
+ * @brief Fill in the default configuration
+ */
+void midi_router_get_default_config(midi_router_config_t *config) {
+    memset(config, 0, sizeof(*config));
+    
+    // Every input to every other output
+    for (int src = 0; src < MIDI_TRANSPORT_COUNT; src++) {
+        for (int dest = 0; dest < MIDI_TRANSPORT_COUNT; dest++) {
+            config->routing_matrix[src][dest] = (src != dest);
+        }
+    }
+    
+    config->auto_translate = true;
+    config->merge_inputs = false;
+    config->default_group = 0;
+    
+    for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+        config->dest_policies[t] = MIDI_DEST_POLICY_DEFAULT();
+        config->dest_policies[t].active_sensing = (t == MIDI_TRANSPORT_UART);   // DIN gear only
+        
+        // Wired transports on worker 0, network on worker 1
+        config->source_worker[t] = midi_router_is_network(t) ? 1 : 0;
+        config->dest_worker[t] = config->source_worker[t];
+    }
+}
+
+/**
+ * @brief Select where the configuration is persisted
+ */
+esp_err_t midi_router_set_config_store(const midi_config_store_t *store) {
+    s_config_store = store ? store : midi_config_store_nvs();
+    return ESP_OK;
+}
+
+/**
+ * @brief Save configuration
+ */
+esp_err_t midi_router_save_config(void) {
+    static midi_router_config_t current;
+    
+    midi_router_get_config(&current);
+    return midi_router_write_blob(ROUTER_CONFIG_NAME, &current);
+}
+
+/**
+ * @brief Load configuration
+ */
+esp_err_t midi_router_load_config(void) {
+    static midi_router_config_t loaded;
+    
+    esp_err_t err = midi_router_read_blob(ROUTER_CONFIG_NAME, &loaded);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return midi_router_set_config(&loaded);
+}
+
+/**
+ * @brief Reset configuration to defaults
+ */
+esp_err_t midi_router_reset_config(void) {
+    static midi_router_config_t defaults;
+    
+    midi_router_get_default_config(&defaults);
+    return midi_router_set_config(&defaults);
+}
+
+/**
+ * @brief Get init timing
+ */
+esp_err_t midi_router_get_boot_timing(midi_router_boot_timing_t *timing) {
+    if (!timing) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    *timing = g_router_state.boot_timing;
+    return ESP_OK;
+}
+
+//=============================================================================
+// Statistics
+//=============================================================================
+
+// Counters that add across shards and subtract between snapshots
+#define ROUTER_STATS_COUNTERS(X) \
+    X(packets_routed) X(packets_dropped) X(packets_filtered) \
+    X(translations_1to2) X(translations_2to1) X(translations_1to1) X(routing_errors) \
+    X(packets_shed) X(packets_coalesced) X(critical_dropped) X(tx_retries) \
+    X(cc_thinned) X(cc_deferred) X(notes_released) X(active_sensing_sent) \
+    X(duplicates_dropped) X(loops_dropped) X(class_packets) X(handoff_dropped)
+
+/**
+ * @brief Fold every current shard into one set of totals
+ */
+static void midi_router_stats_fold(midi_router_stats_t *out) {
+    uint64_t latency_sum[MIDI_PRIO_COUNT] = {0};
+    
+    memset(out, 0, sizeof(*out));
+    
+    for (int i = 0; i < ROUTER_STATS_SHARDS; i++) {
+        const midi_router_stats_shard_t *shard = &g_router_state.stats_shards[i];
+        if (!midi_stats_shard_current(&g_router_state.stats_epoch, &shard->generation)) {
+            continue;  // Not written since the last reset
+        }
+        const midi_router_stats_t *in = &shard->stats;
+        
+#define ROUTER_STATS_ADD(field) midi_stats_add_u32(&out->field, &in->field, sizeof(out->field));
+        ROUTER_STATS_COUNTERS(ROUTER_STATS_ADD)
+#undef ROUTER_STATS_ADD
+        
+        for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+            if (in->queue_high_water[t] > out->queue_high_water[t]) {
+                out->queue_high_water[t] = in->queue_high_water[t];
+            }
+        }
+        for (int c = 0; c < MIDI_PRIO_COUNT; c++) {
+            latency_sum[c] += (uint64_t)in->class_latency_avg_us[c] * in->class_packets[c];
+            if (in->class_latency_max_us[c] > out->class_latency_max_us[c]) {
+                out->class_latency_max_us[c] = in->class_latency_max_us[c];
+            }
+            if (in->class_queue_high_water[c] > out->class_queue_high_water[c]) {
+                out->class_queue_high_water[c] = in->class_queue_high_water[c];
+            }
+        }
+    }
+    
+    // Shard averages weighted by the packets behind them
+    for (int c = 0; c < MIDI_PRIO_COUNT; c++) {
+        if (out->class_packets[c]) {
+            out->class_latency_avg_us[c] = (uint32_t)(latency_sum[c] / out->class_packets[c]);
+        }
+    }
+    
+    // Thinning is counted by the transports' coalescers
+    for (int dest = 0; dest < MIDI_TRANSPORT_COUNT; dest++) {
+        const midi_coalescer_t *c = g_router_state.coalescers[dest];
+        if (c) {
+            out->cc_thinned[dest] = c->stats.thinned - g_router_state.cc_thinned_base[dest];
+            out->cc_deferred[dest] = c->stats.sent_deferred - g_router_state.cc_deferred_base[dest];
+        }
+    }
+}
+
+/**
+ * @brief Get statistics
+ */
+esp_err_t midi_router_get_stats(midi_router_stats_t *stats) {
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    midi_router_stats_fold(stats);
+    return ESP_OK;
+}
+
+/**
+ * @brief Get statistics with the time they were taken
+ */
+esp_err_t midi_router_get_stats_snapshot(midi_router_stats_snapshot_t *snapshot) {
+    if (!snapshot) {
         return ESP_ERR_INVALID_ARG;
     }
     
-    g_router_state.transport_tx_callbacks[transport] = tx_callback;
-    ESP_LOGI(TAG, "Registered TX callback for %s", transport_names[transport]);
+    snapshot->generation = midi_stats_epoch_current(&g_router_state.stats_epoch);
+    snapshot->timestamp_us = esp_timer_get_time();
+    midi_router_stats_fold(&snapshot->stats);
+    return ESP_OK;
+}
+
+/**
+ * @brief Counter changes between two snapshots
+ */
+esp_err_t midi_router_stats_delta(const midi_router_stats_snapshot_t *older,
+                                  const midi_router_stats_snapshot_t *newer,
+                                  midi_router_stats_t *delta) {
+    if (!older || !newer || !delta) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    // Gauges (averages, maxima, high water) are taken from the newer one
+    *delta = newer->stats;
+    if (older->generation != newer->generation) {
+        return ESP_OK;  // Reset in between: newer counts are all since then
+    }
+    
+    const midi_router_stats_t *n = &newer->stats;
+    const midi_router_stats_t *o = &older->stats;
+#define ROUTER_STATS_SUB(field) midi_stats_delta_u32(&delta->field, &n->field, &o->field, sizeof(delta->field));
+    ROUTER_STATS_COUNTERS(ROUTER_STATS_SUB)
+#undef ROUTER_STATS_SUB
     
     return ESP_OK;
 }
 
-// ... (additional functions: set_route, get_route, save_config, etc.)
-// [Implementation continues with NVS operations, config management]
+/**
+ * @brief Reset statistics
+ * 
+ * Safe from any task: writers zero their own shards when they next run.
+ */
+esp_err_t midi_router_reset_stats(void) {
+    for (int dest = 0; dest < MIDI_TRANSPORT_COUNT; dest++) {
+        const midi_coalescer_t *c = g_router_state.coalescers[dest];
+        g_router_state.cc_thinned_base[dest] = c ? c->stats.thinned : 0;
+        g_router_state.cc_deferred_base[dest] = c ? c->stats.sent_deferred : 0;
+    }
+    midi_stats_epoch_advance(&g_router_state.stats_epoch);
+    return ESP_OK;
+}
 
 /**
  * @brief Get transport name
  */
 const char* midi_router_get_transport_name(midi_transport_t transport) {
-    if (transport < MIDI_TRANSPORT_COUNT) {
-        return transport_names[transport];
+    if (transport >= MIDI_TRANSPORT_COUNT) {
+        return "Unknown";
     }
-    return "Unknown";
+    const midi_transport_ops_t *ops = __atomic_load_n(&s_ports[transport].ops, __ATOMIC_ACQUIRE);
+    return (ops && ops->name) ? ops->name : port_labels[transport];
 }
 
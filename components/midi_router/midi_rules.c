@@ -0,0 +1,466 @@
+/**
+ * @file midi_rules.c
+ * @brief Router Rule Engine Implementation
+ */
+
+#include "midi_rules.h"
+#include "midi_defs.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "midi_rules";
+
+#define FIELD_NONE 0xFF
+
+/**
+ * @brief Fields extracted from a message for matching
+ */
+typedef struct {
+    midi_msg_class_t cls;
+    uint8_t group;
+    uint8_t channel;    /**< FIELD_NONE if channel-less */
+    uint8_t data1;      /**< Note / controller number, FIELD_NONE if absent */
+    uint8_t value7;     /**< Value on 7-bit scale, FIELD_NONE if absent */
+} rule_view_t;
+
+//=============================================================================
+// Compilation
+//=============================================================================
+
+esp_err_t midi_rules_compile(const midi_rule_t *rules, uint8_t count,
+                             midi_rule_table_t *table) {
+    if (!table || (count && !rules)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (count > MIDI_RULES_MAX) {
+        ESP_LOGE(TAG, "Too many rules: %d (max %d)", count, MIDI_RULES_MAX);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Validate everything before touching the output table
+    for (int i = 0; i < count; i++) {
+        const midi_rule_t *r = &rules[i];
+        if (r->action >= MIDI_RULE_ACTION_COUNT ||
+            (r->match_data1 && (r->data1_min > r->data1_max || r->data1_max > 127)) ||
+            (r->match_value && (r->value_min > r->value_max || r->value_max > 127))) {
+            ESP_LOGE(TAG, "Rule %d: invalid match or action", i);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if ((r->action == MIDI_RULE_ACTION_REMAP_CHANNEL && (r->param < 0 || r->param > 15)) ||
+            (r->action == MIDI_RULE_ACTION_REWRITE_CC && (r->param < 0 || r->param > 127)) ||
+            (r->action == MIDI_RULE_ACTION_TRANSPOSE && (r->param < -127 || r->param > 127)) ||
+            (r->action == MIDI_RULE_ACTION_SCALE && r->param < 0)) {
+            ESP_LOGE(TAG, "Rule %d: parameter %d out of range", i, r->param);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    memset(table, 0, sizeof(*table));
+
+    for (int i = 0; i < count; i++) {
+        const midi_rule_t *r = &rules[i];
+        midi_rule_entry_t *e = &table->entries[i];
+
+        e->group_mask = r->group_mask ? r->group_mask : 0xFFFF;
+        e->channel_mask = r->channel_mask ? r->channel_mask : 0xFFFF;
+        e->class_mask = r->class_mask ? r->class_mask : MIDI_CLASS_MASK_ALL;
+        e->action = (uint8_t)r->action;
+        e->param = r->param;
+        e->offset = r->offset;
+
+        if (r->channel_mask) {
+            e->flags |= MIDI_RULE_F_CHANNEL;
+        }
+        if (r->match_data1) {
+            e->flags |= MIDI_RULE_F_DATA1;
+            for (int n = r->data1_min; n <= r->data1_max; n++) {
+                e->data1_bitmap[n >> 5] |= 1u << (n & 31);
+            }
+        }
+        if (r->match_value) {
+            e->flags |= MIDI_RULE_F_VALUE;
+            e->value_min = r->value_min;
+            e->value_max = r->value_max;
+        }
+        if (r->continue_eval) {
+            e->flags |= MIDI_RULE_F_CONTINUE;
+        }
+
+        table->class_any |= e->class_mask;
+
+        // Expand source/destination masks into per-route entry bitmaps
+        uint16_t src_mask = r->source_mask ? r->source_mask : 0xFFFF;
+        uint16_t dst_mask = r->dest_mask ? r->dest_mask : 0xFFFF;
+        for (int s = 0; s < MIDI_RULES_MAX_TRANSPORTS; s++) {
+            if (!(src_mask & (1u << s))) continue;
+            for (int d = 0; d < MIDI_RULES_MAX_TRANSPORTS; d++) {
+                if (dst_mask & (1u << d)) {
+                    table->route_entries[s][d] |= 1u << i;
+                }
+            }
+        }
+    }
+
+    table->count = count;
+    ESP_LOGI(TAG, "Compiled %d rule(s)", count);
+    return ESP_OK;
+}
+
+//=============================================================================
+// Matching
+//=============================================================================
+
+static inline bool rule_matches(const midi_rule_entry_t *e, const rule_view_t *v) {
+    if (!(e->class_mask & (1u << v->cls)) ||
+        !(e->group_mask & (1u << v->group))) {
+        return false;
+    }
+    if (e->flags & MIDI_RULE_F_CHANNEL) {
+        if (v->channel == FIELD_NONE || !(e->channel_mask & (1u << v->channel))) {
+            return false;
+        }
+    }
+    if (e->flags & MIDI_RULE_F_DATA1) {
+        if (v->data1 == FIELD_NONE ||
+            !(e->data1_bitmap[v->data1 >> 5] & (1u << (v->data1 & 31)))) {
+            return false;
+        }
+    }
+    if (e->flags & MIDI_RULE_F_VALUE) {
+        if (v->value7 == FIELD_NONE || v->value7 < e->value_min || v->value7 > e->value_max) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Scale a value of the given bit width (unipolar or centered)
+ */
+static uint32_t scale_value(uint32_t value, uint8_t bits, bool bipolar,
+                            int16_t percent, int16_t offset7) {
+    int64_t max = (bits == 32) ? 0xFFFFFFFFLL : ((1LL << bits) - 1);
+    int64_t center = bipolar ? (1LL << (bits - 1)) : 0;
+    int64_t v = ((int64_t)value - center) * percent / 100 + center;
+    v += (int64_t)offset7 << (bits - 7);
+    if (v < 0) v = 0;
+    if (v > max) v = max;
+    return (uint32_t)v;
+}
+
+/**
+ * @brief Pop the next matching entry from a route's pending bitmap
+ *
+ * @return Entry index, or -1 when no further entry matches
+ */
+static inline int next_match(const midi_rule_table_t *table, uint32_t *pending,
+                             const rule_view_t *view) {
+    while (*pending) {
+        int i = __builtin_ctz(*pending);
+        *pending &= *pending - 1;
+        if (rule_matches(&table->entries[i], view)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//=============================================================================
+// MIDI 1.0
+//=============================================================================
+
+static void view_from_midi1(const midi_message_t *msg, uint8_t group, rule_view_t *v) {
+    v->cls = midi_msg_class_from_status(msg->status);
+    v->group = group & 0x0F;
+    v->channel = midi_msg_class_has_channel(v->cls) ? (msg->status & 0x0F) : FIELD_NONE;
+    v->data1 = FIELD_NONE;
+    v->value7 = FIELD_NONE;
+
+    switch (v->cls) {
+        case MIDI_CLASS_NOTE_OFF:
+        case MIDI_CLASS_NOTE_ON:
+        case MIDI_CLASS_POLY_PRESSURE:
+        case MIDI_CLASS_CONTROL_CHANGE:
+            v->data1 = msg->data.bytes[0] & 0x7F;
+            v->value7 = msg->data.bytes[1] & 0x7F;
+            break;
+        case MIDI_CLASS_PROGRAM_CHANGE:
+        case MIDI_CLASS_CHANNEL_PRESSURE:
+            v->value7 = msg->data.bytes[0] & 0x7F;
+            break;
+        case MIDI_CLASS_PITCH_BEND:
+            v->value7 = msg->data.bytes[1] & 0x7F;
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Apply one action to a MIDI 1.0 message
+ * @return false if the message must be dropped
+ */
+static bool action_midi1(const midi_rule_entry_t *e, midi_message_t *msg, rule_view_t *v) {
+    switch (e->action) {
+        case MIDI_RULE_ACTION_REMAP_CHANNEL:
+            if (v->channel != FIELD_NONE) {
+                msg->status = (msg->status & 0xF0) | (uint8_t)e->param;
+                msg->channel = (uint8_t)e->param;
+                v->channel = (uint8_t)e->param;
+            }
+            break;
+
+        case MIDI_RULE_ACTION_TRANSPOSE:
+            if ((MIDI_CLASS_MASK_NOTE >> v->cls) & 1u) {
+                int note = msg->data.bytes[0] + e->param;
+                if (note < 0 || note > 127) {
+                    return false;  // Out of range: drop rather than fold
+                }
+                msg->data.bytes[0] = (uint8_t)note;
+                v->data1 = (uint8_t)note;
+            }
+            break;
+
+        case MIDI_RULE_ACTION_SCALE:
+            if (v->cls == MIDI_CLASS_PITCH_BEND) {
+                uint32_t pb = ((uint32_t)msg->data.bytes[1] << 7) | msg->data.bytes[0];
+                pb = scale_value(pb, 14, true, e->param, e->offset);
+                msg->data.bytes[0] = pb & 0x7F;
+                msg->data.bytes[1] = (pb >> 7) & 0x7F;
+                v->value7 = msg->data.bytes[1];
+            } else if (v->cls == MIDI_CLASS_CHANNEL_PRESSURE) {
+                msg->data.bytes[0] = (uint8_t)scale_value(msg->data.bytes[0], 7, false,
+                                                          e->param, e->offset);
+                v->value7 = msg->data.bytes[0];
+            } else if (v->data1 != FIELD_NONE) {
+                uint8_t old = msg->data.bytes[1];
+                uint8_t val = (uint8_t)scale_value(old, 7, false, e->param, e->offset);
+                // Never turn a sounding Note On into a running-status Note Off
+                if (v->cls == MIDI_CLASS_NOTE_ON && old && !val) {
+                    val = 1;
+                }
+                msg->data.bytes[1] = val;
+                v->value7 = val;
+            }
+            break;
+
+        case MIDI_RULE_ACTION_REWRITE_CC:
+            if (v->cls == MIDI_CLASS_CONTROL_CHANGE) {
+                msg->data.bytes[0] = (uint8_t)e->param;
+                v->data1 = (uint8_t)e->param;
+            }
+            break;
+
+        default:
+            break;
+    }
+    return true;
+}
+
+bool midi_rules_apply_midi1(const midi_rule_table_t *table,
+                            uint8_t source, uint8_t dest, uint8_t group,
+                            midi_message_t *msg) {
+    if (!midi_rules_route_active(table, source, dest)) {
+        return true;
+    }
+
+    rule_view_t view;
+    view_from_midi1(msg, group, &view);
+    if (!(table->class_any & (1u << view.cls))) {
+        return true;
+    }
+
+    uint32_t pending = table->route_entries[source][dest];
+    int i;
+    while ((i = next_match(table, &pending, &view)) >= 0) {
+        const midi_rule_entry_t *e = &table->entries[i];
+        if (e->action == MIDI_RULE_ACTION_DROP) {
+            return false;
+        }
+        if (e->action == MIDI_RULE_ACTION_PASS) {
+            return true;
+        }
+        if (!action_midi1(e, msg, &view)) {
+            return false;
+        }
+        if (!(e->flags & MIDI_RULE_F_CONTINUE)) {
+            break;
+        }
+    }
+    return true;
+}
+
+//=============================================================================
+// UMP
+//=============================================================================
+
+static void view_from_ump(const ump_packet_t *ump, rule_view_t *v) {
+    uint32_t w0 = ump->words[0];
+    uint32_t w1 = ump->words[1];
+    uint8_t mt = UMP_GET_MT(w0);
+
+    v->cls = midi_msg_class_from_ump(w0);
+    v->group = UMP_GET_GROUP(w0);
+    v->channel = midi_msg_class_has_channel(v->cls) ? UMP_GET_CHANNEL(w0) : FIELD_NONE;
+    v->data1 = FIELD_NONE;
+    v->value7 = FIELD_NONE;
+
+    if (mt == UMP_MT_MIDI1_CHANNEL_VOICE) {
+        uint8_t d1 = (w0 >> 8) & 0x7F;
+        uint8_t d2 = w0 & 0x7F;
+        switch (v->cls) {
+            case MIDI_CLASS_NOTE_OFF:
+            case MIDI_CLASS_NOTE_ON:
+            case MIDI_CLASS_POLY_PRESSURE:
+            case MIDI_CLASS_CONTROL_CHANGE:
+                v->data1 = d1;
+                v->value7 = d2;
+                break;
+            case MIDI_CLASS_PROGRAM_CHANGE:
+            case MIDI_CLASS_CHANNEL_PRESSURE:
+                v->value7 = d1;
+                break;
+            case MIDI_CLASS_PITCH_BEND:
+                v->value7 = d2;
+                break;
+            default:
+                break;
+        }
+    } else if (mt == UMP_MT_MIDI2_CHANNEL_VOICE) {
+        switch (v->cls) {
+            case MIDI_CLASS_NOTE_OFF:
+            case MIDI_CLASS_NOTE_ON:
+                v->data1 = (w0 >> 8) & 0x7F;
+                v->value7 = w1 >> 25;
+                break;
+            case MIDI_CLASS_POLY_PRESSURE:
+            case MIDI_CLASS_CONTROL_CHANGE:
+            case MIDI_CLASS_PER_NOTE:
+                v->data1 = (w0 >> 8) & 0x7F;
+                v->value7 = w1 >> 25;
+                break;
+            case MIDI_CLASS_PARAMETER:
+                v->data1 = w0 & 0x7F;
+                v->value7 = w1 >> 25;
+                break;
+            case MIDI_CLASS_PROGRAM_CHANGE:
+                v->value7 = (w1 >> 24) & 0x7F;
+                break;
+            case MIDI_CLASS_CHANNEL_PRESSURE:
+            case MIDI_CLASS_PITCH_BEND:
+                v->value7 = w1 >> 25;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Apply one action to a UMP
+ * @return false if the packet must be dropped
+ */
+static bool action_ump(const midi_rule_entry_t *e, ump_packet_t *ump, rule_view_t *v) {
+    uint32_t *w = ump->words;
+    bool midi2 = (UMP_GET_MT(w[0]) == UMP_MT_MIDI2_CHANNEL_VOICE);
+
+    switch (e->action) {
+        case MIDI_RULE_ACTION_REMAP_CHANNEL:
+            if (v->channel != FIELD_NONE) {
+                w[0] = (w[0] & ~0x000F0000u) | ((uint32_t)e->param << 16);
+                v->channel = (uint8_t)e->param;
+            }
+            break;
+
+        case MIDI_RULE_ACTION_TRANSPOSE:
+            if ((MIDI_CLASS_MASK_NOTE >> v->cls) & 1u) {
+                int note = (int)((w[0] >> 8) & 0x7F) + e->param;
+                if (note < 0 || note > 127) {
+                    return false;
+                }
+                w[0] = (w[0] & ~0x00007F00u) | ((uint32_t)note << 8);
+                v->data1 = (uint8_t)note;
+            }
+            break;
+
+        case MIDI_RULE_ACTION_SCALE:
+            if (v->value7 == FIELD_NONE || v->cls == MIDI_CLASS_PROGRAM_CHANGE) {
+                break;
+            }
+            if (!midi2) {
+                if (v->cls == MIDI_CLASS_PITCH_BEND) {
+                    uint32_t pb = ((w[0] & 0x7F) << 7) | ((w[0] >> 8) & 0x7F);
+                    pb = scale_value(pb, 14, true, e->param, e->offset);
+                    w[0] = (w[0] & ~0x00007F7Fu) | ((pb & 0x7F) << 8) | ((pb >> 7) & 0x7F);
+                    v->value7 = (pb >> 7) & 0x7F;
+                } else if (v->cls == MIDI_CLASS_CHANNEL_PRESSURE) {
+                    uint32_t val = scale_value((w[0] >> 8) & 0x7F, 7, false, e->param, e->offset);
+                    w[0] = (w[0] & ~0x00007F00u) | (val << 8);
+                    v->value7 = (uint8_t)val;
+                } else {
+                    uint32_t old = w[0] & 0x7F;
+                    uint32_t val = scale_value(old, 7, false, e->param, e->offset);
+                    if (v->cls == MIDI_CLASS_NOTE_ON && old && !val) {
+                        val = 1;
+                    }
+                    w[0] = (w[0] & ~0x0000007Fu) | val;
+                    v->value7 = (uint8_t)val;
+                }
+            } else if (v->cls == MIDI_CLASS_NOTE_ON || v->cls == MIDI_CLASS_NOTE_OFF) {
+                uint32_t vel = scale_value(w[1] >> 16, 16, false, e->param, e->offset);
+                w[1] = (w[1] & 0x0000FFFFu) | (vel << 16);
+                v->value7 = vel >> 9;
+            } else {
+                bool centered = (v->cls == MIDI_CLASS_PITCH_BEND) ||
+                                (v->cls == MIDI_CLASS_PER_NOTE &&
+                                 ((w[0] >> 20) & 0x0F) == (MIDI2_STATUS_PER_NOTE_PITCH >> 4));
+                w[1] = scale_value(w[1], 32, centered, e->param, e->offset);
+                v->value7 = w[1] >> 25;
+            }
+            break;
+
+        case MIDI_RULE_ACTION_REWRITE_CC:
+            if (v->cls == MIDI_CLASS_CONTROL_CHANGE) {
+                w[0] = (w[0] & ~0x00007F00u) | ((uint32_t)e->param << 8);
+                v->data1 = (uint8_t)e->param;
+            }
+            break;
+
+        default:
+            break;
+    }
+    return true;
+}
+
+bool midi_rules_apply_ump(const midi_rule_table_t *table,
+                          uint8_t source, uint8_t dest,
+                          ump_packet_t *ump) {
+    if (!midi_rules_route_active(table, source, dest)) {
+        return true;
+    }
+
+    rule_view_t view;
+    view_from_ump(ump, &view);
+    if (!(table->class_any & (1u << view.cls))) {
+        return true;
+    }
+
+    uint32_t pending = table->route_entries[source][dest];
+    int i;
+    while ((i = next_match(table, &pending, &view)) >= 0) {
+        const midi_rule_entry_t *e = &table->entries[i];
+        if (e->action == MIDI_RULE_ACTION_DROP) {
+            return false;
+        }
+        if (e->action == MIDI_RULE_ACTION_PASS) {
+            return true;
+        }
+        if (!action_ump(e, ump, &view)) {
+            return false;
+        }
+        if (!(e->flags & MIDI_RULE_F_CONTINUE)) {
+            break;
+        }
+    }
+    return true;
+}
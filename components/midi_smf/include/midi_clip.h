@@ -0,0 +1,176 @@
+/**
+ * @file midi_clip.h
+ * @brief Streaming MIDI Clip File (MIDI 2.0) Recorder and Player
+ *
+ * The Clip File is the MIDI 2.0 counterpart of a single-track SMF: UMP
+ * messages, each preceded by a Delta Clockstamp, so 32-bit controllers,
+ * per-note data and 16-bit velocities survive a round trip that SMF
+ * would reduce to MIDI 1.0.
+ *
+ * File layout written (UMP words big-endian):
+ *   "SMF2CLIP"
+ *   header     DC 0, DCTPQ (ticks per quarter note)
+ *   sequence   DC 0, Start of Clip, DC 0, Set Tempo (Flex Data),
+ *              { DC ticks, UMP } ..., DC ticks, End of Clip
+ *
+ * The writer takes the UMP records of a capture (midi_capture.h) as the
+ * SMF writer takes MIDI 1.0 ones, draining a live ring so a session
+ * streams to flash or SD in bounded memory. A clip has no port field:
+ * record one transport per file, or expect their groups to merge. The
+ * player reads through one small window and sends every message into
+ * the router as UMP at its time, following tempo changes.
+ */
+
+#ifndef MIDI_CLIP_H
+#define MIDI_CLIP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "midi_router.h"
+#include "midi_capture.h"
+#include "midi_smf.h"
+#include "ump_types.h"
+
+#define MIDI_CLIP_MAGIC         "SMF2CLIP"
+#define MIDI_CLIP_MAGIC_SIZE    8
+
+//=============================================================================
+// Writer
+//=============================================================================
+
+/**
+ * @brief Clip writer settings
+ *
+ * As with SMF, ticks are tempo_us / tpq microseconds long; tpq equal to
+ * tempo_us keeps capture time to the microsecond.
+ */
+typedef struct {
+    uint16_t tpq;                 /**< Delta clockstamp ticks per quarter note (0 = 960) */
+    uint32_t tempo_us;            /**< Microseconds per quarter note (0 = 500000, 120 BPM) */
+    uint32_t transports;          /**< Bit per transport ID to record (0 = all) */
+    bool outputs;                 /**< Record output records (what was sent) instead of input */
+    midi_capture_write_fn_t write; /**< Appends to the file */
+    void *ctx;
+} midi_clip_writer_config_t;
+
+/**
+ * @brief Clip writer state
+ */
+typedef struct {
+    midi_clip_writer_config_t config;
+    esp_err_t error;              /**< First sink error (sticky) */
+    size_t offset;                /**< Bytes handed to the sink */
+    uint8_t out[MIDI_SMF_WRITE_CHUNK];
+    size_t out_len;
+    bool started;                 /**< First message seen, origin_us set */
+    uint64_t origin_us;           /**< Capture time of tick 0 */
+    uint64_t last_tick;
+    uint8_t record[MIDI_SMF_RECORD_MAX];
+
+    uint32_t records;             /**< Capture records consumed */
+    uint32_t events;              /**< UMP messages written */
+    uint32_t skipped;             /**< Records that are not UMP, and utility messages */
+    uint32_t dropped;             /**< Records too large, or with a truncated message */
+} midi_clip_writer_t;
+
+/**
+ * @brief Start a clip: file header, clip header, Start of Clip and tempo
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, or the sink's error
+ */
+esp_err_t midi_clip_writer_begin(midi_clip_writer_t *writer, const midi_clip_writer_config_t *config);
+
+/**
+ * @brief Add one capture record (records in time order)
+ *
+ * @return ESP_OK, or the sink's error
+ */
+esp_err_t midi_clip_writer_record(midi_clip_writer_t *writer, const midi_capture_record_t *record);
+
+/**
+ * @brief Move everything in a capture ring into the clip
+ *
+ * @param written Output: records consumed (may be NULL)
+ * @return ESP_OK, or the sink's error
+ */
+esp_err_t midi_clip_writer_drain(midi_clip_writer_t *writer, midi_capture_t *cap, uint32_t *written);
+
+/**
+ * @brief Write End of Clip
+ *
+ * @return ESP_OK, or the first sink error of the whole recording
+ */
+esp_err_t midi_clip_writer_end(midi_clip_writer_t *writer);
+
+//=============================================================================
+// Player
+//=============================================================================
+
+/**
+ * @brief Clip player settings
+ */
+typedef struct {
+    midi_smf_read_fn_t read;      /**< Access to the file */
+    void *ctx;
+    size_t size;                  /**< File length in bytes */
+    midi_transport_t source;      /**< Transport messages enter the router from */
+    uint16_t speed;               /**< 1 = as written, N = N times faster, 0 = unpaced */
+    int64_t start_at_us;          /**< Shared time to start at, as for SMF (0 = first poll) */
+} midi_clip_player_config_t;
+
+/**
+ * @brief Clip player state
+ */
+typedef struct {
+    midi_clip_player_config_t config;
+    size_t pos;                   /**< File offset after the buffered window */
+    uint8_t buf[MIDI_SMF_TRACK_BUFFER];
+    uint16_t buf_pos;
+    uint16_t buf_len;
+
+    uint16_t tpq;                 /**< From the DCTPQ message */
+    uint32_t tempo_10ns;          /**< Tempo from tempo_tick on, per Set Tempo */
+    uint64_t tempo_tick;
+    uint64_t tempo_time_us;
+    uint64_t tick;                /**< Delta clockstamps summed */
+    bool in_clip;                 /**< Start of Clip seen */
+    bool done;                    /**< End of Clip or end of file */
+    bool has_next;
+    ump_packet_t next;            /**< Message due at tick */
+
+    int64_t start_us;             /**< Shared time */
+    uint64_t time_us;             /**< Clip time of the last message dispatched */
+    uint32_t events;
+    uint32_t refused;
+    uint32_t skipped;             /**< Messages before Start of Clip, truncated ones */
+    uint32_t late_max_us;
+    uint64_t late_sum_us;
+} midi_clip_player_t;
+
+/**
+ * @brief Open a clip and read up to its first message
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_VERSION (not a
+ *         clip file), or the read callback's error
+ */
+esp_err_t midi_clip_player_open(midi_clip_player_t *player, const midi_clip_player_config_t *config);
+
+/**
+ * @brief Send every message that is due (the first call starts the clock)
+ *
+ * @param next_due_us Output: esp_timer time of the next message (may be NULL)
+ * @return ESP_OK while messages remain, ESP_ERR_NOT_FOUND at the end
+ */
+esp_err_t midi_clip_player_poll(midi_clip_player_t *player, int64_t *next_due_us);
+
+/**
+ * @brief Play the whole clip, blocking the calling task
+ *
+ * @param report Output: counters and timing (may be NULL)
+ * @return ESP_OK
+ */
+esp_err_t midi_clip_player_run(midi_clip_player_t *player, midi_smf_report_t *report);
+
+#endif // MIDI_CLIP_H
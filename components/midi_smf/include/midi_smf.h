@@ -0,0 +1,297 @@
+/**
+ * @file midi_smf.h
+ * @brief Streaming Standard MIDI File Recorder and Player
+ *
+ * The writer turns capture records (midi_capture.h) into an SMF type 0
+ * or 1 file as they arrive: MIDI 1.0 byte streams, USB-MIDI 1.0 event
+ * packets and the MIDI 1.0 side of UMP (system, MIDI 1.0 channel voice,
+ * SysEx7) become track events, timed by the capture clock. A recorder
+ * task drains the active capture ring with midi_smf_writer_drain(), so
+ * a DIN session streams to flash or SD through a few hundred bytes of
+ * state no matter how long it runs.
+ *
+ * The player reads a file through a random-access callback, keeping
+ * one small window per track, follows the tempo map and schedules each
+ * event into the router at its time to the microsecond.
+ *
+ * File layout written:
+ *   type 0   one track: name, tempo, events
+ *   type 1   conductor track (name, tempo), then one track of events
+ *
+ * A MIDI Port meta event (FF 21) precedes events whenever the transport
+ * they arrived on changes; the player can use it to feed them back in
+ * from the same transport. A SysEx split across reads is written as a
+ * divided SysEx (F0 then F7 continuation events); realtime and system
+ * common messages as F7 escapes. Active Sensing is not recorded.
+ */
+
+#ifndef MIDI_SMF_H
+#define MIDI_SMF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "esp_err.h"
+#include "midi_router.h"
+#include "midi_capture.h"
+
+#ifdef CONFIG_MIDI_SMF_MAX_TRACKS
+#define MIDI_SMF_MAX_TRACKS     CONFIG_MIDI_SMF_MAX_TRACKS
+#else
+#define MIDI_SMF_MAX_TRACKS     16
+#endif
+
+#ifdef CONFIG_MIDI_SMF_TRACK_BUFFER
+#define MIDI_SMF_TRACK_BUFFER   CONFIG_MIDI_SMF_TRACK_BUFFER
+#else
+#define MIDI_SMF_TRACK_BUFFER   64
+#endif
+
+#ifdef CONFIG_MIDI_SMF_SYSEX_MAX
+#define MIDI_SMF_SYSEX_MAX      CONFIG_MIDI_SMF_SYSEX_MAX
+#else
+#define MIDI_SMF_SYSEX_MAX      256
+#endif
+
+/** Largest capture record midi_smf_writer_drain() copies out */
+#define MIDI_SMF_RECORD_MAX     256
+
+/** Bytes the writer gathers before handing them to the sink */
+#define MIDI_SMF_WRITE_CHUNK    64
+
+/**
+ * @brief Rewrite bytes already written (used once, for the track length)
+ *
+ * @return ESP_OK, or an error that fails midi_smf_writer_end()
+ */
+typedef esp_err_t (*midi_smf_patch_fn_t)(void *ctx, size_t offset, const void *data, size_t len);
+
+/**
+ * @brief Read bytes of the file being played
+ *
+ * @return ESP_OK once len bytes are in data, else an error
+ */
+typedef esp_err_t (*midi_smf_read_fn_t)(void *ctx, size_t offset, void *data, size_t len);
+
+//=============================================================================
+// Writer
+//=============================================================================
+
+/**
+ * @brief Writer settings
+ *
+ * Ticks are tempo_us / division microseconds long; with division equal
+ * to tempo_us a tick is one microsecond and the file keeps capture time
+ * exactly, at the cost of an unmusical tempo in sequencers.
+ */
+typedef struct {
+    uint8_t format;               /**< 0 or 1 */
+    uint16_t division;            /**< Ticks per quarter note (0 = 960) */
+    uint32_t tempo_us;            /**< Microseconds per quarter note (0 = 500000, 120 BPM) */
+    const char *name;             /**< Sequence name (may be NULL) */
+    uint32_t transports;          /**< Bit per transport ID to record (0 = all) */
+    bool outputs;                 /**< Record output records (what was sent) instead of input */
+    midi_capture_write_fn_t write; /**< Appends to the file */
+    midi_smf_patch_fn_t patch;    /**< Fills in the track length at the end */
+    void *ctx;                    /**< Passed to write and patch */
+} midi_smf_writer_config_t;
+
+/**
+ * @brief Message assembly per transport
+ */
+typedef struct {
+    uint8_t status;               /**< Running status, or system common being collected */
+    uint8_t data[2];
+    uint8_t have;                 /**< Data bytes collected */
+    uint8_t need;                 /**< Data bytes the status takes */
+    bool in_sysex;                /**< Inside F0 ... F7 */
+    bool sysex_open;              /**< First SysEx chunk already written */
+} midi_smf_rx_state_t;
+
+/**
+ * @brief Writer state
+ */
+typedef struct {
+    midi_smf_writer_config_t config;
+    esp_err_t error;              /**< First sink error (sticky) */
+    size_t offset;                /**< Bytes handed to the sink */
+    size_t track_length_at;       /**< Offset of the event track's length field */
+    uint8_t out[MIDI_SMF_WRITE_CHUNK];
+    size_t out_len;
+    bool started;                 /**< First event seen, origin_us set */
+    uint64_t origin_us;           /**< Capture time of tick 0 */
+    uint64_t last_tick;
+    uint8_t running;              /**< Running status in the file */
+    uint8_t port;                 /**< Transport of the last port meta event */
+    midi_smf_rx_state_t rx[MIDI_TRANSPORT_COUNT];
+    uint8_t record[MIDI_SMF_RECORD_MAX];
+
+    uint32_t records;             /**< Capture records consumed */
+    uint32_t events;              /**< Track events written (meta events excluded) */
+    uint32_t skipped;             /**< Messages SMF cannot hold (e.g. MIDI 2.0 channel voice) */
+    uint32_t dropped;             /**< Records lost: too large, or before a clean status */
+} midi_smf_writer_t;
+
+/**
+ * @brief Start a file: header, conductor track (type 1), event track header
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG (no write or patch callback,
+ *         format above 1), or the sink's error
+ */
+esp_err_t midi_smf_writer_begin(midi_smf_writer_t *writer, const midi_smf_writer_config_t *config);
+
+/**
+ * @brief Add one capture record
+ *
+ * Records must come in time order, as a capture ring or log holds them.
+ *
+ * @return ESP_OK, or the sink's error
+ */
+esp_err_t midi_smf_writer_record(midi_smf_writer_t *writer, const midi_capture_record_t *record);
+
+/**
+ * @brief Move everything in a capture ring into the file
+ *
+ * Safe while transports keep capturing into the ring; call it from a
+ * recorder task often enough that the ring does not wrap.
+ *
+ * @param writer Writer
+ * @param cap Ring to drain
+ * @param written Output: records consumed (may be NULL)
+ * @return ESP_OK, or the sink's error
+ */
+esp_err_t midi_smf_writer_drain(midi_smf_writer_t *writer, midi_capture_t *cap, uint32_t *written);
+
+/**
+ * @brief Close the event track and fill in its length
+ *
+ * @return ESP_OK, or the first sink error of the whole recording
+ */
+esp_err_t midi_smf_writer_end(midi_smf_writer_t *writer);
+
+//=============================================================================
+// Player
+//=============================================================================
+
+/**
+ * @brief Player settings
+ */
+typedef struct {
+    midi_smf_read_fn_t read;      /**< Random access to the file */
+    void *ctx;
+    size_t size;                  /**< File length in bytes */
+    midi_transport_t source;      /**< Transport events enter the router from */
+    bool follow_ports;            /**< Use the file's port meta events as source instead */
+    uint16_t speed;               /**< 1 = as written, N = N times faster, 0 = unpaced */
+    int64_t start_at_us;          /**< Shared time (midi_timebase.h) to start at, the same on
+                                       every synced device to play in step (0 = first poll) */
+} midi_smf_player_config_t;
+
+/**
+ * @brief Read position in one track
+ */
+typedef struct {
+    size_t pos;                   /**< File offset after the buffered window */
+    size_t end;                   /**< File offset past the track */
+    uint8_t buf[MIDI_SMF_TRACK_BUFFER];
+    uint16_t buf_pos;
+    uint16_t buf_len;
+    uint64_t tick;                /**< Absolute tick of the next event */
+    uint8_t running;              /**< Running status */
+    uint8_t port;                 /**< Last port meta event (0xFF = none) */
+    bool done;
+} midi_smf_track_t;
+
+/**
+ * @brief Player state
+ */
+typedef struct {
+    midi_smf_player_config_t config;
+    uint16_t format;
+    uint16_t num_tracks;
+    uint16_t division;            /**< Ticks per quarter, or SMPTE (bit 15 set) */
+    midi_smf_track_t tracks[MIDI_SMF_MAX_TRACKS];
+
+    uint32_t tempo_us;            /**< Tempo from tempo_tick on */
+    uint64_t tempo_tick;
+    uint64_t tempo_time_us;       /**< File time at tempo_tick */
+
+    uint8_t sysex[MIDI_SMF_SYSEX_MAX];
+    uint16_t sysex_len;
+    bool in_sysex;                /**< Divided SysEx awaiting continuation */
+    bool sysex_overflow;
+
+    int64_t start_us;             /**< When playback started (shared time) */
+    uint64_t time_us;             /**< File time of the last event dispatched */
+    uint32_t events;              /**< Messages offered to the router */
+    uint32_t refused;             /**< Turned away at router ingress */
+    uint32_t skipped;             /**< Events not playable (oversized SysEx, bad escapes) */
+    uint32_t late_max_us;         /**< Worst dispatch delay behind schedule */
+    uint64_t late_sum_us;
+} midi_smf_player_t;
+
+/**
+ * @brief Playback outcome
+ */
+typedef struct {
+    uint32_t events;
+    uint32_t refused;
+    uint32_t skipped;
+    uint32_t duration_us;         /**< File time of the last event */
+    uint32_t elapsed_us;          /**< Wall time of the run */
+    uint32_t late_max_us;         /**< Worst dispatch delay behind schedule */
+    uint32_t late_avg_us;
+} midi_smf_report_t;
+
+/**
+ * @brief Open a file for playback
+ *
+ * Reads the header and finds the tracks; nothing is sent yet.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_VERSION (not an
+ *         SMF), ESP_ERR_NOT_SUPPORTED (type 2, or more tracks than
+ *         MIDI_SMF_MAX_TRACKS), or the read callback's error
+ */
+esp_err_t midi_smf_player_open(midi_smf_player_t *player, const midi_smf_player_config_t *config);
+
+/**
+ * @brief Send every event that is due
+ *
+ * The first call starts the clock, unless start_at_us sets it. Lets a
+ * task that has other work interleave playback with it.
+ *
+ * @param player Player
+ * @param next_due_us Output: esp_timer time of the next event (may be NULL)
+ * @return ESP_OK while events remain, ESP_ERR_NOT_FOUND at the end
+ */
+esp_err_t midi_smf_player_poll(midi_smf_player_t *player, int64_t *next_due_us);
+
+/**
+ * @brief Play the whole file, blocking the calling task
+ *
+ * Sleeps while the next event is more than a tick away and yields in
+ * the last tick before it, so events leave on time to the microsecond
+ * on an idle system.
+ *
+ * @param player Opened player
+ * @param report Output: counters and timing (may be NULL)
+ * @return ESP_OK
+ */
+esp_err_t midi_smf_player_run(midi_smf_player_t *player, midi_smf_report_t *report);
+
+//=============================================================================
+// File Helpers
+//=============================================================================
+
+/**
+ * @brief Sink, patch and read callbacks over a stdio FILE (ctx)
+ *
+ * For files on SPIFFS, FAT (SD) or the host file system. Open the file
+ * "w+b" for recording, "rb" for playback.
+ */
+esp_err_t midi_smf_file_write(void *ctx, const void *data, size_t len);
+esp_err_t midi_smf_file_patch(void *ctx, size_t offset, const void *data, size_t len);
+esp_err_t midi_smf_file_read(void *ctx, size_t offset, void *data, size_t len);
+
+#endif // MIDI_SMF_H
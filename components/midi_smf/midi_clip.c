@@ -0,0 +1,384 @@
+/**
+ * @file midi_clip.c
+ * @brief Streaming MIDI Clip File Recorder and Player Implementation
+ */
+
+#include "midi_clip.h"
+#include "ump_parser.h"
+#include "ump_defs.h"
+#include "midi_timebase.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char *TAG = "MIDI_CLIP";
+
+#define CLIP_DEFAULT_TPQ        960
+#define CLIP_DEFAULT_TEMPO_US   500000
+#define CLIP_DC_MAX             0xFFFFFu    // Delta Clockstamp field is 20 bits
+
+// Flex Data Set Tempo (group-addressed, status bank 0, status 0); word 1 in 10 ns units
+#define CLIP_SET_TEMPO          0xD0100000u
+#define CLIP_SET_TEMPO_MASK     0xF0F0FFFFu
+
+// Words per UMP, by message type
+static const uint8_t ump_words[16] = {
+    1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4
+};
+
+static inline uint32_t clip_utility(uint8_t status, uint32_t value) {
+    return ((uint32_t)UMP_MT_UTILITY << 28) | ((uint32_t)status << 20) | value;
+}
+
+static inline uint32_t clip_stream(uint16_t status) {
+    return ((uint32_t)UMP_MT_UMP_STREAM << 28) | ((uint32_t)status << 16);
+}
+
+//=============================================================================
+// Writer
+//=============================================================================
+
+static void clip_flush(midi_clip_writer_t *w) {
+    if (w->out_len && w->error == ESP_OK) {
+        w->error = w->config.write(w->config.ctx, w->out, w->out_len);
+    }
+    w->out_len = 0;
+}
+
+static void clip_put_word(midi_clip_writer_t *w, uint32_t word) {
+    if (w->out_len + 4 > sizeof(w->out)) {
+        clip_flush(w);
+    }
+    w->out[w->out_len++] = (uint8_t)(word >> 24);
+    w->out[w->out_len++] = (uint8_t)(word >> 16);
+    w->out[w->out_len++] = (uint8_t)(word >> 8);
+    w->out[w->out_len++] = (uint8_t)word;
+    w->offset += 4;
+}
+
+/**
+ * @brief Delta Clockstamp(s) up to a capture time
+ */
+static void clip_put_time(midi_clip_writer_t *w, uint64_t time_us) {
+    if (!w->started) {
+        w->started = true;
+        w->origin_us = time_us;
+    }
+    uint64_t elapsed = time_us > w->origin_us ? time_us - w->origin_us : 0;
+    uint64_t tick = (elapsed * w->config.tpq + w->config.tempo_us / 2) / w->config.tempo_us;
+    uint64_t gap = 0;
+    if (tick > w->last_tick) {
+        gap = tick - w->last_tick;
+        w->last_tick = tick;
+    }
+    // Longer gaps than one clockstamp holds take several in a row
+    while (gap > CLIP_DC_MAX) {
+        clip_put_word(w, clip_utility(UMP_UTILITY_DC_TICKS, CLIP_DC_MAX));
+        gap -= CLIP_DC_MAX;
+    }
+    clip_put_word(w, clip_utility(UMP_UTILITY_DC_TICKS, (uint32_t)gap));
+}
+
+static void clip_put_message(midi_clip_writer_t *w, const uint32_t *words, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        clip_put_word(w, words[i]);
+    }
+}
+
+esp_err_t midi_clip_writer_begin(midi_clip_writer_t *writer, const midi_clip_writer_config_t *config) {
+    if (!writer || !config || !config->write) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(writer, 0, sizeof(*writer));
+    writer->config = *config;
+    if (!writer->config.tpq) {
+        writer->config.tpq = CLIP_DEFAULT_TPQ;
+    }
+    if (!writer->config.tempo_us) {
+        writer->config.tempo_us = CLIP_DEFAULT_TEMPO_US;
+    }
+
+    memcpy(writer->out, MIDI_CLIP_MAGIC, MIDI_CLIP_MAGIC_SIZE);
+    writer->out_len = writer->offset = MIDI_CLIP_MAGIC_SIZE;
+
+    // Clip header, then the sequence opens with Start of Clip and the tempo
+    const uint32_t zero = clip_utility(UMP_UTILITY_DC_TICKS, 0);
+    const uint32_t start[4] = { clip_stream(UMP_STREAM_START_OF_CLIP) };
+    const uint32_t tempo[4] = { CLIP_SET_TEMPO, writer->config.tempo_us * 100u };
+    clip_put_word(writer, zero);
+    clip_put_word(writer, clip_utility(UMP_UTILITY_DCTPQ, writer->config.tpq));
+    clip_put_word(writer, zero);
+    clip_put_message(writer, start, 4);
+    clip_put_word(writer, zero);
+    clip_put_message(writer, tempo, 4);
+
+    clip_flush(writer);
+    return writer->error;
+}
+
+esp_err_t midi_clip_writer_record(midi_clip_writer_t *writer, const midi_capture_record_t *record) {
+    bool output = record->source != MIDI_CAPTURE_NO_SOURCE;
+    if (output != writer->config.outputs || record->transport >= MIDI_TRANSPORT_COUNT ||
+        (writer->config.transports && !(writer->config.transports & (1u << record->transport)))) {
+        return writer->error;
+    }
+    writer->records++;
+    if (record->kind != MIDI_CAPTURE_UMP) {
+        writer->skipped++;   // MIDI 1.0 input belongs in an SMF
+        return writer->error;
+    }
+
+    uint32_t words[UMP_MAX_WORDS];
+    size_t offset = 0;
+    while (offset + 4 <= record->length) {
+        memcpy(&words[0], &record->data[offset], 4);
+        uint8_t count = ump_words[UMP_GET_MT(words[0])];
+        if (offset + count * 4u > record->length) {
+            writer->dropped++;
+            break;
+        }
+        memcpy(words, &record->data[offset], count * 4u);
+        offset += count * 4u;
+        if (UMP_GET_MT(words[0]) == UMP_MT_UTILITY) {
+            writer->skipped++;   // Clockstamps are the file's own; JR timing is per link
+            continue;
+        }
+        clip_put_time(writer, record->time_us);
+        clip_put_message(writer, words, count);
+        writer->events++;
+    }
+    return writer->error;
+}
+
+esp_err_t midi_clip_writer_drain(midi_clip_writer_t *writer, midi_capture_t *cap, uint32_t *written) {
+    midi_capture_record_t rec;
+    uint32_t count = 0;
+    esp_err_t err;
+
+    while ((err = midi_capture_take(cap, &rec, writer->record, sizeof(writer->record))) !=
+           ESP_ERR_NOT_FOUND) {
+        if (err != ESP_OK) {
+            writer->dropped++;
+            continue;
+        }
+        midi_clip_writer_record(writer, &rec);
+        count++;
+    }
+    clip_flush(writer);
+    if (written) {
+        *written = count;
+    }
+    return writer->error;
+}
+
+esp_err_t midi_clip_writer_end(midi_clip_writer_t *writer) {
+    const uint32_t end[4] = { clip_stream(UMP_STREAM_END_OF_CLIP) };
+    clip_put_word(writer, clip_utility(UMP_UTILITY_DC_TICKS, 0));
+    clip_put_message(writer, end, 4);
+    clip_flush(writer);
+
+    ESP_LOGI(TAG, "Clip written: %lu messages, %lu bytes, %lu skipped, %lu dropped",
+             (unsigned long)writer->events, (unsigned long)writer->offset,
+             (unsigned long)writer->skipped, (unsigned long)writer->dropped);
+    return writer->error;
+}
+
+//=============================================================================
+// Player
+//=============================================================================
+
+static bool clip_read_word(midi_clip_player_t *p, uint32_t *word) {
+    uint8_t b[4];
+    for (int i = 0; i < 4; i++) {
+        if (p->buf_pos == p->buf_len) {
+            size_t n = p->config.size - p->pos;
+            if (n > sizeof(p->buf)) {
+                n = sizeof(p->buf);
+            }
+            if (n == 0 || p->config.read(p->config.ctx, p->pos, p->buf, n) != ESP_OK) {
+                return false;
+            }
+            p->pos += n;
+            p->buf_pos = 0;
+            p->buf_len = (uint16_t)n;
+        }
+        b[i] = p->buf[p->buf_pos++];
+    }
+    *word = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+    return true;
+}
+
+static uint64_t clip_tick_time(const midi_clip_player_t *p, uint64_t tick) {
+    return p->tempo_time_us + (tick - p->tempo_tick) * p->tempo_10ns / (100ULL * p->tpq);
+}
+
+/**
+ * @brief Read on to the next message to send, applying clockstamps and tempo
+ *
+ * Single stream, so everything before the message has been sent by now
+ * and a tempo change can take effect as it is read.
+ */
+static void clip_fetch(midi_clip_player_t *p) {
+    uint32_t words[UMP_MAX_WORDS];
+    p->has_next = false;
+
+    while (!p->done) {
+        if (!clip_read_word(p, &words[0])) {
+            p->done = true;
+            break;
+        }
+        uint8_t mt = UMP_GET_MT(words[0]);
+        uint8_t count = ump_words[mt];
+        bool whole = true;
+        for (uint8_t i = 1; i < count && whole; i++) {
+            whole = clip_read_word(p, &words[i]);
+        }
+        if (!whole) {
+            p->skipped++;
+            p->done = true;
+            break;
+        }
+
+        if (mt == UMP_MT_UTILITY) {
+            uint8_t status = (words[0] >> 20) & 0x0F;
+            if (status == UMP_UTILITY_DC_TICKS) {
+                p->tick += words[0] & CLIP_DC_MAX;
+            } else if (status == UMP_UTILITY_DCTPQ && (words[0] & 0xFFFF)) {
+                p->tempo_time_us = clip_tick_time(p, p->tick);
+                p->tempo_tick = p->tick;
+                p->tpq = words[0] & 0xFFFF;
+            }
+            continue;
+        }
+        if (mt == UMP_MT_UMP_STREAM) {
+            uint16_t status = (words[0] >> 16) & 0x3FF;
+            if (status == UMP_STREAM_START_OF_CLIP) {
+                p->in_clip = true;
+                continue;
+            }
+            if (status == UMP_STREAM_END_OF_CLIP) {
+                p->done = true;
+                break;
+            }
+        }
+        if ((words[0] & CLIP_SET_TEMPO_MASK) == CLIP_SET_TEMPO && words[1]) {
+            p->tempo_time_us = clip_tick_time(p, p->tick);
+            p->tempo_tick = p->tick;
+            p->tempo_10ns = words[1];
+            continue;
+        }
+        if (!p->in_clip) {
+            p->skipped++;   // Header content other than timing is not played
+            continue;
+        }
+        if (ump_parser_parse_packet(words, &p->next) == ESP_OK) {
+            p->has_next = true;
+            break;
+        }
+        p->skipped++;
+    }
+}
+
+esp_err_t midi_clip_player_open(midi_clip_player_t *player, const midi_clip_player_config_t *config) {
+    if (!player || !config || !config->read || config->source >= MIDI_TRANSPORT_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(player, 0, sizeof(*player));
+    player->config = *config;
+    player->tpq = CLIP_DEFAULT_TPQ;
+    player->tempo_10ns = CLIP_DEFAULT_TEMPO_US * 100u;
+
+    uint8_t magic[MIDI_CLIP_MAGIC_SIZE];
+    if (config->size < sizeof(magic)) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    esp_err_t err = config->read(config->ctx, 0, magic, sizeof(magic));
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (memcmp(magic, MIDI_CLIP_MAGIC, sizeof(magic)) != 0) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    player->pos = sizeof(magic);
+
+    clip_fetch(player);
+    ESP_LOGI(TAG, "Clip opened: %u ticks per quarter, %lu us per quarter", player->tpq,
+             (unsigned long)(player->tempo_10ns / 100));
+    return ESP_OK;
+}
+
+esp_err_t midi_clip_player_poll(midi_clip_player_t *player, int64_t *next_due_us) {
+    int64_t now = midi_timebase_now_us(); // Paced on shared time: synced devices play in step
+    if (!player->start_us) {
+        player->start_us = player->config.start_at_us ? player->config.start_at_us : now;
+    }
+
+    while (player->has_next) {
+        uint64_t time_us = clip_tick_time(player, player->tick);
+        int64_t due = player->start_us +
+                      (player->config.speed ? (int64_t)(time_us / player->config.speed) : 0);
+        if (player->config.speed && due > now) {
+            if (next_due_us) {
+                *next_due_us = midi_timebase_to_local_us(due);
+            }
+            return ESP_OK;
+        }
+
+        uint32_t late = player->config.speed ? (uint32_t)(now - due) : 0;
+        if (late > player->late_max_us) {
+            player->late_max_us = late;
+        }
+        player->late_sum_us += late;
+
+        midi_router_packet_t pkt = {
+            .source = player->config.source,
+            .destination = 0xFF,
+            .format = MIDI_FORMAT_2_0,
+            .data.ump = player->next
+        };
+        player->events++;
+        if (midi_router_inject(&pkt) != ESP_OK) {
+            player->refused++;
+        }
+        player->time_us = time_us;
+        clip_fetch(player);
+        now = midi_timebase_now_us();
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t midi_clip_player_run(midi_clip_player_t *player, midi_smf_report_t *report) {
+    int64_t due = 0;
+    while (midi_clip_player_poll(player, &due) == ESP_OK) {
+        for (;;) {
+            int64_t ahead = due - esp_timer_get_time();
+            if (ahead <= 0) {
+                break;
+            }
+            if (ahead >= (int64_t)portTICK_PERIOD_MS * 1000 * 2) {
+                vTaskDelay(1);
+            } else {
+                taskYIELD();
+            }
+        }
+    }
+
+    if (report) {
+        report->events = player->events;
+        report->refused = player->refused;
+        report->skipped = player->skipped;
+        report->duration_us = (uint32_t)player->time_us;
+        report->elapsed_us = (uint32_t)(midi_timebase_now_us() - player->start_us);
+        report->late_max_us = player->late_max_us;
+        report->late_avg_us = player->events
+                              ? (uint32_t)(player->late_sum_us / player->events) : 0;
+    }
+    ESP_LOGI(TAG, "Played %lu messages (%lu refused, %lu skipped), worst %lu us late",
+             (unsigned long)player->events, (unsigned long)player->refused,
+             (unsigned long)player->skipped, (unsigned long)player->late_max_us);
+    return ESP_OK;
+}
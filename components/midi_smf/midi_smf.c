@@ -0,0 +1,885 @@
+/**
+ * @file midi_smf.c
+ * @brief Streaming Standard MIDI File Recorder and Player Implementation
+ */
+
+#include "midi_smf.h"
+#include "midi_parser.h"
+#include "ump_parser.h"
+#include "ump_defs.h"
+#include "midi_timebase.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char *TAG = "MIDI_SMF";
+
+#define SMF_DEFAULT_DIVISION    960
+#define SMF_DEFAULT_TEMPO_US    500000
+#define SMF_HEADER_SIZE         14      // "MThd", length 6, format, tracks, division
+
+#define SMF_META                0xFF
+#define SMF_META_NAME           0x03
+#define SMF_META_PORT           0x21
+#define SMF_META_END_OF_TRACK   0x2F
+#define SMF_META_TEMPO          0x51
+#define SMF_ESCAPE              0xF7
+
+// MIDI bytes carried by a USB-MIDI 1.0 event packet, by Code Index Number
+static const uint8_t usb_cin_length[16] = {
+    0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1
+};
+
+//=============================================================================
+// Writer Output
+//=============================================================================
+
+static void smf_flush(midi_smf_writer_t *w) {
+    if (w->out_len && w->error == ESP_OK) {
+        w->error = w->config.write(w->config.ctx, w->out, w->out_len);
+    }
+    w->out_len = 0;
+}
+
+static void smf_put(midi_smf_writer_t *w, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    w->offset += len;
+    while (len) {
+        size_t n = sizeof(w->out) - w->out_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&w->out[w->out_len], bytes, n);
+        w->out_len += n;
+        bytes += n;
+        len -= n;
+        if (w->out_len == sizeof(w->out)) {
+            smf_flush(w);
+        }
+    }
+}
+
+static void smf_put_byte(midi_smf_writer_t *w, uint8_t byte) {
+    smf_put(w, &byte, 1);
+}
+
+static void smf_put_be(midi_smf_writer_t *w, uint32_t value, int bytes) {
+    while (bytes--) {
+        smf_put_byte(w, (uint8_t)(value >> (8 * bytes)));
+    }
+}
+
+/**
+ * @brief SMF variable-length quantity: 7 bits per byte, most significant first
+ */
+static void smf_put_vlq(midi_smf_writer_t *w, uint32_t value) {
+    uint8_t bytes[5];
+    int n = 0;
+    do {
+        bytes[n++] = value & 0x7F;
+        value >>= 7;
+    } while (value);
+    while (n--) {
+        smf_put_byte(w, bytes[n] | (n ? 0x80 : 0));
+    }
+}
+
+static void smf_put_meta(midi_smf_writer_t *w, uint8_t type, const void *data, size_t len) {
+    smf_put_byte(w, SMF_META);
+    smf_put_byte(w, type);
+    smf_put_vlq(w, (uint32_t)len);
+    smf_put(w, data, len);
+    w->running = 0;   // Meta and SysEx events cancel running status
+}
+
+/**
+ * @brief Name and tempo, at tick 0 of the first track
+ */
+static void smf_put_setup(midi_smf_writer_t *w) {
+    if (w->config.name) {
+        smf_put_vlq(w, 0);
+        smf_put_meta(w, SMF_META_NAME, w->config.name, strlen(w->config.name));
+    }
+    uint8_t tempo[3] = { w->config.tempo_us >> 16, w->config.tempo_us >> 8, w->config.tempo_us };
+    smf_put_vlq(w, 0);
+    smf_put_meta(w, SMF_META_TEMPO, tempo, sizeof(tempo));
+}
+
+/**
+ * @brief Delta time of the next event, preceded by a port change if needed
+ */
+static void smf_event_time(midi_smf_writer_t *w, uint64_t time_us, uint8_t transport) {
+    if (!w->started) {
+        w->started = true;
+        w->origin_us = time_us;
+    }
+    uint64_t elapsed = time_us > w->origin_us ? time_us - w->origin_us : 0;
+    uint64_t tick = (elapsed * w->config.division + w->config.tempo_us / 2) / w->config.tempo_us;
+    if (tick < w->last_tick) {
+        tick = w->last_tick;
+    }
+    uint32_t delta = (uint32_t)(tick - w->last_tick);
+    w->last_tick = tick;
+
+    if (transport != w->port) {
+        w->port = transport;
+        smf_put_vlq(w, delta);
+        smf_put_meta(w, SMF_META_PORT, &transport, 1);
+        delta = 0;
+    }
+    smf_put_vlq(w, delta);
+}
+
+static void smf_put_channel(midi_smf_writer_t *w, uint64_t time_us, uint8_t transport,
+                            uint8_t status, const uint8_t *data, uint8_t len) {
+    smf_event_time(w, time_us, transport);
+    if (status != w->running) {
+        smf_put_byte(w, status);
+        w->running = status;
+    }
+    smf_put(w, data, len);
+    w->events++;
+}
+
+/**
+ * @brief SysEx or escape event: type byte, length, bytes
+ */
+static void smf_put_sysex(midi_smf_writer_t *w, uint64_t time_us, uint8_t transport,
+                          uint8_t type, const uint8_t *data, size_t len, bool end) {
+    smf_event_time(w, time_us, transport);
+    smf_put_byte(w, type);
+    smf_put_vlq(w, (uint32_t)len + (end ? 1 : 0));
+    smf_put(w, data, len);
+    if (end) {
+        smf_put_byte(w, MIDI_STATUS_SYSEX_END);
+    }
+    w->running = 0;
+    w->events++;
+}
+
+//=============================================================================
+// Writer Input
+//=============================================================================
+
+/**
+ * @brief Write the SysEx bytes collected from this read as one chunk
+ */
+static void smf_sysex_chunk(midi_smf_writer_t *w, uint64_t time_us, uint8_t transport,
+                            const uint8_t *data, size_t len, bool end) {
+    midi_smf_rx_state_t *rx = &w->rx[transport];
+    if (!len && !end) {
+        return;
+    }
+    smf_put_sysex(w, time_us, transport, rx->sysex_open ? SMF_ESCAPE : MIDI_STATUS_SYSEX_START,
+                  data, len, end);
+    rx->sysex_open = !end;
+    if (end) {
+        rx->in_sysex = false;
+    }
+}
+
+/**
+ * @brief Assemble messages from a MIDI 1.0 byte stream and write them
+ *
+ * SysEx bytes are written as they come: a SysEx that spans several
+ * reads becomes a divided SysEx, and realtime bytes inside it land
+ * between its chunks, where they were received.
+ */
+static void smf_feed_bytes(midi_smf_writer_t *w, uint64_t time_us, uint8_t transport,
+                           const uint8_t *bytes, size_t len) {
+    midi_smf_rx_state_t *rx = &w->rx[transport];
+    size_t sysex_from = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t b = bytes[i];
+
+        if (midi_is_realtime_message(b)) {
+            if (rx->in_sysex) {
+                smf_sysex_chunk(w, time_us, transport, &bytes[sysex_from], i - sysex_from, false);
+                sysex_from = i + 1;
+            }
+            if (b != MIDI_STATUS_ACTIVE_SENSING) {
+                smf_put_sysex(w, time_us, transport, SMF_ESCAPE, &b, 1, false);
+            }
+            continue;
+        }
+
+        if (rx->in_sysex) {
+            if (midi_is_data_byte(b)) {
+                continue;
+            }
+            // F7 ends it; any other status aborts it, closed here so the file stays valid
+            smf_sysex_chunk(w, time_us, transport, &bytes[sysex_from], i - sysex_from, true);
+            if (b == MIDI_STATUS_SYSEX_END) {
+                continue;
+            }
+        }
+
+        if (b == MIDI_STATUS_SYSEX_START) {
+            rx->in_sysex = true;
+            rx->sysex_open = false;
+            rx->status = 0;
+            sysex_from = i + 1;
+        } else if (midi_is_system_common_message(b)) {
+            // Stray F7 outside a SysEx is ignored
+            rx->status = b == MIDI_STATUS_SYSEX_END ? 0 : b;
+            rx->need = midi_get_data_byte_count(b);
+            rx->have = 0;
+            if (rx->status && !rx->need) {
+                smf_put_sysex(w, time_us, transport, SMF_ESCAPE, &b, 1, false);
+                rx->status = 0;
+            }
+        } else if (midi_is_status_byte(b)) {
+            rx->status = b;
+            rx->need = midi_get_data_byte_count(b);
+            rx->have = 0;
+        } else if (!rx->status) {
+            w->dropped++;   // Data byte with no status to apply it to
+        } else {
+            rx->data[rx->have++] = b;
+            if (rx->have < rx->need) {
+                continue;
+            }
+            rx->have = 0;
+            if (midi_is_channel_message(rx->status)) {
+                smf_put_channel(w, time_us, transport, rx->status, rx->data, rx->need);
+            } else {
+                uint8_t msg[3] = { rx->status, rx->data[0], rx->data[1] };
+                smf_put_sysex(w, time_us, transport, SMF_ESCAPE, msg, 1 + rx->need, false);
+                rx->status = 0;
+            }
+        }
+    }
+
+    if (rx->in_sysex) {
+        smf_sysex_chunk(w, time_us, transport, &bytes[sysex_from], len - sysex_from, false);
+    }
+}
+
+/**
+ * @brief Write the MIDI 1.0 content of UMP words
+ */
+static void smf_feed_ump(midi_smf_writer_t *w, uint64_t time_us, uint8_t transport,
+                         const uint8_t *data, size_t len) {
+    uint32_t words[UMP_MAX_WORDS];
+    ump_packet_t ump;
+    size_t offset = 0;
+
+    while (offset + 4 <= len) {
+        memset(words, 0, sizeof(words));
+        memcpy(words, &data[offset], (len - offset) < sizeof(words) ? (len - offset)
+                                                                    : sizeof(words));
+        if (ump_parser_parse_packet(words, &ump) != ESP_OK ||
+            offset + ump.num_words * 4u > len) {
+            w->dropped++;
+            return;
+        }
+        offset += ump.num_words * 4u;
+
+        uint32_t w0 = ump.words[0];
+        uint8_t bytes[8];
+        size_t n = 0;
+        switch (ump.message_type) {
+        case UMP_MT_SYSTEM:
+        case UMP_MT_MIDI1_CHANNEL_VOICE:
+            bytes[0] = (uint8_t)(w0 >> 16);
+            bytes[1] = (uint8_t)(w0 >> 8);
+            bytes[2] = (uint8_t)w0;
+            n = 1 + midi_get_data_byte_count(bytes[0]);
+            break;
+        case UMP_MT_DATA_64: {
+            uint8_t form = (w0 >> 20) & 0x0F;
+            uint8_t count = (w0 >> 16) & 0x0F;
+            const uint8_t payload[6] = { w0 >> 8, w0, ump.words[1] >> 24, ump.words[1] >> 16,
+                                         ump.words[1] >> 8, ump.words[1] };
+            if (count > 6) {
+                count = 6;
+            }
+            if (form == UMP_FORMAT_COMPLETE || form == UMP_FORMAT_START) {
+                bytes[n++] = MIDI_STATUS_SYSEX_START;
+            }
+            memcpy(&bytes[n], payload, count);
+            n += count;
+            if (form == UMP_FORMAT_COMPLETE || form == UMP_FORMAT_END) {
+                bytes[n++] = MIDI_STATUS_SYSEX_END;
+            }
+            break;
+        }
+        default:
+            w->skipped++;   // MIDI 2.0 only: see the Clip File writer
+            break;
+        }
+        smf_feed_bytes(w, time_us, transport, bytes, n);
+    }
+}
+
+//=============================================================================
+// Writer
+//=============================================================================
+
+esp_err_t midi_smf_writer_begin(midi_smf_writer_t *writer, const midi_smf_writer_config_t *config) {
+    if (!writer || !config || !config->write || !config->patch || config->format > 1 ||
+        (config->tempo_us >> 24)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (config->name && strlen(config->name) > 16383) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(writer, 0, sizeof(*writer));
+    writer->config = *config;
+    if (!writer->config.division) {
+        writer->config.division = SMF_DEFAULT_DIVISION;
+    }
+    writer->config.division &= 0x7FFF;
+    if (!writer->config.tempo_us) {
+        writer->config.tempo_us = SMF_DEFAULT_TEMPO_US;
+    }
+    writer->port = 0xFF;
+
+    smf_put(writer, "MThd", 4);
+    smf_put_be(writer, 6, 4);
+    smf_put_be(writer, writer->config.format, 2);
+    smf_put_be(writer, writer->config.format == 1 ? 2 : 1, 2);
+    smf_put_be(writer, writer->config.division, 2);
+
+    if (writer->config.format == 1) {
+        // Conductor track: its length is known up front
+        size_t name = writer->config.name ? strlen(writer->config.name) : 0;
+        size_t length = (name ? 3 + (name > 127 ? 2 : 1) + name : 0) + 7 + 4;
+        smf_put(writer, "MTrk", 4);
+        smf_put_be(writer, (uint32_t)length, 4);
+        smf_put_setup(writer);
+        static const uint8_t end[] = { 0x00, SMF_META, SMF_META_END_OF_TRACK, 0x00 };
+        smf_put(writer, end, sizeof(end));
+    }
+
+    smf_put(writer, "MTrk", 4);
+    writer->track_length_at = writer->offset;
+    smf_put_be(writer, 0, 4);
+    if (writer->config.format == 0) {
+        smf_put_setup(writer);
+    }
+    writer->running = 0;
+    smf_flush(writer);
+    return writer->error;
+}
+
+esp_err_t midi_smf_writer_record(midi_smf_writer_t *writer, const midi_capture_record_t *record) {
+    bool output = record->source != MIDI_CAPTURE_NO_SOURCE;
+    if (output != writer->config.outputs || record->transport >= MIDI_TRANSPORT_COUNT ||
+        (writer->config.transports && !(writer->config.transports & (1u << record->transport)))) {
+        return writer->error;
+    }
+    writer->records++;
+
+    switch (record->kind) {
+    case MIDI_CAPTURE_BYTES:
+        smf_feed_bytes(writer, record->time_us, record->transport, record->data, record->length);
+        break;
+    case MIDI_CAPTURE_USB_MIDI1:
+        for (size_t i = 0; i + 3 < record->length; i += 4) {
+            uint8_t cin = record->data[i] & 0x0F;
+            smf_feed_bytes(writer, record->time_us, record->transport, &record->data[i + 1],
+                           usb_cin_length[cin]);
+        }
+        break;
+    case MIDI_CAPTURE_UMP:
+        smf_feed_ump(writer, record->time_us, record->transport, record->data, record->length);
+        break;
+    default:
+        writer->dropped++;
+        break;
+    }
+    return writer->error;
+}
+
+esp_err_t midi_smf_writer_drain(midi_smf_writer_t *writer, midi_capture_t *cap, uint32_t *written) {
+    midi_capture_record_t rec;
+    uint32_t count = 0;
+    esp_err_t err;
+
+    while ((err = midi_capture_take(cap, &rec, writer->record, sizeof(writer->record))) !=
+           ESP_ERR_NOT_FOUND) {
+        if (err != ESP_OK) {
+            writer->dropped++;
+            continue;
+        }
+        midi_smf_writer_record(writer, &rec);
+        count++;
+    }
+    smf_flush(writer);
+    if (written) {
+        *written = count;
+    }
+    return writer->error;
+}
+
+esp_err_t midi_smf_writer_end(midi_smf_writer_t *writer) {
+    static const uint8_t end[] = { 0x00, SMF_META, SMF_META_END_OF_TRACK, 0x00 };
+    smf_put(writer, end, sizeof(end));
+    smf_flush(writer);
+
+    uint32_t length = (uint32_t)(writer->offset - writer->track_length_at - 4);
+    uint8_t be[4] = { length >> 24, length >> 16, length >> 8, length };
+    if (writer->error == ESP_OK) {
+        writer->error = writer->config.patch(writer->config.ctx, writer->track_length_at,
+                                             be, sizeof(be));
+    }
+
+    ESP_LOGI(TAG, "SMF type %u written: %lu events, %lu bytes, %lu skipped, %lu dropped",
+             writer->config.format, (unsigned long)writer->events,
+             (unsigned long)writer->offset, (unsigned long)writer->skipped,
+             (unsigned long)writer->dropped);
+    return writer->error;
+}
+
+//=============================================================================
+// Player Input
+//=============================================================================
+
+static bool smf_track_byte(midi_smf_player_t *p, midi_smf_track_t *t, uint8_t *byte) {
+    if (t->buf_pos == t->buf_len) {
+        size_t n = t->end - t->pos;
+        if (n == 0) {
+            return false;
+        }
+        if (n > sizeof(t->buf)) {
+            n = sizeof(t->buf);
+        }
+        if (p->config.read(p->config.ctx, t->pos, t->buf, n) != ESP_OK) {
+            return false;
+        }
+        t->pos += n;
+        t->buf_pos = 0;
+        t->buf_len = (uint16_t)n;
+    }
+    *byte = t->buf[t->buf_pos++];
+    return true;
+}
+
+static bool smf_track_vlq(midi_smf_player_t *p, midi_smf_track_t *t, uint32_t *value) {
+    uint32_t v = 0;
+    uint8_t b;
+    for (int i = 0; i < 4; i++) {
+        if (!smf_track_byte(p, t, &b)) {
+            return false;
+        }
+        v = (v << 7) | (b & 0x7F);
+        if (!(b & 0x80)) {
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Read the next event's delta time; the track ends if there is none
+ */
+static void smf_track_advance(midi_smf_player_t *p, midi_smf_track_t *t) {
+    uint32_t delta;
+    if (!t->done && smf_track_vlq(p, t, &delta)) {
+        t->tick += delta;
+    } else {
+        t->done = true;
+    }
+}
+
+static bool smf_skip(midi_smf_player_t *p, midi_smf_track_t *t, uint32_t len) {
+    uint8_t b;
+    while (len--) {
+        if (!smf_track_byte(p, t, &b)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint64_t smf_tick_time(const midi_smf_player_t *p, uint64_t tick) {
+    if (p->division & 0x8000) {
+        // SMPTE: frames per second (29 = 30 drop frame) times ticks per frame
+        uint64_t fps = (uint8_t)-(int8_t)(p->division >> 8);
+        uint64_t tpf = p->division & 0xFF;
+        if (!fps || !tpf) {
+            return 0;
+        }
+        return fps == 29 ? tick * 1001000000ULL / (30000 * tpf) : tick * 1000000 / (fps * tpf);
+    }
+    return p->tempo_time_us + (tick - p->tempo_tick) * p->tempo_us / p->division;
+}
+
+//=============================================================================
+// Player Output
+//=============================================================================
+
+static void smf_send(midi_smf_player_t *p, const midi_smf_track_t *t, const midi_message_t *msg) {
+    midi_router_packet_t pkt = {
+        .source = (p->config.follow_ports && t->port < MIDI_TRANSPORT_COUNT)
+                  ? (midi_transport_t)t->port : p->config.source,
+        .destination = 0xFF,
+        .format = MIDI_FORMAT_1_0,
+        .data.midi1 = *msg
+    };
+    p->events++;
+    if (midi_router_inject(&pkt) != ESP_OK) {
+        p->refused++;
+    }
+}
+
+static void smf_send_short(midi_smf_player_t *p, const midi_smf_track_t *t,
+                           uint8_t status, uint8_t d1, uint8_t d2) {
+    midi_message_t msg = {
+        .type = midi_is_channel_message(status) ? MIDI_MSG_TYPE_CHANNEL
+              : midi_is_realtime_message(status) ? MIDI_MSG_TYPE_SYSTEM_REALTIME
+              : MIDI_MSG_TYPE_SYSTEM_COMMON,
+        .status = status,
+        .channel = midi_is_channel_message(status) ? (status & MIDI_CHANNEL_MASK) : 0,
+        .data.bytes = { d1, d2 }
+    };
+    smf_send(p, t, &msg);
+}
+
+/**
+ * @brief Add a byte to the SysEx being collected; send it at F7
+ *
+ * The SysEx buffer is reused by the next SysEx, as with the transports'
+ * own parsers.
+ */
+static void smf_sysex_byte(midi_smf_player_t *p, const midi_smf_track_t *t, uint8_t b) {
+    if (b != MIDI_STATUS_SYSEX_END) {
+        if (p->sysex_len < sizeof(p->sysex)) {
+            p->sysex[p->sysex_len++] = b;
+        } else {
+            p->sysex_overflow = true;
+        }
+        return;
+    }
+    p->in_sysex = false;
+    if (p->sysex_overflow) {
+        p->skipped++;
+        return;
+    }
+    midi_message_t msg = {
+        .type = MIDI_MSG_TYPE_SYSTEM_EXCLUSIVE,
+        .status = MIDI_STATUS_SYSEX_START,
+        .data.sysex = { .data = p->sysex, .length = p->sysex_len }
+    };
+    smf_send(p, t, &msg);
+}
+
+/**
+ * @brief F0 event, or F7 continuing a divided SysEx
+ */
+static void smf_sysex(midi_smf_player_t *p, midi_smf_track_t *t, uint32_t len) {
+    uint8_t b;
+    for (uint32_t i = 0; i < len; i++) {
+        if (!smf_track_byte(p, t, &b)) {
+            t->done = true;
+            return;
+        }
+        smf_sysex_byte(p, t, b);
+    }
+}
+
+/**
+ * @brief F7 escape: a realtime or system common message as is
+ *
+ * A lone realtime byte may sit between the chunks of a divided SysEx;
+ * any other escape while one is open continues it.
+ */
+static void smf_escape(midi_smf_player_t *p, midi_smf_track_t *t, uint32_t len) {
+    uint8_t msg[3] = { 0 };
+    if (len == 0 || !smf_track_byte(p, t, &msg[0])) {
+        t->done = len != 0;
+        return;
+    }
+    if (p->in_sysex && !(len == 1 && midi_is_realtime_message(msg[0]))) {
+        smf_sysex_byte(p, t, msg[0]);
+        smf_sysex(p, t, len - 1);
+        return;
+    }
+    for (uint32_t i = 1; i < len; i++) {
+        uint8_t b;
+        if (!smf_track_byte(p, t, &b)) {
+            t->done = true;
+            return;
+        }
+        if (i < sizeof(msg)) {
+            msg[i] = b;
+        }
+    }
+    bool single = midi_is_status_byte(msg[0]) && msg[0] != MIDI_STATUS_SYSEX_START &&
+                  msg[0] != MIDI_STATUS_SYSEX_END && !midi_is_channel_message(msg[0]) &&
+                  len == 1u + (midi_is_realtime_message(msg[0]) ? 0
+                                                                : midi_get_data_byte_count(msg[0]));
+    if (single) {
+        smf_send_short(p, t, msg[0], msg[1], msg[2]);
+    } else {
+        p->skipped++;
+    }
+}
+
+static void smf_meta(midi_smf_player_t *p, midi_smf_track_t *t, uint64_t time_us) {
+    uint8_t type, data[3];
+    uint32_t len;
+    if (!smf_track_byte(p, t, &type) || !smf_track_vlq(p, t, &len)) {
+        t->done = true;
+        return;
+    }
+    if (type == SMF_META_END_OF_TRACK) {
+        t->done = true;
+        return;
+    }
+    if ((type != SMF_META_TEMPO || len != 3) && (type != SMF_META_PORT || len != 1)) {
+        if (!smf_skip(p, t, len)) {
+            t->done = true;
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        if (!smf_track_byte(p, t, &data[i])) {
+            t->done = true;
+            return;
+        }
+    }
+    if (type == SMF_META_PORT) {
+        t->port = data[0];
+    } else if (!(p->division & 0x8000)) {
+        // New tempo segment from this tick on
+        p->tempo_time_us = time_us;
+        p->tempo_tick = t->tick;
+        p->tempo_us = ((uint32_t)data[0] << 16) | (data[1] << 8) | data[2];
+    }
+}
+
+/**
+ * @brief Dispatch the event at the track's read position
+ */
+static void smf_event(midi_smf_player_t *p, midi_smf_track_t *t, uint64_t time_us) {
+    uint8_t b, d1 = 0, d2 = 0;
+    uint32_t len;
+    if (!smf_track_byte(p, t, &b)) {
+        t->done = true;
+        return;
+    }
+
+    if (b == SMF_META) {
+        smf_meta(p, t, time_us);
+        t->running = 0;
+        return;
+    }
+    if (b == MIDI_STATUS_SYSEX_START || b == SMF_ESCAPE) {
+        t->running = 0;
+        if (!smf_track_vlq(p, t, &len)) {
+            t->done = true;
+        } else if (b == MIDI_STATUS_SYSEX_START) {
+            p->sysex_len = 0;
+            p->sysex_overflow = false;
+            p->in_sysex = true;
+            smf_sysex(p, t, len);
+        } else {
+            smf_escape(p, t, len);
+        }
+        return;
+    }
+
+    uint8_t status = b;
+    bool have_first = false;
+    if (midi_is_data_byte(b)) {
+        if (!t->running) {
+            t->done = true;   // Corrupt track
+            p->skipped++;
+            return;
+        }
+        status = t->running;
+        d1 = b;
+        have_first = true;
+    } else if (!midi_is_channel_message(b)) {
+        t->done = true;
+        p->skipped++;
+        return;
+    }
+    t->running = status;
+
+    uint8_t need = midi_get_data_byte_count(status);
+    if ((!have_first && need >= 1 && !smf_track_byte(p, t, &d1)) ||
+        (need == 2 && !smf_track_byte(p, t, &d2))) {
+        t->done = true;
+        return;
+    }
+    smf_send_short(p, t, status, d1, d2);
+}
+
+//=============================================================================
+// Player
+//=============================================================================
+
+esp_err_t midi_smf_player_open(midi_smf_player_t *player, const midi_smf_player_config_t *config) {
+    if (!player || !config || !config->read || config->source >= MIDI_TRANSPORT_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(player, 0, sizeof(*player));
+    player->config = *config;
+    player->tempo_us = SMF_DEFAULT_TEMPO_US;
+
+    uint8_t hdr[SMF_HEADER_SIZE];
+    if (config->size < sizeof(hdr)) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    esp_err_t err = config->read(config->ctx, 0, hdr, sizeof(hdr));
+    if (err != ESP_OK) {
+        return err;
+    }
+    uint32_t hdr_len = ((uint32_t)hdr[4] << 24) | (hdr[5] << 16) | (hdr[6] << 8) | hdr[7];
+    if (memcmp(hdr, "MThd", 4) != 0 || hdr_len < 6) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    player->format = (hdr[8] << 8) | hdr[9];
+    player->division = (hdr[12] << 8) | hdr[13];
+    if (player->format > 1 || player->division == 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    // Find the track chunks, skipping unknown ones
+    uint16_t declared = (hdr[10] << 8) | hdr[11];
+    size_t pos = 8 + (size_t)hdr_len;
+    while (pos + 8 <= config->size && player->num_tracks < declared) {
+        uint8_t chunk[8];
+        if ((err = config->read(config->ctx, pos, chunk, sizeof(chunk))) != ESP_OK) {
+            return err;
+        }
+        uint32_t len = ((uint32_t)chunk[4] << 24) | (chunk[5] << 16) | (chunk[6] << 8) | chunk[7];
+        pos += 8;
+        if (len > config->size - pos) {
+            len = (uint32_t)(config->size - pos);   // Truncated file: play what is there
+        }
+        if (memcmp(chunk, "MTrk", 4) == 0) {
+            if (player->num_tracks == MIDI_SMF_MAX_TRACKS) {
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            midi_smf_track_t *t = &player->tracks[player->num_tracks++];
+            t->pos = pos;
+            t->end = pos + len;
+            t->port = 0xFF;
+        }
+        pos += len;
+    }
+
+    for (int i = 0; i < player->num_tracks; i++) {
+        smf_track_advance(player, &player->tracks[i]);
+    }
+    ESP_LOGI(TAG, "SMF type %u, %u tracks, division 0x%04X", player->format,
+             player->num_tracks, player->division);
+    return ESP_OK;
+}
+
+/**
+ * @brief Track holding the earliest event (lowest index on a tie)
+ */
+static midi_smf_track_t *smf_next_track(midi_smf_player_t *p) {
+    midi_smf_track_t *next = NULL;
+    for (int i = 0; i < p->num_tracks; i++) {
+        midi_smf_track_t *t = &p->tracks[i];
+        if (!t->done && (!next || t->tick < next->tick)) {
+            next = t;
+        }
+    }
+    return next;
+}
+
+esp_err_t midi_smf_player_poll(midi_smf_player_t *player, int64_t *next_due_us) {
+    int64_t now = midi_timebase_now_us(); // Paced on shared time: synced devices play in step
+    if (!player->start_us) {
+        player->start_us = player->config.start_at_us ? player->config.start_at_us : now;
+    }
+
+    midi_smf_track_t *t;
+    while ((t = smf_next_track(player)) != NULL) {
+        uint64_t time_us = smf_tick_time(player, t->tick);
+        int64_t due = player->start_us +
+                      (player->config.speed ? (int64_t)(time_us / player->config.speed) : 0);
+        if (player->config.speed && due > now) {
+            if (next_due_us) {
+                *next_due_us = midi_timebase_to_local_us(due);
+            }
+            return ESP_OK;
+        }
+
+        uint32_t late = player->config.speed ? (uint32_t)(now - due) : 0;
+        if (late > player->late_max_us) {
+            player->late_max_us = late;
+        }
+        uint32_t sent = player->events;
+        smf_event(player, t, time_us);
+        if (player->events != sent) {
+            player->late_sum_us += late;
+        }
+        player->time_us = time_us;
+        smf_track_advance(player, t);
+        now = midi_timebase_now_us();
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t midi_smf_player_run(midi_smf_player_t *player, midi_smf_report_t *report) {
+    int64_t due = 0;
+    while (midi_smf_player_poll(player, &due) == ESP_OK) {
+        for (;;) {
+            int64_t ahead = due - esp_timer_get_time();
+            if (ahead <= 0) {
+                break;
+            }
+            if (ahead >= (int64_t)portTICK_PERIOD_MS * 1000 * 2) {
+                vTaskDelay(1);
+            } else {
+                taskYIELD();
+            }
+        }
+    }
+
+    if (report) {
+        report->events = player->events;
+        report->refused = player->refused;
+        report->skipped = player->skipped;
+        report->duration_us = (uint32_t)player->time_us;
+        report->elapsed_us = (uint32_t)(midi_timebase_now_us() - player->start_us);
+        report->late_max_us = player->late_max_us;
+        report->late_avg_us = player->events
+                              ? (uint32_t)(player->late_sum_us / player->events) : 0;
+    }
+    ESP_LOGI(TAG, "Played %lu events (%lu refused, %lu skipped), worst %lu us late",
+             (unsigned long)player->events, (unsigned long)player->refused,
+             (unsigned long)player->skipped, (unsigned long)player->late_max_us);
+    return ESP_OK;
+}
+
+//=============================================================================
+// File Helpers
+//=============================================================================
+
+esp_err_t midi_smf_file_write(void *ctx, const void *data, size_t len) {
+    return fwrite(data, 1, len, (FILE *)ctx) == len ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t midi_smf_file_patch(void *ctx, size_t offset, const void *data, size_t len) {
+    FILE *f = ctx;
+    long end = ftell(f);
+    if (end < 0 || fseek(f, (long)offset, SEEK_SET) != 0) {
+        return ESP_FAIL;
+    }
+    bool ok = fwrite(data, 1, len, f) == len;
+    return fseek(f, end, SEEK_SET) == 0 && ok ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t midi_smf_file_read(void *ctx, size_t offset, void *data, size_t len) {
+    FILE *f = ctx;
+    if (fseek(f, (long)offset, SEEK_SET) != 0 || fread(data, 1, len, f) != len) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
@@ -19,8 +19,12 @@
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "midi_types.h"
 #include "midi_parser.h"
+#include "midi_router.h"
+#include "midi_coalescer.h"
+#include "esp_timer.h"
 #include "sdkconfig.h"
 
 /**
@@ -40,6 +44,8 @@
 #define MIDI_UART_RX_BUF_SIZE       CONFIG_MIDI_UART_RX_BUFFER_SIZE
 #define MIDI_UART_TX_BUF_SIZE       CONFIG_MIDI_UART_TX_BUFFER_SIZE
 #define MIDI_UART_EVENT_QUEUE_SIZE  CONFIG_MIDI_UART_EVENT_QUEUE_SIZE
+#define MIDI_UART_TX_BUSY_BYTES     CONFIG_MIDI_UART_TX_BUSY_BYTES
+#define MIDI_UART_SYSEX_SLICE_BYTES CONFIG_MIDI_UART_SYSEX_SLICE_BYTES
 
 // Task Configuration
 #define MIDI_UART_TASK_STACK_SIZE   CONFIG_MIDI_UART_TASK_STACK_SIZE
@@ -88,6 +94,14 @@ typedef struct {
     // UART event queue handle
     QueueHandle_t uart_event_queue;
     
+    // TX path: router task and flush timer, serialized by tx_mutex
+    SemaphoreHandle_t tx_mutex;
+    midi_coalescer_t coalescer;
+    esp_timer_handle_t flush_timer;
+    
+    // Outgoing SysEx progress (under tx_mutex, 0 = none in flight)
+    uint16_t sysex_tx_sent;
+    
 } midi_uart_state_t;
 
 esp_err_t midi_uart_configure(QueueHandle_t *uart_event_queue);
@@ -139,6 +153,21 @@ esp_err_t midi_uart_send_message(const midi_message_t *msg);
  */
 esp_err_t midi_uart_send_bytes(const uint8_t *data, size_t len);
 
+/**
+ * @brief Router TX callback for MIDI OUT
+ * 
+ * Registered with the router by midi_uart_init(). Notes and other
+ * discrete messages are written immediately; continuous controllers
+ * pass through the TX coalescer and may be held while the output is
+ * busy. UMP packets are translated to MIDI 1.0. SysEx goes out in
+ * MIDI_UART_SYSEX_SLICE_BYTES slices, one per call.
+ * 
+ * @param packet Packet to transmit
+ * @return ESP_OK on success (or held), ESP_ERR_TIMEOUT if TX buffer full,
+ *         ESP_ERR_NOT_FINISHED after a SysEx slice with more to come
+ */
+esp_err_t midi_uart_router_tx(const midi_router_packet_t *packet);
+
 /**
  * @brief Check if MIDI UART is initialized
  * 
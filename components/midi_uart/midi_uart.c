@@ -6,7 +6,10 @@
 #include "midi_uart.h"
 #include "midi_message.h"
 #include "midi_router.h"
+#include "midi_translator.h"
+#include "midi_capture.h"
 #include "driver/uart.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include <string.h>
@@ -15,6 +18,9 @@ static const char *TAG = "midi_uart";
 
 static midi_uart_state_t uart_state = {0};
 
+#define MIDI_UART_FLUSH_PERIOD_US 1000
+#define MIDI_UART_SENSE_POLL_MS   20    // RX wake-up for the Active Sensing timeout
+
 /**
  * @brief Configure UART hardware for MIDI
  * 
@@ -96,7 +102,10 @@ esp_err_t midi_uart_deconfigure(QueueHandle_t *uart_event_queue) {
  * @brief UART RX Task (ESP-IDF v5.5 compatible)
  * 
  * Continuously reads from UART, feeds to MIDI parser,
- * calls callback on complete messages
+ * calls callback on complete messages. Wakes periodically to check the
+ * Active Sensing timeout: when a sender that used Active Sensing goes
+ * silent (cable pulled, gear switched off), the router releases the
+ * notes it left sounding.
  */
 static void midi_uart_rx_task(void *arg) {
     midi_uart_state_t *state = (midi_uart_state_t *)arg;
@@ -116,7 +125,7 @@ static void midi_uart_rx_task(void *arg) {
     ESP_LOGI(TAG, "RX callback: %p", state->rx_callback);  // ← Check if NULL
     while (1) {
         // Wait for UART event
-        if (xQueueReceive(uart_queue, &event, portMAX_DELAY) == pdTRUE) {
+        if (xQueueReceive(uart_queue, &event, pdMS_TO_TICKS(MIDI_UART_SENSE_POLL_MS)) == pdTRUE) {
             ESP_LOGI(TAG, "Event: type=%d, size=%d", event.type, event.size);
             switch (event.type) {
                 case UART_DATA:
@@ -127,6 +136,8 @@ static void midi_uart_rx_task(void *arg) {
                                                   event.size, 0);
                         ESP_LOGI(TAG, "Read %d bytes: ", len);
                         if (len > 0) {
+                            midi_capture_rx(MIDI_TRANSPORT_UART, MIDI_CAPTURE_BYTES, data, len);
+                            
                             // Process each byte
                             for (int i = 0; i < len; i++) {
                                 rx_byte = data[i];
@@ -192,11 +203,202 @@ static void midi_uart_rx_task(void *arg) {
                     break;
             }
         }
-        // Timeout - continue loop (allows clean task deletion if needed)
         
+        if (midi_parser_check_active_sensing_timeout(&state->parser,
+                                                     (uint32_t)esp_timer_get_time())) {
+            ESP_LOGW(TAG, "Active Sensing timeout: MIDI IN lost");
+            midi_parser_reset(&state->parser);
+            midi_router_source_lost(MIDI_TRANSPORT_UART);
+        }
+    }
+}
+
+//=============================================================================
+// Router TX Path
+//=============================================================================
+
+/**
+ * @brief Check whether MIDI OUT is backed up
+ */
+static bool midi_uart_tx_busy(void) {
+    size_t free_bytes = 0;
+    if (uart_get_tx_buffer_free_size(MIDI_UART_PORT, &free_bytes) != ESP_OK) {
+        return false;
+    }
+    return (MIDI_UART_TX_BUF_SIZE - free_bytes) >= MIDI_UART_TX_BUSY_BYTES;
+}
+
+/**
+ * @brief Write the next slice of a SysEx (F0, data, F7)
+ * 
+ * A slice is only written once the previous one has left the wire.
+ * 
+ * @return ESP_ERR_NOT_FINISHED while bytes remain, ESP_OK after F7,
+ *         ESP_ERR_TIMEOUT if the previous slice is still going out
+ */
+static esp_err_t midi_uart_write_sysex_slice(const midi_message_t *msg) {
+    if (uart_wait_tx_done(MIDI_UART_PORT, 0) != ESP_OK) {
+        return ESP_ERR_TIMEOUT;
+    }
+    
+    size_t total = (size_t)msg->data.sysex.length + 2;
+    uint8_t slice[MIDI_UART_SYSEX_SLICE_BYTES];
+    size_t len = 0;
+    
+    while (len < sizeof(slice) && uart_state.sysex_tx_sent < total) {
+        size_t pos = uart_state.sysex_tx_sent++;
+        slice[len++] = (pos == 0) ? 0xF0 :
+                       (pos == total - 1) ? 0xF7 : msg->data.sysex.data[pos - 1];
+    }
+    
+    if (uart_write_bytes(MIDI_UART_PORT, (const char *)slice, len) != len) {
+        uart_state.sysex_tx_sent = 0;
+        return ESP_FAIL;
+    }
+    
+    if (uart_state.sysex_tx_sent < total) {
+        return ESP_ERR_NOT_FINISHED;
+    }
+    uart_state.sysex_tx_sent = 0;
+    return ESP_OK;
+}
+
+/**
+ * @brief Serialize and write a router packet without blocking
+ */
+static esp_err_t midi_uart_write_packet(const midi_router_packet_t *packet) {
+    midi_message_t msg;
+    
+    if (packet->format == MIDI_FORMAT_1_0) {
+        msg = packet->data.midi1;
+    } else {
+        esp_err_t err = midi_translate_2to1(&packet->data.ump, &msg);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    
+    if (msg.type == MIDI_MSG_TYPE_SYSTEM_EXCLUSIVE && msg.data.sysex.data) {
+        return midi_uart_write_sysex_slice(&msg);
+    }
+    
+    uint8_t buffer[16];
+    size_t len = 0;
+    esp_err_t err = midi_message_to_bytes(&msg, buffer, sizeof(buffer), &len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    
+    // Never block the router task: report busy instead
+    size_t free_bytes = 0;
+    if (uart_get_tx_buffer_free_size(MIDI_UART_PORT, &free_bytes) == ESP_OK &&
+        free_bytes < len) {
+        return ESP_ERR_TIMEOUT;
+    }
+    
+    return (uart_write_bytes(MIDI_UART_PORT, (const char *)buffer, len) == len)
+           ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Send held controller values that are due
+ * 
+ * Runs on the esp_timer task. It takes tx_mutex like the router's TX
+ * path, so the SysEx check and its writes cannot interleave with a
+ * SysEx the router is starting; if the router holds it, try next tick.
+ */
+static void midi_uart_flush_timer_cb(void *arg) {
+    midi_router_packet_t packet;
+    
+    if (xSemaphoreTake(uart_state.tx_mutex, 0) != pdTRUE) {
+        esp_timer_start_once(uart_state.flush_timer, MIDI_UART_FLUSH_PERIOD_US);
+        return;
+    }
+    
+    // Held controllers must not land inside a SysEx being sliced out
+    while (!uart_state.sysex_tx_sent && !midi_uart_tx_busy() &&
+           midi_coalescer_poll(&uart_state.coalescer, esp_timer_get_time(), &packet)) {
+        if (midi_uart_write_packet(&packet) != ESP_OK) {
+            break;  // A value not written stays held
+        }
+        midi_coalescer_sent(&uart_state.coalescer, &packet, esp_timer_get_time());
+    }
+    
+    bool more = midi_coalescer_has_pending(&uart_state.coalescer);
+    xSemaphoreGive(uart_state.tx_mutex);
+    
+    if (more) {
+        esp_timer_start_once(uart_state.flush_timer, MIDI_UART_FLUSH_PERIOD_US);
+    }
+}
+
+esp_err_t midi_uart_router_tx(const midi_router_packet_t *packet) {
+    if (!uart_state.is_initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    xSemaphoreTake(uart_state.tx_mutex, portMAX_DELAY);
+    
+    esp_err_t err = ESP_OK;  // Unless sent: held for later or redundant
+    int64_t now_us = esp_timer_get_time();
+    midi_coalesce_result_t result = midi_coalescer_offer(&uart_state.coalescer, packet, now_us,
+                                                         midi_uart_tx_busy());
+    if (result == MIDI_COALESCE_SEND) {
+        // Values held on this channel were sent first by the source
+        midi_router_packet_t held;
+        while (err == ESP_OK &&
+               midi_coalescer_poll_before(&uart_state.coalescer, packet, &held)) {
+            err = midi_uart_write_packet(&held);
+            if (err == ESP_OK) {
+                midi_coalescer_sent(&uart_state.coalescer, &held, now_us);
+            }
+        }
+        
+        // Recorded only once written: a busy write is retried by the router,
+        // and the retry must not look like a repeat of the value on the wire
+        if (err == ESP_OK) {
+            err = midi_uart_write_packet(packet);
+        }
+        if (err == ESP_OK) {
+            midi_coalescer_sent(&uart_state.coalescer, packet, now_us);
+        }
+    }
+    bool pending = midi_coalescer_has_pending(&uart_state.coalescer);
+    
+    xSemaphoreGive(uart_state.tx_mutex);
+    
+    if (pending && !esp_timer_is_active(uart_state.flush_timer)) {
+        esp_timer_start_once(uart_state.flush_timer, MIDI_UART_FLUSH_PERIOD_US);
+    }
+    return err;
+}
+
+static esp_err_t midi_uart_transport_send(void *ctx, const midi_router_packet_t *packet) {
+    return midi_uart_router_tx(packet);
+}
+
+/**
+ * @brief Forget a SysEx the router gave up on part way
+ * 
+ * No F7 is sent: the next status byte ends the truncated message on the
+ * receiver, which then does not take it for a complete one.
+ */
+static void midi_uart_transport_abort(void *ctx) {
+    if (!uart_state.tx_mutex) {
+        return;
     }
+    xSemaphoreTake(uart_state.tx_mutex, portMAX_DELAY);
+    uart_state.sysex_tx_sent = 0;
+    xSemaphoreGive(uart_state.tx_mutex);
 }
 
+static const midi_transport_ops_t s_uart_transport = {
+    .name = "UART",
+    .native_format = MIDI_FORMAT_1_0,
+    .send = midi_uart_transport_send,
+    .abort = midi_uart_transport_abort
+};
+
 /**
  * @brief Initialize MIDI UART driver
  */
@@ -230,6 +432,40 @@ esp_err_t midi_uart_init(void) {
     uart_state.rx_callback = uart_rx_callback;
     uart_state.rx_callback_ctx = NULL;
     
+    // TX controller thinning
+    midi_coalescer_config_t thin_cfg = {
+#if CONFIG_MIDI_UART_THIN_ENABLE
+        .enabled = true,
+        .max_rate_hz = CONFIG_MIDI_UART_THIN_MAX_RATE_HZ,
+        .min_delta = CONFIG_MIDI_UART_THIN_MIN_DELTA,
+        .settle_ms = CONFIG_MIDI_UART_THIN_SETTLE_MS,
+#else
+        .enabled = false,
+#endif
+    };
+    midi_coalescer_init(&uart_state.coalescer, &thin_cfg);
+    uart_state.sysex_tx_sent = 0;
+    if (!uart_state.tx_mutex) {
+        uart_state.tx_mutex = xSemaphoreCreateMutex();
+        if (!uart_state.tx_mutex) {
+            midi_uart_deconfigure(&uart_state.uart_event_queue);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    
+    const esp_timer_create_args_t flush_args = {
+        .callback = midi_uart_flush_timer_cb,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "midi_uart_thin"
+    };
+    err = esp_timer_create(&flush_args, &uart_state.flush_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Flush timer create failed: %s", esp_err_to_name(err));
+        midi_uart_deconfigure(&uart_state.uart_event_queue);
+        return err;
+    }
+    
     // Create RX task
     BaseType_t task_created = xTaskCreatePinnedToCore(
         midi_uart_rx_task,
@@ -248,6 +484,10 @@ esp_err_t midi_uart_init(void) {
     }
     
     uart_state.is_initialized = true;
+    
+    midi_router_attach_transport(MIDI_TRANSPORT_UART, &s_uart_transport, NULL);
+    midi_router_register_coalescer(MIDI_TRANSPORT_UART, &uart_state.coalescer);
+    
     ESP_LOGI(TAG, "MIDI UART initialized successfully");
     
     return ESP_OK;
@@ -263,6 +503,15 @@ esp_err_t midi_uart_deinit(void) {
     
     ESP_LOGI(TAG, "Deinitializing MIDI UART driver");
     
+    midi_router_attach_transport(MIDI_TRANSPORT_UART, NULL, NULL);
+    midi_router_register_coalescer(MIDI_TRANSPORT_UART, NULL);
+    
+    if (uart_state.flush_timer) {
+        esp_timer_stop(uart_state.flush_timer);
+        esp_timer_delete(uart_state.flush_timer);
+        uart_state.flush_timer = NULL;
+    }
+    
     // Delete RX task
     if (uart_state.rx_task_handle) {
         vTaskDelete(uart_state.rx_task_handle);
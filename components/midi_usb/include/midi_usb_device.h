@@ -60,6 +60,13 @@ esp_err_t midi_usb_device_send_packet(const midi_usb_packet_t *packet);
  */
 bool midi_usb_device_is_mounted(void);
 
+/**
+ * @brief Check if the host selected alternate setting 1 (UMP)
+ * 
+ * @return true if UMP is active, false on USB-MIDI 1.0 or unmounted
+ */
+bool midi_usb_device_ump_active(void);
+
 /**
  * @brief Flush TX FIFO
  * 
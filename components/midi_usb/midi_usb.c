@@ -10,6 +10,9 @@
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "midi_message.h"
+#include "midi_router.h"
+#include "midi_translator.h"
+#include "ump_defs.h"
 #include <string.h>
 
 static const char *TAG = "midi_usb";
@@ -25,6 +28,10 @@ typedef struct {
     midi_usb_config_t config;
     midi_usb_stats_t stats;
     midi_usb_mode_t active_mode;
+    
+    // SysEx bytes waiting to fill a USB-MIDI 1.0 Event Packet
+    uint8_t sysex_tx[3];
+    uint8_t sysex_tx_len;
 } midi_usb_state_t;
 
 static midi_usb_state_t g_usb_state = {0};
@@ -100,6 +107,111 @@ static midi_usb_mode_t detect_usb_mode(void) {
     return (level == 0) ? MIDI_USB_MODE_HOST : MIDI_USB_MODE_DEVICE;
 }
 
+/**
+ * @brief Send one USB-MIDI 1.0 Event Packet
+ */
+static esp_err_t usb_send_event(uint8_t cin, const uint8_t bytes[3]) {
+    midi_usb_packet_t packet = {
+        .cable_number = 0,
+        .protocol = MIDI_USB_PROTOCOL_1_0,
+        .timestamp_us = esp_timer_get_time()
+    };
+    packet.data.midi1.cin = cin;
+    memcpy(packet.data.midi1.midi_bytes, bytes, 3);
+    return midi_usb_send_packet(&packet);
+}
+
+/**
+ * @brief Send a SysEx7 UMP as USB-MIDI 1.0 SysEx Event Packets
+ * 
+ * Bytes are packed three to a packet across UMPs; the packet that
+ * carries F7 gets CIN 0x5-0x7.
+ */
+static esp_err_t usb_send_sysex7(const ump_packet_t *ump) {
+    uint32_t w0 = ump->words[0];
+    uint32_t w1 = ump->words[1];
+    uint8_t form = (w0 >> 20) & 0x0F;
+    uint8_t count = (w0 >> 16) & 0x0F;
+    uint8_t data[6] = { (w0 >> 8) & 0x7F, w0 & 0x7F, (w1 >> 24) & 0x7F,
+                        (w1 >> 16) & 0x7F, (w1 >> 8) & 0x7F, w1 & 0x7F };
+    uint8_t bytes[8];
+    size_t len = 0;
+    
+    if (form == UMP_FORMAT_COMPLETE || form == UMP_FORMAT_START) {
+        bytes[len++] = 0xF0;
+        g_usb_state.sysex_tx_len = 0;
+    }
+    for (uint8_t i = 0; i < count && i < sizeof(data); i++) {
+        bytes[len++] = data[i];
+    }
+    bool end = (form == UMP_FORMAT_COMPLETE || form == UMP_FORMAT_END);
+    if (end) {
+        bytes[len++] = 0xF7;
+    }
+    
+    esp_err_t err = ESP_OK;
+    for (size_t i = 0; i < len && err == ESP_OK; i++) {
+        g_usb_state.sysex_tx[g_usb_state.sysex_tx_len++] = bytes[i];
+        if (g_usb_state.sysex_tx_len == 3) {
+            err = usb_send_event(bytes[i] == 0xF7 ? 0x07 : 0x04, g_usb_state.sysex_tx);
+            g_usb_state.sysex_tx_len = 0;
+        }
+    }
+    if (err == ESP_OK && end && g_usb_state.sysex_tx_len > 0) {
+        uint8_t last[3] = {0};
+        memcpy(last, g_usb_state.sysex_tx, g_usb_state.sysex_tx_len);
+        err = usb_send_event(g_usb_state.sysex_tx_len == 1 ? 0x05 : 0x06, last);
+    }
+    if (err != ESP_OK || end) {
+        g_usb_state.sysex_tx_len = 0;
+    }
+    // Part of it may be out already: a retry would repeat those bytes
+    return (err == ESP_OK) ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Router driver send
+ * 
+ * Routed packets arrive as UMP. On UMP (device, alternate setting 1)
+ * they go out as they are; on USB-MIDI 1.0 the router has already
+ * turned channel voice into MT 0x2 for the MIDI 1.0 Protocol link.
+ */
+static esp_err_t midi_usb_transport_send(void *ctx, const midi_router_packet_t *packet) {
+    const ump_packet_t *ump = &packet->data.ump;
+    
+    if (g_usb_state.active_mode == MIDI_USB_MODE_DEVICE && midi_usb_device_ump_active()) {
+        midi_usb_packet_t out = {
+            .cable_number = 0,
+            .protocol = MIDI_USB_PROTOCOL_2_0,
+            .timestamp_us = esp_timer_get_time()
+        };
+        out.data.ump = *ump;
+        return midi_usb_send_packet(&out);
+    }
+    
+    if (UMP_GET_MT(ump->words[0]) == UMP_MT_DATA_64) {
+        return usb_send_sysex7(ump);
+    }
+    
+    midi_message_t msg;
+    if (midi_translate_2to1(ump, &msg) != ESP_OK) {
+        return ESP_OK;  // Utility and stream messages have no MIDI 1.0 form
+    }
+    return midi_usb_send_midi1_message(&msg, 0);
+}
+
+static bool midi_usb_transport_link_up(void *ctx) {
+    return (g_usb_state.active_mode == MIDI_USB_MODE_DEVICE) ? midi_usb_device_is_mounted()
+                                                             : midi_usb_host_is_device_connected();
+}
+
+static const midi_transport_ops_t s_usb_transport = {
+    .name = "USB",
+    .native_format = MIDI_FORMAT_2_0,
+    .send = midi_usb_transport_send,
+    .link_up = midi_usb_transport_link_up
+};
+
 /**
  * @brief Initialize USB MIDI
  */
@@ -145,6 +257,11 @@ esp_err_t midi_usb_init(const midi_usb_config_t *config) {
     }
     
     g_usb_state.initialized = true;
+    
+    // Host mode talks USB-MIDI 1.0; device mode follows the alternate setting
+    midi_router_attach_transport(MIDI_TRANSPORT_USB, &s_usb_transport, NULL);
+    midi_router_set_transport_protocol(MIDI_TRANSPORT_USB, UMP_STREAM_PROTOCOL_MIDI1);
+    
     ESP_LOGI(TAG, "USB MIDI initialized in %s mode",
              (mode == MIDI_USB_MODE_HOST) ? "HOST" : "DEVICE");
     
@@ -160,6 +277,7 @@ esp_err_t midi_usb_deinit(void) {
     }
     
     ESP_LOGI(TAG, "Deinitializing USB MIDI");
+    midi_router_attach_transport(MIDI_TRANSPORT_USB, NULL, NULL);
     
     if (g_usb_state.active_mode == MIDI_USB_MODE_DEVICE) {
         midi_usb_device_deinit();
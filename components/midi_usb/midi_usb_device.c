@@ -7,12 +7,16 @@
 
 #include "midi_usb_device.h"
 #include "midi_usb_descriptors.h"
+#include "midi_router.h"
+#include "midi_capture.h"
+#include "ump_parser.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "tusb.h"
+#include "device/usbd_pvt.h"
 #include <string.h>
 
 static const char *TAG = "usb_device";
@@ -27,6 +31,7 @@ typedef struct {
     
     // TinyUSB MIDI interface
     uint8_t midi_itf;
+    uint8_t alt_setting;          // MIDI Streaming alternate setting (1 = UMP)
     
     // Callbacks
     midi_usb_rx_callback_t rx_callback;
@@ -56,6 +61,100 @@ static void tud_midi_rx_cb(uint8_t itf) {
     }
 }
 
+/**
+ * @brief Switch between USB-MIDI 1.0 (alt 0) and UMP (alt 1)
+ */
+static void usb_device_set_alt_setting(uint8_t alt) {
+    ESP_LOGI(TAG, "MIDI Streaming alternate setting %u", alt);
+    g_device_state.alt_setting = alt;
+    
+    // Alternate setting 1 (UMP) starts in the Group Terminal Block's
+    // protocol; the host may change it with Stream Configuration
+    midi_router_set_transport_protocol(MIDI_TRANSPORT_USB,
+                                       alt ? UMP_STREAM_PROTOCOL_MIDI2 : UMP_STREAM_PROTOCOL_MIDI1);
+}
+
+/**
+ * @brief Open the MIDI function, both alternate settings
+ * 
+ * TinyUSB's MIDI driver parses alternate setting 0; alternate setting 1
+ * uses the same endpoints, so its descriptors are claimed here as well.
+ */
+static uint16_t usb_midi_open(uint8_t rhport, tusb_desc_interface_t const *desc_intf,
+                              uint16_t max_len) {
+    uint16_t len = midid_open(rhport, desc_intf, max_len);
+    if (len == 0) {
+        return 0;
+    }
+    
+    uint8_t const *p = (uint8_t const *)desc_intf + len;
+    uint8_t const *end = (uint8_t const *)desc_intf + max_len;
+    while (p < end) {
+        if (tu_desc_type(p) == TUSB_DESC_INTERFACE_ASSOCIATION) {
+            break;
+        }
+        if (tu_desc_type(p) == TUSB_DESC_INTERFACE) {
+            tusb_desc_interface_t const *itf = (tusb_desc_interface_t const *)p;
+            if (itf->bAlternateSetting == 0) {
+                break;  // Next function
+            }
+            g_device_state.midi_itf = itf->bInterfaceNumber;
+        }
+        len += tu_desc_len(p);
+        p = tu_desc_next(p);
+    }
+    return len;
+}
+
+/**
+ * @brief Answer SET_INTERFACE / GET_INTERFACE for the streaming interface
+ */
+static bool usb_midi_control_xfer_cb(uint8_t rhport, uint8_t stage,
+                                     tusb_control_request_t const *request) {
+    if (request->bmRequestType_bit.type == TUSB_REQ_TYPE_STANDARD &&
+        request->bmRequestType_bit.recipient == TUSB_REQ_RCPT_INTERFACE &&
+        tu_u16_low(request->wIndex) == g_device_state.midi_itf && g_device_state.midi_itf) {
+        if (request->bRequest == TUSB_REQ_SET_INTERFACE) {
+            if (stage == CONTROL_STAGE_SETUP) {
+                if (request->wValue > 1) {
+                    return false;
+                }
+                usb_device_set_alt_setting((uint8_t)request->wValue);
+                tud_control_status(rhport, request);
+            }
+            return true;
+        }
+        if (request->bRequest == TUSB_REQ_GET_INTERFACE) {
+            if (stage == CONTROL_STAGE_SETUP) {
+                tud_control_xfer(rhport, request, &g_device_state.alt_setting, 1);
+            }
+            return true;
+        }
+    }
+    return midid_control_xfer_cb(rhport, stage, request);
+}
+
+static const usbd_class_driver_t s_usb_midi_driver = {
+    .init = midid_init,
+    .deinit = midid_deinit,
+    .reset = midid_reset,
+    .open = usb_midi_open,
+    .control_xfer_cb = usb_midi_control_xfer_cb,
+    .xfer_cb = midid_xfer_cb,
+    .sof = NULL,
+};
+
+/**
+ * @brief TinyUSB application class driver hook
+ * 
+ * Tried before the built-in drivers, so MIDI goes through the wrapper
+ * above and the alternate setting the host selects is seen.
+ */
+usbd_class_driver_t const *usbd_app_driver_get_cb(uint8_t *driver_count) {
+    *driver_count = 1;
+    return &s_usb_midi_driver;
+}
+
 /**
  * @brief TinyUSB mount callback
  * 
@@ -65,6 +164,9 @@ void tud_mount_cb(void) {
     ESP_LOGI(TAG, "USB device mounted (PC connected)");
     g_device_state.mounted = true;
     
+    // SET_CONFIGURATION selects alternate setting 0
+    usb_device_set_alt_setting(0);
+    
     if (g_device_state.conn_callback) {
         g_device_state.conn_callback(true, g_device_state.callback_ctx);
     }
@@ -79,6 +181,9 @@ void tud_umount_cb(void) {
     ESP_LOGI(TAG, "USB device unmounted (PC disconnected)");
     g_device_state.mounted = false;
     
+    // Release notes the host left sounding downstream
+    midi_router_source_lost(MIDI_TRANSPORT_USB);
+    
     if (g_device_state.conn_callback) {
         g_device_state.conn_callback(false, g_device_state.callback_ctx);
     }
@@ -106,44 +211,21 @@ static esp_err_t parse_usb_midi1_packet(const uint8_t *usb_packet,
     return ESP_OK;
 }
 
+/**
+ * @brief 32-bit words in a UMP, by Message Type
+ */
+static const uint8_t s_ump_words[16] = {
+    1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4
+};
+
 /**
  * @brief Parse UMP from USB
  */
-static esp_err_t parse_usb_ump(const uint8_t *usb_data, size_t len,
-                                midi_usb_packet_t *out_packet) {
-    if (len < 4) {
-        return ESP_ERR_INVALID_SIZE;
-    }
-    
-    // UMP packets are 32-bit word aligned
-    // Copy words into UMP structure
-    uint32_t *words = (uint32_t *)usb_data;
-    
+static esp_err_t parse_usb_ump(const uint32_t *words, midi_usb_packet_t *out_packet) {
+    out_packet->cable_number = 0;
     out_packet->protocol = MIDI_USB_PROTOCOL_2_0;
     out_packet->timestamp_us = esp_timer_get_time();
-    
-    // Determine packet size from Message Type
-    uint8_t mt = (words[0] >> 28) & 0x0F;
-    uint8_t num_words = 1;
-    
-    if (mt <= 0x2) num_words = 1;       // 32-bit
-    else if (mt <= 0x5) num_words = 2;  // 64-bit
-    else if (mt <= 0xC) num_words = 3;  // 96-bit
-    else num_words = 4;                  // 128-bit
-    
-    if (len < (num_words * 4)) {
-        return ESP_ERR_INVALID_SIZE;
-    }
-    
-    // Copy UMP words
-    for (int i = 0; i < num_words && i < 4; i++) {
-        out_packet->data.ump.words[i] = words[i];
-    }
-    out_packet->data.ump.num_words = num_words;
-    out_packet->data.ump.message_type = mt;
-    out_packet->data.ump.group = (words[0] >> 24) & 0x0F;
-    
-    return ESP_OK;
+    return ump_parser_parse_packet(words, &out_packet->data.ump);
 }
 
 /**
@@ -155,42 +237,38 @@ static esp_err_t parse_usb_ump(const uint8_t *usb_data, size_t len,
 static void midi_usb_device_rx_task(void *arg) {
     ESP_LOGI(TAG, "USB Device RX task started");
     
-    uint8_t buffer[64];
+    uint32_t words[4];
+    uint8_t num_words = 0;
     midi_usb_packet_t packet;
     
     while (1) {
         // Wait for notification from TinyUSB RX callback
         ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
         
-        // Process all available packets
-        while (tud_midi_available()) {
-            uint32_t bytes_read = tud_midi_stream_read(buffer, sizeof(buffer));
-            
-            if (bytes_read == 0) {
-                break;
-            }
-            
-            ESP_LOGD(TAG, "RX: %lu bytes from PC", bytes_read);
-            
-            // Check protocol (MIDI 1.0 vs MIDI 2.0)
-            // In MIDI 1.0 mode, packets are 4 bytes each
-            // In MIDI 2.0 mode (UMP), packets are variable length
-            
-            if (g_device_state.config.enable_midi2) {
-                // Parse as UMP
-                esp_err_t err = parse_usb_ump(buffer, bytes_read, &packet);
-                if (err == ESP_OK && g_device_state.rx_callback) {
+        // Both alternate settings move 4-byte units: USB-MIDI 1.0 Event
+        // Packets on alt 0, UMP words (little-endian) on alt 1
+        uint8_t unit[4];
+        while (tud_midi_packet_read(unit)) {
+            if (g_device_state.alt_setting == 0) {
+                num_words = 0;
+                midi_capture_rx(MIDI_TRANSPORT_USB, MIDI_CAPTURE_USB_MIDI1, unit, sizeof(unit));
+                if (parse_usb_midi1_packet(unit, &packet) == ESP_OK &&
+                    g_device_state.rx_callback) {
                     g_device_state.rx_callback(&packet, g_device_state.callback_ctx);
                 }
-            } else {
-                // Parse as USB-MIDI 1.0 (4 bytes per packet)
-                for (size_t i = 0; i + 3 < bytes_read; i += 4) {
-                    esp_err_t err = parse_usb_midi1_packet(&buffer[i], &packet);
-                    if (err == ESP_OK && g_device_state.rx_callback) {
-                        g_device_state.rx_callback(&packet, g_device_state.callback_ctx);
-                    }
-                }
+                continue;
+            }
+            
+            memcpy(&words[num_words++], unit, sizeof(unit));
+            if (num_words < s_ump_words[UMP_GET_MT(words[0])]) {
+                continue;
             }
+            midi_capture_rx(MIDI_TRANSPORT_USB, MIDI_CAPTURE_UMP, words, num_words * 4);
+            if (parse_usb_ump(words, &packet) == ESP_OK &&
+                g_device_state.rx_callback) {
+                g_device_state.rx_callback(&packet, g_device_state.callback_ctx);
+            }
+            num_words = 0;
         }
     }
 }
@@ -358,21 +436,20 @@ esp_err_t midi_usb_device_send_packet(const midi_usb_packet_t *packet) {
             packet->data.midi1.midi_bytes[2]
         };
         
-        uint32_t written = tud_midi_stream_write(packet->cable_number, 
-                                                   usb_packet, 4);
-        if (written != 4) {
-            ESP_LOGW(TAG, "TX: Only wrote %lu/4 bytes", written);
+        if (!tud_midi_packet_write(usb_packet)) {
+            ESP_LOGW(TAG, "TX: FIFO full");
             result = ESP_ERR_TIMEOUT;
         }
+    } else if (g_device_state.alt_setting != 1) {
+        result = ESP_ERR_INVALID_STATE;  // Host has not selected UMP
     } else {
-        // Send UMP
-        uint32_t num_bytes = packet->data.ump.num_words * 4;
-        uint32_t written = tud_midi_stream_write(packet->cable_number,
-                                                   (uint8_t*)packet->data.ump.words,
-                                                   num_bytes);
-        if (written != num_bytes) {
-            ESP_LOGW(TAG, "UMP TX: Only wrote %lu/%lu bytes", written, num_bytes);
-            result = ESP_ERR_TIMEOUT;
+        // Send UMP, one little-endian word per 4-byte unit
+        for (uint8_t i = 0; i < packet->data.ump.num_words; i++) {
+            if (!tud_midi_packet_write((const uint8_t *)&packet->data.ump.words[i])) {
+                ESP_LOGW(TAG, "UMP TX: Only wrote %u/%u words", i, packet->data.ump.num_words);
+                result = ESP_ERR_TIMEOUT;
+                break;
+            }
         }
     }
     
@@ -389,6 +466,13 @@ bool midi_usb_device_is_mounted(void) {
     return g_device_state.mounted;
 }
 
+/**
+ * @brief Check if the host selected the UMP alternate setting
+ */
+bool midi_usb_device_ump_active(void) {
+    return g_device_state.mounted && g_device_state.alt_setting == 1;
+}
+
 /**
  * @brief Flush TX FIFO
  */
@@ -6,6 +6,8 @@
  */
 
 #include "midi_usb_host.h"
+#include "midi_router.h"
+#include "midi_capture.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
@@ -239,6 +241,8 @@ static void midi_usb_host_rx_task(void *arg) {
         if (err == ESP_OK && transfer->actual_num_bytes > 0) {
             // Data received from MIDI device
             ESP_LOGD(TAG, "RX: %d bytes from MIDI device", transfer->actual_num_bytes);
+            midi_capture_rx(MIDI_TRANSPORT_USB, MIDI_CAPTURE_USB_MIDI1,
+                            transfer->data_buffer, transfer->actual_num_bytes);
             
             // Parse USB-MIDI packets (4 bytes each)
             for (int i = 0; i + 3 < transfer->actual_num_bytes; i += 4) {
@@ -333,6 +337,7 @@ static void usb_host_event_callback(const usb_host_client_event_msg_t *event_msg
                 g_host_state.device_connected = false;
                 
                 ESP_LOGI(TAG, "MIDI device removed");
+                midi_router_source_lost(MIDI_TRANSPORT_USB);
                 
                 // Call disconnection callback
                 if (g_host_state.conn_callback) {
@@ -14,11 +14,12 @@
  * - Retransmit support for packet loss recovery
  * - Multiple simultaneous connections
  * - Low-latency streaming
+ * - Clock sync between devices on the same socket (midi_sync.h)
  * 
  * Protocol Details:
  * - Port: 5004 (default host port)
  * - Service: _midi2._udp.local
- * - Payload: Raw UMP packets (4-16 bytes each)
+ * - Payload: "MIDI" signature + command packets (midi_net.h)
  * - MTU: 1472 bytes max (to fit in single UDP packet)
  */
 
@@ -29,6 +30,11 @@
 #include <stdbool.h>
 #include "esp_err.h"
 #include "ump_types.h"
+#include "midi_stats.h"
+#include "midi_router.h"
+#include "midi_net.h"
+#include "midi_timer_wheel.h"
+#include "midi_sync.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_netif.h"
@@ -48,10 +54,10 @@
 #define WIFI_FAIL_BIT         BIT1
 
 // Network MIDI 2.0 constants[file:4]
-#define MIDI_WIFI_DEFAULT_PORT        5004
-#define MIDI_WIFI_MTU                 1472  // Max UDP payload to fit in single packet
+#define MIDI_WIFI_DEFAULT_PORT        MIDI_NET_DEFAULT_PORT
+#define MIDI_WIFI_MTU                 MIDI_NET_MTU  // Max UDP payload to fit in single packet
 #define MIDI_WIFI_SERVICE_NAME        "_midi2._udp"
-#define MIDI_WIFI_KEEPALIVE_INTERVAL  1000  // 1 second
+#define MIDI_WIFI_KEEPALIVE_INTERVAL  1000  // Peer silence before a Ping (traffic counts as keepalive)
 #define MIDI_WIFI_SESSION_TIMEOUT     5000  // 5 seconds
 
 /**
@@ -64,29 +70,9 @@ typedef enum {
 } midi_wifi_mode_t;
 
 /**
- * @brief Session state
+ * @brief Remote peer information (session state and counters)
  */
-typedef enum {
-    MIDI_WIFI_SESSION_DISCONNECTED = 0,
-    MIDI_WIFI_SESSION_CONNECTING,
-    MIDI_WIFI_SESSION_CONNECTED,
-    MIDI_WIFI_SESSION_ERROR
-} midi_wifi_session_state_t;
-
-/**
- * @brief Remote peer information
- */
-typedef struct {
-    char ip_addr[16];            /**< IPv4 address string */
-    uint16_t port;               /**< UDP port */
-    char endpoint_name[64];      /**< UMP Endpoint name */
-    uint8_t session_id;          /**< Session identifier */
-    midi_wifi_session_state_t state;
-    uint32_t last_rx_time_ms;    /**< Last packet received timestamp */
-    uint32_t packets_rx;         /**< Packets received */
-    uint32_t packets_tx;         /**< Packets transmitted */
-    uint32_t packets_lost;       /**< Packets lost (detected) */
-} midi_wifi_peer_t;
+typedef midi_net_peer_t midi_wifi_peer_t;
 
 /**
  * @brief Discovered MIDI device info
@@ -146,9 +132,8 @@ typedef struct {
     char endpoint_name[64];          /**< UMP Endpoint name */
     uint8_t max_clients;             /**< Max simultaneous clients (host mode) */
     
-    bool enable_fec;                 /**< Enable Forward Error Correction */
-    bool enable_retransmit;          /**< Enable retransmit support */
-    uint16_t retransmit_buffer_size; /**< Retransmit buffer (packets) */
+    bool enable_fec;                 /**< Repeat MIDI_NET_FEC_DEPTH earlier commands per datagram */
+    bool enable_retransmit;          /**< Ask peers to resend gaps (history: MIDI_NET_HISTORY_SIZE) */
     
     bool enable_mdns;                /**< Enable mDNS discovery */
     
@@ -171,6 +156,20 @@ typedef struct {
     uint32_t discovery_count;
 } midi_wifi_stats_t;
 
+/**
+ * @brief Statistics shards, one per writer (see midi_stats.h)
+ */
+typedef enum {
+    MIDI_WIFI_STATS_RX,           /**< RX task (receive and session handling) */
+    MIDI_WIFI_STATS_TX,           /**< Send path, written under peers_mutex */
+    MIDI_WIFI_STATS_SHARDS
+} midi_wifi_stats_shard_id_t;
+
+typedef struct {
+    uint32_t generation;
+    midi_wifi_stats_t stats;
+} midi_wifi_stats_shard_t;
+
 /**
  * @brief WiFi MIDI driver state
  */
@@ -178,7 +177,10 @@ typedef struct {
     bool initialized;
     bool wifi_connected;
     midi_wifi_config_t config;
-    midi_wifi_stats_t stats;
+    
+    // Statistics (folded by midi_wifi_get_stats)
+    midi_stats_epoch_t stats_epoch;
+    midi_wifi_stats_shard_t stats_shards[MIDI_WIFI_STATS_SHARDS];
     
     // WiFi
     esp_netif_t *netif;
@@ -191,33 +193,22 @@ typedef struct {
     
     // Tasks
     TaskHandle_t rx_task_handle;
-    TaskHandle_t keepalive_task_handle;
     
-    // Session management
+    // Session management (midi_net engine, calls under peers_mutex)
+    midi_net_t net;
     midi_wifi_peer_t peers[CONFIG_MIDI_WIFI_MAX_CLIENTS];
-    uint8_t num_active_peers;
+    midi_timer_t peer_timers[CONFIG_MIDI_WIFI_MAX_CLIENTS]; // Next deadline per slot
     SemaphoreHandle_t peers_mutex;
     
+    // Clock sync (midi_sync engine, also under peers_mutex; role off unless configured)
+    midi_sync_t sync;
+    midi_timer_t sync_timer;
+    
     // Discovery (managed by midi_wifi_discovery.c)
     midi_wifi_discovered_device_t discovered[16];
     uint8_t num_discovered;
     SemaphoreHandle_t discovery_mutex;
     
-    // FEC buffer (for Forward Error Correction)
-    ump_packet_t *fec_buffer;
-    uint16_t fec_buffer_size;
-    uint16_t fec_buffer_idx;
-    
-    // Retransmit buffer
-    struct {
-        ump_packet_t packet;
-        uint32_t sequence_num;
-        uint32_t timestamp_ms;
-    } *retransmit_buffer;
-    uint16_t retransmit_buffer_size;
-    uint16_t retransmit_buffer_idx;
-    uint32_t tx_sequence_num;
-    
 } midi_wifi_state_t;
 
 /**
@@ -251,6 +242,27 @@ esp_err_t midi_wifi_deinit(void);
  */
 esp_err_t midi_wifi_connect(const char *ssid, const char *password, uint32_t timeout_ms);
 
+/**
+ * @brief Router TX callback for the WiFi transport
+ * 
+ * Registered with the router by midi_wifi_init(). Forwarded packets
+ * carry their hop count to MIDI-Cube peers as a hop marker (midi_net.h),
+ * so a loop between bridged devices ends at the router's hop limit.
+ * 
+ * @param packet UMP packet from the router
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for non-UMP packets
+ */
+esp_err_t midi_wifi_router_tx(const midi_router_packet_t *packet);
+
+/**
+ * @brief RX callback that feeds received UMP into the router
+ * 
+ * Use as midi_wifi_config_t.rx_callback. Passes the session sequence
+ * tag and hop marker so the router can drop duplicates and loops.
+ */
+void midi_wifi_router_rx(const ump_packet_t *ump, const midi_wifi_peer_t *peer,
+                         void *user_ctx);
+
 /**
  * @brief Disconnect from WiFi
  * 
@@ -290,7 +302,8 @@ esp_err_t midi_wifi_send_ump_to(const ump_packet_t *ump,
 /**
  * @brief Connect to discovered device (client mode)
  * 
- * Establishes session with remote host
+ * Sends an Invitation, repeated until the host accepts or
+ * MIDI_WIFI_SESSION_TIMEOUT passes
  * 
  * @param ip_addr Host IP address
  * @param port Host UDP port
@@ -301,7 +314,7 @@ esp_err_t midi_wifi_connect_to_peer(const char *ip_addr, uint16_t port);
 /**
  * @brief Disconnect from peer
  * 
- * Closes session with remote peer
+ * Closes session with remote peer (Bye)
  * 
  * @param ip_addr Peer IP address
  * @param port Peer UDP port
@@ -355,6 +368,9 @@ esp_err_t midi_wifi_stop_discovery(void);
 /**
  * @brief Get WiFi MIDI statistics
  * 
+ * Folds the RX and TX counter shards, plus the session engine's loss
+ * and recovery totals (briefly under peers_mutex).
+ * 
  * @param stats Output statistics structure
  * @return ESP_OK on success
  */
@@ -363,10 +379,23 @@ esp_err_t midi_wifi_get_stats(midi_wifi_stats_t *stats);
 /**
  * @brief Reset statistics
  * 
+ * Safe from any task; each shard is cleared by its writer, the session
+ * totals under peers_mutex.
+ * 
  * @return ESP_OK on success
  */
 esp_err_t midi_wifi_reset_stats(void);
 
+/**
+ * @brief Get clock sync state
+ * 
+ * @param stats Output: offset achieved and path delay (slave role)
+ * @param locked Output: shared timebase follows the master (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if clock sync does
+ *         not run on WiFi
+ */
+esp_err_t midi_wifi_get_sync_stats(midi_sync_stats_t *stats, bool *locked);
+
 /**
  * @brief Get local IP address
  * 
@@ -3,7 +3,8 @@
  * @brief MIDI WiFi Session Management - Internal API
  * 
  * Handles session establishment, keepalive, and tear-down
- * per Network MIDI 2.0 spec
+ * per Network MIDI 2.0 spec (engine in midi_net.h). Per-peer deadlines
+ * run as timers on the shared timer wheel (midi_timer_wheel.h).
  */
 
 #ifndef MIDI_WIFI_SESSION_H
@@ -11,18 +12,6 @@
 
 #include "midi_wifi.h"
 
-/**
- * @brief Session packet types (Network MIDI 2.0)[file:4]
- */
-typedef enum {
-    MIDI_WIFI_PKT_UMP = 0x00,           /**< UMP payload */
-    MIDI_WIFI_PKT_SESSION_START = 0x01,  /**< Session start request */
-    MIDI_WIFI_PKT_SESSION_ACK = 0x02,    /**< Session start acknowledgment */
-    MIDI_WIFI_PKT_SESSION_END = 0x03,    /**< Session end notification */
-    MIDI_WIFI_PKT_KEEPALIVE = 0x04,      /**< Keepalive heartbeat */
-    MIDI_WIFI_PKT_RETRANSMIT_REQ = 0x05, /**< Retransmit request */
-} midi_wifi_packet_type_t;
-
 /**
  * @brief Initialize session manager
  * 
@@ -34,6 +23,8 @@ esp_err_t midi_wifi_session_init(const midi_wifi_config_t *config);
 /**
  * @brief Deinitialize session manager
  * 
+ * Sends Bye to every peer.
+ * 
  * @return ESP_OK on success
  */
 esp_err_t midi_wifi_session_deinit(void);
@@ -41,24 +32,14 @@ esp_err_t midi_wifi_session_deinit(void);
 /**
  * @brief Handle incoming packet
  * 
- * Processes session control packets and UMP payload
+ * Processes session commands and UMP Data
  * 
- * @param data Packet data
- * @param len Packet length
- * @param src_ip Source IP address
- * @param src_port Source UDP port
+ * @param data Datagram
+ * @param len Datagram length
+ * @param src Sender address
  * @return ESP_OK on success
  */
 esp_err_t midi_wifi_session_handle_packet(const uint8_t *data, size_t len,
-                                           const char *src_ip, uint16_t src_port);
-
-/**
- * @brief Send session keepalive
- * 
- * Sends keepalive to all active sessions
- * 
- * @return ESP_OK on success
- */
-esp_err_t midi_wifi_session_send_keepalive(void);
+                                           const struct sockaddr_in *src);
 
 #endif /* MIDI_WIFI_SESSION_H */
@@ -13,7 +13,18 @@
 
 static const char *TAG = "midi_wifi";
 
-static midi_wifi_state_t g_wifi_state = {0};
+// Shared with midi_wifi_session.c
+midi_wifi_state_t g_wifi_state = {0};
+
+/**
+ * @brief Writer's statistics shard, cleared first if a reset is pending
+ */
+static inline midi_wifi_stats_t *wifi_stats(midi_wifi_stats_shard_id_t id) {
+    midi_wifi_stats_shard_t *shard = &g_wifi_state.stats_shards[id];
+    midi_stats_shard_sync(&g_wifi_state.stats_epoch, &shard->generation,
+                          &shard->stats, sizeof(shard->stats));
+    return &shard->stats;
+}
 
 /**
  * @brief WiFi event handler
@@ -130,17 +141,10 @@ static void midi_wifi_rx_task(void *arg) {
                           (struct sockaddr *)&src_addr, &src_addr_len);
         
         if (len > 0) {
-            // Convert source address to string
-            char src_ip[16];
-            inet_ntoa_r(src_addr.sin_addr, src_ip, sizeof(src_ip));
-            uint16_t src_port = ntohs(src_addr.sin_port);
-            
-            ESP_LOGD(TAG, "RX: %d bytes from %s:%d", len, src_ip, src_port);
-            
-            g_wifi_state.stats.packets_rx_total++;
+            wifi_stats(MIDI_WIFI_STATS_RX)->packets_rx_total++;
             
             // Handle packet via session manager
-            midi_wifi_session_handle_packet(rx_buffer, len, src_ip, src_port);
+            midi_wifi_session_handle_packet(rx_buffer, len, &src_addr);
             
         } else if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
             ESP_LOGW(TAG, "recvfrom failed: errno %d", errno);
@@ -149,21 +153,6 @@ static void midi_wifi_rx_task(void *arg) {
     }
 }
 
-/**
- * @brief Keepalive task - sends periodic keepalive packets
- */
-static void midi_wifi_keepalive_task(void *arg) {
-    ESP_LOGI(TAG, "Keepalive task started");
-    
-    while (1) {
-        vTaskDelay(pdMS_TO_TICKS(MIDI_WIFI_KEEPALIVE_INTERVAL));
-        
-        if (g_wifi_state.wifi_connected && g_wifi_state.num_active_peers > 0) {
-            midi_wifi_session_send_keepalive();
-        }
-    }
-}
-
 /**
  * @brief Initialize mDNS for service discovery[file:4]
  */
@@ -210,6 +199,32 @@ static esp_err_t mdns_init_service(void) {
     return ESP_OK;
 }
 
+static esp_err_t midi_wifi_transport_send(void *ctx, const midi_router_packet_t *packet) {
+    return midi_wifi_router_tx(packet);
+}
+
+static bool midi_wifi_transport_link_up(void *ctx) {
+    return g_wifi_state.wifi_connected && midi_net_num_sessions(&g_wifi_state.net) > 0;
+}
+
+static esp_err_t midi_wifi_transport_stats(void *ctx, midi_transport_stats_t *stats) {
+    midi_wifi_stats_t wifi;
+    midi_wifi_get_stats(&wifi);
+    stats->packets_tx = wifi.packets_tx_total;
+    stats->packets_rx = wifi.packets_rx_total;
+    stats->packets_lost = wifi.packets_lost_total;
+    return ESP_OK;
+}
+
+static const midi_transport_ops_t s_wifi_transport = {
+    .name = "WiFi",
+    .native_format = MIDI_FORMAT_2_0,
+    .flags = MIDI_TRANSPORT_FLAG_NETWORK,
+    .send = midi_wifi_transport_send,
+    .link_up = midi_wifi_transport_link_up,
+    .get_stats = midi_wifi_transport_stats
+};
+
 /**
  * @brief Initialize MIDI WiFi driver
  */
@@ -246,19 +261,6 @@ esp_err_t midi_wifi_init(const midi_wifi_config_t *config) {
         return ESP_FAIL;
     }
     
-    // Allocate FEC buffer if enabled
-    if (config->enable_fec) {
-        g_wifi_state.fec_buffer = malloc(sizeof(ump_packet_t) * 2);
-        g_wifi_state.fec_buffer_size = 2;
-    }
-    
-    // Allocate retransmit buffer if enabled
-    if (config->enable_retransmit) {
-        g_wifi_state.retransmit_buffer = calloc(config->retransmit_buffer_size,
-                                                 sizeof(*g_wifi_state.retransmit_buffer));
-        g_wifi_state.retransmit_buffer_size = config->retransmit_buffer_size;
-    }
-    
     // Initialize WiFi
     err = wifi_init_sta();
     if (err != ESP_OK) {
@@ -272,6 +274,7 @@ esp_err_t midi_wifi_init(const midi_wifi_config_t *config) {
     }
     
     g_wifi_state.initialized = true;
+    midi_router_attach_transport(MIDI_TRANSPORT_WIFI, &s_wifi_transport, NULL);
     
     ESP_LOGI(TAG, "MIDI WiFi initialized (mode: %s)",
              config->mode == MIDI_WIFI_MODE_HOST ? "HOST" :
@@ -289,14 +292,12 @@ esp_err_t midi_wifi_deinit(void) {
     }
     
     ESP_LOGI(TAG, "Deinitializing MIDI WiFi");
+    midi_router_attach_transport(MIDI_TRANSPORT_WIFI, NULL, NULL);
     
     // Stop tasks
     if (g_wifi_state.rx_task_handle) {
         vTaskDelete(g_wifi_state.rx_task_handle);
     }
-    if (g_wifi_state.keepalive_task_handle) {
-        vTaskDelete(g_wifi_state.keepalive_task_handle);
-    }
     
     // Close socket
     if (g_wifi_state.sock_fd >= 0) {
@@ -315,14 +316,6 @@ esp_err_t midi_wifi_deinit(void) {
     esp_wifi_stop();
     esp_wifi_deinit();
     
-    // Free buffers
-    if (g_wifi_state.fec_buffer) {
-        free(g_wifi_state.fec_buffer);
-    }
-    if (g_wifi_state.retransmit_buffer) {
-        free(g_wifi_state.retransmit_buffer);
-    }
-    
     // Delete mutexes
     if (g_wifi_state.peers_mutex) {
         vSemaphoreDelete(g_wifi_state.peers_mutex);
@@ -381,9 +374,6 @@ esp_err_t midi_wifi_connect(const char *ssid, const char *password, uint32_t tim
         // Create RX task
         xTaskCreate(midi_wifi_rx_task, "midi_wifi_rx", 4096, NULL, 10, &g_wifi_state.rx_task_handle);
         
-        // Create keepalive task
-        xTaskCreate(midi_wifi_keepalive_task, "midi_wifi_ka", 2048, NULL, 5, &g_wifi_state.keepalive_task_handle);
-        
         return ESP_OK;
     } else {
         ESP_LOGE(TAG, "Failed to connect to WiFi");
@@ -392,9 +382,12 @@ esp_err_t midi_wifi_connect(const char *ssid, const char *password, uint32_t tim
 }
 
 /**
- * @brief Send UMP to all connected peers
+ * @brief Send UMP to all connected peers, behind a hop marker if hops > 0
+ * 
+ * One UMP Data command per session, behind the FEC copies of the
+ * previous ones.
  */
-esp_err_t midi_wifi_send_ump(const ump_packet_t *ump) {
+static esp_err_t wifi_send_ump(const ump_packet_t *ump, uint8_t hops) {
     if (!g_wifi_state.initialized || !g_wifi_state.wifi_connected) {
         return ESP_ERR_INVALID_STATE;
     }
@@ -403,61 +396,97 @@ esp_err_t midi_wifi_send_ump(const ump_packet_t *ump) {
         return ESP_ERR_INVALID_ARG;
     }
     
-    // Build packet payload[file:4]
-    uint8_t payload[MIDI_WIFI_MTU];
-    size_t payload_len = 0;
-    
-    // Packet header: type (1 byte) + sequence (4 bytes)
-    payload[0] = MIDI_WIFI_PKT_UMP;
-    uint32_t seq = g_wifi_state.tx_sequence_num++;
-    memcpy(&payload[1], &seq, 4);
-    payload_len = 5;
-    
-    // Add UMP words
-    uint32_t ump_bytes = ump->num_words * 4;
-    memcpy(&payload[payload_len], ump->words, ump_bytes);
-    payload_len += ump_bytes;
-    
-    // Send to all active peers
     xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
+    midi_wifi_stats_t *stats = wifi_stats(MIDI_WIFI_STATS_TX);
     
-    for (int i = 0; i < g_wifi_state.num_active_peers; i++) {
-        midi_wifi_peer_t *peer = &g_wifi_state.peers[i];
-        
-        if (peer->state != MIDI_WIFI_SESSION_CONNECTED) {
-            continue;
-        }
-        
-        struct sockaddr_in dest_addr;
-        dest_addr.sin_family = AF_INET;
-        dest_addr.sin_port = htons(peer->port);
-        inet_pton(AF_INET, peer->ip_addr, &dest_addr.sin_addr);
-        
-        int sent = sendto(g_wifi_state.sock_fd, payload, payload_len, 0,
-                         (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-        
-        if (sent == payload_len) {
-            peer->packets_tx++;
-            g_wifi_state.stats.packets_tx_total++;
-        } else {
-            ESP_LOGW(TAG, "Failed to send to %s:%d", peer->ip_addr, peer->port);
-        }
+    esp_err_t err = midi_net_send_ump_hops(&g_wifi_state.net, ump->words, ump->num_words,
+                                           hops, esp_timer_get_time());
+    if (err == ESP_OK) {
+        stats->packets_tx_total += midi_net_num_sessions(&g_wifi_state.net);
     }
     
     xSemaphoreGive(g_wifi_state.peers_mutex);
     
-    // Store in retransmit buffer if enabled
-    if (g_wifi_state.retransmit_buffer) {
-        uint16_t idx = g_wifi_state.retransmit_buffer_idx++ % g_wifi_state.retransmit_buffer_size;
-        g_wifi_state.retransmit_buffer[idx].packet = *ump;
-        g_wifi_state.retransmit_buffer[idx].sequence_num = seq;
-        g_wifi_state.retransmit_buffer[idx].timestamp_ms = esp_timer_get_time() / 1000;
+    return err;
+}
+
+/**
+ * @brief Send UMP to all connected peers
+ */
+esp_err_t midi_wifi_send_ump(const ump_packet_t *ump) {
+    return wifi_send_ump(ump, 0);
+}
+
+/**
+ * @brief Router TX callback
+ */
+esp_err_t midi_wifi_router_tx(const midi_router_packet_t *packet) {
+    if (packet->format != MIDI_FORMAT_2_0) {
+        return ESP_ERR_INVALID_ARG;
     }
+    return wifi_send_ump(&packet->data.ump, packet->hops);
+}
+
+/**
+ * @brief RX callback feeding the router
+ */
+void midi_wifi_router_rx(const ump_packet_t *ump, const midi_wifi_peer_t *peer,
+                         void *user_ctx) {
+    midi_router_packet_t packet = {
+        .source = MIDI_TRANSPORT_WIFI,
+        .destination = 0xFF,
+        .format = MIDI_FORMAT_2_0,
+        .hops = peer->last_rx_hops,
+        .seq = peer->last_rx_seq,
+        .data.ump = *ump
+    };
+    
+    if (midi_router_send(&packet) != ESP_OK) {
+        ESP_LOGD(TAG, "Router queue full, WiFi packet dropped");
+    }
+}
+
+/**
+ * @brief Get list of active peers
+ */
+esp_err_t midi_wifi_get_peers(midi_wifi_peer_t *peers, uint8_t max_peers, uint8_t *num_peers) {
+    if (!peers || !num_peers) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!g_wifi_state.peers_mutex) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    *num_peers = 0;
+    xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_MIDI_WIFI_MAX_CLIENTS && *num_peers < max_peers; i++) {
+        if (g_wifi_state.peers[i].state == MIDI_NET_PEER_ESTABLISHED) {
+            peers[(*num_peers)++] = g_wifi_state.peers[i];
+        }
+    }
+    xSemaphoreGive(g_wifi_state.peers_mutex);
     
     return ESP_OK;
 }
 
-// ... (remaining helper functions: get_stats, get_peers, etc.)
+/**
+ * @brief Get local IP address
+ */
+esp_err_t midi_wifi_get_local_ip(char *ip_str) {
+    if (!ip_str) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!g_wifi_state.netif || !g_wifi_state.wifi_connected) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    esp_netif_ip_info_t ip_info;
+    esp_err_t err = esp_netif_get_ip_info(g_wifi_state.netif, &ip_info);
+    if (err == ESP_OK) {
+        esp_ip4addr_ntoa(&ip_info.ip, ip_str, 16);
+    }
+    return err;
+}
 
 /**
  * @brief Check if WiFi is connected
@@ -474,8 +503,37 @@ esp_err_t midi_wifi_get_stats(midi_wifi_stats_t *stats) {
         return ESP_ERR_INVALID_ARG;
     }
     
-    *stats = g_wifi_state.stats;
-    stats->active_sessions = g_wifi_state.num_active_peers;
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < MIDI_WIFI_STATS_SHARDS; i++) {
+        const midi_wifi_stats_shard_t *shard = &g_wifi_state.stats_shards[i];
+        if (midi_stats_shard_current(&g_wifi_state.stats_epoch, &shard->generation)) {
+            midi_stats_add_u32(stats, &shard->stats, sizeof(*stats));
+        }
+    }
+    
+    // Session engine totals (lost less recovered, resent on request)
+    // and the session gauge
+    xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
+    stats->packets_lost_total += g_wifi_state.net.stats.packets_lost;
+    stats->packets_recovered_fec += g_wifi_state.net.stats.packets_recovered_fec;
+    stats->packets_retransmitted += g_wifi_state.net.stats.packets_retransmitted;
+    stats->active_sessions = midi_net_num_sessions(&g_wifi_state.net);
+    xSemaphoreGive(g_wifi_state.peers_mutex);
+    
+    // Gauge, not counter
+    stats->discovery_count = g_wifi_state.num_discovered;
+    
+    return ESP_OK;
+}
+
+/**
+ * @brief Reset statistics
+ */
+esp_err_t midi_wifi_reset_stats(void) {
+    midi_stats_epoch_advance(&g_wifi_state.stats_epoch);
     
+    xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
+    memset(&g_wifi_state.net.stats, 0, sizeof(g_wifi_state.net.stats));
+    xSemaphoreGive(g_wifi_state.peers_mutex);
     return ESP_OK;
 }
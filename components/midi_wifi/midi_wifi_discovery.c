@@ -89,8 +89,6 @@ esp_err_t midi_wifi_start_discovery(uint32_t scan_duration_ms) {
         r = r->next;
     }
     
-    g_wifi_state.stats.discovery_count = g_wifi_state.num_discovered;
-    
     xSemaphoreGive(g_wifi_state.discovery_mutex);
     
     // Free results
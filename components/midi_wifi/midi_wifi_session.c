@@ -2,391 +2,282 @@
  * @file midi_wifi_session.c
  * @brief MIDI WiFi Session Management Implementation
  * 
- * Handles session lifecycle per Network MIDI 2.0 spec
+ * Binds the Network MIDI 2.0 session engine (midi_net.h) to the WiFi
+ * UDP socket, the application callbacks and the router. Clock sync
+ * messages (midi_sync.h) arrive on the same socket and go to the sync
+ * engine instead.
  */
 
 #include "midi_wifi_session.h"
 #include "midi_wifi.h"
+#include "midi_router.h"
+#include "midi_capture.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include <string.h>
 
 static const char *TAG = "wifi_session";
 
-// External access to main state (declared in midi_wifi.c)
+// External access to main state (defined in midi_wifi.c)
 extern midi_wifi_state_t g_wifi_state;
 
 /**
- * @brief Session packet header structure[file:4]
+ * @brief Engine send callback: one datagram to the peer
  */
-typedef struct __attribute__((packed)) {
-    uint8_t packet_type;        // MIDI_WIFI_PKT_*
-    uint32_t sequence_number;   // Packet sequence
-    uint8_t session_id;         // Session identifier (optional)
-} session_packet_header_t;
+static esp_err_t session_send(const midi_net_addr_t *to, const uint8_t *data, size_t len,
+                              void *ctx) {
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(to->port),
+        .sin_addr.s_addr = to->ip
+    };
+    
+    int sent = sendto(g_wifi_state.sock_fd, data, len, 0,
+                      (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    return (sent == (int)len) ? ESP_OK : ESP_FAIL;
+}
 
 /**
- * @brief Find peer by IP and port
+ * @brief Engine UMP callback: capture, then hand to the application
  */
-static midi_wifi_peer_t* find_peer(const char *ip_addr, uint16_t port) {
-    for (int i = 0; i < g_wifi_state.num_active_peers; i++) {
-        midi_wifi_peer_t *peer = &g_wifi_state.peers[i];
-        if (strcmp(peer->ip_addr, ip_addr) == 0 && peer->port == port) {
-            return peer;
-        }
+static void session_ump(const midi_net_peer_t *peer, const ump_packet_t *ump, void *ctx) {
+    midi_capture_rx(MIDI_TRANSPORT_WIFI, MIDI_CAPTURE_UMP, ump->words, ump->num_words * 4);
+    
+    if (g_wifi_state.config.rx_callback) {
+        g_wifi_state.config.rx_callback(ump, peer, g_wifi_state.config.callback_ctx);
     }
-    return NULL;
 }
 
 /**
- * @brief Add new peer to list
+ * @brief Engine session callback: a peer came or went
  */
-static midi_wifi_peer_t* add_peer(const char *ip_addr, uint16_t port) {
-    if (g_wifi_state.num_active_peers >= CONFIG_MIDI_WIFI_MAX_CLIENTS) {
-        ESP_LOGW(TAG, "Max peers reached, cannot add %s:%d", ip_addr, port);
-        return NULL;
+static void session_changed(const midi_net_peer_t *peer, bool up, void *ctx) {
+    // The engine negotiates the session's protocol itself (session_endpoint)
+    if (!up) {
+        midi_router_source_lost(MIDI_TRANSPORT_WIFI);
     }
-    
-    midi_wifi_peer_t *peer = &g_wifi_state.peers[g_wifi_state.num_active_peers++];
-    memset(peer, 0, sizeof(midi_wifi_peer_t));
-    
-    strncpy(peer->ip_addr, ip_addr, sizeof(peer->ip_addr) - 1);
-    peer->port = port;
-    peer->session_id = g_wifi_state.num_active_peers;  // Simple ID assignment
-    peer->state = MIDI_WIFI_SESSION_CONNECTING;
-    peer->last_rx_time_ms = esp_timer_get_time() / 1000;
-    
-    ESP_LOGI(TAG, "Added peer %s:%d (session %d)", ip_addr, port, peer->session_id);
-    
-    return peer;
-}
 
-/**
- * @brief Remove peer from list
- */
-static void remove_peer(midi_wifi_peer_t *peer) {
-    if (!peer) return;
-    
-    ESP_LOGI(TAG, "Removing peer %s:%d", peer->ip_addr, peer->port);
-    
-    // Shift remaining peers
-    int peer_idx = peer - g_wifi_state.peers;
-    if (peer_idx < g_wifi_state.num_active_peers - 1) {
-        memmove(peer, peer + 1, 
-                (g_wifi_state.num_active_peers - peer_idx - 1) * sizeof(midi_wifi_peer_t));
+    if (g_wifi_state.config.conn_callback) {
+        g_wifi_state.config.conn_callback(peer, up, g_wifi_state.config.callback_ctx);
     }
-    
-    g_wifi_state.num_active_peers--;
 }
 
 /**
- * @brief Send session start acknowledgment[file:4]
+ * @brief Engine endpoint callback: sessions negotiate as the router's endpoint
  */
-static esp_err_t send_session_ack(const char *ip_addr, uint16_t port, uint8_t session_id) {
-    uint8_t packet[6];
-    packet[0] = MIDI_WIFI_PKT_SESSION_ACK;
-    memcpy(&packet[1], &g_wifi_state.tx_sequence_num, 4);
-    packet[5] = session_id;
-    
-    struct sockaddr_in dest_addr;
-    dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(port);
-    inet_pton(AF_INET, ip_addr, &dest_addr.sin_addr);
-    
-    int sent = sendto(g_wifi_state.sock_fd, packet, sizeof(packet), 0,
-                     (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-    
-    if (sent != sizeof(packet)) {
-        ESP_LOGW(TAG, "Failed to send session ACK to %s:%d", ip_addr, port);
-        return ESP_FAIL;
-    }
-    
-    ESP_LOGD(TAG, "Sent SESSION_ACK to %s:%d", ip_addr, port);
-    return ESP_OK;
+static const ump_endpoint_t *session_endpoint(void *ctx) {
+    return midi_router_get_endpoint();
 }
 
 /**
- * @brief Send keepalive packet[file:4]
+ * @brief Engine schedule callback: move the slot's timer on the shared wheel
  */
-static esp_err_t send_keepalive(midi_wifi_peer_t *peer) {
-    uint8_t packet[5];
-    packet[0] = MIDI_WIFI_PKT_KEEPALIVE;
-    memcpy(&packet[1], &g_wifi_state.tx_sequence_num, 4);
-    
-    struct sockaddr_in dest_addr;
-    dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(peer->port);
-    inet_pton(AF_INET, peer->ip_addr, &dest_addr.sin_addr);
-    
-    int sent = sendto(g_wifi_state.sock_fd, packet, sizeof(packet), 0,
-                     (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+static void session_schedule(midi_net_peer_t *peer, int64_t due_us, void *ctx) {
+    midi_timer_t *timer = &g_wifi_state.peer_timers[peer - g_wifi_state.peers];
     
-    if (sent != sizeof(packet)) {
-        return ESP_FAIL;
+    if (due_us) {
+        midi_timer_start(timer, due_us);
+    } else {
+        midi_timer_stop(timer);
     }
-    
-    ESP_LOGV(TAG, "Sent KEEPALIVE to %s:%d", peer->ip_addr, peer->port);
-    return ESP_OK;
 }
 
 /**
- * @brief Handle session start request[file:4]
+ * @brief A slot's deadline passed (timer task)
  */
-static esp_err_t handle_session_start(const uint8_t *data, size_t len,
-                                       const char *src_ip, uint16_t src_port) {
-    ESP_LOGI(TAG, "SESSION_START from %s:%d", src_ip, src_port);
-    
+static void session_timer(midi_timer_t *timer, void *ctx) {
     xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
-    
-    // Check if peer already exists
-    midi_wifi_peer_t *peer = find_peer(src_ip, src_port);
-    if (!peer) {
-        peer = add_peer(src_ip, src_port);
-        if (!peer) {
-            xSemaphoreGive(g_wifi_state.peers_mutex);
-            return ESP_ERR_NO_MEM;
-        }
-    }
-    
-    // Mark as connected
-    peer->state = MIDI_WIFI_SESSION_CONNECTED;
-    peer->last_rx_time_ms = esp_timer_get_time() / 1000;
-    
+    midi_net_expire(&g_wifi_state.net, ctx, esp_timer_get_time());
     xSemaphoreGive(g_wifi_state.peers_mutex);
-    
-    // Send acknowledgment
-    send_session_ack(src_ip, src_port, peer->session_id);
-    
-    // Notify application
-    if (g_wifi_state.config.conn_callback) {
-        g_wifi_state.config.conn_callback(peer, true, g_wifi_state.config.callback_ctx);
+}
+
+static bool peer_addr(const char *ip_addr, uint16_t port, midi_net_addr_t *addr) {
+    struct in_addr in;
+    if (inet_pton(AF_INET, ip_addr, &in) != 1) {
+        return false;
     }
-    
-    return ESP_OK;
+    addr->ip = in.s_addr;
+    addr->port = port;
+    return true;
 }
 
+#ifdef CONFIG_MIDI_WIFI_CLOCK_SYNC
 /**
- * @brief Handle session end notification[file:4]
+ * @brief Sync engine clock: stamps taken right after a send
  */
-static esp_err_t handle_session_end(const uint8_t *data, size_t len,
-                                     const char *src_ip, uint16_t src_port) {
-    ESP_LOGI(TAG, "SESSION_END from %s:%d", src_ip, src_port);
-    
-    xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
-    
-    midi_wifi_peer_t *peer = find_peer(src_ip, src_port);
-    if (peer) {
-        // Notify application before removing
-        if (g_wifi_state.config.conn_callback) {
-            g_wifi_state.config.conn_callback(peer, false, g_wifi_state.config.callback_ctx);
-        }
-        
-        remove_peer(peer);
-    }
-    
-    xSemaphoreGive(g_wifi_state.peers_mutex);
-    
-    return ESP_OK;
+static int64_t sync_clock(void *ctx) {
+    return esp_timer_get_time();
 }
 
 /**
- * @brief Handle keepalive packet[file:4]
+ * @brief Sync period passed (timer task)
  */
-static esp_err_t handle_keepalive(const uint8_t *data, size_t len,
-                                   const char *src_ip, uint16_t src_port) {
+static void sync_timer(midi_timer_t *timer, void *ctx) {
     xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
-    
-    midi_wifi_peer_t *peer = find_peer(src_ip, src_port);
-    if (peer) {
-        peer->last_rx_time_ms = esp_timer_get_time() / 1000;
-        ESP_LOGV(TAG, "KEEPALIVE from %s:%d", src_ip, src_port);
-    }
-    
+    int64_t next_us = midi_sync_expire(&g_wifi_state.sync, esp_timer_get_time());
+    bool running = (g_wifi_state.sync.config.role != MIDI_SYNC_ROLE_OFF);
     xSemaphoreGive(g_wifi_state.peers_mutex);
     
-    return ESP_OK;
+    if (running) {
+        midi_timer_start(timer, next_us);
+    }
 }
 
 /**
- * @brief Handle UMP payload packet[file:4]
+ * @brief Start clock sync in the configured role
  */
-static esp_err_t handle_ump_payload(const uint8_t *data, size_t len,
-                                     const char *src_ip, uint16_t src_port) {
-    if (len < 5) {  // Header (1 + 4) + at least 4 bytes UMP
-        return ESP_ERR_INVALID_SIZE;
+static esp_err_t sync_start(void) {
+    midi_sync_config_t sync_config;
+    midi_sync_config_default(&sync_config);
+    sync_config.send = session_send;
+    sync_config.clock = sync_clock;
+#ifdef CONFIG_MIDI_SYNC_ROLE_SLAVE
+    if (!peer_addr(CONFIG_MIDI_SYNC_MASTER_IP, CONFIG_MIDI_SYNC_MASTER_PORT, &sync_config.master)) {
+        ESP_LOGE(TAG, "Bad clock sync master address %s", CONFIG_MIDI_SYNC_MASTER_IP);
+        return ESP_ERR_INVALID_ARG;
     }
+#endif
     
-    // Extract sequence number
-    uint32_t sequence;
-    memcpy(&sequence, &data[1], 4);
-    
-    // Parse UMP packets (starting at offset 5)
-    const uint8_t *ump_data = &data[5];
-    size_t ump_len = len - 5;
-    
+    int64_t now = esp_timer_get_time();
     xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
-    
-    midi_wifi_peer_t *peer = find_peer(src_ip, src_port);
-    if (!peer || peer->state != MIDI_WIFI_SESSION_CONNECTED) {
-        xSemaphoreGive(g_wifi_state.peers_mutex);
-        return ESP_ERR_INVALID_STATE;
-    }
-    
-    peer->last_rx_time_ms = esp_timer_get_time() / 1000;
-    peer->packets_rx++;
-    
+    esp_err_t err = midi_sync_init(&g_wifi_state.sync, &sync_config, now);
     xSemaphoreGive(g_wifi_state.peers_mutex);
     
-    // Parse UMP words
-    size_t offset = 0;
-    while (offset + 4 <= ump_len) {
-        ump_packet_t ump;
-        memset(&ump, 0, sizeof(ump));
-        
-        // Read first word to determine packet size
-        memcpy(&ump.words[0], &ump_data[offset], 4);
-        uint8_t mt = (ump.words[0] >> 28) & 0x0F;
-        
-        // Determine number of words
-        if (mt <= 0x2) ump.num_words = 1;       // 32-bit
-        else if (mt <= 0x5) ump.num_words = 2;  // 64-bit
-        else if (mt <= 0xC) ump.num_words = 3;  // 96-bit
-        else ump.num_words = 4;                  // 128-bit
-        
-        // Check if enough data
-        if (offset + (ump.num_words * 4) > ump_len) {
-            ESP_LOGW(TAG, "Incomplete UMP packet");
-            break;
-        }
-        
-        // Read remaining words
-        for (int i = 1; i < ump.num_words; i++) {
-            memcpy(&ump.words[i], &ump_data[offset + (i * 4)], 4);
-        }
-        
-        ump.message_type = mt;
-        ump.group = (ump.words[0] >> 24) & 0x0F;
-        
-        // Call user callback
-        if (g_wifi_state.config.rx_callback) {
-            g_wifi_state.config.rx_callback(&ump, peer, g_wifi_state.config.callback_ctx);
-        }
-        
-        offset += ump.num_words * 4;
+    if (err == ESP_OK) {
+        midi_timer_init(&g_wifi_state.sync_timer, sync_timer, NULL);
+        midi_timer_start(&g_wifi_state.sync_timer, now);
+        ESP_LOGI(TAG, "Clock sync started as %s",
+                 sync_config.role == MIDI_SYNC_ROLE_MASTER ? "master" : "slave");
     }
-    
-    return ESP_OK;
+    return err;
 }
+#endif
 
 /**
  * @brief Handle incoming packet
  */
 esp_err_t midi_wifi_session_handle_packet(const uint8_t *data, size_t len,
-                                           const char *src_ip, uint16_t src_port) {
-    if (len < 1) {
-        return ESP_ERR_INVALID_SIZE;
-    }
-    
-    uint8_t packet_type = data[0];
+                                           const struct sockaddr_in *src) {
+    midi_net_addr_t from = {
+        .ip = src->sin_addr.s_addr,
+        .port = ntohs(src->sin_port)
+    };
+    int64_t now = esp_timer_get_time(); // Before the lock: sync timestamps want arrival
     
-    switch (packet_type) {
-        case MIDI_WIFI_PKT_SESSION_START:
-            return handle_session_start(data, len, src_ip, src_port);
-            
-        case MIDI_WIFI_PKT_SESSION_END:
-            return handle_session_end(data, len, src_ip, src_port);
-            
-        case MIDI_WIFI_PKT_KEEPALIVE:
-            return handle_keepalive(data, len, src_ip, src_port);
-            
-        case MIDI_WIFI_PKT_UMP:
-            return handle_ump_payload(data, len, src_ip, src_port);
-            
-        case MIDI_WIFI_PKT_RETRANSMIT_REQ:
-            // TODO: Handle retransmit request
-            ESP_LOGD(TAG, "Retransmit request from %s:%d", src_ip, src_port);
-            return ESP_OK;
-            
-        default:
-            ESP_LOGW(TAG, "Unknown packet type: 0x%02X from %s:%d", 
-                     packet_type, src_ip, src_port);
-            return ESP_ERR_NOT_SUPPORTED;
+    xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
+    esp_err_t err = midi_sync_match(data, len)
+                    ? midi_sync_receive(&g_wifi_state.sync, &from, data, len, now)
+                    : midi_net_receive(&g_wifi_state.net, &from, data, len, now);
+    xSemaphoreGive(g_wifi_state.peers_mutex);
+
+    if (err != ESP_OK) {
+        ESP_LOGD(TAG, "Ignored %u-byte datagram: %s", (unsigned)len, esp_err_to_name(err));
     }
+    return err;
 }
 
 /**
- * @brief Send keepalive to all peers
+ * @brief Invite a host (client mode)
  */
-esp_err_t midi_wifi_session_send_keepalive(void) {
-    xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
+esp_err_t midi_wifi_connect_to_peer(const char *ip_addr, uint16_t port) {
+    midi_net_addr_t to;
+    if (!ip_addr || !peer_addr(ip_addr, port, &to)) {
+        return ESP_ERR_INVALID_ARG;
+    }
     
-    uint32_t current_time_ms = esp_timer_get_time() / 1000;
+    xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
+    esp_err_t err = midi_net_invite(&g_wifi_state.net, &to, esp_timer_get_time());
+    xSemaphoreGive(g_wifi_state.peers_mutex);
     
-    for (int i = 0; i < g_wifi_state.num_active_peers; i++) {
-        midi_wifi_peer_t *peer = &g_wifi_state.peers[i];
-        
-        if (peer->state != MIDI_WIFI_SESSION_CONNECTED) {
-            continue;
-        }
-        
-        // Check for timeout
-        if (current_time_ms - peer->last_rx_time_ms > MIDI_WIFI_SESSION_TIMEOUT) {
-            ESP_LOGW(TAG, "Peer %s:%d timed out", peer->ip_addr, peer->port);
-            
-            // Notify application
-            if (g_wifi_state.config.conn_callback) {
-                g_wifi_state.config.conn_callback(peer, false, g_wifi_state.config.callback_ctx);
-            }
-            
-            remove_peer(peer);
-            i--;  // Adjust index after removal
-            continue;
-        }
-        
-        // Send keepalive
-        send_keepalive(peer);
+    return err;
+}
+
+/**
+ * @brief End a session with Bye
+ */
+esp_err_t midi_wifi_disconnect_peer(const char *ip_addr, uint16_t port) {
+    midi_net_addr_t to;
+    if (!ip_addr || !peer_addr(ip_addr, port, &to)) {
+        return ESP_ERR_INVALID_ARG;
     }
-    
+
+    xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
+    esp_err_t err = midi_net_bye(&g_wifi_state.net, &to, MIDI_NET_BYE_USER_TERMINATED,
+                                 esp_timer_get_time());
     xSemaphoreGive(g_wifi_state.peers_mutex);
     
-    return ESP_OK;
+    return err;
 }
 
 /**
  * @brief Initialize session manager
  */
 esp_err_t midi_wifi_session_init(const midi_wifi_config_t *config) {
-    ESP_LOGI(TAG, "Session manager initialized");
-    return ESP_OK;
+    midi_net_config_t net_config = {
+        .name = config->endpoint_name,
+        .accept_invitations = (config->mode != MIDI_WIFI_MODE_CLIENT),
+        .fec_depth = config->enable_fec ? MIDI_NET_FEC_DEPTH : 0,
+        .retransmit = config->enable_retransmit,
+        .ping_interval_ms = MIDI_WIFI_KEEPALIVE_INTERVAL,
+        .timeout_ms = MIDI_WIFI_SESSION_TIMEOUT,
+        .send = session_send,
+        .on_ump = session_ump,
+        .on_session = session_changed,
+        .schedule = session_schedule,
+        .endpoint = session_endpoint
+    };
+    
+    esp_err_t err = midi_timer_service_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    for (int i = 0; i < CONFIG_MIDI_WIFI_MAX_CLIENTS; i++) {
+        midi_timer_init(&g_wifi_state.peer_timers[i], session_timer, &g_wifi_state.peers[i]);
+    }
+    
+    err = midi_net_init(&g_wifi_state.net, &net_config, g_wifi_state.peers,
+                        CONFIG_MIDI_WIFI_MAX_CLIENTS);
+#ifdef CONFIG_MIDI_WIFI_CLOCK_SYNC
+    if (err == ESP_OK) {
+        err = sync_start();
+    }
+#endif
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Session manager initialized");
+    }
+    return err;
 }
 
 /**
  * @brief Deinitialize session manager
  */
 esp_err_t midi_wifi_session_deinit(void) {
-    // Send SESSION_END to all peers
+    // Send Bye to all peers
     xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
+    midi_net_close_all(&g_wifi_state.net, MIDI_NET_BYE_POWER_DOWN, esp_timer_get_time());
+    g_wifi_state.sync.config.role = MIDI_SYNC_ROLE_OFF; // A sync tick already due does not rearm
+    xSemaphoreGive(g_wifi_state.peers_mutex);
+    midi_timer_stop(&g_wifi_state.sync_timer);
     
-    for (int i = 0; i < g_wifi_state.num_active_peers; i++) {
-        midi_wifi_peer_t *peer = &g_wifi_state.peers[i];
-        
-        uint8_t packet[5];
-        packet[0] = MIDI_WIFI_PKT_SESSION_END;
-        memcpy(&packet[1], &g_wifi_state.tx_sequence_num, 4);
-        
-        struct sockaddr_in dest_addr;
-        dest_addr.sin_family = AF_INET;
-        dest_addr.sin_port = htons(peer->port);
-        inet_pton(AF_INET, peer->ip_addr, &dest_addr.sin_addr);
-        
-        sendto(g_wifi_state.sock_fd, packet, sizeof(packet), 0,
-               (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-        
-        ESP_LOGI(TAG, "Sent SESSION_END to %s:%d", peer->ip_addr, peer->port);
+    return ESP_OK;
+}
+
+/**
+ * @brief Get clock sync state
+ */
+esp_err_t midi_wifi_get_sync_stats(midi_sync_stats_t *stats, bool *locked) {
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!g_wifi_state.peers_mutex || g_wifi_state.sync.config.role == MIDI_SYNC_ROLE_OFF) {
+        return ESP_ERR_NOT_SUPPORTED;
     }
     
-    g_wifi_state.num_active_peers = 0;
-    
+    xSemaphoreTake(g_wifi_state.peers_mutex, portMAX_DELAY);
+    *stats = g_wifi_state.sync.stats;
+    if (locked) {
+        *locked = midi_sync_locked(&g_wifi_state.sync);
+    }
     xSemaphoreGive(g_wifi_state.peers_mutex);
     
     return ESP_OK;
@@ -33,6 +33,10 @@
 
 // Test suite (optional)
 #include "test_midi_core.h"
+#include "test_midi_router.h"
+#include "test_midi_loopback.h"
+#include "test_midi_smf.h"
+#include "test_midi_net.h"
 
 static const char *TAG = "main";
 
@@ -322,6 +326,10 @@ void app_main(void) {
 #if ENABLE_TEST_MODE
     // Run test suite instead of normal operation
     midi_core_run_tests();
+    midi_router_run_tests();
+    midi_loopback_run_tests();
+    midi_smf_run_tests();
+    midi_net_run_tests();
     ESP_LOGI(TAG, "Test mode complete. Reboot to run application.");
     return;
 #endif
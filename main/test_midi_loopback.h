@@ -0,0 +1,14 @@
+/**
+ * @file test_midi_loopback.h
+ * @brief MIDI Loopback Test Suite Header
+ */
+
+#ifndef TEST_MIDI_LOOPBACK_H
+#define TEST_MIDI_LOOPBACK_H
+
+/**
+ * @brief Run all MIDI Loopback component tests
+ */
+void midi_loopback_run_tests(void);
+
+#endif /* TEST_MIDI_LOOPBACK_H */
@@ -0,0 +1,1104 @@
+/**
+ * @file test_midi_net.c
+ * @brief Interactive test harness for midi_net component
+ * 
+ * Call midi_net_run_tests() from main.c to execute all tests
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "ump_defs.h"
+#include "midi_net.h"
+#include "ump_endpoint.h"
+#include "midi_timer_wheel.h"
+#include "midi_sync.h"
+#include "midi_timebase.h"
+#include "lwip/sockets.h"
+
+static const char *TAG = "net_test";
+
+/**
+ * @brief One Network MIDI 2.0 endpoint on a localhost UDP socket
+ */
+typedef struct {
+    int fd;
+    midi_net_addr_t addr;
+    midi_net_t net;
+    midi_net_peer_t peers[2];
+    uint32_t drop_mask;           // Bit n: datagram n is lost on the way
+    uint32_t sent;
+    uint8_t last[64];             // Last datagram sent (first 64 bytes)
+    size_t last_len;
+    uint32_t words[16];           // Word 0 of each UMP delivered
+    uint8_t hops[16];             // Hop marker of each UMP delivered
+    uint32_t received;
+    int sessions;                 // Sessions up minus down
+    int64_t due_us;               // Last deadline reported by the engine
+    const ump_endpoint_t *endpoint; // Negotiate per session as this (NULL = off)
+} test_net_node_t;
+
+static test_net_node_t s_net_host, s_net_client;
+
+static esp_err_t test_net_send(const midi_net_addr_t *to, const uint8_t *data, size_t len,
+                               void *ctx) {
+    test_net_node_t *node = ctx;
+    uint32_t n = node->sent++;
+    
+    node->last_len = len < sizeof(node->last) ? len : sizeof(node->last);
+    memcpy(node->last, data, node->last_len);
+    if (n < 32 && (node->drop_mask & (1u << n))) {
+        return ESP_OK;
+    }
+    struct sockaddr_in dest = {
+        .sin_family = AF_INET, .sin_port = htons(to->port), .sin_addr.s_addr = to->ip
+    };
+    return sendto(node->fd, data, len, 0, (struct sockaddr *)&dest, sizeof(dest)) == (int)len ?
+           ESP_OK : ESP_FAIL;
+}
+
+static void test_net_ump(const midi_net_peer_t *peer, const ump_packet_t *ump, void *ctx) {
+    test_net_node_t *node = ctx;
+    if (node->received < 16) {
+        node->words[node->received] = ump->words[0];
+        node->hops[node->received] = peer->last_rx_hops;
+    }
+    node->received++;
+}
+
+static void test_net_session(const midi_net_peer_t *peer, bool up, void *ctx) {
+    ((test_net_node_t *)ctx)->sessions += up ? 1 : -1;
+}
+
+static void test_net_schedule(midi_net_peer_t *peer, int64_t due_us, void *ctx) {
+    ((test_net_node_t *)ctx)->due_us = due_us;
+}
+
+static const ump_endpoint_t *test_net_endpoint(void *ctx) {
+    return ((test_net_node_t *)ctx)->endpoint;
+}
+
+static bool test_net_open(test_net_node_t *node, const char *name, bool host) {
+    memset(node, 0, sizeof(*node));
+    node->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    
+    struct sockaddr_in local = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(local);
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = 20000 };
+    if (node->fd < 0 || bind(node->fd, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+        getsockname(node->fd, (struct sockaddr *)&local, &len) < 0) {
+        return false;
+    }
+    setsockopt(node->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    node->addr = (midi_net_addr_t){ .ip = local.sin_addr.s_addr, .port = ntohs(local.sin_port) };
+    
+    midi_net_config_t cfg = {
+        .name = name, .accept_invitations = host, .fec_depth = 2, .retransmit = true,
+        .send = test_net_send, .on_ump = test_net_ump, .on_session = test_net_session,
+        .ctx = node
+    };
+    return midi_net_init(&node->net, &cfg, node->peers, 2) == ESP_OK;
+}
+
+/**
+ * @brief Feed the datagrams waiting at some nodes to their engines until quiet
+ */
+static void test_net_settle_nodes(test_net_node_t *const *nodes, int count, int64_t now_us) {
+    uint8_t buf[MIDI_NET_MTU];
+    bool busy = true;
+    
+    while (busy) {
+        busy = false;
+        for (int i = 0; i < count; i++) {
+            struct sockaddr_in src;
+            socklen_t len = sizeof(src);
+            int n = recvfrom(nodes[i]->fd, buf, sizeof(buf), 0, (struct sockaddr *)&src, &len);
+            if (n > 0) {
+                midi_net_addr_t from = { .ip = src.sin_addr.s_addr, .port = ntohs(src.sin_port) };
+                midi_net_receive(&nodes[i]->net, &from, buf, n, now_us);
+                busy = true;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Feed the datagrams waiting at host and client until quiet
+ */
+static void test_net_settle(int64_t now_us) {
+    test_net_node_t *const nodes[] = { &s_net_host, &s_net_client };
+    test_net_settle_nodes(nodes, 2, now_us);
+}
+
+static void test_net_note(uint8_t note, int64_t now_us) {
+    uint32_t word = 0x20903C00 | note;
+    midi_net_send_ump(&s_net_client.net, &word, 1, now_us);
+    test_net_settle(now_us);
+}
+
+/**
+ * @brief Test 1: Network MIDI 2.0 Sessions over Localhost UDP
+ */
+void test_network_session(void) {
+    ESP_LOGI(TAG, "=== Test 1: Network MIDI 2.0 Sessions over UDP ===");
+    
+    if (!test_net_open(&s_net_host, "MIDI-Cube", true) ||
+        !test_net_open(&s_net_client, "Test Peer", false)) {
+        ESP_LOGE(TAG, "✗ Localhost UDP sockets unavailable!");
+        close(s_net_host.fd);
+        close(s_net_client.fd);
+        return;
+    }
+    int64_t now = 1000000;
+    
+    // Invitation, Invitation Reply: Accepted; names travel both ways
+    midi_net_invite(&s_net_client.net, &s_net_host.addr, now);
+    test_net_settle(now);
+    midi_net_peer_t *at_host = midi_net_find(&s_net_host.net, &s_net_client.addr);
+    midi_net_peer_t *at_client = midi_net_find(&s_net_client.net, &s_net_host.addr);
+    bool session_ok = at_host && at_client &&
+                      at_host->state == MIDI_NET_PEER_ESTABLISHED &&
+                      at_client->state == MIDI_NET_PEER_ESTABLISHED &&
+                      s_net_host.sessions == 1 && s_net_client.sessions == 1 &&
+                      strcmp(at_host->endpoint_name, "Test Peer") == 0 &&
+                      strcmp(at_client->endpoint_name, "MIDI-Cube") == 0;
+    if (!session_ok) {
+        ESP_LOGE(TAG, "✗ Session not established (host %d, client %d)!",
+                 s_net_host.sessions, s_net_client.sessions);
+        close(s_net_host.fd);
+        close(s_net_client.fd);
+        return;
+    }
+    
+    // Wire format: signature, UMP Data (0xFF), 1 word, sequence 0, the UMP
+    test_net_note(0, now);
+    static const uint8_t expected[] = {
+        'M', 'I', 'D', 'I', 0xFF, 0x01, 0x00, 0x00, 0x20, 0x90, 0x3C, 0x00
+    };
+    bool wire_ok = s_net_client.last_len == sizeof(expected) &&
+                   memcmp(s_net_client.last, expected, sizeof(expected)) == 0 &&
+                   s_net_host.received == 1;
+    
+    // FEC: the second of four datagrams is lost, its copy rides in the third
+    s_net_client.drop_mask = 1u << (s_net_client.sent + 1);
+    for (uint8_t i = 1; i <= 4; i++) {
+        test_net_note(i, now);
+    }
+    bool fec_ok = s_net_host.received == 5 && at_host->packets_recovered_fec == 1 &&
+                  at_host->packets_lost == 0;
+    for (uint32_t i = 0; i < 5 && fec_ok; i++) {
+        fec_ok = s_net_host.words[i] == (0x20903C00u | i);
+    }
+    
+    // Three in a row lost: FEC (depth 2) brings two, Retransmit Request the first
+    s_net_client.drop_mask = 7u << s_net_client.sent;
+    for (uint8_t i = 5; i <= 8; i++) {
+        test_net_note(i, now);
+    }
+    bool retx_ok = s_net_host.received == 9 && at_host->packets_recovered_retransmit == 1 &&
+                   at_host->packets_recovered_fec == 3 && at_host->packets_lost == 0 &&
+                   at_client->packets_retransmitted == 1 && s_net_host.words[8] == 0x20903C05;
+    s_net_client.drop_mask = 0;
+    
+    // A forwarded message goes behind a hop marker, which is not delivered
+    uint32_t forwarded = 0x20903C09;
+    midi_net_send_ump_hops(&s_net_client.net, &forwarded, 1, 3, now);
+    static const uint8_t marked[] = {
+        0xFF, 0x02, 0x00, 0x09, 0x00, 0x00, 'H', 0x03, 0x20, 0x90, 0x3C, 0x09
+    };
+    bool hop_wire_ok = s_net_client.last_len == 32 &&  // Behind two FEC copies
+                       memcmp(&s_net_client.last[20], marked, sizeof(marked)) == 0;
+    test_net_settle(now);
+    test_net_note(10, now);
+    bool hops_ok = s_net_host.received == 11 && s_net_host.words[9] == forwarded &&
+                   s_net_host.hops[9] == 3 && s_net_host.hops[10] == 0 &&
+                   at_host->last_rx_hops == 0;
+    
+    // The inviter's Ping answered; silence past the timeout ends the session with Bye
+    now += (int64_t)MIDI_NET_PING_INTERVAL_MS * 1000;
+    midi_net_poll(&s_net_client.net, now);
+    test_net_settle(now);
+    bool ping_ok = at_host->last_rx_us == now && at_client->last_rx_us == now &&
+                   s_net_host.sessions == 1;
+    now += (int64_t)MIDI_NET_SESSION_TIMEOUT_MS * 1000;
+    midi_net_poll(&s_net_host.net, now);
+    test_net_settle(now);
+    bool timeout_ok = ping_ok && s_net_host.sessions == 0 && s_net_client.sessions == 0 &&
+                      !midi_net_find(&s_net_host.net, &s_net_client.addr) &&
+                      !midi_net_find(&s_net_client.net, &s_net_host.addr);
+    
+    // Without a session, UMP Data gets Bye (Session Not Established); junk is dropped
+    uint32_t word = 0x20903C00;
+    midi_net_invite(&s_net_client.net, &s_net_host.addr, now);
+    test_net_settle(now);
+    at_host = midi_net_find(&s_net_host.net, &s_net_client.addr);
+    at_host->state = MIDI_NET_PEER_FREE; // Host forgets the client (e.g. rebooted)
+    s_net_host.sessions--;
+    midi_net_send_ump(&s_net_client.net, &word, 1, now);
+    test_net_settle(now);
+    const uint8_t junk[] = { 'R', 'T', 'P', '!', 0xFF, 0x00, 0x00, 0x00 };
+    bool stranger_ok = s_net_host.last_len == 8 && s_net_host.last[4] == MIDI_NET_CMD_BYE &&
+                       s_net_host.last[6] == MIDI_NET_BYE_NO_SESSION &&
+                       s_net_client.sessions == 0 &&
+                       midi_net_receive(&s_net_host.net, &s_net_client.addr, junk, sizeof(junk),
+                                        now) == ESP_ERR_INVALID_RESPONSE;
+    
+    // Bye from the client ends the session at both ends
+    midi_net_invite(&s_net_client.net, &s_net_host.addr, now);
+    test_net_settle(now);
+    bool reopened = s_net_host.sessions == 1 && s_net_client.sessions == 1;
+    midi_net_bye(&s_net_client.net, &s_net_host.addr, MIDI_NET_BYE_USER_TERMINATED, now);
+    test_net_settle(now);
+    bool bye_ok = reopened && s_net_host.sessions == 0 && s_net_client.sessions == 0 &&
+                  !midi_net_find(&s_net_client.net, &s_net_host.addr);
+    
+    close(s_net_host.fd);
+    close(s_net_client.fd);
+    
+    ESP_LOGI(TAG, "✓ Invitation accepted, endpoint names exchanged");
+    if (wire_ok) {
+        ESP_LOGI(TAG, "✓ Datagram is \"MIDI\" + UMP Data command (12 bytes for one MT 0x2)");
+    } else {
+        ESP_LOGE(TAG, "✗ Wire format wrong (%u bytes)!", (unsigned)s_net_client.last_len);
+    }
+    if (fec_ok) {
+        ESP_LOGI(TAG, "✓ Lost datagram recovered from FEC copy, order kept");
+    } else {
+        ESP_LOGE(TAG, "✗ FEC: %lu delivered, %lu recovered, %lu lost!",
+                 (unsigned long)s_net_host.received, (unsigned long)at_host->packets_recovered_fec,
+                 (unsigned long)at_host->packets_lost);
+    }
+    if (retx_ok) {
+        ESP_LOGI(TAG, "✓ Gap beyond FEC filled by Retransmit Request");
+    } else {
+        ESP_LOGE(TAG, "✗ Retransmit: %lu delivered, %lu retransmitted, %lu lost!",
+                 (unsigned long)s_net_host.received,
+                 (unsigned long)at_client->packets_retransmitted,
+                 (unsigned long)at_host->packets_lost);
+    }
+    if (hop_wire_ok && hops_ok) {
+        ESP_LOGI(TAG, "✓ Hop count rides in a NOOP marker and reaches the receiver");
+    } else {
+        ESP_LOGE(TAG, "✗ Hop marker %s, delivered hops %u!", hop_wire_ok ? "sent" : "wrong",
+                 s_net_host.hops[9]);
+    }
+    if (timeout_ok) {
+        ESP_LOGI(TAG, "✓ Ping answered; silent peer timed out with Bye");
+    } else {
+        ESP_LOGE(TAG, "✗ Ping %s, sessions after timeout %d/%d!", ping_ok ? "ok" : "lost",
+                 s_net_host.sessions, s_net_client.sessions);
+    }
+    if (stranger_ok) {
+        ESP_LOGI(TAG, "✓ Data without session gets Bye; unsigned datagram ignored");
+    } else {
+        ESP_LOGE(TAG, "✗ Stranger handling wrong (last host command 0x%02X)!", s_net_host.last[4]);
+    }
+    if (bye_ok) {
+        ESP_LOGI(TAG, "✓ Bye closes the session at both ends");
+    } else {
+        ESP_LOGE(TAG, "✗ Bye left sessions open (%d/%d)!", s_net_host.sessions, s_net_client.sessions);
+    }
+}
+
+static test_net_node_t s_net_midi1;
+
+/**
+ * @brief Test 2: UMP Endpoint Negotiation per Session
+ */
+void test_network_endpoint(void) {
+    ESP_LOGI(TAG, "=== Test 2: UMP Endpoint Negotiation per Session ===");
+    
+    // We send JR timestamps; one peer speaks MIDI 1.0 only, the other
+    // MIDI 2.0 and receives JR timestamps
+    static const ump_endpoint_t ours = {
+        .info = { .ump_version_major = UMP_VERSION_MAJOR, .ump_version_minor = UMP_VERSION_MINOR,
+                  .midi2_protocol = true, .midi1_protocol = true, .tx_jr_timestamp = true },
+        .protocol = UMP_STREAM_PROTOCOL_MIDI2
+    };
+    static const ump_endpoint_t midi1_only = {
+        .info = { .ump_version_major = UMP_VERSION_MAJOR, .ump_version_minor = UMP_VERSION_MINOR,
+                  .midi1_protocol = true },
+        .protocol = UMP_STREAM_PROTOCOL_MIDI1
+    };
+    static const ump_endpoint_t jr_receiver = {
+        .info = { .ump_version_major = UMP_VERSION_MAJOR, .ump_version_minor = UMP_VERSION_MINOR,
+                  .midi2_protocol = true, .rx_jr_timestamp = true },
+        .protocol = UMP_STREAM_PROTOCOL_MIDI2
+    };
+    
+    test_net_node_t *const nodes[] = { &s_net_host, &s_net_midi1, &s_net_client };
+    if (!test_net_open(&s_net_host, "MIDI-Cube", true) ||
+        !test_net_open(&s_net_midi1, "MIDI 1.0 Peer", false) ||
+        !test_net_open(&s_net_client, "JR Peer", false)) {
+        ESP_LOGE(TAG, "✗ Localhost UDP sockets unavailable!");
+        for (int i = 0; i < 3; i++) {
+            close(nodes[i]->fd);
+        }
+        return;
+    }
+    const ump_endpoint_t *endpoints[] = { &ours, &midi1_only, &jr_receiver };
+    for (int i = 0; i < 3; i++) {
+        nodes[i]->endpoint = endpoints[i];
+        nodes[i]->net.config.endpoint = test_net_endpoint;
+    }
+    int64_t now = 1000000;
+    
+    // Both sessions open; each side discovers the other and asks for the
+    // best common settings
+    midi_net_invite(&s_net_midi1.net, &s_net_host.addr, now);
+    midi_net_invite(&s_net_client.net, &s_net_host.addr, now);
+    test_net_settle_nodes(nodes, 3, now);
+    midi_net_peer_t *to_midi1 = midi_net_find(&s_net_host.net, &s_net_midi1.addr);
+    midi_net_peer_t *to_jr = midi_net_find(&s_net_host.net, &s_net_client.addr);
+    midi_net_peer_t *jr_to_us = midi_net_find(&s_net_client.net, &s_net_host.addr);
+    bool negotiated = to_midi1 && to_jr && jr_to_us &&
+                      to_midi1->link.negotiated && to_jr->link.negotiated &&
+                      to_midi1->link.protocol == UMP_STREAM_PROTOCOL_MIDI1 &&
+                      to_jr->link.protocol == UMP_STREAM_PROTOCOL_MIDI2;
+    
+    // JR timestamps flow one way: we send, the JR peer receives
+    bool jr_ok = negotiated && to_jr->link.jr_tx && !to_jr->link.jr_rx &&
+                 jr_to_us->link.jr_rx && !jr_to_us->link.jr_tx &&
+                 !to_midi1->link.jr_tx && !to_midi1->link.jr_rx;
+    bool consumed = s_net_host.received == 0 && s_net_midi1.received == 0 &&
+                    s_net_client.received == 0;
+    
+    // Discovery from one session is answered on that session only
+    uint32_t midi1_before = negotiated ? to_midi1->packets_tx : 0;
+    uint32_t jr_before = negotiated ? to_jr->packets_tx : 0;
+    uint32_t discovery[4] = {
+        0xF0000000u | (UMP_VERSION_MAJOR << 8) | UMP_VERSION_MINOR, UMP_DISCOVER_ENDPOINT_INFO
+    };
+    midi_net_send_ump(&s_net_midi1.net, discovery, 4, now);
+    test_net_settle_nodes(nodes, 3, now);
+    bool answered_one = negotiated && to_midi1->packets_tx > midi1_before &&
+                        to_jr->packets_tx == jr_before;
+    
+    // One send, each session in its own form: MT 0x2 for MIDI 1.0, MT 0x4
+    // and the JR timestamp for the other
+    uint32_t note[2] = { 0x40903C00, 0xFFFF0000 };
+    uint32_t jr_stamp = 0x00201234;
+    midi_net_send_ump(&s_net_host.net, &jr_stamp, 1, now);
+    midi_net_send_ump(&s_net_host.net, note, 2, now);
+    test_net_settle_nodes(nodes, 3, now);
+    bool adapted = s_net_midi1.received == 1 && s_net_midi1.words[0] == 0x20903C7F &&
+                   s_net_client.received == 2 && s_net_client.words[0] == jr_stamp &&
+                   s_net_client.words[1] == note[0];
+    
+    for (int i = 0; i < 3; i++) {
+        close(nodes[i]->fd);
+    }
+    
+    if (negotiated && consumed) {
+        ESP_LOGI(TAG, "✓ Each session settled on its own protocol");
+    } else {
+        ESP_LOGE(TAG, "✗ Session negotiation wrong (negotiated %d, stream delivered %d)!",
+                 negotiated, !consumed);
+    }
+    if (jr_ok) {
+        ESP_LOGI(TAG, "✓ JR timestamps enabled in the direction both ends support");
+    } else {
+        ESP_LOGE(TAG, "✗ JR timestamps negotiated the wrong way!");
+    }
+    if (answered_one && adapted) {
+        ESP_LOGI(TAG, "✓ Replies stay on the asking session, sends fit each session");
+    } else {
+        ESP_LOGE(TAG, "✗ Per-session traffic wrong (replies %d, forms %d: got %lu/%lu)!",
+                 answered_one, adapted, (unsigned long)s_net_midi1.received,
+                 (unsigned long)s_net_client.received);
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+static int64_t s_wheel_now;
+static int64_t s_wheel_fired[8];
+static uint32_t s_wheel_order;
+
+static void test_wheel_fired(midi_timer_t *timer, void *ctx) {
+    s_wheel_fired[(intptr_t)ctx] = s_wheel_now;
+    s_wheel_order = (s_wheel_order << 4) | (uint32_t)(intptr_t)ctx;
+}
+
+/**
+ * @brief Test 3: Timer Wheel and Session Deadlines
+ */
+void test_timer_wheel(void) {
+    ESP_LOGI(TAG, "=== Test 3: Timer Wheel and Session Deadlines ===");
+    
+    // Pure wheel, driven like the timer task: wake only at next_us
+    static midi_timer_wheel_t wheel;
+    static midi_timer_t timers[6];
+    static const int64_t due[6] = {
+        4500, 64000, 10000, 4100000, 300000000, 65000 // #2 is cancelled
+    };
+    midi_timer_wheel_init(&wheel, 0);
+    memset(s_wheel_fired, 0, sizeof(s_wheel_fired));
+    s_wheel_order = 0;
+    for (int i = 0; i < 6; i++) {
+        midi_timer_init(&timers[i], test_wheel_fired, (void *)(intptr_t)i);
+        midi_timer_wheel_add(&wheel, &timers[i], due[i]);
+    }
+    midi_timer_wheel_cancel(&wheel, &timers[2]);
+    
+    int wakeups = 0;
+    int64_t next;
+    while ((next = midi_timer_wheel_next_us(&wheel)) != 0 && wakeups < 100) {
+        s_wheel_now = next;
+        midi_timer_wheel_advance(&wheel, next);
+        midi_timer_t *timer;
+        while ((timer = midi_timer_wheel_pop(&wheel)) != NULL) {
+            timer->fn(timer, timer->ctx);
+        }
+        wakeups++;
+    }
+    uint32_t wheel_order = s_wheel_order;
+    bool wheel_ok = wheel_order == 0x1534 && s_wheel_fired[2] == 0;
+    for (int i = 0; i < 6 && wheel_ok; i++) {
+        int64_t expected = (due[i] + MIDI_TIMER_TICK_US - 1) / MIDI_TIMER_TICK_US * MIDI_TIMER_TICK_US;
+        wheel_ok = (i == 2) || s_wheel_fired[i] == expected;
+    }
+    
+    // Many timers: none early or late, never out of order
+    static midi_timer_t many[200];
+    static int64_t many_due[200];
+    uint32_t lcg = 12345;
+    int64_t last_fired = 0;
+    bool many_ok = true;
+    midi_timer_wheel_init(&wheel, 1000000);
+    for (int i = 0; i < 200; i++) {
+        lcg = lcg * 1103515245 + 12345;
+        many_due[i] = 1000000 + (lcg >> 8) % 10000000;
+        midi_timer_init(&many[i], NULL, (void *)(intptr_t)i);
+        midi_timer_wheel_add(&wheel, &many[i], many_due[i]);
+    }
+    int fired = 0;
+    while ((next = midi_timer_wheel_next_us(&wheel)) != 0) {
+        midi_timer_wheel_advance(&wheel, next);
+        midi_timer_t *timer;
+        while ((timer = midi_timer_wheel_pop(&wheel)) != NULL) {
+            int64_t exact = many_due[(intptr_t)timer->ctx];
+            many_ok &= next >= exact && next - exact < MIDI_TIMER_TICK_US && next >= last_fired;
+            last_fired = next;
+            fired++;
+        }
+    }
+    many_ok &= (fired == 200);
+    
+    // Shared timer service: one task, callbacks in deadline order
+    static midi_timer_t service_timers[3];
+    s_wheel_order = 0;
+    midi_timer_service_init();
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < 3; i++) {
+        midi_timer_init(&service_timers[i], test_wheel_fired, (void *)(intptr_t)(i + 1));
+    }
+    s_wheel_now = start;
+    midi_timer_start(&service_timers[2], start + 30000);
+    midi_timer_start(&service_timers[0], start + 10000);
+    midi_timer_start(&service_timers[1], start + 20000);
+    vTaskDelay(pdMS_TO_TICKS(100));
+    bool service_ok = s_wheel_order == 0x123;
+    
+    // Engine deadlines: flush of a lost last datagram, retransmit retry, timeout
+    bool open_ok = test_net_open(&s_net_host, "MIDI-Cube", true) &&
+                   test_net_open(&s_net_client, "Test Peer", false);
+    s_net_host.net.config.schedule = test_net_schedule;
+    s_net_client.net.config.schedule = test_net_schedule;
+    int64_t now = 1000000;
+    midi_net_invite(&s_net_client.net, &s_net_host.addr, now);
+    test_net_settle(now);
+    midi_net_peer_t *at_host = midi_net_find(&s_net_host.net, &s_net_client.addr);
+    midi_net_peer_t *at_client = midi_net_find(&s_net_client.net, &s_net_host.addr);
+    int64_t ping_us = (int64_t)MIDI_NET_PING_INTERVAL_MS * 1000;
+    open_ok &= at_host && at_client && s_net_host.due_us == now + 2 * ping_us &&
+               s_net_client.due_us == now + ping_us;
+    
+    bool flush_ok = false, retx_ok = false, timeout_ok = false;
+    if (open_ok) {
+        s_net_client.drop_mask = 1u << s_net_client.sent;
+        test_net_note(1, now);
+        flush_ok = s_net_client.due_us == now + MIDI_NET_FEC_FLUSH_MS * 1000 &&
+                   s_net_host.received == 0;
+        now = s_net_client.due_us;
+        midi_net_expire(&s_net_client.net, at_client, now);
+        test_net_settle(now);
+        flush_ok &= s_net_host.received == 1 && s_net_host.words[0] == 0x20903C01 &&
+                    s_net_client.due_us == 1000000 + ping_us;
+        
+        // Without FEC: lose #1, and the answer to the first Retransmit Request
+        s_net_client.net.config.fec_depth = 0;
+        s_net_client.drop_mask = (1u << s_net_client.sent) | (1u << (s_net_client.sent + 2));
+        test_net_note(2, now);
+        test_net_note(3, now);
+        retx_ok = s_net_host.received == 2 && at_host->packets_lost == 1 &&
+                  s_net_host.due_us == now + MIDI_NET_RETRANSMIT_TIMEOUT_MS * 1000;
+        now = s_net_host.due_us;
+        midi_net_expire(&s_net_host.net, at_host, now);
+        test_net_settle(now);
+        retx_ok &= s_net_host.received == 3 && s_net_host.words[2] == 0x20903C02 &&
+                   at_host->packets_lost == 0 && at_host->packets_recovered_retransmit == 1;
+        s_net_client.drop_mask = 0;
+        
+        // The client goes silent: follow the host's deadlines only
+        int64_t silent_since = at_host->last_rx_us;
+        int expiries = 0;
+        while (s_net_host.sessions == 1 && s_net_host.due_us && expiries < 20) {
+            now = s_net_host.due_us;
+            midi_net_expire(&s_net_host.net, at_host, now);
+            expiries++;
+        }
+        timeout_ok = s_net_host.sessions == 0 && s_net_host.due_us == 0 &&
+                     now == silent_since + (int64_t)MIDI_NET_SESSION_TIMEOUT_MS * 1000;
+    }
+    close(s_net_host.fd);
+    close(s_net_client.fd);
+    
+    if (wheel_ok) {
+        ESP_LOGI(TAG, "✓ Wheel fired 4.5 ms..300 s timers on their tick in %d wakeups", wakeups);
+    } else {
+        ESP_LOGE(TAG, "✗ Wheel order 0x%04lX!", (unsigned long)wheel_order);
+    }
+    if (many_ok) {
+        ESP_LOGI(TAG, "✓ 200 random timers fired in order, none early or late");
+    } else {
+        ESP_LOGE(TAG, "✗ Random timers: %d fired, order or timing wrong!", fired);
+    }
+    if (service_ok) {
+        ESP_LOGI(TAG, "✓ Timer service ran callbacks in deadline order");
+    } else {
+        ESP_LOGE(TAG, "✗ Timer service order 0x%03lX!", (unsigned long)s_wheel_order);
+    }
+    if (open_ok) {
+        ESP_LOGI(TAG, "✓ Session deadlines reported at the ping interval (invitee: twice)");
+    } else {
+        ESP_LOGE(TAG, "✗ Session deadlines wrong!");
+    }
+    if (flush_ok) {
+        ESP_LOGI(TAG, "✓ Lost last datagram recovered by the FEC flush");
+    } else {
+        ESP_LOGE(TAG, "✗ FEC flush did not recover the last datagram!");
+    }
+    if (retx_ok) {
+        ESP_LOGI(TAG, "✓ Retransmit Request repeated when the answer was lost");
+    } else {
+        ESP_LOGE(TAG, "✗ Retransmit retry failed (%lu lost)!",
+                 open_ok ? (unsigned long)at_host->packets_lost : 0);
+    }
+    if (timeout_ok) {
+        ESP_LOGI(TAG, "✓ Silent peer dropped exactly at the timeout");
+    } else {
+        ESP_LOGE(TAG, "✗ Silent peer not dropped on time!");
+    }
+}
+
+/**
+ * @brief Stream for a while in 50 ms steps, polling both engines like their timers would
+ */
+static void test_net_stream(int64_t *now, int64_t duration_us, bool client_sends, bool host_sends) {
+    for (int64_t end = *now + duration_us; *now < end; *now += 50000) {
+        uint32_t word = 0x20903C40;
+        if (client_sends) {
+            midi_net_send_ump(&s_net_client.net, &word, 1, *now);
+        }
+        if (host_sends) {
+            midi_net_send_ump(&s_net_host.net, &word, 1, *now);
+        }
+        test_net_settle(*now);
+        midi_net_poll(&s_net_client.net, *now);
+        midi_net_poll(&s_net_host.net, *now);
+        test_net_settle(*now);
+    }
+}
+
+/**
+ * @brief Test 4: Keepalive Suppression under Traffic
+ */
+void test_keepalive_suppression(void) {
+    ESP_LOGI(TAG, "=== Test 4: Keepalive Suppression under Traffic ===");
+    
+    if (!test_net_open(&s_net_host, "MIDI-Cube", true) ||
+        !test_net_open(&s_net_client, "Test Peer", false)) {
+        ESP_LOGE(TAG, "✗ Localhost UDP sockets unavailable!");
+        close(s_net_host.fd);
+        close(s_net_client.fd);
+        return;
+    }
+    int64_t now = 1000000;
+    midi_net_invite(&s_net_client.net, &s_net_host.addr, now);
+    test_net_settle(now);
+    midi_net_peer_t *at_host = midi_net_find(&s_net_host.net, &s_net_client.addr);
+    midi_net_peer_t *at_client = midi_net_find(&s_net_client.net, &s_net_host.addr);
+    if (!at_host || !at_client) {
+        ESP_LOGE(TAG, "✗ Session not established!");
+        close(s_net_host.fd);
+        close(s_net_client.fd);
+        return;
+    }
+    
+    // Both directions busy: every datagram is a keepalive, no Ping at all
+    test_net_stream(&now, 5000000, true, true);
+    uint32_t busy_pings = at_client->pings_sent + at_host->pings_sent;
+    
+    // Client to host only: the client's Pings ride on its UMP Data
+    test_net_stream(&now, 5000000, true, false);
+    uint32_t oneway_pings = at_client->pings_sent;
+    uint32_t oneway_alone = at_client->pings_sent - at_client->pings_piggybacked + at_host->pings_sent;
+    
+    // Idle: the first side to ping keeps the other quiet
+    uint32_t before = at_client->pings_sent + at_host->pings_sent;
+    uint32_t datagrams = s_net_client.sent + s_net_host.sent;
+    test_net_stream(&now, 5000000, false, false);
+    uint32_t idle_pings = at_client->pings_sent + at_host->pings_sent - before;
+    uint32_t idle_datagrams = s_net_client.sent + s_net_host.sent - datagrams;
+    bool alive = s_net_host.sessions == 1 && s_net_client.sessions == 1;
+    
+    close(s_net_host.fd);
+    close(s_net_client.fd);
+    
+    if (busy_pings == 0) {
+        ESP_LOGI(TAG, "✓ Two-way traffic: no Ping in 5 s");
+    } else {
+        ESP_LOGE(TAG, "✗ %lu Pings despite two-way traffic!", (unsigned long)busy_pings);
+    }
+    if (oneway_pings >= 4 && oneway_alone == 0) {
+        ESP_LOGI(TAG, "✓ One-way traffic: %lu Pings, all piggybacked on UMP Data",
+                 (unsigned long)oneway_pings);
+    } else {
+        ESP_LOGE(TAG, "✗ One-way traffic: %lu Pings, %lu in datagrams of their own!",
+                 (unsigned long)oneway_pings, (unsigned long)oneway_alone);
+    }
+    if (idle_pings >= 4 && idle_pings <= 6 && alive) {
+        ESP_LOGI(TAG, "✓ Idle: %lu Pings in 5 s (%lu datagrams), one side only, session kept",
+                 (unsigned long)idle_pings, (unsigned long)idle_datagrams);
+    } else {
+        ESP_LOGE(TAG, "✗ Idle: %lu Pings in 5 s, session %s!", (unsigned long)idle_pings,
+                 alive ? "kept" : "lost");
+    }
+}
+
+#define TEST_PROXY_DELAY_US     20000           // Each way
+#define TEST_PROXY_JITTER_US    4000            // Added at random, each way
+#define TEST_PROXY_QUEUE        32
+#define TEST_CLOCK_SKEW_US      123456789LL     // Host clock ahead of the client's
+
+typedef struct {
+    int64_t due_us;
+    struct sockaddr_in to;
+    size_t len;
+    uint8_t data[128];
+} test_proxy_entry_t;
+
+/**
+ * @brief Hand one waiting datagram (if any) to a node's engine
+ */
+static bool test_net_pump_once(test_net_node_t *node, int64_t now_us) {
+    uint8_t buf[MIDI_NET_MTU];
+    struct sockaddr_in src;
+    socklen_t len = sizeof(src);
+    int n = recvfrom(node->fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&src, &len);
+    
+    if (n <= 0) {
+        return false;
+    }
+    midi_net_addr_t from = { .ip = src.sin_addr.s_addr, .port = ntohs(src.sin_port) };
+    midi_net_receive(&node->net, &from, buf, n, now_us);
+    return true;
+}
+
+/**
+ * @brief Test 5: Round Trip Time and Clock Offset through a Delay Proxy
+ */
+void test_network_clock(void) {
+    ESP_LOGI(TAG, "=== Test 5: RTT and Clock Offset through a Delay Proxy ===");
+    
+    // Client <-> proxy (20 ms + 0..4 ms each way) <-> host, real time
+    int proxy_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    struct sockaddr_in proxy = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t proxy_len = sizeof(proxy);
+    bool open_ok = test_net_open(&s_net_host, "MIDI-Cube", true) &&
+                   test_net_open(&s_net_client, "Test Peer", false) && proxy_fd >= 0 &&
+                   bind(proxy_fd, (struct sockaddr *)&proxy, sizeof(proxy)) == 0 &&
+                   getsockname(proxy_fd, (struct sockaddr *)&proxy, &proxy_len) == 0;
+    if (!open_ok) {
+        ESP_LOGE(TAG, "✗ Localhost UDP sockets unavailable!");
+        close(s_net_host.fd);
+        close(s_net_client.fd);
+        close(proxy_fd);
+        return;
+    }
+    midi_net_addr_t proxy_addr = { .ip = proxy.sin_addr.s_addr, .port = ntohs(proxy.sin_port) };
+    struct sockaddr_in host = {
+        .sin_family = AF_INET, .sin_port = htons(s_net_host.addr.port), .sin_addr.s_addr = s_net_host.addr.ip
+    };
+    struct sockaddr_in client = {
+        .sin_family = AF_INET, .sin_port = htons(s_net_client.addr.port), .sin_addr.s_addr = s_net_client.addr.ip
+    };
+    s_net_client.net.config.ping_interval_ms = 50;
+    
+    static test_proxy_entry_t queue[TEST_PROXY_QUEUE];
+    int queued = 0;
+    uint32_t lcg = 777;
+    int64_t now = esp_timer_get_time();
+    int64_t end = now + 1500000;
+    midi_net_invite(&s_net_client.net, &proxy_addr, now);
+    
+    while ((now = esp_timer_get_time()) < end) {
+        while (test_net_pump_once(&s_net_client, now)) {
+        }
+        while (test_net_pump_once(&s_net_host, now + TEST_CLOCK_SKEW_US)) {
+        }
+        
+        // Proxy: hold each datagram, then pass it on to the other side
+        struct sockaddr_in src;
+        socklen_t src_len = sizeof(src);
+        test_proxy_entry_t *entry = &queue[queued];
+        int n;
+        while (queued < TEST_PROXY_QUEUE &&
+               (n = recvfrom(proxy_fd, entry->data, sizeof(entry->data), MSG_DONTWAIT,
+                             (struct sockaddr *)&src, &src_len)) > 0) {
+            lcg = lcg * 1103515245 + 12345;
+            entry->len = n;
+            entry->to = (src.sin_port == host.sin_port) ? client : host;
+            entry->due_us = now + TEST_PROXY_DELAY_US + (lcg >> 8) % TEST_PROXY_JITTER_US;
+            entry = &queue[++queued];
+        }
+        for (int i = 0; i < queued; ) {
+            if (queue[i].due_us <= now) {
+                sendto(proxy_fd, queue[i].data, queue[i].len, 0, (struct sockaddr *)&queue[i].to,
+                       sizeof(queue[i].to));
+                memmove(&queue[i], &queue[i + 1], sizeof(queue[0]) * (queued - i - 1));
+                queued--;
+            } else {
+                i++;
+            }
+        }
+        
+        midi_net_poll(&s_net_client.net, now);
+        midi_net_poll(&s_net_host.net, now + TEST_CLOCK_SKEW_US);
+        vTaskDelay(1);
+    }
+    
+    // A standard peer (no clock capability in its Invitation) gets the bare ID back
+    midi_net_addr_t plain = { .ip = htonl(INADDR_LOOPBACK), .port = 9 };
+    static const uint8_t plain_invite[] = { 'M', 'I', 'D', 'I', 0x01, 0x00, 0x00, 0x00 };
+    static const uint8_t plain_ping[] = {
+        'M', 'I', 'D', 'I', 0x20, 0x01, 0x00, 0x00, 0x12, 0x34, 0x56, 0x78
+    };
+    midi_net_receive(&s_net_host.net, &plain, plain_invite, sizeof(plain_invite), now);
+    midi_net_receive(&s_net_host.net, &plain, plain_ping, sizeof(plain_ping), now);
+    static const uint8_t plain_reply[] = {
+        'M', 'I', 'D', 'I', 0x21, 0x01, 0x00, 0x00, 0x12, 0x34, 0x56, 0x78
+    };
+    bool plain_ok = s_net_host.last_len == sizeof(plain_reply) &&
+                    memcmp(s_net_host.last, plain_reply, sizeof(plain_reply)) == 0;
+    
+    midi_net_peer_t *at_client = midi_net_find(&s_net_client.net, &proxy_addr);
+    close(s_net_host.fd);
+    close(s_net_client.fd);
+    close(proxy_fd);
+    
+    if (!at_client || at_client->state != MIDI_NET_PEER_ESTABLISHED || at_client->rtt_samples < 8) {
+        ESP_LOGE(TAG, "✗ Too few round trips through the proxy (%u)!",
+                 at_client ? at_client->rtt_samples : 0);
+        return;
+    }
+    int64_t offset_error = at_client->clock_offset_us - TEST_CLOCK_SKEW_US;
+    uint32_t rto = midi_net_peer_retransmit_timeout_us(at_client);
+    
+    if (at_client->rtt_us >= 2 * TEST_PROXY_DELAY_US &&
+        at_client->rtt_us <= 2 * (TEST_PROXY_DELAY_US + TEST_PROXY_JITTER_US) + 3000 &&
+        at_client->rtt_min_us >= 2 * TEST_PROXY_DELAY_US) {
+        ESP_LOGI(TAG, "✓ RTT %lu us (min %lu, var %lu) over %u pings, injected 40-48 ms",
+                 (unsigned long)at_client->rtt_us, (unsigned long)at_client->rtt_min_us,
+                 (unsigned long)at_client->rtt_var_us, at_client->rtt_samples);
+    } else {
+        ESP_LOGE(TAG, "✗ RTT %lu us (min %lu), injected 40-48 ms!",
+                 (unsigned long)at_client->rtt_us, (unsigned long)at_client->rtt_min_us);
+    }
+    if (at_client->offset_samples >= 8 && llabs(offset_error) < 2500) {
+        ESP_LOGI(TAG, "✓ Clock offset within %lld us of the skew (jitter %lu us)",
+                 (long long)llabs(offset_error), (unsigned long)at_client->clock_jitter_us);
+    } else {
+        ESP_LOGE(TAG, "✗ Clock offset off by %lld us (%u samples)!", (long long)offset_error,
+                 at_client->offset_samples);
+    }
+    if (rto > at_client->rtt_us && rto < MIDI_NET_RETRANSMIT_MAX_MS * 1000 &&
+        midi_net_peer_delay_us(at_client) == at_client->rtt_us / 2) {
+        ESP_LOGI(TAG, "✓ Retransmit timeout %lu us follows the RTT", (unsigned long)rto);
+    } else {
+        ESP_LOGE(TAG, "✗ Retransmit timeout %lu us!", (unsigned long)rto);
+    }
+    if (plain_ok) {
+        ESP_LOGI(TAG, "✓ Peer without the clock capability gets a plain Ping Reply");
+    } else {
+        ESP_LOGE(TAG, "✗ Ping Reply to a standard peer is %u bytes!", (unsigned)s_net_host.last_len);
+    }
+}
+
+#define TEST_SYNC_NODES         4               // Master and three slaves
+#define TEST_SYNC_INTERVAL_MS   100
+
+/**
+ * @brief One simulated device: own socket, sync engine, timebase and crystal
+ */
+typedef struct {
+    int fd;
+    midi_net_addr_t addr;
+    midi_sync_t sync;
+    midi_timebase_t timebase;
+    int64_t clock_base_us;        // Local clock at the test's origin
+    int32_t clock_ppm;            // Crystal error against real time
+    int64_t next_us;              // Next midi_sync_expire(), local clock
+    int64_t last_shared_us;       // Shared time last read, for the monotonic check
+    uint32_t last_steps;          // Timebase steps at that read
+} test_sync_node_t;
+
+static test_sync_node_t s_sync_nodes[TEST_SYNC_NODES];
+static int64_t s_sync_origin;
+
+static int64_t test_sync_local_at(const test_sync_node_t *node, int64_t real_us) {
+    int64_t real = real_us - s_sync_origin;
+    return node->clock_base_us + real + real * node->clock_ppm / 1000000;
+}
+
+static int64_t test_sync_local(const test_sync_node_t *node) {
+    return test_sync_local_at(node, esp_timer_get_time());
+}
+
+static int64_t test_sync_clock(void *ctx) {
+    return test_sync_local(ctx);
+}
+
+static esp_err_t test_sync_send(const midi_net_addr_t *to, const uint8_t *data, size_t len,
+                                void *ctx) {
+    test_sync_node_t *node = ctx;
+    struct sockaddr_in dest = {
+        .sin_family = AF_INET, .sin_port = htons(to->port), .sin_addr.s_addr = to->ip
+    };
+    return sendto(node->fd, data, len, 0, (struct sockaddr *)&dest, sizeof(dest)) == (int)len ?
+           ESP_OK : ESP_FAIL;
+}
+
+static bool test_sync_open(test_sync_node_t *node, midi_sync_role_t role,
+                           const midi_net_addr_t *master, int64_t base_us, int32_t ppm) {
+    memset(node, 0, sizeof(*node));
+    node->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    
+    struct sockaddr_in local = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(local);
+    if (node->fd < 0 || bind(node->fd, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+        getsockname(node->fd, (struct sockaddr *)&local, &len) < 0) {
+        return false;
+    }
+    node->addr = (midi_net_addr_t){ .ip = local.sin_addr.s_addr, .port = ntohs(local.sin_port) };
+    node->clock_base_us = base_us;
+    node->clock_ppm = ppm;
+    midi_timebase_init(&node->timebase);
+    
+    midi_sync_config_t cfg = {
+        .role = role, .interval_ms = TEST_SYNC_INTERVAL_MS, .timebase = &node->timebase,
+        .send = test_sync_send, .clock = test_sync_clock, .ctx = node
+    };
+    if (master) {
+        cfg.master = *master;
+    }
+    node->next_us = test_sync_local(node);
+    return midi_sync_init(&node->sync, &cfg, node->next_us) == ESP_OK;
+}
+
+/**
+ * @brief Let every node handle its datagrams and periodic work for a while
+ *
+ * @param master_up Whether the master takes part
+ * @param worst_us Output: largest slave error against the master seen (may be NULL)
+ * @param monotonic Cleared if a slave's shared time went backwards after its step
+ */
+static void test_sync_run(int64_t duration_us, bool master_up, int64_t *worst_us,
+                          bool *monotonic) {
+    int64_t end = esp_timer_get_time() + duration_us;
+    
+    while (esp_timer_get_time() < end) {
+        // Wake on arrival, as the drivers' RX tasks do, so reception is stamped on time
+        fd_set readable;
+        int max_fd = -1;
+        FD_ZERO(&readable);
+        for (int i = master_up ? 0 : 1; i < TEST_SYNC_NODES; i++) {
+            FD_SET(s_sync_nodes[i].fd, &readable);
+            max_fd = s_sync_nodes[i].fd > max_fd ? s_sync_nodes[i].fd : max_fd;
+        }
+        struct timeval wait = { .tv_sec = 0, .tv_usec = 1000 };
+        select(max_fd + 1, &readable, NULL, NULL, &wait);
+        
+        for (int i = master_up ? 0 : 1; i < TEST_SYNC_NODES; i++) {
+            test_sync_node_t *node = &s_sync_nodes[i];
+            uint8_t buf[64];
+            struct sockaddr_in src;
+            socklen_t len = sizeof(src);
+            int n;
+            while ((n = recvfrom(node->fd, buf, sizeof(buf), MSG_DONTWAIT,
+                                 (struct sockaddr *)&src, &len)) > 0) {
+                midi_net_addr_t from = { .ip = src.sin_addr.s_addr, .port = ntohs(src.sin_port) };
+                midi_sync_receive(&node->sync, &from, buf, n, test_sync_local(node));
+            }
+            int64_t local = test_sync_local(node);
+            if (local >= node->next_us) {
+                node->next_us = midi_sync_expire(&node->sync, local);
+            }
+        }
+        
+        // Shared times of every device at one real instant
+        int64_t real = esp_timer_get_time();
+        int64_t master_shared = midi_timebase_shared_us(&s_sync_nodes[0].timebase,
+                                                        test_sync_local_at(&s_sync_nodes[0], real));
+        for (int i = 1; i < TEST_SYNC_NODES; i++) {
+            test_sync_node_t *node = &s_sync_nodes[i];
+            int64_t shared = midi_timebase_shared_us(&node->timebase, test_sync_local_at(node, real));
+            if (node->timebase.steps == node->last_steps && shared < node->last_shared_us) {
+                *monotonic = false;
+            }
+            node->last_shared_us = shared;
+            node->last_steps = node->timebase.steps;
+            if (worst_us && llabs(shared - master_shared) > *worst_us) {
+                *worst_us = llabs(shared - master_shared);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Test 6: Clock Sync of Several Devices on Loopback
+ */
+void test_clock_sync(void) {
+    ESP_LOGI(TAG, "=== Test 6: Clock Sync of Several Devices on Loopback ===");
+    
+    // Crystals off by up to 120 ppm, clocks seconds apart
+    static const int64_t bases[TEST_SYNC_NODES] = {
+        1000000000LL, 1002500000LL, 993000000LL, 1000000300LL
+    };
+    static const int32_t ppms[TEST_SYNC_NODES] = { 0, 80, -120, 15 };
+    
+    s_sync_origin = esp_timer_get_time();
+    bool open_ok = test_sync_open(&s_sync_nodes[0], MIDI_SYNC_ROLE_MASTER, NULL, bases[0], ppms[0]);
+    for (int i = 1; i < TEST_SYNC_NODES && open_ok; i++) {
+        open_ok = test_sync_open(&s_sync_nodes[i], MIDI_SYNC_ROLE_SLAVE, &s_sync_nodes[0].addr,
+                                 bases[i], ppms[i]);
+    }
+    if (!open_ok) {
+        ESP_LOGE(TAG, "✗ Localhost UDP sockets unavailable!");
+        for (int i = 0; i < TEST_SYNC_NODES; i++) {
+            close(s_sync_nodes[i].fd);
+        }
+        return;
+    }
+    
+    // Converge, then measure
+    bool monotonic = true;
+    int64_t worst_us = 0;
+    test_sync_run(2500000, true, NULL, &monotonic);
+    uint8_t slaves = midi_sync_num_slaves(&s_sync_nodes[0].sync, test_sync_local(&s_sync_nodes[0]));
+    test_sync_run(1500000, true, &worst_us, &monotonic);
+    
+    bool locked = true;
+    bool freq_ok = true;
+    bool inverse_ok = true;
+    uint32_t accuracy_us = 0;
+    for (int i = 1; i < TEST_SYNC_NODES; i++) {
+        test_sync_node_t *node = &s_sync_nodes[i];
+        locked &= midi_sync_locked(&node->sync) && node->timebase.steps == 1;
+        freq_ok &= abs(node->timebase.freq_ppb + node->clock_ppm * 1000) < 25000;
+        if (node->sync.stats.offset_abs_us > accuracy_us) {
+            accuracy_us = node->sync.stats.offset_abs_us;
+        }
+        int64_t local = test_sync_local(node);
+        int64_t back = midi_timebase_local_us(&node->timebase,
+                                              midi_timebase_shared_us(&node->timebase, local));
+        inverse_ok &= llabs(back - local) <= 1;
+        ESP_LOGI(TAG, "  Slave %d: %+ld ppm crystal, learned %+ld ppb, |offset| %lu us, "
+                 "delay %lu us, %lu/%lu exchanges discarded", i, (long)node->clock_ppm,
+                 (long)node->timebase.freq_ppb, (unsigned long)node->sync.stats.offset_abs_us,
+                 (unsigned long)node->sync.stats.delay_us,
+                 (unsigned long)node->sync.stats.discarded,
+                 (unsigned long)node->sync.stats.exchanges);
+    }
+    
+    if (slaves == TEST_SYNC_NODES - 1 && locked) {
+        ESP_LOGI(TAG, "✓ Master serves %u slaves, all locked after one step", slaves);
+    } else {
+        ESP_LOGE(TAG, "✗ %u slaves subscribed, locked %d!", slaves, locked);
+    }
+    if (worst_us < 500 && accuracy_us < 200) {
+        ESP_LOGI(TAG, "✓ Slaves within %lld us of the master (worst), %lu us smoothed",
+                 (long long)worst_us, (unsigned long)accuracy_us);
+    } else {
+        ESP_LOGE(TAG, "✗ Slaves up to %lld us off (smoothed %lu us)!", (long long)worst_us,
+                 (unsigned long)accuracy_us);
+    }
+    if (freq_ok && monotonic && inverse_ok) {
+        ESP_LOGI(TAG, "✓ Crystal errors learned, shared time slewed without going back");
+    } else {
+        ESP_LOGE(TAG, "✗ Frequency %d, monotonic %d, inverse %d!", freq_ok, monotonic, inverse_ok);
+    }
+    
+    // Master gone: slaves hold over on the learned frequency
+    int64_t holdover_worst_us = 0;
+    test_sync_run(1000000, false, &holdover_worst_us, &monotonic);
+    bool held = true;
+    for (int i = 1; i < TEST_SYNC_NODES; i++) {
+        held &= s_sync_nodes[i].sync.stats.holdovers == 1 &&
+                !midi_sync_locked(&s_sync_nodes[i].sync);
+    }
+    for (int i = 0; i < TEST_SYNC_NODES; i++) {
+        close(s_sync_nodes[i].fd);
+    }
+    
+    if (held && holdover_worst_us < 200) {
+        ESP_LOGI(TAG, "✓ Master lost: holdover drifted to %lld us in 1 s",
+                 (long long)holdover_worst_us);
+    } else {
+        ESP_LOGE(TAG, "✗ Holdover: detected %d, drifted to %lld us!", held,
+                 (long long)holdover_worst_us);
+    }
+}
+
+/**
+ * @brief Run all MIDI Net tests
+ * 
+ * Call this from main() to run test suite
+ */
+void midi_net_run_tests(void) {
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "====================================");
+    ESP_LOGI(TAG, "  MIDI Net Component Test Suite");
+    ESP_LOGI(TAG, "====================================");
+    ESP_LOGI(TAG, "");
+    
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    
+    test_network_session();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_network_endpoint();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_timer_wheel();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_keepalive_suppression();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_network_clock();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_clock_sync();
+    
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "====================================");
+    ESP_LOGI(TAG, "  All Tests Complete!");
+    ESP_LOGI(TAG, "====================================");
+    ESP_LOGI(TAG, "");
+}
@@ -0,0 +1,14 @@
+/**
+ * @file test_midi_net.h
+ * @brief MIDI Net Test Suite Header
+ */
+
+#ifndef TEST_MIDI_NET_H
+#define TEST_MIDI_NET_H
+
+/**
+ * @brief Run all MIDI Net component tests
+ */
+void midi_net_run_tests(void);
+
+#endif /* TEST_MIDI_NET_H */
@@ -0,0 +1,2585 @@
+/**
+ * @file test_midi_router.c
+ * @brief Interactive test harness for midi_router component
+ * 
+ * Call midi_router_run_tests() from main.c to execute all tests
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "midi_defs.h"
+#include "midi_types.h"
+#include "midi_parser.h"
+#include "midi_translator.h"
+#include "ump_defs.h"
+#include "ump_types.h"
+#include "midi_router.h"
+#include "midi_msg_class.h"
+#include "midi_rules.h"
+#include "midi_coalescer.h"
+#include "midi_note_tracker.h"
+#include "midi_loop_guard.h"
+#include "midi_stats.h"
+#include "midi_config_blob.h"
+#include "midi_config_store.h"
+#include "midi_loopback.h"
+#include "midi_net.h"
+
+static const char *TAG = "router_test";
+
+// Compiled tables are large; keep them off the test task stack
+static midi_rule_table_t s_table;
+static midi_loop_guard_t s_guard;
+
+/**
+ * @brief Test 1: Message Classification (MIDI 1.0 and UMP)
+ */
+void test_msg_classification(void) {
+    ESP_LOGI(TAG, "=== Test 1: Message Classification ===");
+    
+    struct { uint8_t status; midi_msg_class_t expected; } midi1_cases[] = {
+        {0x93, MIDI_CLASS_NOTE_ON}, {0x80, MIDI_CLASS_NOTE_OFF},
+        {0xBF, MIDI_CLASS_CONTROL_CHANGE}, {0xE0, MIDI_CLASS_PITCH_BEND},
+        {0xF8, MIDI_CLASS_CLOCK}, {0xFA, MIDI_CLASS_TRANSPORT},
+        {0xFE, MIDI_CLASS_ACTIVE_SENSING}, {0xF0, MIDI_CLASS_SYSEX},
+    };
+    struct { uint32_t word0; midi_msg_class_t expected; } ump_cases[] = {
+        {0x20903C64, MIDI_CLASS_NOTE_ON},        // MT2 Note On
+        {0x40903C00, MIDI_CLASS_NOTE_ON},        // MT4 Note On
+        {0x40250000, MIDI_CLASS_PARAMETER},      // MT4 RPN
+        {0x40F53C00, MIDI_CLASS_PER_NOTE},       // MT4 Per-Note Mgmt
+        {0x10F80000, MIDI_CLASS_CLOCK},          // MT1 Clock
+        {0x30160000, MIDI_CLASS_SYSEX},          // MT3 SysEx7
+        {0xF0000000, MIDI_CLASS_OTHER},          // Stream
+    };
+    
+    int failures = 0;
+    for (int i = 0; i < sizeof(midi1_cases) / sizeof(midi1_cases[0]); i++) {
+        midi_msg_class_t cls = midi_msg_class_from_status(midi1_cases[i].status);
+        if (cls != midi1_cases[i].expected) {
+            ESP_LOGE(TAG, "✗ Status 0x%02X → %s", midi1_cases[i].status, midi_msg_class_name(cls));
+            failures++;
+        }
+    }
+    for (int i = 0; i < sizeof(ump_cases) / sizeof(ump_cases[0]); i++) {
+        midi_msg_class_t cls = midi_msg_class_from_ump(ump_cases[i].word0);
+        if (cls != ump_cases[i].expected) {
+            ESP_LOGE(TAG, "✗ UMP 0x%08lX → %s", ump_cases[i].word0, midi_msg_class_name(cls));
+            failures++;
+        }
+    }
+    
+    if (failures == 0) {
+        ESP_LOGI(TAG, "✓ All classifications correct!");
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+/**
+ * @brief Test 2: Rules - Drop, Transpose and Channel Remap (MIDI 1.0)
+ */
+void test_rules_midi1(void) {
+    ESP_LOGI(TAG, "=== Test 2: Rules - MIDI 1.0 ===");
+    
+    midi_rule_t rules[] = {
+        // Drop clock from UART to USB
+        { .source_mask = 1 << MIDI_TRANSPORT_UART, .dest_mask = 1 << MIDI_TRANSPORT_USB,
+          .class_mask = 1 << MIDI_CLASS_CLOCK, .action = MIDI_RULE_ACTION_DROP },
+        // Keyboard split: notes 0-59 → transpose +12, then continue
+        { .class_mask = (1 << MIDI_CLASS_NOTE_ON) | (1 << MIDI_CLASS_NOTE_OFF),
+          .match_data1 = true, .data1_min = 0, .data1_max = 59,
+          .action = MIDI_RULE_ACTION_TRANSPOSE, .param = 12, .continue_eval = true },
+        // ...and move the lower half to channel 2
+        { .channel_mask = 1 << 0, .match_data1 = true, .data1_min = 12, .data1_max = 71,
+          .action = MIDI_RULE_ACTION_REMAP_CHANNEL, .param = 1 },
+    };
+    
+    if (midi_rules_compile(rules, 3, &s_table) != ESP_OK) {
+        ESP_LOGE(TAG, "✗ Compile failed!");
+        return;
+    }
+    
+    midi_message_t clock = { .status = 0xF8 };
+    bool clock_usb = midi_rules_apply_midi1(&s_table, MIDI_TRANSPORT_UART, MIDI_TRANSPORT_USB, 0, &clock);
+    bool clock_wifi = midi_rules_apply_midi1(&s_table, MIDI_TRANSPORT_UART, MIDI_TRANSPORT_WIFI, 0, &clock);
+    
+    midi_message_t low = { .status = 0x90, .channel = 0, .data.bytes = {48, 100} };
+    midi_message_t high = { .status = 0x90, .channel = 0, .data.bytes = {72, 100} };
+    midi_rules_apply_midi1(&s_table, MIDI_TRANSPORT_UART, MIDI_TRANSPORT_USB, 0, &low);
+    midi_rules_apply_midi1(&s_table, MIDI_TRANSPORT_UART, MIDI_TRANSPORT_USB, 0, &high);
+    
+    ESP_LOGI(TAG, "  Clock → USB: %s, → WiFi: %s", clock_usb ? "pass" : "drop", clock_wifi ? "pass" : "drop");
+    ESP_LOGI(TAG, "  Low note:  0x%02X %d", low.status, low.data.bytes[0]);
+    ESP_LOGI(TAG, "  High note: 0x%02X %d", high.status, high.data.bytes[0]);
+    
+    if (!clock_usb && clock_wifi &&
+        low.status == 0x91 && low.channel == 1 && low.data.bytes[0] == 60 &&
+        high.status == 0x90 && high.data.bytes[0] == 72) {
+        ESP_LOGI(TAG, "✓ MIDI 1.0 rules correct!");
+    } else {
+        ESP_LOGE(TAG, "✗ MIDI 1.0 rules incorrect!");
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+/**
+ * @brief Test 3: Rules - Scale and CC Rewrite (UMP)
+ */
+void test_rules_ump(void) {
+    ESP_LOGI(TAG, "=== Test 3: Rules - UMP ===");
+    
+    midi_rule_t rules[] = {
+        // Velocity curve on group 1: 50% + 32
+        { .group_mask = 1 << 1, .class_mask = 1 << MIDI_CLASS_NOTE_ON,
+          .action = MIDI_RULE_ACTION_SCALE, .param = 50, .offset = 32 },
+        // Mod wheel → CC 74
+        { .class_mask = 1 << MIDI_CLASS_CONTROL_CHANGE, .match_data1 = true,
+          .data1_min = 1, .data1_max = 1, .action = MIDI_RULE_ACTION_REWRITE_CC, .param = 74 },
+    };
+    
+    if (midi_rules_compile(rules, 2, &s_table) != ESP_OK) {
+        ESP_LOGE(TAG, "✗ Compile failed!");
+        return;
+    }
+    
+    // MT4 Note On, group 1, velocity 0x8000
+    ump_packet_t note = { .words = {0x41903C00, 0x80000000}, .num_words = 2,
+                          .message_type = UMP_MT_MIDI2_CHANNEL_VOICE, .group = 1 };
+    // MT2 CC 1 = 64, group 0
+    ump_packet_t cc = { .words = {0x20B00140}, .num_words = 1,
+                        .message_type = UMP_MT_MIDI1_CHANNEL_VOICE, .group = 0 };
+    
+    midi_rules_apply_ump(&s_table, MIDI_TRANSPORT_WIFI, MIDI_TRANSPORT_USB, &note);
+    midi_rules_apply_ump(&s_table, MIDI_TRANSPORT_WIFI, MIDI_TRANSPORT_USB, &cc);
+    
+    uint16_t velocity = note.words[1] >> 16;
+    uint8_t controller = (cc.words[0] >> 8) & 0x7F;
+    ESP_LOGI(TAG, "  Velocity: 0x%04X (expected 0x8000)", velocity);
+    ESP_LOGI(TAG, "  Controller: %d (expected 74), value %lu", controller, cc.words[0] & 0x7F);
+    
+    if (velocity == 0x8000 && controller == 74 && (cc.words[0] & 0x7F) == 64) {
+        ESP_LOGI(TAG, "✓ UMP rules correct!");
+    } else {
+        ESP_LOGE(TAG, "✗ UMP rules incorrect!");
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+/**
+ * @brief Test 4: Rules - Worst-Case Evaluation Cost
+ */
+void test_rules_performance(void) {
+    ESP_LOGI(TAG, "=== Test 4: Rules - Evaluation Cost ===");
+    
+    // Fill the table with rules that match but keep evaluating
+    midi_rule_t rules[MIDI_RULES_MAX];
+    for (int i = 0; i < MIDI_RULES_MAX; i++) {
+        rules[i] = (midi_rule_t){
+            .class_mask = 1 << MIDI_CLASS_NOTE_ON,
+            .action = MIDI_RULE_ACTION_SCALE, .param = 100,
+            .continue_eval = true
+        };
+    }
+    midi_rules_compile(rules, MIDI_RULES_MAX, &s_table);
+    
+    const int iterations = 10000;
+    midi_message_t msg = { .status = 0x90, .data.bytes = {60, 100} };
+    
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++) {
+        midi_rules_apply_midi1(&s_table, MIDI_TRANSPORT_UART, MIDI_TRANSPORT_USB, 0, &msg);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    
+    ESP_LOGI(TAG, "  %d rules × %d packets: %lld us (%.2f us/packet)",
+             MIDI_RULES_MAX, iterations, elapsed, (float)elapsed / iterations);
+    
+    if (msg.data.bytes[1] == 100) {
+        ESP_LOGI(TAG, "✓ Worst case evaluated without side effects");
+    } else {
+        ESP_LOGE(TAG, "✗ Identity scale changed velocity to %d", msg.data.bytes[1]);
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+/**
+ * @brief Test 5: Coalescer - Pitch Bend Flood into Busy Output
+ */
+void test_coalescer_thinning(void) {
+    ESP_LOGI(TAG, "=== Test 5: Coalescer - CC Thinning ===");
+    
+    static midi_coalescer_t coalescer;
+    midi_coalescer_config_t cfg = { .enabled = true, .max_rate_hz = 100, .settle_ms = 20 };
+    midi_coalescer_init(&coalescer, &cfg);
+    
+    midi_router_packet_t pkt = { .format = MIDI_FORMAT_1_0 };
+    midi_router_packet_t out;
+    int64_t now = 1000000;
+    int sent = 0;
+    
+    // 1000 pitch bend values at 10 kHz (0.1 s) while the output is busy
+    for (int i = 0; i < 1000; i++, now += 100) {
+        uint16_t pb = (uint16_t)(i * 16);
+        pkt.data.midi1 = (midi_message_t){ .status = 0xE0, .data.bytes = {pb & 0x7F, pb >> 7} };
+        if (midi_coalescer_offer(&coalescer, &pkt, now, i < 900) == MIDI_COALESCE_SEND) {
+            midi_coalescer_sent(&coalescer, &pkt, now);
+            sent++;
+        }
+        if (i >= 900) {
+            while (midi_coalescer_poll(&coalescer, now, &out)) {
+                midi_coalescer_sent(&coalescer, &out, now);
+                sent++;
+            }
+        }
+    }
+    
+    // A note is never held, even while busy
+    pkt.data.midi1 = (midi_message_t){ .status = 0x90, .data.bytes = {60, 100} };
+    bool note_sent = midi_coalescer_offer(&coalescer, &pkt, now, true) == MIDI_COALESCE_SEND;
+    
+    // Parameter, switch and mode controllers act in sequence: RPN 0 = 2,
+    // RPN 1 = 2, Sustain pressed twice and a repeated All Notes Off must
+    // all go out, busy or not
+    static const uint8_t sequence[][2] = {
+        {101, 0}, {100, 0}, {6, 2}, {101, 0}, {100, 1}, {6, 2},
+        {64, 127}, {64, 0}, {64, 127}, {123, 0}, {123, 0}
+    };
+    bool sequence_sent = true;
+    for (size_t i = 0; i < sizeof(sequence) / sizeof(sequence[0]); i++) {
+        pkt.data.midi1 = (midi_message_t){ .status = 0xB0,
+                                           .data.bytes = {sequence[i][0], sequence[i][1]} };
+        sequence_sent &= midi_coalescer_offer(&coalescer, &pkt, now, i & 1) == MIDI_COALESCE_SEND;
+    }
+    
+    // Final value must reach the output once the rate limit allows
+    now += 20000;
+    bool final_sent = false;
+    while (midi_coalescer_poll(&coalescer, now, &out)) {
+        final_sent = (out.data.midi1.data.bytes[1] == (999 * 16) >> 7);
+        midi_coalescer_sent(&coalescer, &out, now);
+        sent++;
+    }
+    
+    // A write that failed is not on the wire: the router's retry must go out
+    pkt.data.midi1 = (midi_message_t){ .status = 0xB0, .data.bytes = {7, 90} };
+    bool retried = midi_coalescer_offer(&coalescer, &pkt, now, false) == MIDI_COALESCE_SEND &&
+                   midi_coalescer_offer(&coalescer, &pkt, now, false) == MIDI_COALESCE_SEND;
+    midi_coalescer_sent(&coalescer, &pkt, now);
+    retried &= midi_coalescer_offer(&coalescer, &pkt, now + 20000, false) == MIDI_COALESCE_DROPPED;
+    
+    // Volume held on channel 2: a note there takes it along first, one on
+    // channel 3 does not
+    now += 20000;
+    pkt.data.midi1 = (midi_message_t){ .status = 0xB1, .data.bytes = {7, 100} };
+    bool ordered = midi_coalescer_offer(&coalescer, &pkt, now, true) == MIDI_COALESCE_HELD;
+    pkt.data.midi1 = (midi_message_t){ .status = 0x92, .data.bytes = {60, 100} };
+    ordered &= midi_coalescer_offer(&coalescer, &pkt, now, false) == MIDI_COALESCE_SEND &&
+               !midi_coalescer_poll_before(&coalescer, &pkt, &out);
+    pkt.data.midi1.status = 0x91;
+    ordered &= midi_coalescer_offer(&coalescer, &pkt, now, false) == MIDI_COALESCE_SEND &&
+               midi_coalescer_poll_before(&coalescer, &pkt, &out) &&
+               out.data.midi1.status == 0xB1 && out.data.midi1.data.bytes[1] == 100;
+    midi_coalescer_sent(&coalescer, &out, now);
+    ordered &= !midi_coalescer_poll_before(&coalescer, &pkt, &out) &&
+               !midi_coalescer_has_pending(&coalescer);
+    
+    ESP_LOGI(TAG, "  1000 values in → %d out, thinned %lu", sent, coalescer.stats.thinned);
+    
+    // Busy for 90 ms, then 10 ms at 100 Hz: one send, plus the final value
+    if (note_sent && sent <= 3 && final_sent) {
+        ESP_LOGI(TAG, "✓ Flood thinned, latest value delivered, notes pass");
+    } else {
+        ESP_LOGE(TAG, "✗ Thinning incorrect (note %d, final %d)", note_sent, final_sent);
+    }
+    if (retried) {
+        ESP_LOGI(TAG, "✓ Failed write retried, repeat of a written value dropped");
+    } else {
+        ESP_LOGE(TAG, "✗ Retry after a failed write was dropped!");
+    }
+    if (sequence_sent) {
+        ESP_LOGI(TAG, "✓ RPN/Data Entry, Sustain and channel mode controllers never thinned");
+    } else {
+        ESP_LOGE(TAG, "✗ A parameter, switch or mode controller was held or dropped!");
+    }
+    if (ordered) {
+        ESP_LOGI(TAG, "✓ Held value sent ahead of a note on its channel");
+    } else {
+        ESP_LOGE(TAG, "✗ Note would overtake a held value!");
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+static int s_released_offs;
+static bool s_released_ok;
+
+static void test_collect_note_off(midi_transport_t dest, const midi_router_packet_t *off, void *ctx) {
+    s_released_offs++;
+    // Only the UART source played channel 3 towards USB, as MT4
+    if (dest != MIDI_TRANSPORT_USB || off->format != MIDI_FORMAT_2_0 ||
+        off->data.ump.words[0] >> 16 != 0x4083) {
+        s_released_ok = false;
+    }
+}
+
+/**
+ * @brief Test 6: Note Tracker - Release Lost Source
+ */
+void test_note_tracker_release(void) {
+    ESP_LOGI(TAG, "=== Test 6: Note Tracker - Release Lost Source ===");
+    
+    static midi_note_tracker_t tracker;
+    midi_note_tracker_reset(&tracker);
+    
+    // UART plays three notes on ch 3 (to USB as MIDI 2.0) and releases one
+    midi_router_packet_t pkt = { .source = MIDI_TRANSPORT_UART, .format = MIDI_FORMAT_2_0 };
+    uint8_t notes[] = {60, 64, 67};
+    for (int i = 0; i < 3; i++) {
+        pkt.data.ump.words[0] = 0x40930000 | (notes[i] << 8);
+        pkt.data.ump.words[1] = 0x80000000;
+        midi_note_tracker_update(&tracker, MIDI_TRANSPORT_USB, &pkt);
+    }
+    pkt.data.ump.words[0] = 0x40834000;  // Note Off 64
+    midi_note_tracker_update(&tracker, MIDI_TRANSPORT_USB, &pkt);
+    
+    // WiFi plays a note on ch 1 to UART (MIDI 1.0), and one on UART's ch 3
+    midi_router_packet_t wifi = { .source = MIDI_TRANSPORT_WIFI, .format = MIDI_FORMAT_1_0 };
+    wifi.data.midi1 = (midi_message_t){ .status = 0x90, .data.bytes = {48, 90} };
+    midi_note_tracker_update(&tracker, MIDI_TRANSPORT_UART, &wifi);
+    midi_router_packet_t shared = { .source = MIDI_TRANSPORT_WIFI, .format = MIDI_FORMAT_2_0 };
+    shared.data.ump.words[0] = 0x40934800;
+    shared.data.ump.words[1] = 0x80000000;
+    midi_note_tracker_update(&tracker, MIDI_TRANSPORT_USB, &shared);
+    
+    s_released_offs = 0;
+    s_released_ok = true;
+    uint32_t released = midi_note_tracker_release_source(&tracker, MIDI_TRANSPORT_UART,
+                                                         test_collect_note_off, NULL);
+    bool uart_offs_ok = s_released_ok;
+    uint32_t again = midi_note_tracker_release_source(&tracker, MIDI_TRANSPORT_UART,
+                                                      test_collect_note_off, NULL);
+    uint32_t wifi_released = midi_note_tracker_release_source(&tracker, MIDI_TRANSPORT_WIFI,
+                                                              test_collect_note_off, NULL);
+    
+    ESP_LOGI(TAG, "  UART released %lu, again %lu, WiFi released %lu",
+             released, again, wifi_released);
+    
+    if (released == 2 && uart_offs_ok && again == 0 && wifi_released == 2) {
+        ESP_LOGI(TAG, "✓ Only the lost source's sounding notes released, once");
+    } else {
+        ESP_LOGE(TAG, "✗ Note release incorrect!");
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+// Fake USB output used by the overload test
+static volatile bool s_usb_busy;
+static uint8_t s_usb_data_entry[4];
+static int s_usb_data_entries;
+static volatile int s_usb_note_offs;
+static volatile int s_usb_packets;
+static uint32_t s_usb_sysex7[2];
+static int s_usb_sysex7_count;
+
+static esp_err_t test_usb_tx(const midi_router_packet_t *packet) {
+    if (s_usb_busy) {
+        return ESP_ERR_TIMEOUT;
+    }
+    s_usb_packets++;
+    if (packet->format == MIDI_FORMAT_1_0 &&
+        (packet->data.midi1.status & 0xF0) == 0x80) {
+        s_usb_note_offs++;
+    }
+    if (packet->format == MIDI_FORMAT_1_0 && packet->data.midi1.status == 0xB0 &&
+        packet->data.midi1.data.bytes[0] == 6 && s_usb_data_entries < 4) {
+        s_usb_data_entry[s_usb_data_entries++] = packet->data.midi1.data.bytes[1];
+    }
+    if (packet->format == MIDI_FORMAT_2_0 &&
+        UMP_GET_MT(packet->data.ump.words[0]) == UMP_MT_DATA_64 && s_usb_sysex7_count < 2) {
+        s_usb_sysex7[s_usb_sysex7_count++] = packet->data.ump.words[0];
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Test 7: Router - Overload Policy Keeps Note Offs
+ */
+void test_router_overload_policy(void) {
+    ESP_LOGI(TAG, "=== Test 7: Router - Overload Policy ===");
+    
+    static midi_router_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.routing_matrix[MIDI_TRANSPORT_UART][MIDI_TRANSPORT_USB] = true;
+    cfg.auto_translate = false;  // Keep MIDI 1.0 end to end
+    for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+        cfg.dest_policies[t] = MIDI_DEST_POLICY_DEFAULT();
+    }
+    cfg.dest_policies[MIDI_TRANSPORT_USB].max_tx_retries = 255;
+    
+    midi_router_deinit();
+    if (midi_router_init(&cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "✗ Router init failed!");
+        return;
+    }
+    midi_router_register_transport_tx(MIDI_TRANSPORT_USB, test_usb_tx);
+    midi_router_reset_stats();
+    
+    s_usb_busy = true;
+    s_usb_note_offs = 0;
+    s_usb_packets = 0;
+    
+    // Note-offs, then a flood of mod wheel and breath control while USB is busy
+    midi_router_packet_t pkt = { .source = MIDI_TRANSPORT_UART, .format = MIDI_FORMAT_1_0 };
+    for (int n = 0; n < 20; n++) {
+        pkt.data.midi1 = (midi_message_t){ .status = 0x80, .data.bytes = {40 + n, 0} };
+        midi_router_send(&pkt);
+    }
+    for (int i = 0; i < 200; i++) {
+        pkt.data.midi1 = (midi_message_t){ .status = 0xB0, .data.bytes = {1 + (i & 1), i & 0x7F} };
+        midi_router_send(&pkt);
+        if ((i & 15) == 0) vTaskDelay(1);
+    }
+    
+    // NRPN 1 = 10, NRPN 2 = 20: queued Data Entry must not merge
+    static const uint8_t nrpn[][2] = { {99, 0}, {98, 1}, {6, 10}, {99, 0}, {98, 2}, {6, 20} };
+    s_usb_data_entries = 0;
+    for (size_t i = 0; i < sizeof(nrpn) / sizeof(nrpn[0]); i++) {
+        pkt.data.midi1 = (midi_message_t){ .status = 0xB0, .data.bytes = {nrpn[i][0], nrpn[i][1]} };
+        midi_router_send(&pkt);
+    }
+    
+    vTaskDelay(pdMS_TO_TICKS(20));
+    s_usb_busy = false;
+    vTaskDelay(pdMS_TO_TICKS(50));
+    
+    midi_router_stats_t stats;
+    midi_router_get_stats(&stats);
+    ESP_LOGI(TAG, "  Delivered: %d (note offs %d)", s_usb_packets, s_usb_note_offs);
+    ESP_LOGI(TAG, "  Coalesced: %lu, Shed: %lu, Critical lost: %lu, High water: %u",
+             stats.packets_coalesced[MIDI_TRANSPORT_USB], stats.packets_shed[MIDI_TRANSPORT_USB],
+             stats.critical_dropped[MIDI_TRANSPORT_USB], stats.queue_high_water[MIDI_TRANSPORT_USB]);
+    
+    if (s_usb_note_offs == 20 && stats.packets_coalesced[MIDI_TRANSPORT_USB] > 0 &&
+        stats.critical_dropped[MIDI_TRANSPORT_USB] == 0) {
+        ESP_LOGI(TAG, "✓ Note-offs kept, superseded CC values coalesced");
+    } else {
+        ESP_LOGE(TAG, "✗ Overload policy incorrect!");
+    }
+    if (s_usb_data_entries == 2 && s_usb_data_entry[0] == 10 && s_usb_data_entry[1] == 20) {
+        ESP_LOGI(TAG, "✓ Queued Data Entry for two NRPNs kept apart");
+    } else {
+        ESP_LOGE(TAG, "✗ Data Entry coalesced across parameters (%d seen)!", s_usb_data_entries);
+    }
+    
+    // SysEx to a UMP output: a run of SysEx7 packets in the default group
+    midi_router_deinit();
+    cfg.auto_translate = true;
+    cfg.default_group = 3;
+    midi_router_init(&cfg);
+    midi_router_register_transport_tx(MIDI_TRANSPORT_USB, test_usb_tx);
+    static uint8_t sysex_data[] = { 0x7E, 0x7F, 0x06, 0x01, 0x10, 0x20, 0x30, 0x40 };
+    pkt.data.midi1 = (midi_message_t){
+        .type = MIDI_MSG_TYPE_SYSTEM_EXCLUSIVE, .status = 0xF0,
+        .data.sysex = { .data = sysex_data, .length = sizeof(sysex_data) }
+    };
+    s_usb_sysex7_count = 0;
+    midi_router_send(&pkt);
+    vTaskDelay(pdMS_TO_TICKS(20));
+    if (s_usb_sysex7_count == 2 && s_usb_sysex7[0] == 0x33167E7F &&
+        s_usb_sysex7[1] == 0x33323040) {
+        ESP_LOGI(TAG, "✓ MIDI 1.0 SysEx goes out as SysEx7 in the default group");
+    } else {
+        ESP_LOGE(TAG, "✗ SysEx to UMP got %d packets (%08lX, %08lX)!", s_usb_sysex7_count,
+                 (unsigned long)s_usb_sysex7[0], (unsigned long)s_usb_sysex7[1]);
+    }
+    
+    midi_router_register_transport_tx(MIDI_TRANSPORT_USB, NULL);
+    midi_router_deinit();
+    
+    ESP_LOGI(TAG, "");
+}
+
+/**
+ * @brief Test 8: Loop Guard - Duplicates, Window Expiry, Flood
+ */
+void test_loop_guard(void) {
+    ESP_LOGI(TAG, "=== Test 8: Loop Guard ===");
+    
+    midi_loop_guard_init(&s_guard, 50);
+    
+    midi_router_packet_t pkt = {
+        .source = MIDI_TRANSPORT_WIFI,
+        .format = MIDI_FORMAT_2_0,
+        .seq = 1000,
+        .data.ump = { .words = {0x20903C64}, .num_words = 1 }
+    };
+    midi_router_packet_t same_from_eth = pkt;
+    same_from_eth.source = MIDI_TRANSPORT_ETHERNET;
+    
+    int64_t t0 = 1000000;
+    bool first = midi_loop_guard_check_insert(&s_guard, midi_loop_guard_ingress_hash(&pkt), t0);
+    bool repeat = midi_loop_guard_check_insert(&s_guard, midi_loop_guard_ingress_hash(&pkt), t0 + 10000);
+    bool other_src = midi_loop_guard_check_insert(&s_guard, midi_loop_guard_ingress_hash(&same_from_eth), t0 + 10000);
+    bool expired = midi_loop_guard_check_insert(&s_guard, midi_loop_guard_ingress_hash(&pkt), t0 + 60000);
+    
+    ESP_LOGI(TAG, "  First: %d, repeat: %d, other source: %d, after window: %d",
+             first, repeat, other_src, expired);
+    
+    if (!first && repeat && !other_src && !expired) {
+        ESP_LOGI(TAG, "✓ Duplicates caught inside the window only");
+    } else {
+        ESP_LOGE(TAG, "✗ Duplicate detection incorrect!");
+    }
+    
+    // Echo: content hash ignores source and sequence
+    midi_loop_guard_insert(&s_guard, midi_loop_guard_content_hash(&pkt), t0 + 70000);
+    same_from_eth.seq = 77;
+    if (midi_loop_guard_contains(&s_guard, midi_loop_guard_content_hash(&same_from_eth), t0 + 75000)) {
+        ESP_LOGI(TAG, "✓ Own output recognised when it comes back");
+    } else {
+        ESP_LOGE(TAG, "✗ Echo not recognised!");
+    }
+    
+    // Flood of distinct messages: fixed table, oldest overwritten, fast
+    const int flood = 100000;
+    int false_hits = 0;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < flood; i++) {
+        pkt.seq = 2000 + i;
+        pkt.data.ump.words[0] = 0x20B00000 | (i & 0x7FFF);
+        if (midi_loop_guard_check_insert(&s_guard, midi_loop_guard_ingress_hash(&pkt),
+                                         t0 + 100000 + i)) {
+            false_hits++;
+        }
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    
+    ESP_LOGI(TAG, "  Flood: %d checks in %lld us (%.3f us/msg), %u B table",
+             flood, elapsed, (double)elapsed / flood, (unsigned)sizeof(s_guard));
+    ESP_LOGI(TAG, "  False hits: %d, evictions: %lu", false_hits,
+             (unsigned long)s_guard.stats.evictions);
+    
+    if (false_hits == 0 && s_guard.stats.evictions > 0) {
+        ESP_LOGI(TAG, "✓ Constant memory under flood, no false duplicates");
+    } else {
+        ESP_LOGE(TAG, "✗ Flood handling incorrect!");
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+// Fake network output and USB input for the echo test
+static volatile int s_echo_net_sent;
+static volatile int s_echo_usb_on, s_echo_usb_off;
+
+static esp_err_t test_echo_net_send(void *ctx, const midi_router_packet_t *packet) {
+    s_echo_net_sent++;
+    return ESP_OK;
+}
+
+static const midi_transport_ops_t s_test_echo_net = {
+    .name = "WiFi",
+    .native_format = MIDI_FORMAT_2_0,
+    .flags = MIDI_TRANSPORT_FLAG_NETWORK,
+    .send = test_echo_net_send
+};
+
+static esp_err_t test_echo_usb_tx(const midi_router_packet_t *packet) {
+    uint8_t opcode = (packet->data.ump.words[0] >> 20) & 0x0F;
+    if (opcode == 0x9) {
+        s_echo_usb_on++;
+    } else if (opcode == 0x8) {
+        s_echo_usb_off++;
+    }
+    return ESP_OK;
+}
+
+static void test_echo_wait(volatile int *counter, int count) {
+    for (int wait = 0; wait < 200 && *counter < count; wait++) {
+        vTaskDelay(1);
+    }
+    vTaskDelay(pdMS_TO_TICKS(5));
+}
+
+/**
+ * @brief Test 9: Router - Network Echo Suppression Spares Note Offs
+ */
+void test_router_echo_suppression(void) {
+    ESP_LOGI(TAG, "=== Test 9: Router - Network Echo Suppression ===");
+    
+    static midi_router_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.routing_matrix[MIDI_TRANSPORT_USB][MIDI_TRANSPORT_WIFI] = true;
+    cfg.routing_matrix[MIDI_TRANSPORT_WIFI][MIDI_TRANSPORT_USB] = true;
+    cfg.auto_translate = false;
+    for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+        cfg.dest_policies[t] = MIDI_DEST_POLICY_DEFAULT();
+    }
+    
+    midi_router_deinit();
+    if (midi_router_init(&cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "✗ Router init failed!");
+        return;
+    }
+    midi_router_attach_transport(MIDI_TRANSPORT_WIFI, &s_test_echo_net, NULL);
+    midi_router_register_transport_tx(MIDI_TRANSPORT_USB, test_echo_usb_tx);
+    midi_router_reset_stats();
+    s_echo_net_sent = s_echo_usb_on = s_echo_usb_off = 0;
+    
+    // We play note 60 to the network...
+    midi_router_packet_t pkt = {
+        .source = MIDI_TRANSPORT_USB, .format = MIDI_FORMAT_2_0,
+        .data.ump = { .words = { 0x20903C64 }, .num_words = 1,
+                      .message_type = UMP_MT_MIDI1_CHANNEL_VOICE }
+    };
+    midi_router_send(&pkt);
+    pkt.data.ump.words[0] = 0x20803C00;
+    midi_router_send(&pkt);
+    test_echo_wait(&s_echo_net_sent, 2);
+    
+    // ...and a second player there plays the same note right after
+    pkt.source = MIDI_TRANSPORT_WIFI;
+    pkt.seq = 1;
+    pkt.data.ump.words[0] = 0x20903C64;
+    midi_router_send(&pkt);
+    pkt.seq = 2;
+    pkt.data.ump.words[0] = 0x20803C00;
+    midi_router_send(&pkt);
+    test_echo_wait(&s_echo_usb_off, 1);
+    
+    midi_router_stats_t stats;
+    midi_router_get_stats(&stats);
+    
+    midi_router_register_transport_tx(MIDI_TRANSPORT_USB, NULL);
+    midi_router_attach_transport(MIDI_TRANSPORT_WIFI, NULL, NULL);
+    midi_router_deinit();
+    
+    ESP_LOGI(TAG, "  Sent to WiFi: %d, back on USB: %d on / %d off, loops dropped: %lu",
+             s_echo_net_sent, s_echo_usb_on, s_echo_usb_off,
+             (unsigned long)stats.loops_dropped[MIDI_TRANSPORT_WIFI]);
+    if (s_echo_usb_on == 0 && stats.loops_dropped[MIDI_TRANSPORT_WIFI] == 1) {
+        ESP_LOGI(TAG, "✓ Echo of our Note On dropped");
+    } else {
+        ESP_LOGE(TAG, "✗ Echo passed!");
+    }
+    if (s_echo_usb_off == 1) {
+        ESP_LOGI(TAG, "✓ Identical Note Off from the network kept");
+    } else {
+        ESP_LOGE(TAG, "✗ Note Off dropped as an echo!");
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+/**
+ * @brief Test 10: Priority Classes
+ */
+void test_priority_classes(void) {
+    ESP_LOGI(TAG, "=== Test 10: Priority Classes ===");
+    
+    struct { uint8_t status; midi_router_priority_t expected; } cases[] = {
+        {0xF8, MIDI_PRIO_REALTIME}, {0xFA, MIDI_PRIO_REALTIME},
+        {0x90, MIDI_PRIO_NOTE}, {0x80, MIDI_PRIO_NOTE},
+        {0xB0, MIDI_PRIO_CONTROL}, {0xE0, MIDI_PRIO_CONTROL},
+        {0xF2, MIDI_PRIO_CONTROL}, {0xF0, MIDI_PRIO_BULK},
+    };
+    int errors = 0;
+    
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        midi_router_packet_t pkt = { .format = MIDI_FORMAT_1_0 };
+        pkt.data.midi1.status = cases[i].status;
+        if (midi_router_packet_priority(&pkt) != cases[i].expected) {
+            ESP_LOGE(TAG, "  0x%02X: got %d, expected %d", cases[i].status,
+                     midi_router_packet_priority(&pkt), cases[i].expected);
+            errors++;
+        }
+    }
+    
+    // UMP: SysEx7 is bulk, MT4 note is a note, source-lost event follows notes
+    midi_router_packet_t ump = { .format = MIDI_FORMAT_2_0 };
+    ump.data.ump.words[0] = 0x30160000;
+    errors += midi_router_packet_priority(&ump) != MIDI_PRIO_BULK;
+    ump.data.ump.words[0] = 0x40903C00;
+    errors += midi_router_packet_priority(&ump) != MIDI_PRIO_NOTE;
+    midi_router_packet_t event = { .format = MIDI_FORMAT_EVENT };
+    errors += midi_router_packet_priority(&event) != MIDI_PRIO_NOTE;
+    
+    if (errors == 0) {
+        ESP_LOGI(TAG, "✓ All priority classes correct!");
+    } else {
+        ESP_LOGE(TAG, "✗ %d priority errors", errors);
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+// Fake USB output recording delivery order for the scheduling test.
+// SysEx goes out in two slices; the second fails while s_usb_sysex_fail.
+static uint8_t s_usb_order[64];
+static volatile int s_usb_order_count;
+static volatile int s_usb_sysex_sent, s_usb_sysex_starts, s_usb_aborts;
+static volatile bool s_usb_sysex_fail;
+
+static esp_err_t test_usb_order_tx(const midi_router_packet_t *packet) {
+    if (s_usb_busy) {
+        return ESP_ERR_TIMEOUT;
+    }
+    if (packet->data.midi1.status == 0xF0) {
+        if (s_usb_sysex_sent++ == 0) {
+            s_usb_sysex_starts++;
+            return ESP_ERR_NOT_FINISHED;
+        }
+        if (s_usb_sysex_fail) {
+            return ESP_FAIL;
+        }
+        s_usb_sysex_sent = 0;
+    }
+    if (s_usb_order_count < sizeof(s_usb_order)) {
+        s_usb_order[s_usb_order_count++] = packet->data.midi1.status;
+    }
+    return ESP_OK;
+}
+
+static void test_usb_order_abort(void) {
+    s_usb_sysex_sent = 0;
+    s_usb_aborts++;
+}
+
+/**
+ * @brief Test 11: Router - Clock Overtakes Queued Controllers
+ */
+void test_router_priority_scheduling(void) {
+    ESP_LOGI(TAG, "=== Test 11: Router - Priority Scheduling ===");
+    
+    static midi_router_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.routing_matrix[MIDI_TRANSPORT_UART][MIDI_TRANSPORT_USB] = true;
+    cfg.auto_translate = false;
+    for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+        cfg.dest_policies[t] = MIDI_DEST_POLICY_DEFAULT();
+    }
+    cfg.dest_policies[MIDI_TRANSPORT_USB].max_tx_retries = 255;
+    
+    midi_router_deinit();
+    if (midi_router_init(&cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "✗ Router init failed!");
+        return;
+    }
+    midi_router_register_transport_tx(MIDI_TRANSPORT_USB, test_usb_order_tx);
+    midi_router_register_transport_abort(MIDI_TRANSPORT_USB, test_usb_order_abort);
+    midi_router_reset_stats();
+    
+    s_usb_busy = true;
+    s_usb_order_count = 0;
+    s_usb_sysex_sent = s_usb_sysex_starts = s_usb_aborts = 0;
+    
+    // 20 distinct controllers queue up behind a busy output, then a clock tick
+    midi_router_packet_t pkt = { .source = MIDI_TRANSPORT_UART, .format = MIDI_FORMAT_1_0 };
+    for (int i = 0; i < 20; i++) {
+        pkt.data.midi1 = (midi_message_t){ .status = 0xB0, .data.bytes = {20 + i, 64} };
+        midi_router_send(&pkt);
+    }
+    pkt.data.midi1 = (midi_message_t){ .type = MIDI_MSG_TYPE_SYSTEM_REALTIME, .status = 0xF8 };
+    midi_router_send(&pkt);
+    
+    vTaskDelay(pdMS_TO_TICKS(20));
+    s_usb_busy = false;
+    vTaskDelay(pdMS_TO_TICKS(50));
+    
+    midi_router_stats_t stats;
+    midi_router_get_stats(&stats);
+    int clock_run = s_usb_order_count;
+    uint8_t clock_first = s_usb_order[0];
+    
+    // A SysEx failing after its first slice, then one that goes through:
+    // the second must start from F0, not resume where the first stopped
+    pkt.data.midi1 = (midi_message_t){ .type = MIDI_MSG_TYPE_SYSTEM_EXCLUSIVE, .status = 0xF0 };
+    s_usb_sysex_fail = true;
+    midi_router_send(&pkt);
+    vTaskDelay(pdMS_TO_TICKS(20));
+    s_usb_sysex_fail = false;
+    midi_router_send(&pkt);
+    vTaskDelay(pdMS_TO_TICKS(20));
+    bool restarted = s_usb_aborts == 1 && s_usb_sysex_starts == 2 &&
+                     s_usb_order_count == clock_run + 1;
+    
+    ESP_LOGI(TAG, "  Delivered %d, first 0x%02X", clock_run, clock_first);
+    ESP_LOGI(TAG, "  Latency avg/max us: realtime %lu/%lu, control %lu/%lu",
+             stats.class_latency_avg_us[MIDI_PRIO_REALTIME], stats.class_latency_max_us[MIDI_PRIO_REALTIME],
+             stats.class_latency_avg_us[MIDI_PRIO_CONTROL], stats.class_latency_max_us[MIDI_PRIO_CONTROL]);
+    
+    if (clock_run == 21 && clock_first == 0xF8) {
+        ESP_LOGI(TAG, "✓ Clock sent ahead of queued controllers");
+    } else {
+        ESP_LOGE(TAG, "✗ Priority scheduling incorrect!");
+    }
+    if (restarted) {
+        ESP_LOGI(TAG, "✓ SysEx dropped part way is abandoned at the output");
+    } else {
+        ESP_LOGE(TAG, "✗ Sliced SysEx not reset (aborts %d, starts %d)!",
+                 s_usb_aborts, s_usb_sysex_starts);
+    }
+    
+    midi_router_register_transport_tx(MIDI_TRANSPORT_USB, NULL);
+    midi_router_deinit();
+    
+    ESP_LOGI(TAG, "");
+}
+
+// USB output recording channel 1 in arrival order
+static volatile bool s_order_stall, s_order_stalled, s_order_busy;
+static uint8_t s_order_seen[16][3];
+static volatile int s_order_count, s_order_total;
+
+static esp_err_t test_order_usb_tx(const midi_router_packet_t *packet) {
+    if (s_order_busy) {
+        return ESP_ERR_TIMEOUT;
+    }
+    while (s_order_stall) {
+        s_order_stalled = true;
+        vTaskDelay(1);
+    }
+    const midi_message_t *msg = &packet->data.midi1;
+    if ((msg->status & 0x0F) == 0 && s_order_count < 16) {
+        s_order_seen[s_order_count][0] = msg->status;
+        s_order_seen[s_order_count][1] = msg->data.bytes[0];
+        s_order_seen[s_order_count][2] = msg->data.bytes[1];
+        s_order_count++;
+    }
+    s_order_total++;
+    return ESP_OK;
+}
+
+/**
+ * @brief Send a sequence on channel 1 behind a note on channel 2
+ * 
+ * @return true if channel 1 came out as sent
+ */
+static bool test_order_run(const uint8_t (*seq)[3], int count, volatile bool *hold,
+                           const midi_router_config_t *publish) {
+    midi_router_packet_t pkt = { .source = MIDI_TRANSPORT_UART, .format = MIDI_FORMAT_1_0 };
+    s_order_count = s_order_total = 0;
+    s_order_stalled = false;
+    
+    *hold = true;
+    pkt.data.midi1 = (midi_message_t){ .status = 0x91, .data.bytes = {50, 100} };
+    midi_router_send(&pkt);
+    for (int wait = 0; wait < 100 && hold == &s_order_stall && !s_order_stalled; wait++) {
+        vTaskDelay(1);
+    }
+    for (int i = 0; i < count; i++) {
+        pkt.data.midi1 = (midi_message_t){ .status = seq[i][0],
+                                           .data.bytes = {seq[i][1], seq[i][2]} };
+        midi_router_send(&pkt);
+    }
+    vTaskDelay(pdMS_TO_TICKS(20));  // All of it queued behind the held note
+    if (publish) {
+        midi_router_set_config(publish);
+    }
+    *hold = false;
+    for (int wait = 0; wait < 200 && s_order_total < count + 1; wait++) {
+        vTaskDelay(1);
+    }
+    
+    bool in_order = s_order_count == count;
+    for (int i = 0; in_order && i < count; i++) {
+        in_order = memcmp(s_order_seen[i], seq[i], 3) == 0;
+    }
+    return in_order;
+}
+
+/**
+ * @brief Test 12: Router - Stream Order Across Priority Classes
+ */
+void test_router_stream_order(void) {
+    ESP_LOGI(TAG, "=== Test 12: Router - Stream Order Across Classes ===");
+    
+    static midi_router_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.routing_matrix[MIDI_TRANSPORT_UART][MIDI_TRANSPORT_USB] = true;
+    cfg.auto_translate = false;
+    for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+        cfg.dest_policies[t] = MIDI_DEST_POLICY_DEFAULT();
+    }
+    cfg.dest_policies[MIDI_TRANSPORT_USB].max_tx_retries = 255;
+    
+    midi_router_deinit();
+    if (midi_router_init(&cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "✗ Router init failed!");
+        return;
+    }
+    midi_router_register_transport_tx(MIDI_TRANSPORT_USB, test_order_usb_tx);
+    
+    // Router stalled in a send: the sequence waits in the ingress queues
+    static const uint8_t ingress_seq[][3] = {
+        {0xC0, 5, 0}, {0xB0, 64, 127}, {0x90, 60, 100}, {0xB0, 7, 90}, {0x80, 60, 0}
+    };
+    bool ingress_ok = test_order_run(ingress_seq, 5, &s_order_stall, NULL);
+    
+    // Output busy: the sequence waits in the output queues, and the
+    // Sustain release is not merged into the press across the note
+    static const uint8_t output_seq[][3] = {
+        {0xB0, 64, 127}, {0x90, 60, 100}, {0xB0, 64, 0}, {0xC0, 6, 0}, {0x90, 62, 100}
+    };
+    bool output_ok = test_order_run(output_seq, 5, &s_order_busy, NULL);
+    
+    // A publish moving the default group while both queue sets hold
+    // MIDI 1.0 traffic, then the same sequences again
+    cfg.default_group = 5;
+    bool publish_ok = test_order_run(ingress_seq, 5, &s_order_stall, &cfg) &&
+                      test_order_run(output_seq, 5, &s_order_busy, &cfg);
+    cfg.default_group = 0;
+    publish_ok = publish_ok && test_order_run(output_seq, 5, &s_order_busy, &cfg) &&
+                 test_order_run(ingress_seq, 5, &s_order_stall, NULL);
+    
+    midi_router_register_transport_tx(MIDI_TRANSPORT_USB, NULL);
+    midi_router_deinit();
+    
+    if (ingress_ok) {
+        ESP_LOGI(TAG, "✓ Program, Sustain and notes routed in order");
+    } else {
+        ESP_LOGE(TAG, "✗ Ingress reordered a channel (%d of 5 seen)!", s_order_count);
+    }
+    if (output_ok) {
+        ESP_LOGI(TAG, "✓ Controller then Note On sent in order, Sustain kept");
+    } else {
+        ESP_LOGE(TAG, "✗ Output reordered a channel (%d of 5 seen)!", s_order_count);
+    }
+    if (publish_ok) {
+        ESP_LOGI(TAG, "✓ Order kept across a default group change");
+    } else {
+        ESP_LOGE(TAG, "✗ Queued packets lost their stream on publish (%d of 5 seen)!",
+                 s_order_count);
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+/**
+ * @brief Worker-scaling fixture: per-output delivery order checks
+ * 
+ * Each TX callback runs on its output's owner only, so these need no locks.
+ */
+#define SCALE_PACKETS 4000
+
+static volatile int s_scale_delivered[MIDI_TRANSPORT_COUNT];
+static volatile int s_scale_out_of_order;
+static int16_t s_scale_last[MIDI_TRANSPORT_COUNT][16];
+
+static void test_scale_record(midi_transport_t dest, const midi_router_packet_t *packet) {
+    uint32_t word0 = packet->data.ump.words[0];
+    uint8_t channel = UMP_GET_CHANNEL(word0);
+    int16_t seq = (word0 >> 8) & 0x7F;    // Note number carries a per-channel counter
+    
+    if (seq != ((s_scale_last[dest][channel] + 1) & 0x7F)) {
+        s_scale_out_of_order++;
+    }
+    s_scale_last[dest][channel] = seq;
+    s_scale_delivered[dest]++;
+}
+
+static esp_err_t test_scale_usb_tx(const midi_router_packet_t *packet) {
+    test_scale_record(MIDI_TRANSPORT_USB, packet);
+    return ESP_OK;
+}
+
+static volatile int s_scale_eth_stall_ms;
+
+static esp_err_t test_scale_eth_tx(const midi_router_packet_t *packet) {
+    if (s_scale_eth_stall_ms) {
+        int stall_ms = s_scale_eth_stall_ms;
+        s_scale_eth_stall_ms = 0;
+        vTaskDelay(pdMS_TO_TICKS(stall_ms));  // Owner busy: its inbound ring fills
+    }
+    test_scale_record(MIDI_TRANSPORT_ETHERNET, packet);
+    return ESP_OK;
+}
+
+static uint8_t s_scale_counter[16];
+
+/**
+ * @brief Start the router with one spread source feeding two outputs
+ * 
+ * USB is driven by worker 0 and Ethernet by worker 1 (when present).
+ */
+static bool test_scale_start(uint8_t workers) {
+    static midi_router_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.routing_matrix[MIDI_TRANSPORT_UART][MIDI_TRANSPORT_USB] = true;
+    cfg.routing_matrix[MIDI_TRANSPORT_UART][MIDI_TRANSPORT_ETHERNET] = true;
+    cfg.auto_translate = true;
+    for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+        cfg.dest_policies[t] = MIDI_DEST_POLICY_DEFAULT();
+    }
+    cfg.num_workers = workers;
+    cfg.source_worker[MIDI_TRANSPORT_UART] = MIDI_ROUTER_SHARD_SPREAD;
+    cfg.dest_worker[MIDI_TRANSPORT_ETHERNET] = 1;
+    
+    // Rules that are evaluated for every note but never fire (velocity 100)
+    for (int i = 0; i < 8; i++) {
+        cfg.rules[i] = (midi_rule_t){
+            .class_mask = 1u << MIDI_CLASS_NOTE_ON,
+            .match_value = true, .value_min = 0, .value_max = 10 + i,
+            .action = MIDI_RULE_ACTION_DROP
+        };
+    }
+    cfg.num_rules = 8;
+    
+    midi_router_deinit();
+    if (midi_router_init(&cfg) != ESP_OK) {
+        return false;
+    }
+    midi_router_register_transport_tx(MIDI_TRANSPORT_USB, test_scale_usb_tx);
+    midi_router_register_transport_tx(MIDI_TRANSPORT_ETHERNET, test_scale_eth_tx);
+    
+    memset((void *)s_scale_delivered, 0, sizeof(s_scale_delivered));
+    memset(s_scale_last, 0xFF, sizeof(s_scale_last));   // -1: next expected is 0
+    memset(s_scale_counter, 0, sizeof(s_scale_counter));
+    s_scale_out_of_order = 0;
+    return true;
+}
+
+/**
+ * @brief Send count notes round-robin over 16 channels, wait for delivery
+ */
+static void test_scale_feed(int count) {
+    midi_router_packet_t pkt = { .source = MIDI_TRANSPORT_UART, .format = MIDI_FORMAT_1_0 };
+    int target = s_scale_delivered[MIDI_TRANSPORT_USB] + count;
+    bool to_eth = false;
+    midi_router_get_route(MIDI_TRANSPORT_UART, MIDI_TRANSPORT_ETHERNET, &to_eth);
+    int eth_target = s_scale_delivered[MIDI_TRANSPORT_ETHERNET] + (to_eth ? count : 0);
+    
+    for (int i = 0; i < count; i++) {
+        uint8_t channel = i & 0x0F;
+        uint8_t note = s_scale_counter[channel]++ & 0x7F;
+        pkt.data.midi1 = (midi_message_t){ .status = 0x90 | channel, .channel = channel,
+                                           .data.bytes = {note, 100} };
+        while (midi_router_send(&pkt) != ESP_OK) {
+            vTaskDelay(1);  // Ingress full: let the workers catch up
+        }
+    }
+    
+    for (int wait = 0; wait < 2000; wait++) {
+        if (s_scale_delivered[MIDI_TRANSPORT_USB] >= target &&
+            s_scale_delivered[MIDI_TRANSPORT_ETHERNET] >= eth_target) {
+            break;
+        }
+        vTaskDelay(1);
+    }
+    vTaskDelay(pdMS_TO_TICKS(5));   // Counters are updated just after TX returns
+}
+
+static void test_scale_stop(void) {
+    midi_router_register_transport_tx(MIDI_TRANSPORT_USB, NULL);
+    midi_router_register_transport_tx(MIDI_TRANSPORT_ETHERNET, NULL);
+    midi_router_deinit();
+}
+
+/**
+ * @brief Route SCALE_PACKETS through the router with the given worker count
+ * 
+ * @return Elapsed microseconds, or -1 on failure
+ */
+static int64_t test_scale_run(uint8_t workers) {
+    if (!test_scale_start(workers)) {
+        return -1;
+    }
+    
+    int64_t start = esp_timer_get_time();
+    test_scale_feed(SCALE_PACKETS);
+    int64_t elapsed = esp_timer_get_time() - start;
+    
+    test_scale_stop();
+    return elapsed;
+}
+
+/**
+ * @brief Test 13: Router - Sharded Workers Keep Per-Channel Order
+ */
+void test_router_worker_scaling(void) {
+    ESP_LOGI(TAG, "=== Test 13: Router - Worker Scaling ===");
+    
+    int64_t single_us = test_scale_run(1);
+    bool single_ok = s_scale_out_of_order == 0 &&
+                     s_scale_delivered[MIDI_TRANSPORT_USB] == SCALE_PACKETS &&
+                     s_scale_delivered[MIDI_TRANSPORT_ETHERNET] == SCALE_PACKETS;
+    
+    int64_t sharded_us = test_scale_run(MIDI_ROUTER_MAX_WORKERS);
+    bool sharded_ok = s_scale_out_of_order == 0 &&
+                      s_scale_delivered[MIDI_TRANSPORT_USB] == SCALE_PACKETS &&
+                      s_scale_delivered[MIDI_TRANSPORT_ETHERNET] == SCALE_PACKETS;
+    
+    ESP_LOGI(TAG, "  %d packets x 2 outputs: 1 worker %lld us, %d workers %lld us",
+             SCALE_PACKETS, single_us, MIDI_ROUTER_MAX_WORKERS, sharded_us);
+    ESP_LOGI(TAG, "  Out of order: %d", s_scale_out_of_order);
+    
+    if (single_us > 0 && sharded_us > 0 && single_ok && sharded_ok) {
+        ESP_LOGI(TAG, "✓ All packets delivered in per-channel order");
+    } else {
+        ESP_LOGE(TAG, "✗ Sharded routing lost or reordered packets!");
+    }
+    
+    // Ethernet's owner stalls: the other worker sleeps on the full ring
+    // until woken, and nothing is lost
+    bool stalled_ok = false;
+    midi_router_stats_t stats = {0};
+    if (MIDI_ROUTER_MAX_WORKERS > 1 && test_scale_start(MIDI_ROUTER_MAX_WORKERS)) {
+        s_scale_eth_stall_ms = 10;
+        test_scale_feed(400);
+        midi_router_get_stats(&stats);
+        stalled_ok = s_scale_out_of_order == 0 &&
+                     s_scale_delivered[MIDI_TRANSPORT_ETHERNET] == 400 &&
+                     stats.handoff_dropped[MIDI_TRANSPORT_ETHERNET] == 0;
+        test_scale_stop();
+    }
+    if (MIDI_ROUTER_MAX_WORKERS == 1 || stalled_ok) {
+        ESP_LOGI(TAG, "✓ Handoff waited out a stalled owner");
+    } else {
+        ESP_LOGE(TAG, "✗ Handoff lost %lu packet(s) to a stalled owner!",
+                 (unsigned long)stats.handoff_dropped[MIDI_TRANSPORT_ETHERNET]);
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+/**
+ * @brief Total packets delivered from UART to USB and Ethernet
+ */
+static uint32_t test_stats_routed(const midi_router_stats_t *stats) {
+    return stats->packets_routed[MIDI_TRANSPORT_UART][MIDI_TRANSPORT_USB] +
+           stats->packets_routed[MIDI_TRANSPORT_UART][MIDI_TRANSPORT_ETHERNET];
+}
+
+/**
+ * @brief Test 14: Router - Sharded Statistics, Reset and Deltas
+ */
+void test_router_stats_shards(void) {
+    ESP_LOGI(TAG, "=== Test 14: Router - Statistics Shards ===");
+    
+    if (!test_scale_start(MIDI_ROUTER_MAX_WORKERS)) {
+        ESP_LOGE(TAG, "✗ Router init failed!");
+        return;
+    }
+    
+    // Both workers count deliveries; the fold must see all of them
+    midi_router_stats_snapshot_t first, second, third;
+    midi_router_stats_t delta;
+    test_scale_feed(1000);
+    midi_router_get_stats_snapshot(&first);
+    bool folded = test_stats_routed(&first.stats) == 2000 &&
+                  first.stats.translations_1to2 == 2000;
+    
+    // Reset from this task while the workers own their shards
+    midi_router_reset_stats();
+    midi_router_stats_t after_reset;
+    midi_router_get_stats(&after_reset);
+    bool reset = test_stats_routed(&after_reset) == 0;
+    
+    test_scale_feed(500);
+    midi_router_get_stats_snapshot(&second);
+    midi_router_stats_delta(&first, &second, &delta);
+    bool across_reset = test_stats_routed(&delta) == 1000;
+    
+    test_scale_feed(200);
+    midi_router_get_stats_snapshot(&third);
+    midi_router_stats_delta(&second, &third, &delta);
+    bool delta_ok = test_stats_routed(&delta) == 400 && delta.translations_1to2 == 400;
+    
+    uint32_t rate = midi_stats_rate(test_stats_routed(&delta),
+                                    third.timestamp_us - second.timestamp_us);
+    ESP_LOGI(TAG, "  Routed: %lu, after reset %lu, since reset %lu, delta %lu (%lu/s)",
+             test_stats_routed(&first.stats), test_stats_routed(&after_reset),
+             test_stats_routed(&second.stats), test_stats_routed(&delta), rate);
+    
+    test_scale_stop();
+    
+    if (folded && reset) {
+        ESP_LOGI(TAG, "✓ Shards fold to exact totals and reset cleanly");
+    } else {
+        ESP_LOGE(TAG, "✗ Folded statistics wrong!");
+    }
+    if (across_reset && delta_ok) {
+        ESP_LOGI(TAG, "✓ Snapshot deltas correct, including across a reset");
+    } else {
+        ESP_LOGE(TAG, "✗ Snapshot deltas wrong!");
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+// File stand-in for NVS (any writable VFS path; a host build can use /tmp)
+#ifndef TEST_CONFIG_PREFIX
+#define TEST_CONFIG_PREFIX "/spiffs/midi_router_test_"
+#endif
+
+static midi_router_config_t s_cfg_saved;
+static midi_router_config_t s_cfg_loaded;
+static uint8_t s_blob[MIDI_CONFIG_BLOB_MAX + 8];
+static uint8_t s_blob_check[MIDI_CONFIG_BLOB_MAX];
+
+/**
+ * @brief Re-encode a config and compare with s_blob
+ */
+static bool test_config_same(const midi_router_config_t *config, size_t len) {
+    size_t check_len;
+    return midi_config_blob_encode(config, s_blob_check, sizeof(s_blob_check), &check_len) == ESP_OK &&
+           check_len == len && memcmp(s_blob, s_blob_check, len) == 0;
+}
+
+/**
+ * @brief Rewrite s_blob's header for another version and payload length
+ */
+static void test_blob_reseal(uint16_t version, size_t payload) {
+    s_blob[4] = version & 0xFF;
+    s_blob[5] = version >> 8;
+    s_blob[6] = payload & 0xFF;
+    s_blob[7] = payload >> 8;
+    uint32_t crc = midi_config_crc32(&s_blob[MIDI_CONFIG_BLOB_HEADER], payload);
+    for (int i = 0; i < 4; i++) {
+        s_blob[8 + i] = (crc >> (8 * i)) & 0xFF;
+    }
+}
+
+/**
+ * @brief Test 15: Router - Config Blob and Persistence
+ */
+void test_router_config_persistence(void) {
+    ESP_LOGI(TAG, "=== Test 15: Router - Config Persistence ===");
+    
+    // Non-default config touching every section of the blob
+    midi_router_get_default_config(&s_cfg_saved);
+    s_cfg_saved.routing_matrix[MIDI_TRANSPORT_UART][MIDI_TRANSPORT_WIFI] = false;
+    s_cfg_saved.merge_inputs = true;
+    s_cfg_saved.default_group = 5;
+    s_cfg_saved.input_filters[MIDI_TRANSPORT_USB] = (midi_filter_t){
+        .enabled = true, .block_clock = true, .channel_mask = 0x00FF,
+        .per_group_channels = true, .group_channel_mask = { [3] = 0x0001 }
+    };
+    s_cfg_saved.dest_policies[MIDI_TRANSPORT_ETHERNET].drop_mode = MIDI_DROP_NEWEST;
+    s_cfg_saved.dest_policies[MIDI_TRANSPORT_ETHERNET].max_tx_retries = 9;
+    s_cfg_saved.num_workers = 1;
+    s_cfg_saved.source_worker[MIDI_TRANSPORT_UART] = MIDI_ROUTER_SHARD_SPREAD;
+    s_cfg_saved.rules[0] = (midi_rule_t){
+        .source_mask = 1 << MIDI_TRANSPORT_USB, .class_mask = 1 << MIDI_CLASS_NOTE_ON,
+        .match_data1 = true, .data1_min = 36, .data1_max = 96,
+        .action = MIDI_RULE_ACTION_TRANSPOSE, .param = -12
+    };
+    s_cfg_saved.num_rules = 1;
+    s_cfg_saved.group_map[MIDI_TRANSPORT_ETHERNET][3] = 7 + 1;
+    
+    size_t len;
+    int64_t start = esp_timer_get_time();
+    bool encoded = midi_config_blob_encode(&s_cfg_saved, s_blob, sizeof(s_blob), &len) == ESP_OK;
+    bool decoded = encoded && midi_config_blob_decode(s_blob, len, &s_cfg_loaded) == ESP_OK;
+    int64_t codec_us = esp_timer_get_time() - start;
+    bool round_trip = decoded && test_config_same(&s_cfg_loaded, len) &&
+                      s_cfg_loaded.rules[0].param == -12 &&
+                      s_cfg_loaded.input_filters[MIDI_TRANSPORT_USB].group_channel_mask[3] == 0x0001;
+    ESP_LOGI(TAG, "  Blob: %u bytes (config struct %u), encode+decode %lld us",
+             (unsigned)len, (unsigned)sizeof(midi_router_config_t), codec_us);
+    
+    // Corruption and foreign data are rejected
+    s_blob[MIDI_CONFIG_BLOB_HEADER + 2] ^= 0x10;
+    bool crc_caught = midi_config_blob_decode(s_blob, len, &s_cfg_loaded) == ESP_ERR_INVALID_CRC;
+    s_blob[MIDI_CONFIG_BLOB_HEADER + 2] ^= 0x10;
+    bool short_caught = midi_config_blob_decode(s_blob, len - 1, &s_cfg_loaded) == ESP_ERR_INVALID_SIZE;
+    s_blob[0] ^= 0xFF;
+    bool magic_caught = midi_config_blob_decode(s_blob, len, &s_cfg_loaded) == ESP_ERR_INVALID_VERSION;
+    s_blob[0] ^= 0xFF;
+    
+    // A newer firmware's blob: same fields plus appended ones
+    memset(&s_blob[len], 0xA5, 3);
+    test_blob_reseal(MIDI_CONFIG_BLOB_VERSION + 1, len - MIDI_CONFIG_BLOB_HEADER + 3);
+    bool newer_ok = midi_config_blob_decode(s_blob, len + 3, &s_cfg_loaded) == ESP_OK &&
+                    midi_config_blob_encode(&s_cfg_loaded, s_blob, sizeof(s_blob), &len) == ESP_OK &&
+                    test_config_same(&s_cfg_saved, len);
+    
+    // A version 1 blob (before group maps) migrates with identity maps;
+    // a v1 decoder stops where v2 appended, so the tail is just ignored
+    s_cfg_saved.group_map[MIDI_TRANSPORT_ETHERNET][3] = 0;
+    midi_config_blob_encode(&s_cfg_saved, s_blob, sizeof(s_blob), &len);
+    test_blob_reseal(1, len - MIDI_CONFIG_BLOB_HEADER);
+    bool migrated = midi_config_blob_decode(s_blob, len, &s_cfg_loaded) == ESP_OK &&
+                    midi_config_blob_encode(&s_cfg_loaded, s_blob, sizeof(s_blob), &len) == ESP_OK &&
+                    test_config_same(&s_cfg_saved, len);
+    
+    if (round_trip) {
+        ESP_LOGI(TAG, "✓ Config survives encode/decode");
+    } else {
+        ESP_LOGE(TAG, "✗ Config round trip failed!");
+    }
+    if (crc_caught && short_caught && magic_caught && newer_ok && migrated) {
+        ESP_LOGI(TAG, "✓ Corrupt blobs rejected, older and newer blobs accepted");
+    } else {
+        ESP_LOGE(TAG, "✗ Blob validation wrong (crc=%d short=%d magic=%d newer=%d v1=%d)!",
+                 crc_caught, short_caught, magic_caught, newer_ok, migrated);
+    }
+    
+    // Save, restart the router from the store, check what it loaded
+    static midi_config_store_t store;
+    midi_config_store_file_init(&store, TEST_CONFIG_PREFIX);
+    if (store.write(&store, "probe", s_blob, 0) != ESP_OK) {
+        ESP_LOGW(TAG, "  %s not writable, skipping persistence check", TEST_CONFIG_PREFIX);
+        ESP_LOGI(TAG, "");
+        return;
+    }
+    midi_router_set_config_store(&store);
+    
+    bool restored = false;
+    midi_router_boot_timing_t timing = {0};
+    if (midi_router_init(&s_cfg_saved) == ESP_OK) {
+        midi_router_set_route(MIDI_TRANSPORT_USB, MIDI_TRANSPORT_UART, false);
+        bool saved = midi_router_save_config() == ESP_OK;
+        midi_router_deinit();
+        
+        if (saved && midi_router_init(NULL) == ESP_OK) {
+            bool usb_uart = true, uart_wifi = true, uart_usb = false;
+            midi_router_get_route(MIDI_TRANSPORT_USB, MIDI_TRANSPORT_UART, &usb_uart);
+            midi_router_get_route(MIDI_TRANSPORT_UART, MIDI_TRANSPORT_WIFI, &uart_wifi);
+            midi_router_get_route(MIDI_TRANSPORT_UART, MIDI_TRANSPORT_USB, &uart_usb);
+            midi_router_get_boot_timing(&timing);
+            restored = !usb_uart && !uart_wifi && uart_usb;
+            midi_router_deinit();
+        }
+    }
+    
+    store.erase(&store, "probe");
+    store.erase(&store, "config");
+    midi_router_set_config_store(NULL);
+    
+    ESP_LOGI(TAG, "  Init from store: config %lu us, ready after %lu us",
+             (unsigned long)timing.config_load_us, (unsigned long)timing.init_us);
+    if (restored) {
+        ESP_LOGI(TAG, "✓ Saved routes restored at init");
+    } else {
+        ESP_LOGE(TAG, "✗ Saved config not restored!");
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+#define RECONFIG_SWAPS 40
+
+static midi_router_config_t s_scenes[2];
+static volatile bool s_reconfig_done;
+static volatile int s_reconfig_ok;
+static volatile int64_t s_reconfig_max_us;
+
+/**
+ * @brief Switch between two scenes and toggle a route while traffic flows
+ */
+static void test_reconfig_task(void *arg) {
+    for (int i = 0; i < RECONFIG_SWAPS; i++) {
+        int64_t start = esp_timer_get_time();
+        esp_err_t scene = midi_router_set_config(&s_scenes[i & 1]);
+        esp_err_t route = midi_router_set_route(MIDI_TRANSPORT_UART, MIDI_TRANSPORT_WIFI, i & 1);
+        int64_t elapsed = esp_timer_get_time() - start;
+        
+        if (scene == ESP_OK && route == ESP_OK) {
+            s_reconfig_ok++;
+        }
+        if (elapsed > s_reconfig_max_us) {
+            s_reconfig_max_us = elapsed;
+        }
+        vTaskDelay(1);
+    }
+    s_reconfig_done = true;
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Test 16: Router - Live Reconfiguration Under Traffic
+ */
+void test_router_live_reconfig(void) {
+    ESP_LOGI(TAG, "=== Test 16: Router - Live Reconfiguration ===");
+    
+    if (!test_scale_start(MIDI_ROUTER_MAX_WORKERS)) {
+        ESP_LOGE(TAG, "✗ Router init failed!");
+        return;
+    }
+    
+    // Both scenes keep UART → USB/Ethernet but differ in everything else
+    midi_router_get_config(&s_scenes[0]);
+    s_scenes[1] = s_scenes[0];
+    s_scenes[1].num_rules = 2;
+    s_scenes[1].routing_matrix[MIDI_TRANSPORT_USB][MIDI_TRANSPORT_WIFI] = true;
+    s_scenes[1].input_filters[MIDI_TRANSPORT_UART] = (midi_filter_t){
+        .enabled = true, .block_clock = true, .channel_mask = 0xFFFF
+    };
+    s_scenes[1].dest_policies[MIDI_TRANSPORT_USB].max_tx_retries = 2;
+    
+    s_reconfig_done = false;
+    s_reconfig_ok = 0;
+    s_reconfig_max_us = 0;
+    xTaskCreate(test_reconfig_task, "reconfig", 4096, NULL, 5, NULL);
+    
+    int64_t start = esp_timer_get_time();
+    test_scale_feed(SCALE_PACKETS);
+    int64_t elapsed = esp_timer_get_time() - start;
+    
+    while (!s_reconfig_done) {
+        vTaskDelay(1);
+    }
+    
+    midi_router_config_t final;
+    midi_router_get_config(&final);
+    bool final_ok = final.num_rules == s_scenes[1].num_rules &&
+                    final.routing_matrix[MIDI_TRANSPORT_UART][MIDI_TRANSPORT_WIFI];
+    bool routed_ok = s_scale_out_of_order == 0 &&
+                     s_scale_delivered[MIDI_TRANSPORT_USB] == SCALE_PACKETS &&
+                     s_scale_delivered[MIDI_TRANSPORT_ETHERNET] == SCALE_PACKETS;
+    
+    ESP_LOGI(TAG, "  %d packets in %lld us during %d changes (slowest %lld us)",
+             SCALE_PACKETS, elapsed, s_reconfig_ok, s_reconfig_max_us);
+    
+    test_scale_stop();
+    
+    if (routed_ok) {
+        ESP_LOGI(TAG, "✓ No packet lost or reordered during scene changes");
+    } else {
+        ESP_LOGE(TAG, "✗ Traffic disturbed by reconfiguration (out of order %d)!",
+                 s_scale_out_of_order);
+    }
+    if (s_reconfig_ok == RECONFIG_SWAPS && final_ok) {
+        ESP_LOGI(TAG, "✓ Every change published");
+    } else {
+        ESP_LOGE(TAG, "✗ Changes lost!");
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+/**
+ * @brief Wait for the router to report a preset, return microseconds taken
+ */
+static int64_t test_preset_wait(int preset, int64_t start) {
+    for (int i = 0; i < 100000 && midi_router_get_active_preset() != preset; i++) {
+        taskYIELD();
+    }
+    return esp_timer_get_time() - start;
+}
+
+/**
+ * @brief Test 17: Router - Preset Bank
+ */
+void test_router_presets(void) {
+    ESP_LOGI(TAG, "=== Test 17: Router - Preset Bank ===");
+    
+    if (!test_scale_start(MIDI_ROUTER_MAX_WORKERS)) {
+        ESP_LOGE(TAG, "✗ Router init failed!");
+        return;
+    }
+    
+    // Preset 0: as started. Preset 1: Ethernet muted, other rules
+    midi_router_get_config(&s_scenes[0]);
+    s_scenes[1] = s_scenes[0];
+    s_scenes[1].routing_matrix[MIDI_TRANSPORT_UART][MIDI_TRANSPORT_ETHERNET] = false;
+    s_scenes[1].num_rules = 3;
+    s_scenes[1].group_map[MIDI_TRANSPORT_WIFI][0] = 2 + 1;
+    bool stored = midi_router_preset_store(0, &s_scenes[0]) == ESP_OK &&
+                  midi_router_preset_store(1, &s_scenes[1]) == ESP_OK &&
+                  midi_router_preset_recall(2) == ESP_ERR_NOT_FOUND;
+    
+    // API recall
+    int64_t start = esp_timer_get_time();
+    bool recalled = midi_router_preset_recall(1) == ESP_OK;
+    int64_t api_us = esp_timer_get_time() - start;
+    test_scale_feed(100);
+    bool api_ok = stored && recalled && midi_router_get_active_preset() == 1 &&
+                  s_scale_delivered[MIDI_TRANSPORT_USB] == 100 &&
+                  s_scale_delivered[MIDI_TRANSPORT_ETHERNET] == 0;
+    
+    // Program Change 0 on channel 16 from UART (consumed)
+    midi_router_preset_trigger_t trigger = {
+        .program_change = true, .sysex = true, .consume = true, .control_channel = 15
+    };
+    midi_router_set_preset_trigger(&trigger);
+    midi_router_packet_t pc = {
+        .source = MIDI_TRANSPORT_UART, .format = MIDI_FORMAT_1_0,
+        .data.midi1 = { .status = 0xCF, .channel = 15, .data.bytes = {0} }
+    };
+    start = esp_timer_get_time();
+    midi_router_send(&pc);
+    int64_t pc_us = test_preset_wait(0, start);
+    test_scale_feed(100);
+    bool pc_ok = midi_router_get_active_preset() == 0 &&
+                 s_scale_delivered[MIDI_TRANSPORT_USB] == 200 &&
+                 s_scale_delivered[MIDI_TRANSPORT_ETHERNET] == 100;
+    
+    // SysEx F0 7D 'M' 'C' 01 01 F7 as one UMP from WiFi
+    midi_router_packet_t sysex = {
+        .source = MIDI_TRANSPORT_WIFI, .format = MIDI_FORMAT_2_0,
+        .data.ump = { .words = { 0x30057D4D, 0x43010100 }, .num_words = 2 }
+    };
+    start = esp_timer_get_time();
+    midi_router_send(&sysex);
+    int64_t sysex_us = test_preset_wait(1, start);
+    bool sysex_ok = midi_router_get_active_preset() == 1;
+    
+    // Editing the active preset applies at once and keeps it active
+    s_scenes[1].routing_matrix[MIDI_TRANSPORT_UART][MIDI_TRANSPORT_ETHERNET] = true;
+    midi_router_preset_store(1, &s_scenes[1]);
+    test_scale_feed(100);
+    bool edit_ok = midi_router_get_active_preset() == 1 &&
+                   s_scale_delivered[MIDI_TRANSPORT_ETHERNET] == 200;
+    
+    // Any other change leaves the preset
+    midi_router_set_merge_mode(false);
+    bool left = midi_router_get_active_preset() == -1;
+    
+    trigger = (midi_router_preset_trigger_t){0};
+    midi_router_set_preset_trigger(&trigger);
+    test_scale_stop();
+    
+    ESP_LOGI(TAG, "  Switch: API %lld us, Program Change %lld us, SysEx %lld us (send to active)",
+             api_us, pc_us, sysex_us);
+    if (api_ok) {
+        ESP_LOGI(TAG, "✓ Preset recalled by API");
+    } else {
+        ESP_LOGE(TAG, "✗ API recall wrong!");
+    }
+    if (pc_ok && sysex_ok) {
+        ESP_LOGI(TAG, "✓ Program Change and SysEx switch presets");
+    } else {
+        ESP_LOGE(TAG, "✗ MIDI triggers wrong (pc=%d sysex=%d)!", pc_ok, sysex_ok);
+    }
+    if (edit_ok && left) {
+        ESP_LOGI(TAG, "✓ Active preset editable");
+    } else {
+        ESP_LOGE(TAG, "✗ Preset edit wrong!");
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+/**
+ * @brief Loopback-style transport registered at run time
+ * 
+ * MIDI 1.0 native, takes batches, can report no room or no link.
+ */
+static volatile int s_port_received;
+static volatile int s_port_out_of_order;
+static volatile int s_port_wrong_format;
+static volatile int s_port_max_batch;
+static volatile int s_port_flushes;
+static volatile size_t s_port_room = SIZE_MAX;
+static volatile bool s_port_up = true;
+static int16_t s_port_last[16];
+
+static esp_err_t test_port_send(void *ctx, const midi_router_packet_t *packet) {
+    if (packet->format != MIDI_FORMAT_1_0) {
+        s_port_wrong_format++;
+    } else if (packet->source == MIDI_TRANSPORT_UART) {
+        uint8_t channel = packet->data.midi1.status & 0x0F;
+        int16_t seq = packet->data.midi1.data.bytes[0];
+        if (seq != ((s_port_last[channel] + 1) & 0x7F)) {
+            s_port_out_of_order++;
+        }
+        s_port_last[channel] = seq;
+    }
+    s_port_received++;
+    return ESP_OK;
+}
+
+static esp_err_t test_port_send_batch(void *ctx, const midi_router_packet_t *packets,
+                                      size_t count, size_t *sent) {
+    if ((int)count > s_port_max_batch) {
+        s_port_max_batch = count;
+    }
+    for (*sent = 0; *sent < count; (*sent)++) {
+        test_port_send(ctx, &packets[*sent]);
+    }
+    return ESP_OK;
+}
+
+static void test_port_flush(void *ctx) {
+    s_port_flushes++;
+}
+
+static size_t test_port_capacity(void *ctx) {
+    return s_port_room;
+}
+
+static bool test_port_link_up(void *ctx) {
+    return s_port_up;
+}
+
+static esp_err_t test_port_stats(void *ctx, midi_transport_stats_t *stats) {
+    stats->packets_tx = s_port_received;
+    return ESP_OK;
+}
+
+static const midi_transport_ops_t s_test_port = {
+    .name = "Loopback",
+    .native_format = MIDI_FORMAT_1_0,
+    .send = test_port_send,
+    .send_batch = test_port_send_batch,
+    .flush = test_port_flush,
+    .tx_capacity = test_port_capacity,
+    .link_up = test_port_link_up,
+    .get_stats = test_port_stats
+};
+
+static void test_port_wait(int count) {
+    for (int wait = 0; wait < 500 && s_port_received < count; wait++) {
+        vTaskDelay(1);
+    }
+    vTaskDelay(pdMS_TO_TICKS(5));
+}
+
+/**
+ * @brief Test 18: Router - Transports Registered at Run Time
+ */
+void test_router_dynamic_transport(void) {
+    ESP_LOGI(TAG, "=== Test 18: Router - Dynamic Transports ===");
+    
+    if (!test_scale_start(MIDI_ROUTER_MAX_WORKERS)) {
+        ESP_LOGE(TAG, "✗ Router init failed!");
+        return;
+    }
+    
+    midi_transport_t port;
+    bool added = midi_router_add_transport(&s_test_port, NULL, &port) == ESP_OK &&
+                 port >= MIDI_TRANSPORT_BUILTIN_COUNT;
+    if (!added) {
+        ESP_LOGE(TAG, "✗ No transport slot!");
+        test_scale_stop();
+        return;
+    }
+    midi_dest_policy_t patient = MIDI_DEST_POLICY_DEFAULT();
+    patient.max_tx_retries = UINT8_MAX;
+    midi_router_set_dest_policy(port, &patient);
+    midi_router_set_route(MIDI_TRANSPORT_UART, port, true);
+    midi_router_set_route(MIDI_TRANSPORT_WIFI, port, true);
+    
+    memset(s_port_last, 0xFF, sizeof(s_port_last));
+    s_port_received = s_port_out_of_order = s_port_wrong_format = 0;
+    s_port_max_batch = s_port_flushes = 0;
+    
+    // Notes and a UMP from WiFi arrive as MIDI 1.0, in order
+    test_scale_feed(64);
+    midi_router_packet_t ump = {
+        .source = MIDI_TRANSPORT_WIFI, .format = MIDI_FORMAT_2_0,
+        .data.ump = { .words = { 0x40903C00, 0xC0000000 }, .num_words = 2,
+                      .message_type = UMP_MT_MIDI2_CHANNEL_VOICE }
+    };
+    midi_router_send(&ump);
+    test_port_wait(65);
+    bool routed = s_port_received == 65 && !s_port_out_of_order && !s_port_wrong_format;
+    
+    // No room: packets wait, then leave in batches
+    s_port_room = 0;
+    test_scale_feed(24);
+    int held = s_port_received;
+    s_port_room = SIZE_MAX;
+    test_port_wait(65 + 24);
+    bool batched = held == 65 && s_port_received == 65 + 24 && s_port_max_batch > 1 &&
+                   s_port_flushes > 0 && !s_port_out_of_order;
+    
+    // Link down: discarded, not queued
+    midi_router_stats_t before, after;
+    midi_router_get_stats(&before);
+    s_port_up = false;
+    test_scale_feed(16);
+    s_port_up = true;
+    midi_router_get_stats(&after);
+    bool discarded = s_port_received == 65 + 24 &&
+                     after.packets_dropped[port] - before.packets_dropped[port] == 16;
+    
+    // Introspection, then every free slot taken and given back
+    midi_transport_info_t info;
+    midi_transport_stats_t counters;
+    bool described = midi_router_get_transport_info(port, &info) == ESP_OK &&
+                     strcmp(info.name, "Loopback") == 0 && info.dynamic && info.attached &&
+                     info.native_format == MIDI_FORMAT_1_0 &&
+                     midi_router_get_transport_stats(port, &counters) == ESP_OK &&
+                     counters.packets_tx == 65 + 24;
+    
+    midi_transport_t extra[MIDI_TRANSPORT_COUNT];
+    int extras = 0;
+    while (extras < MIDI_TRANSPORT_COUNT &&
+           midi_router_add_transport(&s_test_port, NULL, &extra[extras]) == ESP_OK) {
+        extras++;
+    }
+    bool slots_ok = extras == MIDI_TRANSPORT_COUNT - MIDI_TRANSPORT_BUILTIN_COUNT - 1;
+    for (int i = 0; i < extras; i++) {
+        midi_router_remove_transport(extra[i]);
+    }
+    midi_router_remove_transport(port);
+    midi_transport_t again;
+    bool reused = midi_router_add_transport(&s_test_port, NULL, &again) == ESP_OK &&
+                  again == port;
+    midi_router_remove_transport(again);
+    test_scale_stop();
+    
+    ESP_LOGI(TAG, "  %s got id %d, largest batch %d, %d flush(es)",
+             info.name, port, s_port_max_batch, s_port_flushes);
+    if (routed) {
+        ESP_LOGI(TAG, "✓ Routed and translated to the transport's native format");
+    } else {
+        ESP_LOGE(TAG, "✗ Routing wrong (got %d, order %d, format %d)!",
+                 s_port_received, s_port_out_of_order, s_port_wrong_format);
+    }
+    if (batched && discarded) {
+        ESP_LOGI(TAG, "✓ Capacity, batching, flush and link state honoured");
+    } else {
+        ESP_LOGE(TAG, "✗ Driver hooks wrong (batch=%d link=%d)!", batched, discarded);
+    }
+    if (described && slots_ok && reused) {
+        ESP_LOGI(TAG, "✓ IDs allocated, described and released");
+    } else {
+        ESP_LOGE(TAG, "✗ Registration wrong (info=%d slots=%d reuse=%d)!",
+                 described, slots_ok, reused);
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+static midi_loopback_t s_lb_midi1_in, s_lb_ump_in, s_lb_midi1_out, s_lb_ump_out;
+static midi_loopback_record_t s_lb_records[64];
+
+/**
+ * @brief Route a pattern between two loopback ports, unpaced
+ * 
+ * @return true if every packet accepted was delivered
+ */
+static bool test_loopback_pattern(midi_loopback_t *in, midi_loopback_t *out,
+                                  midi_loopback_pattern_t pattern, uint8_t format) {
+    midi_loopback_stream_t stream = {
+        .pattern = pattern, .format = format, .count = 48, .sysex_length = 40
+    };
+    midi_loopback_inject_result_t res;
+    
+    midi_loopback_reset(out);
+    midi_loopback_inject(in, &stream, &res);
+    return res.accepted > 0 && midi_loopback_wait(out, res.accepted, 100) &&
+           out->received[in->id] == res.accepted;
+}
+
+/**
+ * @brief Test 19: Loopback Load Test - Throughput and Latency per Route
+ */
+void test_loopback_load(void) {
+    ESP_LOGI(TAG, "=== Test 19: Loopback Load Test ===");
+    
+    static midi_router_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.auto_translate = true;
+    for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+        cfg.dest_policies[t] = MIDI_DEST_POLICY_DEFAULT();
+        cfg.dest_policies[t].coalesce = false;     // Count every CC of a sweep
+    }
+    midi_router_deinit();
+    if (midi_router_init(&cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "✗ Router init failed!");
+        return;
+    }
+    
+    // Sources stand in for UART and USB; the outputs take run-time slots
+    bool created =
+        midi_loopback_create(&s_lb_midi1_in, &(midi_loopback_config_t){
+            .name = "Loop 1.0 in", .native_format = MIDI_FORMAT_1_0,
+            .transport = MIDI_TRANSPORT_UART }) == ESP_OK &&
+        midi_loopback_create(&s_lb_ump_in, &(midi_loopback_config_t){
+            .name = "Loop UMP in", .native_format = MIDI_FORMAT_2_0,
+            .transport = MIDI_TRANSPORT_USB }) == ESP_OK &&
+        midi_loopback_create(&s_lb_midi1_out, &(midi_loopback_config_t){
+            .name = "Loop 1.0 out", .native_format = MIDI_FORMAT_1_0,
+            .transport = MIDI_LOOPBACK_NEW_ID,
+            .records = s_lb_records, .record_capacity = 64 }) == ESP_OK &&
+        midi_loopback_create(&s_lb_ump_out, &(midi_loopback_config_t){
+            .name = "Loop UMP out", .native_format = MIDI_FORMAT_2_0,
+            .transport = MIDI_LOOPBACK_NEW_ID }) == ESP_OK;
+    if (!created) {
+        ESP_LOGE(TAG, "✗ Loopback ports not registered!");
+        midi_router_deinit();
+        return;
+    }
+    
+    // Every pattern passes through unchanged in each format
+    midi_router_set_route(s_lb_midi1_in.id, s_lb_midi1_out.id, true);
+    midi_router_set_route(s_lb_ump_in.id, s_lb_ump_out.id, true);
+    int patterns_ok = 0;
+    for (int p = MIDI_LOOPBACK_NOTES; p <= MIDI_LOOPBACK_SYSEX_DUMP; p++) {
+        patterns_ok += test_loopback_pattern(&s_lb_midi1_in, &s_lb_midi1_out, p, MIDI_FORMAT_1_0);
+        patterns_ok += test_loopback_pattern(&s_lb_ump_in, &s_lb_ump_out, p, MIDI_FORMAT_2_0);
+    }
+    
+    // Captured records carry the delivery time and ingress latency
+    midi_loopback_reset(&s_lb_midi1_out);
+    midi_loopback_stream_t paced = {
+        .pattern = MIDI_LOOPBACK_NOTES, .format = MIDI_FORMAT_1_0,
+        .rate_hz = 2000, .count = 32, .burst = 4
+    };
+    midi_loopback_inject_result_t paced_res;
+    midi_loopback_inject(&s_lb_midi1_in, &paced, &paced_res);
+    midi_loopback_wait(&s_lb_midi1_out, paced_res.accepted, 100);
+    bool stamped = s_lb_midi1_out.captured == 32 && paced_res.elapsed_us >= 14000 &&
+                   (s_lb_records[0].word0 >> 16) == MIDI_STATUS_NOTE_ON &&
+                   s_lb_records[31].time_us - s_lb_records[0].time_us >= 12000 &&
+                   s_lb_records[31].latency_us <= s_lb_midi1_out.latency_max_us;
+    midi_router_set_route(s_lb_midi1_in.id, s_lb_midi1_out.id, false);
+    midi_router_set_route(s_lb_ump_in.id, s_lb_ump_out.id, false);
+    
+    // One route at a time: find what it sustains
+    struct {
+        midi_loopback_t *in, *out;
+        uint8_t format;
+    } routes[] = {
+        { &s_lb_midi1_in, &s_lb_midi1_out, MIDI_FORMAT_1_0 },
+        { &s_lb_midi1_in, &s_lb_ump_out, MIDI_FORMAT_1_0 },
+        { &s_lb_ump_in, &s_lb_ump_out, MIDI_FORMAT_2_0 },
+        { &s_lb_ump_in, &s_lb_midi1_out, MIDI_FORMAT_2_0 },
+    };
+    int routes_ok = 0;
+    for (size_t r = 0; r < sizeof(routes) / sizeof(routes[0]); r++) {
+        midi_loopback_load_config_t load = {
+            .stream = { .pattern = MIDI_LOOPBACK_NOTES, .format = routes[r].format, .burst = 8 },
+            .step_ms = 100
+        };
+        midi_loopback_report_t rep;
+        midi_router_set_route(routes[r].in->id, routes[r].out->id, true);
+        midi_loopback_measure(routes[r].in, routes[r].out, &load, &rep);
+        midi_router_set_route(routes[r].in->id, routes[r].out->id, false);
+        vTaskDelay(pdMS_TO_TICKS(20));
+        
+        ESP_LOGI(TAG, "  %s -> %s: %lu msg/s sustained (fails at %lu, %lu lost), "
+                 "p50 %lu / p90 %lu / p99 %lu / max %lu us",
+                 routes[r].in->ops.name, routes[r].out->ops.name,
+                 (unsigned long)rep.sustained_rate_hz, (unsigned long)rep.failing_rate_hz,
+                 (unsigned long)rep.lost, (unsigned long)rep.p50_us, (unsigned long)rep.p90_us,
+                 (unsigned long)rep.p99_us, (unsigned long)rep.max_us);
+        if (rep.sustained_rate_hz >= 1000 && rep.delivered > 0 &&
+            rep.p50_us <= rep.p99_us && rep.p99_us <= rep.max_us) {
+            routes_ok++;
+        }
+    }
+    
+    midi_loopback_destroy(&s_lb_ump_out);
+    midi_loopback_destroy(&s_lb_midi1_out);
+    midi_loopback_destroy(&s_lb_ump_in);
+    midi_loopback_destroy(&s_lb_midi1_in);
+    midi_router_deinit();
+    
+    if (patterns_ok == 8) {
+        ESP_LOGI(TAG, "✓ Notes, CC sweep, clock and SysEx delivered in both formats");
+    } else {
+        ESP_LOGE(TAG, "✗ Only %d/8 pattern runs delivered!", patterns_ok);
+    }
+    if (stamped) {
+        ESP_LOGI(TAG, "✓ Paced injection captured with timestamps");
+    } else {
+        ESP_LOGE(TAG, "✗ Pacing or capture wrong (%lu captured in %lu us)!",
+                 (unsigned long)s_lb_midi1_out.captured, (unsigned long)paced_res.elapsed_us);
+    }
+    if (routes_ok == 4) {
+        ESP_LOGI(TAG, "✓ All 4 routes sustain at least 1000 msg/s");
+    } else {
+        ESP_LOGE(TAG, "✗ Only %d/4 routes sustained 1000 msg/s!", routes_ok);
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+static midi_loopback_t s_as_din_out, s_as_net_out;
+static midi_loopback_record_t s_as_records[32];
+
+/**
+ * @brief Send a MIDI 1.0 channel message from the USB port
+ */
+static void test_as_send(uint8_t status, uint8_t d1, uint8_t d2) {
+    midi_router_packet_t pkt = { .source = MIDI_TRANSPORT_USB, .format = MIDI_FORMAT_1_0 };
+    pkt.data.midi1 = (midi_message_t){
+        .type = MIDI_MSG_TYPE_CHANNEL, .status = status, .channel = status & 0x0F,
+        .data.bytes = { d1, d2 }
+    };
+    midi_router_send(&pkt);
+}
+
+/**
+ * @brief Count the Active Sensing bytes the DIN stand-in captured
+ */
+static uint32_t test_as_count(void) {
+    uint32_t n = s_as_din_out.captured < 32 ? s_as_din_out.captured : 32;
+    uint32_t sensed = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        sensed += (s_as_records[i].word0 >> 16) == MIDI_STATUS_ACTIVE_SENSING;
+    }
+    return sensed;
+}
+
+/**
+ * @brief Test 20: Active Sensing - Timeout Detection and Idle Generation
+ */
+void test_active_sensing(void) {
+    ESP_LOGI(TAG, "=== Test 20: Active Sensing ===");
+    
+    // Parser: silence only counts once the sender has used 0xFE
+    midi_parser_state_t parser;
+    midi_message_t msg;
+    bool complete;
+    midi_parser_init(&parser, NULL, 0);
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    bool unarmed = !midi_parser_check_active_sensing_timeout(&parser, now + 1000000);
+    
+    midi_parser_parse_byte(&parser, MIDI_STATUS_ACTIVE_SENSING, &msg, &complete);
+    bool armed = complete && msg.status == MIDI_STATUS_ACTIVE_SENSING && parser.active_sensing;
+    const uint8_t note[] = { 0x90, 60, 100 };
+    for (int i = 0; i < 3; i++) {
+        midi_parser_parse_byte(&parser, note[i], &msg, &complete);
+    }
+    uint32_t last = parser.last_rx_us;
+    bool parser_ok = unarmed && armed && complete && msg.status == 0x90 &&
+                     !midi_parser_check_active_sensing_timeout(&parser, last + 290000) &&
+                     midi_parser_check_active_sensing_timeout(&parser, last + 310000) &&
+                     !midi_parser_check_active_sensing_timeout(&parser, last + 900000);
+    
+    // Router: DIN stand-in senses, network stand-in stays quiet
+    static midi_router_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.auto_translate = true;
+    for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+        cfg.dest_policies[t] = MIDI_DEST_POLICY_DEFAULT();
+    }
+    cfg.dest_policies[MIDI_TRANSPORT_UART].active_sensing = true;
+    cfg.routing_matrix[MIDI_TRANSPORT_USB][MIDI_TRANSPORT_UART] = true;
+    cfg.routing_matrix[MIDI_TRANSPORT_USB][MIDI_TRANSPORT_WIFI] = true;
+    midi_router_deinit();
+    if (midi_router_init(&cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "✗ Router init failed!");
+        return;
+    }
+    bool created =
+        midi_loopback_create(&s_as_din_out, &(midi_loopback_config_t){
+            .name = "Loop DIN", .native_format = MIDI_FORMAT_1_0,
+            .transport = MIDI_TRANSPORT_UART,
+            .records = s_as_records, .record_capacity = 32 }) == ESP_OK &&
+        midi_loopback_create(&s_as_net_out, &(midi_loopback_config_t){
+            .name = "Loop WiFi", .native_format = MIDI_FORMAT_2_0,
+            .transport = MIDI_TRANSPORT_WIFI }) == ESP_OK;
+    if (!created) {
+        ESP_LOGE(TAG, "✗ Loopback ports not registered!");
+        midi_router_deinit();
+        return;
+    }
+    
+    // Idle: one 0xFE per interval on the DIN output only
+    midi_loopback_reset(&s_as_din_out);
+    midi_loopback_reset(&s_as_net_out);
+    midi_router_reset_stats();
+    vTaskDelay(pdMS_TO_TICKS(MIDI_ROUTER_ACTIVE_SENSING_MS * 5 / 2));
+    uint32_t idle_sensed = test_as_count();
+    midi_router_stats_t stats;
+    midi_router_get_stats(&stats);
+    bool idle_ok = idle_sensed >= 2 && idle_sensed <= 3 &&
+                   s_as_din_out.captured == idle_sensed && s_as_net_out.captured == 0 &&
+                   stats.active_sensing_sent[MIDI_TRANSPORT_UART] == idle_sensed &&
+                   stats.active_sensing_sent[MIDI_TRANSPORT_WIFI] == 0;
+    
+    // Traffic: anything sent within the interval replaces Active Sensing
+    test_as_send(0x90, 60, 100);
+    midi_loopback_wait(&s_as_din_out, idle_sensed + 1, 100);
+    midi_loopback_reset(&s_as_din_out);
+    for (int i = 0; i < 5; i++) {
+        vTaskDelay(pdMS_TO_TICKS(MIDI_ROUTER_ACTIVE_SENSING_MS / 2));
+        test_as_send(0xB0, 7, 100 - i);
+    }
+    midi_loopback_wait(&s_as_din_out, 5, 100);
+    uint32_t busy_sensed = test_as_count();
+    bool busy_ok = busy_sensed == 0 && s_as_din_out.received[MIDI_TRANSPORT_USB] == 5;
+    
+    // Sender went silent: the timeout releases its note on every output
+    midi_parser_parse_byte(&parser, MIDI_STATUS_ACTIVE_SENSING, &msg, &complete);
+    midi_loopback_reset(&s_as_din_out);
+    midi_loopback_reset(&s_as_net_out);
+    bool released = false;
+    if (midi_parser_check_active_sensing_timeout(&parser, parser.last_rx_us + 310000)) {
+        midi_router_source_lost(MIDI_TRANSPORT_USB);
+        released = midi_loopback_wait(&s_as_net_out, 1, 100) &&
+                   midi_loopback_wait(&s_as_din_out, 1, 100);
+    }
+    released &= s_as_din_out.received[MIDI_TRANSPORT_USB] == 1 &&
+                (s_as_records[0].word0 >> 8) == ((MIDI_STATUS_NOTE_OFF << 8) | 60);
+    
+    midi_loopback_destroy(&s_as_net_out);
+    midi_loopback_destroy(&s_as_din_out);
+    midi_router_deinit();
+    
+    if (parser_ok) {
+        ESP_LOGI(TAG, "✓ Parser times out 300 ms after the last byte, once armed by 0xFE");
+    } else {
+        ESP_LOGE(TAG, "✗ Parser timeout wrong (unarmed=%d armed=%d)!", unarmed, armed);
+    }
+    if (idle_ok && busy_ok) {
+        ESP_LOGI(TAG, "✓ Idle DIN output sensed %lu times, none while busy or on WiFi",
+                 (unsigned long)idle_sensed);
+    } else {
+        ESP_LOGE(TAG, "✗ Generator wrong (idle %lu, busy %lu, WiFi got %lu)!",
+                 (unsigned long)idle_sensed, (unsigned long)busy_sensed,
+                 (unsigned long)stats.active_sensing_sent[MIDI_TRANSPORT_WIFI]);
+    }
+    if (released) {
+        ESP_LOGI(TAG, "✓ Timeout released the silent sender's note");
+    } else {
+        ESP_LOGE(TAG, "✗ Note not released after the timeout!");
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+static midi_loopback_t s_ep_peer, s_ep_other;
+static midi_loopback_record_t s_ep_records[16];
+
+/**
+ * @brief Send a UMP Stream message from the WiFi peer
+ */
+static void test_ep_send(uint32_t word0, uint32_t word1) {
+    midi_router_packet_t pkt = { .source = MIDI_TRANSPORT_WIFI, .format = MIDI_FORMAT_2_0 };
+    pkt.data.ump = (ump_packet_t){
+        .words = { word0, word1, 0, 0 }, .num_words = 4,
+        .message_type = UMP_MT_UMP_STREAM, .group = 0xFF
+    };
+    midi_router_send(&pkt);
+}
+
+/**
+ * @brief Whether the peer got exactly these stream statuses, in order
+ */
+static bool test_ep_replies(const uint16_t *statuses, uint32_t count) {
+    midi_loopback_wait(&s_ep_peer, count, 100);
+    if (s_ep_peer.captured != count) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if ((s_ep_records[i].word0 >> 16) != (0xF000u | statuses[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Test 21: UMP Endpoint Discovery and Protocol Negotiation
+ */
+void test_endpoint_discovery(void) {
+    ESP_LOGI(TAG, "=== Test 21: UMP Endpoint Discovery ===");
+    
+    static midi_router_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.auto_translate = true;
+    for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+        cfg.dest_policies[t] = MIDI_DEST_POLICY_DEFAULT();
+    }
+    cfg.routing_matrix[MIDI_TRANSPORT_WIFI][MIDI_TRANSPORT_ETHERNET] = true;
+    midi_router_deinit();
+    if (midi_router_init(&cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "✗ Router init failed!");
+        return;
+    }
+    bool created =
+        midi_loopback_create(&s_ep_peer, &(midi_loopback_config_t){
+            .name = "Loop WiFi", .native_format = MIDI_FORMAT_2_0,
+            .transport = MIDI_TRANSPORT_WIFI,
+            .records = s_ep_records, .record_capacity = 16 }) == ESP_OK &&
+        midi_loopback_create(&s_ep_other, &(midi_loopback_config_t){
+            .name = "Loop Ethernet", .native_format = MIDI_FORMAT_2_0,
+            .transport = MIDI_TRANSPORT_ETHERNET }) == ESP_OK;
+    if (!created) {
+        ESP_LOGE(TAG, "✗ Loopback ports not registered!");
+        midi_router_deinit();
+        return;
+    }
+    
+    // Peer asks: every reply goes back to it, nothing is routed on
+    const uint16_t endpoint_replies[] = {
+        UMP_STREAM_ENDPOINT_INFO, UMP_STREAM_DEVICE_IDENTITY,
+        UMP_STREAM_ENDPOINT_NAME, UMP_STREAM_CONFIGURATION_NOTIFY
+    };
+    midi_loopback_reset(&s_ep_peer);
+    test_ep_send(0xF0000000u | (UMP_VERSION_MAJOR << 8) | UMP_VERSION_MINOR, UMP_DISCOVER_ALL);
+    bool endpoint_ok = test_ep_replies(endpoint_replies, 4) &&
+                       (s_ep_records[0].word0 & 0xFFFF) == ((UMP_VERSION_MAJOR << 8) | UMP_VERSION_MINOR) &&
+                       ((s_ep_records[3].word0 >> 8) & 0xFF) == UMP_STREAM_PROTOCOL_MIDI2;
+    
+    const uint16_t block_replies[] = {
+        UMP_STREAM_FUNCTION_BLOCK_INFO, UMP_STREAM_FUNCTION_BLOCK_NAME
+    };
+    midi_loopback_reset(&s_ep_peer);
+    test_ep_send(0xF0100000u | (UMP_FB_ALL << 8) | UMP_FB_DISCOVER_INFO | UMP_FB_DISCOVER_NAME, 0);
+    bool blocks_ok = test_ep_replies(block_replies, 2) &&
+                     (s_ep_records[0].word0 & 0x8003) == (0x8000 | UMP_FB_DIR_BIDIRECTIONAL);
+    
+    // Peer configures the link: MIDI 1.0 protocol, confirmed by a notification
+    const uint16_t notify_reply[] = { UMP_STREAM_CONFIGURATION_NOTIFY };
+    midi_loopback_reset(&s_ep_peer);
+    test_ep_send(0xF0050000u | (UMP_STREAM_PROTOCOL_MIDI1 << 8), 0);
+    midi_transport_info_t info;
+    bool request_ok = test_ep_replies(notify_reply, 1) &&
+                      ((s_ep_records[0].word0 >> 8) & 0xFF) == UMP_STREAM_PROTOCOL_MIDI1 &&
+                      midi_router_get_transport_info(MIDI_TRANSPORT_WIFI, &info) == ESP_OK &&
+                      info.ump_link.negotiated &&
+                      info.ump_link.protocol == UMP_STREAM_PROTOCOL_MIDI1;
+    
+    // Router asks a MIDI 1.0-only peer, then requests the one protocol in common
+    const uint16_t discovery[] = { UMP_STREAM_ENDPOINT_DISCOVERY };
+    const uint16_t config_request[] = { UMP_STREAM_CONFIGURATION_REQUEST };
+    midi_loopback_destroy(&s_ep_peer);
+    midi_loopback_create(&s_ep_peer, &(midi_loopback_config_t){
+        .name = "Loop WiFi", .native_format = MIDI_FORMAT_2_0,
+        .transport = MIDI_TRANSPORT_WIFI,
+        .records = s_ep_records, .record_capacity = 16 });
+    midi_router_get_transport_info(MIDI_TRANSPORT_WIFI, &info);
+    bool fresh = !info.ump_link.negotiated && info.ump_link.protocol == UMP_STREAM_PROTOCOL_MIDI2;
+    midi_loopback_reset(&s_ep_peer);
+    midi_router_discover_endpoint(MIDI_TRANSPORT_WIFI);
+    bool asked = test_ep_replies(discovery, 1);
+    midi_loopback_reset(&s_ep_peer);
+    test_ep_send(0xF0010000u | (UMP_VERSION_MAJOR << 8) | UMP_VERSION_MINOR, 0x100);
+    bool requested = test_ep_replies(config_request, 1) &&
+                     ((s_ep_records[0].word0 >> 8) & 0xFF) == UMP_STREAM_PROTOCOL_MIDI1;
+    test_ep_send(0xF0060000u | (UMP_STREAM_PROTOCOL_MIDI1 << 8), 0);
+    vTaskDelay(pdMS_TO_TICKS(20));
+    midi_router_get_transport_info(MIDI_TRANSPORT_WIFI, &info);
+    bool discover_ok = fresh && asked && requested && info.ump_link.peer_known &&
+                       info.ump_link.negotiated &&
+                       info.ump_link.protocol == UMP_STREAM_PROTOCOL_MIDI1 &&
+                       !info.ump_link.peer.midi2_protocol;
+    
+    // Clip markers are content, not negotiation: they route as usual
+    midi_loopback_reset(&s_ep_peer);
+    midi_loopback_reset(&s_ep_other);
+    test_ep_send(0xF0200000u, 0);
+    bool routed = midi_loopback_wait(&s_ep_other, 1, 100) && s_ep_peer.captured == 0 &&
+                  s_ep_other.received[MIDI_TRANSPORT_WIFI] == 1;
+    
+    midi_loopback_destroy(&s_ep_other);
+    midi_loopback_destroy(&s_ep_peer);
+    midi_router_deinit();
+    
+    if (endpoint_ok && blocks_ok) {
+        ESP_LOGI(TAG, "✓ Endpoint and function block discovery answered on the asking link");
+    } else {
+        ESP_LOGE(TAG, "✗ Discovery replies wrong (endpoint=%d blocks=%d)!", endpoint_ok, blocks_ok);
+    }
+    if (request_ok && discover_ok) {
+        ESP_LOGI(TAG, "✓ Link negotiated MIDI 1.0 protocol from either side");
+    } else {
+        ESP_LOGE(TAG, "✗ Negotiation failed (request=%d fresh=%d asked=%d requested=%d)!",
+                 request_ok, fresh, asked, requested);
+    }
+    if (routed) {
+        ESP_LOGI(TAG, "✓ Start of Clip routed, not consumed");
+    } else {
+        ESP_LOGE(TAG, "✗ Start of Clip not routed!");
+    }
+}
+
+static midi_loopback_t s_lp_ump_out, s_lp_din_out;
+static midi_loopback_record_t s_lp_ump_records[8], s_lp_din_records[8];
+
+/**
+ * @brief Send one message from a source and return word 0 as a loopback got it
+ */
+static uint32_t test_lp_route(const midi_router_packet_t *pkt, midi_loopback_t *out,
+                              const midi_loopback_record_t *records) {
+    midi_loopback_reset(out);
+    midi_router_send(pkt);
+    return midi_loopback_wait(out, 1, 100) ? records[0].word0 : 0;
+}
+
+/**
+ * @brief Test 22: Per-Link Protocol Drives Translation (MT 0x2 vs MT 0x4)
+ */
+void test_link_protocol(void) {
+    ESP_LOGI(TAG, "=== Test 22: Per-Link Protocol Translation ===");
+    
+    // Value scaling: the ends and center are exact
+    bool scale_ok = midi_upscale_7to32(0) == 0 && midi_upscale_7to32(64) == 0x80000000u &&
+                    midi_upscale_7to32(127) == 0xFFFFFFFFu &&
+                    midi_downscale_32to7(midi_upscale_7to32(100)) == 100;
+    
+    static midi_router_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.auto_translate = true;
+    for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+        cfg.dest_policies[t] = MIDI_DEST_POLICY_DEFAULT();
+    }
+    cfg.routing_matrix[MIDI_TRANSPORT_USB][MIDI_TRANSPORT_WIFI] = true;
+    cfg.routing_matrix[MIDI_TRANSPORT_ETHERNET][MIDI_TRANSPORT_WIFI] = true;
+    cfg.routing_matrix[MIDI_TRANSPORT_ETHERNET][MIDI_TRANSPORT_UART] = true;
+    midi_router_deinit();
+    if (midi_router_init(&cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "✗ Router init failed!");
+        return;
+    }
+    bool created =
+        midi_loopback_create(&s_lp_ump_out, &(midi_loopback_config_t){
+            .name = "Loop WiFi", .native_format = MIDI_FORMAT_2_0,
+            .transport = MIDI_TRANSPORT_WIFI,
+            .records = s_lp_ump_records, .record_capacity = 8 }) == ESP_OK &&
+        midi_loopback_create(&s_lp_din_out, &(midi_loopback_config_t){
+            .name = "Loop DIN", .native_format = MIDI_FORMAT_1_0,
+            .transport = MIDI_TRANSPORT_UART,
+            .records = s_lp_din_records, .record_capacity = 8 }) == ESP_OK;
+    if (!created) {
+        ESP_LOGE(TAG, "✗ Loopback ports not registered!");
+        midi_router_deinit();
+        return;
+    }
+    
+    midi_router_packet_t cc = { .source = MIDI_TRANSPORT_USB, .format = MIDI_FORMAT_1_0 };
+    cc.data.midi1 = (midi_message_t){
+        .type = MIDI_MSG_TYPE_CHANNEL, .status = 0xB2, .channel = 2, .data.bytes = { 7, 100 }
+    };
+    midi_router_packet_t note = { .source = MIDI_TRANSPORT_ETHERNET, .format = MIDI_FORMAT_2_0 };
+    note.data.ump = (ump_packet_t){
+        .words = { 0x41913C00, 0xFFFF0000 }, .num_words = 2,
+        .message_type = UMP_MT_MIDI2_CHANNEL_VOICE, .group = 1
+    };
+    midi_router_packet_t bend = { .source = MIDI_TRANSPORT_ETHERNET, .format = MIDI_FORMAT_2_0 };
+    bend.data.ump = (ump_packet_t){
+        .words = { 0x20E10040 }, .num_words = 1,
+        .message_type = UMP_MT_MIDI1_CHANNEL_VOICE, .group = 0
+    };
+    
+    // Default (MIDI 2.0 Protocol): upscale to MT 0x4, MT 0x2 included
+    midi_router_reset_stats();
+    uint32_t cc_mt4 = test_lp_route(&cc, &s_lp_ump_out, s_lp_ump_records);
+    uint32_t bend_mt4 = test_lp_route(&bend, &s_lp_ump_out, s_lp_ump_records);
+    midi_router_stats_t stats;
+    midi_router_get_stats(&stats);
+    bool midi2_ok = cc_mt4 == 0x40B20700 && bend_mt4 == 0x40E10000 &&
+                    stats.translations_1to2 == 2 && stats.translations_1to1 == 0;
+    
+    // Peer configures MIDI 1.0 Protocol: wrap as MT 0x2, downscale MT 0x4
+    midi_router_packet_t request = { .source = MIDI_TRANSPORT_WIFI, .format = MIDI_FORMAT_2_0 };
+    request.data.ump = (ump_packet_t){
+        .words = { 0xF0050000u | (UMP_STREAM_PROTOCOL_MIDI1 << 8) }, .num_words = 4,
+        .message_type = UMP_MT_UMP_STREAM, .group = 0xFF
+    };
+    test_lp_route(&request, &s_lp_ump_out, s_lp_ump_records);
+    midi_router_reset_stats();
+    uint32_t cc_mt2 = test_lp_route(&cc, &s_lp_ump_out, s_lp_ump_records);
+    midi_loopback_reset(&s_lp_din_out);
+    uint32_t note_mt2 = test_lp_route(&note, &s_lp_ump_out, s_lp_ump_records);
+    uint32_t note_din = midi_loopback_wait(&s_lp_din_out, 1, 100) ? s_lp_din_records[0].word0 : 0;
+    uint32_t bend_pass = test_lp_route(&bend, &s_lp_ump_out, s_lp_ump_records);
+    midi_router_get_stats(&stats);
+    bool midi1_ok = cc_mt2 == 0x20B20764 && note_mt2 == 0x21913C7F && bend_pass == 0x20E10040 &&
+                    stats.translations_1to1 == 1 && stats.translations_1to2 == 0;
+    
+    // The DIN output got the MT 0x4 note as bytes; the driver can switch back to 2.0
+    midi_router_set_transport_protocol(MIDI_TRANSPORT_WIFI, UMP_STREAM_PROTOCOL_MIDI2);
+    uint32_t cc_again = test_lp_route(&cc, &s_lp_ump_out, s_lp_ump_records);
+    bool driver_ok = note_din == 0x00913C7F && cc_again == 0x40B20700;
+    
+    midi_loopback_destroy(&s_lp_din_out);
+    midi_loopback_destroy(&s_lp_ump_out);
+    midi_router_deinit();
+    
+    if (scale_ok) {
+        ESP_LOGI(TAG, "✓ 7-bit to 32-bit scaling keeps 0, center and max");
+    } else {
+        ESP_LOGE(TAG, "✗ 7-bit to 32-bit scaling wrong!");
+    }
+    if (midi2_ok) {
+        ESP_LOGI(TAG, "✓ MIDI 2.0 Protocol link gets MT 0x4 (CC %08lX)", (unsigned long)cc_mt4);
+    } else {
+        ESP_LOGE(TAG, "✗ MIDI 2.0 link got CC %08lX, bend %08lX!",
+                 (unsigned long)cc_mt4, (unsigned long)bend_mt4);
+    }
+    if (midi1_ok) {
+        ESP_LOGI(TAG, "✓ MIDI 1.0 Protocol link gets 32-bit MT 0x2 (CC %08lX)", (unsigned long)cc_mt2);
+    } else {
+        ESP_LOGE(TAG, "✗ MIDI 1.0 link got CC %08lX, note %08lX, bend %08lX!",
+                 (unsigned long)cc_mt2, (unsigned long)note_mt2, (unsigned long)bend_pass);
+    }
+    if (driver_ok) {
+        ESP_LOGI(TAG, "✓ DIN gets MIDI 1.0 bytes; driver-set protocol applies");
+    } else {
+        ESP_LOGE(TAG, "✗ DIN note %08lX, CC after driver switch %08lX!",
+                 (unsigned long)note_din, (unsigned long)cc_again);
+    }
+}
+
+// Two bridged cubes, sessions held in memory: our WiFi and Ethernet
+// engines (0, 1) talk to a peer cube's (2, 3), which forwards everything
+// from one of its sessions to the other, one hop further
+typedef struct {
+    uint8_t to, from;
+    uint8_t len;
+    uint8_t data[64];
+} test_hop_dgram_t;
+
+typedef struct {
+    uint8_t node;
+    uint8_t hops;
+    uint32_t seq;
+    ump_packet_t ump;
+} test_hop_rx_t;
+
+typedef struct {
+    uint8_t node;                 // Our engine the router sent to
+    midi_router_packet_t packet;
+} test_hop_tx_t;
+
+static midi_net_t s_hop_net[4];
+static midi_net_peer_t s_hop_peers[4][1];
+static test_hop_dgram_t s_hop_dgrams[16];
+static test_hop_rx_t s_hop_rx[16];
+static uint8_t s_hop_dgram_count, s_hop_rx_count;
+static QueueHandle_t s_hop_wire;
+static volatile int s_hop_forwarded;
+
+static esp_err_t test_hop_dgram_send(const midi_net_addr_t *to, const uint8_t *data, size_t len,
+                                     void *ctx) {
+    if (s_hop_dgram_count == 16 || len > sizeof(s_hop_dgrams[0].data)) {
+        return ESP_FAIL;
+    }
+    test_hop_dgram_t *d = &s_hop_dgrams[s_hop_dgram_count++];
+    d->to = (uint8_t)(to->ip - 1);
+    d->from = (uint8_t)(intptr_t)ctx;
+    d->len = (uint8_t)len;
+    memcpy(d->data, data, len);
+    return ESP_OK;
+}
+
+static void test_hop_ump(const midi_net_peer_t *peer, const ump_packet_t *ump, void *ctx) {
+    if (s_hop_rx_count < 16) {
+        s_hop_rx[s_hop_rx_count++] = (test_hop_rx_t){
+            .node = (uint8_t)(intptr_t)ctx, .hops = peer->last_rx_hops,
+            .seq = peer->last_rx_seq, .ump = *ump
+        };
+    }
+}
+
+static void test_hop_pump(int64_t now_us) {
+    while (s_hop_dgram_count) {
+        test_hop_dgram_t d = s_hop_dgrams[0];
+        memmove(&s_hop_dgrams[0], &s_hop_dgrams[1], --s_hop_dgram_count * sizeof(d));
+        midi_net_addr_t from = { .ip = d.from + 1, .port = MIDI_NET_DEFAULT_PORT };
+        midi_net_receive(&s_hop_net[d.to], &from, d.data, d.len, now_us);
+    }
+}
+
+static esp_err_t test_hop_net_send(void *ctx, const midi_router_packet_t *packet) {
+    test_hop_tx_t tx = { .node = (uint8_t)(intptr_t)ctx, .packet = *packet };
+    s_hop_forwarded++;
+    xQueueSend(s_hop_wire, &tx, 0);
+    return ESP_OK;
+}
+
+static const midi_transport_ops_t s_test_hop_wifi = {
+    .name = "WiFi",
+    .native_format = MIDI_FORMAT_2_0,
+    .flags = MIDI_TRANSPORT_FLAG_NETWORK,
+    .send = test_hop_net_send
+};
+
+static const midi_transport_ops_t s_test_hop_eth = {
+    .name = "Ethernet",
+    .native_format = MIDI_FORMAT_2_0,
+    .flags = MIDI_TRANSPORT_FLAG_NETWORK,
+    .send = test_hop_net_send
+};
+
+/**
+ * @brief Test 23: Router - Realtime Loop between Bridged Cubes Ends
+ */
+void test_router_hop_limit(void) {
+    ESP_LOGI(TAG, "=== Test 23: Router - Hop Limit Ends a Realtime Loop ===");
+    
+    int64_t now = 1000000;
+    s_hop_dgram_count = s_hop_rx_count = 0;
+    for (int i = 0; i < 4; i++) {
+        midi_net_config_t net_cfg = {
+            .name = i < 2 ? "MIDI-Cube" : "Peer Cube", .accept_invitations = i >= 2,
+            .fec_depth = 2, .send = test_hop_dgram_send, .on_ump = test_hop_ump,
+            .ctx = (void *)(intptr_t)i
+        };
+        midi_net_init(&s_hop_net[i], &net_cfg, s_hop_peers[i], 1);
+    }
+    for (int i = 0; i < 2; i++) {
+        midi_net_addr_t peer = { .ip = i + 3, .port = MIDI_NET_DEFAULT_PORT };
+        midi_net_invite(&s_hop_net[i], &peer, now);
+    }
+    test_hop_pump(now);
+    
+    static midi_router_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.routing_matrix[MIDI_TRANSPORT_WIFI][MIDI_TRANSPORT_ETHERNET] = true;
+    cfg.routing_matrix[MIDI_TRANSPORT_ETHERNET][MIDI_TRANSPORT_WIFI] = true;
+    cfg.auto_translate = false;
+    for (int t = 0; t < MIDI_TRANSPORT_COUNT; t++) {
+        cfg.dest_policies[t] = MIDI_DEST_POLICY_DEFAULT();
+    }
+    
+    midi_router_deinit();
+    s_hop_wire = xQueueCreate(8, sizeof(test_hop_tx_t));
+    if (!s_hop_wire || midi_router_init(&cfg) != ESP_OK ||
+        midi_net_num_sessions(&s_hop_net[0]) != 1 || midi_net_num_sessions(&s_hop_net[1]) != 1) {
+        ESP_LOGE(TAG, "✗ Router or sessions not up!");
+        if (s_hop_wire) {
+            vQueueDelete(s_hop_wire);
+        }
+        return;
+    }
+    midi_router_attach_transport(MIDI_TRANSPORT_WIFI, &s_test_hop_wifi, (void *)0);
+    midi_router_attach_transport(MIDI_TRANSPORT_ETHERNET, &s_test_hop_eth, (void *)1);
+    midi_router_reset_stats();
+    s_hop_forwarded = 0;
+    
+    // A clock tick from a standard host on WiFi (no marker); realtime
+    // repeats by design, so only the hop count can stop it
+    midi_router_packet_t pkt = {
+        .source = MIDI_TRANSPORT_WIFI, .format = MIDI_FORMAT_2_0,
+        .data.ump = { .words = { 0x10F80000 }, .num_words = 1, .message_type = UMP_MT_SYSTEM }
+    };
+    midi_router_send(&pkt);
+    
+    test_hop_tx_t tx;
+    while (xQueueReceive(s_hop_wire, &tx, pdMS_TO_TICKS(50)) == pdTRUE && s_hop_forwarded < 100) {
+        // Our driver: the packet's hops go out as a marker
+        midi_net_send_ump_hops(&s_hop_net[tx.node], tx.packet.data.ump.words,
+                               tx.packet.data.ump.num_words, tx.packet.hops, now);
+        test_hop_pump(now);
+        while (s_hop_rx_count) {
+            test_hop_rx_t rx = s_hop_rx[0];
+            memmove(&s_hop_rx[0], &s_hop_rx[1], --s_hop_rx_count * sizeof(rx));
+            if (rx.node >= 2) {
+                // Peer cube's router: out of its other session, one hop further
+                midi_net_send_ump_hops(&s_hop_net[rx.node ^ 1], rx.ump.words, rx.ump.num_words,
+                                       rx.hops + 1, now);
+                test_hop_pump(now);
+            } else {
+                // Our driver: the marker comes back as the packet's hops
+                midi_router_packet_t in = {
+                    .source = rx.node ? MIDI_TRANSPORT_ETHERNET : MIDI_TRANSPORT_WIFI,
+                    .destination = 0xFF, .format = MIDI_FORMAT_2_0,
+                    .hops = rx.hops, .seq = rx.seq, .data.ump = rx.ump
+                };
+                midi_router_send(&in);
+            }
+        }
+    }
+    
+    midi_router_stats_t stats;
+    midi_router_get_stats(&stats);
+    
+    midi_router_attach_transport(MIDI_TRANSPORT_WIFI, NULL, NULL);
+    midi_router_attach_transport(MIDI_TRANSPORT_ETHERNET, NULL, NULL);
+    midi_router_deinit();
+    vQueueDelete(s_hop_wire);
+    
+    uint32_t loops = stats.loops_dropped[MIDI_TRANSPORT_WIFI] +
+                     stats.loops_dropped[MIDI_TRANSPORT_ETHERNET];
+    ESP_LOGI(TAG, "  Forwarded %d times, loops dropped: %lu", s_hop_forwarded,
+             (unsigned long)loops);
+    if (s_hop_forwarded > 0 && s_hop_forwarded <= CONFIG_MIDI_ROUTER_MAX_HOPS && loops == 1) {
+        ESP_LOGI(TAG, "✓ Looped clock dropped at the hop limit");
+    } else {
+        ESP_LOGE(TAG, "✗ Realtime loop not ended!");
+    }
+    
+    ESP_LOGI(TAG, "");
+}
+
+/**
+ * @brief Run all MIDI router tests
+ * 
+ * Call this from main() to run test suite
+ */
+void midi_router_run_tests(void) {
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "====================================");
+    ESP_LOGI(TAG, "  MIDI Router Component Test Suite");
+    ESP_LOGI(TAG, "====================================");
+    ESP_LOGI(TAG, "");
+    
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    
+    test_msg_classification();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_rules_midi1();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_rules_ump();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_rules_performance();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_coalescer_thinning();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_note_tracker_release();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_router_overload_policy();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_loop_guard();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_router_echo_suppression();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_priority_classes();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_router_priority_scheduling();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_router_stream_order();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_router_worker_scaling();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_router_stats_shards();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_router_config_persistence();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_router_live_reconfig();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_router_presets();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_router_dynamic_transport();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_loopback_load();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_active_sensing();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_endpoint_discovery();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_link_protocol();
+    vTaskDelay(pdMS_TO_TICKS(500));
+    
+    test_router_hop_limit();
+    
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "====================================");
+    ESP_LOGI(TAG, "  All Tests Complete!");
+    ESP_LOGI(TAG, "====================================");
+    ESP_LOGI(TAG, "");
+}
@@ -0,0 +1,14 @@
+/**
+ * @file test_midi_router.h
+ * @brief MIDI Router Test Suite Header
+ */
+
+#ifndef TEST_MIDI_ROUTER_H
+#define TEST_MIDI_ROUTER_H
+
+/**
+ * @brief Run all MIDI router component tests
+ */
+void midi_router_run_tests(void);
+
+#endif /* TEST_MIDI_ROUTER_H */
@@ -0,0 +1,14 @@
+/**
+ * @file test_midi_smf.h
+ * @brief MIDI SMF Test Suite Header
+ */
+
+#ifndef TEST_MIDI_SMF_H
+#define TEST_MIDI_SMF_H
+
+/**
+ * @brief Run all MIDI SMF component tests
+ */
+void midi_smf_run_tests(void);
+
+#endif /* TEST_MIDI_SMF_H */